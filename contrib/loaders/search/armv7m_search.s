@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ ***************************************************************************/
+
+/*
+	Find the first occurrence of a byte pattern in a memory range.
+
+	parameters:
+	r0 - range start (in), match address (out)
+	r1 - range size in bytes (in), 1 if found, 0 otherwise (out)
+	r2 - pattern
+	r3 - pattern size in bytes, at least 1
+*/
+
+	.text
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+	.thumb_func
+
+	.align	2
+
+start:
+	cmp	r1, r3
+	blo	not_found
+	subs	r1, r1, r3
+	adds	r1, r1, r0	/* last address a match can start at */
+	ldrb	r4, [r2]	/* first pattern byte */
+
+byte_loop:
+	cmp	r0, r1
+	bhi	not_found
+	ldrb	r5, [r0]
+	cmp	r5, r4
+	bne	next
+
+	movs	r6, #1
+compare:
+	cmp	r6, r3
+	beq	found
+	ldrb	r5, [r0, r6]
+	ldrb	r7, [r2, r6]
+	cmp	r5, r7
+	bne	next
+	adds	r6, #1
+	b	compare
+
+next:
+	adds	r0, #1
+	b	byte_loop
+
+found:
+	movs	r1, #1
+	b	done
+
+not_found:
+	movs	r1, #0
+
+/* Avoid padding at .text segment end. Otherwise exit point check fails. */
+	.skip	( . - start + 2) & 2, 0
+
+done:
+	bkpt	#0
+
+	.end
@@ -291,6 +291,45 @@ static void cleanup_all_fds(void)
 	cleanup_fd(srst_fd, srst_gpio);
 }
 
+/*
+ * Scan vector: TMS, TDI and capture bitmaps of the given number of clocks,
+ * answered with the TDO values of the captured clocks, packed.
+ */
+static int process_vector(void)
+{
+	static unsigned char tms[8192], tdi[8192], capture[8192], tdo[8192];
+	unsigned char header[2];
+
+	if (fread(header, sizeof(header), 1, stdin) != 1)
+		return ERROR_FAIL;
+	unsigned bits = header[0] | (header[1] << 8);
+	size_t bytes = (bits + 7) / 8;
+	if (fread(tms, bytes, 1, stdin) != 1 ||
+			fread(tdi, bytes, 1, stdin) != 1 ||
+			fread(capture, bytes, 1, stdin) != 1)
+		return ERROR_FAIL;
+
+	unsigned captures = 0;
+	int bit_tms = 0, bit_tdi = 0;
+	memset(tdo, 0, bytes);
+	for (unsigned i = 0; i < bits; i++) {
+		bit_tms = (tms[i / 8] >> (i % 8)) & 1;
+		bit_tdi = (tdi[i / 8] >> (i % 8)) & 1;
+		sysfsgpio_write(0, bit_tms, bit_tdi);
+		if ((capture[i / 8] >> (i % 8)) & 1) {
+			if (sysfsgpio_read() == '1')
+				tdo[captures / 8] |= 1 << (captures % 8);
+			captures++;
+		}
+		sysfsgpio_write(1, bit_tms, bit_tdi);
+	}
+	sysfsgpio_write(0, bit_tms, bit_tdi);
+
+	if (captures && fwrite(tdo, (captures + 7) / 8, 1, stdout) != 1)
+		return ERROR_FAIL;
+	return ERROR_OK;
+}
+
 static void process_remote_protocol(void)
 {
 	int c;
@@ -311,7 +350,14 @@ static void process_remote_protocol(void)
 					(d & 1));
 		} else if (c == 'R')
 			putchar(sysfsgpio_read());
-		else
+		else if (c == 'V') /* Scan vectors are supported */
+			putchar('2');
+		else if (c == 'X') {
+			if (process_vector() != ERROR_OK) {
+				LOG_ERROR("Truncated scan vector");
+				break;
+			}
+		} else
 			LOG_ERROR("Unknown command '%c' received", c);
 	}
 }
@@ -297,3 +297,198 @@ int arm_nandread(struct arm_nand_data *nand, uint8_t *data, uint32_t size)
 
 	return retval;
 }
+
+static const uint8_t armv4_5_nand_write_code[] = {
+#include "../../../contrib/loaders/flash/nand/armv4_5_nand_write.inc"
+};
+
+static const uint8_t armv7m_nand_write_code[] = {
+#include "../../../contrib/loaders/flash/nand/armv7m_nand_write.inc"
+};
+
+/* parameter block of contrib/loaders/flash/nand/nand_write.S */
+enum arm_nand_write_param {
+	NAND_WRITE_DATA,
+	NAND_WRITE_CMD,
+	NAND_WRITE_ADDR,
+	NAND_WRITE_CYCLES,
+	NAND_WRITE_DATA_SIZE,
+	NAND_WRITE_OOB_SIZE,
+	NAND_WRITE_ECC_RESET,
+	NAND_WRITE_ECC_RESET_VAL,
+	NAND_WRITE_ECC,
+	NAND_WRITE_ECC_REGS,
+	NAND_WRITE_ECC_BYTES,
+	NAND_WRITE_ECC_OFFSET,
+	NAND_WRITE_NUM_PARAMS
+};
+
+/**
+ * Programs @a count consecutive pages of an 8-bit NAND device attached to
+ * memory mapped command, address and data latches, running the whole
+ * command sequence and status polling for a batch of pages on the target.
+ * For ARMv4, ARMv5 and ARMv7-M cores.
+ *
+ * @param io Pointer to the arm_nand_data struct that defines the I/O
+ * @param nand The NAND device to program
+ * @param page First page to program
+ * @param count Number of pages
+ * @param buffer For each page @a data_size bytes of data followed by
+ *               @a oob_size bytes of OOB data
+ * @param data_size Data bytes per page
+ * @param oob_size OOB bytes per page, may be 0
+ * @param ecc Use the ECC engine described in @a io
+ * @return Success or failure of the operation, ERROR_NAND_NO_BUFFER if
+ *         the pages have to be written another way
+ */
+int arm_nand_write_pages(struct arm_nand_data *io, struct nand_device *nand,
+		uint32_t page, uint32_t count, const uint8_t *buffer,
+		uint32_t data_size, uint32_t oob_size, bool ecc)
+{
+	struct target *target = io->target;
+	struct arm_algorithm armv4_5_algo;
+	struct armv7m_algorithm armv7m_algo;
+	void *arm_algo;
+	struct arm *arm = target->arch_info;
+	struct working_area *area = NULL;
+	struct reg_param reg_params[3];
+	const uint8_t *code;
+	unsigned code_size;
+	uint32_t exit_var = 0;
+	int retval = ERROR_OK;
+
+	if (!io->cmd || !io->addr || !data_size
+			|| (nand->device->options & NAND_BUSWIDTH_16))
+		return ERROR_NAND_NO_BUFFER;
+
+	if (is_armv7m(target_to_armv7m(target))) {
+		armv7m_algo.common_magic = ARMV7M_COMMON_MAGIC;
+		armv7m_algo.core_mode = ARM_MODE_THREAD;
+		arm_algo = &armv7m_algo;
+		code = armv7m_nand_write_code;
+		code_size = sizeof(armv7m_nand_write_code);
+	} else {
+		armv4_5_algo.common_magic = ARM_COMMON_MAGIC;
+		armv4_5_algo.core_mode = ARM_MODE_SVC;
+		armv4_5_algo.core_state = ARM_STATE_ARM;
+		arm_algo = &armv4_5_algo;
+		code = armv4_5_nand_write_code;
+		code_size = sizeof(armv4_5_nand_write_code);
+	}
+
+	/* The ECC engine result goes into OOB data, so make room for it
+	 * when the caller has none; OOB data given is written unchanged. */
+	uint32_t param[NAND_WRITE_NUM_PARAMS] = { 0 };
+	uint32_t record_oob_size = oob_size;
+	if (ecc) {
+		param[NAND_WRITE_ECC_RESET] = io->ecc_reset;
+		param[NAND_WRITE_ECC_RESET_VAL] = io->ecc_reset_value;
+		if (!oob_size && io->ecc_regs) {
+			record_oob_size = nand->page_size == 512 ? 16 : 64;
+			param[NAND_WRITE_ECC] = io->ecc;
+			param[NAND_WRITE_ECC_REGS] = io->ecc_regs;
+			param[NAND_WRITE_ECC_BYTES] = io->ecc_bytes;
+			param[NAND_WRITE_ECC_OFFSET] = io->ecc_offset;
+		}
+	}
+	param[NAND_WRITE_DATA] = io->data;
+	param[NAND_WRITE_CMD] = io->cmd;
+	param[NAND_WRITE_ADDR] = io->addr;
+	param[NAND_WRITE_DATA_SIZE] = data_size;
+	param[NAND_WRITE_OOB_SIZE] = record_oob_size;
+
+	/* address cycles, data and OOB data of each page, word aligned */
+	uint32_t record_size = (8 + data_size + record_oob_size + 3) & ~3;
+	uint32_t params_size = sizeof(param);
+	uint32_t batch = MIN(count, MAX(65536 / record_size, 1));
+	while (target_alloc_working_area_try(target,
+			code_size + params_size + batch * record_size, &area) != ERROR_OK) {
+		if (batch == 1) {
+			LOG_DEBUG("%s: no buffer for one page", __func__);
+			return ERROR_NAND_NO_BUFFER;
+		}
+		batch /= 2;
+	}
+
+	uint8_t *records = malloc(batch * record_size);
+	uint8_t *code_buf = malloc(code_size);
+	if (!records || !code_buf) {
+		retval = ERROR_FAIL;
+		goto out;
+	}
+
+	/* code in target endianness */
+	for (unsigned i = 0; i < code_size; i += 4)
+		target_buffer_set_u32(target, code_buf + i, le_to_h_u32(code + i));
+	retval = target_write_buffer(target, area->address, code_size, code_buf);
+	if (retval != ERROR_OK)
+		goto out;
+
+	/* armv4 must exit using a hardware breakpoint */
+	if (arm->is_armv4)
+		exit_var = area->address + code_size - 4;
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_IN_OUT);
+
+	uint32_t params_address = area->address + code_size;
+	uint32_t records_address = params_address + params_size;
+
+	while (count > 0) {
+		uint32_t n = MIN(count, batch);
+
+		memset(records, 0xff, n * record_size);
+		for (uint32_t i = 0; i < n; i++) {
+			uint8_t *record = records + i * record_size;
+			const uint8_t *src = buffer + i * (data_size + oob_size);
+
+			param[NAND_WRITE_CYCLES] = nand_page_address(nand, page + i,
+					false, record);
+			memcpy(record + 8, src, data_size + oob_size);
+		}
+
+		uint8_t params_buf[sizeof(param)];
+		target_buffer_set_u32_array(target, params_buf, NAND_WRITE_NUM_PARAMS, param);
+		retval = target_write_buffer(target, params_address, params_size, params_buf);
+		if (retval == ERROR_OK)
+			retval = target_write_buffer(target, records_address, n * record_size, records);
+		if (retval != ERROR_OK)
+			break;
+
+		buf_set_u32(reg_params[0].value, 0, 32, params_address);
+		buf_set_u32(reg_params[1].value, 0, 32, records_address);
+		buf_set_u32(reg_params[2].value, 0, 32, n);
+
+		/* programming a page takes well under 10 ms */
+		retval = target_run_algorithm(target, 0, NULL, 3, reg_params,
+				area->address, exit_var, 1000 + 10 * n, arm_algo);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("error executing hosted NAND page write");
+			break;
+		}
+
+		uint32_t status = buf_get_u32(reg_params[0].value, 0, 32);
+		uint32_t left = buf_get_u32(reg_params[2].value, 0, 32);
+		if (status != 0 || left != 0) {
+			LOG_ERROR("write operation didn't pass at page %" PRIu32 ", status: 0x%2.2" PRIx32,
+					page + n - left, status);
+			retval = ERROR_NAND_OPERATION_FAILED;
+			break;
+		}
+
+		page += n;
+		buffer += n * (data_size + oob_size);
+		count -= n;
+	}
+
+	destroy_reg_param(&reg_params[0]);
+	destroy_reg_param(&reg_params[1]);
+	destroy_reg_param(&reg_params[2]);
+
+out:
+	free(code_buf);
+	free(records);
+	target_free_working_area(target, area);
+	return retval;
+}
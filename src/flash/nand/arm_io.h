@@ -46,10 +46,30 @@ struct arm_nand_data {
 	/** Last operation executed using this struct. */
 	enum arm_nand_op op;
 
+	/** Command and address latches, needed by arm_nand_write_pages(). */
+	uint32_t cmd;
+	uint32_t addr;
+
+	/**
+	 * Optional ECC engine for arm_nand_write_pages(). Before each page
+	 * ecc_reset_value is written to ecc_reset (if set). After the page
+	 * data the low ecc_bytes bytes of the ecc_regs registers starting at
+	 * ecc go to the OOB data at ecc_offset, unless the caller gave OOB.
+	 */
+	uint32_t ecc_reset;
+	uint32_t ecc_reset_value;
+	uint32_t ecc;
+	unsigned ecc_regs;
+	unsigned ecc_bytes;
+	unsigned ecc_offset;
+
 	/* currently implicit:  data width == 8 bits (not 16) */
 };
 
 int arm_nandwrite(struct arm_nand_data *nand, uint8_t *data, int size);
 int arm_nandread(struct arm_nand_data *nand, uint8_t *data, uint32_t size);
+int arm_nand_write_pages(struct arm_nand_data *io, struct nand_device *nand,
+		uint32_t page, uint32_t count, const uint8_t *buffer,
+		uint32_t data_size, uint32_t oob_size, bool ecc);
 
 #endif /* OPENOCD_FLASH_NAND_ARM_IO_H */
@@ -486,6 +486,49 @@ static int at91sam9_write_page(struct nand_device *nand, uint32_t page,
 	return retval;
 }
 
+/**
+ * Write several pages to a NAND device attached to an AT91SAM9 controller
+ * using a hosted loop, with the 1-bit ECC from the ECC controller unless
+ * raw access is selected or OOB data is given.
+ *
+ * @param nand NAND device to write to.
+ * @param page First page to write.
+ * @param count Number of pages.
+ * @param buffer Data and OOB data of each page.
+ * @param data_size Data bytes per page.
+ * @param oob_size OOB bytes per page.
+ * @return Success or failure of the page writes.
+ */
+static int at91sam9_write_pages(struct nand_device *nand, uint32_t page,
+	uint32_t count, uint8_t *buffer, uint32_t data_size, uint32_t oob_size)
+{
+	struct at91sam9_nand *info = nand->controller_priv;
+	struct arm_nand_data *io = &info->io;
+
+	if (!at91sam9_halted(nand->target, "write pages"))
+		return ERROR_NAND_OPERATION_FAILED;
+
+	if (!nand->use_raw && !info->ecc) {
+		LOG_ERROR("ECC controller address must be set when not reading raw NAND data");
+		return ERROR_NAND_OPERATION_FAILED;
+	}
+
+	/* the latches can be changed by the cle and ale commands */
+	io->cmd = info->cmd;
+	io->addr = info->addr;
+	io->ecc_reset = info->ecc + AT91C_ECCx_CR;
+	io->ecc_reset_value = 1;
+	io->ecc = info->ecc + AT91C_ECCx_PR;
+	io->ecc_regs = 2;	/* PR and NPR, 16 bits each */
+	io->ecc_bytes = 2;
+	io->ecc_offset = 0;
+
+	at91sam9_enable(nand);
+
+	return arm_nand_write_pages(io, nand, page, count, buffer,
+			data_size, oob_size, !nand->use_raw);
+}
+
 /**
  * Handle the initial NAND device command for AT91SAM9 controllers.  This
  * initializes much of the controller information struct to be ready for future
@@ -719,4 +762,5 @@ struct nand_flash_controller at91sam9_nand_controller = {
 	.write_block_data = at91sam9_write_block_data,
 	.read_page = at91sam9_read_page,
 	.write_page = at91sam9_write_page,
+	.write_pages = at91sam9_write_pages,
 };
@@ -688,6 +688,43 @@ int nand_write_page(struct nand_device *nand, uint32_t page,
 		return nand->controller->write_page(nand, page, data, data_size, oob, oob_size);
 }
 
+int nand_write_pages(struct nand_device *nand, uint32_t page, uint32_t count,
+	uint8_t *buffer, uint32_t data_size, uint32_t oob_size)
+{
+	int retval = ERROR_NAND_NO_BUFFER;
+
+	if (!nand->device)
+		return ERROR_NAND_DEVICE_NOT_PROBED;
+
+	if (data_size && nand->controller->write_pages) {
+		uint32_t pages_per_block = nand->erase_size / nand->page_size;
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t block = (page + i) / pages_per_block;
+			if (nand->blocks[block].is_erased == 1)
+				nand->blocks[block].is_erased = 0;
+		}
+
+		retval = nand->controller->write_pages(nand, page, count,
+				buffer, data_size, oob_size);
+	}
+
+	if (retval != ERROR_NAND_NO_BUFFER)
+		return retval;
+
+	/* no bulk writes, or no working area for them */
+	for (uint32_t i = 0; i < count; i++) {
+		uint8_t *data = buffer + i * (data_size + oob_size);
+
+		retval = nand_write_page(nand, page + i, data_size ? data : NULL, data_size,
+				oob_size ? data + data_size : NULL, oob_size);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
 int nand_read_page(struct nand_device *nand, uint32_t page,
 	uint8_t *data, uint32_t data_size,
 	uint8_t *oob, uint32_t oob_size)
@@ -701,59 +738,74 @@ int nand_read_page(struct nand_device *nand, uint32_t page,
 		return nand->controller->read_page(nand, page, data, data_size, oob, oob_size);
 }
 
-int nand_page_command(struct nand_device *nand, uint32_t page,
-	uint8_t cmd, bool oob_only)
+int nand_page_address(struct nand_device *nand, uint32_t page,
+	bool oob_only, uint8_t *cycles)
 {
-	if (!nand->device)
-		return ERROR_NAND_DEVICE_NOT_PROBED;
-
-	if (oob_only && NAND_CMD_READ0 == cmd && nand->page_size <= 512)
-		cmd = NAND_CMD_READOOB;
-
-	nand->controller->command(nand, cmd);
+	int n = 0;
 
 	if (nand->page_size <= 512) {
 		/* small page device */
 
 		/* column (always 0, we start at the beginning of a page/OOB area) */
-		nand->controller->address(nand, 0x0);
+		cycles[n++] = 0x0;
 
 		/* row */
-		nand->controller->address(nand, page & 0xff);
-		nand->controller->address(nand, (page >> 8) & 0xff);
+		cycles[n++] = page & 0xff;
+		cycles[n++] = (page >> 8) & 0xff;
 
 		/* 4th cycle only on devices with more than 32 MiB */
 		if (nand->address_cycles >= 4)
-			nand->controller->address(nand, (page >> 16) & 0xff);
+			cycles[n++] = (page >> 16) & 0xff;
 
 		/* 5th cycle only on devices with more than 8 GiB */
 		if (nand->address_cycles >= 5)
-			nand->controller->address(nand, (page >> 24) & 0xff);
+			cycles[n++] = (page >> 24) & 0xff;
 	} else {
 		/* large page device */
 
 		/* column (0 when we start at the beginning of a page,
 		 * or 2048 for the beginning of OOB area)
 		 */
-		nand->controller->address(nand, 0x0);
+		cycles[n++] = 0x0;
 		if (oob_only)
-			nand->controller->address(nand, 0x8);
+			cycles[n++] = 0x8;
 		else
-			nand->controller->address(nand, 0x0);
+			cycles[n++] = 0x0;
 
 		/* row */
-		nand->controller->address(nand, page & 0xff);
-		nand->controller->address(nand, (page >> 8) & 0xff);
+		cycles[n++] = page & 0xff;
+		cycles[n++] = (page >> 8) & 0xff;
 
 		/* 5th cycle only on devices with more than 128 MiB */
 		if (nand->address_cycles >= 5)
-			nand->controller->address(nand, (page >> 16) & 0xff);
-
-		/* large page devices need a start command if reading */
-		if (NAND_CMD_READ0 == cmd)
-			nand->controller->command(nand, NAND_CMD_READSTART);
+			cycles[n++] = (page >> 16) & 0xff;
 	}
 
+	return n;
+}
+
+int nand_page_command(struct nand_device *nand, uint32_t page,
+	uint8_t cmd, bool oob_only)
+{
+	uint8_t cycles[NAND_MAX_ADDRESS_CYCLES];
+	int n;
+
+	if (!nand->device)
+		return ERROR_NAND_DEVICE_NOT_PROBED;
+
+	if (oob_only && NAND_CMD_READ0 == cmd && nand->page_size <= 512)
+		cmd = NAND_CMD_READOOB;
+
+	nand->controller->command(nand, cmd);
+
+	n = nand_page_address(nand, page, oob_only, cycles);
+	for (int i = 0; i < n; i++)
+		nand->controller->address(nand, cycles[i]);
+
+	/* large page devices need a start command if reading */
+	if (nand->page_size > 512 && NAND_CMD_READ0 == cmd)
+		nand->controller->command(nand, NAND_CMD_READSTART);
+
 	if (nand->controller->nand_ready) {
 		if (!nand->controller->nand_ready(nand, 100))
 			return ERROR_NAND_OPERATION_TIMEOUT;
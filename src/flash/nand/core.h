@@ -193,6 +193,16 @@ enum oob_formats {
 
 struct nand_device *get_nand_device_by_num(int num);
 
+/** The most address cycles nand_page_address() generates */
+#define NAND_MAX_ADDRESS_CYCLES	5
+
+/**
+ * Fills @a cycles with the address cycles that select @a page (or its OOB
+ * area, for @a oob_only) after a page command.
+ * @returns The number of address cycles.
+ */
+int nand_page_address(struct nand_device *nand, uint32_t page,
+		      bool oob_only, uint8_t *cycles);
 int nand_page_command(struct nand_device *nand, uint32_t page,
 		      uint8_t cmd, bool oob_only);
 
@@ -71,6 +71,14 @@ struct nand_flash_controller {
 	int (*write_page)(struct nand_device *nand, uint32_t page, uint8_t *data,
 			  uint32_t data_size, uint8_t *oob, uint32_t oob_size);
 
+	/**
+	 * Write several consecutive pages to the NAND device, laid out as
+	 * described for nand_write_pages(). Returns ERROR_NAND_NO_BUFFER to
+	 * have the core write them one page at a time instead.
+	 */
+	int (*write_pages)(struct nand_device *nand, uint32_t page, uint32_t count,
+			uint8_t *buffer, uint32_t data_size, uint32_t oob_size);
+
 	/** Read a page from the NAND device. */
 	int (*read_page)(struct nand_device *nand, uint32_t page, uint8_t *data, uint32_t data_size,
 			 uint8_t *oob, uint32_t oob_size);
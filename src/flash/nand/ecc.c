@@ -3,8 +3,8 @@
  * and correction of 1-bit errors in a 256 byte block of data.
  *
  * [ Extracted from the initial code found in some early Linux versions.
- *   The current Linux code is bigger while being faster, but this is of
- *   no real benefit when the bottleneck largely remains the JTAG link.  ]
+ *   The parity loop has since been changed to work on 32-bit words, so
+ *   the host keeps up with bulk page writes.  ]
  *
  * Copyright (C) 2000-2004 Steven J. Hill (sjhill at realitydiluted.com)
  *                         Toshiba America Electronics Components, Inc.
@@ -70,23 +70,42 @@ static const uint8_t nand_ecc_precalc_table[] = {
 int nand_calculate_ecc(struct nand_device *nand, const uint8_t *dat, uint8_t *ecc_code)
 {
 	uint8_t idx, reg1, reg2, reg3, tmp1, tmp2;
+	uint32_t cols = 0, rows = 0, low = 0;
 	int i;
 
-	/* Initialize variables */
-	reg1 = reg2 = reg3 = 0;
-
-	/* Build up column parity */
-	for (i = 0; i < 256; i++) {
-		/* Get CP0 - CP5 from table */
-		idx = nand_ecc_precalc_table[*dat++];
-		reg1 ^= (idx & 0x3f);
-
-		/* All bit XOR = 1 ? */
-		if (idx & 0x40) {
-			reg3 ^= (uint8_t) i;
-			reg2 ^= ~((uint8_t) i);
-		}
+	/*
+	 * Work on 32 bits (4 bytes) at a time. The column parity of the
+	 * block is that of all bytes XORed together, and the line parity
+	 * is the XOR of the indexes of all bytes with odd parity; for a
+	 * word that's the word index (when it holds an odd number of such
+	 * bytes) plus the byte positions within the word.
+	 */
+	for (i = 0; i < 64; i++) {
+		uint32_t w = le_to_h_u32(dat + 4 * i);
+		uint32_t p;
+
+		cols ^= w;
+
+		/* byte parities into bits 0, 8, 16 and 24 */
+		p = w ^ (w >> 4);
+		p ^= p >> 2;
+		p ^= p >> 1;
+		p &= 0x01010101;
+
+		/* byte position bit 0 from bytes 1 and 3, bit 1 from 2 and 3 */
+		low ^= ((p >> 8) ^ (p >> 24)) | (((p >> 16) ^ (p >> 24)) << 1);
+		if ((p ^ (p >> 8) ^ (p >> 16) ^ (p >> 24)) & 1)
+			rows ^= i << 2;
 	}
+	cols ^= cols >> 16;
+	cols ^= cols >> 8;
+
+	/* Get CP0 - CP5 from table */
+	idx = nand_ecc_precalc_table[cols & 0xff];
+	reg1 = idx & 0x3f;
+	reg3 = rows ^ (low & 3);
+	/* Odd number of odd bytes: each flipped index adds 0xff */
+	reg2 = (idx & 0x40) ? ~reg3 : reg3;
 
 	/* Create non-inverted ECC code from line parity */
 	tmp1  = (reg3 & 0x80) >> 0; /* B7 -> B7 */
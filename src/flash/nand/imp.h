@@ -27,6 +27,14 @@ int nand_write_page(struct nand_device *nand,
 		uint32_t page, uint8_t *data, uint32_t data_size,
 		uint8_t *oob, uint32_t oob_size);
 
+/**
+ * Writes @a count consecutive pages starting at @a page. For each page
+ * @a buffer holds @a data_size bytes of data followed by @a oob_size bytes
+ * of OOB data. Uses the controller's bulk write when it has one.
+ */
+int nand_write_pages(struct nand_device *nand, uint32_t page, uint32_t count,
+		uint8_t *buffer, uint32_t data_size, uint32_t oob_size);
+
 int nand_read_page(struct nand_device *nand, uint32_t page,
 		uint8_t *data, uint32_t data_size,
 		uint8_t *oob, uint32_t oob_size);
@@ -240,6 +240,9 @@ COMMAND_HANDLER(handle_nand_check_bad_blocks_command)
 	return retval;
 }
 
+/* pages handed to nand_write_pages() at once by "nand write" */
+#define NAND_WRITE_BATCH_PAGES	64
+
 COMMAND_HANDLER(handle_nand_write_command)
 {
 	struct nand_device *nand = NULL;
@@ -249,27 +252,50 @@ COMMAND_HANDLER(handle_nand_write_command)
 	if (ERROR_OK != retval)
 		return retval;
 
+	/* collect pages with their OOB data to write them in batches */
+	uint32_t stride = s.page_size + s.oob_size;
+	uint8_t *batch = malloc(NAND_WRITE_BATCH_PAGES * stride);
+	if (!batch) {
+		nand_fileio_cleanup(&s);
+		return ERROR_FAIL;
+	}
+
 	uint32_t total_bytes = s.size;
 	while (s.size > 0) {
-		int bytes_read = nand_fileio_read(nand, &s);
-		if (bytes_read <= 0) {
-			command_print(CMD, "error while reading file");
-			nand_fileio_cleanup(&s);
-			return ERROR_FAIL;
+		uint32_t address = s.address;
+		uint32_t pages = 0;
+
+		while (s.size > 0 && pages < NAND_WRITE_BATCH_PAGES) {
+			int bytes_read = nand_fileio_read(nand, &s);
+			if (bytes_read <= 0) {
+				command_print(CMD, "error while reading file");
+				free(batch);
+				nand_fileio_cleanup(&s);
+				return ERROR_FAIL;
+			}
+			s.size -= bytes_read;
+
+			uint8_t *p = batch + pages * stride;
+			if (s.page)
+				memcpy(p, s.page, s.page_size);
+			if (s.oob)
+				memcpy(p + s.page_size, s.oob, s.oob_size);
+			pages++;
+			s.address += s.page_size;
 		}
-		s.size -= bytes_read;
 
-		retval = nand_write_page(nand, s.address / nand->page_size,
-				s.page, s.page_size, s.oob, s.oob_size);
+		retval = nand_write_pages(nand, address / nand->page_size, pages,
+				batch, s.page_size, s.oob_size);
 		if (ERROR_OK != retval) {
 			command_print(CMD, "failed writing file %s "
 				"to NAND flash %s at offset 0x%8.8" PRIx32,
-				CMD_ARGV[1], CMD_ARGV[0], s.address);
+				CMD_ARGV[1], CMD_ARGV[0], address);
+			free(batch);
 			nand_fileio_cleanup(&s);
 			return retval;
 		}
-		s.address += s.page_size;
 	}
+	free(batch);
 
 	if (nand_fileio_finish(&s) == ERROR_OK) {
 		command_print(CMD, "wrote file %s to NAND flash %s up to "
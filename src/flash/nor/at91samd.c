@@ -23,6 +23,8 @@
 #include "imp.h"
 #include "helper/binarybuffer.h"
 
+#include <target/algorithm.h>
+#include <target/armv7m.h>
 #include <target/cortex_m.h>
 
 #define SAMD_NUM_PROT_BLOCKS	16
@@ -41,7 +43,7 @@
 #define SAMD_NVMCTRL_CTRLA		0x00	/* NVM control A register */
 #define SAMD_NVMCTRL_CTRLB		0x04	/* NVM control B register */
 #define SAMD_NVMCTRL_PARAM		0x08	/* NVM parameters register */
-#define SAMD_NVMCTRL_INTFLAG	0x18	/* NVM Interrupt Flag Status & Clear */
+#define SAMD_NVMCTRL_INTFLAG	0x14	/* NVM Interrupt Flag Status & Clear */
 #define SAMD_NVMCTRL_STATUS		0x18	/* NVM status register */
 #define SAMD_NVMCTRL_ADDR		0x1C	/* NVM address register */
 #define SAMD_NVMCTRL_LOCK		0x20	/* NVM Lock section register */
@@ -804,6 +806,105 @@ static int samd_erase(struct flash_bank *bank, unsigned int first,
 	return ERROR_OK;
 }
 
+/* Pages kept in flight in the loader's fifo */
+#define SAMD_LOADER_PAGES	16
+
+/**
+ * Programs whole pages with a loader running on the target, which the
+ * pages are streamed to while it writes them.
+ * @param bank The flash bank.
+ * @param buffer The data, @a count pages of it.
+ * @param offset Page aligned offset into the bank.
+ * @param count Number of pages.
+ * @param manual_wp Whether each page needs a write page command.
+ * @return ERROR_TARGET_RESOURCE_NOT_AVAILABLE if there is not enough working
+ * area, so the caller can fall back to writing pages from the host.
+ */
+static int samd_write_block(struct flash_bank *bank, const uint8_t *buffer,
+		uint32_t offset, uint32_t count, bool manual_wp)
+{
+	struct samd_info *chip = (struct samd_info *)bank->driver_priv;
+	struct target *target = bank->target;
+	struct working_area *write_algorithm;
+	struct working_area *source;
+	struct reg_param reg_params[7];
+	struct armv7m_algorithm armv7m_info;
+	unsigned int fifo_pages = SAMD_LOADER_PAGES;
+	int res;
+
+	static const uint8_t samd_flash_write_code[] = {
+#include "../../../contrib/loaders/flash/at91samd/at91samd.inc"
+	};
+
+	if (target_alloc_working_area(target, sizeof(samd_flash_write_code),
+			&write_algorithm) != ERROR_OK) {
+		LOG_WARNING("no working area available, can't do block memory writes");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	res = target_write_buffer(target, write_algorithm->address,
+			sizeof(samd_flash_write_code), samd_flash_write_code);
+	if (res != ERROR_OK) {
+		target_free_working_area(target, write_algorithm);
+		return res;
+	}
+
+	/* The fifo must hold whole pages, and at least two of them since it
+	 * is never filled completely */
+	while (target_alloc_working_area_try(target, 8 + fifo_pages * chip->page_size,
+			&source) != ERROR_OK) {
+		fifo_pages /= 2;
+		if (fifo_pages < 2) {
+			target_free_working_area(target, write_algorithm);
+			LOG_WARNING("no large enough working area available, can't do block memory writes");
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		}
+	}
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);	/* NVMCTRL base (in), status (out) */
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);	/* count (pages) */
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);	/* buffer start */
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);	/* buffer end */
+	init_reg_param(&reg_params[4], "r4", 32, PARAM_IN_OUT);	/* target address */
+	init_reg_param(&reg_params[5], "r5", 32, PARAM_OUT);	/* page size */
+	init_reg_param(&reg_params[6], "r6", 32, PARAM_OUT);	/* write page command */
+
+	buf_set_u32(reg_params[0].value, 0, 32, SAMD_NVMCTRL);
+	buf_set_u32(reg_params[1].value, 0, 32, count);
+	buf_set_u32(reg_params[2].value, 0, 32, source->address);
+	buf_set_u32(reg_params[3].value, 0, 32, source->address + source->size);
+	buf_set_u32(reg_params[4].value, 0, 32, bank->base + offset);
+	buf_set_u32(reg_params[5].value, 0, 32, chip->page_size);
+	buf_set_u32(reg_params[6].value, 0, 32, manual_wp ? SAMD_NVM_CMD(SAMD_NVM_CMD_WP) : 0);
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARM_MODE_THREAD;
+
+	res = target_run_flash_async_algorithm(target, buffer, count, chip->page_size,
+			0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			source->address, source->size,
+			write_algorithm->address, 0,
+			&armv7m_info);
+
+	if (res == ERROR_FLASH_OPERATION_FAILED) {
+		/* The loader stops on the page that failed and leaves its status
+		 * in NVMCTRL for samd_check_error() to report and clear */
+		LOG_ERROR("SAMD: write failed at address 0x%08" PRIx32,
+				buf_get_u32(reg_params[4].value, 0, 32) - chip->page_size);
+		int res2 = samd_check_error(target);
+		if (res2 != ERROR_OK)
+			res = res2;
+	}
+
+	target_free_working_area(target, source);
+	target_free_working_area(target, write_algorithm);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	return res;
+}
 
 static int samd_write(struct flash_bank *bank, const uint8_t *buffer,
 		uint32_t offset, uint32_t count)
@@ -845,6 +946,31 @@ static int samd_write(struct flash_bank *bank, const uint8_t *buffer,
 		return res;
 	}
 
+	/* Pad to whole pages with 0xff, which leaves the flash untouched,
+	 * and let the loader program them */
+	uint32_t block_offset = offset - offset % chip->page_size;
+	uint32_t block_end = offset + count;
+	if (block_end % chip->page_size)
+		block_end += chip->page_size - block_end % chip->page_size;
+	const uint8_t *block = buffer;
+	if (block_offset != offset || block_end != offset + count) {
+		pb = malloc(block_end - block_offset);
+		if (!pb)
+			return ERROR_FAIL;
+		memset(pb, 0xff, block_end - block_offset);
+		memcpy(pb + (offset - block_offset), buffer, count);
+		block = pb;
+	}
+
+	res = samd_write_block(bank, block, block_offset,
+			(block_end - block_offset) / chip->page_size, manual_wp);
+	free(pb);
+	pb = NULL;
+	if (res != ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+		return res;
+
+	LOG_WARNING("SAMD: couldn't use the flash loader, writing pages from the host");
+
 	while (count) {
 		nb = chip->page_size - offset % chip->page_size;
 		if (count < nb)
@@ -31,6 +31,7 @@
 #include <target/arm7_9_common.h>
 #include <target/armv7m.h>
 #include <target/mips32.h>
+#include <target/riscv/riscv.h>
 #include <helper/binarybuffer.h>
 #include <target/algorithm.h>
 
@@ -2253,6 +2254,191 @@ static int cfi_write_words(struct flash_bank *bank, const uint8_t *word,
 	return ERROR_FLASH_OPERATION_FAILED;
 }
 
+static const uint8_t armv7m_cfi_async_code[] = {
+#include "../../../contrib/loaders/flash/cfi/armv7m_cfi_async.inc"
+};
+
+static const uint8_t riscv32_cfi_async_code[] = {
+#include "../../../contrib/loaders/flash/cfi/riscv32_cfi_async.inc"
+};
+
+static const uint8_t riscv64_cfi_async_code[] = {
+#include "../../../contrib/loaders/flash/cfi/riscv64_cfi_async.inc"
+};
+
+/* parameter table at the end of the cfi_async loaders */
+enum cfi_async_param {
+	CFI_ASYNC_UNLOCK1,
+	CFI_ASYNC_UNLOCK2,
+	CFI_ASYNC_CMD_AA,
+	CFI_ASYNC_CMD_55,
+	CFI_ASYNC_CMD_PROG,
+	CFI_ASYNC_CMD_BUF_LOAD,
+	CFI_ASYNC_BUF_COUNT,
+	CFI_ASYNC_CMD_BUF_CONFIRM,
+	CFI_ASYNC_STATUS_MASK,
+	CFI_ASYNC_AUX_MASK,
+	CFI_ASYNC_FLAGS,
+	CFI_ASYNC_BUS_WIDTH,
+	CFI_ASYNC_BUF_WORDS,
+	CFI_ASYNC_BUF_MASK,
+	CFI_ASYNC_NUM_PARAMS
+};
+
+#define CFI_ASYNC_FLAG_INTEL	1
+
+/* Program count bytes at address while the host streams them through a fifo,
+ * see contrib/loaders/flash/cfi/riscv_cfi_async.S. Whole, aligned write
+ * buffers go through buffered programming, everything else word by word.
+ * Returns ERROR_TARGET_RESOURCE_NOT_AVAILABLE if the target can't run it. */
+static int cfi_write_block_async(struct flash_bank *bank, const uint8_t *buffer,
+	uint32_t address, uint32_t count)
+{
+	struct cfi_flash_bank *cfi_info = bank->driver_priv;
+	struct target *target = bank->target;
+	struct armv7m_algorithm armv7m_algo;
+	void *arch_info = NULL;
+	struct working_area *write_algorithm;
+	struct working_area *source;
+	uint32_t fifo_size = 32768;
+	unsigned int xlen = 32;
+	const uint8_t *code;
+	size_t code_size;
+	int retval;
+
+	if (bank->bus_width != 1 && bank->bus_width != 2 && bank->bus_width != 4)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	if (strcmp(target_type_name(target), "riscv") == 0) {
+		if (!riscv_can_access_memory_running(target, 4))
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		xlen = riscv_xlen(target);
+		if (xlen == 32) {
+			code = riscv32_cfi_async_code;
+			code_size = sizeof(riscv32_cfi_async_code);
+		} else {
+			code = riscv64_cfi_async_code;
+			code_size = sizeof(riscv64_cfi_async_code);
+		}
+	} else if (is_armv7m(target_to_armv7m(target))) {
+		armv7m_algo.common_magic = ARMV7M_COMMON_MAGIC;
+		armv7m_algo.core_mode = ARM_MODE_THREAD;
+		arch_info = &armv7m_algo;
+		code = armv7m_cfi_async_code;
+		code_size = sizeof(armv7m_cfi_async_code);
+	} else {
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	/* The write buffer of each chip in an interleaved bank is filled in
+	 * parallel, so a bus wide buffer is the sum of them all. */
+	uint32_t buffersize = 0;
+	if (cfi_info->buf_write_timeout_typ != 0 && bank->chip_width <= bank->bus_width)
+		buffersize = (1UL << cfi_info->max_buf_write_size) *
+			(bank->bus_width / bank->chip_width);
+	/* the word count is written as a command, so it has to fit a byte */
+	if (buffersize < bank->bus_width || buffersize / bank->bus_width > 256)
+		buffersize = 0;
+
+	uint8_t params[CFI_ASYNC_NUM_PARAMS * 4] = { 0 };
+	uint32_t param[CFI_ASYNC_NUM_PARAMS] = { 0 };
+	if (cfi_info->pri_id == 2) {
+		struct cfi_spansion_pri_ext *pri_ext = cfi_info->pri_ext;
+
+		param[CFI_ASYNC_UNLOCK1] = cfi_flash_address(bank, 0, pri_ext->_unlock1);
+		param[CFI_ASYNC_UNLOCK2] = cfi_flash_address(bank, 0, pri_ext->_unlock2);
+		param[CFI_ASYNC_CMD_AA] = cfi_command_val(bank, 0xaa);
+		param[CFI_ASYNC_CMD_55] = cfi_command_val(bank, 0x55);
+		param[CFI_ASYNC_CMD_PROG] = cfi_command_val(bank, 0xa0);
+		param[CFI_ASYNC_CMD_BUF_LOAD] = cfi_command_val(bank, 0x25);
+		param[CFI_ASYNC_CMD_BUF_CONFIRM] = cfi_command_val(bank, 0x29);
+		param[CFI_ASYNC_STATUS_MASK] = cfi_command_val(bank, 0x80);
+		/* without DQ5 the loader just keeps polling DQ7 */
+		if (cfi_info->status_poll_mask & (1 << 5))
+			param[CFI_ASYNC_AUX_MASK] = cfi_command_val(bank, 0x20);
+	} else {
+		param[CFI_ASYNC_CMD_PROG] = cfi_command_val(bank, 0x40);
+		param[CFI_ASYNC_CMD_BUF_LOAD] = cfi_command_val(bank, 0xe8);
+		param[CFI_ASYNC_CMD_BUF_CONFIRM] = cfi_command_val(bank, 0xd0);
+		param[CFI_ASYNC_STATUS_MASK] = cfi_command_val(bank, 0x80);
+		param[CFI_ASYNC_AUX_MASK] = cfi_command_val(bank, 0x7e);
+		param[CFI_ASYNC_FLAGS] = CFI_ASYNC_FLAG_INTEL;
+	}
+	param[CFI_ASYNC_BUS_WIDTH] = bank->bus_width;
+	if (buffersize) {
+		param[CFI_ASYNC_BUF_WORDS] = buffersize / bank->bus_width;
+		param[CFI_ASYNC_BUF_COUNT] = cfi_command_val(bank, buffersize / bank->bus_width - 1);
+		param[CFI_ASYNC_BUF_MASK] = buffersize - 1;
+	}
+	target_buffer_set_u32_array(target, params, CFI_ASYNC_NUM_PARAMS, param);
+
+	if (target_alloc_working_area(target, code_size, &write_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	retval = target_write_buffer(target, write_algorithm->address,
+			code_size - sizeof(params), code);
+	if (retval == ERROR_OK)
+		retval = target_write_buffer(target,
+				write_algorithm->address + code_size - sizeof(params),
+				sizeof(params), params);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, write_algorithm);
+		return retval;
+	}
+
+	/* No point in a fifo much bigger than the data, but keep room for two
+	 * write buffers so the next one fills while the flash programs. */
+	uint32_t min_fifo_size = MAX(256, 2 * buffersize + 8);
+	while (fifo_size / 2 >= count + 8 && fifo_size / 2 >= min_fifo_size)
+		fifo_size /= 2;
+	while (target_alloc_working_area_try(target, fifo_size, &source) != ERROR_OK) {
+		fifo_size /= 2;
+		if (fifo_size < 256) {
+			target_free_working_area(target, write_algorithm);
+			LOG_WARNING("no large enough working area available, can't do block memory writes");
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		}
+	}
+
+	struct reg_param reg_params[4];
+	bool arm = arch_info;
+	init_reg_param(&reg_params[0], arm ? "r0" : "a0", xlen, PARAM_IN_OUT);	/* fifo start (in), status (out) */
+	init_reg_param(&reg_params[1], arm ? "r1" : "a1", xlen, PARAM_OUT);	/* fifo end */
+	init_reg_param(&reg_params[2], arm ? "r2" : "a2", xlen, PARAM_OUT);	/* flash address */
+	init_reg_param(&reg_params[3], arm ? "r3" : "a3", xlen, PARAM_OUT);	/* count (bus words) */
+
+	buf_set_u64(reg_params[0].value, 0, xlen, source->address);
+	buf_set_u64(reg_params[1].value, 0, xlen, source->address + source->size);
+	buf_set_u64(reg_params[2].value, 0, xlen, address);
+	buf_set_u64(reg_params[3].value, 0, xlen, count / bank->bus_width);
+
+	if (cfi_info->pri_id != 2)
+		cfi_intel_clear_status_register(bank);
+
+	retval = target_run_flash_async_algorithm(target, buffer,
+			count / bank->bus_width, bank->bus_width,
+			0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			source->address, source->size,
+			write_algorithm->address, 0,
+			arch_info);
+
+	if (retval == ERROR_FLASH_OPERATION_FAILED) {
+		LOG_ERROR("flash write failed at base " TARGET_ADDR_FMT ", address 0x%" PRIx32,
+				bank->base, address);
+		if (cfi_info->pri_id != 2)
+			cfi_intel_clear_status_register(bank);
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	target_free_working_area(target, source);
+	target_free_working_area(target, write_algorithm);
+
+	return retval;
+}
+
 static int cfi_read(struct flash_bank *bank, uint8_t *buffer, uint32_t offset, uint32_t count)
 {
 	struct cfi_flash_bank *cfi_info = bank->driver_priv;
@@ -2392,10 +2578,14 @@ static int cfi_write(struct flash_bank *bank, const uint8_t *buffer, uint32_t of
 		/* try block writes (fails without working area) */
 		case 1:
 		case 3:
-			retval = cfi_intel_write_block(bank, buffer, write_p, blk_count);
+			retval = cfi_write_block_async(bank, buffer, write_p, blk_count);
+			if (retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+				retval = cfi_intel_write_block(bank, buffer, write_p, blk_count);
 			break;
 		case 2:
-			retval = cfi_spansion_write_block(bank, buffer, write_p, blk_count);
+			retval = cfi_write_block_async(bank, buffer, write_p, blk_count);
+			if (retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+				retval = cfi_spansion_write_block(bank, buffer, write_p, blk_count);
 			break;
 		default:
 			LOG_ERROR("cfi primary command set %i unsupported", cfi_info->pri_id);
@@ -36,13 +36,142 @@
  */
 
 static struct flash_bank *flash_banks;
+/* Bank get_flash_bank_by_addr() found last */
+static struct flash_bank *flash_bank_last_hit;
+
+/* Driver operations in progress. Flash algorithms resume and halt the
+ * target, which mustn't make us forget what those same operations did. */
+static unsigned int flash_ops_active;
+
+/* Virtual banks share their master's sectors, so what we learn about one
+ * holds for the other too. */
+static bool flash_banks_share_sectors(struct flash_bank *a, struct flash_bank *b)
+{
+	return a == b || (a->sectors && a->sectors == b->sectors);
+}
+
+/* Return @a *known if it describes @a size blocks, or a cleared array of
+ * that size if @a alloc is set, otherwise NULL. */
+static bool *flash_known_blocks(bool **known, unsigned int *num_known,
+		unsigned int size, bool alloc)
+{
+	if (*known && *num_known == size)
+		return *known;
+
+	free(*known);
+	*known = NULL;
+	*num_known = 0;
+	if (!alloc || size == 0)
+		return NULL;
+
+	*known = calloc(size, sizeof(bool));
+	if (*known)
+		*num_known = size;
+	return *known;
+}
+
+static bool *flash_known_erased(struct flash_bank *bank, bool alloc)
+{
+	return flash_known_blocks(&bank->known_erased, &bank->num_known_erased,
+			bank->num_sectors, alloc);
+}
+
+static bool *flash_known_unprotected(struct flash_bank *bank, bool alloc)
+{
+	unsigned int num_blocks = bank->num_prot_blocks ? bank->num_prot_blocks
+			: bank->num_sectors;
+	return flash_known_blocks(&bank->known_unprotected,
+			&bank->num_known_unprotected, num_blocks, alloc);
+}
+
+static void flash_set_known_erased(struct flash_bank *bank, unsigned int first,
+		unsigned int last, bool erased)
+{
+	for (struct flash_bank *c = flash_banks; c; c = c->next) {
+		if (!flash_banks_share_sectors(bank, c))
+			continue;
+		bool *known = flash_known_erased(c, erased);
+		if (!known || last >= c->num_sectors)
+			continue;
+		for (unsigned int i = first; i <= last; i++)
+			known[i] = erased;
+	}
+}
+
+static void flash_set_known_unprotected(struct flash_bank *bank,
+		unsigned int first, unsigned int last, bool unprotected)
+{
+	for (struct flash_bank *c = flash_banks; c; c = c->next) {
+		if (!flash_banks_share_sectors(bank, c))
+			continue;
+		bool *known = flash_known_unprotected(c, unprotected);
+		if (!known || last >= c->num_known_unprotected)
+			continue;
+		for (unsigned int i = first; i <= last; i++)
+			known[i] = unprotected;
+	}
+}
+
+void flash_forget_state(struct flash_bank *bank)
+{
+	for (struct flash_bank *c = flash_banks; c; c = c->next) {
+		if (!flash_banks_share_sectors(bank, c))
+			continue;
+		free(c->known_erased);
+		c->known_erased = NULL;
+		c->num_known_erased = 0;
+		free(c->known_unprotected);
+		c->known_unprotected = NULL;
+		c->num_known_unprotected = 0;
+	}
+}
+
+/* Code running on any target, or a reset, may have changed any flash */
+static int flash_target_event(struct target *target, enum target_event event,
+		void *priv)
+{
+	switch (event) {
+	case TARGET_EVENT_HALTED:
+	case TARGET_EVENT_RESUMED:
+	case TARGET_EVENT_RESET_START:
+	case TARGET_EVENT_RESET_END:
+		if (flash_ops_active)
+			break;
+		for (struct flash_bank *c = flash_banks; c; c = c->next)
+			flash_forget_state(c);
+		break;
+	default:
+		break;
+	}
+
+	return ERROR_OK;
+}
 
 int flash_driver_erase(struct flash_bank *bank, unsigned int first,
 		unsigned int last)
 {
 	int retval;
 
+	flash_ops_active++;
 	retval = bank->driver->erase(bank, first, last);
+	flash_ops_active--;
+	/* a failed erase may have erased some of the sectors, or none */
+	flash_set_known_erased(bank, first, last, retval == ERROR_OK);
+	if (retval != ERROR_OK)
+		LOG_ERROR("failed erasing sectors %u to %u", first, last);
+
+	return retval;
+}
+
+int flash_driver_erase_start(struct flash_bank *bank, unsigned int first,
+		unsigned int last)
+{
+	int retval;
+
+	flash_ops_active++;
+	retval = bank->driver->erase_start(bank, first, last);
+	flash_ops_active--;
+	flash_set_known_erased(bank, first, last, retval == ERROR_OK);
 	if (retval != ERROR_OK)
 		LOG_ERROR("failed erasing sectors %u to %u", first, last);
 
@@ -86,19 +215,55 @@ int flash_driver_protect(struct flash_bank *bank, int set, unsigned int first,
 	 *
 	 * Drivers only receive valid protection block range.
 	 */
+	flash_ops_active++;
 	retval = bank->driver->protect(bank, set, first, last);
+	flash_ops_active--;
+	flash_set_known_unprotected(bank, first, last, !set && retval == ERROR_OK);
 	if (retval != ERROR_OK)
 		LOG_ERROR("failed setting protection for blocks %u to %u", first, last);
 
 	return retval;
 }
 
+/* Index of the first of the @a num_blocks blocks that ends after @a offset:
+ * the one containing it, or the next one if it's in a gap. @a num_blocks if
+ * there is none. Drivers lay sectors and protection blocks out in order of
+ * offset, so this can bisect banks with thousands of small sectors. */
+static unsigned int flash_block_after(const struct flash_sector *blocks,
+		unsigned int num_blocks, uint32_t offset)
+{
+	unsigned int low = 0;
+	unsigned int high = num_blocks;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+		if ((uint64_t)blocks[mid].offset + blocks[mid].size <= offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* The sectors of a write are no longer known to be erased */
+static void flash_forget_erased(struct flash_bank *bank, uint32_t offset, uint32_t count)
+{
+	for (unsigned int i = flash_block_after(bank->sectors, bank->num_sectors, offset);
+			i < bank->num_sectors && bank->sectors[i].offset < offset + count; i++)
+		flash_set_known_erased(bank, i, i, false);
+}
+
 int flash_driver_write(struct flash_bank *bank,
 	const uint8_t *buffer, uint32_t offset, uint32_t count)
 {
 	int retval;
 
+	flash_ops_active++;
 	retval = bank->driver->write(bank, buffer, offset, count);
+	flash_ops_active--;
+
+	flash_forget_erased(bank, offset, count);
+
 	if (retval != ERROR_OK) {
 		LOG_ERROR(
 			"error writing to flash at address " TARGET_ADDR_FMT
@@ -117,7 +282,9 @@ int flash_driver_read(struct flash_bank *bank,
 
 	LOG_DEBUG("call flash_driver_read()");
 
+	flash_ops_active++;
 	retval = bank->driver->read(bank, buffer, offset, count);
+	flash_ops_active--;
 	if (retval != ERROR_OK) {
 		LOG_ERROR(
 			"error reading to flash at address " TARGET_ADDR_FMT
@@ -140,8 +307,10 @@ int flash_driver_verify(struct flash_bank *bank,
 {
 	int retval;
 
+	flash_ops_active++;
 	retval = bank->driver->verify ? bank->driver->verify(bank, buffer, offset, count) :
 		default_flash_verify(bank, buffer, offset, count);
+	flash_ops_active--;
 	if (retval != ERROR_OK) {
 		LOG_ERROR("verify failed in bank at " TARGET_ADDR_FMT " starting at 0x%8.8" PRIx32,
 			bank->base, offset);
@@ -150,6 +319,22 @@ int flash_driver_verify(struct flash_bank *bank,
 	return retval;
 }
 
+int flash_driver_erase_check(struct flash_bank *bank)
+{
+	int retval;
+
+	flash_ops_active++;
+	retval = bank->driver->erase_check(bank);
+	flash_ops_active--;
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < bank->num_sectors; i++)
+		flash_set_known_erased(bank, i, i, bank->sectors[i].is_erased == 1);
+
+	return ERROR_OK;
+}
+
 int default_flash_verify(struct flash_bank *bank,
 	const uint8_t *buffer, uint32_t offset, uint32_t count)
 {
@@ -185,8 +370,10 @@ void flash_bank_add(struct flash_bank *bank)
 		}
 		p->next = bank;
 		bank_num += 1;
-	} else
+	} else {
 		flash_banks = bank;
+		target_register_event_callback(flash_target_event, NULL);
+	}
 
 	bank->bank_number = bank_num;
 }
@@ -226,6 +413,8 @@ void default_flash_free_driver_priv(struct flash_bank *bank)
 
 void flash_free_all_banks(void)
 {
+	flash_bank_last_hit = NULL;
+
 	struct flash_bank *bank = flash_banks;
 	while (bank) {
 		struct flash_bank *next = bank->next;
@@ -244,11 +433,14 @@ void flash_free_all_banks(void)
 			free(bank->prot_blocks);
 		}
 
+		free(bank->known_erased);
+		free(bank->known_unprotected);
 		free(bank->name);
 		free(bank);
 		bank = next;
 	}
 	flash_banks = NULL;
+	target_unregister_event_callback(flash_target_event, NULL);
 }
 
 struct flash_bank *get_flash_bank_by_name_noprobe(const char *name)
@@ -313,7 +505,23 @@ int get_flash_bank_by_addr(struct target *target,
 	bool check,
 	struct flash_bank **result_bank)
 {
-	struct flash_bank *c;
+	struct flash_bank *c = flash_bank_last_hit;
+
+	/* GDB memory writes and image sections tend to hit the same bank
+	 * over and over, try it before probing the others */
+	if (c && c->target == target &&
+			addr >= c->base && addr <= c->base + (c->size - 1)) {
+		int retval = c->driver->auto_probe(c);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("auto_probe failed");
+			return retval;
+		}
+		/* probing may have resized it */
+		if (addr >= c->base && addr <= c->base + (c->size - 1)) {
+			*result_bank = c;
+			return ERROR_OK;
+		}
+	}
 
 	/* cycle through bank list */
 	for (c = flash_banks; c; c = c->next) {
@@ -329,6 +537,7 @@ int get_flash_bank_by_addr(struct target *target,
 		}
 		/* check whether address belongs to this flash bank */
 		if ((addr >= c->base) && (addr <= c->base + (c->size - 1))) {
+			flash_bank_last_hit = c;
 			*result_bank = c;
 			return ERROR_OK;
 		}
@@ -504,7 +713,8 @@ static int flash_iterate_address_range_inner(struct target *target,
 		num_blocks = c->num_sectors;
 	}
 
-	for (i = 0; i < num_blocks; i++) {
+	/* blocks ending before addr can be neither first nor last */
+	for (i = flash_block_after(block_array, num_blocks, addr - c->base); i < num_blocks; i++) {
 		struct flash_sector *f = &block_array[i];
 		target_addr_t sector_addr = c->base + f->offset;
 		target_addr_t sector_last_addr = sector_addr + f->size - 1;
@@ -624,9 +834,65 @@ int flash_erase_address_range(struct target *target,
 		addr, length, false, &flash_driver_erase);
 }
 
+/* Erase the sectors from first to last that aren't known to be erased
+ * already, in as few calls to @a erase as possible. */
+static int flash_erase_unknown(struct flash_bank *bank, unsigned int first,
+		unsigned int last,
+		int (*erase)(struct flash_bank *bank, unsigned int first,
+			unsigned int last))
+{
+	const bool *known = flash_known_erased(bank, false);
+
+	for (unsigned int i = first; i <= last; i++) {
+		if (known && known[i])
+			continue;
+
+		unsigned int end = i;
+		while (end < last && !(known && known[end + 1]))
+			end++;
+		if (i != first || end != last)
+			LOG_DEBUG("erasing sectors %u to %u, the rest of %u to %u are erased",
+				i, end, first, last);
+
+		int retval = erase(bank, i, end);
+		if (retval != ERROR_OK)
+			return retval;
+		/* erasing may have reallocated the array */
+		known = flash_known_erased(bank, false);
+		i = end;
+	}
+
+	return ERROR_OK;
+}
+
+static int flash_driver_erase_unknown(struct flash_bank *bank,
+		unsigned int first, unsigned int last)
+{
+	return flash_erase_unknown(bank, first, last, &flash_driver_erase);
+}
+
+/* Like flash_erase_address_range() with padding, but skips the sectors
+ * already known to be erased. */
+static int flash_erase_unknown_address_range(struct target *target,
+		target_addr_t addr, uint32_t length)
+{
+	return flash_iterate_address_range(target, "erase",
+		addr, length, false, &flash_driver_erase_unknown);
+}
+
 static int flash_driver_unprotect(struct flash_bank *bank, unsigned int first,
 		unsigned int last)
 {
+	const bool *known = flash_known_unprotected(bank, false);
+	unsigned int i = first;
+
+	while (known && i <= last && known[i])
+		i++;
+	if (i > last) {
+		LOG_DEBUG("blocks %u to %u are already unprotected", first, last);
+		return ERROR_OK;
+	}
+
 	return flash_driver_protect(bank, 0, first, last);
 }
 
@@ -667,12 +933,12 @@ target_addr_t flash_write_align_start(struct flash_bank *bank, target_addr_t add
 	if (bank->write_start_alignment == FLASH_WRITE_ALIGN_SECTOR) {
 		uint32_t offset = addr - bank->base;
 		uint32_t aligned = 0;
-		for (unsigned int sect = 0; sect < bank->num_sectors; sect++) {
-			if (bank->sectors[sect].offset > offset)
-				break;
-
+		/* start of the last sector starting at or before offset */
+		unsigned int sect = flash_block_after(bank->sectors, bank->num_sectors, offset);
+		if (sect < bank->num_sectors && bank->sectors[sect].offset <= offset)
 			aligned = bank->sectors[sect].offset;
-		}
+		else if (sect > 0)
+			aligned = bank->sectors[sect - 1].offset;
 		return bank->base + aligned;
 	}
 
@@ -691,11 +957,12 @@ target_addr_t flash_write_align_end(struct flash_bank *bank, target_addr_t addr)
 	if (bank->write_end_alignment == FLASH_WRITE_ALIGN_SECTOR) {
 		uint32_t offset = addr - bank->base;
 		uint32_t aligned = 0;
-		for (unsigned int sect = 0; sect < bank->num_sectors; sect++) {
+		/* end of the first sector ending at or after offset */
+		unsigned int sect = flash_block_after(bank->sectors, bank->num_sectors, offset);
+		if (sect == bank->num_sectors && sect > 0)
+			sect--;
+		if (sect < bank->num_sectors)
 			aligned = bank->sectors[sect].offset + bank->sectors[sect].size - 1;
-			if (aligned >= offset)
-				break;
-		}
 		return bank->base + aligned;
 	}
 
@@ -714,13 +981,11 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 		return false;
 
 	if (bank->minimal_write_gap == FLASH_WRITE_GAP_SECTOR) {
-		unsigned int sect;
 		uint32_t offset1 = addr1 - bank->base;
 		/* find the sector following the one containing addr1 */
-		for (sect = 0; sect < bank->num_sectors; sect++) {
-			if (bank->sectors[sect].offset > offset1)
-				break;
-		}
+		unsigned int sect = flash_block_after(bank->sectors, bank->num_sectors, offset1);
+		if (sect < bank->num_sectors && bank->sectors[sect].offset <= offset1)
+			sect++;
 		if (sect >= bank->num_sectors)
 			return false;
 
@@ -734,8 +999,172 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 }
 
 
+/* Erase (if asked to) and write the sectors of a run that don't already
+ * hold the image. */
+static int flash_write_run_incremental(struct target *target,
+		struct flash_bank *c, const uint8_t *buffer, target_addr_t run_address,
+		uint32_t run_size, bool erase, uint32_t *written)
+{
+	uint32_t run_offset = run_address - c->base;
+	uint32_t run_end = run_offset + run_size;
+
+	for (unsigned int sector = flash_block_after(c->sectors, c->num_sectors, run_offset);
+			sector < c->num_sectors && c->sectors[sector].offset < run_end; sector++) {
+		uint32_t start = MAX(c->sectors[sector].offset, run_offset);
+		uint32_t end = MIN(c->sectors[sector].offset + c->sectors[sector].size,
+				run_end);
+		if (start >= end)
+			continue;
+
+		const uint8_t *data = buffer + (start - run_offset);
+		if (target_memory_matches(target, c->base + start, end - start, data))
+			continue;
+
+		int retval = ERROR_OK;
+		if (erase)
+			retval = flash_erase_unknown_address_range(target, c->base + start,
+					end - start);
+		if (retval == ERROR_OK)
+			retval = flash_driver_write(c, data, start, end - start);
+		if (retval != ERROR_OK)
+			return retval;
+
+		if (written)
+			*written += end - start;
+	}
+
+	return ERROR_OK;
+}
+
+/* A run of an image write held back by flash_write_run_paired() */
+struct flash_run {
+	struct flash_bank *bank;
+	uint8_t *buffer;
+	target_addr_t address;
+	uint32_t size;
+};
+
+/* Write and verify @a run, then free its buffer */
+static int flash_write_run_held(struct flash_run *run, bool verify)
+{
+	int retval = flash_driver_write(run->bank, run->buffer,
+			run->address - run->bank->base, run->size);
+	if (retval == ERROR_OK && verify)
+		retval = flash_driver_verify(run->bank, run->buffer,
+				run->address - run->bank->base, run->size);
+
+	free(run->buffer);
+	run->buffer = NULL;
+	return retval;
+}
+
+/* For drivers with write_pair: hold the (erased) run back until there is a
+ * run on another bank of the driver to program it together with. Takes
+ * over @a buffer. A run still held at the end is written by the caller
+ * with flash_write_run_held(). */
+static int flash_write_run_paired(struct flash_run *held, struct flash_bank *c,
+		uint8_t *buffer, target_addr_t run_address, uint32_t run_size, bool verify)
+{
+	struct flash_run run = {
+		.bank = c,
+		.buffer = buffer,
+		.address = run_address,
+		.size = run_size,
+	};
+	int retval;
+
+	if (held->buffer && held->bank != c && held->bank->driver == c->driver) {
+		uint32_t offset0 = held->address - held->bank->base;
+		uint32_t offset1 = run_address - c->base;
+
+		flash_ops_active++;
+		retval = c->driver->write_pair(held->bank, held->buffer, offset0, held->size,
+				c, buffer, offset1, run_size);
+		flash_ops_active--;
+
+		if (retval != ERROR_FLASH_OPER_UNSUPPORTED) {
+			flash_forget_erased(held->bank, offset0, held->size);
+			flash_forget_erased(c, offset1, run_size);
+			if (retval != ERROR_OK)
+				LOG_ERROR("error writing to flash banks %s and %s",
+						held->bank->name, c->name);
+
+			if (retval == ERROR_OK && verify)
+				retval = flash_driver_verify(held->bank, held->buffer, offset0, held->size);
+			if (retval == ERROR_OK && verify)
+				retval = flash_driver_verify(c, buffer, offset1, run_size);
+
+			free(held->buffer);
+			held->buffer = NULL;
+			free(buffer);
+			return retval;
+		}
+	}
+
+	if (held->buffer) {
+		retval = flash_write_run_held(held, verify);
+		if (retval != ERROR_OK) {
+			free(buffer);
+			return retval;
+		}
+	}
+
+	*held = run;
+	return ERROR_OK;
+}
+
+/* Sectors the pipelined write erases with one erase_start() call */
+#define FLASH_PIPELINE_CHUNK	0x10000
+
+/* Erase, write and verify a run a chunk at a time. Each erase is only
+ * started, so the flash erases while the driver sends the chunk's data to
+ * the target instead of the link idling through the erase. Chunks are
+ * whole sectors up to the next FLASH_PIPELINE_CHUNK boundary, so drivers
+ * with small sectors can still erase them with larger blocks. */
+static int flash_write_run_pipelined(struct target *target,
+		struct flash_bank *c, const uint8_t *buffer, target_addr_t run_address,
+		uint32_t run_size, bool verify)
+{
+	uint32_t run_offset = run_address - c->base;
+	uint32_t run_end = run_offset + run_size;
+
+	for (unsigned int sector = flash_block_after(c->sectors, c->num_sectors, run_offset);
+			sector < c->num_sectors; sector++) {
+		uint32_t sector_start = c->sectors[sector].offset;
+		uint32_t sector_end = sector_start + c->sectors[sector].size;
+		uint32_t start = MAX(sector_start, run_offset);
+		uint32_t end = MIN(sector_end, run_end);
+		if (start >= end)
+			continue;
+
+		const uint8_t *data = buffer + (start - run_offset);
+		int retval;
+		if (start == sector_start && end == sector_end) {
+			unsigned int first = sector;
+			while (sector + 1 < c->num_sectors &&
+					c->sectors[sector + 1].offset % FLASH_PIPELINE_CHUNK &&
+					c->sectors[sector + 1].offset + c->sectors[sector + 1].size <= run_end)
+				sector++;
+			end = c->sectors[sector].offset + c->sectors[sector].size;
+			retval = flash_erase_unknown(c, first, sector,
+					&flash_driver_erase_start);
+		} else	/* let the usual checks warn about erasing beyond the run */
+			retval = flash_erase_unknown_address_range(target, c->base + start,
+					end - start);
+		if (retval == ERROR_OK)
+			retval = flash_driver_write(c, data, start, end - start);
+		if (retval == ERROR_OK && verify)
+			retval = flash_driver_verify(c, data, start, end - start);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
 int flash_write_unlock_verify(struct target *target, struct image *image,
-	uint32_t *written, bool erase, bool unlock, bool write, bool verify)
+	uint32_t *written, bool erase, bool unlock, bool write, bool verify,
+	bool incremental)
 {
 	int retval = ERROR_OK;
 
@@ -743,6 +1172,7 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 	uint32_t section_offset;
 	struct flash_bank *c;
 	int *padding;
+	struct flash_run held = { .buffer = NULL };
 
 	section = 0;
 	section_offset = 0;
@@ -750,6 +1180,9 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 	if (written)
 		*written = 0;
 
+	/* checksums and blank checks run algorithms on the target too */
+	flash_ops_active++;
+
 	if (erase) {
 		/* assume all sectors need erasing - stops any problems
 		 * when flash_write is called multiple times */
@@ -889,12 +1322,12 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 			uint32_t offset_end = offset_start + run_size;
 			uint32_t end = offset_end, delta;
 
-			for (unsigned int sector = 0; sector < c->num_sectors; sector++) {
-				end = c->sectors[sector].offset
-					+ c->sectors[sector].size;
-				if (offset_end <= end)
-					break;
-			}
+			unsigned int sector = flash_block_after(c->sectors, c->num_sectors,
+					offset_end - 1);
+			if (sector == c->num_sectors && sector > 0)
+				sector--;
+			if (sector < c->num_sectors)
+				end = c->sectors[sector].offset + c->sectors[sector].size;
 
 			delta = end - offset_end;
 			padding[section_last] += delta;
@@ -957,26 +1390,43 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 		}
 
 		retval = ERROR_OK;
+		bool verified = false;
 
 		if (unlock)
 			retval = flash_unlock_address_range(target, run_address, run_size);
-		if (retval == ERROR_OK) {
-			if (erase) {
-				/* calculate and erase sectors */
-				retval = flash_erase_address_range(target,
-						true, run_address, run_size);
+		if (retval == ERROR_OK && write && incremental) {
+			/* only touch the sectors that differ */
+			retval = flash_write_run_incremental(target, c, buffer,
+					run_address, run_size, erase, written);
+		} else if (retval == ERROR_OK && write && erase && c->driver->erase_start) {
+			retval = flash_write_run_pipelined(target, c, buffer,
+					run_address, run_size, verify);
+			verified = true;
+		} else {
+			if (retval == ERROR_OK) {
+				if (erase) {
+					/* calculate and erase sectors */
+					retval = flash_erase_unknown_address_range(target,
+							run_address, run_size);
+				}
 			}
-		}
 
-		if (retval == ERROR_OK) {
-			if (write) {
-				/* write flash sectors */
-				retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+			if (retval == ERROR_OK && write && c->driver->write_pair) {
+				/* maybe program it together with a run on another bank */
+				retval = flash_write_run_paired(&held, c, buffer,
+						run_address, run_size, verify);
+				buffer = NULL;
+				verified = true;
+			} else if (retval == ERROR_OK) {
+				if (write) {
+					/* write flash sectors */
+					retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+				}
 			}
 		}
 
 		if (retval == ERROR_OK) {
-			if (verify) {
+			if (verify && !verified) {
 				/* verify flash sectors */
 				retval = flash_driver_verify(c, buffer, run_address - c->base, run_size);
 			}
@@ -989,13 +1439,18 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 			goto done;
 		}
 
-		if (written != NULL)
+		if (written != NULL && !(write && incremental))
 			*written += run_size;	/* add run size to total written counter */
 	}
 
+	if (held.buffer)
+		retval = flash_write_run_held(&held, verify);
+
 done:
+	free(held.buffer);
 	free(sections);
 	free(padding);
+	flash_ops_active--;
 
 	return retval;
 }
@@ -1003,7 +1458,8 @@ done:
 int flash_write(struct target *target, struct image *image,
 	uint32_t *written, bool erase)
 {
-	return flash_write_unlock_verify(target, image, written, erase, false, true, false);
+	return flash_write_unlock_verify(target, image, written, erase, false, true, false,
+			false);
 }
 
 struct flash_sector *alloc_block_array(uint32_t offset, uint32_t size,
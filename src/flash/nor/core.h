@@ -138,6 +138,23 @@ struct flash_bank {
 	/** Array of protection blocks, allocated and initialized by the flash driver */
 	struct flash_sector *prot_blocks;
 
+	/**
+	 * Sectors the core itself erased or found blank since the target
+	 * last ran or was reset, so writes can skip erasing them. Unlike
+	 * flash_sector::is_erased this is kept up to date by every erase and
+	 * write done through the core. Ignored unless num_known_erased
+	 * matches num_sectors.
+	 */
+	bool *known_erased;
+	unsigned int num_known_erased;
+	/**
+	 * Protection blocks the core unprotected since the target last ran or
+	 * was reset, so writes can skip unprotecting them again. Ignored
+	 * unless num_known_unprotected matches the number of protection blocks.
+	 */
+	bool *known_unprotected;
+	unsigned int num_known_unprotected;
+
 	struct flash_bank *next; /**< The next flash bank on this chip */
 };
 
@@ -107,6 +107,22 @@ struct flash_driver {
 	int (*erase)(struct flash_bank *bank, unsigned int first,
 		unsigned int last);
 
+	/**
+	 * Start erasing a range of sectors, but return as soon as the erase
+	 * of the last one is under way (optional).
+	 *
+	 * flash_write_unlock_verify() uses this to transfer a sector's data
+	 * to the target while the flash is still erasing it. The driver's
+	 * next erase or write must wait for the pending erase to finish.
+	 *
+	 * @param bank The bank of flash to be erased.
+	 * @param first The number of the first sector to erase.
+	 * @param last The number of the last sector to erase.
+	 * @returns ERROR_OK if the erase was started; otherwise, an error code.
+	 */
+	int (*erase_start)(struct flash_bank *bank, unsigned int first,
+		unsigned int last);
+
 	/**
 	 * Bank/sector protection routine (target-specific).
 	 *
@@ -141,6 +157,23 @@ struct flash_driver {
 	int (*write)(struct flash_bank *bank,
 			const uint8_t *buffer, uint32_t offset, uint32_t count);
 
+	/**
+	 * Program data into two banks of the same chip at the same time, for
+	 * banks with independent controllers (optional). Otherwise like
+	 * write, for each bank.
+	 *
+	 * flash_write_unlock_verify() pairs up runs of an image that fall
+	 * into different banks of the driver.
+	 *
+	 * @returns ERROR_FLASH_OPER_UNSUPPORTED if these banks can't be
+	 * programmed together, before programming either; the caller then
+	 * writes one after the other.
+	 */
+	int (*write_pair)(struct flash_bank *bank0, const uint8_t *buffer0,
+			uint32_t offset0, uint32_t count0,
+			struct flash_bank *bank1, const uint8_t *buffer1,
+			uint32_t offset1, uint32_t count1);
+
 	/**
 	 * Read data from the flash. Note CPU address will be
 	 * "bank->base + offset", while the physical address is
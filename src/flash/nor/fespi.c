@@ -39,6 +39,7 @@
 
 #include "imp.h"
 #include "spi.h"
+#include "sfdp.h"
 #include <jtag/jtag.h>
 #include <helper/time_support.h>
 #include <target/algorithm.h>
@@ -115,16 +116,34 @@
 #define FESPI_ENDIAN_LSB          1
 
 
+/* 1-1-4 fast read: single bit command and address, 8 dummy clocks, data on
+ * four lines. Virtually all quad capable parts implement it this way. */
+#define SPIFLASH_QUAD_OUTPUT_READ 0x6b
+#define FESPI_QUAD_READ_FFMT \
+	(FESPI_INSN_CMD_EN | FESPI_INSN_ADDR_LEN(3) | FESPI_INSN_PAD_CNT(8) | \
+	 FESPI_INSN_CMD_PROTO(FESPI_PROTO_S) | FESPI_INSN_ADDR_PROTO(FESPI_PROTO_S) | \
+	 FESPI_INSN_DATA_PROTO(FESPI_PROTO_Q) | \
+	 FESPI_INSN_CMD_CODE(SPIFLASH_QUAD_OUTPUT_READ) | FESPI_INSN_PAD_CODE(0))
+
 /* Timeout in ms */
 #define FESPI_CMD_TIMEOUT   (100)
 #define FESPI_PROBE_TIMEOUT (100)
 #define FESPI_MAX_TIMEOUT  (3000)
 
 
+enum fespi_quad_read {
+	FESPI_QUAD_UNKNOWN,	/* not tried yet, or only on blank data */
+	FESPI_QUAD_OK,		/* a quad read returned data that needs IO2/IO3 */
+	FESPI_QUAD_NONE,	/* not supported, or the flash's QE bit isn't set */
+};
+
 struct fespi_flash_bank {
 	bool probed;
 	target_addr_t ctrl_base;
 	const struct flash_device *dev;
+	struct flash_device device;	/* table entry completed from SFDP */
+	bool erase_pending;	/* fespi_erase_start() didn't wait for the last erase */
+	enum fespi_quad_read quad_read;
 };
 
 struct fespi_target {
@@ -158,6 +177,8 @@ FLASH_BANK_COMMAND_HANDLER(fespi_flash_bank_command)
 
 	bank->driver_priv = fespi_info;
 	fespi_info->probed = false;
+	fespi_info->erase_pending = false;
+	fespi_info->quad_read = FESPI_QUAD_NONE;
 	fespi_info->ctrl_base = 0;
 	if (CMD_ARGC >= 7) {
 		COMMAND_PARSE_ADDRESS(CMD_ARGV[6], fespi_info->ctrl_base);
@@ -319,11 +340,33 @@ static int fespi_wip(struct flash_bank *bank, int timeout)
 	return ERROR_FAIL;
 }
 
-static int fespi_erase_sector(struct flash_bank *bank, int sector)
+/* Wait for the flash to be idle. Only allow for a sector erase when one may
+ * still be running, otherwise the flash should be idle almost right away. */
+static int fespi_wait_idle(struct flash_bank *bank)
+{
+	struct fespi_flash_bank *fespi_info = bank->driver_priv;
+	int timeout = fespi_info->erase_pending ? FESPI_MAX_TIMEOUT : FESPI_PROBE_TIMEOUT;
+
+	fespi_info->erase_pending = false;
+	return fespi_wip(bank, timeout);
+}
+
+/* Instruction to send, with the 4-byte address variant on large devices */
+static uint8_t fespi_cmd(struct flash_bank *bank, uint8_t cmd)
+{
+	return bank->size > 0x1000000 ? spi_4byte_cmd(cmd) : cmd;
+}
+
+/* Start erasing one block and leave it erasing, for spi_erase_range() */
+static int fespi_erase_block(struct flash_bank *bank, uint8_t cmd, uint32_t offset)
 {
 	struct fespi_flash_bank *fespi_info = bank->driver_priv;
 	int retval;
 
+	retval = fespi_wait_idle(bank);
+	if (retval != ERROR_OK)
+		return retval;
+
 	retval = fespi_tx(bank, SPIFLASH_WRITE_ENABLE);
 	if (retval != ERROR_OK)
 		return retval;
@@ -333,22 +376,21 @@ static int fespi_erase_sector(struct flash_bank *bank, int sector)
 
 	if (fespi_write_reg(bank, FESPI_REG_CSMODE, FESPI_CSMODE_HOLD) != ERROR_OK)
 		return ERROR_FAIL;
-	retval = fespi_tx(bank, fespi_info->dev->erase_cmd);
+	retval = fespi_tx(bank, cmd);
 	if (retval != ERROR_OK)
 		return retval;
-	sector = bank->sectors[sector].offset;
 	if (bank->size > 0x1000000) {
-		retval = fespi_tx(bank, sector >> 24);
+		retval = fespi_tx(bank, offset >> 24);
 		if (retval != ERROR_OK)
 			return retval;
 	}
-	retval = fespi_tx(bank, sector >> 16);
+	retval = fespi_tx(bank, offset >> 16);
 	if (retval != ERROR_OK)
 		return retval;
-	retval = fespi_tx(bank, sector >> 8);
+	retval = fespi_tx(bank, offset >> 8);
 	if (retval != ERROR_OK)
 		return retval;
-	retval = fespi_tx(bank, sector);
+	retval = fespi_tx(bank, offset);
 	if (retval != ERROR_OK)
 		return retval;
 	retval = fespi_txwm_wait(bank);
@@ -357,15 +399,12 @@ static int fespi_erase_sector(struct flash_bank *bank, int sector)
 	if (fespi_write_reg(bank, FESPI_REG_CSMODE, FESPI_CSMODE_AUTO) != ERROR_OK)
 		return ERROR_FAIL;
 
-	retval = fespi_wip(bank, FESPI_MAX_TIMEOUT);
-	if (retval != ERROR_OK)
-		return retval;
-
+	fespi_info->erase_pending = true;
 	return ERROR_OK;
 }
 
-static int fespi_erase(struct flash_bank *bank, unsigned int first,
-		unsigned int last)
+static int fespi_erase_sectors(struct flash_bank *bank, unsigned int first,
+		unsigned int last, bool wait)
 {
 	struct target *target = bank->target;
 	struct fespi_flash_bank *fespi_info = bank->driver_priv;
@@ -411,16 +450,17 @@ static int fespi_erase(struct flash_bank *bank, unsigned int first,
 		return ERROR_FAIL;
 
 	/* poll WIP */
-	retval = fespi_wip(bank, FESPI_PROBE_TIMEOUT);
+	retval = fespi_wait_idle(bank);
 	if (retval != ERROR_OK)
 		goto done;
 
-	for (unsigned int sector = first; sector <= last; sector++) {
-		retval = fespi_erase_sector(bank, sector);
-		if (retval != ERROR_OK)
-			goto done;
-		keep_alive();
-	}
+	/* sectors are the smallest erase size, larger blocks are used where
+	 * the range covers them */
+	retval = spi_erase_range(bank, fespi_info->dev, bank->sectors[first].offset,
+			bank->sectors[last].offset + bank->sectors[last].size,
+			bank->size > 0x1000000, fespi_erase_block);
+	if (retval == ERROR_OK && wait)
+		retval = fespi_wait_idle(bank);
 
 	/* Switch to HW mode before return to prompt */
 done:
@@ -429,6 +469,20 @@ done:
 	return retval;
 }
 
+static int fespi_erase(struct flash_bank *bank, unsigned int first,
+		unsigned int last)
+{
+	return fespi_erase_sectors(bank, first, last, true);
+}
+
+/* Leave the last block erasing; fespi_write() sends its data to the
+ * working area before waiting for the erase to finish. */
+static int fespi_erase_start(struct flash_bank *bank, unsigned int first,
+		unsigned int last)
+{
+	return fespi_erase_sectors(bank, first, last, false);
+}
+
 static int fespi_protect(struct flash_bank *bank, int set,
 		unsigned int first, unsigned int last)
 {
@@ -453,7 +507,7 @@ static int slow_fespi_write_buffer(struct flash_bank *bank,
 	if (fespi_write_reg(bank, FESPI_REG_CSMODE, FESPI_CSMODE_HOLD) != ERROR_OK)
 		return ERROR_FAIL;
 
-	if (fespi_tx(bank, fespi_info->dev->pprog_cmd) != ERROR_OK)
+	if (fespi_tx(bank, fespi_cmd(bank, fespi_info->dev->pprog_cmd)) != ERROR_OK)
 		return ERROR_FAIL;
 
 	if (bank->size > 0x1000000 && fespi_tx(bank, offset >> 24) != ERROR_OK)
@@ -489,6 +543,116 @@ static const uint8_t riscv64_bin[] = {
 #include "../../../contrib/loaders/flash/fespi/riscv64_fespi.inc"
 };
 
+static const uint8_t riscv32_async_bin[] = {
+#include "../../../contrib/loaders/flash/fespi/riscv32_fespi_async.inc"
+};
+
+static const uint8_t riscv64_async_bin[] = {
+#include "../../../contrib/loaders/flash/fespi/riscv64_fespi_async.inc"
+};
+
+/* Stream the whole write through a ring buffer while the loader programs
+ * page after page, so the SPI bus doesn't idle for a debugger round trip
+ * between chunks. Returns ERROR_TARGET_RESOURCE_NOT_AVAILABLE when the
+ * target can't do this, in which case the caller uses the resident loader. */
+static int fespi_write_async(struct flash_bank *bank, const uint8_t *buffer,
+		uint32_t offset, uint32_t count, uint32_t page_size)
+{
+	struct target *target = bank->target;
+	struct fespi_flash_bank *fespi_info = bank->driver_priv;
+	struct working_area *algorithm_wa;
+	struct working_area *fifo_wa;
+	uint32_t fifo_size = 16384;
+	int retval;
+
+	if (!riscv_can_access_memory_running(target, 4))
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	int xlen = riscv_xlen(target);
+	const uint8_t *bin;
+	size_t bin_size;
+	if (xlen == 32) {
+		bin = riscv32_async_bin;
+		bin_size = sizeof(riscv32_async_bin);
+	} else {
+		bin = riscv64_async_bin;
+		bin_size = sizeof(riscv64_async_bin);
+	}
+
+	if (target_alloc_working_area(target, bin_size, &algorithm_wa) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	/* No point in a fifo much bigger than the data itself. */
+	while (fifo_size / 2 >= count + 8 && fifo_size > 256)
+		fifo_size /= 2;
+	while (target_alloc_working_area_try(target, fifo_size, &fifo_wa) != ERROR_OK) {
+		fifo_size /= 2;
+		if (fifo_size < 256) {
+			target_free_working_area(target, algorithm_wa);
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		}
+	}
+
+	/* The fifo pointers are 32 bits wide. */
+	if (fifo_wa->address + fifo_wa->size > UINT32_MAX) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto out;
+	}
+
+	retval = target_write_buffer(target, algorithm_wa->address, bin_size, bin);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Failed to write code to " TARGET_ADDR_FMT ": %d",
+				algorithm_wa->address, retval);
+		goto out;
+	}
+
+	struct reg_param reg_params[6];
+	init_reg_param(&reg_params[0], "a0", xlen, PARAM_IN_OUT);	/* ctrl base (in), status (out) */
+	init_reg_param(&reg_params[1], "a1", xlen, PARAM_OUT);	/* count */
+	init_reg_param(&reg_params[2], "a2", xlen, PARAM_OUT);	/* fifo start */
+	init_reg_param(&reg_params[3], "a3", xlen, PARAM_OUT);	/* fifo end */
+	init_reg_param(&reg_params[4], "a4", xlen, PARAM_OUT);	/* flash offset */
+	init_reg_param(&reg_params[5], "a5", xlen, PARAM_OUT);	/* command, flags, page size */
+
+	buf_set_u64(reg_params[0].value, 0, xlen, fespi_info->ctrl_base);
+	buf_set_u64(reg_params[1].value, 0, xlen, count);
+	buf_set_u64(reg_params[2].value, 0, xlen, fifo_wa->address);
+	buf_set_u64(reg_params[3].value, 0, xlen, fifo_wa->address + fifo_wa->size);
+	buf_set_u64(reg_params[4].value, 0, xlen, offset);
+	buf_set_u64(reg_params[5].value, 0, xlen, fespi_cmd(bank, fespi_info->dev->pprog_cmd) |
+			(bank->size > 0x1000000 ? 0x100 : 0) | page_size << 16);
+
+	/* The loader polls WIP for long enough to wait out a pending erase. */
+	fespi_info->erase_pending = false;
+
+	retval = target_run_flash_async_algorithm(target, buffer, count, 1,
+			0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			fifo_wa->address, fifo_wa->size,
+			algorithm_wa->address, 0,
+			NULL);
+
+	if (retval == ERROR_OK) {
+		uint64_t algorithm_result = buf_get_u64(reg_params[0].value, 0, xlen);
+		if (algorithm_result != 0) {
+			LOG_ERROR("Algorithm returned error %" PRIu64, algorithm_result);
+			retval = ERROR_FLASH_OPERATION_FAILED;
+		}
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	/* The loader restores hardware mode itself unless it was stopped. */
+	if (retval != ERROR_OK)
+		fespi_enable_hw_mode(bank);
+
+out:
+	target_free_working_area(target, fifo_wa);
+	target_free_working_area(target, algorithm_wa);
+	return retval;
+}
+
 static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 		uint32_t offset, uint32_t count)
 {
@@ -523,6 +687,15 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 		}
 	}
 
+	/* If no valid page_size, use reasonable default. */
+	page_size = fespi_info->dev->pagesize ?
+		fespi_info->dev->pagesize : SPIFLASH_DEF_PAGESIZE;
+
+	retval = fespi_write_async(bank, buffer, offset, count, page_size);
+	if (retval != ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+		return retval;
+	retval = ERROR_OK;
+
 	int xlen = riscv_xlen(target);
 	struct working_area *algorithm_wa = NULL;
 	struct working_area *data_wa = NULL;
@@ -567,11 +740,12 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 		algorithm_wa = NULL;
 	}
 
-	/* If no valid page_size, use reasonable default. */
-	page_size = fespi_info->dev->pagesize ?
-		fespi_info->dev->pagesize : SPIFLASH_DEF_PAGESIZE;
-
+	struct riscv_resident_algorithm resident = { 0 };
 	if (algorithm_wa) {
+		retval = riscv_resident_algorithm_begin(target, &resident);
+		if (retval != ERROR_OK)
+			goto err;
+
 		struct reg_param reg_params[6];
 		init_reg_param(&reg_params[0], "a0", xlen, PARAM_IN_OUT);
 		init_reg_param(&reg_params[1], "a1", xlen, PARAM_OUT);
@@ -588,7 +762,8 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 			buf_set_u64(reg_params[3].value, 0, xlen, offset);
 			buf_set_u64(reg_params[4].value, 0, xlen, cur_count);
 			buf_set_u64(reg_params[5].value, 0, xlen,
-					fespi_info->dev->pprog_cmd | (bank->size > 0x1000000 ? 0x100 : 0));
+					fespi_cmd(bank, fespi_info->dev->pprog_cmd) |
+					(bank->size > 0x1000000 ? 0x100 : 0));
 
 			retval = target_write_buffer(target, data_wa->address, cur_count,
 					buffer);
@@ -598,14 +773,26 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 				goto err;
 			}
 
+			if (fespi_info->erase_pending) {
+				/* The algorithm only polls WIP briefly, so wait out the
+				 * erase here, now that the data has been transferred. */
+				if (fespi_disable_hw_mode(bank) != ERROR_OK) {
+					retval = ERROR_FAIL;
+					goto err;
+				}
+				retval = fespi_wait_idle(bank);
+				if (retval != ERROR_OK)
+					goto err;
+			}
+
 			LOG_DEBUG("write(ctrl_base=0x%" TARGET_PRIxADDR ", page_size=0x%x, "
 					"address=0x%" TARGET_PRIxADDR ", offset=0x%" PRIx32
 					", count=0x%" PRIx32 "), buffer=%02x %02x %02x %02x %02x %02x ..." PRIx32,
 					fespi_info->ctrl_base, page_size, data_wa->address, offset, cur_count,
 					buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5]);
-			retval = target_run_algorithm(target, 0, NULL,
+			retval = riscv_resident_algorithm_run(target, &resident,
 					ARRAY_SIZE(reg_params), reg_params,
-					algorithm_wa->address, 0, cur_count * 2, NULL);
+					algorithm_wa->address, 0, cur_count * 2);
 			if (retval != ERROR_OK) {
 				LOG_ERROR("Failed to execute algorithm at " TARGET_ADDR_FMT ": %d",
 						algorithm_wa->address, retval);
@@ -624,8 +811,11 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 			count -= cur_count;
 		}
 
+		retval = riscv_resident_algorithm_end(target, &resident);
 		target_free_working_area(target, data_wa);
 		target_free_working_area(target, algorithm_wa);
+		if (retval != ERROR_OK)
+			return retval;
 
 	} else {
 		fespi_txwm_wait(bank);
@@ -635,7 +825,7 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 			return ERROR_FAIL;
 
 		/* poll WIP */
-		retval = fespi_wip(bank, FESPI_PROBE_TIMEOUT);
+		retval = fespi_wait_idle(bank);
 		if (retval != ERROR_OK)
 			goto err;
 
@@ -667,6 +857,7 @@ static int fespi_write(struct flash_bank *bank, const uint8_t *buffer,
 
 err:
 	if (algorithm_wa) {
+		riscv_resident_algorithm_end(target, &resident);
 		target_free_working_area(target, data_wa);
 		target_free_working_area(target, algorithm_wa);
 	}
@@ -678,6 +869,90 @@ err:
 	return retval;
 }
 
+/* Switch the memory mapped window to quad reads, returning the format to
+ * restore afterwards. */
+static int fespi_quad_read_begin(struct flash_bank *bank, uint32_t *ffmt)
+{
+	if (fespi_read_reg(bank, ffmt, FESPI_REG_FFMT) != ERROR_OK)
+		return ERROR_FAIL;
+	return fespi_write_reg(bank, FESPI_REG_FFMT, FESPI_QUAD_READ_FFMT);
+}
+
+static int fespi_quad_read_end(struct flash_bank *bank, uint32_t ffmt)
+{
+	return fespi_write_reg(bank, FESPI_REG_FFMT, ffmt);
+}
+
+static int fespi_read(struct flash_bank *bank, uint8_t *buffer,
+		uint32_t offset, uint32_t count)
+{
+	struct fespi_flash_bank *fespi_info = bank->driver_priv;
+	uint32_t ffmt;
+	int retval;
+
+	if (fespi_info->quad_read != FESPI_QUAD_OK)
+		return default_flash_read(bank, buffer, offset, count);
+
+	retval = fespi_quad_read_begin(bank, &ffmt);
+	if (retval != ERROR_OK)
+		return retval;
+	retval = default_flash_read(bank, buffer, offset, count);
+	if (fespi_quad_read_end(bank, ffmt) != ERROR_OK)
+		return ERROR_FAIL;
+
+	return retval;
+}
+
+/* True if reading @a buffer in quad mode depends on the flash driving
+ * IO2/IO3; undriven lines are pulled up and read back as ones. */
+static bool fespi_needs_io23(const uint8_t *buffer, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+		if ((buffer[i] & 0xcc) != 0xcc)
+			return true;
+	return false;
+}
+
+/* Verify through the memory mapped window, so the target computes the CRC,
+ * reading the flash in quad mode unless that is known not to work. */
+static int fespi_verify(struct flash_bank *bank, const uint8_t *buffer,
+		uint32_t offset, uint32_t count)
+{
+	struct fespi_flash_bank *fespi_info = bank->driver_priv;
+	uint32_t ffmt;
+	int retval;
+
+	if (fespi_info->quad_read == FESPI_QUAD_NONE)
+		return default_flash_verify(bank, buffer, offset, count);
+
+	retval = fespi_quad_read_begin(bank, &ffmt);
+	if (retval != ERROR_OK)
+		return retval;
+	retval = default_flash_verify(bank, buffer, offset, count);
+	if (fespi_quad_read_end(bank, ffmt) != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (retval == ERROR_OK) {
+		if (fespi_info->quad_read == FESPI_QUAD_UNKNOWN &&
+				fespi_needs_io23(buffer, count)) {
+			LOG_DEBUG("quad reads work, using them for %s", bank->name);
+			fespi_info->quad_read = FESPI_QUAD_OK;
+		}
+		return ERROR_OK;
+	}
+
+	if (fespi_info->quad_read == FESPI_QUAD_OK)
+		return retval;
+
+	/* The flash probably has its QE bit clear. Don't try again. */
+	retval = default_flash_verify(bank, buffer, offset, count);
+	if (retval == ERROR_OK) {
+		LOG_INFO("quad reads of %s don't work, using single bit reads", bank->name);
+		fespi_info->quad_read = FESPI_QUAD_NONE;
+	}
+	return retval;
+}
+
 /* Return ID of flash device */
 /* On exit, SW mode is kept */
 static int fespi_read_flash_id(struct flash_bank *bank, uint32_t *id)
@@ -732,6 +1007,47 @@ static int fespi_read_flash_id(struct flash_bank *bank, uint32_t *id)
 	return ERROR_OK;
 }
 
+/* Read SFDP words, in SW mode. Each byte sent clocks one into the receive
+ * fifo, so receive as we go to keep it from overflowing. */
+static int fespi_read_sfdp_block(struct flash_bank *bank, uint32_t addr,
+		uint32_t words, uint32_t *buffer)
+{
+	int retval;
+
+	fespi_set_dir(bank, FESPI_DIR_RX);
+
+	if (fespi_write_reg(bank, FESPI_REG_CSMODE, FESPI_CSMODE_HOLD) != ERROR_OK)
+		return ERROR_FAIL;
+
+	/* instruction, 3 address bytes and 8 dummy clocks */
+	const uint8_t header[] = { SPIFLASH_READ_SFDP, addr >> 16, addr >> 8, addr, 0 };
+	for (unsigned int i = 0; i < ARRAY_SIZE(header); i++) {
+		retval = fespi_tx(bank, header[i]);
+		if (retval == ERROR_OK)
+			retval = fespi_rx(bank, NULL);
+		if (retval != ERROR_OK)
+			goto done;
+	}
+
+	for (uint32_t i = 0; i < words * 4; i++) {
+		uint8_t rx;
+		retval = fespi_tx(bank, 0);
+		if (retval == ERROR_OK)
+			retval = fespi_rx(bank, &rx);
+		if (retval != ERROR_OK)
+			goto done;
+		if ((i & 3) == 0)
+			buffer[i / 4] = 0;
+		buffer[i / 4] |= (uint32_t)rx << ((i & 3) * 8);
+	}
+
+done:
+	if (fespi_write_reg(bank, FESPI_REG_CSMODE, FESPI_CSMODE_AUTO) != ERROR_OK)
+		return ERROR_FAIL;
+	fespi_set_dir(bank, FESPI_DIR_TX);
+	return retval;
+}
+
 static int fespi_probe(struct flash_bank *bank)
 {
 	struct target *target = bank->target;
@@ -778,36 +1094,35 @@ static int fespi_probe(struct flash_bank *bank)
 		return ERROR_FAIL;
 
 	retval = fespi_read_flash_id(bank, &id);
+	if (retval == ERROR_OK)
+		retval = spi_sfdp_probe(bank, id, &fespi_info->device,
+				fespi_read_sfdp_block);
 
 	if (fespi_enable_hw_mode(bank) != ERROR_OK)
 		return ERROR_FAIL;
 	if (retval != ERROR_OK)
 		return retval;
 
-	fespi_info->dev = NULL;
-	for (const struct flash_device *p = flash_devices; p->name ; p++)
-		if (p->device_id == id) {
-			fespi_info->dev = p;
-			break;
-		}
-
-	if (!fespi_info->dev) {
-		LOG_ERROR("Unknown flash device (ID 0x%08" PRIx32 ")", id);
-		return ERROR_FAIL;
-	}
+	fespi_info->dev = &fespi_info->device;
 
 	LOG_INFO("Found flash device \'%s\' (ID 0x%08" PRIx32 ")",
 			fespi_info->dev->name, fespi_info->dev->device_id);
 
+	/* The flash only drives IO2/IO3 if its (non-volatile) QE bit is set,
+	 * which we leave alone. Quad reads are tried by fespi_verify(), and
+	 * only used by fespi_read() once they have proven to work. */
+	fespi_info->quad_read = (fespi_info->dev->qread_cmd &&
+			fespi_info->dev->size_in_bytes <= (1UL << 24)) ?
+		FESPI_QUAD_UNKNOWN : FESPI_QUAD_NONE;
+
 	/* Set correct size value */
 	bank->size = fespi_info->dev->size_in_bytes;
 
 	if (bank->size <= (1UL << 16))
 		LOG_WARNING("device needs 2-byte addresses - not implemented");
 
-	/* if no sectors, treat whole bank as single sector */
-	sectorsize = fespi_info->dev->sectorsize ?
-		fespi_info->dev->sectorsize : fespi_info->dev->size_in_bytes;
+	/* smallest erase size, or whole bank as single sector if none */
+	sectorsize = spi_erase_granularity(fespi_info->dev);
 
 	/* create and fill sectors array */
 	bank->num_sectors = fespi_info->dev->size_in_bytes / sectorsize;
@@ -864,9 +1179,11 @@ const struct flash_driver fespi_flash = {
 	.name = "fespi",
 	.flash_bank_command = fespi_flash_bank_command,
 	.erase = fespi_erase,
+	.erase_start = fespi_erase_start,
 	.protect = fespi_protect,
 	.write = fespi_write,
-	.read = default_flash_read,
+	.read = fespi_read,
+	.verify = fespi_verify,
 	.probe = fespi_probe,
 	.auto_probe = fespi_auto_probe,
 	.erase_check = default_flash_blank_check,
@@ -21,6 +21,7 @@
 #include "imp.h"
 #include <helper/binarybuffer.h>
 #include <target/algorithm.h>
+#include "target/riscv/riscv.h"
 
 /* gd32vf103 register locations */
 
@@ -611,78 +612,83 @@ static int gd32vf103_write_block(struct flash_bank *bank, const uint8_t *buffer,
 	init_reg_param(&reg_params[4], "a4", 32, PARAM_IN_OUT);	/* target address */
 
 
-	uint32_t wp_addr = source->address;
-	uint32_t rp_addr = source->address + 4;
-	uint32_t fifo_start_addr = source->address + 8;
-	uint32_t fifo_end_addr = source->address + source->size;
-
-	uint32_t wp = fifo_start_addr;
-	uint32_t rp = fifo_start_addr;
-	uint32_t thisrun_bytes = fifo_end_addr-fifo_start_addr-2; /* (2:block size) */
+	struct riscv_resident_algorithm resident = { 0 };
 
-	retval = target_write_u32(target, rp_addr, rp);
-	if (retval != ERROR_OK)
-		return retval;
+	if (riscv_can_access_memory_running(target, 4)) {
+		/* Stream data into the loader's fifo while it programs. */
+		buf_set_u32(reg_params[0].value, 0, 32, gd32vf103_info->register_base);
+		buf_set_u32(reg_params[1].value, 0, 32, count);
+		buf_set_u32(reg_params[2].value, 0, 32, source->address);
+		buf_set_u32(reg_params[3].value, 0, 32, source->address + source->size);
+		buf_set_u32(reg_params[4].value, 0, 32, address);
 
-	while (count > 0) {
-		retval = target_read_u32(target, rp_addr, &rp);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("failed to get read pointer");
-			break;
-		}
+		retval = target_run_flash_async_algorithm(target, buffer, count, 2,
+				0, NULL,
+				5, reg_params,
+				source->address, source->size,
+				write_algorithm->address, write_algorithm->address + 4,
+				NULL);
+		goto done;
+	}
 
-		if (wp != rp) {
-			LOG_ERROR("Failed to write flash ;;  rp = 0x%x ;;; wp = 0x%x", rp, wp);
-			break;
-		}
-		wp = fifo_start_addr;
-		rp = fifo_start_addr;
-		retval = target_write_u32(target, rp_addr, rp);
-		if (retval != ERROR_OK)
-			break;
-		/* Limit to the amount of data we actually want to write */
-		if (thisrun_bytes > count * 2)
-			thisrun_bytes = count * 2;
+	/* Without memory access while the hart runs, fill the fifo, run the
+	 * loader over it and repeat. The fifo pointers go in the same write as
+	 * the data, and the loader's a0/a4 tell whether it got through. */
+	uint32_t fifo_start_addr = source->address + 8;
+	uint32_t fifo_size = source->size - 8 - 2;	/* keep wp != rp, like the async protocol */
+	uint8_t *chunk = malloc(source->size);
+	if (chunk == NULL) {
+		LOG_ERROR("no memory for fifo buffer");
+		retval = ERROR_FAIL;
+		goto done;
+	}
 
-		/* Write data to fifo */
-		retval = target_write_buffer(target, wp, thisrun_bytes, buffer);
-		if (retval != ERROR_OK)
-			break;
+	retval = riscv_resident_algorithm_begin(target, &resident);
+	if (retval != ERROR_OK) {
+		free(chunk);
+		goto done;
+	}
 
-		/* Update counters and wrap write pointer */
-		buffer += thisrun_bytes;
-		count -= thisrun_bytes / 2;
-		rp = fifo_start_addr;
-		wp = fifo_start_addr+thisrun_bytes;
+	while (count > 0) {
+		uint32_t thisrun_bytes = MIN(fifo_size, count * 2);
 
-		/* Store updated write pointer to target */
-		retval = target_write_u32(target, wp_addr, wp);
+		target_buffer_set_u32(target, chunk, fifo_start_addr + thisrun_bytes);
+		target_buffer_set_u32(target, chunk + 4, fifo_start_addr);
+		memcpy(chunk + 8, buffer, thisrun_bytes);
+		retval = target_write_buffer(target, source->address, thisrun_bytes + 8, chunk);
 		if (retval != ERROR_OK)
 			break;
-		retval = target_write_u32(target, rp_addr, rp);
-		if (retval != ERROR_OK)
-			return retval;
 
 		buf_set_u32(reg_params[0].value, 0, 32, gd32vf103_info->register_base);
-		buf_set_u32(reg_params[1].value, 0, 32, thisrun_bytes/2);
+		buf_set_u32(reg_params[1].value, 0, 32, thisrun_bytes / 2);
 		buf_set_u32(reg_params[2].value, 0, 32, source->address);
 		buf_set_u32(reg_params[3].value, 0, 32, source->address + source->size);
 		buf_set_u32(reg_params[4].value, 0, 32, address);
 
-		retval = target_run_algorithm(target, 0, NULL, 5, reg_params,
-				write_algorithm->address, write_algorithm->address+4,
-				10000, NULL);
-
+		retval = riscv_resident_algorithm_run(target, &resident, 5, reg_params,
+				write_algorithm->address, write_algorithm->address + 4,
+				10000);
 		if (retval != ERROR_OK) {
 			LOG_ERROR("Failed to execute algorithm at 0x%" TARGET_PRIxADDR ": %d",
 					write_algorithm->address, retval);
-			return retval;
-			}
-		address += thisrun_bytes;
+			break;
+		}
+
+		/* a0 is the last FMC_STAT, a4 the next address to program */
+		if ((buf_get_u32(reg_params[0].value, 0, 32) & (FMC_STAT_PGERR | FMC_STAT_WPERR)) ||
+				buf_get_u32(reg_params[4].value, 0, 32) != address + thisrun_bytes) {
+			retval = ERROR_FLASH_OPERATION_FAILED;
+			break;
+		}
 
+		buffer += thisrun_bytes;
+		count -= thisrun_bytes / 2;
+		address += thisrun_bytes;
 	}
 
+	free(chunk);
 
+done:
 	if (retval == ERROR_FLASH_OPERATION_FAILED) {
 		LOG_ERROR("flash write failed at address 0x%"PRIx32,
 				buf_get_u32(reg_params[4].value, 0, 32));
@@ -700,6 +706,10 @@ static int gd32vf103_write_block(struct flash_bank *bank, const uint8_t *buffer,
 		}
 	}
 
+	int end_retval = riscv_resident_algorithm_end(target, &resident);
+	if (retval == ERROR_OK)
+		retval = end_retval;
+
 	target_free_working_area(target, source);
 	target_free_working_area(target, write_algorithm);
 
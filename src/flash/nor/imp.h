@@ -39,6 +39,8 @@ struct flash_bank *flash_bank_list(void);
 
 int flash_driver_erase(struct flash_bank *bank, unsigned int first,
 		unsigned int last);
+int flash_driver_erase_start(struct flash_bank *bank, unsigned int first,
+		unsigned int last);
 int flash_driver_protect(struct flash_bank *bank, int set, unsigned int first,
 		unsigned int last);
 int flash_driver_write(struct flash_bank *bank,
@@ -47,9 +49,16 @@ int flash_driver_read(struct flash_bank *bank,
 		uint8_t *buffer, uint32_t offset, uint32_t count);
 int flash_driver_verify(struct flash_bank *bank,
 		const uint8_t *buffer, uint32_t offset, uint32_t count);
+int flash_driver_erase_check(struct flash_bank *bank);
+
+/** Forget the erase and protection state the core has cached for @a bank */
+void flash_forget_state(struct flash_bank *bank);
 
-/* write (optional verify) an image to flash memory of the given target */
+/* write (optional verify) an image to flash memory of the given target.
+ * With incremental set, sectors that already hold the image are neither
+ * erased nor written. */
 int flash_write_unlock_verify(struct target *target, struct image *image,
-		uint32_t *written, bool erase, bool unlock, bool write, bool verify);
+		uint32_t *written, bool erase, bool unlock, bool write, bool verify,
+		bool incremental);
 
 #endif /* OPENOCD_FLASH_NOR_IMP_H */
@@ -22,16 +22,26 @@
 #include "imp.h"
 #include <jtag/jtag.h>
 #include <flash/nor/spi.h>
+#include <flash/nor/sfdp.h>
 #include <helper/time_support.h>
 
 #define JTAGSPI_MAX_TIMEOUT 3000
 
+/* Status reads queued behind each page program, and the one a program
+ * should typically finish at. The idle clocks between them adapt. */
+#define JTAGSPI_POLLS 8
+#define JTAGSPI_POLL_TARGET 4
+#define JTAGSPI_MIN_POLL_INTERVAL 8
+#define JTAGSPI_MAX_POLL_INTERVAL (1 << 20)
+
 
 struct jtagspi_flash_bank {
 	struct jtag_tap *tap;
 	const struct flash_device *dev;
+	struct flash_device device;	/* table entry completed from SFDP */
 	bool probed;
 	uint32_t ir;
+	unsigned int poll_interval;	/* idle clocks between queued status reads */
 };
 
 FLASH_BANK_COMMAND_HANDLER(jtagspi_flash_bank_command)
@@ -50,6 +60,7 @@ FLASH_BANK_COMMAND_HANDLER(jtagspi_flash_bank_command)
 
 	info->tap = NULL;
 	info->probed = false;
+	info->poll_interval = 1000;
 	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[6], info->ir);
 
 	return ERROR_OK;
@@ -69,21 +80,24 @@ static void jtagspi_set_ir(struct flash_bank *bank)
 	jtag_add_ir_scan(info->tap, &field, TAP_IDLE);
 }
 
-static void flip_u8(uint8_t *in, uint8_t *out, int len)
+static void flip_u8(const uint8_t *in, uint8_t *out, int len)
 {
 	for (int i = 0; i < len; i++)
 		out[i] = flip_u32(in[i], 8);
 }
 
-static int jtagspi_cmd(struct flash_bank *bank, uint8_t cmd,
-		uint32_t *addr, uint8_t *data, int len)
+/* Queue an SPI command without running the queue. For reads (len < 0) the
+ * data arrives bit reversed in 'in', which must stay valid until the queue
+ * has been executed. */
+static int jtagspi_queue_cmd(struct flash_bank *bank, uint8_t cmd,
+		uint32_t *addr, const uint8_t *data, uint8_t *in, int len)
 {
 	struct jtagspi_flash_bank *info = bank->driver_priv;
 	struct scan_field fields[6];
 	uint8_t marker = 1;
 	uint8_t xfer_bits_buf[4];
 	uint8_t addr_buf[3];
-	uint8_t *data_buf;
+	uint8_t *data_buf = NULL;
 	uint32_t xfer_bits;
 	int is_read, lenb, n;
 
@@ -127,12 +141,7 @@ static int jtagspi_cmd(struct flash_bank *bank, uint8_t cmd,
 	}
 
 	lenb = DIV_ROUND_UP(len, 8);
-	data_buf = malloc(lenb);
 	if (lenb > 0) {
-		if (data_buf == NULL) {
-			LOG_ERROR("no memory for spi buffer");
-			return ERROR_FAIL;
-		}
 		if (is_read) {
 			fields[n].num_bits = jtag_tap_count_enabled();
 			fields[n].out_value = NULL;
@@ -140,8 +149,13 @@ static int jtagspi_cmd(struct flash_bank *bank, uint8_t cmd,
 			n++;
 
 			fields[n].out_value = NULL;
-			fields[n].in_value = data_buf;
+			fields[n].in_value = in;
 		} else {
+			data_buf = malloc(lenb);
+			if (data_buf == NULL) {
+				LOG_ERROR("no memory for spi buffer");
+				return ERROR_FAIL;
+			}
 			flip_u8(data, data_buf, lenb);
 			fields[n].out_value = data_buf;
 			fields[n].in_value = NULL;
@@ -151,13 +165,56 @@ static int jtagspi_cmd(struct flash_bank *bank, uint8_t cmd,
 	}
 
 	jtagspi_set_ir(bank);
-	/* passing from an IR scan to SHIFT-DR clears BYPASS registers */
+	/* passing from an IR scan to SHIFT-DR clears BYPASS registers;
+	 * the queue keeps its own copy of the data shifted out */
 	jtag_add_dr_scan(info->tap, n, fields, TAP_IDLE);
-	int retval = jtag_execute_queue();
-
-	if (is_read)
-		flip_u8(data_buf, data, lenb);
 	free(data_buf);
+	return ERROR_OK;
+}
+
+static int jtagspi_cmd(struct flash_bank *bank, uint8_t cmd,
+		uint32_t *addr, uint8_t *data, int len)
+{
+	uint8_t *in = NULL;
+	int lenb = DIV_ROUND_UP(len < 0 ? -len : len, 8);
+
+	if (len < 0 && lenb > 0) {
+		in = malloc(lenb);
+		if (in == NULL) {
+			LOG_ERROR("no memory for spi buffer");
+			return ERROR_FAIL;
+		}
+	}
+
+	int retval = jtagspi_queue_cmd(bank, cmd, addr, data, in, len);
+	if (retval == ERROR_OK)
+		retval = jtag_execute_queue();
+
+	if (in) {
+		if (retval == ERROR_OK)
+			flip_u8(in, data, lenb);
+		free(in);
+	}
+	return retval;
+}
+
+static int jtagspi_read_sfdp_block(struct flash_bank *bank, uint32_t addr,
+		uint32_t words, uint32_t *buffer)
+{
+	/* the first byte read covers the 8 dummy clocks */
+	uint8_t *data = malloc(1 + words * 4);
+	if (data == NULL) {
+		LOG_ERROR("no memory for spi buffer");
+		return ERROR_FAIL;
+	}
+
+	int retval = jtagspi_cmd(bank, SPIFLASH_READ_SFDP, &addr, data,
+			-8 * (1 + words * 4));
+	if (retval == ERROR_OK)
+		for (uint32_t i = 0; i < words; i++)
+			buffer[i] = le_to_h_u32(data + 1 + i * 4);
+
+	free(data);
 	return retval;
 }
 
@@ -182,17 +239,10 @@ static int jtagspi_probe(struct flash_bank *bank)
 	/* the table in spi.c has the manufacturer byte (first) as the lsb */
 	id = le_to_h_u24(in_buf);
 
-	info->dev = NULL;
-	for (const struct flash_device *p = flash_devices; p->name ; p++)
-		if (p->device_id == id) {
-			info->dev = p;
-			break;
-		}
-
-	if (!(info->dev)) {
-		LOG_ERROR("Unknown flash device (ID 0x%08" PRIx32 ")", id);
-		return ERROR_FAIL;
-	}
+	int retval = spi_sfdp_probe(bank, id, &info->device, jtagspi_read_sfdp_block);
+	if (retval != ERROR_OK)
+		return retval;
+	info->dev = &info->device;
 
 	LOG_INFO("Found flash device \'%s\' (ID 0x%08" PRIx32 ")",
 		info->dev->name, info->dev->device_id);
@@ -204,9 +254,8 @@ static int jtagspi_probe(struct flash_bank *bank)
 	if (bank->size > (1UL << 24))
 		LOG_WARNING("device needs paging or 4-byte addresses - not implemented");
 
-	/* if no sectors, treat whole bank as single sector */
-	sectorsize = info->dev->sectorsize ?
-		info->dev->sectorsize : info->dev->size_in_bytes;
+	/* smallest erase size, or whole bank as single sector if none */
+	sectorsize = spi_erase_granularity(info->dev);
 
 	/* create and fill sectors array */
 	bank->num_sectors = info->dev->size_in_bytes / sectorsize;
@@ -299,18 +348,17 @@ static int jtagspi_bulk_erase(struct flash_bank *bank)
 	return retval;
 }
 
-static int jtagspi_sector_erase(struct flash_bank *bank, unsigned int sector)
+static int jtagspi_erase_block(struct flash_bank *bank, uint8_t cmd, uint32_t offset)
 {
-	struct jtagspi_flash_bank *info = bank->driver_priv;
 	int retval;
 	int64_t t0 = timeval_ms();
 
 	retval = jtagspi_write_enable(bank);
 	if (retval != ERROR_OK)
 		return retval;
-	jtagspi_cmd(bank, info->dev->erase_cmd, &bank->sectors[sector].offset, NULL, 0);
+	jtagspi_cmd(bank, cmd, &offset, NULL, 0);
 	retval = jtagspi_wait(bank, JTAGSPI_MAX_TIMEOUT);
-	LOG_INFO("sector %u took %" PRId64 " ms", sector, timeval_ms() - t0);
+	LOG_INFO("block at 0x%08" PRIx32 " took %" PRId64 " ms", offset, timeval_ms() - t0);
 	return retval;
 }
 
@@ -352,13 +400,13 @@ static int jtagspi_erase(struct flash_bank *bank, unsigned int first,
 	if (info->dev->erase_cmd == 0x00)
 		return ERROR_FLASH_OPER_UNSUPPORTED;
 
-	for (unsigned int sector = first; sector <= last; sector++) {
-		retval = jtagspi_sector_erase(bank, sector);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Sector erase failed.");
-			break;
-		}
-	}
+	/* sectors are the smallest erase size, larger blocks are used where
+	 * the range covers them */
+	retval = spi_erase_range(bank, info->dev, bank->sectors[first].offset,
+			bank->sectors[last].offset + bank->sectors[last].size,
+			false, jtagspi_erase_block);
+	if (retval != ERROR_OK)
+		LOG_ERROR("Sector erase failed.");
 
 	return retval;
 }
@@ -384,14 +432,55 @@ static int jtagspi_read(struct flash_bank *bank, uint8_t *buffer, uint32_t offse
 	return ERROR_OK;
 }
 
+/* Space the queued status reads so that a page program typically ends at
+ * the JTAGSPI_POLL_TARGET one, from the read that first saw it done. */
+static void jtagspi_calibrate_polls(struct jtagspi_flash_bank *info, unsigned int done)
+{
+	uint64_t interval = (uint64_t)info->poll_interval * done / JTAGSPI_POLL_TARGET;
+
+	info->poll_interval = MIN(MAX(interval, JTAGSPI_MIN_POLL_INTERVAL),
+			JTAGSPI_MAX_POLL_INTERVAL);
+}
+
 static int jtagspi_page_write(struct flash_bank *bank, const uint8_t *buffer, uint32_t offset, uint32_t count)
 {
+	struct jtagspi_flash_bank *info = bank->driver_priv;
+	uint8_t we_status;
+	uint8_t status[JTAGSPI_POLLS];
 	int retval;
 
-	retval = jtagspi_write_enable(bank);
+	/* Write enable, a status read to check it, the page program and a few
+	 * spaced out status reads all go in one queue. Only a page that takes
+	 * longer than all of those reads costs more round trips. */
+	retval = jtagspi_queue_cmd(bank, SPIFLASH_WRITE_ENABLE, NULL, NULL, NULL, 0);
+	if (retval == ERROR_OK)
+		retval = jtagspi_queue_cmd(bank, SPIFLASH_READ_STATUS, NULL, NULL, &we_status, -8);
+	if (retval == ERROR_OK)
+		retval = jtagspi_queue_cmd(bank, SPIFLASH_PAGE_PROGRAM, &offset, buffer, NULL, count * 8);
+	for (unsigned int i = 0; i < JTAGSPI_POLLS && retval == ERROR_OK; i++) {
+		jtag_add_runtest(info->poll_interval, TAP_IDLE);
+		retval = jtagspi_queue_cmd(bank, SPIFLASH_READ_STATUS, NULL, NULL, &status[i], -8);
+	}
+	if (retval == ERROR_OK)
+		retval = jtag_execute_queue();
 	if (retval != ERROR_OK)
 		return retval;
-	jtagspi_cmd(bank, SPIFLASH_PAGE_PROGRAM, &offset, (uint8_t *) buffer, count*8);
+
+	we_status = flip_u32(we_status, 8);
+	if ((we_status & SPIFLASH_WE_BIT) == 0) {
+		LOG_ERROR("Cannot enable write to flash. Status=0x%02" PRIx8, we_status);
+		return ERROR_FAIL;
+	}
+
+	for (unsigned int i = 0; i < JTAGSPI_POLLS; i++) {
+		if ((flip_u32(status[i], 8) & SPIFLASH_BSY_BIT) == 0) {
+			jtagspi_calibrate_polls(info, i + 1);
+			return ERROR_OK;
+		}
+	}
+
+	/* still programming, space the reads out further next time */
+	jtagspi_calibrate_polls(info, 2 * JTAGSPI_POLLS);
 	return jtagspi_wait(bank, JTAGSPI_MAX_TIMEOUT);
 }
 
@@ -182,6 +182,21 @@ int spi_sfdp(struct flash_bank *bank, struct flash_device *dev,
 			dev->erase_cmd = (erase >> 8) & 0xFF;
 			dev->sectorsize = 1UL << (erase & 0xFF);
 
+			/* keep all erase types, so that ranges can be erased with a mix */
+			for (j = 0; j < SPI_ERASE_TYPES; j++) {
+				erase = ((j < 2 ? table->erase_t12 : table->erase_t34) >> ((j & 1) * 16)) & 0xFFFF;
+				if ((erase & 0xFF) == 0)
+					continue;
+				dev->erase_types[j].cmd = (erase >> 8) & 0xFF;
+				dev->erase_types[j].size = 1UL << (erase & 0xFF);
+			}
+
+			/* 1-1-2 and 1-1-4 fast read instructions */
+			if (table->fast_addr & (1UL << 16))
+				dev->read_112_cmd = (table->fast_1x2 >> 8) & 0xFF;
+			if (table->fast_addr & (1UL << 22))
+				dev->read_114_cmd = (table->fast_1x4 >> 24) & 0xFF;
+
 			if ((offsetof(struct sfdp_basic_flash_param, chip_byte) >> 2) < words) {
 				/* get Program Page Size, if chip_byte present, that's optional */
 				dev->pagesize = 1UL << ((table->chip_byte >> 4) & 0x0F);
@@ -211,6 +226,12 @@ int spi_sfdp(struct flash_bank *bank, struct flash_device *dev,
 					dev->erase_cmd = 0xDC;
 					if (dev->qread_cmd != 0)
 						dev->qread_cmd = 0xEC;
+					for (j = 0; j < SPI_ERASE_TYPES; j++)
+						dev->erase_types[j].cmd = spi_4byte_cmd(dev->erase_types[j].cmd);
+					if (dev->read_112_cmd != 0)
+						dev->read_112_cmd = spi_4byte_cmd(dev->read_112_cmd);
+					if (dev->read_114_cmd != 0)
+						dev->read_114_cmd = spi_4byte_cmd(dev->read_114_cmd);
 				} else if (((table->fast_addr >> 17) & 0x3) == 0x1)
 					LOG_INFO("device has to be switched to 4-byte addresses");
 			}
@@ -228,6 +249,12 @@ int spi_sfdp(struct flash_bank *bank, struct flash_device *dev,
 					dev->qread_cmd = 0xEC;
 				if (table->flags & (1UL << 6))
 					dev->pprog_cmd = 0x12;
+				if (table->flags & (1UL << 2))
+					dev->read_112_cmd = 0x3C;
+				if (table->flags & (1UL << 4))
+					dev->read_114_cmd = 0x6C;
+				if (table->flags & (1UL << 7))
+					dev->pprog_114_cmd = 0x34;
 
 				/* erase instructions */
 				if ((erase_type == 1) && (table->flags & (1UL << 9)))
@@ -238,6 +265,10 @@ int spi_sfdp(struct flash_bank *bank, struct flash_device *dev,
 					dev->erase_cmd = (table->erase_t1234 >> 16) & 0xFF;
 				else if ((erase_type == 4) && (table->flags & (1UL << 12)))
 					dev->erase_cmd = (table->erase_t1234 >> 24) & 0xFF;
+
+				for (j = 0; j < SPI_ERASE_TYPES; j++)
+					if (table->flags & (1UL << (9 + j)))
+						dev->erase_types[j].cmd = (table->erase_t1234 >> (j * 8)) & 0xFF;
 			} else
 				LOG_ERROR("parameter table id=0x%04" PRIx16 " invalid length %d", id, words);
 		} else
@@ -261,3 +292,46 @@ err:
 
 	return retval;
 }
+
+/* Look up id in flash_devices[] and add what only SFDP tells about the
+ * device: all erase sizes and the dual and quad instructions. A device
+ * that isn't in the table is described by its SFDP alone. */
+int spi_sfdp_probe(struct flash_bank *bank, uint32_t id, struct flash_device *dev,
+	read_sfdp_block_t read_sfdp_block)
+{
+	const struct flash_device *p;
+	struct flash_device sfdp;
+	int retval;
+
+	for (p = flash_devices; p->name; p++)
+		if (p->device_id == id)
+			break;
+
+	retval = spi_sfdp(bank, &sfdp, read_sfdp_block);
+
+	if (!p->name) {
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Unknown flash device (ID 0x%08" PRIx32 ")", id);
+			return ERROR_FAIL;
+		}
+		*dev = sfdp;
+		dev->device_id = id;
+		return ERROR_OK;
+	}
+
+	*dev = *p;
+	if (retval != ERROR_OK)
+		return ERROR_OK;
+
+	if (sfdp.size_in_bytes != p->size_in_bytes) {
+		LOG_WARNING("SFDP size 0x%" PRIx32 " doesn't match '%s', ignoring SFDP",
+			sfdp.size_in_bytes, p->name);
+		return ERROR_OK;
+	}
+
+	dev->read_112_cmd = sfdp.read_112_cmd;
+	dev->read_114_cmd = sfdp.read_114_cmd;
+	dev->pprog_114_cmd = sfdp.pprog_114_cmd;
+	memcpy(dev->erase_types, sfdp.erase_types, sizeof(dev->erase_types));
+	return ERROR_OK;
+}
@@ -31,4 +31,7 @@ typedef int (*read_sfdp_block_t)(struct flash_bank *bank, uint32_t addr,
 extern int spi_sfdp(struct flash_bank *bank, struct flash_device *dev,
 	read_sfdp_block_t read_sfdp_block);
 
+extern int spi_sfdp_probe(struct flash_bank *bank, uint32_t id,
+	struct flash_device *dev, read_sfdp_block_t read_sfdp_block);
+
 #endif /* OPENOCD_FLASH_NOR_SFDP_H */
@@ -151,3 +151,104 @@ const struct flash_device flash_devices[] = {
 
 	FLASH_ID(NULL,                  0,    0,    0,    0,    0,    0,          0,     0,       0)
 };
+
+/* Native 4-byte address variants of the common 3-byte address instructions.
+ * These don't depend on the device's address mode, unlike switching it into
+ * 4-byte mode, which some boot ROMs don't expect after a reset. */
+static const uint8_t spi_4byte_cmds[][2] = {
+	{ 0x03, 0x13 },		/* read */
+	{ 0x0B, 0x0C },		/* fast read */
+	{ 0x3B, 0x3C },		/* 1-1-2 fast read */
+	{ 0xBB, 0xBC },		/* 1-2-2 fast read */
+	{ 0x6B, 0x6C },		/* 1-1-4 fast read */
+	{ 0xEB, 0xEC },		/* 1-4-4 fast read */
+	{ 0x02, 0x12 },		/* page program */
+	{ 0x32, 0x34 },		/* 1-1-4 page program */
+	{ 0x38, 0x3E },		/* 1-4-4 page program */
+	{ 0x20, 0x21 },		/* 4 KiB erase */
+	{ 0x52, 0x5C },		/* 32 KiB erase */
+	{ 0xD8, 0xDC },		/* 64 KiB erase */
+};
+
+/* Map an instruction to the one taking a 4-byte address, if there is one */
+uint8_t spi_4byte_cmd(uint8_t cmd)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(spi_4byte_cmds); i++)
+		if (spi_4byte_cmds[i][0] == cmd)
+			return spi_4byte_cmds[i][1];
+	return cmd;
+}
+
+/* Smallest block the device can erase, which is what a bank's sectors
+ * should be so that erasing a range doesn't touch more than necessary. */
+uint32_t spi_erase_granularity(const struct flash_device *dev)
+{
+	uint32_t size = 0;
+
+	for (unsigned int i = 0; i < SPI_ERASE_TYPES; i++)
+		if (dev->erase_types[i].cmd && dev->erase_types[i].size &&
+				(size == 0 || dev->erase_types[i].size < size))
+			size = dev->erase_types[i].size;
+
+	if (size == 0)
+		size = dev->sectorsize;
+	if (size == 0)
+		size = dev->size_in_bytes;
+	return size;
+}
+
+/* Erase [offset, end) with as few instructions as possible: at each offset
+ * use the largest erase block that is aligned there and fits in the range,
+ * e.g. 4 KiB blocks up to the next 32/64 KiB boundary, then 64 KiB blocks.
+ * Both ends must be aligned to spi_erase_granularity(). */
+int spi_erase_range(struct flash_bank *bank, const struct flash_device *dev,
+	uint32_t offset, uint32_t end, bool addr4, spi_erase_block_t erase_block)
+{
+	const struct spi_erase_type fallback = {
+		.cmd = dev->erase_cmd,
+		.size = dev->sectorsize ? dev->sectorsize : dev->size_in_bytes,
+	};
+	const struct spi_erase_type *types = dev->erase_types;
+	unsigned int num_types = SPI_ERASE_TYPES;
+	int retval;
+
+	bool have_types = false;
+	for (unsigned int i = 0; i < SPI_ERASE_TYPES; i++)
+		if (dev->erase_types[i].cmd && dev->erase_types[i].size)
+			have_types = true;
+	if (!have_types) {
+		types = &fallback;
+		num_types = 1;
+	}
+
+	while (offset < end) {
+		const struct spi_erase_type *best = NULL;
+
+		for (unsigned int i = 0; i < num_types; i++) {
+			const struct spi_erase_type *t = &types[i];
+			if (t->cmd == 0 || t->size == 0)
+				continue;
+			if ((offset & (t->size - 1)) || end - offset < t->size)
+				continue;
+			if (!best || t->size > best->size)
+				best = t;
+		}
+
+		if (!best) {
+			LOG_ERROR("no erase block fits at 0x%08" PRIx32, offset);
+			return ERROR_FLASH_SECTOR_INVALID;
+		}
+
+		uint8_t cmd = addr4 ? spi_4byte_cmd(best->cmd) : best->cmd;
+		LOG_DEBUG("erasing 0x%" PRIx32 " bytes at 0x%08" PRIx32 " (cmd 0x%02" PRIx8 ")",
+			best->size, offset, cmd);
+		retval = erase_block(bank, cmd, offset);
+		if (retval != ERROR_OK)
+			return retval;
+
+		offset += best->size;
+		keep_alive();
+	}
+
+	return ERROR_OK;
+}
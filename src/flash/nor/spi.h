@@ -27,6 +27,16 @@
 
 #ifndef __ASSEMBLER__
 
+struct flash_bank;
+
+#define SPI_ERASE_TYPES		4
+
+/* an erase instruction and the size of the block it erases, 0 if unused */
+struct spi_erase_type {
+	uint8_t cmd;
+	uint32_t size;
+};
+
 /* data structure to maintain flash ids from different vendors */
 struct flash_device {
 	const char *name;
@@ -39,6 +49,13 @@ struct flash_device {
 	uint32_t pagesize;
 	uint32_t sectorsize;
 	uint32_t size_in_bytes;
+	/* only known from SFDP, 0 otherwise */
+	uint8_t read_112_cmd;		/* 1-1-2 fast read */
+	uint8_t read_114_cmd;		/* 1-1-4 fast read */
+	uint8_t pprog_114_cmd;		/* 1-1-4 page program */
+	/* all erase sizes the device supports, from SFDP; if none are set,
+	 * erase_cmd and sectorsize are the only one */
+	struct spi_erase_type erase_types[SPI_ERASE_TYPES];
 };
 
 #define FLASH_ID(n, re, qr, pp, es, ces, id, psize, ssize, size) \
@@ -71,6 +88,15 @@ struct flash_device {
 
 extern const struct flash_device flash_devices[];
 
+/* erase the block of the given instruction at offset, for spi_erase_range() */
+typedef int (*spi_erase_block_t)(struct flash_bank *bank, uint8_t cmd,
+	uint32_t offset);
+
+uint8_t spi_4byte_cmd(uint8_t cmd);
+uint32_t spi_erase_granularity(const struct flash_device *dev);
+int spi_erase_range(struct flash_bank *bank, const struct flash_device *dev,
+	uint32_t offset, uint32_t end, bool addr4, spi_erase_block_t erase_block);
+
 #endif
 
 /* fields in SPI flash status register */
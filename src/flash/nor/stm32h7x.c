@@ -743,6 +743,176 @@ flash_lock:
 	return (retval == ERROR_OK) ? retval2 : retval;
 }
 
+/* Size of the dual bank loader's descriptor of a bank, see stm32h7x_dual.S */
+#define STM32_DUAL_DESC_SIZE	20
+
+static int stm32x_write_block_pair(struct flash_bank *banks[2],
+		const uint8_t *buffers[2], uint32_t offsets[2], uint32_t counts[2])
+{
+	struct target *target = banks[0]->target;
+	struct stm32h7x_flash_bank *stm32x_info = banks[0]->driver_priv;
+	uint32_t block_size = stm32x_info->part_info->block_size;
+	uint32_t data_size = 256 * block_size;
+	struct working_area *write_algorithm;
+	struct working_area *source[2] = { NULL, NULL };
+	struct target_async_fifo fifos[2];
+	struct reg_param reg_params[3];
+	struct armv7m_algorithm armv7m_info;
+	uint8_t desc[2 * STM32_DUAL_DESC_SIZE];
+	int retval;
+
+	static const uint8_t stm32x_flash_write_dual_code[] = {
+#include "../../../contrib/loaders/flash/stm32/stm32h7x_dual.inc"
+	};
+
+	/* the descriptors follow the code */
+	if (target_alloc_working_area(target, sizeof(stm32x_flash_write_dual_code) + sizeof(desc),
+			&write_algorithm) != ERROR_OK) {
+		LOG_WARNING("no working area available, can't do dual bank writes");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+	target_addr_t desc_address = write_algorithm->address + sizeof(stm32x_flash_write_dual_code);
+
+	/* a fifo per bank */
+	for (unsigned int i = 0; i < 2; i++) {
+		while (target_alloc_working_area_try(target, 8 + data_size, &source[i]) != ERROR_OK) {
+			data_size /= 2;
+			if (data_size <= 256) {
+				if (i)
+					target_free_working_area(target, source[0]);
+				target_free_working_area(target, write_algorithm);
+				LOG_WARNING("no large enough working area available, can't do dual bank writes");
+				return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < 2; i++) {
+		struct stm32h7x_flash_bank *info = banks[i]->driver_priv;
+		uint8_t *d = desc + i * STM32_DUAL_DESC_SIZE;
+
+		target_buffer_set_u32(target, d, source[i]->address);
+		target_buffer_set_u32(target, d + 4, source[i]->address + source[i]->size);
+		target_buffer_set_u32(target, d + 8, banks[i]->base + offsets[i]);
+		target_buffer_set_u32(target, d + 12, counts[i]);
+		target_buffer_set_u32(target, d + 16, info->flash_regs_base);
+
+		fifos[i].buffer = buffers[i];
+		fifos[i].count = counts[i];
+		fifos[i].start = source[i]->address;
+		fifos[i].size = source[i]->size;
+	}
+
+	retval = target_write_buffer(target, write_algorithm->address,
+			sizeof(stm32x_flash_write_dual_code), stm32x_flash_write_dual_code);
+	if (retval == ERROR_OK)
+		retval = target_write_buffer(target, desc_address, sizeof(desc), desc);
+	if (retval != ERROR_OK)
+		goto free_areas;
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARM_MODE_THREAD;
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);		/* bank 0 descriptor, status (out) */
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_IN_OUT);		/* bank 1 descriptor, failing bank (out) */
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);		/* word size in bytes */
+
+	buf_set_u32(reg_params[0].value, 0, 32, desc_address);
+	buf_set_u32(reg_params[1].value, 0, 32, desc_address + STM32_DUAL_DESC_SIZE);
+	buf_set_u32(reg_params[2].value, 0, 32, block_size);
+
+	retval = target_run_flash_async_algorithm_multi(target, fifos, 2, block_size,
+			0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			write_algorithm->address, 0,
+			&armv7m_info);
+
+	if (retval == ERROR_FLASH_OPERATION_FAILED) {
+		LOG_ERROR("error executing stm32h7x dual bank flash write algorithm");
+
+		uint32_t flash_sr = buf_get_u32(reg_params[0].value, 0, 32);
+		struct flash_bank *bank = banks[0];
+		if (buf_get_u32(reg_params[1].value, 0, 32) != desc_address)
+			bank = banks[1];
+
+		if (flash_sr & FLASH_WRPERR)
+			LOG_ERROR("flash memory write protected");
+
+		if ((flash_sr & FLASH_ERROR) != 0) {
+			LOG_ERROR("flash write failed in %s, FLASH_SR = 0x%08" PRIx32,
+					bank->name, flash_sr);
+			/* Clear error + EOP flags but report errors */
+			stm32x_write_flash_reg(bank, FLASH_CCR, flash_sr);
+			retval = ERROR_FAIL;
+		}
+	}
+
+	destroy_reg_param(&reg_params[0]);
+	destroy_reg_param(&reg_params[1]);
+	destroy_reg_param(&reg_params[2]);
+
+free_areas:
+	target_free_working_area(target, source[1]);
+	target_free_working_area(target, source[0]);
+	target_free_working_area(target, write_algorithm);
+	return retval;
+}
+
+/* Program both banks of dual bank parts at once, each bank has its own
+ * controller. Only whole runs go through the dual bank loader, anything
+ * it can't take is left to stm32x_write() by the flash core. */
+static int stm32x_write_pair(struct flash_bank *bank0, const uint8_t *buffer0,
+		uint32_t offset0, uint32_t count0,
+		struct flash_bank *bank1, const uint8_t *buffer1,
+		uint32_t offset1, uint32_t count1)
+{
+	struct stm32h7x_flash_bank *info0 = bank0->driver_priv;
+	struct stm32h7x_flash_bank *info1 = bank1->driver_priv;
+	struct flash_bank *banks[2] = { bank0, bank1 };
+	const uint8_t *buffers[2] = { buffer0, buffer1 };
+	uint32_t offsets[2] = { offset0, offset1 };
+	uint32_t counts[2];
+	int retval, retval2;
+
+	if (!info0->probed || !info1->probed || bank0->target != bank1->target ||
+			info0->part_info != info1->part_info ||
+			info0->flash_regs_base == info1->flash_regs_base)
+		return ERROR_FLASH_OPER_UNSUPPORTED;
+
+	if (bank0->target->state != TARGET_HALTED) {
+		LOG_ERROR("Target not halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	/* should be enforced via bank->write_{start,end}_alignment */
+	uint32_t block_size = info0->part_info->block_size;
+	assert(!(offset0 % block_size) && !(count0 % block_size));
+	assert(!(offset1 % block_size) && !(count1 % block_size));
+	counts[0] = count0 / block_size;
+	counts[1] = count1 / block_size;
+	if (!counts[0] || !counts[1])
+		return ERROR_FLASH_OPER_UNSUPPORTED;
+
+	retval = stm32x_unlock_reg(bank0);
+	if (retval == ERROR_OK)
+		retval = stm32x_unlock_reg(bank1);
+	if (retval == ERROR_OK)
+		retval = stm32x_write_block_pair(banks, buffers, offsets, counts);
+
+	retval2 = stm32x_lock_reg(bank0);
+	if (stm32x_lock_reg(bank1) != ERROR_OK)
+		retval2 = ERROR_FAIL;
+	if (retval2 != ERROR_OK)
+		LOG_ERROR("error during the lock of flash");
+
+	if (retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE) {
+		/* one bank at a time can make do with less working area */
+		return ERROR_FLASH_OPER_UNSUPPORTED;
+	}
+
+	return (retval == ERROR_OK) ? retval2 : retval;
+}
+
 static int stm32x_read_id_code(struct flash_bank *bank, uint32_t *id)
 {
 	/* read stm32 device id register */
@@ -1204,6 +1374,7 @@ const struct flash_driver stm32h7x_flash = {
 	.erase = stm32x_erase,
 	.protect = stm32x_protect,
 	.write = stm32x_write,
+	.write_pair = stm32x_write_pair,
 	.read = default_flash_read,
 	.probe = stm32x_probe,
 	.auto_probe = stm32x_auto_probe,
@@ -188,6 +188,9 @@ static inline uint32_t h_to_le_32(uint32_t val)
 #define SPI_MAX_TIMEOUT			(2000)
 #define SPI_MASS_ERASE_TIMEOUT	(400000)
 
+/* BUSY polls before sleeping between them */
+#define SPI_BUSY_POLLS			(8)
+
 struct sector_info {
 	uint32_t offset;
 	uint32_t size;
@@ -245,6 +248,7 @@ static int poll_busy(struct flash_bank *bank, int timeout)
 	uint32_t spi_sr;
 	int retval;
 	long long endtime;
+	unsigned int polls = 0;
 
 	endtime = timeval_ms() + timeout;
 	do {
@@ -257,13 +261,33 @@ static int poll_busy(struct flash_bank *bank, int timeout)
 			return retval;
 		} else
 			LOG_DEBUG("busy: 0x%08X", spi_sr);
-		alive_sleep(1);
+		/* most commands finish within a few polls, only then back off */
+		if (++polls > SPI_BUSY_POLLS)
+			alive_sleep(1);
 	} while (timeval_ms() < endtime);
 
 	LOG_ERROR("Timeout while polling BUSY");
 	return ERROR_FLASH_OPERATION_FAILED;
 }
 
+/* How much of count bytes at offset can be read at bank->base once
+ * set_mm_mode() has been called */
+static uint32_t mm_read_size(struct flash_bank *bank, uint32_t offset,
+	uint32_t count)
+{
+	struct stmqspi_flash_bank *stmqspi_info = bank->driver_priv;
+
+	/* set_mm_mode() always selects memory mapped mode for OCTOSPI,
+	 * for QSPI it's part of the saved CCR */
+	if (!IS_OCTOSPI && (stmqspi_info->saved_ccr & QSPI_MM_MODE) != QSPI_MM_MODE)
+		return 0;
+
+	/* some devices hang reading the very last word memory mapped */
+	if (bank->size < sizeof(uint32_t) || offset >= bank->size - sizeof(uint32_t))
+		return 0;
+	return MIN(count, bank->size - sizeof(uint32_t) - offset);
+}
+
 /* Set to memory-mapped mode, e.g. after an error */
 static int set_mm_mode(struct flash_bank *bank)
 {
@@ -1589,6 +1613,24 @@ static int stmqspi_read(struct flash_bank *bank, uint8_t *buffer,
 		count = bank->size - offset;
 	}
 
+	/* The controller fetches memory mapped data on its own, so reading it
+	 * needs no loader, and no handshake to pass it through working area */
+	uint32_t mm_count = mm_read_size(bank, offset, count);
+	if (mm_count) {
+		retval = set_mm_mode(bank);
+		if (retval == ERROR_OK)
+			retval = target_read_buffer(target, bank->base + offset, mm_count, buffer);
+		if (retval == ERROR_OK) {
+			if (mm_count == count)
+				return ERROR_OK;
+			buffer += mm_count;
+			offset += mm_count;
+			count -= mm_count;
+		} else {
+			LOG_DEBUG("memory mapped read failed, using indirect mode");
+		}
+	}
+
 	/* Abort any previous operation */
 	retval = target_write_u32(target, io_base + SPI_CR,
 		READ_REG(SPI_CR) | BIT(SPI_ABORT));
@@ -1703,6 +1745,22 @@ static int stmqspi_verify(struct flash_bank *bank, const uint8_t *buffer,
 		return ERROR_FLASH_DST_BREAKS_ALIGNMENT;
 	}
 
+	/* checksum the memory mapped flash, on the target where supported */
+	uint32_t mm_count = mm_read_size(bank, offset, count);
+	if (mm_count) {
+		retval = set_mm_mode(bank);
+		if (retval == ERROR_OK) {
+			retval = default_flash_verify(bank, buffer, offset, mm_count);
+			if (retval != ERROR_OK || mm_count == count)
+				return retval;
+			buffer += mm_count;
+			offset += mm_count;
+			count -= mm_count;
+		} else {
+			LOG_DEBUG("can't switch to memory mapped mode, verifying in indirect mode");
+		}
+	}
+
 	/* Abort any previous operation */
 	retval = target_write_u32(target, io_base + SPI_CR,
 		READ_REG(SPI_CR) | BIT(SPI_ABORT));
@@ -23,6 +23,7 @@
 #endif
 #include "imp.h"
 #include <helper/time_support.h>
+#include <jtag/jtag.h>
 #include <target/image.h>
 
 /**
@@ -174,6 +175,7 @@ COMMAND_HANDLER(handle_flash_probe_command)
 		return retval;
 
 	if (p) {
+		flash_forget_state(p);
 		retval = p->driver->probe(p);
 		if (retval == ERROR_OK)
 			command_print(CMD,
@@ -199,7 +201,7 @@ COMMAND_HANDLER(handle_flash_erase_check_command)
 	if (ERROR_OK != retval)
 		return retval;
 
-	retval = p->driver->erase_check(p);
+	retval = flash_driver_erase_check(p);
 	if (retval == ERROR_OK)
 		command_print(CMD, "successfully checked erase state");
 	else {
@@ -413,6 +415,7 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 	/* flash auto-erase is disabled by default*/
 	int auto_erase = 0;
 	bool auto_unlock = false;
+	bool incremental = false;
 
 	while (CMD_ARGC) {
 		if (strcmp(CMD_ARGV[0], "erase") == 0) {
@@ -425,6 +428,11 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 			CMD_ARGV++;
 			CMD_ARGC--;
 			command_print(CMD, "auto unlock enabled");
+		} else if (strcmp(CMD_ARGV[0], "delta") == 0) {
+			incremental = true;
+			CMD_ARGV++;
+			CMD_ARGC--;
+			command_print(CMD, "delta write enabled");
 		} else
 			break;
 	}
@@ -455,7 +463,7 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 		return retval;
 
 	retval = flash_write_unlock_verify(target, &image, &written, auto_erase,
-		auto_unlock, true, false);
+		auto_unlock, true, false, incremental);
 	if (retval != ERROR_OK) {
 		image_close(&image);
 		return retval;
@@ -507,7 +515,7 @@ COMMAND_HANDLER(handle_flash_verify_image_command)
 		return retval;
 
 	retval = flash_write_unlock_verify(target, &image, &verified, false,
-		false, false, true);
+		false, false, true, false);
 	if (retval != ERROR_OK) {
 		image_close(&image);
 		return retval;
@@ -1056,6 +1064,93 @@ COMMAND_HANDLER(handle_flash_verify_bank_command)
 	return differ ? ERROR_FAIL : ERROR_OK;
 }
 
+/* Print one phase of "flash benchmark" */
+static void flash_benchmark_print(struct command_invocation *cmd, const char *what,
+		struct duration *bench, uint32_t size, int flushes)
+{
+	command_print(cmd, "%s: %" PRIu32 " bytes in %.3f ms, %.1f KiB/s, %d queue flushes",
+			what, size, duration_elapsed(bench) * 1000, duration_kbps(bench, size), flushes);
+}
+
+COMMAND_HANDLER(handle_flash_benchmark_command)
+{
+	unsigned int sector;
+	struct duration bench;
+	int flushes;
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct flash_bank *p;
+	int retval = CALL_COMMAND_HANDLER(flash_command_get_bank, 0, &p);
+	if (retval != ERROR_OK)
+		return retval;
+
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], sector);
+	if (sector >= p->num_sectors) {
+		command_print(CMD, "sector %u is out of range of flash bank %u",
+				sector, p->bank_number);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	uint32_t offset = p->sectors[sector].offset;
+	uint32_t size = p->sectors[sector].size;
+	uint8_t *pattern = malloc(size);
+	uint8_t *readback = malloc(size);
+	if (!pattern || !readback) {
+		LOG_ERROR("Out of memory");
+		retval = ERROR_FAIL;
+		goto done;
+	}
+	for (uint32_t i = 0; i < size; i++)
+		pattern[i] = rand();
+
+	LOG_WARNING("flash benchmark destroys the contents of sector %u of flash bank %u",
+			sector, p->bank_number);
+
+	flushes = jtag_get_flush_queue_count();
+	duration_start(&bench);
+	retval = flash_driver_erase(p, sector, sector);
+	duration_measure(&bench);
+	if (retval != ERROR_OK)
+		goto done;
+	flash_benchmark_print(CMD, "erase", &bench, size, jtag_get_flush_queue_count() - flushes);
+
+	flushes = jtag_get_flush_queue_count();
+	duration_start(&bench);
+	retval = flash_driver_write(p, pattern, offset, size);
+	duration_measure(&bench);
+	if (retval != ERROR_OK)
+		goto done;
+	flash_benchmark_print(CMD, "write", &bench, size, jtag_get_flush_queue_count() - flushes);
+
+	flushes = jtag_get_flush_queue_count();
+	duration_start(&bench);
+	retval = flash_driver_read(p, readback, offset, size);
+	duration_measure(&bench);
+	if (retval != ERROR_OK)
+		goto done;
+	flash_benchmark_print(CMD, "read", &bench, size, jtag_get_flush_queue_count() - flushes);
+
+	flushes = jtag_get_flush_queue_count();
+	duration_start(&bench);
+	retval = flash_driver_verify(p, pattern, offset, size);
+	duration_measure(&bench);
+	if (retval != ERROR_OK)
+		goto done;
+	flash_benchmark_print(CMD, "verify", &bench, size, jtag_get_flush_queue_count() - flushes);
+
+	if (memcmp(pattern, readback, size)) {
+		command_print(CMD, "read back data does not match what was written");
+		retval = ERROR_FAIL;
+	}
+
+done:
+	free(readback);
+	free(pattern);
+	return retval;
+}
+
 void flash_set_dirty(void)
 {
 	struct flash_bank *c;
@@ -1194,10 +1289,11 @@ static const struct command_registration flash_exec_command_handlers[] = {
 		.name = "write_image",
 		.handler = handle_flash_write_image_command,
 		.mode = COMMAND_EXEC,
-		.usage = "[erase] [unlock] filename [offset [file_type]]",
+		.usage = "[erase] [unlock] [delta] filename [offset [file_type]]",
 		.help = "Write an image to flash.  Optionally first unprotect "
 			"and/or erase the region to be used. Allow optional "
-			"offset from beginning of bank (defaults to zero)",
+			"offset from beginning of bank (defaults to zero). "
+			"With delta, sectors that already hold the image are skipped",
 	},
 	{
 		.name = "verify_image",
@@ -1224,6 +1320,14 @@ static const struct command_registration flash_exec_command_handlers[] = {
 			"flash bank. Allow optional offset from beginning of the bank "
 			"(defaults to zero).",
 	},
+	{
+		.name = "benchmark",
+		.handler = handle_flash_benchmark_command,
+		.mode = COMMAND_EXEC,
+		.usage = "bank_id sector",
+		.help = "Measure erasing, writing, reading and verifying one "
+			"sector. Destroys the sector's contents.",
+	},
 	{
 		.name = "protect",
 		.handler = handle_flash_protect_command,
@@ -19,11 +19,22 @@ proc program {filename args} {
 	set exit 0
 	set needsflash 1
 
-	foreach arg $args {
+	set plain_args {}
+
+	for {set i 0} {$i < [llength $args]} {incr i} {
+		set arg [lindex $args $i]
+		if {[string equal $arg "-gang"]} {
+			incr i
+			set gang [lindex $args $i]
+			continue
+		}
+		lappend plain_args $arg
 		if {[string equal $arg "preverify"]} {
 			set preverify 1
 		} elseif {[string equal $arg "verify"]} {
 			set verify 1
+		} elseif {[string equal $arg "delta"]} {
+			set delta 1
 		} elseif {[string equal $arg "reset"]} {
 			set reset 1
 		} elseif {[string equal $arg "exit"]} {
@@ -33,6 +44,10 @@ proc program {filename args} {
 		}
 	}
 
+	if {[info exists gang]} {
+		return [program_gang $filename $gang $exit $plain_args]
+	}
+
 	# Set variables
 	set filename \{$filename\}
 	if {[info exists address]} {
@@ -65,7 +80,12 @@ proc program {filename args} {
 	if {$needsflash == 1} {
 		echo "** Programming Started **"
 
-		if {[catch {eval flash write_image erase $flash_args}] == 0} {
+		if {[info exists delta]} {
+			set write_args "erase delta $flash_args"
+		} else {
+			set write_args "erase $flash_args"
+		}
+		if {[catch {eval flash write_image $write_args}] == 0} {
 			echo "** Programming Finished **"
 			if {[info exists verify]} {
 				# verify phase
@@ -98,8 +118,88 @@ proc program {filename args} {
 	return
 }
 
-add_help_text program "write an image to flash, address is only required for binary images. verify, reset, exit are optional"
-add_usage_text program "<filename> \[address\] \[pre-verify\] \[verify\] \[reset\] \[exit\]"
+# program the same image into several targets sharing this OpenOCD process,
+# e.g. identical boards daisy-chained on one JTAG adapter. All targets are
+# reset and halted together, each one is written and verified in turn, and
+# they are released together, so a failing board doesn't stop the others.
+proc program_gang {filename gang exit plain_args} {
+	if {[llength $gang] == 0 || [string equal $gang "all"]} {
+		set gang [target names]
+	}
+
+	set filename \{$filename\}
+	set flash_args "$filename"
+	foreach arg $plain_args {
+		if {[lsearch {preverify verify delta reset exit} $arg] >= 0} {
+			set $arg 1
+		} else {
+			set flash_args "$filename $arg"
+		}
+	}
+
+	if {[catch {init}] != 0} {
+		program_error "** OpenOCD init failed **" 1
+	}
+
+	if {[catch {reset init}] != 0} {
+		program_error "** Unable to reset targets **" $exit
+	}
+
+	set current [target current]
+	set failed {}
+	foreach t $gang {
+		targets $t
+
+		if {[info exists preverify]} {
+			if {[catch {eval verify_image $flash_args}] == 0} {
+				echo "** $t: Verified OK - No flashing **"
+				continue
+			}
+		}
+
+		echo "** $t: Programming Started **"
+		if {[info exists delta]} {
+			set write_args "erase delta $flash_args"
+		} else {
+			set write_args "erase $flash_args"
+		}
+		if {[catch {eval flash write_image $write_args}] != 0} {
+			echo "** $t: Programming Failed **"
+			lappend failed $t
+			continue
+		}
+		if {[info exists verify]} {
+			if {[catch {eval verify_image $flash_args}] != 0} {
+				echo "** $t: Verify Failed **"
+				lappend failed $t
+				continue
+			}
+			echo "** $t: Verified OK **"
+		}
+		echo "** $t: Programming Finished **"
+	}
+	targets $current
+
+	if {[info exists reset]} {
+		if {$exit == 1} {
+			poll off
+		}
+		echo "** Resetting Targets **"
+		reset run
+	}
+
+	if {[llength $failed] != 0} {
+		program_error "** Programming Failed on: $failed **" $exit
+	}
+
+	if {$exit == 1} {
+		shutdown
+	}
+	return
+}
+
+add_help_text program "write an image to flash, address is only required for binary images. verify, delta, reset, exit are optional. -gang writes the image into each of the listed targets (or all) in turn"
+add_usage_text program "<filename> \[address\] \[pre-verify\] \[verify\] \[delta\] \[reset\] \[exit\] \[-gang <target list>|all\]"
 
 # stm32[f0x|f3x] uses the same flash driver as the stm32f1x
 proc stm32f0x args { eval stm32f1x $args }
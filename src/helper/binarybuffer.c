@@ -51,6 +51,35 @@ static const char hex_digits[] = {
 	'a', 'b', 'c', 'd', 'e', 'f'
 };
 
+/* Both hexadecimal digits of every byte value, so that hexify() converts a
+ * byte per lookup */
+static const char hex_pairs[2 * 256 + 1] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* Value of each hexadecimal digit plus one, 0 for anything else, so that
+ * unhexify() needs no comparisons per digit */
+static const uint8_t hex_values[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
 void *buf_cpy(const void *from, void *_to, unsigned size)
 {
 	if (NULL == from || NULL == _to)
@@ -103,7 +132,17 @@ bool buf_cmp_mask(const void *_buf1, const void *_buf2,
 
 	const uint8_t *buf1 = _buf1, *buf2 = _buf2, *mask = _mask;
 	unsigned last = size / 8;
-	for (unsigned i = 0; i < last; i++) {
+	unsigned i = 0;
+	/* eight bytes at a time; memcpy() copes with any alignment */
+	for (; i + sizeof(uint64_t) <= last; i += sizeof(uint64_t)) {
+		uint64_t a, b, m;
+		memcpy(&a, buf1 + i, sizeof(a));
+		memcpy(&b, buf2 + i, sizeof(b));
+		memcpy(&m, mask + i, sizeof(m));
+		if ((a ^ b) & m)
+			return true;
+	}
+	for (; i < last; i++) {
 		if (buf_cmp_masked(buf1[i], buf2[i], mask[i]))
 			return true;
 	}
@@ -134,7 +173,7 @@ void *buf_set_buf(const void *_src, unsigned src_start,
 {
 	const uint8_t *src = _src;
 	uint8_t *dst = _dst;
-	unsigned i, sb, db, sq, dq, lb, lq;
+	unsigned sb, db, sq, dq, lb, lq;
 
 	sb = src_start / 8;
 	db = dst_start / 8;
@@ -146,29 +185,34 @@ void *buf_set_buf(const void *_src, unsigned src_start,
 	src += sb;
 	dst += db;
 
-	/* check if both buffers are on byte boundary and
-	 * len is a multiple of 8bit so we can simple copy
-	 * the buffer */
-	if ((sq == 0) && (dq == 0) &&  (lq == 0)) {
-		for (i = 0; i < lb; i++)
-			*dst++ = *src++;
+	/* check if both buffers are on byte boundary so we can simply copy
+	 * the whole bytes, and merge the remaining bits into the last one */
+	if ((sq == 0) && (dq == 0)) {
+		memcpy(dst, src, lb);
+		if (lq) {
+			uint8_t mask = (1 << lq) - 1;
+			dst[lb] = (dst[lb] & ~mask) | (src[lb] & mask);
+		}
 		return _dst;
 	}
 
-	/* fallback to slow bit copy */
-	for (i = 0; i < len; i++) {
-		if (((*src >> (sq&7)) & 1) == 1)
-			*dst |= 1 << (dq&7);
-		else
-			*dst &= ~(1 << (dq&7));
-		if (sq++ == 7) {
-			sq = 0;
-			src++;
-		}
-		if (dq++ == 7) {
-			dq = 0;
-			dst++;
-		}
+	/* otherwise fill the destination up to a byte at a time, from a
+	 * window of the two source bytes the bits may straddle */
+	while (len) {
+		unsigned n = MIN(8 - dq, len);
+		unsigned window = src[0];
+		if (sq + n > 8)
+			window |= src[1] << 8;
+		uint8_t mask = ((1 << n) - 1) << dq;
+		*dst = (*dst & ~mask) | (((window >> sq) << dq) & mask);
+
+		len -= n;
+		sq += n;
+		src += sq / 8;
+		sq %= 8;
+		dq += n;
+		dst += dq / 8;
+		dq %= 8;
 	}
 
 	return _dst;
@@ -365,27 +409,25 @@ void bit_copy_discard(struct bit_copy_queue *q)
 size_t unhexify(uint8_t *bin, const char *hex, size_t count)
 {
 	size_t i;
-	char tmp;
 
 	if (!bin || !hex)
 		return 0;
 
-	memset(bin, 0, count);
-
-	for (i = 0; i < 2 * count; i++) {
-		if (hex[i] >= 'a' && hex[i] <= 'f')
-			tmp = hex[i] - 'a' + 10;
-		else if (hex[i] >= 'A' && hex[i] <= 'F')
-			tmp = hex[i] - 'A' + 10;
-		else if (hex[i] >= '0' && hex[i] <= '9')
-			tmp = hex[i] - '0';
-		else
-			return i / 2;
+	for (i = 0; i < count; i++) {
+		uint8_t hi = hex_values[(uint8_t)hex[2 * i]];
+		uint8_t lo = hi ? hex_values[(uint8_t)hex[2 * i + 1]] : 0;
 
-		bin[i / 2] |= tmp << (4 * ((i + 1) % 2));
+		if (!lo) {
+			/* keep a lone high digit, clear the rest */
+			memset(bin + i, 0, count - i);
+			if (hi)
+				bin[i] = (hi - 1) << 4;
+			break;
+		}
+		bin[i] = ((hi - 1) << 4) | (lo - 1);
 	}
 
-	return i / 2;
+	return i;
 }
 
 /**
@@ -403,14 +445,19 @@ size_t unhexify(uint8_t *bin, const char *hex, size_t count)
 size_t hexify(char *hex, const uint8_t *bin, size_t count, size_t length)
 {
 	size_t i;
-	uint8_t tmp;
 
 	if (!length)
 		return 0;
 
-	for (i = 0; i < length - 1 && i < 2 * count; i++) {
-		tmp = (bin[i / 2] >> (4 * ((i + 1) % 2))) & 0x0f;
-		hex[i] = hex_digits[tmp];
+	size_t pairs = MIN(count, (length - 1) / 2);
+	for (i = 0; i < pairs; i++)
+		memcpy(hex + 2 * i, hex_pairs + 2 * bin[i], 2);
+	i *= 2;
+
+	/* an odd length leaves room for the high digit of one more byte */
+	if (i < length - 1 && i < 2 * count) {
+		hex[i] = hex_pairs[2 * bin[i / 2]];
+		i++;
 	}
 
 	hex[i] = 0;
@@ -49,11 +49,15 @@ static inline void buf_set_u32(uint8_t *_buffer,
 		buffer[1] = (value >> 8) & 0xff;
 		buffer[0] = (value >> 0) & 0xff;
 	} else {
-		for (unsigned i = first; i < first + num; i++) {
-			if (((value >> (i - first)) & 1) == 1)
-				buffer[i / 8] |= 1 << (i % 8);
-			else
-				buffer[i / 8] &= ~(1 << (i % 8));
+		/* a byte at a time, masking the partial bytes at either end */
+		buffer += first / 8;
+		first %= 8;
+		for (unsigned done = 0; done < num; buffer++) {
+			unsigned n = (8 - first < num - done) ? 8 - first : num - done;
+			uint8_t mask = ((1U << n) - 1) << first;
+			*buffer = (*buffer & ~mask) | ((uint8_t)((value >> done) << first) & mask);
+			done += n;
+			first = 0;
 		}
 	}
 }
@@ -88,11 +92,15 @@ static inline void buf_set_u64(uint8_t *_buffer,
 		buffer[1] = (value >> 8) & 0xff;
 		buffer[0] = (value >> 0) & 0xff;
 	} else {
-		for (unsigned i = first; i < first + num; i++) {
-			if (((value >> (i - first)) & 1) == 1)
-				buffer[i / 8] |= 1 << (i % 8);
-			else
-				buffer[i / 8] &= ~(1 << (i % 8));
+		/* a byte at a time, masking the partial bytes at either end */
+		buffer += first / 8;
+		first %= 8;
+		for (unsigned done = 0; done < num; buffer++) {
+			unsigned n = (8 - first < num - done) ? 8 - first : num - done;
+			uint8_t mask = ((1U << n) - 1) << first;
+			*buffer = (*buffer & ~mask) | ((uint8_t)((value >> done) << first) & mask);
+			done += n;
+			first = 0;
 		}
 	}
 }
@@ -117,12 +125,16 @@ static inline uint32_t buf_get_u32(const uint8_t *_buffer,
 				(((uint32_t)buffer[1]) << 8) |
 				(((uint32_t)buffer[0]) << 0);
 	} else {
-		uint32_t result = 0;
-		for (unsigned i = first; i < first + num; i++) {
-			if (((buffer[i / 8] >> (i % 8)) & 1) == 1)
-				result |= 1U << (i - first);
-		}
-		return result;
+		/* gather the (at most five) bytes holding the field, then shift */
+		if (num == 0)
+			return 0;
+		buffer += first / 8;
+		first %= 8;
+		unsigned bytes = (first + num + 7) / 8;
+		uint64_t result = 0;
+		for (unsigned i = 0; i < bytes; i++)
+			result |= (uint64_t)buffer[i] << (8 * i);
+		return (result >> first) & (((uint64_t)1 << num) - 1);
 	}
 }
 
@@ -155,11 +167,20 @@ static inline uint64_t buf_get_u64(const uint8_t *_buffer,
 				(((uint64_t)buffer[1]) << 8)  |
 				(((uint64_t)buffer[0]) << 0));
 	} else {
+		/* gather the (at most nine) bytes holding the field, then shift */
+		if (num == 0)
+			return 0;
+		buffer += first / 8;
+		first %= 8;
+		unsigned bytes = (first + num + 7) / 8;
 		uint64_t result = 0;
-		for (unsigned i = first; i < first + num; i++) {
-			if (((buffer[i / 8] >> (i % 8)) & 1) == 1)
-				result = result | ((uint64_t)1 << (uint64_t)(i - first));
-		}
+		for (unsigned i = 0; i < bytes && i < 8; i++)
+			result |= (uint64_t)buffer[i] << (8 * i);
+		result >>= first;
+		if (bytes > 8)
+			result |= (uint64_t)buffer[8] << (64 - first);
+		if (num < 64)
+			result &= ((uint64_t)1 << num) - 1;
 		return result;
 	}
 }
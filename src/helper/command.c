@@ -40,6 +40,7 @@
 #include "log.h"
 #include "time_support.h"
 #include "jim-eventloop.h"
+#include "gnulib/gl_linkedhash_map.h"
 
 /* nice short description of source file */
 #define __THIS__FILE__ "command.c"
@@ -147,31 +148,32 @@ void script_debug(Jim_Interp *interp, unsigned int argc, Jim_Obj * const *argv)
 	free(dbg);
 }
 
-static void script_command_args_free(char **words, unsigned nwords)
-{
-	for (unsigned i = 0; i < nwords; i++)
-		free(words[i]);
-	free(words);
-}
-
+/* The words and the pointers to them share one allocation, commands in
+ * tight script loops would otherwise spend more time in malloc than in
+ * their handlers. */
 static char **script_command_args_alloc(
 	unsigned argc, Jim_Obj * const *argv, unsigned *nwords)
 {
-	char **words = malloc(argc * sizeof(char *));
+	size_t size = argc * sizeof(char *);
+	for (unsigned i = 0; i < argc; i++) {
+		int len;
+		Jim_GetString(argv[i], &len);
+		size += len + 1;
+	}
+
+	char **words = malloc(size);
 	if (NULL == words)
 		return NULL;
 
-	unsigned i;
-	for (i = 0; i < argc; i++) {
+	char *p = (char *)(words + argc);
+	for (unsigned i = 0; i < argc; i++) {
 		int len;
 		const char *w = Jim_GetString(argv[i], &len);
-		words[i] = strdup(w);
-		if (words[i] == NULL) {
-			script_command_args_free(words, i);
-			return NULL;
-		}
+		memcpy(p, w, len + 1);
+		words[i] = p;
+		p += len + 1;
 	}
-	*nwords = i;
+	*nwords = argc;
 	return words;
 }
 
@@ -195,7 +197,9 @@ struct command_context *current_command_context(Jim_Interp *interp)
 static int script_command_run(Jim_Interp *interp,
 	int argc, Jim_Obj * const *argv, struct command *c)
 {
-	target_call_timer_callbacks_now(NULL);
+	/* Only what is due: forcing every periodic callback here polled all
+	 * targets before each command of a scripted loop. */
+	target_call_timer_callbacks(NULL);
 	LOG_USER_N("%s", "");	/* Keep GDB connection alive*/
 
 	unsigned nwords;
@@ -206,7 +210,7 @@ static int script_command_run(Jim_Interp *interp,
 	struct command_context *cmd_ctx = current_command_context(interp);
 	int retval = run_command(cmd_ctx, c, (const char **)words, nwords);
 
-	script_command_args_free(words, nwords);
+	free(words);
 	return command_retval_set(interp, retval);
 }
 
@@ -227,38 +231,62 @@ static struct command *command_root(struct command *c)
 	return c;
 }
 
+static bool command_name_equals(const void *x1, const void *x2)
+{
+	return strcmp(x1, x2) == 0;
+}
+
+static size_t command_name_hash(const void *x)
+{
+	size_t hash = 5381;
+	for (const unsigned char *s = x; *s; s++)
+		hash = hash * 33 + *s;
+	return hash;
+}
+
 /**
- * Find a command by name from a list of commands.
+ * Find a command by name among the children of one parent.
+ * @param map The name index of the children, may be NULL.
  * @returns Returns the named command if it exists in the list.
  * Returns NULL otherwise.
  */
-static struct command *command_find(struct command *head, const char *name)
+static struct command *command_find(gl_map_t map, const char *name)
 {
-	for (struct command *cc = head; cc; cc = cc->next) {
-		if (strcmp(cc->name, name) == 0)
-			return cc;
-	}
-	return NULL;
+	if (!map)
+		return NULL;
+	return (struct command *)gl_map_get(map, name);
 }
 
 struct command *command_find_in_context(struct command_context *cmd_ctx,
 	const char *name)
 {
-	return command_find(cmd_ctx->commands, name);
+	return command_find(cmd_ctx->commands_by_name, name);
 }
 
 /**
- * Add the command into the linked list, sorted by name.
+ * Add the command into the linked list, sorted by name, and index it.
+ * The list is what help walks, the index is what lookups use.
  * @param head Address to head of command list pointer, which may be
  * updated if @c c gets inserted at the beginning of the list.
+ * @param map Address of the name index of that list, created on first use.
  * @param c The command to add to the list pointed to by @c head.
  */
-static void command_add_child(struct command **head, struct command *c)
+static int command_add_child(struct command **head, gl_map_t *map,
+	struct command *c)
 {
 	assert(head);
+	if (!*map) {
+		*map = gl_map_nx_create_empty(GL_LINKEDHASH_MAP, command_name_equals,
+				command_name_hash, NULL, NULL);
+		if (!*map)
+			return ERROR_FAIL;
+	}
+	if (gl_map_nx_put(*map, c->name, c) == -1)
+		return ERROR_FAIL;
+
 	if (NULL == *head) {
 		*head = c;
-		return;
+		return ERROR_OK;
 	}
 
 	while ((*head)->next && (strcmp(c->name, (*head)->name) > 0))
@@ -271,6 +299,7 @@ static void command_add_child(struct command **head, struct command *c)
 		c->next = *head;
 		*head = c;
 	}
+	return ERROR_OK;
 }
 
 static struct command **command_list_for_parent(
@@ -279,6 +308,12 @@ static struct command **command_list_for_parent(
 	return parent ? &parent->children : &cmd_ctx->commands;
 }
 
+static gl_map_t *command_map_for_parent(
+	struct command_context *cmd_ctx, struct command *parent)
+{
+	return parent ? &parent->children_by_name : &cmd_ctx->commands_by_name;
+}
+
 static void command_free(struct command *c)
 {
 	/** @todo if command has a handler, unregister its jim command! */
@@ -288,6 +323,8 @@ static void command_free(struct command *c)
 		c->children = tmp->next;
 		command_free(tmp);
 	}
+	if (c->children_by_name)
+		gl_map_free(c->children_by_name);
 
 	free(c->name);
 	free(c->help);
@@ -333,7 +370,9 @@ static struct command *command_new(struct command_context *cmd_ctx,
 	c->jim_handler = cr->jim_handler;
 	c->mode = cr->mode;
 
-	command_add_child(command_list_for_parent(cmd_ctx, parent), c);
+	if (command_add_child(command_list_for_parent(cmd_ctx, parent),
+			command_map_for_parent(cmd_ctx, parent), c) != ERROR_OK)
+		goto command_new_error;
 
 	return c;
 
@@ -366,8 +405,7 @@ static struct command *register_command(struct command_context *context,
 		return NULL;
 
 	const char *name = cr->name;
-	struct command **head = command_list_for_parent(context, parent);
-	struct command *c = command_find(*head, name);
+	struct command *c = command_find(*command_map_for_parent(context, parent), name);
 	if (NULL != c) {
 		/* TODO: originally we treated attempting to register a cmd twice as an error
 		 * Sometimes we need this behaviour, such as with flash banks.
@@ -437,6 +475,11 @@ int unregister_all_commands(struct command_context *context,
 		*head = tmp->next;
 		command_free(tmp);
 	}
+	gl_map_t *map = command_map_for_parent(context, parent);
+	if (*map) {
+		gl_map_free(*map);
+		*map = NULL;
+	}
 
 	return ERROR_OK;
 }
@@ -457,6 +500,7 @@ static int unregister_command(struct command_context *context,
 			p->next = c->next;
 		else
 			*head = c->next;
+		gl_map_remove(*command_map_for_parent(context, parent), c->name);
 
 		command_free(c);
 		return ERROR_OK;
@@ -800,18 +844,18 @@ static int jim_capture(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
 	return retcode;
 }
 
-static COMMAND_HELPER(command_help_find, struct command *head,
+static COMMAND_HELPER(command_help_find, gl_map_t map,
 	struct command **out)
 {
 	if (0 == CMD_ARGC)
 		return ERROR_COMMAND_SYNTAX_ERROR;
-	*out = command_find(head, CMD_ARGV[0]);
+	*out = command_find(map, CMD_ARGV[0]);
 	if (NULL == *out)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 	if (--CMD_ARGC == 0)
 		return ERROR_OK;
 	CMD_ARGV++;
-	return CALL_COMMAND_HANDLER(command_help_find, (*out)->children, out);
+	return CALL_COMMAND_HANDLER(command_help_find, (*out)->children_by_name, out);
 }
 
 static COMMAND_HELPER(command_help_show, struct command *c, unsigned n,
@@ -949,16 +993,16 @@ COMMAND_HANDLER(handle_help_command)
 }
 
 static int command_unknown_find(unsigned argc, Jim_Obj *const *argv,
-	struct command *head, struct command **out)
+	gl_map_t map, struct command **out)
 {
 	if (0 == argc)
 		return argc;
 	const char *cmd_name = Jim_GetString(argv[0], NULL);
-	struct command *c = command_find(head, cmd_name);
+	struct command *c = command_find(map, cmd_name);
 	if (NULL == c)
 		return argc;
 	*out = c;
-	return command_unknown_find(--argc, ++argv, (*out)->children, out);
+	return command_unknown_find(--argc, ++argv, (*out)->children_by_name, out);
 }
 
 static char *alloc_concatenate_strings(int argc, Jim_Obj * const *argv)
@@ -1025,8 +1069,8 @@ static int command_unknown(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
 	script_debug(interp, argc, argv);
 
 	struct command_context *cmd_ctx = current_command_context(interp);
-	struct command *c = cmd_ctx->commands;
-	int remaining = command_unknown_find(argc, argv, c, &c);
+	struct command *c = NULL;
+	int remaining = command_unknown_find(argc, argv, cmd_ctx->commands_by_name, &c);
 	/* if nothing could be consumed, then it's really an unknown command */
 	if (remaining == argc) {
 		const char *cmd = Jim_GetString(argv[0], NULL);
@@ -1064,8 +1108,9 @@ static int jim_command_mode(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
 	enum command_mode mode;
 
 	if (argc > 1) {
-		struct command *c = cmd_ctx->commands;
-		int remaining = command_unknown_find(argc - 1, argv + 1, c, &c);
+		struct command *c = NULL;
+		int remaining = command_unknown_find(argc - 1, argv + 1,
+				cmd_ctx->commands_by_name, &c);
 		/* if nothing could be consumed, then it's an unknown command */
 		if (remaining == argc - 1) {
 			Jim_SetResultString(interp, "unknown", -1);
@@ -1097,8 +1142,8 @@ static int jim_command_mode(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
 int help_add_command(struct command_context *cmd_ctx, struct command *parent,
 	const char *cmd_name, const char *help_text, const char *usage)
 {
-	struct command **head = command_list_for_parent(cmd_ctx, parent);
-	struct command *nc = command_find(*head, cmd_name);
+	struct command *nc = command_find(*command_map_for_parent(cmd_ctx, parent),
+			cmd_name);
 	if (NULL == nc) {
 		/* add a new command with help text */
 		struct command_registration cr = {
@@ -1163,8 +1208,8 @@ COMMAND_HANDLER(handle_help_add_command)
 
 	struct command *c = NULL;
 	if (CMD_ARGC > 0) {
-		c = CMD_CTX->commands;
-		int retval = CALL_COMMAND_HANDLER(command_help_find, c, &c);
+		int retval = CALL_COMMAND_HANDLER(command_help_find,
+				CMD_CTX->commands_by_name, &c);
 		if (ERROR_OK != retval)
 			return retval;
 	}
@@ -53,6 +53,8 @@ struct command_context {
 	Jim_Interp *interp;
 	enum command_mode mode;
 	struct command *commands;
+	/* the commands above indexed by name, see command_find() */
+	struct gl_map_impl *commands_by_name;
 	struct target *current_target;
 		/* The target set by 'targets xx' command or the latest created */
 	struct target *current_target_override;
@@ -183,6 +185,8 @@ struct command {
 	char *usage;
 	struct command *parent;
 	struct command *children;
+	/* the children indexed by name, NULL while there are none */
+	struct gl_map_impl *children_by_name;
 	command_handler_t handler;
 	Jim_CmdProc *jim_handler;
 	void *jim_handler_data;
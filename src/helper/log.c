@@ -33,6 +33,10 @@
 
 #include <stdarg.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifdef _DEBUG_FREE_SPACE_
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
@@ -62,6 +66,70 @@ static const char * const log_strings[6] = {
 
 static int count;
 
+/* Debug messages are collected here, when log_buffer is set, and written
+ * out in one go by log_flush() */
+static char *log_buffer;
+static unsigned log_buffer_size;
+static unsigned log_buffer_used;
+
+#ifdef HAVE_PTHREAD_H
+/* The adapter I/O thread logs too, so output and keep alive are serialized.
+ * Recursive, as log callbacks and keep_alive() log themselves. */
+static pthread_mutex_t log_mutex;
+static pthread_once_t log_mutex_once = PTHREAD_ONCE_INIT;
+
+static void log_mutex_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&log_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void log_lock(void)
+{
+	pthread_once(&log_mutex_once, log_mutex_init);
+	pthread_mutex_lock(&log_mutex);
+}
+
+static void log_unlock(void)
+{
+	pthread_mutex_unlock(&log_mutex);
+}
+#else
+static inline void log_lock(void) {}
+static inline void log_unlock(void) {}
+#endif
+
+static void log_flush_unlocked(void)
+{
+	if (log_buffer_used == 0 || !log_output)
+		return;
+	fwrite(log_buffer, 1, log_buffer_used, log_output);
+	fflush(log_output);
+	log_buffer_used = 0;
+}
+
+/* Add a message to the log buffer, making room by writing it out if need be.
+ * Returns false if the message doesn't go in the buffer. */
+static bool log_buffer_put(const char *header, const char *string)
+{
+	size_t header_len = strlen(header);
+	size_t len = strlen(string);
+
+	if (header_len + len > log_buffer_size)
+		return false;
+	if (header_len + len > log_buffer_size - log_buffer_used)
+		log_flush_unlocked();
+
+	memcpy(log_buffer + log_buffer_used, header, header_len);
+	memcpy(log_buffer + log_buffer_used + header_len, string, len);
+	log_buffer_used += header_len + len;
+	return true;
+}
+
 /* forward the log to the listeners */
 static void log_forward(const char *file, unsigned line, const char *function, const char *string)
 {
@@ -85,7 +153,7 @@ static void log_forward(const char *file, unsigned line, const char *function, c
  * target_request.c).
  *
  */
-static void log_puts(enum log_levels level,
+static void log_puts_unlocked(enum log_levels level,
 	const char *file,
 	int line,
 	const char *function,
@@ -100,6 +168,10 @@ static void log_puts(enum log_levels level,
 		return;
 	}
 
+	/* anything not buffered must come after what is */
+	if (level < LOG_LVL_DEBUG)
+		log_flush_unlocked();
+
 	if (level == LOG_LVL_OUTPUT) {
 		/* do not prepend any headers, just print out what we were given and return */
 		fputs(string, log_output);
@@ -115,19 +187,26 @@ static void log_puts(enum log_levels level,
 		if (debug_level >= LOG_LVL_DEBUG) {
 			/* print with count and time information */
 			int64_t t = timeval_ms() - start;
+			char header[256];
 #ifdef _DEBUG_FREE_SPACE_
 			struct mallinfo info;
 			info = mallinfo();
 #endif
-			fprintf(log_output, "%s%d %" PRId64 " %s:%d %s()"
+			snprintf(header, sizeof(header), "%s%d %" PRId64 " %s:%d %s()"
 #ifdef _DEBUG_FREE_SPACE_
 				" %d"
 #endif
-				": %s", log_strings[level + 1], count, t, file, line, function,
+				": ", log_strings[level + 1], count, t, file, line, function
 #ifdef _DEBUG_FREE_SPACE_
-				info.fordblks,
+				, info.fordblks
 #endif
-				string);
+				);
+			/* debug messages aren't forwarded, so they can wait */
+			if (level >= LOG_LVL_DEBUG && log_buffer_put(header, string))
+				return;
+			log_flush_unlocked();
+			fputs(header, log_output);
+			fputs(string, log_output);
 		} else {
 			/* if we are using gdb through pipes then we do not want any output
 			 * to the pipe otherwise we get repeated strings */
@@ -146,6 +225,17 @@ static void log_puts(enum log_levels level,
 		log_forward(file, line, function, string);
 }
 
+static void log_puts(enum log_levels level,
+	const char *file,
+	int line,
+	const char *function,
+	const char *string)
+{
+	log_lock();
+	log_puts_unlocked(level, file, line, function, string);
+	log_unlock();
+}
+
 void log_printf(enum log_levels level,
 	const char *file,
 	unsigned line,
@@ -174,13 +264,26 @@ void log_printf(enum log_levels level,
 void log_vprintf_lf(enum log_levels level, const char *file, unsigned line,
 		const char *function, const char *format, va_list args)
 {
+	char buffer[256];
 	char *tmp;
+	va_list ap;
 
 	count++;
 
 	if (level > debug_level)
 		return;
 
+	/* most messages fit on the stack, with room for the newline */
+	va_copy(ap, args);
+	int len = vsnprintf(buffer, sizeof(buffer) - 1, format, ap);
+	va_end(ap);
+	if (len >= 0 && (size_t)len < sizeof(buffer) - 1) {
+		buffer[len] = '\n';
+		buffer[len + 1] = 0;
+		log_puts(level, file, line, function, buffer);
+		return;
+	}
+
 	tmp = alloc_vprintf(format, args);
 
 	if (!tmp)
@@ -227,8 +330,53 @@ COMMAND_HANDLER(handle_debug_level_command)
 	return ERROR_OK;
 }
 
+void log_flush(void)
+{
+	log_lock();
+	log_flush_unlocked();
+	log_unlock();
+}
+
+COMMAND_HANDLER(handle_log_buffer_command)
+{
+	static bool flush_at_exit;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned size;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], size);
+
+		char *buffer = NULL;
+		if (size > 0) {
+			buffer = malloc(size);
+			if (!buffer) {
+				LOG_ERROR("can't allocate a log buffer of %u bytes", size);
+				return ERROR_FAIL;
+			}
+		}
+
+		log_lock();
+		log_flush_unlocked();
+		free(log_buffer);
+		log_buffer = buffer;
+		log_buffer_size = size;
+		log_unlock();
+
+		if (size > 0 && !flush_at_exit)
+			flush_at_exit = atexit(log_flush) == 0;
+	}
+
+	command_print(CMD, "log_buffer: %u", log_buffer_size);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_log_output_command)
 {
+	log_flush();
+
 	if (CMD_ARGC == 0 || (CMD_ARGC == 1 && strcmp(CMD_ARGV[0], "default") == 0)) {
 		if (log_output != stderr && log_output != NULL) {
 			/* Close previous log file, if it was open and wasn't stderr. */
@@ -264,6 +412,14 @@ static const struct command_registration log_command_handlers[] = {
 		.help = "redirect logging to a file (default: stderr)",
 		.usage = "[file_name | \"default\"]",
 	},
+	{
+		.name = "log_buffer",
+		.handler = handle_log_buffer_command,
+		.mode = COMMAND_ANY,
+		.help = "collect debug messages in a buffer of this many bytes "
+			"and write them out while idle (0 to write each at once)",
+		.usage = "[size]",
+	},
 	{
 		.name = "debug_level",
 		.handler = handle_debug_level_command,
@@ -431,6 +587,8 @@ static void gdb_timeout_warning(int64_t delta_time)
 
 void keep_alive(void)
 {
+	log_lock();
+
 	current_time = timeval_ms();
 
 	int64_t delta_time = current_time - last_time;
@@ -455,11 +613,15 @@ void keep_alive(void)
 		 * These functions should be invoked at a well defined spot in server.c
 		 */
 	}
+
+	log_unlock();
 }
 
 /* reset keep alive timer without sending message */
 void kept_alive(void)
 {
+	log_lock();
+
 	current_time = timeval_ms();
 
 	int64_t delta_time = current_time - last_time;
@@ -468,6 +630,8 @@ void kept_alive(void)
 
 	if (delta_time > KEEP_ALIVE_TIMEOUT_MS)
 		gdb_timeout_warning(delta_time);
+
+	log_unlock();
 }
 
 /* if we sleep for extended periods of time, we must invoke keep_alive() intermittently */
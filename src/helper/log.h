@@ -75,6 +75,8 @@ void log_init(void);
 int set_log_output(struct command_context *cmd_ctx, FILE *output);
 
 int log_register_commands(struct command_context *cmd_ctx);
+/** Write out the debug messages collected by log_buffer. */
+void log_flush(void);
 
 void keep_alive(void);
 void kept_alive(void);
@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH		4
+/* The block format wants the last 5 bytes as literals, and no match
+ * starting in the last 12. */
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MATCH_LIMIT		12
+#define LZ4_MAX_OFFSET		0xffff
+#define LZ4_HASH_BITS		12
+
+static uint32_t lz4_read32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned int lz4_hash(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Append the extra bytes of a length that didn't fit in its token nibble */
+static uint8_t *lz4_put_length(uint8_t *out, const uint8_t *end, size_t length)
+{
+	for (length -= 15; length >= 255; length -= 255) {
+		if (out == end)
+			return NULL;
+		*out++ = 255;
+	}
+	if (out == end)
+		return NULL;
+	*out++ = length;
+	return out;
+}
+
+/* Append one sequence: literals, then a match unless match_length is 0 */
+static uint8_t *lz4_put_sequence(uint8_t *out, const uint8_t *end,
+		const uint8_t *literals, size_t literal_length,
+		size_t offset, size_t match_length)
+{
+	if (out == end)
+		return NULL;
+
+	uint8_t *token = out++;
+	*token = (literal_length < 15 ? literal_length : 15) << 4;
+	if (literal_length >= 15) {
+		out = lz4_put_length(out, end, literal_length);
+		if (!out)
+			return NULL;
+	}
+
+	if ((size_t)(end - out) < literal_length)
+		return NULL;
+	memcpy(out, literals, literal_length);
+	out += literal_length;
+
+	if (match_length == 0)
+		return out;
+
+	if (end - out < 2)
+		return NULL;
+	*out++ = offset;
+	*out++ = offset >> 8;
+
+	match_length -= LZ4_MIN_MATCH;
+	*token |= match_length < 15 ? match_length : 15;
+	if (match_length >= 15)
+		out = lz4_put_length(out, end, match_length);
+	return out;
+}
+
+size_t lz4_compress_block(const uint8_t *src, size_t size,
+		uint8_t *dst, size_t capacity)
+{
+	/* positions + 1, so 0 means empty */
+	uint32_t table[1 << LZ4_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	uint8_t *out = dst;
+	const uint8_t *end = dst + capacity;
+	size_t anchor = 0;
+	size_t pos = 0;
+
+	while (size >= LZ4_MATCH_LIMIT && pos <= size - LZ4_MATCH_LIMIT) {
+		uint32_t sequence = lz4_read32(src + pos);
+		unsigned int hash = lz4_hash(sequence);
+		size_t candidate = table[hash];
+		table[hash] = pos + 1;
+
+		if (candidate == 0 || pos - (candidate - 1) > LZ4_MAX_OFFSET ||
+				lz4_read32(src + candidate - 1) != sequence) {
+			pos++;
+			continue;
+		}
+
+		size_t match = candidate - 1;
+		size_t length = LZ4_MIN_MATCH;
+		while (pos + length < size - LZ4_LAST_LITERALS &&
+				src[match + length] == src[pos + length])
+			length++;
+
+		out = lz4_put_sequence(out, end, src + anchor, pos - anchor,
+				pos - match, length);
+		if (!out)
+			return 0;
+
+		pos += length;
+		anchor = pos;
+	}
+
+	out = lz4_put_sequence(out, end, src + anchor, size - anchor, 0, 0);
+	if (!out)
+		return 0;
+
+	return out - dst;
+}
@@ -0,0 +1,32 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_HELPER_LZ4_H
+#define OPENOCD_HELPER_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Compress @a size bytes at @a src into an LZ4 block (the format without
+ * frame header) of at most @a capacity bytes at @a dst. This favours a
+ * small, simple implementation over compression ratio; the decompressors
+ * run on targets while images are loaded.
+ * @returns the size of the block, or 0 if it doesn't fit in @a capacity.
+ */
+size_t lz4_compress_block(const uint8_t *src, size_t size,
+		uint8_t *dst, size_t capacity);
+
+#endif /* OPENOCD_HELPER_LZ4_H */
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "perf.h"
+#include "log.h"
+#include "command.h"
+#include "time_support.h"
+
+/*
+ * Counters behind the "perf" command. They are updated unconditionally
+ * from the hot paths, so recording is kept to a few additions; the time
+ * is taken with gettimeofday(), which is cheap compared to anything that
+ * talks to an adapter.
+ */
+
+struct perf_stat {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t us;
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+} perf_event_info[PERF_EVENTS] = {
+	[PERF_JTAG_EXECUTE_QUEUE] = { "jtag_execute_queue", NULL },
+	[PERF_JTAG_SCAN] = { "jtag_scan", "bits" },
+	[PERF_TARGET_POLL] = { "target_poll", NULL },
+	[PERF_TARGET_READ_MEMORY] = { "target_read_memory", "bytes" },
+	[PERF_TARGET_WRITE_MEMORY] = { "target_write_memory", "bytes" },
+	[PERF_TARGET_READ_BATCH] = { "target_read_memory_batch", "bytes" },
+	[PERF_TARGET_WRITE_BATCH] = { "target_write_memory_batch", "bytes" },
+	[PERF_TARGET_ALGORITHM] = { "target_run_algorithm", NULL },
+};
+
+static struct perf_stat perf_stats[PERF_EVENTS];
+/* indexed by the first character of the packet */
+static struct perf_stat perf_gdb_stats[128];
+static int64_t perf_since;
+
+int64_t perf_now(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void perf_add(struct perf_stat *stat, uint64_t bytes, int64_t start)
+{
+	stat->calls++;
+	stat->bytes += bytes;
+	if (start)
+		stat->us += perf_now() - start;
+}
+
+void perf_record(enum perf_event event, uint64_t bytes, int64_t start)
+{
+	perf_add(&perf_stats[event], bytes, start);
+}
+
+void perf_record_gdb(char packet, int64_t start)
+{
+	if (packet < 0x20 || packet > 0x7e)
+		packet = '?';
+	perf_add(&perf_gdb_stats[(unsigned char)packet], 0, start);
+}
+
+static void perf_reset(void)
+{
+	memset(perf_stats, 0, sizeof(perf_stats));
+	memset(perf_gdb_stats, 0, sizeof(perf_gdb_stats));
+	perf_since = perf_now();
+}
+
+COMMAND_HANDLER(handle_perf_reset_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	perf_reset();
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_perf_report_command)
+{
+	bool json = false;
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "json"))
+		json = true;
+	else if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!perf_since)
+		perf_since = perf_now();
+	int64_t elapsed = perf_now() - perf_since;
+
+	if (json) {
+		command_print_sameline(CMD, "{\"elapsed_us\": %" PRId64 ", \"events\": {", elapsed);
+		for (unsigned int i = 0; i < PERF_EVENTS; i++) {
+			const struct perf_stat *stat = &perf_stats[i];
+			command_print_sameline(CMD, "%s\"%s\": {\"calls\": %" PRIu64 ", \"us\": %" PRIu64,
+					i ? ", " : "", perf_event_info[i].name, stat->calls, stat->us);
+			if (perf_event_info[i].unit)
+				command_print_sameline(CMD, ", \"%s\": %" PRIu64,
+						perf_event_info[i].unit, stat->bytes);
+			command_print_sameline(CMD, "}");
+		}
+		command_print_sameline(CMD, "}, \"gdb_packets\": {");
+		bool first = true;
+		for (unsigned int i = 0; i < ARRAY_SIZE(perf_gdb_stats); i++) {
+			const struct perf_stat *stat = &perf_gdb_stats[i];
+			if (!stat->calls)
+				continue;
+			/* packet types are printable, but may be '"' or '\\' in theory */
+			command_print_sameline(CMD, "%s\"%s%c\": {\"calls\": %" PRIu64 ", \"us\": %" PRIu64 "}",
+					first ? "" : ", ", (i == '"' || i == '\\') ? "\\" : "", i,
+					stat->calls, stat->us);
+			first = false;
+		}
+		command_print(CMD, "}}");
+		return ERROR_OK;
+	}
+
+	command_print(CMD, "%-26s %10s %14s %12s", "event", "calls", "bytes/bits", "ms");
+	for (unsigned int i = 0; i < PERF_EVENTS; i++) {
+		const struct perf_stat *stat = &perf_stats[i];
+		if (perf_event_info[i].unit)
+			command_print(CMD, "%-26s %10" PRIu64 " %14" PRIu64 " %12.3f",
+					perf_event_info[i].name, stat->calls, stat->bytes, stat->us / 1000.0);
+		else
+			command_print(CMD, "%-26s %10" PRIu64 " %14s %12.3f",
+					perf_event_info[i].name, stat->calls, "", stat->us / 1000.0);
+	}
+	for (unsigned int i = 0; i < ARRAY_SIZE(perf_gdb_stats); i++) {
+		const struct perf_stat *stat = &perf_gdb_stats[i];
+		if (stat->calls)
+			command_print(CMD, "gdb packet '%c'%-12s %10" PRIu64 " %14s %12.3f",
+					i, "", stat->calls, "", stat->us / 1000.0);
+	}
+	command_print(CMD, "%.3f ms since perf reset", elapsed / 1000.0);
+
+	return ERROR_OK;
+}
+
+static const struct command_registration perf_subcommand_handlers[] = {
+	{
+		.name = "reset",
+		.handler = handle_perf_reset_command,
+		.mode = COMMAND_ANY,
+		.help = "clear the operation counters and timers",
+		.usage = "",
+	},
+	{
+		.name = "report",
+		.handler = handle_perf_report_command,
+		.mode = COMMAND_ANY,
+		.help = "show how many JTAG, target and GDB operations ran "
+			"since the last reset, and how long they took",
+		.usage = "['json']",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration perf_command_handlers[] = {
+	{
+		.name = "perf",
+		.mode = COMMAND_ANY,
+		.help = "operation counters for finding slow paths",
+		.usage = "",
+		.chain = perf_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+int perf_register_commands(struct command_context *cmd_ctx)
+{
+	perf_since = perf_now();
+	return register_commands(cmd_ctx, NULL, perf_command_handlers);
+}
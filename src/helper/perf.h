@@ -0,0 +1,48 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_HELPER_PERF_H
+#define OPENOCD_HELPER_PERF_H
+
+#include <stdint.h>
+
+struct command_context;
+
+/* Operations counted for the "perf" command */
+enum perf_event {
+	PERF_JTAG_EXECUTE_QUEUE,	/* jtag_execute_queue() runs */
+	PERF_JTAG_SCAN,				/* IR and DR scans queued, bits shifted */
+	PERF_TARGET_POLL,
+	PERF_TARGET_READ_MEMORY,	/* target_read_memory() calls, bytes read */
+	PERF_TARGET_WRITE_MEMORY,
+	PERF_TARGET_READ_BATCH,		/* target_read_memory_batch() calls */
+	PERF_TARGET_WRITE_BATCH,
+	PERF_TARGET_ALGORITHM,		/* helper algorithms run on targets */
+	PERF_EVENTS
+};
+
+/** Time in microseconds, to pass to perf_record() later */
+int64_t perf_now(void);
+
+/** Count one @a event, moving @a bytes (or bits, for scans) and started
+ * at @a start, as returned by perf_now(). A @a start of 0 records no time. */
+void perf_record(enum perf_event event, uint64_t bytes, int64_t start);
+
+/** Count one GDB packet of the type @a packet, started at @a start */
+void perf_record_gdb(char packet, int64_t start);
+
+int perf_register_commands(struct command_context *cmd_ctx);
+
+#endif /* OPENOCD_HELPER_PERF_H */
@@ -381,11 +381,19 @@ COMMAND_HANDLER(handle_adapter_srst_pulse_width_command)
 
 COMMAND_HANDLER(handle_adapter_speed_command)
 {
-	if (CMD_ARGC > 1)
+	if (CMD_ARGC > 2 || (CMD_ARGC == 2 && strcmp(CMD_ARGV[0], "auto")))
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
 	int retval = ERROR_OK;
-	if (CMD_ARGC == 1) {
+	if (CMD_ARGC >= 1 && !strcmp(CMD_ARGV[0], "auto")) {
+		unsigned max_khz = 100000;
+		if (CMD_ARGC == 2)
+			COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], max_khz);
+		unsigned khz;
+		retval = jtag_config_khz_auto(max_khz, &khz);
+		if (ERROR_OK != retval)
+			return retval;
+	} else if (CMD_ARGC == 1) {
 		unsigned khz = 0;
 		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], khz);
 
@@ -552,9 +560,10 @@ static const struct command_registration adapter_command_handlers[] = {
 		.mode = COMMAND_ANY,
 		.help = "With an argument, change to the specified maximum "
 			"jtag speed.  For JTAG, 0 KHz signifies adaptive "
-			"clocking. "
+			"clocking. 'auto' searches for the fastest speed "
+			"the scan chain passes data through reliably. "
 			"With or without argument, display current setting.",
-		.usage = "[khz]",
+		.usage = "[khz | 'auto' [max_khz]]",
 	},
 	{
 		.name = "list",
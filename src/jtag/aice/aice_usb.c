@@ -436,6 +436,11 @@ static uint32_t usb_out_packets_buffer_length;
 static uint32_t usb_in_packets_buffer_length;
 static enum aice_command_mode aice_command_mode;
 
+/* Command code of each packed command, checked against its acknowledge
+ * on flush; all packed commands answer with a DTHMB */
+static uint8_t usb_pack_cmd_codes[AICE_OUT_PACK_COMMAND_SIZE / AICE_FORMAT_HTDMC];
+static uint32_t usb_pack_cmd_count;
+
 static int aice_batch_buffer_write(uint8_t buf_index, const uint8_t *word,
 		uint32_t num_of_words);
 
@@ -458,6 +463,17 @@ static int aice_usb_packet_flush(void)
 		usb_out_packets_buffer_length = 0;
 		usb_in_packets_buffer_length = 0;
 
+		uint32_t count = usb_pack_cmd_count;
+		usb_pack_cmd_count = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			uint8_t cmd_ack_code = usb_in_packets_buffer[i * AICE_FORMAT_DTHMB];
+			if (cmd_ack_code != usb_pack_cmd_codes[i]) {
+				LOG_ERROR("aice packed command %" PRIu32 " failed (command=0x%" PRIx8
+						", response=0x%" PRIx8 ")", i, usb_pack_cmd_codes[i], cmd_ack_code);
+				return ERROR_FAIL;
+			}
+		}
+
 	} else if (AICE_COMMAND_MODE_BATCH == aice_command_mode) {
 		LOG_DEBUG("Flush usb packets (AICE_COMMAND_MODE_BATCH)");
 
@@ -526,6 +542,9 @@ static int aice_usb_packet_append(uint8_t *out_buffer, int out_length, int in_le
 
 	LOG_DEBUG("Append usb packets 0x%02x", out_buffer[0]);
 
+	if (AICE_COMMAND_MODE_PACK == aice_command_mode)
+		usb_pack_cmd_codes[usb_pack_cmd_count++] = out_buffer[0];
+
 	memcpy(usb_out_packets_buffer + usb_out_packets_buffer_length, out_buffer, out_length);
 	usb_out_packets_buffer_length += out_length;
 	usb_in_packets_buffer_length += in_length;
@@ -941,9 +960,8 @@ static int aice_write_misc(uint8_t target_id, uint32_t address, uint32_t data)
 {
 	int retry_times = 0;
 
-	if (AICE_COMMAND_MODE_PACK == aice_command_mode) {
-		aice_usb_packet_flush();
-	} else if (AICE_COMMAND_MODE_BATCH == aice_command_mode) {
+	if ((AICE_COMMAND_MODE_PACK == aice_command_mode) ||
+		(AICE_COMMAND_MODE_BATCH == aice_command_mode)) {
 		aice_pack_htdmc(AICE_CMD_T_WRITE_MISC, target_id, 0, address, data,
 				AICE_LITTLE_ENDIAN);
 		return aice_usb_packet_append(usb_out_buffer, AICE_FORMAT_HTDMC,
@@ -1455,9 +1473,8 @@ static int aice_fastwrite_mem(uint8_t target_id, const uint8_t *word, uint32_t n
 {
 	int retry_times = 0;
 
-	if (AICE_COMMAND_MODE_PACK == aice_command_mode) {
-		aice_usb_packet_flush();
-	} else if (AICE_COMMAND_MODE_BATCH == aice_command_mode) {
+	if ((AICE_COMMAND_MODE_PACK == aice_command_mode) ||
+		(AICE_COMMAND_MODE_BATCH == aice_command_mode)) {
 		aice_pack_htdmd_multiple_data(AICE_CMD_T_FASTWRITE_MEM, target_id,
 				num_of_words - 1, 0, word, data_endian);
 		return aice_usb_packet_append(usb_out_buffer,
@@ -3204,6 +3221,28 @@ static int aice_usb_write_mem_w_dim(uint32_t coreid, uint32_t address, uint32_t
 	return ERROR_OK;
 }
 
+static int aice_usb_set_command_mode(enum aice_command_mode command_mode);
+
+/* Writes through the bus need no answer before the next one, pack them
+ * into as few USB transactions as fit unless a command mode was chosen
+ * explicitly. Returns whether packing was started. */
+static bool aice_usb_pack_begin(void)
+{
+	if (AICE_COMMAND_MODE_NORMAL != aice_command_mode)
+		return false;
+
+	return aice_usb_set_command_mode(AICE_COMMAND_MODE_PACK) == ERROR_OK;
+}
+
+static int aice_usb_pack_end(bool packing, int retval)
+{
+	if (!packing)
+		return retval;
+
+	int flush_retval = aice_usb_set_command_mode(AICE_COMMAND_MODE_NORMAL);
+	return (retval != ERROR_OK) ? retval : flush_retval;
+}
+
 static int aice_usb_write_memory_unit(uint32_t coreid, uint32_t addr, uint32_t size,
 		uint32_t count, const uint8_t *buffer)
 {
@@ -3211,8 +3250,11 @@ static int aice_usb_write_memory_unit(uint32_t coreid, uint32_t addr, uint32_t s
 			", size: %" PRIu32 ", count: %" PRIu32 "",
 			addr, size, count);
 
+	bool packing = false;
 	if (NDS_MEMORY_ACC_CPU == core_info[coreid].access_channel)
 		aice_usb_set_address_dim(coreid, addr);
+	else
+		packing = aice_usb_pack_begin();
 
 	size_t i;
 	write_mem_func_t write_mem_func;
@@ -3262,7 +3304,7 @@ static int aice_usb_write_memory_unit(uint32_t coreid, uint32_t addr, uint32_t s
 			break;
 	}
 
-	return ERROR_OK;
+	return aice_usb_pack_end(packing, ERROR_OK);
 }
 
 static int aice_bulk_read_mem(uint32_t coreid, uint32_t addr, uint32_t count,
@@ -3294,25 +3336,33 @@ static int aice_bulk_write_mem(uint32_t coreid, uint32_t addr, uint32_t count,
 		const uint8_t *buffer)
 {
 	uint32_t packet_size;
+	int retval = ERROR_OK;
+
+	/* the SBAR write goes out with the data instead of on its own */
+	bool packing = aice_usb_pack_begin();
 
 	while (count > 0) {
 		packet_size = (count >= 0x100) ? 0x100 : count;
 
 		/** set address */
 		addr &= 0xFFFFFFFC;
-		if (aice_write_misc(coreid, NDS_EDM_MISC_SBAR, addr | 1) != ERROR_OK)
-			return ERROR_FAIL;
+		if (aice_write_misc(coreid, NDS_EDM_MISC_SBAR, addr | 1) != ERROR_OK) {
+			retval = ERROR_FAIL;
+			break;
+		}
 
 		if (aice_fastwrite_mem(coreid, buffer,
-					packet_size) != ERROR_OK)
-			return ERROR_FAIL;
+					packet_size) != ERROR_OK) {
+			retval = ERROR_FAIL;
+			break;
+		}
 
 		buffer += (packet_size * 4);
 		addr += (packet_size * 4);
 		count -= packet_size;
 	}
 
-	return ERROR_OK;
+	return aice_usb_pack_end(packing, retval);
 }
 
 static int aice_usb_bulk_read_mem(uint32_t coreid, uint32_t addr,
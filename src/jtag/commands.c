@@ -33,17 +33,33 @@
 #include <jtag/jtag.h>
 #include <transport/transport.h>
 #include "commands.h"
+#include "interface.h"
 
 struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
 	size_t used;
+	size_t size;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
 static struct cmd_queue_page *cmd_queue_pages;
 static struct cmd_queue_page *cmd_queue_pages_tail;
 
+/* Pages of CMD_QUEUE_PAGE_SIZE kept from earlier flushes, so that queueing
+ * commands doesn't malloc() and fault in a fresh page after every flush.
+ * Every CMD_QUEUE_SHRINK_FLUSHES flushes, the pages that none of those
+ * flushes needed are freed. */
+#define CMD_QUEUE_SHRINK_FLUSHES	1000
+static struct cmd_queue_page *cmd_queue_free_pages;
+static unsigned int cmd_queue_free_page_count;
+/* Pages the current queue uses, and the most any queue used since the last
+ * shrink. */
+static unsigned int cmd_queue_page_count;
+static unsigned int cmd_queue_recent_pages;
+static unsigned int cmd_queue_flushes;
+static struct jtag_queue_stats cmd_queue_stats;
+
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
 
@@ -119,35 +135,84 @@ void *cmd_queue_alloc(size_t size)
 	}
 
 	if (!*p_page) {
-		*p_page = malloc(sizeof(struct cmd_queue_page));
+		if (size <= CMD_QUEUE_PAGE_SIZE && cmd_queue_free_pages) {
+			*p_page = cmd_queue_free_pages;
+			cmd_queue_free_pages = cmd_queue_free_pages->next;
+			cmd_queue_free_page_count--;
+		} else {
+			*p_page = malloc(sizeof(struct cmd_queue_page));
+			size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
+						CMD_QUEUE_PAGE_SIZE : size;
+			(*p_page)->address = malloc(alloc_size);
+			(*p_page)->size = alloc_size;
+			cmd_queue_stats.page_mallocs++;
+		}
 		(*p_page)->used = 0;
-		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
-					CMD_QUEUE_PAGE_SIZE : size;
-		(*p_page)->address = malloc(alloc_size);
 		(*p_page)->next = NULL;
 		cmd_queue_pages_tail = *p_page;
+		cmd_queue_page_count++;
 	}
 
 	offset = (*p_page)->used;
 	(*p_page)->used += size;
+	cmd_queue_stats.bytes += size;
 
 	t = (*p_page)->address;
 	return t + offset;
 }
 
+static void cmd_queue_page_free(struct cmd_queue_page *page)
+{
+	free(page->address);
+	free(page);
+}
+
+/* Put the pages of the queue that was just executed on the free list, and
+ * trim that list when it has been bigger than needed for a while. */
 static void cmd_queue_free(void)
 {
 	struct cmd_queue_page *page = cmd_queue_pages;
 
 	while (page) {
-		struct cmd_queue_page *last = page;
-		free(page->address);
-		page = page->next;
-		free(last);
+		struct cmd_queue_page *next = page->next;
+		if (page->size == CMD_QUEUE_PAGE_SIZE) {
+			page->next = cmd_queue_free_pages;
+			cmd_queue_free_pages = page;
+			cmd_queue_free_page_count++;
+		} else {
+			cmd_queue_page_free(page);
+		}
+		page = next;
 	}
 
 	cmd_queue_pages = NULL;
 	cmd_queue_pages_tail = NULL;
+
+	if (cmd_queue_stats.bytes > cmd_queue_stats.high_water_bytes)
+		cmd_queue_stats.high_water_bytes = cmd_queue_stats.bytes;
+	if (cmd_queue_page_count > cmd_queue_stats.high_water_pages)
+		cmd_queue_stats.high_water_pages = cmd_queue_page_count;
+	if (cmd_queue_page_count > cmd_queue_recent_pages)
+		cmd_queue_recent_pages = cmd_queue_page_count;
+	cmd_queue_stats.bytes = 0;
+	cmd_queue_page_count = 0;
+
+	if (++cmd_queue_flushes < CMD_QUEUE_SHRINK_FLUSHES)
+		return;
+	while (cmd_queue_free_page_count > cmd_queue_recent_pages) {
+		page = cmd_queue_free_pages;
+		cmd_queue_free_pages = page->next;
+		cmd_queue_free_page_count--;
+		cmd_queue_page_free(page);
+	}
+	cmd_queue_flushes = 0;
+	cmd_queue_recent_pages = 0;
+}
+
+void jtag_command_queue_stats(struct jtag_queue_stats *stats)
+{
+	*stats = cmd_queue_stats;
+	stats->pooled_pages = cmd_queue_free_page_count;
 }
 
 void jtag_command_queue_reset(void)
@@ -158,6 +223,118 @@ void jtag_command_queue_reset(void)
 	next_command_pointer = &jtag_command_queue;
 }
 
+bool jtag_queue_optimize = true;
+
+/* The state a command leaves the TAP in, or TAP_INVALID if that isn't known
+ * from the queue, in which case nothing after it relies on the state. */
+static tap_state_t cmd_end_state(const struct jtag_command *cmd, tap_state_t state)
+{
+	switch (cmd->type) {
+		case JTAG_SCAN:
+			return cmd->cmd.scan->end_state;
+		case JTAG_TLR_RESET:
+			return TAP_RESET;
+		case JTAG_RUNTEST:
+			return cmd->cmd.runtest->end_state;
+		case JTAG_PATHMOVE:
+			return cmd->cmd.pathmove->path[cmd->cmd.pathmove->num_states - 1];
+		case JTAG_SLEEP:
+		case JTAG_STABLECLOCKS:
+			return state;
+		default:
+			return TAP_INVALID;
+	}
+}
+
+/* Try to fold next into cmd without changing what ends up on the wire.
+ * Returns whether next can be dropped. */
+static bool cmd_merge(struct jtag_command *cmd, const struct jtag_command *next)
+{
+	if (cmd->type != next->type)
+		return false;
+
+	switch (cmd->type) {
+		case JTAG_RUNTEST:
+			/* Both clock in Run-Test/Idle; only the last one leaves it. */
+			if (cmd->cmd.runtest->end_state != TAP_IDLE)
+				return false;
+			cmd->cmd.runtest->num_cycles += next->cmd.runtest->num_cycles;
+			cmd->cmd.runtest->end_state = next->cmd.runtest->end_state;
+			return true;
+		case JTAG_SLEEP:
+			cmd->cmd.sleep->us += next->cmd.sleep->us;
+			return true;
+		case JTAG_STABLECLOCKS:
+			cmd->cmd.stableclocks->num_cycles += next->cmd.stableclocks->num_cycles;
+			return true;
+		case JTAG_TLR_RESET:
+			/* Test-Logic-Reset is where the first one already left us. */
+			return true;
+		case JTAG_PATHMOVE: {
+			struct pathmove_command *a = cmd->cmd.pathmove;
+			const struct pathmove_command *b = next->cmd.pathmove;
+			tap_state_t *path = cmd_queue_alloc((a->num_states + b->num_states) *
+					sizeof(*path));
+			memcpy(path, a->path, a->num_states * sizeof(*path));
+			memcpy(path + a->num_states, b->path, b->num_states * sizeof(*path));
+			a->path = path;
+			a->num_states += b->num_states;
+			return true;
+		}
+		case JTAG_TMS: {
+			struct tms_command *a = cmd->cmd.tms;
+			const struct tms_command *b = next->cmd.tms;
+			uint8_t *bits = cmd_queue_alloc(DIV_ROUND_UP(a->num_bits + b->num_bits, 8));
+			buf_set_buf(a->bits, 0, bits, 0, a->num_bits);
+			buf_set_buf(b->bits, 0, bits, a->num_bits, b->num_bits);
+			a->bits = bits;
+			a->num_bits += b->num_bits;
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+/* A command that leaves the TAP where it already is, without clocking
+ * anything in between, like a RUNTEST of no cycles in Run-Test/Idle. */
+static bool cmd_is_noop(const struct jtag_command *cmd, tap_state_t state)
+{
+	switch (cmd->type) {
+		case JTAG_RUNTEST:
+			return cmd->cmd.runtest->num_cycles == 0 && state == TAP_IDLE &&
+				cmd->cmd.runtest->end_state == TAP_IDLE;
+		case JTAG_STABLECLOCKS:
+			return cmd->cmd.stableclocks->num_cycles == 0;
+		case JTAG_SLEEP:
+			return cmd->cmd.sleep->us == 0;
+		default:
+			return false;
+	}
+}
+
+void jtag_command_queue_optimize(void)
+{
+	if (!jtag_queue_optimize)
+		return;
+
+	/* The first command might start anywhere. */
+	tap_state_t state = TAP_INVALID;
+	struct jtag_command **link = &jtag_command_queue;
+	while (*link) {
+		struct jtag_command *cmd = *link;
+		if (cmd_is_noop(cmd, state)) {
+			*link = cmd->next;
+			continue;
+		}
+		while (cmd->next && cmd_merge(cmd, cmd->next))
+			cmd->next = cmd->next->next;
+		state = cmd_end_state(cmd, state);
+		link = &cmd->next;
+	}
+	next_command_pointer = link;
+}
+
 /**
  * Copy a struct scan_field for insertion into the queue.
  *
@@ -277,3 +454,108 @@ int jtag_read_buffer(uint8_t *buffer, const struct scan_command *cmd)
 
 	return retval;
 }
+
+/* A queue trace is JTAG_TRACE_MAGIC followed by one record per scan, in the
+ * order they were executed: a little endian 32 bit word holding the scan's
+ * length in bits, with bit 31 set for IR scans, then the bits captured from
+ * TDO, zero where no field asked for them. That is all a replay needs to
+ * give the code that queued the scans the same answers. */
+#define JTAG_TRACE_MAGIC	"OCDJTRC1"
+#define JTAG_TRACE_IR_SCAN	(1u << 31)
+
+int jtag_trace_write_header(FILE *file)
+{
+	if (fwrite(JTAG_TRACE_MAGIC, strlen(JTAG_TRACE_MAGIC), 1, file) != 1)
+		return ERROR_FAIL;
+	return ERROR_OK;
+}
+
+int jtag_trace_check_header(FILE *file)
+{
+	char magic[sizeof(JTAG_TRACE_MAGIC) - 1];
+	if (fread(magic, sizeof(magic), 1, file) != 1 ||
+			memcmp(magic, JTAG_TRACE_MAGIC, sizeof(magic))) {
+		LOG_ERROR("not a JTAG queue trace");
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+int jtag_trace_write_queue(FILE *file)
+{
+	for (struct jtag_command *cmd = jtag_command_queue; cmd; cmd = cmd->next) {
+		if (cmd->type != JTAG_SCAN)
+			continue;
+
+		const struct scan_command *scan = cmd->cmd.scan;
+		unsigned num_bits = jtag_scan_size(scan);
+		uint8_t *record = calloc(1, 4 + DIV_ROUND_UP(num_bits, 8));
+		if (!record)
+			return ERROR_FAIL;
+		h_u32_to_le(record, num_bits | (scan->ir_scan ? JTAG_TRACE_IR_SCAN : 0));
+		unsigned bit = 0;
+		for (int i = 0; i < scan->num_fields; i++) {
+			if (scan->fields[i].in_value)
+				buf_set_buf(scan->fields[i].in_value, 0, record + 4, bit,
+						scan->fields[i].num_bits);
+			bit += scan->fields[i].num_bits;
+		}
+
+		size_t size = 4 + DIV_ROUND_UP(num_bits, 8);
+		bool written = fwrite(record, size, 1, file) == 1;
+		free(record);
+		if (!written)
+			return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+int jtag_trace_replay_queue(FILE *file)
+{
+	for (struct jtag_command *cmd = jtag_command_queue; cmd; cmd = cmd->next) {
+		/* track the TAP state like a driver would, the queue optimizer
+		 * relies on it */
+		if (cmd->type == JTAG_RESET) {
+			if (cmd->cmd.reset->trst == 1)
+				tap_set_state(TAP_RESET);
+			continue;
+		}
+		tap_state_t state = cmd_end_state(cmd, tap_get_state());
+		if (state != TAP_INVALID)
+			tap_set_state(state);
+		if (cmd->type != JTAG_SCAN)
+			continue;
+
+		const struct scan_command *scan = cmd->cmd.scan;
+		unsigned num_bits = jtag_scan_size(scan);
+		uint8_t header[4];
+		if (fread(header, sizeof(header), 1, file) != 1) {
+			LOG_ERROR("JTAG queue trace ends before this %s scan",
+					scan->ir_scan ? "IR" : "DR");
+			return ERROR_JTAG_QUEUE_FAILED;
+		}
+		uint32_t recorded = le_to_h_u32(header);
+		if (recorded != (num_bits | (scan->ir_scan ? JTAG_TRACE_IR_SCAN : 0))) {
+			LOG_ERROR("%u bit %s scan doesn't match the trace's %u bit %s scan",
+					num_bits, scan->ir_scan ? "IR" : "DR",
+					recorded & ~JTAG_TRACE_IR_SCAN,
+					(recorded & JTAG_TRACE_IR_SCAN) ? "IR" : "DR");
+			return ERROR_JTAG_QUEUE_FAILED;
+		}
+
+		uint8_t *tdo = malloc(DIV_ROUND_UP(num_bits, 8));
+		if (!tdo)
+			return ERROR_FAIL;
+		int retval = ERROR_OK;
+		if (fread(tdo, DIV_ROUND_UP(num_bits, 8), 1, file) != 1) {
+			LOG_ERROR("JTAG queue trace is truncated");
+			retval = ERROR_JTAG_QUEUE_FAILED;
+		} else {
+			retval = jtag_read_buffer(tdo, scan);
+		}
+		free(tdo);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	return ERROR_OK;
+}
@@ -168,10 +168,47 @@ void *cmd_queue_alloc(size_t size);
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
 
+struct jtag_queue_stats {
+	/** Bytes allocated in the current queue. */
+	size_t bytes;
+	/** Most bytes and pages any one queue needed. */
+	size_t high_water_bytes;
+	unsigned int high_water_pages;
+	/** Pages kept for reuse by later queues. */
+	unsigned int pooled_pages;
+	/** Pages that had to be allocated from the heap. */
+	uint64_t page_mallocs;
+};
+
+void jtag_command_queue_stats(struct jtag_queue_stats *stats);
+
+/** Whether jtag_command_queue_optimize() does anything. */
+extern bool jtag_queue_optimize;
+
+/**
+ * Drop commands in the queue that have no effect, and combine consecutive
+ * commands of the same kind where the result is the same on the wire, so
+ * drivers have less to do.  Scans are never combined, since each one needs
+ * its own Capture and Update.
+ */
+void jtag_command_queue_optimize(void);
+
 void jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src);
 enum scan_type jtag_scan_type(const struct scan_command *cmd);
 int jtag_scan_size(const struct scan_command *cmd);
 int jtag_read_buffer(uint8_t *buffer, const struct scan_command *cmd);
 int jtag_build_buffer(const struct scan_command *cmd, uint8_t **buffer);
 
+/**
+ * JTAG queue traces record what TDO returned for each scan of the executed
+ * queues ("jtag record"), so the dummy driver can answer the same scans
+ * again without hardware ("dummy replay").
+ */
+int jtag_trace_write_header(FILE *file);
+int jtag_trace_check_header(FILE *file);
+/** Appends the scans of the just executed queue to the trace. */
+int jtag_trace_write_queue(FILE *file);
+/** Fills in the scans of the queue from the trace, instead of executing it. */
+int jtag_trace_replay_queue(FILE *file);
+
 #endif /* OPENOCD_JTAG_COMMANDS_H */
@@ -35,12 +35,17 @@
 #include "interface.h"
 #include <transport/transport.h>
 #include <helper/jep106.h>
+#include <helper/perf.h>
 #include "helper/system.h"
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 /* SVF and XSVF are higher level JTAG command sets (for boundary scan) */
 #include "svf/svf.h"
 #include "xsvf/xsvf.h"
@@ -51,6 +56,29 @@ static int jtag_flush_queue_count;
 /* Sleep this # of ms after flushing the queue */
 static int jtag_flush_queue_sleep;
 
+/* "jtag record" trace of the executed queues, NULL when not recording */
+static FILE *jtag_record_file;
+
+#ifdef HAVE_PTHREAD_H
+/**
+ * When enabled, the queue is flushed on a separate adapter I/O thread while
+ * the thread that queued the commands waits for it, keeping GDB connections
+ * alive rather than sitting blocked inside the adapter driver.
+ */
+static bool jtag_io_thread_enabled;
+static bool jtag_io_thread_running;
+static pthread_t jtag_io_thread;
+static pthread_mutex_t jtag_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jtag_io_cond = PTHREAD_COND_INITIALIZER;
+static enum {
+	JTAG_IO_IDLE,
+	JTAG_IO_SUBMITTED,
+	JTAG_IO_COMPLETED,
+	JTAG_IO_EXIT,
+} jtag_io_state;
+static int jtag_io_result;
+#endif
+
 static void jtag_add_scan_check(struct jtag_tap *active,
 		void (*jtag_add_scan)(struct jtag_tap *active,
 		int in_num_fields,
@@ -95,6 +123,9 @@ static enum reset_types jtag_reset_config = RESET_NONE;
 tap_state_t cmd_queue_cur_state = TAP_RESET;
 
 static bool jtag_verify_capture_ir = true;
+/* Verify one IR scan in this many; 1 verifies all of them. */
+static unsigned jtag_verify_capture_ir_interval = 1;
+static unsigned jtag_ir_scans_unverified;
 static int jtag_verify = 1;
 
 /* how long the OpenOCD should wait before attempting JTAG communication after reset lines
@@ -357,6 +388,7 @@ void jtag_add_ir_scan_noverify(struct jtag_tap *active, const struct scan_field
 	tap_state_t state)
 {
 	jtag_prelude(state);
+	perf_record(PERF_JTAG_SCAN, in_fields->num_bits, 0);
 
 	int retval = interface_jtag_add_ir_scan(active, in_fields, state);
 	jtag_set_error(retval);
@@ -375,7 +407,12 @@ void jtag_add_ir_scan(struct jtag_tap *active, struct scan_field *in_fields, tap
 {
 	assert(state != TAP_RESET);
 
-	if (jtag_verify && jtag_verify_capture_ir) {
+	bool verify = jtag_verify && jtag_verify_capture_ir &&
+		++jtag_ir_scans_unverified >= jtag_verify_capture_ir_interval;
+
+	if (verify) {
+		jtag_ir_scans_unverified = 0;
+
 		/* 8 x 32 bit id's is enough for all invocations */
 
 		/* if we are to run a verification of the ir scan, we need to get the input back.
@@ -396,6 +433,7 @@ void jtag_add_plain_ir_scan(int num_bits, const uint8_t *out_bits, uint8_t *in_b
 	assert(state != TAP_RESET);
 
 	jtag_prelude(state);
+	perf_record(PERF_JTAG_SCAN, num_bits, 0);
 
 	int retval = interface_jtag_add_plain_ir_scan(
 			num_bits, out_bits, in_bits, state);
@@ -458,11 +496,34 @@ void jtag_add_dr_scan(struct jtag_tap *active,
 
 	jtag_prelude(state);
 
+	uint64_t bits = 0;
+	for (int i = 0; i < in_num_fields; i++)
+		bits += in_fields[i].num_bits;
+	perf_record(PERF_JTAG_SCAN, bits, 0);
+
 	int retval;
 	retval = interface_jtag_add_dr_scan(active, in_num_fields, in_fields, state);
 	jtag_set_error(retval);
 }
 
+void jtag_add_dr_scan_nocopy(struct jtag_tap *active,
+	int in_num_fields,
+	const struct scan_field *in_fields,
+	tap_state_t state)
+{
+#if HAVE_JTAG_MINIDRIVER_H
+	jtag_add_dr_scan(active, in_num_fields, in_fields, state);
+#else
+	assert(state != TAP_RESET);
+
+	jtag_prelude(state);
+
+	int retval;
+	retval = interface_jtag_add_dr_scan_nocopy(active, in_num_fields, in_fields, state);
+	jtag_set_error(retval);
+#endif
+}
+
 void jtag_add_plain_dr_scan(int num_bits, const uint8_t *out_bits, uint8_t *in_bits,
 	tap_state_t state)
 {
@@ -470,6 +531,7 @@ void jtag_add_plain_dr_scan(int num_bits, const uint8_t *out_bits, uint8_t *in_b
 	assert(state != TAP_RESET);
 
 	jtag_prelude(state);
+	perf_record(PERF_JTAG_SCAN, num_bits, 0);
 
 	int retval;
 	retval = interface_jtag_add_plain_dr_scan(num_bits, out_bits, in_bits, state);
@@ -952,9 +1014,20 @@ int default_interface_jtag_execute_queue(void)
 			return ERROR_OK;
 	}
 
+#if !HAVE_JTAG_MINIDRIVER_H
+	jtag_command_queue_optimize();
+#endif
+
 	int result = jtag->jtag_ops->execute_queue();
 
 #if !HAVE_JTAG_MINIDRIVER_H
+	if (jtag_record_file && result == ERROR_OK &&
+			jtag_trace_write_queue(jtag_record_file) != ERROR_OK) {
+		LOG_ERROR("couldn't write the JTAG queue trace, recording stopped");
+		fclose(jtag_record_file);
+		jtag_record_file = NULL;
+	}
+
 	/* Only build this if we use a regular driver with a command queue.
 	 * Otherwise jtag_command_queue won't be found at compile/link time. Its
 	 * definition is in jtag/commands.c, which is only built/linked by
@@ -1023,10 +1096,154 @@ int default_interface_jtag_execute_queue(void)
 	return result;
 }
 
+#ifdef HAVE_PTHREAD_H
+static void *jtag_io_thread_main(void *arg)
+{
+	pthread_mutex_lock(&jtag_io_mutex);
+	for (;;) {
+		while (jtag_io_state != JTAG_IO_SUBMITTED && jtag_io_state != JTAG_IO_EXIT)
+			pthread_cond_wait(&jtag_io_cond, &jtag_io_mutex);
+		if (jtag_io_state == JTAG_IO_EXIT)
+			break;
+
+		pthread_mutex_unlock(&jtag_io_mutex);
+		int result = interface_jtag_execute_queue();
+		pthread_mutex_lock(&jtag_io_mutex);
+
+		jtag_io_result = result;
+		jtag_io_state = JTAG_IO_COMPLETED;
+		pthread_cond_broadcast(&jtag_io_cond);
+	}
+	pthread_mutex_unlock(&jtag_io_mutex);
+
+	return NULL;
+}
+
+static int jtag_io_thread_start(void)
+{
+	if (jtag_io_thread_running)
+		return ERROR_OK;
+
+	jtag_io_state = JTAG_IO_IDLE;
+	int retval = pthread_create(&jtag_io_thread, NULL, jtag_io_thread_main, NULL);
+	if (retval != 0) {
+		LOG_ERROR("couldn't start adapter I/O thread: %s", strerror(retval));
+		return ERROR_FAIL;
+	}
+	jtag_io_thread_running = true;
+
+	return ERROR_OK;
+}
+
+static void jtag_io_thread_stop(void)
+{
+	if (!jtag_io_thread_running)
+		return;
+
+	pthread_mutex_lock(&jtag_io_mutex);
+	jtag_io_state = JTAG_IO_EXIT;
+	pthread_cond_broadcast(&jtag_io_cond);
+	pthread_mutex_unlock(&jtag_io_mutex);
+
+	pthread_join(jtag_io_thread, NULL);
+	jtag_io_thread_running = false;
+}
+
+/* Hand the queue to the I/O thread and wait, keeping GDB alive meanwhile */
+static int jtag_io_thread_execute_queue(void)
+{
+	pthread_mutex_lock(&jtag_io_mutex);
+	jtag_io_state = JTAG_IO_SUBMITTED;
+	pthread_cond_broadcast(&jtag_io_cond);
+
+	while (jtag_io_state != JTAG_IO_COMPLETED) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += 100 * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		if (pthread_cond_timedwait(&jtag_io_cond, &jtag_io_mutex, &deadline) == ETIMEDOUT) {
+			pthread_mutex_unlock(&jtag_io_mutex);
+			keep_alive();
+			pthread_mutex_lock(&jtag_io_mutex);
+		}
+	}
+
+	jtag_io_state = JTAG_IO_IDLE;
+	int result = jtag_io_result;
+	pthread_mutex_unlock(&jtag_io_mutex);
+
+	return result;
+}
+#endif
+
+int jtag_set_io_thread(bool enable)
+{
+#ifdef HAVE_PTHREAD_H
+	jtag_io_thread_enabled = enable;
+	if (!jtag)
+		return ERROR_OK;
+	if (enable)
+		return jtag_io_thread_start();
+	jtag_io_thread_stop();
+	return ERROR_OK;
+#else
+	if (enable) {
+		LOG_ERROR("adapter I/O thread not supported on this host");
+		return ERROR_NOT_IMPLEMENTED;
+	}
+	return ERROR_OK;
+#endif
+}
+
+int jtag_record_start(const char *filename)
+{
+	jtag_record_stop();
+
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		LOG_ERROR("couldn't open %s: %s", filename, strerror(errno));
+		return ERROR_FAIL;
+	}
+	if (jtag_trace_write_header(file) != ERROR_OK) {
+		LOG_ERROR("couldn't write %s", filename);
+		fclose(file);
+		return ERROR_FAIL;
+	}
+	jtag_record_file = file;
+	return ERROR_OK;
+}
+
+void jtag_record_stop(void)
+{
+	if (!jtag_record_file)
+		return;
+	fclose(jtag_record_file);
+	jtag_record_file = NULL;
+}
+
+bool jtag_get_io_thread(void)
+{
+#ifdef HAVE_PTHREAD_H
+	return jtag_io_thread_enabled;
+#else
+	return false;
+#endif
+}
+
 void jtag_execute_queue_noclear(void)
 {
+	int64_t start = perf_now();
 	jtag_flush_queue_count++;
-	jtag_set_error(interface_jtag_execute_queue());
+#ifdef HAVE_PTHREAD_H
+	if (jtag_io_thread_running) {
+		jtag_set_error(jtag_io_thread_execute_queue());
+	} else
+#endif
+		jtag_set_error(interface_jtag_execute_queue());
 
 	if (jtag_flush_queue_sleep > 0) {
 		/* For debug purposes it can be useful to test performance
@@ -1035,6 +1252,8 @@ void jtag_execute_queue_noclear(void)
 		 */
 		usleep(jtag_flush_queue_sleep * 1000);
 	}
+
+	perf_record(PERF_JTAG_EXECUTE_QUEUE, 0, start);
 }
 
 int jtag_get_flush_queue_count(void)
@@ -1533,6 +1752,14 @@ int adapter_init(struct command_context *cmd_ctx)
 		return retval;
 	jtag = adapter_driver;
 
+#ifdef HAVE_PTHREAD_H
+	if (jtag_io_thread_enabled) {
+		retval = jtag_io_thread_start();
+		if (retval != ERROR_OK)
+			return retval;
+	}
+#endif
+
 	if (jtag->speed == NULL) {
 		LOG_INFO("This adapter doesn't support configurable speed");
 		return ERROR_OK;
@@ -1652,6 +1879,11 @@ int jtag_init_inner(struct command_context *cmd_ctx)
 
 int adapter_quit(void)
 {
+#ifdef HAVE_PTHREAD_H
+	jtag_io_thread_stop();
+#endif
+	jtag_record_stop();
+
 	if (jtag && jtag->quit) {
 		/* close the JTAG interface */
 		int result = jtag->quit();
@@ -1837,6 +2069,136 @@ int jtag_config_rclk(unsigned fallback_speed_khz)
 	return (ERROR_OK != retval) ? retval : jtag_set_speed(speed);
 }
 
+/* Bits of pattern shifted through the bypassed chain per speed check, in
+ * AUTO_SPEED_ROUNDS scans with different patterns. */
+#define AUTO_SPEED_PATTERN_BITS	512
+#define AUTO_SPEED_ROUNDS	4
+
+/**
+ * Put every enabled TAP in BYPASS and check that pseudo-random patterns come
+ * back out of TDO unchanged, delayed by one bit per TAP.
+ */
+static int jtag_speed_check_chain(void)
+{
+	struct jtag_tap *tap = jtag_tap_next_enabled(NULL);
+	unsigned num_taps = jtag_tap_count_enabled();
+	unsigned bits = AUTO_SPEED_PATTERN_BITS + num_taps;
+	uint8_t out[AUTO_SPEED_ROUNDS][DIV_ROUND_UP(AUTO_SPEED_PATTERN_BITS, 8) + 1];
+	uint8_t in[DIV_ROUND_UP(AUTO_SPEED_PATTERN_BITS, 8) + 1];
+	uint8_t *in_chain[AUTO_SPEED_ROUNDS];
+
+	/* jtag_add_ir_scan() puts all the other TAPs in BYPASS for us and keeps
+	 * the cur_instr of every TAP up to date */
+	uint8_t *ones = malloc(DIV_ROUND_UP(tap->ir_length, 8));
+	if (!ones)
+		return ERROR_FAIL;
+	memset(ones, 0xff, DIV_ROUND_UP(tap->ir_length, 8));
+	struct scan_field field = {
+		.num_bits = tap->ir_length,
+		.out_value = ones,
+	};
+	jtag_add_ir_scan(tap, &field, TAP_IDLE);
+	free(ones);
+
+	uint32_t lfsr = 0xace1u;
+	for (unsigned r = 0; r < AUTO_SPEED_ROUNDS; r++) {
+		memset(out[r], 0, sizeof(out[r]));
+		for (unsigned i = 0; i < AUTO_SPEED_PATTERN_BITS; i++) {
+			lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xb400u);
+			buf_set_u32(out[r], i, 1, lfsr & 1);
+		}
+		/* the bypass registers need num_taps bits past the pattern */
+		in_chain[r] = malloc(DIV_ROUND_UP(bits, 8));
+		if (!in_chain[r]) {
+			while (r--)
+				free(in_chain[r]);
+			return ERROR_FAIL;
+		}
+		jtag_add_plain_dr_scan(bits, out[r], in_chain[r], TAP_IDLE);
+	}
+
+	int retval = jtag_execute_queue();
+	for (unsigned r = 0; r < AUTO_SPEED_ROUNDS; r++) {
+		if (retval == ERROR_OK) {
+			memset(in, 0, sizeof(in));
+			for (unsigned i = 0; i < AUTO_SPEED_PATTERN_BITS; i++)
+				buf_set_u32(in, i, 1, buf_get_u32(in_chain[r], num_taps + i, 1));
+			if (buf_cmp(in, out[r], AUTO_SPEED_PATTERN_BITS))
+				retval = ERROR_JTAG_QUEUE_FAILED;
+		}
+		free(in_chain[r]);
+	}
+	return retval;
+}
+
+int jtag_config_khz_auto(unsigned max_khz, unsigned *result_khz)
+{
+	if (!jtag || !transport_is_jtag() || CLOCK_MODE_KHZ != clock_mode) {
+		LOG_ERROR("automatic speed selection needs an initialized JTAG adapter "
+				"running at a fixed speed");
+		return ERROR_FAIL;
+	}
+	if (!jtag_tap_count_enabled()) {
+		LOG_ERROR("automatic speed selection needs an enabled TAP");
+		return ERROR_FAIL;
+	}
+
+	/* the speed we started at has to work, it's the fallback */
+	unsigned start_khz = jtag_get_speed_khz();
+	int retval = jtag_speed_check_chain();
+	if (retval != ERROR_OK) {
+		LOG_ERROR("JTAG chain check fails at the current speed of %u kHz",
+				start_khz);
+		return retval;
+	}
+
+	unsigned good = start_khz;
+	unsigned bad = max_khz + 1;
+	/* stop once the interval is within 1/16 of the known good speed */
+	while (bad > good + 1 && bad - good > good / 16) {
+		unsigned try_khz = good + (bad - good) / 2;
+		retval = jtag_config_khz(try_khz);
+		int actual_khz = try_khz;
+		if (retval == ERROR_OK)
+			retval = jtag_get_speed_readable(&actual_khz);
+		if (retval == ERROR_OK && actual_khz > 0 && (unsigned)actual_khz <= good) {
+			/* the adapter can't go any faster in between */
+			bad = try_khz;
+			continue;
+		}
+		if (retval == ERROR_OK)
+			retval = jtag_speed_check_chain();
+		LOG_DEBUG("%u kHz (actual %d kHz): %s", try_khz, actual_khz,
+				retval == ERROR_OK ? "ok" : "fails");
+		if (retval == ERROR_OK)
+			good = try_khz;
+		else
+			bad = try_khz;
+	}
+
+	/* leave a margin for temperature and supply drift */
+	unsigned khz = MAX(good - good / 4, start_khz);
+	retval = jtag_config_khz(khz);
+	if (retval == ERROR_OK)
+		retval = jtag_speed_check_chain();
+	if (retval != ERROR_OK) {
+		LOG_WARNING("JTAG chain check fails at %u kHz, back to %u kHz",
+				khz, start_khz);
+		khz = start_khz;
+		int retval2 = jtag_config_khz(khz);
+		if (retval2 != ERROR_OK)
+			return retval2;
+		/* the failed check may have left garbage in the chain */
+		retval = jtag_speed_check_chain();
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	LOG_INFO("fastest passing speed %u kHz, using %u kHz", good, khz);
+	*result_khz = khz;
+	return ERROR_OK;
+}
+
 int jtag_get_speed(int *speed)
 {
 	switch (clock_mode) {
@@ -1888,6 +2250,17 @@ bool jtag_will_verify_capture_ir(void)
 	return jtag_verify_capture_ir;
 }
 
+void jtag_set_verify_capture_ir_interval(unsigned interval)
+{
+	jtag_verify_capture_ir_interval = interval ? interval : 1;
+	jtag_ir_scans_unverified = 0;
+}
+
+unsigned jtag_get_verify_capture_ir_interval(void)
+{
+	return jtag_verify_capture_ir_interval;
+}
+
 int jtag_power_dropout(int *dropout)
 {
 	if (jtag == NULL) {
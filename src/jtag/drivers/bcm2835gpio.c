@@ -52,6 +52,8 @@ static volatile uint32_t *pio_base;
 
 static bb_value_t bcm2835gpio_read(void);
 static int bcm2835gpio_write(int tck, int tms, int tdi);
+static int bcm2835gpio_scan_block(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned int bits);
 
 static int bcm2835_swdio_read(void);
 static void bcm2835_swdio_drive(bool is_output);
@@ -63,6 +65,7 @@ static int bcm2835gpio_quit(void);
 static struct bitbang_interface bcm2835gpio_bitbang = {
 	.read = bcm2835gpio_read,
 	.write = bcm2835gpio_write,
+	.scan_block = bcm2835gpio_scan_block,
 	.swdio_read = bcm2835_swdio_read,
 	.swdio_drive = bcm2835_swdio_drive,
 	.swd_write = bcm2835gpio_swd_write,
@@ -111,6 +114,44 @@ static int bcm2835gpio_write(int tck, int tms, int tdi)
 	return ERROR_OK;
 }
 
+static int bcm2835gpio_scan_block(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned int bits)
+{
+	const uint32_t tck_mask = 1 << tck_gpio;
+	const uint32_t tms_mask = 1 << tms_gpio;
+	const uint32_t tdi_mask = 1 << tdi_gpio;
+	const uint32_t tdo_mask = 1 << tdo_gpio;
+
+	for (unsigned int i = 0; i < bits; i++) {
+		unsigned int byte = i / 8;
+		uint8_t bit = 1 << (i % 8);
+		uint32_t set = 0;
+
+		if (tms[byte] & bit)
+			set |= tms_mask;
+		if (tdi && (tdi[byte] & bit))
+			set |= tdi_mask;
+
+		GPIO_SET = set;
+		GPIO_CLR = ((tms_mask | tdi_mask) & ~set) | tck_mask;
+		for (unsigned int j = 0; j < jtag_delay; j++)
+			asm volatile ("");
+
+		if (tdo) {
+			if (GPIO_LEV & tdo_mask)
+				tdo[byte] |= bit;
+			else
+				tdo[byte] &= ~bit;
+		}
+
+		GPIO_SET = tck_mask;
+		for (unsigned int j = 0; j < jtag_delay; j++)
+			asm volatile ("");
+	}
+
+	return ERROR_OK;
+}
+
 static int bcm2835gpio_swd_write(int swclk, int swdio)
 {
 	uint32_t set = swclk << swclk_gpio | swdio << swdio_gpio;
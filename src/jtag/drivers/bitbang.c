@@ -200,27 +200,13 @@ static int bitbang_stableclocks(int num_cycles)
 	return ERROR_OK;
 }
 
-static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
-		unsigned scan_size)
+/* Clock the scan one bit at a time, leaving the shift state on the last
+ * bit. */
+static int bitbang_scan_bits(enum scan_type type, uint8_t *buffer,
+		unsigned int scan_size)
 {
-	tap_state_t saved_end_state = tap_get_end_state();
-	unsigned bit_cnt;
-
-	if (!((!ir_scan &&
-			(tap_get_state() == TAP_DRSHIFT)) ||
-			(ir_scan && (tap_get_state() == TAP_IRSHIFT)))) {
-		if (ir_scan)
-			bitbang_end_state(TAP_IRSHIFT);
-		else
-			bitbang_end_state(TAP_DRSHIFT);
-
-		if (bitbang_state_move(0) != ERROR_OK)
-			return ERROR_FAIL;
-		bitbang_end_state(saved_end_state);
-	}
-
 	size_t buffered = 0;
-	for (bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
+	for (unsigned int bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
 		int tms = (bit_cnt == scan_size-1) ? 1 : 0;
 		int tdi;
 		int bytec = bit_cnt/8;
@@ -277,6 +263,55 @@ static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 			buffered = 0;
 		}
 	}
+	return ERROR_OK;
+}
+
+/* Hand the whole scan to the interface, which leaves the shift state on the
+ * last bit. */
+static int bitbang_scan_block(enum scan_type type, uint8_t *buffer,
+		unsigned int scan_size)
+{
+	unsigned int bytes = DIV_ROUND_UP(scan_size, 8);
+	uint8_t *tms = calloc(bytes, 1);
+	if (!tms) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	if (scan_size)
+		tms[(scan_size - 1) / 8] = 1 << ((scan_size - 1) % 8);
+
+	int retval = bitbang_interface->scan_block(tms,
+			type == SCAN_IN ? NULL : buffer,
+			type == SCAN_OUT ? NULL : buffer, scan_size);
+	free(tms);
+	return retval;
+}
+
+static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
+		unsigned scan_size)
+{
+	tap_state_t saved_end_state = tap_get_end_state();
+
+	if (!((!ir_scan &&
+			(tap_get_state() == TAP_DRSHIFT)) ||
+			(ir_scan && (tap_get_state() == TAP_IRSHIFT)))) {
+		if (ir_scan)
+			bitbang_end_state(TAP_IRSHIFT);
+		else
+			bitbang_end_state(TAP_DRSHIFT);
+
+		if (bitbang_state_move(0) != ERROR_OK)
+			return ERROR_FAIL;
+		bitbang_end_state(saved_end_state);
+	}
+
+	int retval;
+	if (bitbang_interface->scan_block)
+		retval = bitbang_scan_block(type, buffer, scan_size);
+	else
+		retval = bitbang_scan_bits(type, buffer, scan_size);
+	if (retval != ERROR_OK)
+		return ERROR_FAIL;
 
 	if (tap_get_state() != tap_get_end_state()) {
 		/* we *KNOW* the above loop transitioned out of
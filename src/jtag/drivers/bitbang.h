@@ -54,6 +54,14 @@ struct bitbang_interface {
 	/** Set TCK, TMS, and TDI to the given values. */
 	int (*write)(int tck, int tms, int tdi);
 
+	/** Clock out a whole scan (optional). For each bit i, set TMS and TDI
+	 * to bit i of tms and tdi with TCK low, sample TDO into bit i of tdo
+	 * and raise TCK, just like write(0, ...), read() and write(1, ...)
+	 * would. tdi may be NULL to shift out zeros and tdo may be NULL if TDO
+	 * isn't needed. tdo may be the same buffer as tdi. */
+	int (*scan_block)(const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo,
+			unsigned int bits);
+
 	/** Blink led (optional). */
 	int (*blink)(int on);
 
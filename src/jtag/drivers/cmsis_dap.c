@@ -183,6 +183,9 @@ struct pending_transfer_result {
 struct pending_request_block {
 	struct pending_transfer_result *transfers;
 	int transfer_count;
+	/* All transfers are to the same register in the same direction, so
+	 * the block can be sent as a DAP_TransferBlock. */
+	bool block_transfer;
 };
 
 struct pending_scan_result {
@@ -196,21 +199,31 @@ struct pending_scan_result {
 	unsigned buffer_offset;
 };
 
+/* Runs of at least this many transfers to the same register get a
+ * DAP_TransferBlock of their own. */
+#define MIN_TFER_BLOCK_LEN 8
+
 /* Up to MIN(packet_count, MAX_PENDING_REQUESTS) requests may be issued
  * until the first response arrives */
 #define MAX_PENDING_REQUESTS 3
 
 /* Pending requests are organized as a FIFO - circular buffer */
-/* Each block in FIFO can contain up to pending_queue_len transfers */
+/* Each block in FIFO can contain up to pending_queue_len transfers.
+ * JTAG uses the same indexes for its DAP_JTAG_Sequence packets; only one
+ * of the two transports is ever active. */
 static int pending_queue_len;
+/* A block whose transfers all go to the same register may grow up to
+ * pending_block_len, and goes out as DAP_TransferBlock instead. */
+static int pending_block_len;
 static struct pending_request_block pending_fifo[MAX_PENDING_REQUESTS];
 static int pending_fifo_put_idx, pending_fifo_get_idx;
 static int pending_fifo_block_count;
 
-/* pointers to buffers that will receive jtag scan results on the next flush */
+/* pointers to buffers that will receive jtag scan results, for each packet
+ * in the FIFO */
 #define MAX_PENDING_SCAN_RESULTS 256
-static int pending_scan_result_count;
-static struct pending_scan_result pending_scan_results[MAX_PENDING_SCAN_RESULTS];
+static int pending_scan_result_count[MAX_PENDING_REQUESTS];
+static struct pending_scan_result pending_scan_results[MAX_PENDING_REQUESTS][MAX_PENDING_SCAN_RESULTS];
 
 /* queued JTAG sequences that will be executed on the next flush */
 #define QUEUED_SEQ_BUF_LEN (cmsis_dap_handle->packet_size - 3)
@@ -554,11 +567,23 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 	if (block->transfer_count == 0)
 		goto skip;
 
+	/* All the same register, so the request byte is only needed once. */
+	if (block->transfer_count == 1)
+		block->block_transfer = false;
+
 	size_t idx = 0;
 	buffer[idx++] = 0;	/* report number */
-	buffer[idx++] = CMD_DAP_TFER;
-	buffer[idx++] = 0x00;	/* DAP Index */
-	buffer[idx++] = block->transfer_count;
+	if (block->block_transfer) {
+		buffer[idx++] = CMD_DAP_TFER_BLOCK;
+		buffer[idx++] = 0x00;	/* DAP Index */
+		buffer[idx++] = block->transfer_count & 0xff;
+		buffer[idx++] = block->transfer_count >> 8;
+		buffer[idx++] = (block->transfers[0].cmd >> 1) & 0x0f;
+	} else {
+		buffer[idx++] = CMD_DAP_TFER;
+		buffer[idx++] = 0x00;	/* DAP Index */
+		buffer[idx++] = block->transfer_count;
+	}
 
 	for (int i = 0; i < block->transfer_count; i++) {
 		struct pending_transfer_result *transfer = &(block->transfers[i]);
@@ -589,7 +614,8 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 			data &= ~CORUNDETECT;
 		}
 
-		buffer[idx++] = (cmd >> 1) & 0x0f;
+		if (!block->block_transfer)
+			buffer[idx++] = (cmd >> 1) & 0x0f;
 		if (!(cmd & SWD_CMD_RnW)) {
 			buffer[idx++] = (data) & 0xff;
 			buffer[idx++] = (data >> 8) & 0xff;
@@ -637,26 +663,32 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 		goto skip;
 	}
 
-	if (buffer[2] & 0x08) {
-		LOG_DEBUG("CMSIS-DAP Protocol Error @ %d (wrong parity)", buffer[1]);
+	/* DAP_TransferBlock has a 16 bit count */
+	size_t idx = 1;
+	int count = buffer[idx++];
+	if (block->block_transfer)
+		count |= buffer[idx++] << 8;
+	uint8_t response = buffer[idx++];
+
+	if (response & 0x08) {
+		LOG_DEBUG("CMSIS-DAP Protocol Error @ %d (wrong parity)", count);
 		queued_retval = ERROR_FAIL;
 		goto skip;
 	}
-	uint8_t ack = buffer[2] & 0x07;
+	uint8_t ack = response & 0x07;
 	if (ack != SWD_ACK_OK) {
-		LOG_DEBUG("SWD ack not OK @ %d %s", buffer[1],
+		LOG_DEBUG("SWD ack not OK @ %d %s", count,
 			  ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK");
 		queued_retval = ack == SWD_ACK_WAIT ? ERROR_WAIT : ERROR_FAIL;
 		goto skip;
 	}
 
-	if (block->transfer_count != buffer[1])
+	if (block->transfer_count != count)
 		LOG_ERROR("CMSIS-DAP transfer count mismatch: expected %d, got %d",
-			  block->transfer_count, buffer[1]);
+			  block->transfer_count, count);
 
-	LOG_DEBUG_IO("Received results of %d queued transactions FIFO index %d", buffer[1], pending_fifo_get_idx);
-	size_t idx = 3;
-	for (int i = 0; i < buffer[1]; i++) {
+	LOG_DEBUG_IO("Received results of %d queued transactions FIFO index %d", count, pending_fifo_get_idx);
+	for (int i = 0; i < count; i++) {
 		struct pending_transfer_result *transfer = &(block->transfers[i]);
 		if (transfer->cmd & SWD_CMD_RnW) {
 			static uint32_t last_read;
@@ -703,9 +735,27 @@ static int cmsis_dap_swd_run_queue(void)
 	return retval;
 }
 
+/* Whether cmd has to go out in a block of its own. A block that is still all
+ * one register may grow past pending_queue_len as a DAP_TransferBlock, and
+ * once a long enough run of them ends it is sent as one rather than having
+ * other transfers tacked on. */
+static bool cmsis_dap_swd_block_full(const struct pending_request_block *block, uint8_t cmd)
+{
+	int count = block->transfer_count;
+	if (count == 0)
+		return false;
+
+	if (!block->block_transfer)
+		return count >= pending_queue_len;
+
+	if (cmd == block->transfers[0].cmd)
+		return count >= pending_block_len;
+	return count >= pending_queue_len || count >= MIN_TFER_BLOCK_LEN;
+}
+
 static void cmsis_dap_swd_queue_cmd(uint8_t cmd, uint32_t *dst, uint32_t data)
 {
-	if (pending_fifo[pending_fifo_put_idx].transfer_count == pending_queue_len) {
+	if (cmsis_dap_swd_block_full(&pending_fifo[pending_fifo_put_idx], cmd)) {
 		if (pending_fifo_block_count)
 			cmsis_dap_swd_read_process(cmsis_dap_handle, 0);
 
@@ -723,6 +773,8 @@ static void cmsis_dap_swd_queue_cmd(uint8_t cmd, uint32_t *dst, uint32_t data)
 	struct pending_transfer_result *transfer = &(block->transfers[block->transfer_count]);
 	transfer->data = data;
 	transfer->cmd = cmd;
+	block->block_transfer = block->transfer_count == 0 ||
+		(block->block_transfer && cmd == block->transfers[0].cmd);
 	if (cmd & SWD_CMD_RnW) {
 		/* Queue a read transaction */
 		transfer->buffer = dst;
@@ -926,6 +978,7 @@ static int cmsis_dap_init(void)
 	 * until we get packet count info from the adaptor */
 	cmsis_dap_handle->packet_count = 1;
 	pending_queue_len = 12;
+	pending_block_len = 12;
 
 	/* INFO_ID_PKT_SZ - short */
 	retval = cmsis_dap_cmd_DAP_Info(INFO_ID_PKT_SZ, &data);
@@ -939,6 +992,9 @@ static int cmsis_dap_init(void)
 		 * write. For bulk read sequences just 4 bytes are
 		 * needed per transfer, so this is suboptimal. */
 		pending_queue_len = (pkt_sz - 4) / 5;
+		/* DAP_TransferBlock has 5 bytes of command header and 4 bytes
+		 * per word, and the answer 4 bytes of header. */
+		pending_block_len = MIN((pkt_sz - 5) / 4, 0xffff);
 
 		if (cmsis_dap_handle->packet_size != pkt_sz + 1) {
 			/* reallocate buffer */
@@ -969,7 +1025,7 @@ static int cmsis_dap_init(void)
 
 	LOG_DEBUG("Allocating FIFO for %d pending packets", cmsis_dap_handle->packet_count);
 	for (int i = 0; i < cmsis_dap_handle->packet_count; i++) {
-		pending_fifo[i].transfers = malloc(pending_queue_len * sizeof(struct pending_transfer_result));
+		pending_fifo[i].transfers = malloc(pending_block_len * sizeof(struct pending_transfer_result));
 		if (!pending_fifo[i].transfers) {
 			LOG_ERROR("Unable to allocate memory for CMSIS-DAP queue");
 			return ERROR_FAIL;
@@ -1160,16 +1216,31 @@ static void debug_parse_cmsis_buf(const uint8_t *cmd, int cmdlen)
 }
 #endif
 
-static void cmsis_dap_flush(void)
+static void cmsis_dap_jtag_reset_queue(void)
+{
+	queued_seq_count = 0;
+	queued_seq_buf_end = 0;
+	queued_seq_tdo_ptr = 0;
+}
+
+/* Send the queued sequences as one DAP_JTAG_Sequence packet, without waiting
+ * for the answer. */
+static void cmsis_dap_jtag_write_from_queue(struct cmsis_dap *dap)
 {
 	if (!queued_seq_count)
 		return;
 
-	LOG_DEBUG_IO("Flushing %d queued sequences (%d bytes) with %d pending scan results to capture",
-		queued_seq_count, queued_seq_buf_end, pending_scan_result_count);
+	if (queued_retval != ERROR_OK) {
+		LOG_DEBUG("Skipping due to previous errors: %d", queued_retval);
+		goto skip;
+	}
+
+	LOG_DEBUG_IO("Sending %d queued sequences (%d bytes) with %d pending scan results to capture "
+		"from FIFO index %d", queued_seq_count, queued_seq_buf_end,
+		pending_scan_result_count[pending_fifo_put_idx], pending_fifo_put_idx);
 
 	/* prep CMSIS-DAP packet */
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = dap->packet_buffer;
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_JTAG_SEQ;
 	buffer[2] = queued_seq_count;
@@ -1180,24 +1251,52 @@ static void cmsis_dap_flush(void)
 #endif
 
 	/* send command to USB device */
-	int retval = cmsis_dap_xfer(cmsis_dap_handle, queued_seq_buf_end + 3);
-	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
+	int retval = dap->backend->write(dap, queued_seq_buf_end + 3, USB_TIMEOUT);
+	if (retval < 0) {
 		LOG_ERROR("CMSIS-DAP command CMD_DAP_JTAG_SEQ failed.");
-		exit(-1);
+		queued_retval = ERROR_FAIL;
+		goto skip;
 	}
 
-#ifdef CMSIS_DAP_JTAG_DEBUG
-	LOG_DEBUG_IO("USB response buf:");
-	for (int c = 0; c < queued_seq_buf_end + 3; ++c)
-		printf("%02X ", buffer[c]);
-	printf("\n");
-#endif
+	pending_fifo_put_idx = (pending_fifo_put_idx + 1) % dap->packet_count;
+	pending_fifo_block_count++;
+	if (pending_fifo_block_count > dap->packet_count)
+		LOG_ERROR("too much pending writes %d", pending_fifo_block_count);
+
+	cmsis_dap_jtag_reset_queue();
+	return;
+
+skip:
+	pending_scan_result_count[pending_fifo_put_idx] = 0;
+	cmsis_dap_jtag_reset_queue();
+}
+
+/* Wait for the answer to the oldest DAP_JTAG_Sequence packet in flight, and
+ * copy the captured TDO where it was asked for. */
+static void cmsis_dap_jtag_read_process(struct cmsis_dap *dap, int timeout_ms)
+{
+	uint8_t *buffer = dap->packet_buffer;
+	int idx = pending_fifo_get_idx;
+
+	if (pending_fifo_block_count == 0)
+		LOG_ERROR("no pending write");
+
+	/* get reply */
+	int retval = dap->backend->read(dap, timeout_ms);
+	if (retval == ERROR_TIMEOUT_REACHED && timeout_ms < USB_TIMEOUT)
+		return;
+
+	if (retval <= 0 || buffer[1] != DAP_OK) {
+		LOG_ERROR("CMSIS-DAP command CMD_DAP_JTAG_SEQ failed.");
+		queued_retval = ERROR_FAIL;
+		goto skip;
+	}
 
 	/* copy scan results into client buffers */
-	for (int i = 0; i < pending_scan_result_count; ++i) {
-		struct pending_scan_result *scan = &pending_scan_results[i];
+	for (int i = 0; i < pending_scan_result_count[idx]; ++i) {
+		struct pending_scan_result *scan = &pending_scan_results[idx][i];
 		LOG_DEBUG_IO("Copying pending_scan_result %d/%d: %d bits from byte %d -> buffer + %d bits",
-			i, pending_scan_result_count, scan->length, scan->first + 2, scan->buffer_offset);
+			i, pending_scan_result_count[idx], scan->length, scan->first + 2, scan->buffer_offset);
 #ifdef CMSIS_DAP_JTAG_DEBUG
 		for (uint32_t b = 0; b < DIV_ROUND_UP(scan->length, 8); ++b)
 			printf("%02X ", buffer[2+scan->first+b]);
@@ -1206,11 +1305,36 @@ static void cmsis_dap_flush(void)
 		bit_copy(scan->buffer, scan->buffer_offset, buffer + 2 + scan->first, 0, scan->length);
 	}
 
-	/* reset */
-	queued_seq_count = 0;
-	queued_seq_buf_end = 0;
-	queued_seq_tdo_ptr = 0;
-	pending_scan_result_count = 0;
+skip:
+	pending_scan_result_count[idx] = 0;
+	pending_fifo_get_idx = (pending_fifo_get_idx + 1) % dap->packet_count;
+	pending_fifo_block_count--;
+}
+
+/* The sequence buffer is full: send it, and only wait for an answer once
+ * packet_count packets are in flight. */
+static void cmsis_dap_jtag_send(void)
+{
+	if (pending_fifo_block_count)
+		cmsis_dap_jtag_read_process(cmsis_dap_handle, 0);
+
+	cmsis_dap_jtag_write_from_queue(cmsis_dap_handle);
+
+	if (pending_fifo_block_count >= cmsis_dap_handle->packet_count)
+		cmsis_dap_jtag_read_process(cmsis_dap_handle, USB_TIMEOUT);
+}
+
+/* Send whatever is queued and wait for all packets in flight. Errors are
+ * collected in queued_retval. */
+static void cmsis_dap_flush(void)
+{
+	cmsis_dap_jtag_write_from_queue(cmsis_dap_handle);
+
+	while (pending_fifo_block_count)
+		cmsis_dap_jtag_read_process(cmsis_dap_handle, USB_TIMEOUT);
+
+	pending_fifo_put_idx = 0;
+	pending_fifo_get_idx = 0;
 }
 
 /* queue a sequence of bits to clock out TDI / in TDO, executing if the buffer is full.
@@ -1251,7 +1375,7 @@ static void cmsis_dap_add_jtag_sequence(int s_len, const uint8_t *sequence, int
 	int cmd_len = 1 + DIV_ROUND_UP(s_len, 8);
 	if (queued_seq_count >= 255 || queued_seq_buf_end + cmd_len > QUEUED_SEQ_BUF_LEN)
 		/* empty out the buffer */
-		cmsis_dap_flush();
+		cmsis_dap_jtag_send();
 
 	++queued_seq_count;
 
@@ -1269,7 +1393,8 @@ static void cmsis_dap_add_jtag_sequence(int s_len, const uint8_t *sequence, int
 	queued_seq_buf_end += cmd_len;
 
 	if (tdo_buffer != NULL) {
-		struct pending_scan_result *scan = &pending_scan_results[pending_scan_result_count++];
+		struct pending_scan_result *scan =
+			&pending_scan_results[pending_fifo_put_idx][pending_scan_result_count[pending_fifo_put_idx]++];
 		scan->first = queued_seq_tdo_ptr;
 		queued_seq_tdo_ptr += DIV_ROUND_UP(s_len, 8);
 		scan->length = s_len;
@@ -1286,10 +1411,13 @@ static void cmsis_dap_add_tms_sequence(const uint8_t *sequence, int s_len)
 	   because even though it seems ridiculously inefficient, it
 	   allows us to combine TMS and scan sequences into the same
 	   USB packet. */
-	/* TODO: combine runs of the same tms value */
-	for (int i = 0; i < s_len; ++i) {
+	for (int i = 0; i < s_len; ) {
 		bool bit = (sequence[i / 8] & (1 << (i % 8))) != 0;
-		cmsis_dap_add_jtag_sequence(1, NULL, 0, bit, NULL, 0);
+		int run = 1;
+		while (i + run < s_len && ((sequence[(i + run) / 8] & (1 << ((i + run) % 8))) != 0) == bit)
+			run++;
+		cmsis_dap_add_jtag_sequence(run, NULL, 0, bit, NULL, 0);
+		i += run;
 	}
 }
 
@@ -1447,13 +1575,9 @@ static void cmsis_dap_execute_pathmove(struct jtag_command *cmd)
 
 static void cmsis_dap_stableclocks(int num_cycles)
 {
-	int i;
-
-	uint8_t tms = tap_get_state() == TAP_RESET;
-	/* TODO: Perform optimizations? */
-	/* Execute num_cycles. */
-	for (i = 0; i < num_cycles; i++)
-		cmsis_dap_add_tms_sequence(&tms, 1);
+	bool tms = tap_get_state() == TAP_RESET;
+	/* One sequence per 64 cycles, rather than one per cycle. */
+	cmsis_dap_add_jtag_sequence(num_cycles, NULL, 0, tms, NULL, 0);
 }
 
 static void cmsis_dap_runtest(int num_cycles)
@@ -1521,6 +1645,7 @@ static void cmsis_dap_execute_command(struct jtag_command *cmd)
 			cmsis_dap_execute_stableclocks(cmd);
 			break;
 		case JTAG_TMS:
+			cmsis_dap_flush();
 			cmsis_dap_execute_tms(cmd);
 			break;
 		default:
@@ -1540,7 +1665,10 @@ static int cmsis_dap_execute_queue(void)
 
 	cmsis_dap_flush();
 
-	return ERROR_OK;
+	int retval = queued_retval;
+	queued_retval = ERROR_OK;
+
+	return retval;
 }
 
 static int cmsis_dap_speed(int speed)
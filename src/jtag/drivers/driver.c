@@ -55,18 +55,33 @@ static void jtag_callback_queue_reset(void)
 	jtag_callback_queue_tail = NULL;
 }
 
+/* Start a run of bypassed bits at @a field, or extend the one it holds */
+static void jtag_bypass_run_add(struct scan_field **field, struct scan_field *run_start,
+		int num_bits)
+{
+	if (*field == run_start) {
+		(*field)->num_bits = 0;
+		(*field)->out_value = NULL;
+		(*field)->in_value = NULL;
+		(*field)++;
+	}
+	(*field)[-1].num_bits += num_bits;
+}
+
 /**
  * see jtag_add_ir_scan()
  *
+ * The TAPs in BYPASS around @a active are shifted as one field each side,
+ * however long the chain, so neither this nor the adapter driver does
+ * per-TAP work for them.
  */
 int interface_jtag_add_ir_scan(struct jtag_tap *active,
 		const struct scan_field *in_fields, tap_state_t state)
 {
-	size_t num_taps = jtag_tap_count_enabled();
-
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
 	struct scan_command *scan = cmd_queue_alloc(sizeof(struct scan_command));
-	struct scan_field *out_fields = cmd_queue_alloc(num_taps  * sizeof(struct scan_field));
+	/* at most: bypass run, active TAP, bypass run */
+	struct scan_field *out_fields = cmd_queue_alloc(3 * sizeof(struct scan_field));
 
 	jtag_queue_command(cmd);
 
@@ -74,11 +89,11 @@ int interface_jtag_add_ir_scan(struct jtag_tap *active,
 	cmd->cmd.scan = scan;
 
 	scan->ir_scan = true;
-	scan->num_fields = num_taps;	/* one field per device */
 	scan->fields = out_fields;
 	scan->end_state = state;
 
 	struct scan_field *field = out_fields;	/* keep track where we insert data */
+	struct scan_field *run_start = field;	/* no bypass run open */
 
 	/* loop over all enabled TAPs */
 
@@ -90,46 +105,45 @@ int interface_jtag_add_ir_scan(struct jtag_tap *active,
 			tap->bypass = 0;
 
 			jtag_scan_field_clone(field, in_fields);
+
+			/* update device information */
+			buf_cpy(field->out_value, tap->cur_instr, tap->ir_length);
+
+			field++;
+			run_start = field;
 		} else {
 			/* if a TAP isn't listed in input fields, set it to BYPASS */
 
 			tap->bypass = 1;
 
-			field->num_bits = tap->ir_length;
-			field->out_value = buf_set_ones(cmd_queue_alloc(DIV_ROUND_UP(tap->ir_length, 8)), tap->ir_length);
-			field->in_value = NULL; /* do not collect input for tap's in bypass */
+			buf_set_ones(tap->cur_instr, tap->ir_length);
+			jtag_bypass_run_add(&field, run_start, tap->ir_length);
 		}
+	}
+	assert(field <= out_fields + 3);
 
-		/* update device information */
-		buf_cpy(field->out_value, tap->cur_instr, tap->ir_length);
-
-		field++;
+	/* the bypass runs shift all ones */
+	for (struct scan_field *f = out_fields; f < field; f++) {
+		if (!f->out_value)
+			f->out_value = buf_set_ones(cmd_queue_alloc(DIV_ROUND_UP(f->num_bits, 8)),
+					f->num_bits);
 	}
-	/* paranoia: jtag_tap_count_enabled() and jtag_tap_next_enabled() not in sync */
-	assert(field == out_fields + num_taps);
+	scan->num_fields = field - out_fields;
 
 	return ERROR_OK;
 }
 
 /**
- * see jtag_add_dr_scan()
+ * see jtag_add_dr_scan() and jtag_add_dr_scan_nocopy()
  *
  */
-int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
-		const struct scan_field *in_fields, tap_state_t state)
+static int jtag_add_dr_scan_fields(struct jtag_tap *active, int in_num_fields,
+		const struct scan_field *in_fields, tap_state_t state, bool copy)
 {
-	/* count devices in bypass */
-
-	size_t bypass_devices = 0;
-
-	for (struct jtag_tap *tap = jtag_tap_next_enabled(NULL); tap != NULL; tap = jtag_tap_next_enabled(tap)) {
-		if (tap->bypass)
-			bypass_devices++;
-	}
-
 	struct jtag_command *cmd = cmd_queue_alloc(sizeof(struct jtag_command));
 	struct scan_command *scan = cmd_queue_alloc(sizeof(struct scan_command));
-	struct scan_field *out_fields = cmd_queue_alloc((in_num_fields + bypass_devices) * sizeof(struct scan_field));
+	/* at most: bypass run, the input fields, bypass run */
+	struct scan_field *out_fields = cmd_queue_alloc((in_num_fields + 2) * sizeof(struct scan_field));
 
 	jtag_queue_command(cmd);
 
@@ -137,11 +151,11 @@ int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
 	cmd->cmd.scan = scan;
 
 	scan->ir_scan = false;
-	scan->num_fields = in_num_fields + bypass_devices;
 	scan->fields = out_fields;
 	scan->end_state = state;
 
 	struct scan_field *field = out_fields;	/* keep track where we insert data */
+	struct scan_field *run_start = field;	/* no bypass run open */
 
 	/* loop over all enabled TAPs */
 
@@ -156,29 +170,41 @@ int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
 #endif /* NDEBUG */
 
 			for (int j = 0; j < in_num_fields; j++) {
-				jtag_scan_field_clone(field, in_fields + j);
+				if (copy)
+					jtag_scan_field_clone(field, in_fields + j);
+				else
+					*field = in_fields[j];
 
 				field++;
 			}
 
 			assert(field > start_field);	/* must have at least one input field per not bypassed TAP */
+			run_start = field;
 		}
 
-		/* if a TAP is bypassed, generated a dummy bit*/
-		else {
-			field->num_bits = 1;
-			field->out_value = NULL;
-			field->in_value = NULL;
-
-			field++;
-		}
+		/* if a TAP is bypassed, add a dummy bit to the current run */
+		else
+			jtag_bypass_run_add(&field, run_start, 1);
 	}
 
-	assert(field == out_fields + scan->num_fields); /* no superfluous input fields permitted */
+	assert(field <= out_fields + in_num_fields + 2); /* no superfluous input fields permitted */
+	scan->num_fields = field - out_fields;
 
 	return ERROR_OK;
 }
 
+int interface_jtag_add_dr_scan(struct jtag_tap *active, int in_num_fields,
+		const struct scan_field *in_fields, tap_state_t state)
+{
+	return jtag_add_dr_scan_fields(active, in_num_fields, in_fields, state, true);
+}
+
+int interface_jtag_add_dr_scan_nocopy(struct jtag_tap *active, int in_num_fields,
+		const struct scan_field *in_fields, tap_state_t state)
+{
+	return jtag_add_dr_scan_fields(active, in_num_fields, in_fields, state, false);
+}
+
 static int jtag_add_plain_scan(int num_bits, const uint8_t *out_bits,
 		uint8_t *in_bits, tap_state_t state, bool ir_scan)
 {
@@ -22,6 +22,7 @@
 
 #include <jtag/interface.h>
 #include "bitbang.h"
+#include "dummy_riscv.h"
 #include "hello.h"
 
 /* my private tap controller state, which tracks state for calling code */
@@ -33,8 +34,14 @@ static int clock_count;		/* count clocks in any stable state, only stable states
 
 static uint32_t dummy_data;
 
+/* "dummy replay" trace answering the scans, NULL to bitbang as usual */
+static FILE *dummy_replay_file;
+
 static bb_value_t dummy_read(void)
 {
+	if (dummy_riscv_enabled())
+		return dummy_riscv_tdo() ? BB_HIGH : BB_LOW;
+
 	int data = 1 & dummy_data;
 	dummy_data = (dummy_data >> 1) | (1 << 31);
 	return data ? BB_HIGH : BB_LOW;
@@ -47,6 +54,8 @@ static int dummy_write(int tck, int tms, int tdi)
 		if (tck) {
 			tap_state_t old_state = dummy_state;
 			dummy_state = tap_state_transition(old_state, tms);
+			if (dummy_riscv_enabled())
+				dummy_riscv_clock(old_state, dummy_state, tdi);
 
 			if (old_state != dummy_state) {
 				if (clock_count) {
@@ -76,8 +85,11 @@ static int dummy_reset(int trst, int srst)
 {
 	dummy_clock = 0;
 
-	if (trst || (srst && (jtag_get_reset_config() & RESET_SRST_PULLS_TRST)))
+	if (trst || (srst && (jtag_get_reset_config() & RESET_SRST_PULLS_TRST))) {
 		dummy_state = TAP_RESET;
+		if (dummy_riscv_enabled())
+			dummy_riscv_tap_reset();
+	}
 
 	LOG_DEBUG("reset to: %s", tap_state_name(dummy_state));
 	return ERROR_OK;
@@ -127,15 +139,124 @@ static int dummy_init(void)
 
 static int dummy_quit(void)
 {
+	if (dummy_replay_file) {
+		fclose(dummy_replay_file);
+		dummy_replay_file = NULL;
+	}
+	dummy_riscv_free();
 	return ERROR_OK;
 }
 
+static int dummy_execute_queue(void)
+{
+	if (!dummy_replay_file)
+		return bitbang_execute_queue();
+	return jtag_trace_replay_queue(dummy_replay_file);
+}
+
+COMMAND_HANDLER(dummy_handle_replay_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (dummy_replay_file) {
+		fclose(dummy_replay_file);
+		dummy_replay_file = NULL;
+	}
+	if (!strcmp(CMD_ARGV[0], "off"))
+		return ERROR_OK;
+
+	FILE *file = fopen(CMD_ARGV[0], "rb");
+	if (!file) {
+		LOG_ERROR("couldn't open %s: %s", CMD_ARGV[0], strerror(errno));
+		return ERROR_FAIL;
+	}
+	if (jtag_trace_check_header(file) != ERROR_OK) {
+		fclose(file);
+		return ERROR_FAIL;
+	}
+	dummy_replay_file = file;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(dummy_handle_riscv_command)
+{
+	struct dummy_riscv_config config = {
+		.xlen = 32,
+		.progbufsize = 8,
+		.sba = true,
+		.ram_base = 0x80000000,
+		.ram_size = 1024 * 1024,
+	};
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "off")) {
+		dummy_riscv_free();
+		return ERROR_OK;
+	}
+
+	for (unsigned int i = 0; i < CMD_ARGC; i += 2) {
+		if (i + 1 >= CMD_ARGC)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		const char *option = CMD_ARGV[i];
+		const char *arg = CMD_ARGV[i + 1];
+		if (!strcmp(option, "-xlen")) {
+			COMMAND_PARSE_NUMBER(uint, arg, config.xlen);
+		} else if (!strcmp(option, "-progbufsize")) {
+			COMMAND_PARSE_NUMBER(uint, arg, config.progbufsize);
+		} else if (!strcmp(option, "-sba")) {
+			COMMAND_PARSE_ON_OFF(arg, config.sba);
+		} else if (!strcmp(option, "-ram")) {
+			if (i + 2 >= CMD_ARGC)
+				return ERROR_COMMAND_SYNTAX_ERROR;
+			COMMAND_PARSE_ADDRESS(arg, config.ram_base);
+			COMMAND_PARSE_NUMBER(u32, CMD_ARGV[i + 2], config.ram_size);
+			i++;
+		} else if (!strcmp(option, "-dmi_busy")) {
+			COMMAND_PARSE_NUMBER(uint, arg, config.dmi_busy);
+		} else if (!strcmp(option, "-abstract_busy")) {
+			COMMAND_PARSE_NUMBER(uint, arg, config.abstract_busy);
+		} else if (!strcmp(option, "-sba_busy")) {
+			COMMAND_PARSE_NUMBER(uint, arg, config.sba_busy);
+		} else {
+			command_print(CMD, "unknown option %s", option);
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		}
+	}
+
+	return dummy_riscv_init(&config);
+}
+
+static const struct command_registration dummy_subcommand_handlers[] = {
+	{
+		.name = "riscv",
+		.mode = COMMAND_ANY,
+		.handler = dummy_handle_riscv_command,
+		.help = "Put a software model of a RISC-V debug module with one "
+			"hart behind the dummy TAP, or remove it.",
+		.usage = "['off'] | ['-xlen' 32|64] ['-progbufsize' n] ['-sba' on|off] "
+			"['-ram' base size] ['-dmi_busy' cycles] "
+			"['-abstract_busy' cycles] ['-sba_busy' cycles]",
+	},
+	{
+		.name = "replay",
+		.mode = COMMAND_ANY,
+		.handler = dummy_handle_replay_command,
+		.help = "Answer scans from a 'jtag record' trace instead of "
+			"bitbanging, or stop doing so.",
+		.usage = "filename|'off'",
+	},
+	{
+		.chain = hello_command_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
 static const struct command_registration dummy_command_handlers[] = {
 	{
 		.name = "dummy",
 		.mode = COMMAND_ANY,
 		.help = "dummy interface driver commands",
-		.chain = hello_command_handlers,
+		.chain = dummy_subcommand_handlers,
 		.usage = "",
 	},
 	COMMAND_REGISTRATION_DONE,
@@ -146,7 +267,7 @@ static const struct command_registration dummy_command_handlers[] = {
  */
 static struct jtag_interface dummy_interface = {
 	.supported = DEBUG_CAP_TMS_SEQ,
-	.execute_queue = &bitbang_execute_queue,
+	.execute_queue = &dummy_execute_queue,
 };
 
 struct adapter_driver dummy_adapter_driver = {
@@ -0,0 +1,891 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dummy_riscv.h"
+
+#include <helper/log.h>
+#include <target/riscv/debug_defines.h>
+
+#define get_field(reg, mask) (((reg) & (mask)) / ((mask) & ~((mask) << 1)))
+#define set_field(reg, mask, val) (((reg) & ~(mask)) | (((val) * ((mask) & ~((mask) << 1))) & (mask)))
+
+/*
+ * The DTM has a 5 bit IR with IDCODE, DTMCS and DMI. The DM implements
+ * dmcontrol, dmstatus, abstract register access with a program buffer and
+ * autoexec, and system bus access to one RAM region. The hart doesn't run
+ * code of its own: while "running" it just waits for a halt request, a
+ * single step pretends to execute one instruction, and the program buffer
+ * is interpreted for the subset of RV32I/RV64I OpenOCD puts there.
+ *
+ * Busy behaviour is modelled in TCK cycles spent in Run-Test/Idle, which
+ * is what riscv-013 adds when the DTM or the DM tells it it was too fast.
+ */
+
+#define IR_LENGTH		5
+#define IR_IDCODE		DTM_IDCODE
+#define IR_DTMCS		DTM_DTMCS
+#define IR_DMI			DTM_DMI
+
+#define DUMMY_RISCV_IDCODE	0x1000563d
+#define ABITS			7
+#define DMI_LENGTH		(ABITS + 34)
+
+#define DMI_OP_NOP		0
+#define DMI_OP_READ		1
+#define DMI_OP_WRITE		2
+#define DMI_STATUS_FAILED	2
+#define DMI_STATUS_BUSY		3
+
+#define DATACOUNT		2
+#define MAX_PROGBUFSIZE		16
+/* where the program buffer appears to be, for auipc */
+#define PROGBUF_ADDRESS		0x800
+
+#define CMDERR_NONE		0
+#define CMDERR_BUSY		1
+#define CMDERR_NOT_SUPPORTED	2
+#define CMDERR_EXCEPTION	3
+#define CMDERR_HALT_RESUME	4
+
+#define SBERROR_BAD_ADDRESS	2
+#define SBERROR_BAD_SIZE	4
+
+#define CSR_MSTATUS		0x300
+#define CSR_MISA		0x301
+#define CSR_MHARTID		0xf14
+
+#define DCSR_CAUSE_HALTREQ	3
+#define DCSR_CAUSE_STEP		4
+/* ebreakm, ebreaks, ebreaku, stepie, stopcount, stoptime, step, prv */
+#define DCSR_WRITABLE		0xbe07u
+
+static const uint16_t model_csr_numbers[] = {
+	CSR_MSTATUS, CSR_MISA, 0x304, 0x305, 0x340, 0x341, 0x342, 0x343, 0x344,
+	CSR_TSELECT, CSR_DCSR, CSR_DPC, CSR_DSCRATCH0, CSR_DSCRATCH1,
+	0xf11, 0xf12, 0xf13, CSR_MHARTID,
+};
+
+static struct {
+	bool enabled;
+	struct dummy_riscv_config config;
+	uint8_t *ram;
+
+	/* TAP */
+	tap_state_t state;
+	uint32_t ir;
+	uint32_t ir_shift;
+	uint64_t dr_shift;
+	unsigned int dr_length;
+	uint64_t idle_cycles;
+
+	/* DTM */
+	unsigned int dmi_status;	/* sticky, 0 when OK */
+	uint32_t dmi_data;
+	uint32_t dmi_address;
+	uint64_t dmi_busy_until;
+
+	/* DM */
+	bool dmactive;
+	bool ndmreset;
+	uint32_t hartsel;
+	bool resethaltreq;
+	uint32_t data[DATACOUNT];
+	uint32_t progbuf[MAX_PROGBUFSIZE];
+	uint32_t command;
+	uint32_t abstractauto;
+	unsigned int cmderr;
+	uint64_t abstract_busy_until;
+
+	uint32_t sbcs;
+	uint64_t sbaddress;
+	uint64_t sbdata;
+	uint64_t sba_busy_until;
+
+	/* hart */
+	bool halted;
+	bool resumeack;
+	bool havereset;
+	uint64_t pc;
+	uint64_t gpr[32];
+	uint64_t csr[ARRAY_SIZE(model_csr_numbers)];
+} model;
+
+static uint64_t xlen_mask(uint64_t value)
+{
+	return model.config.xlen == 32 ? (uint32_t)value : value;
+}
+
+static int64_t xlen_signed(uint64_t value)
+{
+	return model.config.xlen == 32 ? (int32_t)value : (int64_t)value;
+}
+
+/* ---- hart ---- */
+
+static uint64_t *csr_find(unsigned int number)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(model_csr_numbers); i++)
+		if (model_csr_numbers[i] == number)
+			return &model.csr[i];
+	return NULL;
+}
+
+static bool csr_read(unsigned int number, uint64_t *value)
+{
+	uint64_t *csr = csr_find(number);
+	if (!csr)
+		return false;
+	*value = *csr;
+	return true;
+}
+
+static bool csr_write(unsigned int number, uint64_t value)
+{
+	uint64_t *csr = csr_find(number);
+	if (!csr)
+		return false;
+	switch (number) {
+		case CSR_MISA:
+		case CSR_MHARTID:
+		case CSR_TSELECT:	/* no triggers */
+		case 0xf11:
+		case 0xf12:
+		case 0xf13:
+			break;
+		case CSR_DCSR:
+			*csr = (*csr & ~(uint64_t)DCSR_WRITABLE) | (value & DCSR_WRITABLE);
+			break;
+		default:
+			*csr = xlen_mask(value);
+			break;
+	}
+	return true;
+}
+
+static void hart_set_cause(unsigned int cause)
+{
+	uint64_t *dcsr = csr_find(CSR_DCSR);
+	*dcsr = (*dcsr & ~(uint64_t)(7 << CSR_DCSR_CAUSE_OFFSET)) |
+		(cause << CSR_DCSR_CAUSE_OFFSET);
+}
+
+static void hart_halt(unsigned int cause)
+{
+	model.halted = true;
+	*csr_find(CSR_DPC) = model.pc;
+	hart_set_cause(cause);
+}
+
+static void hart_resume(void)
+{
+	model.pc = *csr_find(CSR_DPC);
+	model.halted = false;
+	model.resumeack = true;
+	if (*csr_find(CSR_DCSR) & (1 << CSR_DCSR_STEP_OFFSET)) {
+		/* pretend to execute one instruction */
+		model.pc = xlen_mask(model.pc + 4);
+		hart_halt(DCSR_CAUSE_STEP);
+	}
+}
+
+static void hart_reset(void)
+{
+	memset(model.gpr, 0, sizeof(model.gpr));
+	memset(model.csr, 0, sizeof(model.csr));
+	model.pc = model.config.ram_base;
+	*csr_find(CSR_DCSR) = (4 << CSR_DCSR_XDEBUGVER_OFFSET) | 3;
+	uint64_t mxl = model.config.xlen == 32 ? 1 : 2;
+	*csr_find(CSR_MISA) = (mxl << (model.config.xlen - 2)) | (1 << ('I' - 'A'));
+	model.havereset = true;
+	model.halted = false;
+	model.resumeack = false;
+	if (model.resethaltreq)
+		hart_halt(DCSR_CAUSE_HALTREQ);
+}
+
+static bool mem_access(uint64_t address, unsigned int size)
+{
+	return size && address >= model.config.ram_base &&
+		address - model.config.ram_base + size <= model.config.ram_size;
+}
+
+static bool mem_read(uint64_t address, unsigned int size, uint64_t *value)
+{
+	if (!mem_access(address, size))
+		return false;
+	const uint8_t *p = model.ram + (address - model.config.ram_base);
+	*value = 0;
+	for (unsigned int i = 0; i < size; i++)
+		*value |= (uint64_t)p[i] << (8 * i);
+	return true;
+}
+
+static bool mem_write(uint64_t address, unsigned int size, uint64_t value)
+{
+	if (!mem_access(address, size))
+		return false;
+	uint8_t *p = model.ram + (address - model.config.ram_base);
+	for (unsigned int i = 0; i < size; i++)
+		p[i] = value >> (8 * i);
+	return true;
+}
+
+static void gpr_write(unsigned int reg, uint64_t value)
+{
+	if (reg)
+		model.gpr[reg] = xlen_mask(value);
+}
+
+static uint64_t sign_extend(uint64_t value, unsigned int bits)
+{
+	uint64_t sign = 1ull << (bits - 1);
+	return ((value & ((sign << 1) - 1)) ^ sign) - sign;
+}
+
+/* Runs one instruction of the program buffer, returns whether it
+ * completed, setting *done when it was ebreak. */
+static bool hart_execute(uint32_t insn, uint64_t pc, bool *done)
+{
+	unsigned int opcode = insn & 0x7f;
+	unsigned int rd = (insn >> 7) & 0x1f;
+	unsigned int funct3 = (insn >> 12) & 7;
+	unsigned int rs1 = (insn >> 15) & 0x1f;
+	unsigned int rs2 = (insn >> 20) & 0x1f;
+	uint64_t imm_i = sign_extend(insn >> 20, 12);
+	uint64_t imm_s = sign_extend(((insn >> 25) << 5) | ((insn >> 7) & 0x1f), 12);
+	uint64_t imm_u = sign_extend(insn & 0xfffff000u, 32);
+	uint64_t a = model.gpr[rs1];
+	unsigned int shamt_mask = model.config.xlen - 1;
+	uint64_t value;
+
+	switch (opcode) {
+		case 0x37:	/* lui */
+			gpr_write(rd, imm_u);
+			return true;
+		case 0x17:	/* auipc */
+			gpr_write(rd, pc + imm_u);
+			return true;
+		case 0x13:	/* op-imm */
+		case 0x33: {	/* op */
+			uint64_t b = opcode == 0x13 ? imm_i : model.gpr[rs2];
+			bool alt = opcode == 0x33 ? (insn >> 30) & 1 : false;
+			if (opcode == 0x33 && (insn >> 25) & ~0x20u)
+				return false;	/* M extension */
+			switch (funct3) {
+				case 0:
+					value = alt ? a - b : a + b;
+					break;
+				case 1:
+					value = a << (b & shamt_mask);
+					break;
+				case 2:
+					value = xlen_signed(a) < xlen_signed(b);
+					break;
+				case 3:
+					value = xlen_mask(a) < xlen_mask(b);
+					break;
+				case 4:
+					value = a ^ b;
+					break;
+				case 5:
+					if ((insn >> 30) & 1)
+						value = xlen_signed(a) >> (b & shamt_mask);
+					else
+						value = xlen_mask(a) >> (b & shamt_mask);
+					break;
+				case 6:
+					value = a | b;
+					break;
+				default:
+					value = a & b;
+					break;
+			}
+			gpr_write(rd, value);
+			return true;
+		}
+		case 0x03: {	/* load */
+			static const unsigned int sizes[8] = { 1, 2, 4, 8, 1, 2, 4, 0 };
+			unsigned int size = sizes[funct3];
+			if (!size || (size == 8 && model.config.xlen == 32) ||
+					(funct3 == 6 && model.config.xlen == 32))
+				return false;
+			if (!mem_read(a + imm_i, size, &value))
+				return false;
+			if (funct3 < 3)
+				value = sign_extend(value, 8 * size);
+			gpr_write(rd, value);
+			return true;
+		}
+		case 0x23: {	/* store */
+			unsigned int size = 1 << (funct3 & 3);
+			if (funct3 > 3 || (size == 8 && model.config.xlen == 32))
+				return false;
+			return mem_write(a + imm_s, size, model.gpr[rs2]);
+		}
+		case 0x0f:	/* fence, fence.i */
+			return true;
+		case 0x73: {	/* system */
+			if (insn == 0x00100073) {
+				*done = true;
+				return true;
+			}
+			unsigned int csr = insn >> 20;
+			uint64_t src = funct3 & 4 ? rs1 : a;
+			uint64_t old;
+			if ((funct3 & 3) == 0 || !csr_read(csr, &old))
+				return false;
+			switch (funct3 & 3) {
+				case 1:
+					value = src;
+					break;
+				case 2:
+					value = old | src;
+					break;
+				default:
+					value = old & ~src;
+					break;
+			}
+			/* csrrs/csrrc with x0/zero don't write */
+			if (((funct3 & 3) == 1 || rs1) && !csr_write(csr, value))
+				return false;
+			gpr_write(rd, old);
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+static bool hart_execute_progbuf(void)
+{
+	for (unsigned int i = 0; i < model.config.progbufsize; i++) {
+		bool done = false;
+		if (!hart_execute(model.progbuf[i], PROGBUF_ADDRESS + 4 * i, &done))
+			return false;
+		if (done)
+			return true;
+	}
+	/* impebreak */
+	return true;
+}
+
+/* ---- DM ---- */
+
+static bool hart_selected(void)
+{
+	return model.hartsel == 0;
+}
+
+static bool abstract_busy(void)
+{
+	return model.idle_cycles < model.abstract_busy_until;
+}
+
+static bool sba_busy(void)
+{
+	return model.idle_cycles < model.sba_busy_until;
+}
+
+static unsigned int access_register(uint32_t command)
+{
+	unsigned int size = 8 << get_field(command, AC_ACCESS_REGISTER_AARSIZE);
+	unsigned int regno = get_field(command, AC_ACCESS_REGISTER_REGNO);
+
+	if (!model.halted)
+		return CMDERR_HALT_RESUME;
+
+	if (command & AC_ACCESS_REGISTER_TRANSFER) {
+		if (size > model.config.xlen || size < 32)
+			return CMDERR_NOT_SUPPORTED;
+		uint64_t mask = size == 64 ? ~0ull : 0xffffffffull;
+		bool write = command & AC_ACCESS_REGISTER_WRITE;
+		uint64_t value = model.data[0] | (uint64_t)model.data[1] << 32;
+		value &= mask;
+		bool ok;
+		if (regno >= 0x1000 && regno < 0x1020) {
+			ok = true;
+			if (write)
+				gpr_write(regno - 0x1000, value);
+			else
+				value = model.gpr[regno - 0x1000];
+		} else if (regno < 0x1000) {
+			ok = write ? csr_write(regno, value) : csr_read(regno, &value);
+		} else {
+			ok = false;
+		}
+		if (!ok)
+			return CMDERR_EXCEPTION;
+		if (!write) {
+			value &= mask;
+			model.data[0] = value;
+			if (size == 64)
+				model.data[1] = value >> 32;
+		}
+	}
+
+	if (command & AC_ACCESS_REGISTER_AARPOSTINCREMENT)
+		model.command = set_field(command, AC_ACCESS_REGISTER_REGNO,
+				(regno + 1) & 0xffff);
+
+	if ((command & AC_ACCESS_REGISTER_POSTEXEC) && !hart_execute_progbuf())
+		return CMDERR_EXCEPTION;
+
+	return CMDERR_NONE;
+}
+
+static void abstract_execute(void)
+{
+	unsigned int cmderr;
+	if (get_field(model.command, DM_COMMAND_CMDTYPE) == 0)
+		cmderr = access_register(model.command);
+	else
+		cmderr = CMDERR_NOT_SUPPORTED;
+	if (cmderr)
+		model.cmderr = cmderr;
+	model.abstract_busy_until = model.idle_cycles + model.config.abstract_busy;
+}
+
+/* Access to the abstract command registers while a command runs fails.
+ * Returns whether the access goes through. */
+static bool abstract_access(void)
+{
+	if (abstract_busy()) {
+		if (!model.cmderr)
+			model.cmderr = CMDERR_BUSY;
+		return false;
+	}
+	return true;
+}
+
+static void abstract_autoexec(bool autoexec)
+{
+	if (autoexec && !model.cmderr)
+		abstract_execute();
+}
+
+static unsigned int sba_size(void)
+{
+	unsigned int size = 1 << get_field(model.sbcs, DM_SBCS_SBACCESS);
+	if (size > model.config.xlen / 8)
+		return 0;
+	return size;
+}
+
+static bool sba_ready(void)
+{
+	if (sba_busy()) {
+		model.sbcs |= DM_SBCS_SBBUSYERROR;
+		return false;
+	}
+	return !(model.sbcs & (DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR));
+}
+
+static void sba_access(bool write)
+{
+	unsigned int size = sba_size();
+	bool ok;
+	if (!size) {
+		model.sbcs = set_field(model.sbcs, DM_SBCS_SBERROR, SBERROR_BAD_SIZE);
+		return;
+	}
+	if (write)
+		ok = mem_write(model.sbaddress, size, model.sbdata);
+	else
+		ok = mem_read(model.sbaddress, size, &model.sbdata);
+	if (!ok) {
+		model.sbcs = set_field(model.sbcs, DM_SBCS_SBERROR, SBERROR_BAD_ADDRESS);
+		return;
+	}
+	if (model.sbcs & DM_SBCS_SBAUTOINCREMENT)
+		model.sbaddress = xlen_mask(model.sbaddress + size);
+	model.sba_busy_until = model.idle_cycles + model.config.sba_busy;
+}
+
+static void dm_reset(void)
+{
+	model.dmactive = false;
+	model.ndmreset = false;
+	model.hartsel = 0;
+	model.resethaltreq = false;
+	memset(model.data, 0, sizeof(model.data));
+	memset(model.progbuf, 0, sizeof(model.progbuf));
+	model.command = 0;
+	model.abstractauto = 0;
+	model.cmderr = CMDERR_NONE;
+	model.abstract_busy_until = 0;
+	model.sbcs = 0;
+	model.sbaddress = 0;
+	model.sbdata = 0;
+	model.sba_busy_until = 0;
+}
+
+static uint32_t dm_read(unsigned int address)
+{
+	uint32_t value = 0;
+
+	if (address >= DM_DATA0 && address < DM_DATA0 + DATACOUNT) {
+		unsigned int i = address - DM_DATA0;
+		value = model.data[i];
+		if (abstract_access())
+			abstract_autoexec(model.abstractauto & (1 << i));
+		return value;
+	}
+	if (address >= DM_PROGBUF0 && address < DM_PROGBUF0 + model.config.progbufsize) {
+		unsigned int i = address - DM_PROGBUF0;
+		bool autoexec = model.abstractauto & (1 << (i + 16));
+		value = model.progbuf[i];
+		if (abstract_access())
+			abstract_autoexec(autoexec);
+		return value;
+	}
+
+	switch (address) {
+		case DM_DMCONTROL:
+			value = (model.dmactive ? DM_DMCONTROL_DMACTIVE : 0) |
+				(model.ndmreset ? DM_DMCONTROL_NDMRESET : 0) |
+				set_field(0, DM_DMCONTROL_HARTSELLO, model.hartsel & 0x3ff) |
+				set_field(0, DM_DMCONTROL_HARTSELHI, model.hartsel >> 10);
+			break;
+		case DM_DMSTATUS:
+			value = set_field(0, DM_DMSTATUS_VERSION, 2) |
+				DM_DMSTATUS_AUTHENTICATED | DM_DMSTATUS_HASRESETHALTREQ |
+				DM_DMSTATUS_IMPEBREAK;
+			if (!hart_selected()) {
+				value |= DM_DMSTATUS_ALLNONEXISTENT | DM_DMSTATUS_ANYNONEXISTENT;
+				break;
+			}
+			if (model.halted)
+				value |= DM_DMSTATUS_ALLHALTED | DM_DMSTATUS_ANYHALTED;
+			else
+				value |= DM_DMSTATUS_ALLRUNNING | DM_DMSTATUS_ANYRUNNING;
+			if (model.resumeack)
+				value |= DM_DMSTATUS_ALLRESUMEACK | DM_DMSTATUS_ANYRESUMEACK;
+			if (model.havereset)
+				value |= DM_DMSTATUS_ALLHAVERESET | DM_DMSTATUS_ANYHAVERESET;
+			break;
+		case DM_ABSTRACTCS:
+			value = set_field(0, DM_ABSTRACTCS_PROGBUFSIZE, model.config.progbufsize) |
+				set_field(0, DM_ABSTRACTCS_CMDERR, model.cmderr) |
+				set_field(0, DM_ABSTRACTCS_DATACOUNT, DATACOUNT);
+			if (abstract_busy())
+				value |= DM_ABSTRACTCS_BUSY;
+			break;
+		case DM_COMMAND:
+			value = model.command;
+			break;
+		case DM_ABSTRACTAUTO:
+			value = model.abstractauto;
+			break;
+		case DM_HALTSUM0:
+			value = model.halted ? 1 : 0;
+			break;
+		case DM_SBCS:
+			if (!model.config.sba)
+				break;
+			value = model.sbcs | set_field(0, DM_SBCS_SBVERSION, 1) |
+				set_field(0, DM_SBCS_SBASIZE, model.config.xlen) |
+				DM_SBCS_SBACCESS8 | DM_SBCS_SBACCESS16 | DM_SBCS_SBACCESS32 |
+				(model.config.xlen == 64 ? DM_SBCS_SBACCESS64 : 0);
+			if (sba_busy())
+				value |= DM_SBCS_SBBUSY;
+			break;
+		case DM_SBADDRESS0:
+			value = model.sbaddress;
+			break;
+		case DM_SBADDRESS1:
+			value = model.sbaddress >> 32;
+			break;
+		case DM_SBDATA0:
+			if (!model.config.sba)
+				break;
+			value = model.sbdata;
+			if (sba_ready() && (model.sbcs & DM_SBCS_SBREADONDATA))
+				sba_access(false);
+			break;
+		case DM_SBDATA1:
+			value = model.sbdata >> 32;
+			break;
+	}
+	return value;
+}
+
+static void dm_write_dmcontrol(uint32_t value)
+{
+	if (!(value & DM_DMCONTROL_DMACTIVE)) {
+		dm_reset();
+		return;
+	}
+	model.dmactive = true;
+	model.hartsel = get_field(value, DM_DMCONTROL_HARTSELLO) |
+		get_field(value, DM_DMCONTROL_HARTSELHI) << 10;
+	if (value & DM_DMCONTROL_SETRESETHALTREQ)
+		model.resethaltreq = true;
+	if (value & DM_DMCONTROL_CLRRESETHALTREQ)
+		model.resethaltreq = false;
+	bool ndmreset = value & DM_DMCONTROL_NDMRESET;
+	if (ndmreset && !model.ndmreset)
+		hart_reset();
+	model.ndmreset = ndmreset;
+	if (ndmreset || !hart_selected())
+		return;
+
+	if (value & DM_DMCONTROL_ACKHAVERESET)
+		model.havereset = false;
+	if (value & DM_DMCONTROL_HALTREQ) {
+		if (!model.halted)
+			hart_halt(DCSR_CAUSE_HALTREQ);
+	} else if (value & DM_DMCONTROL_RESUMEREQ) {
+		model.resumeack = false;
+		if (model.halted)
+			hart_resume();
+	}
+}
+
+static void dm_write(unsigned int address, uint32_t value)
+{
+	if (address != DM_DMCONTROL && !model.dmactive)
+		return;
+
+	if (address >= DM_DATA0 && address < DM_DATA0 + DATACOUNT) {
+		unsigned int i = address - DM_DATA0;
+		if (abstract_access()) {
+			model.data[i] = value;
+			abstract_autoexec(model.abstractauto & (1 << i));
+		}
+		return;
+	}
+	if (address >= DM_PROGBUF0 && address < DM_PROGBUF0 + model.config.progbufsize) {
+		unsigned int i = address - DM_PROGBUF0;
+		bool autoexec = model.abstractauto & (1 << (i + 16));
+		if (abstract_access()) {
+			model.progbuf[i] = value;
+			abstract_autoexec(autoexec);
+		}
+		return;
+	}
+
+	switch (address) {
+		case DM_DMCONTROL:
+			dm_write_dmcontrol(value);
+			break;
+		case DM_ABSTRACTCS:
+			model.cmderr &= ~get_field(value, DM_ABSTRACTCS_CMDERR);
+			break;
+		case DM_COMMAND:
+			if (!abstract_access())
+				break;
+			model.command = value;
+			if (!model.cmderr)
+				abstract_execute();
+			break;
+		case DM_ABSTRACTAUTO:
+			if (!abstract_access())
+				break;
+			model.abstractauto = value &
+				(set_field(0, DM_ABSTRACTAUTO_AUTOEXECDATA, (1 << DATACOUNT) - 1) |
+				 set_field(0, DM_ABSTRACTAUTO_AUTOEXECPROGBUF,
+					 (1 << model.config.progbufsize) - 1));
+			break;
+		case DM_SBCS:
+			if (!model.config.sba)
+				break;
+			model.sbcs &= ~(value & (DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR));
+			model.sbcs = (model.sbcs & (DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR)) |
+				(value & (DM_SBCS_SBREADONADDR | DM_SBCS_SBACCESS |
+					  DM_SBCS_SBAUTOINCREMENT | DM_SBCS_SBREADONDATA));
+			break;
+		case DM_SBADDRESS0:
+			if (!model.config.sba || !sba_ready())
+				break;
+			model.sbaddress = (model.sbaddress & ~0xffffffffull) | value;
+			if (model.sbcs & DM_SBCS_SBREADONADDR)
+				sba_access(false);
+			break;
+		case DM_SBADDRESS1:
+			if (model.config.xlen == 64 && model.config.sba && sba_ready())
+				model.sbaddress = (model.sbaddress & 0xffffffffull) |
+					(uint64_t)value << 32;
+			break;
+		case DM_SBDATA0:
+			if (!model.config.sba || !sba_ready())
+				break;
+			model.sbdata = (model.sbdata & ~0xffffffffull) | value;
+			sba_access(true);
+			break;
+		case DM_SBDATA1:
+			if (model.config.sba && sba_ready())
+				model.sbdata = (model.sbdata & 0xffffffffull) | (uint64_t)value << 32;
+			break;
+	}
+}
+
+/* ---- DTM ---- */
+
+static uint32_t dtmcs_read(void)
+{
+	return set_field(0, DTM_DTMCS_VERSION, 1) |
+		set_field(0, DTM_DTMCS_ABITS, ABITS) |
+		set_field(0, DTM_DTMCS_DMISTAT, model.dmi_status) |
+		set_field(0, DTM_DTMCS_IDLE, MIN(model.config.dmi_busy, 7));
+}
+
+static void dtmcs_write(uint32_t value)
+{
+	if (value & (DTM_DTMCS_DMIRESET | DTM_DTMCS_DMIHARDRESET))
+		model.dmi_status = 0;
+	if (value & DTM_DTMCS_DMIHARDRESET)
+		model.dmi_busy_until = model.idle_cycles;
+}
+
+static bool dmi_busy(void)
+{
+	return model.idle_cycles < model.dmi_busy_until;
+}
+
+static uint64_t dmi_capture(void)
+{
+	unsigned int op = model.dmi_status;
+	if (!op && dmi_busy())
+		op = model.dmi_status = DMI_STATUS_BUSY;
+	return (uint64_t)model.dmi_address << 34 | (uint64_t)model.dmi_data << 2 | op;
+}
+
+static void dmi_update(uint64_t dmi)
+{
+	unsigned int op = dmi & 3;
+	uint32_t data = dmi >> 2;
+	unsigned int address = (dmi >> 34) & ((1 << ABITS) - 1);
+
+	if (model.dmi_status)
+		return;
+	if (dmi_busy()) {
+		model.dmi_status = DMI_STATUS_BUSY;
+		return;
+	}
+	if (op == DMI_OP_NOP)
+		return;
+
+	model.dmi_address = address;
+	if (op == DMI_OP_READ) {
+		model.dmi_data = dm_read(address);
+	} else if (op == DMI_OP_WRITE) {
+		dm_write(address, data);
+	} else {
+		model.dmi_status = DMI_STATUS_FAILED;
+		return;
+	}
+	model.dmi_busy_until = model.idle_cycles + model.config.dmi_busy;
+}
+
+/* ---- TAP ---- */
+
+void dummy_riscv_tap_reset(void)
+{
+	model.state = TAP_RESET;
+	model.ir = IR_IDCODE;
+}
+
+void dummy_riscv_clock(tap_state_t state, tap_state_t next, int tdi)
+{
+	switch (state) {
+		case TAP_IDLE:
+			model.idle_cycles++;
+			break;
+		case TAP_IRCAPTURE:
+			model.ir_shift = 1;
+			break;
+		case TAP_IRSHIFT:
+			model.ir_shift = (model.ir_shift >> 1) | (tdi ? 1 << (IR_LENGTH - 1) : 0);
+			break;
+		case TAP_DRCAPTURE:
+			switch (model.ir) {
+				case IR_IDCODE:
+					model.dr_shift = DUMMY_RISCV_IDCODE;
+					model.dr_length = 32;
+					break;
+				case IR_DTMCS:
+					model.dr_shift = dtmcs_read();
+					model.dr_length = 32;
+					break;
+				case IR_DMI:
+					model.dr_shift = dmi_capture();
+					model.dr_length = DMI_LENGTH;
+					break;
+				default:
+					model.dr_shift = 0;
+					model.dr_length = 1;
+					break;
+			}
+			break;
+		case TAP_DRSHIFT:
+			model.dr_shift = (model.dr_shift >> 1) |
+				((uint64_t)(tdi ? 1 : 0) << (model.dr_length - 1));
+			break;
+		default:
+			break;
+	}
+
+	model.state = next;
+	switch (next) {
+		case TAP_RESET:
+			dummy_riscv_tap_reset();
+			break;
+		case TAP_IRUPDATE:
+			model.ir = model.ir_shift;
+			break;
+		case TAP_DRUPDATE:
+			if (model.ir == IR_DTMCS)
+				dtmcs_write(model.dr_shift);
+			else if (model.ir == IR_DMI)
+				dmi_update(model.dr_shift);
+			break;
+		default:
+			break;
+	}
+}
+
+int dummy_riscv_tdo(void)
+{
+	if (model.state == TAP_IRSHIFT)
+		return model.ir_shift & 1;
+	return model.dr_shift & 1;
+}
+
+int dummy_riscv_init(const struct dummy_riscv_config *config)
+{
+	if (config->xlen != 32 && config->xlen != 64) {
+		LOG_ERROR("XLEN must be 32 or 64");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	if (config->progbufsize > MAX_PROGBUFSIZE) {
+		LOG_ERROR("at most %d program buffer words", MAX_PROGBUFSIZE);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	dummy_riscv_free();
+	model.ram = calloc(1, config->ram_size);
+	if (!model.ram && config->ram_size) {
+		LOG_ERROR("out of memory");
+		return ERROR_FAIL;
+	}
+	model.config = *config;
+	dummy_riscv_tap_reset();
+	dm_reset();
+	hart_reset();
+	model.enabled = true;
+	return ERROR_OK;
+}
+
+void dummy_riscv_free(void)
+{
+	free(model.ram);
+	memset(&model, 0, sizeof(model));
+}
+
+bool dummy_riscv_enabled(void)
+{
+	return model.enabled;
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef OPENOCD_JTAG_DRIVERS_DUMMY_RISCV_H
+#define OPENOCD_JTAG_DRIVERS_DUMMY_RISCV_H
+
+#include <jtag/jtag.h>
+
+/*
+ * A RISC-V debug transport module and debug module (0.13) with one hart,
+ * modelled in software behind the dummy driver's TAP, so the riscv-013 code
+ * can be exercised and benchmarked without hardware. See "dummy riscv".
+ */
+
+struct dummy_riscv_config {
+	unsigned int xlen;
+	unsigned int progbufsize;
+	bool sba;
+	target_addr_t ram_base;
+	uint32_t ram_size;
+	/* TCK cycles in Run-Test/Idle each kind of access keeps the DTM, the
+	 * abstract command engine or system bus access busy for */
+	unsigned int dmi_busy;
+	unsigned int abstract_busy;
+	unsigned int sba_busy;
+};
+
+int dummy_riscv_init(const struct dummy_riscv_config *config);
+void dummy_riscv_free(void);
+bool dummy_riscv_enabled(void);
+
+/** TAP reset, through TRST or Test-Logic-Reset. */
+void dummy_riscv_tap_reset(void);
+/** Rising TCK edge that moves the TAP from @a state to @a next. */
+void dummy_riscv_clock(tap_state_t state, tap_state_t next, int tdi);
+/** The TDO level until the next rising TCK edge. */
+int dummy_riscv_tdo(void);
+
+#endif /* OPENOCD_JTAG_DRIVERS_DUMMY_RISCV_H */
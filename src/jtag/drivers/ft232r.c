@@ -124,36 +124,39 @@ static int ft232r_send_recv(void)
 	int rxfifo_free = 128;
 
 	while (total_read < ft232r_output_len) {
-		/* Write */
+		/* Write what the RX FIFO can take and read back at the same time,
+		 * the reply is collected as soon as the chip has it */
 		int bytes_to_write = ft232r_output_len - total_written;
 		if (bytes_to_write > 64)
 			bytes_to_write = 64;
 		if (bytes_to_write > rxfifo_free)
 			bytes_to_write = rxfifo_free;
 
-		if (bytes_to_write) {
-			int n;
-
-			if (jtag_libusb_bulk_write(adapter, IN_EP,
-						   (char *) ft232r_output + total_written,
-						   bytes_to_write, 1000, &n) != ERROR_OK) {
-				LOG_ERROR("usb bulk write failed");
-				return ERROR_JTAG_DEVICE_ERROR;
-			}
+		uint8_t reply[64];
+		struct jtag_libusb_xfer transfers[2];
+		size_t n_transfers = 0;
 
-			total_written += n;
-			rxfifo_free -= n;
+		if (bytes_to_write) {
+			transfers[n_transfers].ep = IN_EP;
+			transfers[n_transfers].buf = ft232r_output + total_written;
+			transfers[n_transfers++].size = bytes_to_write;
 		}
+		transfers[n_transfers].ep = OUT_EP;
+		transfers[n_transfers].buf = reply;
+		transfers[n_transfers++].size = sizeof(reply);
 
-		/* Read */
-		uint8_t reply[64];
-		int n;
-
-		if (jtag_libusb_bulk_read(adapter, OUT_EP, (char *) reply,
-					  sizeof(reply), 1000, &n) != ERROR_OK) {
-			LOG_ERROR("usb bulk read failed");
+		if (jtag_libusb_bulk_transfer_n(adapter, transfers, n_transfers, 1000) != ERROR_OK) {
+			LOG_ERROR("usb bulk %s failed",
+					bytes_to_write && transfers[0].retval ? "write" : "read");
 			return ERROR_JTAG_DEVICE_ERROR;
 		}
+
+		if (bytes_to_write) {
+			total_written += transfers[0].transfer_size;
+			rxfifo_free -= transfers[0].transfer_size;
+		}
+
+		int n = transfers[n_transfers - 1].transfer_size;
 		if (n > 2) {
 			/* Copy data, ignoring first 2 bytes. */
 			memcpy(ft232r_output + total_read, reply + 2, n - 2);
@@ -183,6 +186,82 @@ static void ft232r_increase_buf_size(size_t new_buf_size)
 	}
 }
 
+/**
+ * Scans whose TDO is still in ft232r_output, sampled by ft232r_flush()
+ * once the whole buffer has gone out, so a queue of scans is one
+ * transaction instead of one per scan.
+ */
+struct ft232r_pending_scan {
+	struct scan_command *cmd;
+	uint8_t *buffer;
+	size_t bit0_index;
+	int scan_size;
+	enum scan_type type;
+};
+
+static struct ft232r_pending_scan *ft232r_pending;
+static size_t ft232r_pending_count;
+static size_t ft232r_pending_size;
+
+/* flush once this much is buffered, it is 8 bytes per scanned byte */
+#define FT232R_FLUSH_SIZE	(64 * 1024)
+
+static int ft232r_flush(void)
+{
+	int retval = ERROR_OK;
+
+	if (ft232r_output_len > 0)
+		retval = ft232r_send_recv();
+	ft232r_output_len = 0;
+
+	for (size_t i = 0; i < ft232r_pending_count; i++) {
+		struct ft232r_pending_scan *p = &ft232r_pending[i];
+
+		if (retval == ERROR_OK && p->type != SCAN_OUT) {
+			/* TDO is sampled on the rising edge, the second of each bit */
+			const uint8_t *sample = ft232r_output + p->bit0_index + 1;
+			const uint8_t tdo_mask = 1 << tdo_gpio;
+			for (int byte = 0; byte < DIV_ROUND_UP(p->scan_size, 8); byte++) {
+				int bits = MIN(8, p->scan_size - byte * 8);
+				uint8_t value = 0;
+				for (int bit = 0; bit < bits; bit++, sample += 2)
+					if (*sample & tdo_mask)
+						value |= 1 << bit;
+				p->buffer[byte] = value;
+			}
+		}
+		if (retval == ERROR_OK && jtag_read_buffer(p->buffer, p->cmd) != ERROR_OK)
+			retval = ERROR_JTAG_QUEUE_FAILED;
+		free(p->buffer);
+	}
+	ft232r_pending_count = 0;
+
+	return retval;
+}
+
+static int ft232r_add_pending_scan(struct scan_command *cmd, uint8_t *buffer,
+		size_t bit0_index, int scan_size, enum scan_type type)
+{
+	if (ft232r_pending_count == ft232r_pending_size) {
+		size_t size = ft232r_pending_size ? 2 * ft232r_pending_size : 64;
+		struct ft232r_pending_scan *p = realloc(ft232r_pending, size * sizeof(*p));
+		if (!p) {
+			free(buffer);
+			return ERROR_FAIL;
+		}
+		ft232r_pending = p;
+		ft232r_pending_size = size;
+	}
+	ft232r_pending[ft232r_pending_count++] = (struct ft232r_pending_scan) {
+		.cmd = cmd,
+		.buffer = buffer,
+		.bit0_index = bit0_index,
+		.scan_size = scan_size,
+		.type = type,
+	};
+	return ERROR_OK;
+}
+
 /**
  * Add one TCK/TMS/TDI sample to send buffer.
  */
@@ -234,7 +313,7 @@ static void ft232r_reset(int trst, int srst)
 	}
 
 	ft232r_output[ft232r_output_len++] = out_value;
-	ft232r_send_recv();
+	ft232r_flush();
 }
 
 static int ft232r_speed(int divisor)
@@ -336,6 +415,9 @@ static int ft232r_quit(void)
 	jtag_libusb_close(adapter);
 
 	free(ft232r_output); /* free used memory */
+	free(ft232r_pending);
+	ft232r_pending = NULL;
+	ft232r_pending_size = 0;
 	ft232r_output = NULL; /* reset pointer to memory */
 	ft232r_buf_size = FT232R_BUF_SIZE_EXTRA; /* reset next initial buffer size */
 
@@ -763,10 +845,11 @@ static void syncbb_stableclocks(int num_cycles)
 	}
 }
 
-static void syncbb_scan(bool ir_scan, enum scan_type type, uint8_t *buffer, int scan_size)
+static size_t syncbb_scan(bool ir_scan, enum scan_type type, uint8_t *buffer, int scan_size)
 {
 	tap_state_t saved_end_state = tap_get_end_state();
-	int bit_cnt, bit0_index;
+	int bit_cnt;
+	size_t bit0_index;
 
 	if (!((!ir_scan && (tap_get_state() == TAP_DRSHIFT)) || (ir_scan && (tap_get_state() == TAP_IRSHIFT)))) {
 		if (ir_scan)
@@ -804,19 +887,8 @@ static void syncbb_scan(bool ir_scan, enum scan_type type, uint8_t *buffer, int
 		 */
 		syncbb_state_move(1);
 	}
-	ft232r_send_recv();
-
-	if (type != SCAN_OUT)
-		for (bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
-			int bytec = bit_cnt/8;
-			int bcval = 1 << (bit_cnt % 8);
-			int val = ft232r_output[bit0_index + bit_cnt*2 + 1];
-
-			if (val & (1<<tdo_gpio))
-				buffer[bytec] |= bcval;
-			else
-				buffer[bytec] &= ~bcval;
-		}
+
+	return bit0_index;
 }
 
 static int syncbb_execute_queue(void)
@@ -825,6 +897,7 @@ static int syncbb_execute_queue(void)
 	int scan_size;
 	enum scan_type type;
 	uint8_t *buffer;
+	size_t bit0_index;
 	int retval;
 
 	/* return ERROR_OK, unless a jtag_read_buffer returns a failed check
@@ -883,15 +956,17 @@ static int syncbb_execute_queue(void)
 				syncbb_end_state(cmd->cmd.scan->end_state);
 				scan_size = jtag_build_buffer(cmd->cmd.scan, &buffer);
 				type = jtag_scan_type(cmd->cmd.scan);
-				syncbb_scan(cmd->cmd.scan->ir_scan, type, buffer, scan_size);
-				if (jtag_read_buffer(buffer, cmd->cmd.scan) != ERROR_OK)
-					retval = ERROR_JTAG_QUEUE_FAILED;
-				free(buffer);
+				bit0_index = syncbb_scan(cmd->cmd.scan->ir_scan, type, buffer, scan_size);
+				if (ft232r_add_pending_scan(cmd->cmd.scan, buffer, bit0_index,
+							scan_size, type) != ERROR_OK)
+					retval = ERROR_FAIL;
 				break;
 
 			case JTAG_SLEEP:
 				LOG_DEBUG_IO("sleep %" PRIu32, cmd->cmd.sleep->us);
 
+				if (ft232r_flush() != ERROR_OK)
+					retval = ERROR_JTAG_QUEUE_FAILED;
 				jtag_sleep(cmd->cmd.sleep->us);
 				break;
 
@@ -902,10 +977,12 @@ static int syncbb_execute_queue(void)
 				LOG_ERROR("BUG: unknown JTAG command type encountered");
 				exit(-1);
 		}
-		if (ft232r_output_len > 0)
-			ft232r_send_recv();
+		if (ft232r_output_len >= FT232R_FLUSH_SIZE && ft232r_flush() != ERROR_OK)
+			retval = ERROR_JTAG_QUEUE_FAILED;
 		cmd = cmd->next;
 	}
+	if (ft232r_flush() != ERROR_OK)
+		retval = ERROR_JTAG_QUEUE_FAILED;
 /*	ft232r_blink(0);*/
 
 	return retval;
@@ -137,6 +137,7 @@ static uint16_t ftdi_vid[MAX_USB_IDS + 1] = { 0 };
 static uint16_t ftdi_pid[MAX_USB_IDS + 1] = { 0 };
 
 static struct mpsse_ctx *mpsse_ctx;
+static unsigned ftdi_usb_transfers = 1;
 
 struct signal {
 	const char *name;
@@ -737,6 +738,10 @@ static int ftdi_initialize(void)
 	if (!mpsse_ctx)
 		return ERROR_JTAG_INIT_FAILED;
 
+	if (ftdi_usb_transfers > 1 &&
+			mpsse_set_transfers(mpsse_ctx, ftdi_usb_transfers) != ERROR_OK)
+		return ERROR_JTAG_INIT_FAILED;
+
 	output = jtag_output_init;
 	direction = jtag_direction_init;
 
@@ -1263,6 +1268,67 @@ COMMAND_HANDLER(ftdi_handle_tdo_sample_edge_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(ftdi_handle_usb_transfers_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned transfers;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], transfers);
+		if (transfers < 1 || transfers > MPSSE_MAX_TRANSFERS) {
+			command_print(CMD, "number of transfers must be 1 to %d",
+					MPSSE_MAX_TRANSFERS);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (mpsse_ctx) {
+			int retval = mpsse_set_transfers(mpsse_ctx, transfers);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		ftdi_usb_transfers = transfers;
+	}
+
+	command_print(CMD, "ftdi keeps up to %u USB transfers in flight", ftdi_usb_transfers);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(ftdi_handle_stats_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!mpsse_ctx) {
+		command_print(CMD, "ftdi device is not open");
+		return ERROR_FAIL;
+	}
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "clear"))
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		mpsse_clear_stats(mpsse_ctx);
+		return ERROR_OK;
+	}
+
+	struct mpsse_stats stats;
+	mpsse_get_stats(mpsse_ctx, &stats);
+	int64_t wall_ms = timeval_ms() - stats.since_ms;
+
+	command_print(CMD, "buffer size:      %u bytes", stats.buffer_size);
+	command_print(CMD, "flushes:          %" PRIu64 " (%" PRIu64 " on a full buffer, %"
+			PRIu64 " failed)", stats.flushes, stats.full_flushes, stats.failed_flushes);
+	command_print(CMD, "bytes written:    %" PRIu64 " (%.1f per flush)", stats.bytes_written,
+			stats.flushes ? (double)stats.bytes_written / stats.flushes : 0.0);
+	command_print(CMD, "bytes read:       %" PRIu64 " (%.1f per flush)", stats.bytes_read,
+			stats.flushes ? (double)stats.bytes_read / stats.flushes : 0.0);
+	command_print(CMD, "flushes/s:        %.1f",
+			wall_ms > 0 ? 1000.0 * stats.flushes / wall_ms : 0.0);
+	command_print(CMD, "time in flushes:  %" PRId64 " ms of %" PRId64 " ms (%.1f%%)",
+			stats.flush_ms, wall_ms,
+			wall_ms > 0 ? 100.0 * stats.flush_ms / wall_ms : 0.0);
+	return ERROR_OK;
+}
+
 #if BUILD_FTDI_OSCAN1 == 1
 COMMAND_HANDLER(ftdi_handle_oscan1_mode_command)
 {
@@ -1345,6 +1411,22 @@ static const struct command_registration ftdi_command_handlers[] = {
 			"allow signalling speed increase)",
 		.usage = "(rising|falling)",
 	},
+	{
+		.name = "ftdi_usb_transfers",
+		.handler = &ftdi_handle_usb_transfers_command,
+		.mode = COMMAND_ANY,
+		.help = "set how many USB transfers each way may be in flight at once "
+			"- default is 1",
+		.usage = "[count]",
+	},
+	{
+		.name = "ftdi_stats",
+		.handler = &ftdi_handle_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "show how much data each flush to the adapter carried and how "
+			"often flushes happened, or clear those counters",
+		.usage = "[clear]",
+	},
 #if BUILD_FTDI_OSCAN1 == 1
 	{
 		.name = "ftdi_oscan1_mode",
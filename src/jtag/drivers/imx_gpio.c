@@ -85,6 +85,8 @@ static inline bool gpio_level(int g)
 
 static bb_value_t imx_gpio_read(void);
 static int imx_gpio_write(int tck, int tms, int tdi);
+static int imx_gpio_scan_block(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned int bits);
 
 static int imx_gpio_swdio_read(void);
 static void imx_gpio_swdio_drive(bool is_output);
@@ -96,6 +98,7 @@ static int imx_gpio_quit(void);
 static struct bitbang_interface imx_gpio_bitbang = {
 	.read = imx_gpio_read,
 	.write = imx_gpio_write,
+	.scan_block = imx_gpio_scan_block,
 	.swdio_read = imx_gpio_swdio_read,
 	.swdio_drive = imx_gpio_swdio_drive,
 	.swd_write = imx_gpio_swd_write,
@@ -146,6 +149,66 @@ static int imx_gpio_write(int tck, int tms, int tdi)
 	return ERROR_OK;
 }
 
+static int imx_gpio_scan_block(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned int bits)
+{
+	int bank = tck_gpio / 32;
+
+	if (tms_gpio / 32 != bank || tdi_gpio / 32 != bank) {
+		/* No single register to write, so take the slow path. */
+		for (unsigned int i = 0; i < bits; i++) {
+			int tms_bit = (tms[i / 8] >> (i % 8)) & 1;
+			int tdi_bit = tdi ? (tdi[i / 8] >> (i % 8)) & 1 : 0;
+
+			imx_gpio_write(0, tms_bit, tdi_bit);
+			if (tdo) {
+				if (gpio_level(tdo_gpio))
+					tdo[i / 8] |= 1 << (i % 8);
+				else
+					tdo[i / 8] &= ~(1 << (i % 8));
+			}
+			imx_gpio_write(1, tms_bit, tdi_bit);
+		}
+		return ERROR_OK;
+	}
+
+	const uint32_t tck_mask = 1u << (tck_gpio & 0x1F);
+	const uint32_t tms_mask = 1u << (tms_gpio & 0x1F);
+	const uint32_t tdi_mask = 1u << (tdi_gpio & 0x1F);
+	volatile uint32_t *dr = &pio_base[bank].dr;
+	/* Nothing else drives the other pins of the bank during the scan, so
+	 * write the data register without reading it back every time. */
+	uint32_t others = *dr & ~(tck_mask | tms_mask | tdi_mask);
+
+	for (unsigned int i = 0; i < bits; i++) {
+		unsigned int byte = i / 8;
+		uint8_t bit = 1 << (i % 8);
+		uint32_t value = others;
+
+		if (tms[byte] & bit)
+			value |= tms_mask;
+		if (tdi && (tdi[byte] & bit))
+			value |= tdi_mask;
+
+		*dr = value;
+		for (unsigned int j = 0; j < jtag_delay; j++)
+			asm volatile ("");
+
+		if (tdo) {
+			if (gpio_level(tdo_gpio))
+				tdo[byte] |= bit;
+			else
+				tdo[byte] &= ~bit;
+		}
+
+		*dr = value | tck_mask;
+		for (unsigned int j = 0; j < jtag_delay; j++)
+			asm volatile ("");
+	}
+
+	return ERROR_OK;
+}
+
 static int imx_gpio_swd_write(int swclk, int swdio)
 {
 	swdio ? gpio_set(swdio_gpio) : gpio_clear(swdio_gpio);
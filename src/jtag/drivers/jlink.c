@@ -40,6 +40,7 @@
 #include <jtag/commands.h>
 #include <jtag/drivers/jtag_usb_common.h>
 #include <src/helper/replacements.h>
+#include <helper/time_support.h>
 #include <target/cortex_m.h>
 
 #include <libjaylink/libjaylink.h>
@@ -61,8 +62,22 @@ static bool trace_enabled;
 
 #define JLINK_MAX_SPEED			12000
 #define JLINK_TAP_BUFFER_SIZE	2048
+/* jaylink_jtag_io() takes the length in bits as 16 bit number. */
+#define JLINK_MAX_TAP_BUFFER_SIZE	(UINT16_MAX / 8)
 
 static unsigned int swd_buffer_size = JLINK_TAP_BUFFER_SIZE;
+/* How much of the TAP buffers a JTAG flush may use, see adjust_tap_buffer_size(). */
+static unsigned int tap_buffer_size = JLINK_TAP_BUFFER_SIZE;
+
+static struct {
+	uint64_t flushes;
+	/* Flushes because the TAP buffer or the pending scan results were full,
+	 * rather than because the queue was executed. */
+	uint64_t full_flushes;
+	uint64_t bits;
+	int64_t flush_ms;
+	int64_t since_ms;
+} jtag_stats;
 
 /* Maximum SWO frequency deviation. */
 #define SWO_MAX_FREQ_DEV	0.03
@@ -496,6 +511,45 @@ static bool adjust_swd_buffer_size(void)
 	return true;
 }
 
+/*
+ * Let the JTAG TAP buffers follow the free device internal memory, like the
+ * SWD transaction buffer. Devices with plenty of memory can then take a whole
+ * batch of scans per flush instead of 2 KiB.
+ */
+static bool adjust_tap_buffer_size(void)
+{
+	int ret;
+	uint32_t tmp;
+
+	if (!jaylink_has_cap(caps, JAYLINK_DEV_CAP_GET_FREE_MEMORY))
+		return true;
+
+	ret = jaylink_get_free_memory(devh, &tmp);
+
+	if (ret != JAYLINK_OK) {
+		LOG_ERROR("jaylink_get_free_memory() failed: %s.",
+			jaylink_strerror(ret));
+		return false;
+	}
+
+	if (tmp < 143) {
+		LOG_ERROR("Not enough free device internal memory: %" PRIu32 " bytes.", tmp);
+		return false;
+	}
+
+	/* TMS and TDI go in, TDO comes back. */
+	tmp = MIN(JLINK_MAX_TAP_BUFFER_SIZE, (tmp - 16) / 2);
+	tmp = MAX(tmp, 64);
+
+	if (tmp != tap_buffer_size) {
+		tap_buffer_size = tmp;
+		LOG_DEBUG("Adjusted JTAG TAP buffer size to %u bytes.",
+			tap_buffer_size);
+	}
+
+	return true;
+}
+
 static int jaylink_log_handler(const struct jaylink_context *ctx,
 		enum jaylink_log_level level, const char *format, va_list args,
 		void *user_data)
@@ -759,6 +813,10 @@ static int jlink_init(void)
 			jaylink_exit(jayctx);
 			return ERROR_JTAG_INIT_FAILED;
 		}
+	} else if (!adjust_tap_buffer_size()) {
+		jaylink_close(devh);
+		jaylink_exit(jayctx);
+		return ERROR_JTAG_INIT_FAILED;
 	}
 
 	if (jaylink_has_cap(caps, JAYLINK_DEV_CAP_READ_CONFIG)) {
@@ -810,6 +868,7 @@ static int jlink_init(void)
 	jlink_reset(0, 0);
 	jtag_sleep(3000);
 	jlink_tap_init();
+	jtag_stats.since_ms = timeval_ms();
 
 	jlink_speed(jtag_get_speed_khz());
 
@@ -1061,6 +1120,35 @@ COMMAND_HANDLER(jlink_handle_free_memory_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jlink_handle_stats_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "clear"))
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		memset(&jtag_stats, 0, sizeof(jtag_stats));
+		jtag_stats.since_ms = timeval_ms();
+		return ERROR_OK;
+	}
+
+	int64_t wall_ms = timeval_ms() - jtag_stats.since_ms;
+
+	command_print(CMD, "TAP buffer size: %u bytes", tap_buffer_size);
+	command_print(CMD, "flushes:         %" PRIu64 " (%" PRIu64 " on a full buffer)",
+		jtag_stats.flushes, jtag_stats.full_flushes);
+	command_print(CMD, "bits clocked:    %" PRIu64 " (%.1f per flush)", jtag_stats.bits,
+		jtag_stats.flushes ? (double)jtag_stats.bits / jtag_stats.flushes : 0.0);
+	command_print(CMD, "flushes/s:       %.1f",
+		wall_ms > 0 ? 1000.0 * jtag_stats.flushes / wall_ms : 0.0);
+	command_print(CMD, "time in flushes: %" PRId64 " ms of %" PRId64 " ms (%.1f%%)",
+		jtag_stats.flush_ms, wall_ms,
+		wall_ms > 0 ? 100.0 * jtag_stats.flush_ms / wall_ms : 0.0);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(jlink_handle_jlink_jtag_command)
 {
 	int tmp;
@@ -1352,6 +1440,8 @@ static int config_trace(bool enabled, enum tpiu_pin_protocol pin_protocol,
 		 */
 		if (!adjust_swd_buffer_size())
 			return ERROR_FAIL;
+		if (iface == JAYLINK_TIF_JTAG && !adjust_tap_buffer_size())
+			return ERROR_FAIL;
 
 		return ERROR_OK;
 	}
@@ -1433,6 +1523,8 @@ static int config_trace(bool enabled, enum tpiu_pin_protocol pin_protocol,
 	 */
 	if (!adjust_swd_buffer_size())
 		return ERROR_FAIL;
+	if (iface == JAYLINK_TIF_JTAG && !adjust_tap_buffer_size())
+		return ERROR_FAIL;
 
 	return ERROR_OK;
 }
@@ -1921,6 +2013,13 @@ static const struct command_registration jlink_subcommand_handlers[] = {
 		.help = "show free device memory",
 		.usage = "",
 	},
+	{
+		.name = "stats",
+		.handler = &jlink_handle_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "show or clear JTAG flush statistics",
+		.usage = "[clear]",
+	},
 	{
 		.name = "hwstatus",
 		.handler = &jlink_handle_hwstatus_command,
@@ -1996,9 +2095,9 @@ static void jlink_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_c
 
 static unsigned tap_length;
 /* In SWD mode use tms buffer for direction control */
-static uint8_t tms_buffer[JLINK_TAP_BUFFER_SIZE];
-static uint8_t tdi_buffer[JLINK_TAP_BUFFER_SIZE];
-static uint8_t tdo_buffer[JLINK_TAP_BUFFER_SIZE];
+static uint8_t tms_buffer[JLINK_MAX_TAP_BUFFER_SIZE];
+static uint8_t tdi_buffer[JLINK_MAX_TAP_BUFFER_SIZE];
+static uint8_t tdo_buffer[JLINK_MAX_TAP_BUFFER_SIZE];
 
 struct pending_scan_result {
 	/** First bit position in tdo_buffer to read. */
@@ -2011,17 +2110,20 @@ struct pending_scan_result {
 	unsigned buffer_offset;
 };
 
-#define MAX_PENDING_SCAN_RESULTS 256
+/* Enough for a full TAP buffer of DMI sized scans. */
+#define MAX_PENDING_SCAN_RESULTS 2048
 
 static int pending_scan_results_length;
 static struct pending_scan_result pending_scan_results_buffer[MAX_PENDING_SCAN_RESULTS];
 
 static void jlink_tap_init(void)
 {
+	/* Nothing past tap_length has been written to. */
+	unsigned used = DIV_ROUND_UP(tap_length, 8);
 	tap_length = 0;
 	pending_scan_results_length = 0;
-	memset(tms_buffer, 0, sizeof(tms_buffer));
-	memset(tdi_buffer, 0, sizeof(tdi_buffer));
+	memset(tms_buffer, 0, used);
+	memset(tdi_buffer, 0, used);
 }
 
 static void jlink_clock_data(const uint8_t *out, unsigned out_offset,
@@ -2030,13 +2132,14 @@ static void jlink_clock_data(const uint8_t *out, unsigned out_offset,
 			     unsigned length)
 {
 	do {
-		unsigned available_length = JLINK_TAP_BUFFER_SIZE - tap_length / 8;
+		unsigned available_length = tap_buffer_size * 8 - tap_length;
 
 		if (!available_length ||
 		    (in && pending_scan_results_length == MAX_PENDING_SCAN_RESULTS)) {
+			jtag_stats.full_flushes++;
 			if (jlink_flush() != ERROR_OK)
 				return;
-			available_length = JLINK_TAP_BUFFER_SIZE;
+			available_length = tap_buffer_size * 8;
 		}
 
 		struct pending_scan_result *pending_scan_result =
@@ -2077,8 +2180,12 @@ static int jlink_flush(void)
 	jlink_last_state = jtag_debug_state_machine(tms_buffer, tdi_buffer,
 		tap_length, jlink_last_state);
 
+	int64_t start = timeval_ms();
 	ret = jaylink_jtag_io(devh, tms_buffer, tdi_buffer, tdo_buffer,
 		tap_length, jtag_command_version);
+	jtag_stats.flush_ms += timeval_ms() - start;
+	jtag_stats.flushes++;
+	jtag_stats.bits += tap_length;
 
 	if (ret != JAYLINK_OK) {
 		LOG_ERROR("jaylink_jtag_io() failed: %s.", jaylink_strerror(ret));
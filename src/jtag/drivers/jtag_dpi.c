@@ -27,6 +27,7 @@
 #endif
 
 #include <jtag/interface.h>
+#include "sim_shm.h"
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
@@ -44,6 +45,10 @@ static char *server_address;
 static int sockfd;
 static struct sockaddr_in serv_addr;
 
+/* When set, talk to the simulator through shared memory instead of TCP. */
+static char *shm_path;
+static struct sim_shm *shm;
+
 static uint8_t *last_ir_buf;
 static int last_ir_num_bits;
 
@@ -54,6 +59,8 @@ static int write_sock(char *buf, size_t len)
 			__func__, __FILE__, __LINE__);
 		return ERROR_FAIL;
 	}
+	if (shm)
+		return sim_shm_write(shm, buf, len);
 	if (write(sockfd, buf, len) != (ssize_t)len) {
 		LOG_ERROR("%s: %s, file %s, line %d", __func__,
 			strerror(errno), __FILE__, __LINE__);
@@ -69,6 +76,8 @@ static int read_sock(char *buf, size_t len)
 			__func__, __FILE__, __LINE__);
 		return ERROR_FAIL;
 	}
+	if (shm)
+		return sim_shm_read(shm, buf, len);
 	if (read(sockfd, buf, len) != (ssize_t)len) {
 		LOG_ERROR("%s: %s, file %s, line %d", __func__,
 			strerror(errno), __FILE__, __LINE__);
@@ -277,6 +286,11 @@ static int jtag_dpi_execute_queue(void)
 
 static int jtag_dpi_init(void)
 {
+	if (shm_path) {
+		shm = sim_shm_open(shm_path);
+		return shm ? ERROR_OK : ERROR_FAIL;
+	}
+
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd < 0) {
 		LOG_ERROR("socket: %s, function %s, file %s, line %d",
@@ -327,6 +341,14 @@ static int jtag_dpi_quit(void)
 {
 	free(server_address);
 	server_address = NULL;
+	free(shm_path);
+	shm_path = NULL;
+
+	if (shm) {
+		sim_shm_close(shm);
+		shm = NULL;
+		return ERROR_OK;
+	}
 
 	return close(sockfd);
 }
@@ -373,6 +395,29 @@ COMMAND_HANDLER(jtag_dpi_set_address)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_dpi_set_shm)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	else if (CMD_ARGC == 0) {
+		if (shm_path)
+			LOG_INFO("Using shared memory file %s", shm_path);
+		else
+			LOG_INFO("Using TCP");
+	} else {
+		free(shm_path);
+		shm_path = strdup(CMD_ARGV[0]);
+		if (shm_path == NULL) {
+			LOG_ERROR("%s: strdup fail, file %s, line %d",
+				__func__, __FILE__, __LINE__);
+			return ERROR_FAIL;
+		}
+		LOG_INFO("Set shared memory file to %s", shm_path);
+	}
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_dpi_command_handlers[] = {
 	{
 		.name = "jtag_dpi_set_port",
@@ -388,6 +433,14 @@ static const struct command_registration jtag_dpi_command_handlers[] = {
 		.help = "set the address of the DPI server",
 		.usage = "[address]",
 	},
+	{
+		.name = "jtag_dpi_set_shm",
+		.handler = &jtag_dpi_set_shm,
+		.mode = COMMAND_CONFIG,
+		.help = "talk to the DPI server through a shared memory file "
+			"instead of TCP",
+		.usage = "[path]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -34,6 +34,7 @@
 #endif
 
 #include "helper/replacements.h"
+#include "sim_shm.h"
 
 #define NO_TAP_SHIFT	0
 #define TAP_SHIFT	1
@@ -56,9 +57,36 @@ static char *server_address;
 /* Send CMD_STOP_SIMU to server when OpenOCD exits? */
 static bool stop_sim_on_exit;
 
+/* How many CMD_SCAN_CHAIN replies may be outstanding. The server answers
+ * scans in order, so there is no need to wait for each reply before sending
+ * the next command. 1 waits for every reply, like older OpenOCD builds did.
+ * Each vpi_cmd is about 1 KiB, which bounds how much can pile up in the
+ * socket buffers before the replies are read. */
+#define PIPELINE_DEPTH_MAX	64
+static unsigned int pipeline_depth = 1;
+
+/* A CMD_SCAN_CHAIN that was sent and whose reply hasn't been read yet. */
+struct jtag_vpi_pending {
+	/* Where the captured bits go, or NULL if they're not needed. */
+	uint8_t *bits;
+	int nb_bytes;
+	/* Set for the last transfer of a scan: the scan to complete once its
+	 * bits are in, and the buffer built for it. */
+	struct scan_command *scan;
+	uint8_t *buf;
+};
+
+static struct jtag_vpi_pending pending[PIPELINE_DEPTH_MAX];
+static unsigned int pending_start;
+static unsigned int pending_count;
+
 static int sockfd;
 static struct sockaddr_in serv_addr;
 
+/* When set, the packets go through shared memory instead of TCP. */
+static char *shm_path;
+static struct sim_shm *shm;
+
 /* One jtag_vpi "packet" as sent over a TCP channel. */
 struct vpi_cmd {
 	union {
@@ -136,6 +164,12 @@ static int jtag_vpi_send_cmd(struct vpi_cmd *vpi)
 	h_u32_to_le(vpi->length_buf, vpi->length);
 	h_u32_to_le(vpi->nb_bits_buf, vpi->nb_bits);
 
+	if (shm) {
+		if (sim_shm_write(shm, vpi, sizeof(struct vpi_cmd)) != ERROR_OK)
+			exit(-1);
+		return ERROR_OK;
+	}
+
 retry_write:
 	retval = write_socket(sockfd, vpi, sizeof(struct vpi_cmd));
 
@@ -170,6 +204,11 @@ retry_write:
 static int jtag_vpi_receive_cmd(struct vpi_cmd *vpi)
 {
 	unsigned bytes_buffered = 0;
+	if (shm) {
+		if (sim_shm_read(shm, vpi, sizeof(struct vpi_cmd)) != ERROR_OK)
+			exit(-1);
+		bytes_buffered = sizeof(struct vpi_cmd);
+	}
 	while (bytes_buffered < sizeof(struct vpi_cmd)) {
 		int bytes_to_receive = sizeof(struct vpi_cmd) - bytes_buffered;
 		int retval = read_socket(sockfd, ((char *)vpi) + bytes_buffered, bytes_to_receive);
@@ -300,6 +339,55 @@ static int jtag_vpi_state_move(tap_state_t state)
 	return ERROR_OK;
 }
 
+/**
+ * jtag_vpi_receive_pending - read the reply to the oldest scan in flight
+ *
+ * Copies the captured bits where they were asked for, and completes the scan
+ * once its last transfer is in.
+ */
+static int jtag_vpi_receive_pending(void)
+{
+	struct jtag_vpi_pending *p = &pending[pending_start];
+	struct vpi_cmd vpi;
+
+	pending_start = (pending_start + 1) % PIPELINE_DEPTH_MAX;
+	pending_count--;
+
+	int retval = jtag_vpi_receive_cmd(&vpi);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (p->bits)
+		memcpy(p->bits, vpi.buffer_in, p->nb_bytes);
+
+	if (p->scan) {
+		retval = jtag_read_buffer(p->buf, p->scan);
+		free(p->buf);
+		p->scan = NULL;
+		p->buf = NULL;
+	}
+
+	return retval;
+}
+
+/**
+ * jtag_vpi_flush - read all outstanding replies
+ *
+ * Returns the first error, after all replies have been read.
+ */
+static int jtag_vpi_flush(void)
+{
+	int retval = ERROR_OK;
+
+	while (pending_count) {
+		int r = jtag_vpi_receive_pending();
+		if (retval == ERROR_OK)
+			retval = r;
+	}
+
+	return retval;
+}
+
 static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift)
 {
 	struct vpi_cmd vpi;
@@ -321,6 +409,21 @@ static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift)
 	if (retval != ERROR_OK)
 		return retval;
 
+	if (pipeline_depth > 1) {
+		if (pending_count == pipeline_depth) {
+			retval = jtag_vpi_receive_pending();
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		struct jtag_vpi_pending *p =
+			&pending[(pending_start + pending_count++) % PIPELINE_DEPTH_MAX];
+		p->bits = bits;
+		p->nb_bytes = nb_bytes;
+		p->scan = NULL;
+		p->buf = NULL;
+		return ERROR_OK;
+	}
+
 	retval = jtag_vpi_receive_cmd(&vpi);
 	if (retval != ERROR_OK)
 		return retval;
@@ -436,11 +539,20 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 			tap_set_state(TAP_DRPAUSE);
 	}
 
-	retval = jtag_read_buffer(buf, cmd);
-	if (retval != ERROR_OK)
-		return retval;
+	if (pending_count) {
+		/* The reply to the last transfer of this scan is still to come,
+		 * finish the scan when it's in. */
+		struct jtag_vpi_pending *p =
+			&pending[(pending_start + pending_count - 1) % PIPELINE_DEPTH_MAX];
+		p->scan = cmd;
+		p->buf = buf;
+	} else {
+		retval = jtag_read_buffer(buf, cmd);
+		if (retval != ERROR_OK)
+			return retval;
 
-	free(buf);
+		free(buf);
+	}
 
 	if (cmd->end_state != TAP_DRSHIFT) {
 		retval = jtag_vpi_state_move(cmd->end_state);
@@ -519,6 +631,7 @@ static int jtag_vpi_execute_queue(void)
 			retval = jtag_vpi_tms(cmd->cmd.tms);
 			break;
 		case JTAG_SLEEP:
+			retval = jtag_vpi_flush();
 			jtag_sleep(cmd->cmd.sleep->us);
 			break;
 		case JTAG_SCAN:
@@ -532,6 +645,10 @@ static int jtag_vpi_execute_queue(void)
 		}
 	}
 
+	int flush_retval = jtag_vpi_flush();
+	if (retval == ERROR_OK)
+		retval = flush_retval;
+
 	return retval;
 }
 
@@ -539,6 +656,11 @@ static int jtag_vpi_init(void)
 {
 	int flag = 1;
 
+	if (shm_path) {
+		shm = sim_shm_open(shm_path);
+		return shm ? ERROR_OK : ERROR_FAIL;
+	}
+
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd < 0) {
 		LOG_ERROR("Could not create socket");
@@ -594,11 +716,16 @@ static int jtag_vpi_quit(void)
 		if (jtag_vpi_stop_simulation() != ERROR_OK)
 			LOG_WARNING("jtag_vpi: failed to send \"stop simulation\" command");
 	}
-	if (close_socket(sockfd) != 0) {
+	if (shm) {
+		sim_shm_close(shm);
+		shm = NULL;
+	} else if (close_socket(sockfd) != 0) {
 		LOG_WARNING("jtag_vpi: could not close jtag_vpi client socket");
 		log_socket_error("jtag_vpi");
 	}
 	free(server_address);
+	free(shm_path);
+	shm_path = NULL;
 	return ERROR_OK;
 }
 
@@ -629,6 +756,19 @@ COMMAND_HANDLER(jtag_vpi_set_address)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_vpi_set_shm)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	free(shm_path);
+	shm_path = strdup(CMD_ARGV[0]);
+
+	LOG_INFO("Set shared memory file to %s", shm_path);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(jtag_vpi_stop_sim_on_exit_handler)
 {
 	if (CMD_ARGC != 1) {
@@ -640,6 +780,26 @@ COMMAND_HANDLER(jtag_vpi_stop_sim_on_exit_handler)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_vpi_pipeline_depth_handler)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int depth;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], depth);
+		if (depth < 1 || depth > PIPELINE_DEPTH_MAX) {
+			LOG_ERROR("jtag_vpi_pipeline_depth must be between 1 and %d",
+				PIPELINE_DEPTH_MAX);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		pipeline_depth = depth;
+	}
+
+	command_print(CMD, "jtag_vpi keeps up to %u scans in flight", pipeline_depth);
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_vpi_command_handlers[] = {
 	{
 		.name = "jtag_vpi_set_port",
@@ -655,6 +815,14 @@ static const struct command_registration jtag_vpi_command_handlers[] = {
 		.help = "set the address of the VPI server",
 		.usage = "ipv4_addr",
 	},
+	{
+		.name = "jtag_vpi_set_shm",
+		.handler = &jtag_vpi_set_shm,
+		.mode = COMMAND_CONFIG,
+		.help = "talk to the VPI server through a shared memory file "
+			"instead of TCP",
+		.usage = "path",
+	},
 	{
 		.name = "jtag_vpi_stop_sim_on_exit",
 		.handler = &jtag_vpi_stop_sim_on_exit_handler,
@@ -663,6 +831,14 @@ static const struct command_registration jtag_vpi_command_handlers[] = {
 			"before OpenOCD exits (default: off)",
 		.usage = "<on|off>",
 	},
+	{
+		.name = "jtag_vpi_pipeline_depth",
+		.handler = &jtag_vpi_pipeline_depth_handler,
+		.mode = COMMAND_CONFIG,
+		.help = "set how many scans may be sent before waiting for their "
+			"replies (default: 1)",
+		.usage = "[count]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -666,12 +666,11 @@ static int kitprog_swd_switch_seq(enum swd_special_seq seq)
 
 static int kitprog_swd_run_queue(void)
 {
-	int ret;
-
 	size_t read_count = 0;
 	size_t read_index = 0;
 	size_t write_count = 0;
 	uint8_t *buffer = kitprog_handle->packet_buffer;
+	uint8_t response[SWD_MAX_BUFFER_LENGTH];
 
 	do {
 		LOG_DEBUG_IO("Executing %d queued transactions", pending_transfer_count);
@@ -724,16 +723,6 @@ static int kitprog_swd_run_queue(void)
 			}
 		}
 
-		if (jtag_libusb_bulk_write(kitprog_handle->usb_handle,
-					   BULK_EP_OUT, (char *)buffer,
-					   write_count, 0, &ret)) {
-			LOG_ERROR("Bulk write failed");
-			queued_retval = ERROR_FAIL;
-			break;
-		} else {
-			queued_retval = ERROR_OK;
-		}
-
 		/* KitProg firmware does not send a zero length packet
 		 * after the bulk-in transmission of a length divisible by bulk packet
 		 * size (64 bytes) as required by the USB specification.
@@ -747,22 +736,28 @@ static int kitprog_swd_run_queue(void)
 		if (read_count % 64 == 0)
 			read_count_workaround = read_count;
 
-		if (jtag_libusb_bulk_read(kitprog_handle->usb_handle,
-				BULK_EP_IN | LIBUSB_ENDPOINT_IN, (char *)buffer,
-				read_count_workaround, 1000, &ret)) {
-			LOG_ERROR("Bulk read failed");
+		/* The read goes out with the write, so the response is taken
+		 * as soon as the KitProg has it */
+		struct jtag_libusb_xfer transfers[2] = {
+			{ .ep = BULK_EP_OUT, .buf = buffer, .size = write_count },
+			{ .ep = BULK_EP_IN | LIBUSB_ENDPOINT_IN, .buf = response,
+				.size = read_count_workaround },
+		};
+		if (jtag_libusb_bulk_transfer_n(kitprog_handle->usb_handle,
+				transfers, 2, 1000) != ERROR_OK) {
+			LOG_ERROR("Bulk %s failed", transfers[0].retval ? "write" : "read");
 			queued_retval = ERROR_FAIL;
 			break;
 		} else {
 			/* Handle garbage data by offsetting the initial read index */
-			if ((unsigned int)ret > read_count)
-				read_index = ret - read_count;
+			if (transfers[1].transfer_size > read_count)
+				read_index = transfers[1].transfer_size - read_count;
 			queued_retval = ERROR_OK;
 		}
 
 		for (int i = 0; i < pending_transfer_count; i++) {
 			if (pending_transfers[i].cmd & SWD_CMD_RnW) {
-				uint32_t data = le_to_h_u32(&buffer[read_index]);
+				uint32_t data = le_to_h_u32(&response[read_index]);
 
 				LOG_DEBUG_IO("Read result: %"PRIx32, data);
 
@@ -772,8 +767,8 @@ static int kitprog_swd_run_queue(void)
 				read_index += 4;
 			}
 
-			uint8_t ack = buffer[read_index] & 0x07;
-			if (ack != SWD_ACK_OK || (buffer[read_index] & 0x08)) {
+			uint8_t ack = response[read_index] & 0x07;
+			if (ack != SWD_ACK_OK || (response[read_index] & 0x08)) {
 				LOG_DEBUG("SWD ack not OK: %d %s", i,
 					  ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK");
 				queued_retval = ack == SWD_ACK_WAIT ? ERROR_WAIT : ERROR_FAIL;
@@ -271,6 +271,103 @@ int jtag_libusb_bulk_read(struct libusb_device_handle *dev, int ep, char *bytes,
 	return ERROR_OK;
 }
 
+static LIBUSB_CALL void jtag_libusb_transfer_cb(struct libusb_transfer *transfer)
+{
+	int *completed = transfer->user_data;
+	*completed = 1;
+	/* caller interprets result and frees transfer */
+}
+
+static int jtag_libusb_transfer_status(const struct libusb_transfer *transfer)
+{
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return 0;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_STALL:
+		return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return LIBUSB_ERROR_OVERFLOW;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_ERROR:
+	case LIBUSB_TRANSFER_CANCELLED:
+		return LIBUSB_ERROR_IO;
+	default:
+		return LIBUSB_ERROR_OTHER;
+	}
+}
+
+int jtag_libusb_bulk_transfer_n(struct libusb_device_handle *dev,
+		struct jtag_libusb_xfer *transfers, size_t n_transfers, int timeout)
+{
+	int retval = ERROR_OK;
+	size_t submitted;
+
+	for (size_t i = 0; i < n_transfers; i++) {
+		transfers[i].retval = 0;
+		transfers[i].completed = 0;
+		transfers[i].transfer_size = 0;
+		transfers[i].transfer = libusb_alloc_transfer(0);
+		if (!transfers[i].transfer) {
+			for (size_t j = 0; j < i; j++)
+				libusb_free_transfer(transfers[j].transfer);
+			for (size_t j = 0; j < n_transfers; j++)
+				transfers[j].retval = LIBUSB_ERROR_NO_MEM;
+			LOG_ERROR("failed to allocate USB transfers");
+			return ERROR_FAIL;
+		}
+	}
+
+	for (submitted = 0; submitted < n_transfers; submitted++) {
+		struct jtag_libusb_xfer *x = &transfers[submitted];
+
+		libusb_fill_bulk_transfer(x->transfer, dev, x->ep, x->buf, x->size,
+				jtag_libusb_transfer_cb, &x->completed, timeout);
+		int ret = libusb_submit_transfer(x->transfer);
+		if (ret < 0) {
+			LOG_DEBUG("failed to submit transfer %zu: %s", submitted, libusb_error_name(ret));
+			/* the rest would only wait on what this one should have done */
+			for (size_t j = submitted; j < n_transfers; j++)
+				transfers[j].retval = ret;
+			retval = ERROR_FAIL;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < submitted; i++) {
+		struct jtag_libusb_xfer *x = &transfers[i];
+
+		while (!x->completed) {
+			int ret = libusb_handle_events_completed(jtag_libusb_context, &x->completed);
+			if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED)
+				libusb_cancel_transfer(x->transfer);
+		}
+
+		int ret = jtag_libusb_transfer_status(x->transfer);
+		if (ret) {
+			x->retval = ret;
+			if (retval == ERROR_OK) {
+				LOG_DEBUG("transfer %zu failed: %s", i, libusb_error_name(ret));
+				/* later transfers depend on this one, don't wait for their timeouts */
+				for (size_t j = i + 1; j < submitted; j++)
+					libusb_cancel_transfer(transfers[j].transfer);
+			}
+			retval = ERROR_FAIL;
+		} else {
+			x->transfer_size = x->transfer->actual_length;
+		}
+	}
+
+	for (size_t i = 0; i < n_transfers; i++) {
+		libusb_free_transfer(transfers[i].transfer);
+		transfers[i].transfer = NULL;
+	}
+
+	return retval;
+}
+
 int jtag_libusb_set_configuration(struct libusb_device_handle *devh,
 		int configuration)
 {
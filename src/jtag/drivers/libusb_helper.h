@@ -39,6 +39,30 @@ int jtag_libusb_bulk_write(struct libusb_device_handle *dev, int ep,
 		char *bytes, int size, int timeout, int *transferred);
 int jtag_libusb_bulk_read(struct libusb_device_handle *dev, int ep,
 		char *bytes, int size, int timeout, int *transferred);
+
+/** One bulk transfer of a jtag_libusb_bulk_transfer_n() batch. */
+struct jtag_libusb_xfer {
+	int ep;
+	uint8_t *buf;
+	size_t size;
+	/* Set by jtag_libusb_bulk_transfer_n() */
+	int retval;			/**< libusb error of this transfer, 0 if fine */
+	size_t transfer_size;		/**< bytes actually transferred */
+	/* Internal */
+	int completed;
+	struct libusb_transfer *transfer;
+};
+
+/**
+ * Submit @a n_transfers bulk transfers at once and wait for all of them,
+ * so the adapter sees e.g. a command, its data and the read of its
+ * response back to back instead of one host round trip each. After the
+ * first failure the transfers still in flight are cancelled.
+ * @returns ERROR_OK if all completed, ERROR_FAIL otherwise; the failing
+ * transfers have a non-zero @c retval.
+ */
+int jtag_libusb_bulk_transfer_n(struct libusb_device_handle *dev,
+		struct jtag_libusb_xfer *transfers, size_t n_transfers, int timeout);
 int jtag_libusb_set_configuration(struct libusb_device_handle *devh,
 		int configuration);
 /**
@@ -40,6 +40,8 @@ static struct gpiod_line *gpiod_swclk;
 static struct gpiod_line *gpiod_swdio;
 static struct gpiod_line *gpiod_srst;
 static struct gpiod_line *gpiod_led;
+/* TDI, TMS and TCK, requested together so they can be set in one go. */
+static struct gpiod_line_bulk gpiod_jtag_outputs;
 
 static int last_swclk;
 static int last_swdio;
@@ -64,7 +66,9 @@ static bb_value_t linuxgpiod_read(void)
  * Bitbang interface write of TCK, TMS, TDI
  *
  * Seeing as this is the only function where the outputs are changed,
- * we can cache the old value to avoid needlessly writing it.
+ * we can cache the old value to avoid needlessly writing it. All three
+ * lines are updated with a single ioctl. bitbang only changes TMS and TDI
+ * together with a falling TCK, so they don't need to be written first.
  */
 static int linuxgpiod_write(int tck, int tms, int tdi)
 {
@@ -83,23 +87,11 @@ static int linuxgpiod_write(int tck, int tms, int tdi)
 		first_time = 1;
 	}
 
-	if (tdi != last_tdi) {
-		retval = gpiod_line_set_value(gpiod_tdi, tdi);
+	if (tdi != last_tdi || tms != last_tms || tck != last_tck) {
+		const int values[] = { tdi, tms, tck };
+		retval = gpiod_line_set_value_bulk(&gpiod_jtag_outputs, values);
 		if (retval < 0)
-			LOG_WARNING("writing tdi failed");
-	}
-
-	if (tms != last_tms) {
-		retval = gpiod_line_set_value(gpiod_tms, tms);
-		if (retval < 0)
-			LOG_WARNING("writing tms failed");
-	}
-
-	/* write clk last */
-	if (tck != last_tck) {
-		retval = gpiod_line_set_value(gpiod_tck, tck);
-		if (retval < 0)
-			LOG_WARNING("writing tck failed");
+			LOG_WARNING("writing tdi, tms and tck failed");
 	}
 
 	last_tdi = tdi;
@@ -109,6 +101,35 @@ static int linuxgpiod_write(int tck, int tms, int tdi)
 	return ERROR_OK;
 }
 
+static int linuxgpiod_scan_block(const uint8_t *tms, const uint8_t *tdi,
+		uint8_t *tdo, unsigned int bits)
+{
+	for (unsigned int i = 0; i < bits; i++) {
+		unsigned int byte = i / 8;
+		uint8_t bit = 1 << (i % 8);
+		int tms_bit = !!(tms[byte] & bit);
+		int tdi_bit = tdi ? !!(tdi[byte] & bit) : 0;
+
+		linuxgpiod_write(0, tms_bit, tdi_bit);
+
+		if (tdo) {
+			int value = gpiod_line_get_value(gpiod_tdo);
+			if (value < 0) {
+				LOG_ERROR("reading tdo failed");
+				return ERROR_FAIL;
+			}
+			if (value)
+				tdo[byte] |= bit;
+			else
+				tdo[byte] &= ~bit;
+		}
+
+		linuxgpiod_write(1, tms_bit, tdi_bit);
+	}
+
+	return ERROR_OK;
+}
+
 static int linuxgpiod_swdio_read(void)
 {
 	int retval;
@@ -126,10 +147,18 @@ static void linuxgpiod_swdio_drive(bool is_output)
 {
 	int retval;
 
+#ifdef HAVE_GPIOD_LINE_SET_DIRECTION_OUTPUT
+	if (is_output)
+		retval = gpiod_line_set_direction_output(gpiod_swdio, 1);
+	else
+		retval = gpiod_line_set_direction_input(gpiod_swdio);
+	if (retval < 0)
+		LOG_WARNING("Fail set direction of line swdio");
+#else
 	/*
 	 * FIXME: change direction requires release and re-require the line
 	 * https://stackoverflow.com/questions/58735140/
-	 * this would change in future libgpiod
+	 * libgpiod >= 1.5 has gpiod_line_set_direction_*() for this
 	 */
 	gpiod_line_release(gpiod_swdio);
 
@@ -142,6 +171,7 @@ static void linuxgpiod_swdio_drive(bool is_output)
 		if (retval < 0)
 			LOG_WARNING("Fail request_input line swdio");
 	}
+#endif
 
 	last_stored = false;
 	swdio_input = !is_output;
@@ -189,6 +219,7 @@ static int linuxgpiod_blink(int on)
 static struct bitbang_interface linuxgpiod_bitbang = {
 	.read = linuxgpiod_read,
 	.write = linuxgpiod_write,
+	.scan_block = linuxgpiod_scan_block,
 	.swdio_read = linuxgpiod_swdio_read,
 	.swdio_drive = linuxgpiod_swdio_drive,
 	.swd_write = linuxgpiod_swd_write,
@@ -318,6 +349,35 @@ static struct gpiod_line *helper_get_output_line(const char *label, unsigned int
 	return line;
 }
 
+static int helper_get_jtag_output_lines(void)
+{
+	/* In the order of gpiod_jtag_outputs: TDI low, TMS high, TCK low. */
+	const int values[] = { 0, 1, 0 };
+	struct gpiod_line *tdi, *tms, *tck;
+
+	tdi = gpiod_chip_get_line(gpiod_chip, tdi_gpio);
+	tms = gpiod_chip_get_line(gpiod_chip, tms_gpio);
+	tck = gpiod_chip_get_line(gpiod_chip, tck_gpio);
+	if (tdi == NULL || tms == NULL || tck == NULL) {
+		LOG_ERROR("Error get lines tdi, tms and tck");
+		return ERROR_FAIL;
+	}
+
+	gpiod_line_bulk_init(&gpiod_jtag_outputs);
+	gpiod_line_bulk_add(&gpiod_jtag_outputs, tdi);
+	gpiod_line_bulk_add(&gpiod_jtag_outputs, tms);
+	gpiod_line_bulk_add(&gpiod_jtag_outputs, tck);
+	if (gpiod_line_request_bulk_output(&gpiod_jtag_outputs, "OpenOCD", values) < 0) {
+		LOG_ERROR("Error request_output lines tdi, tms and tck");
+		return ERROR_FAIL;
+	}
+
+	gpiod_tdi = tdi;
+	gpiod_tms = tms;
+	gpiod_tck = tck;
+	return ERROR_OK;
+}
+
 static int linuxgpiod_init(void)
 {
 	LOG_INFO("Linux GPIOD JTAG/SWD bitbang driver");
@@ -346,16 +406,7 @@ static int linuxgpiod_init(void)
 		if (gpiod_tdo == NULL)
 			goto out_error;
 
-		gpiod_tdi = helper_get_output_line("tdi", tdi_gpio, 0);
-		if (gpiod_tdi == NULL)
-			goto out_error;
-
-		gpiod_tck = helper_get_output_line("tck", tck_gpio, 0);
-		if (gpiod_tck == NULL)
-			goto out_error;
-
-		gpiod_tms = helper_get_output_line("tms", tms_gpio, 1);
-		if (gpiod_tms == NULL)
+		if (helper_get_jtag_output_lines() != ERROR_OK)
 			goto out_error;
 
 		if (is_gpio_valid(trst_gpio)) {
@@ -81,8 +81,13 @@ struct mpsse_ctx {
 	unsigned read_count;
 	uint8_t *read_chunk;
 	unsigned read_chunk_size;
+	/* USB transfers each way that may be in flight at once, and the room
+	 * each of them gets in the buffers. */
+	unsigned transfers;
+	unsigned transfer_size;
 	struct bit_copy_queue read_queue;
 	int retval;
+	struct mpsse_stats stats;
 };
 
 /* Returns true if the string descriptor indexed by str_index in device matches string */
@@ -318,6 +323,60 @@ error:
 	return false;
 }
 
+/* How much to buffer per USB transfer. High-speed chips drain a buffer much
+ * faster than the host can turn a flush around, so give them more; how much
+ * more follows the size of their receive FIFO. Full speed links (64 byte
+ * packets) keep the old size. */
+static unsigned chip_transfer_size(const struct mpsse_ctx *ctx)
+{
+	if (ctx->max_packet_size < 512)
+		return MPSSE_TRANSFER_SIZE;
+	switch (ctx->type) {
+		case TYPE_FT2232H:
+			/* 4 KiB FIFO per channel */
+			return 4 * MPSSE_TRANSFER_SIZE;
+		case TYPE_FT4232H:
+			/* 2 KiB per channel */
+			return 2 * MPSSE_TRANSFER_SIZE;
+		case TYPE_FT232H:
+			/* 1 KiB, but the channel has the chip to itself */
+			return 2 * MPSSE_TRANSFER_SIZE;
+		default:
+			return MPSSE_TRANSFER_SIZE;
+	}
+}
+
+/* Make room for ctx->transfers transfers of transfer_size bytes. The buffers
+ * must be empty. */
+static int resize_buffers(struct mpsse_ctx *ctx, unsigned transfer_size)
+{
+	unsigned size = ctx->transfers * transfer_size;
+	uint8_t *read_chunk = realloc(ctx->read_chunk, size);
+	if (read_chunk)
+		ctx->read_chunk = read_chunk;
+	uint8_t *read_buffer = realloc(ctx->read_buffer, size);
+	if (read_buffer)
+		ctx->read_buffer = read_buffer;
+	uint8_t *write_buffer = realloc(ctx->write_buffer, size);
+	if (write_buffer) {
+		if (size > ctx->write_size)
+			memset(write_buffer + ctx->write_size, 0, size - ctx->write_size);
+		ctx->write_buffer = write_buffer;
+	}
+	if (!read_chunk || !read_buffer || !write_buffer) {
+		LOG_ERROR("Out of memory.");
+		return ERROR_FAIL;
+	}
+
+	/* The read chunk is shared, one piece per transfer. */
+	ctx->transfer_size = transfer_size;
+	ctx->read_chunk_size = transfer_size;
+	ctx->read_size = size;
+	ctx->write_size = size;
+	LOG_DEBUG("using %u transfers of %u bytes", ctx->transfers, transfer_size);
+	return ERROR_OK;
+}
+
 struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const char *description,
 	const char *serial, const char *location, int channel)
 {
@@ -328,9 +387,11 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 		return 0;
 
 	bit_copy_queue_init(&ctx->read_queue);
-	ctx->read_chunk_size = 16384;
-	ctx->read_size = 16384;
-	ctx->write_size = 16384;
+	ctx->read_chunk_size = MPSSE_TRANSFER_SIZE;
+	ctx->read_size = MPSSE_TRANSFER_SIZE;
+	ctx->write_size = MPSSE_TRANSFER_SIZE;
+	ctx->transfers = 1;
+	ctx->transfer_size = MPSSE_TRANSFER_SIZE;
 	ctx->read_chunk = malloc(ctx->read_chunk_size);
 	ctx->read_buffer = malloc(ctx->read_size);
 
@@ -390,7 +451,11 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 		goto error;
 	}
 
+	if (resize_buffers(ctx, chip_transfer_size(ctx)) != ERROR_OK)
+		goto error;
+
 	mpsse_purge(ctx);
+	mpsse_clear_stats(ctx);
 
 	return ctx;
 error:
@@ -440,6 +505,13 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 	}
 }
 
+/* Flush because the next command doesn't fit in the buffers. */
+static void flush_for_space(struct mpsse_ctx *ctx)
+{
+	ctx->stats.full_flushes++;
+	ctx->retval = mpsse_flush(ctx);
+}
+
 static unsigned buffer_write_space(struct mpsse_ctx *ctx)
 {
 	/* Reserve one byte for SEND_IMMEDIATE */
@@ -512,7 +584,7 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) + (length < 8) < (out || (!out && !in) ? 4 : 3)
 				|| (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			flush_for_space(ctx);
 
 		if (length < 8) {
 			/* Transfer remaining bits in bit mode */
@@ -586,7 +658,7 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			flush_for_space(ctx);
 
 		/* Byte transfer */
 		unsigned this_bits = length;
@@ -629,7 +701,7 @@ void mpsse_set_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t d
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		flush_for_space(ctx);
 
 	buffer_write_byte(ctx, 0x80);
 	buffer_write_byte(ctx, data);
@@ -646,7 +718,7 @@ void mpsse_set_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		flush_for_space(ctx);
 
 	buffer_write_byte(ctx, 0x82);
 	buffer_write_byte(ctx, data);
@@ -663,7 +735,7 @@ void mpsse_read_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		flush_for_space(ctx);
 
 	buffer_write_byte(ctx, 0x81);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -679,7 +751,7 @@ void mpsse_read_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		flush_for_space(ctx);
 
 	buffer_write_byte(ctx, 0x83);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -694,7 +766,7 @@ static void single_byte_boolean_helper(struct mpsse_ctx *ctx, bool var, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		flush_for_space(ctx);
 
 	buffer_write_byte(ctx, var ? val_if_true : val_if_false);
 }
@@ -715,7 +787,7 @@ void mpsse_set_divisor(struct mpsse_ctx *ctx, uint16_t divisor)
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		flush_for_space(ctx);
 
 	buffer_write_byte(ctx, 0x86);
 	buffer_write_byte(ctx, divisor & 0xff);
@@ -780,19 +852,37 @@ struct transfer_result {
 	struct mpsse_ctx *ctx;
 	bool done;
 	unsigned transferred;
+	/* Transfers submitted and not completed yet. */
+	unsigned pending;
+	/* Set when a transfer failed, so that the others can be cancelled. */
+	bool failed;
+	struct libusb_transfer *transfers[MPSSE_MAX_TRANSFERS];
+	unsigned count;
 };
 
+static void cancel_transfers(struct transfer_result *res)
+{
+	for (unsigned i = 0; i < res->count; i++)
+		libusb_cancel_transfer(res->transfers[i]);
+}
+
 static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
 	struct mpsse_ctx *ctx = res->ctx;
 
+	res->pending--;
+	if (res->done || transfer->status == LIBUSB_TRANSFER_CANCELLED)
+		return;
+
 	unsigned packet_size = ctx->max_packet_size;
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
 	/* Strip the two status bytes sent at the beginning of each USB packet
-	 * while copying the chunk buffer to the read buffer */
+	 * while copying the chunk buffer to the read buffer. Transfers on one
+	 * endpoint complete in the order they were submitted, so with several
+	 * in flight the data still arrives in order. */
 	unsigned num_packets = DIV_ROUND_UP(transfer->actual_length, packet_size);
 	unsigned chunk_remains = transfer->actual_length;
 	for (unsigned i = 0; i < num_packets && chunk_remains > 2; i++) {
@@ -802,7 +892,7 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 		if (this_size > ctx->read_count - res->transferred)
 			this_size = ctx->read_count - res->transferred;
 		memcpy(ctx->read_buffer + res->transferred,
-			ctx->read_chunk + packet_size * i + 2,
+			transfer->buffer + packet_size * i + 2,
 			this_size);
 		res->transferred += this_size;
 		chunk_remains -= this_size + 2;
@@ -815,9 +905,15 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 	LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length, res->transferred,
 		ctx->read_count);
 
-	if (!res->done)
-		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
-			res->done = true;
+	if (res->done) {
+		/* Whatever else is in flight would only get status bytes. */
+		cancel_transfers(res);
+	} else if (libusb_submit_transfer(transfer) == LIBUSB_SUCCESS) {
+		res->pending++;
+	} else {
+		res->done = true;
+		cancel_transfers(res);
+	}
 }
 
 static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
@@ -825,22 +921,58 @@ static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
 	struct transfer_result *res = transfer->user_data;
 	struct mpsse_ctx *ctx = res->ctx;
 
+	res->pending--;
 	res->transferred += transfer->actual_length;
 
 	LOG_DEBUG_IO("transferred %d of %d", res->transferred, ctx->write_count);
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
-	if (res->transferred == ctx->write_count)
+	if (res->transferred == ctx->write_count) {
 		res->done = true;
-	else {
-		transfer->length = ctx->write_count - res->transferred;
-		transfer->buffer = ctx->write_buffer + res->transferred;
-		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
+	} else if (transfer->actual_length == transfer->length) {
+		/* Another transfer has the rest. */
+	} else if (res->count > 1 || transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+		/* The transfers after this one may already have gone out, so the
+		 * rest of this one can't be sent any more. */
+		res->failed = true;
+		res->done = true;
+		cancel_transfers(res);
+	} else {
+		transfer->length -= transfer->actual_length;
+		transfer->buffer += transfer->actual_length;
+		if (libusb_submit_transfer(transfer) == LIBUSB_SUCCESS)
+			res->pending++;
+		else
 			res->done = true;
 	}
 }
 
+/* Allocate and submit count transfers for res, each chunk bytes into
+ * buffer. */
+static int submit_transfers(struct transfer_result *res, unsigned count,
+		uint8_t *buffer, unsigned length, unsigned chunk, unsigned char endpoint,
+		libusb_transfer_cb_fn callback, unsigned timeout, bool in)
+{
+	struct mpsse_ctx *ctx = res->ctx;
+	for (unsigned i = 0; i < count; i++) {
+		struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+		if (!transfer)
+			return LIBUSB_ERROR_NO_MEM;
+		res->transfers[res->count++] = transfer;
+		/* Reads each get a whole chunk to fill, writes the next piece of
+		 * what there is to send. */
+		unsigned size = in ? chunk : MIN(chunk, length - i * chunk);
+		libusb_fill_bulk_transfer(transfer, ctx->usb_dev, endpoint,
+				buffer + i * chunk, size, callback, res, timeout);
+		int retval = libusb_submit_transfer(transfer);
+		if (retval != LIBUSB_SUCCESS)
+			return retval;
+		res->pending++;
+	}
+	return LIBUSB_SUCCESS;
+}
+
 int mpsse_flush(struct mpsse_ctx *ctx)
 {
 	int retval = ctx->retval;
@@ -859,7 +991,6 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 	if (ctx->write_count == 0)
 		return retval;
 
-	struct libusb_transfer *read_transfer = 0;
 	struct transfer_result read_result = { .ctx = ctx, .done = true };
 	if (ctx->read_count) {
 		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
@@ -868,48 +999,64 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 		   immediately after processing the MPSSE commands in the write transaction */
 	}
 
+	/* Split the write into up to ctx->transfers pieces, of whole packets,
+	 * and have as many reads in flight as could be needed, so the chip is
+	 * never left waiting for the host to submit the next transfer. */
+	unsigned packet_size = ctx->max_packet_size;
+	unsigned write_chunk = ctx->write_count;
+	unsigned write_transfers = 1;
+	if (ctx->transfers > 1 && ctx->write_count > packet_size) {
+		write_chunk = DIV_ROUND_UP(DIV_ROUND_UP(ctx->write_count, ctx->transfers),
+				packet_size) * packet_size;
+		write_transfers = DIV_ROUND_UP(ctx->write_count, write_chunk);
+	}
+	unsigned read_payload = ctx->read_chunk_size / packet_size * (packet_size - 2);
+	unsigned read_transfers = MIN(ctx->transfers,
+			MAX(1, DIV_ROUND_UP(ctx->read_count, read_payload)));
+
 	struct transfer_result write_result = { .ctx = ctx, .done = false };
-	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
-	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
-		ctx->write_count, write_cb, &write_result, ctx->usb_write_timeout);
-	retval = libusb_submit_transfer(write_transfer);
-	if (retval != LIBUSB_SUCCESS)
-		goto error_check;
+	retval = submit_transfers(&write_result, write_transfers, ctx->write_buffer,
+			ctx->write_count, write_chunk, ctx->out_ep, write_cb,
+			ctx->usb_write_timeout, false);
 
-	if (ctx->read_count) {
-		read_transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
-			ctx->read_chunk_size, read_cb, &read_result,
-			ctx->usb_read_timeout);
-		retval = libusb_submit_transfer(read_transfer);
-		if (retval != LIBUSB_SUCCESS)
-			goto error_check;
+	if (retval == LIBUSB_SUCCESS && ctx->read_count)
+		retval = submit_transfers(&read_result, read_transfers, ctx->read_chunk,
+				0, ctx->read_chunk_size, ctx->in_ep, read_cb,
+				ctx->usb_read_timeout, true);
+
+	if (retval != LIBUSB_SUCCESS) {
+		cancel_transfers(&write_result);
+		cancel_transfers(&read_result);
 	}
 
 	/* Polling loop, more or less taken from libftdi */
 	int64_t start = timeval_ms();
 	int64_t warn_after = 2000;
-	while (!write_result.done || !read_result.done) {
+	while (write_result.pending || read_result.pending ||
+			(retval == LIBUSB_SUCCESS && (!write_result.done || !read_result.done))) {
 		struct timeval timeout_usb;
 
 		timeout_usb.tv_sec = 1;
 		timeout_usb.tv_usec = 0;
 
-		retval = libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL);
+		int err = libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL);
 		keep_alive();
-		if (retval == LIBUSB_ERROR_NO_DEVICE || retval == LIBUSB_ERROR_INTERRUPTED)
+		if (err == LIBUSB_ERROR_NO_DEVICE || err == LIBUSB_ERROR_INTERRUPTED) {
+			if (retval == LIBUSB_SUCCESS)
+				retval = err;
 			break;
+		}
 
-		if (retval != LIBUSB_SUCCESS) {
-			libusb_cancel_transfer(write_transfer);
-			if (read_transfer)
-				libusb_cancel_transfer(read_transfer);
-			while (!write_result.done || !read_result.done) {
-				retval = libusb_handle_events_timeout_completed(ctx->usb_ctx,
-								&timeout_usb, NULL);
-				if (retval != LIBUSB_SUCCESS)
+		if (err != LIBUSB_SUCCESS) {
+			cancel_transfers(&write_result);
+			cancel_transfers(&read_result);
+			while (write_result.pending || read_result.pending) {
+				if (libusb_handle_events_timeout_completed(ctx->usb_ctx,
+							&timeout_usb, NULL) != LIBUSB_SUCCESS)
 					break;
 			}
+			retval = err;
+			break;
 		}
 
 		int64_t now = timeval_ms();
@@ -920,11 +1067,10 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 		}
 	}
 
-error_check:
 	if (retval != LIBUSB_SUCCESS) {
 		LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
 		retval = ERROR_FAIL;
-	} else if (write_result.transferred < ctx->write_count) {
+	} else if (write_result.failed || write_result.transferred < ctx->write_count) {
 		LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
 			write_result.transferred,
 			ctx->write_count);
@@ -935,22 +1081,63 @@ error_check:
 			ctx->read_count);
 		retval = ERROR_FAIL;
 	} else if (ctx->read_count) {
+		ctx->stats.bytes_written += ctx->write_count;
+		ctx->stats.bytes_read += ctx->read_count;
 		ctx->write_count = 0;
 		ctx->read_count = 0;
 		bit_copy_execute(&ctx->read_queue);
 		retval = ERROR_OK;
 	} else {
+		ctx->stats.bytes_written += ctx->write_count;
 		ctx->write_count = 0;
 		bit_copy_discard(&ctx->read_queue);
 		retval = ERROR_OK;
 	}
-
-	libusb_free_transfer(write_transfer);
-	if (read_transfer)
-		libusb_free_transfer(read_transfer);
+	ctx->stats.flushes++;
+	if (retval != ERROR_OK)
+		ctx->stats.failed_flushes++;
+	ctx->stats.flush_ms += timeval_ms() - start;
+
+	/* Transfers that are still pending after an error belong to libusb,
+	 * and it would use them after they were freed, so leak them instead. */
+	if (!write_result.pending)
+		for (unsigned i = 0; i < write_result.count; i++)
+			libusb_free_transfer(write_result.transfers[i]);
+	if (!read_result.pending)
+		for (unsigned i = 0; i < read_result.count; i++)
+			libusb_free_transfer(read_result.transfers[i]);
 
 	if (retval != ERROR_OK)
 		mpsse_purge(ctx);
 
 	return retval;
 }
+
+int mpsse_set_transfers(struct mpsse_ctx *ctx, unsigned transfers)
+{
+	if (transfers < 1 || transfers > MPSSE_MAX_TRANSFERS)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	if (ctx->write_count || ctx->read_count)
+		mpsse_flush(ctx);
+
+	/* Each transfer gets the room a single one has, so a flush also
+	 * carries that much more. */
+	unsigned old_transfers = ctx->transfers;
+	ctx->transfers = transfers;
+	int retval = resize_buffers(ctx, ctx->transfer_size);
+	if (retval != ERROR_OK)
+		ctx->transfers = old_transfers;
+	return retval;
+}
+
+void mpsse_get_stats(const struct mpsse_ctx *ctx, struct mpsse_stats *stats)
+{
+	*stats = ctx->stats;
+	stats->buffer_size = ctx->write_size;
+}
+
+void mpsse_clear_stats(struct mpsse_ctx *ctx)
+{
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	ctx->stats.since_ms = timeval_ms();
+}
@@ -75,4 +75,31 @@ int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency);
 int mpsse_flush(struct mpsse_ctx *ctx);
 void mpsse_purge(struct mpsse_ctx *ctx);
 
+/* Smallest size of each USB transfer, and of the buffers for one of them.
+ * High speed chips get a multiple of it, see mpsse_open(). */
+#define MPSSE_TRANSFER_SIZE	16384
+#define MPSSE_MAX_TRANSFERS	8
+
+/* Have up to transfers USB transfers in flight each way during a flush, and
+ * make the buffers that much bigger. 1 is the default. */
+int mpsse_set_transfers(struct mpsse_ctx *ctx, unsigned transfers);
+
+struct mpsse_stats {
+	/* All flushes, and those that happened because the buffers were full
+	 * rather than because the queue was executed. */
+	uint64_t flushes;
+	uint64_t full_flushes;
+	uint64_t failed_flushes;
+	uint64_t bytes_written;
+	uint64_t bytes_read;
+	/* Time spent waiting for flushes to complete. */
+	int64_t flush_ms;
+	/* When the stats were last cleared. */
+	int64_t since_ms;
+	unsigned buffer_size;
+};
+
+void mpsse_get_stats(const struct mpsse_ctx *ctx, struct mpsse_stats *stats);
+void mpsse_clear_stats(struct mpsse_ctx *ctx);
+
 #endif /* OPENOCD_JTAG_DRIVERS_MPSSE_H */
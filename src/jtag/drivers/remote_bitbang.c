@@ -43,6 +43,35 @@ static char remote_bitbang_buf[64];
 static unsigned remote_bitbang_start;
 static unsigned remote_bitbang_end;
 
+/* Clocks per scan vector, see doc/manual/jtag/drivers/remote_bitbang.txt.
+ * Vectors are only used if they were asked for and the server agreed. */
+#define REMOTE_BITBANG_VECTOR_BITS	4096
+/* How long to wait for the server to answer the vector request. */
+#define REMOTE_BITBANG_NEGOTIATE_MS	2000
+
+static bool remote_bitbang_vectors_wanted;
+static bool remote_bitbang_vectors;
+
+/* The vector being built from the writes bitbang.c makes. */
+static struct {
+	unsigned bits;
+	unsigned captures;
+	/* TCK as last written, so rising edges can be told apart. */
+	bool tck;
+	/* sample() was called, capture TDO on the next clock. */
+	bool sample;
+	uint8_t tms[REMOTE_BITBANG_VECTOR_BITS / 8];
+	uint8_t tdi[REMOTE_BITBANG_VECTOR_BITS / 8];
+	uint8_t capture[REMOTE_BITBANG_VECTOR_BITS / 8];
+} vector;
+
+/* TDO values returned for sent vectors that read_sample() hasn't consumed
+ * yet, one per entry. bitbang.c never has more than buf_size of them
+ * outstanding. */
+static uint8_t vector_tdo[REMOTE_BITBANG_VECTOR_BITS];
+static unsigned vector_tdo_start;
+static unsigned vector_tdo_end;
+
 static int remote_bitbang_buf_full(void)
 {
 	return remote_bitbang_end ==
@@ -97,8 +126,66 @@ static int remote_bitbang_putc(int c)
 	return ERROR_OK;
 }
 
+/* Blocking read of exactly size bytes. */
+static int remote_bitbang_read_all(uint8_t *buf, size_t size)
+{
+	socket_block(remote_bitbang_fd);
+	while (size) {
+		ssize_t count = read(remote_bitbang_fd, buf, size);
+		if (count <= 0) {
+			LOG_ERROR("read: count=%d, error=%s", (int) count, strerror(errno));
+			return ERROR_FAIL;
+		}
+		buf += count;
+		size -= count;
+	}
+	return ERROR_OK;
+}
+
+/* Send the vector built so far, and collect its TDO values if it has any. */
+static int remote_bitbang_vector_flush(void)
+{
+	if (!vector.bits)
+		return ERROR_OK;
+
+	unsigned bytes = DIV_ROUND_UP(vector.bits, 8);
+	uint8_t header[3] = { 'X', vector.bits & 0xff, vector.bits >> 8 };
+	if (fwrite(header, sizeof(header), 1, remote_bitbang_file) != 1 ||
+			fwrite(vector.tms, bytes, 1, remote_bitbang_file) != 1 ||
+			fwrite(vector.tdi, bytes, 1, remote_bitbang_file) != 1 ||
+			fwrite(vector.capture, bytes, 1, remote_bitbang_file) != 1) {
+		LOG_ERROR("fwrite: %s", strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	unsigned captures = vector.captures;
+	memset(vector.tms, 0, bytes);
+	memset(vector.tdi, 0, bytes);
+	memset(vector.capture, 0, bytes);
+	vector.bits = 0;
+	vector.captures = 0;
+	if (!captures)
+		return ERROR_OK;
+
+	if (EOF == fflush(remote_bitbang_file)) {
+		LOG_ERROR("fflush: %s", strerror(errno));
+		return ERROR_FAIL;
+	}
+	uint8_t tdo[REMOTE_BITBANG_VECTOR_BITS / 8];
+	if (remote_bitbang_read_all(tdo, DIV_ROUND_UP(captures, 8)) != ERROR_OK)
+		return ERROR_FAIL;
+	for (unsigned i = 0; i < captures; i++) {
+		vector_tdo[vector_tdo_end] = (tdo[i / 8] >> (i % 8)) & 1;
+		vector_tdo_end = (vector_tdo_end + 1) % ARRAY_SIZE(vector_tdo);
+	}
+	return ERROR_OK;
+}
+
 static int remote_bitbang_quit(void)
 {
+	if (remote_bitbang_vectors && remote_bitbang_vector_flush() != ERROR_OK)
+		return ERROR_FAIL;
+
 	if (EOF == fputc('Q', remote_bitbang_file)) {
 		LOG_ERROR("fputs: %s", strerror(errno));
 		return ERROR_FAIL;
@@ -161,6 +248,11 @@ static bb_value_t remote_bitbang_rread(void)
 
 static int remote_bitbang_sample(void)
 {
+	if (remote_bitbang_vectors) {
+		vector.sample = true;
+		return ERROR_OK;
+	}
+
 	if (remote_bitbang_fill_buf() != ERROR_OK)
 		return ERROR_FAIL;
 	assert(!remote_bitbang_buf_full());
@@ -169,6 +261,21 @@ static int remote_bitbang_sample(void)
 
 static bb_value_t remote_bitbang_read_sample(void)
 {
+	if (remote_bitbang_vectors) {
+		if (vector_tdo_start == vector_tdo_end &&
+				remote_bitbang_vector_flush() != ERROR_OK) {
+			remote_bitbang_quit();
+			return BB_ERROR;
+		}
+		if (vector_tdo_start == vector_tdo_end) {
+			LOG_ERROR("remote_bitbang: read a sample that wasn't taken");
+			return BB_ERROR;
+		}
+		int value = vector_tdo[vector_tdo_start];
+		vector_tdo_start = (vector_tdo_start + 1) % ARRAY_SIZE(vector_tdo);
+		return value ? BB_HIGH : BB_LOW;
+	}
+
 	if (remote_bitbang_start != remote_bitbang_end) {
 		int c = remote_bitbang_buf[remote_bitbang_start];
 		remote_bitbang_start =
@@ -178,20 +285,53 @@ static bb_value_t remote_bitbang_read_sample(void)
 	return remote_bitbang_rread();
 }
 
+/* Add a clock to the vector on every rising edge of TCK. The server drives
+ * TMS and TDI with TCK low, samples TDO if asked to and then raises TCK,
+ * just like the writes bitbang.c makes for each bit. */
+static int remote_bitbang_vector_write(int tck, int tms, int tdi)
+{
+	if (tck && !vector.tck) {
+		if (vector.bits == REMOTE_BITBANG_VECTOR_BITS &&
+				remote_bitbang_vector_flush() != ERROR_OK)
+			return ERROR_FAIL;
+		unsigned i = vector.bits++;
+		if (tms)
+			vector.tms[i / 8] |= 1 << (i % 8);
+		if (tdi)
+			vector.tdi[i / 8] |= 1 << (i % 8);
+		if (vector.sample) {
+			vector.capture[i / 8] |= 1 << (i % 8);
+			vector.captures++;
+			vector.sample = false;
+		}
+	}
+	vector.tck = tck;
+	return ERROR_OK;
+}
+
 static int remote_bitbang_write(int tck, int tms, int tdi)
 {
+	if (remote_bitbang_vectors)
+		return remote_bitbang_vector_write(tck, tms, tdi);
+
 	char c = '0' + ((tck ? 0x4 : 0x0) | (tms ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0));
 	return remote_bitbang_putc(c);
 }
 
 static int remote_bitbang_reset(int trst, int srst)
 {
+	if (remote_bitbang_vectors && remote_bitbang_vector_flush() != ERROR_OK)
+		return ERROR_FAIL;
+
 	char c = 'r' + ((trst ? 0x2 : 0x0) | (srst ? 0x1 : 0x0));
 	return remote_bitbang_putc(c);
 }
 
 static int remote_bitbang_blink(int on)
 {
+	if (remote_bitbang_vectors && remote_bitbang_vector_flush() != ERROR_OK)
+		return ERROR_FAIL;
+
 	char c = on ? 'B' : 'b';
 	return remote_bitbang_putc(c);
 }
@@ -274,6 +414,50 @@ static int remote_bitbang_init_unix(void)
 	return fd;
 }
 
+/* Ask the server whether it understands scan vectors. Servers that don't
+ * ignore the request, so give up on them after a while. */
+static void remote_bitbang_negotiate(void)
+{
+	if (remote_bitbang_putc('V') != ERROR_OK ||
+			EOF == fflush(remote_bitbang_file))
+		return;
+
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(remote_bitbang_fd, &fds);
+	struct timeval timeout = {
+		.tv_sec = REMOTE_BITBANG_NEGOTIATE_MS / 1000,
+		.tv_usec = (REMOTE_BITBANG_NEGOTIATE_MS % 1000) * 1000,
+	};
+	uint8_t version;
+	if (socket_select(remote_bitbang_fd + 1, &fds, NULL, NULL, &timeout) <= 0 ||
+			remote_bitbang_read_all(&version, 1) != ERROR_OK || version != '2') {
+		LOG_WARNING("remote_bitbang: server doesn't support scan vectors, "
+				"using the ASCII protocol");
+		return;
+	}
+
+	memset(&vector, 0, sizeof(vector));
+	vector_tdo_start = 0;
+	vector_tdo_end = 0;
+	remote_bitbang_vectors = true;
+	remote_bitbang_bitbang.buf_size = ARRAY_SIZE(vector_tdo) - 1;
+	LOG_INFO("remote_bitbang: using scan vectors");
+}
+
+static int remote_bitbang_execute_queue(void)
+{
+	int retval = bitbang_execute_queue();
+	if (!remote_bitbang_vectors)
+		return retval;
+
+	/* Don't leave the tail of the queue in the buffers. */
+	if (remote_bitbang_vector_flush() != ERROR_OK ||
+			EOF == fflush(remote_bitbang_file))
+		return ERROR_FAIL;
+	return retval;
+}
+
 static int remote_bitbang_init(void)
 {
 	bitbang_interface = &remote_bitbang_bitbang;
@@ -297,6 +481,11 @@ static int remote_bitbang_init(void)
 		return ERROR_FAIL;
 	}
 
+	remote_bitbang_vectors = false;
+	remote_bitbang_bitbang.buf_size = sizeof(remote_bitbang_buf) - 1;
+	if (remote_bitbang_vectors_wanted)
+		remote_bitbang_negotiate();
+
 	LOG_INFO("remote_bitbang driver initialized");
 	return ERROR_OK;
 }
@@ -323,6 +512,14 @@ COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_host_command)
 	return ERROR_COMMAND_SYNTAX_ERROR;
 }
 
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_vectors_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], remote_bitbang_vectors_wanted);
+	return ERROR_OK;
+}
+
 static const struct command_registration remote_bitbang_command_handlers[] = {
 	{
 		.name = "remote_bitbang_port",
@@ -340,11 +537,19 @@ static const struct command_registration remote_bitbang_command_handlers[] = {
 			"  if port is 0 or unset, this is the name of the unix socket to use.",
 		.usage = "host_name",
 	},
+	{
+		.name = "remote_bitbang_vectors",
+		.handler = remote_bitbang_handle_remote_bitbang_vectors_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Offer the remote jtag binary scan vectors instead of one\n"
+			"  character per clock edge. Off by default.",
+		.usage = "(on|off)",
+	},
 	COMMAND_REGISTRATION_DONE,
 };
 
 static struct jtag_interface remote_bitbang_interface = {
-	.execute_queue = &bitbang_execute_queue,
+	.execute_queue = &remote_bitbang_execute_queue,
 };
 
 struct adapter_driver remote_bitbang_adapter_driver = {
@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sim_shm.h"
+
+#include <helper/log.h>
+#include <helper/replacements.h>
+#include <helper/time_support.h>
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* Polls before going to sleep on an empty or full ring. */
+#define SIM_SHM_SPIN		1000
+/* Longest sleep, so that a dead simulator is noticed and keep_alive() runs. */
+#define SIM_SHM_SLEEP_MS	100
+
+struct sim_shm {
+	struct sim_shm_header *header;
+	size_t map_size;
+	uint32_t ring_size;
+	uint8_t *to_sim;
+	uint8_t *from_sim;
+};
+
+static uint32_t load_acquire(const uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(uint32_t *p, uint32_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/* Sleep until *word no longer holds value, or for a while. */
+static void shm_wait(uint32_t *word, uint32_t value)
+{
+#ifdef __linux__
+	struct timespec timeout = { 0, SIM_SHM_SLEEP_MS * 1000000L };
+	syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+	(void)word;
+	(void)value;
+	struct timespec delay = { 0, 100000 };
+	nanosleep(&delay, NULL);
+#endif
+}
+
+static void shm_wake(uint32_t *word, uint32_t *waiting)
+{
+	/* Pairs with the waiter setting waiting before it rechecks word. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(waiting, __ATOMIC_RELAXED))
+		return;
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+	(void)word;
+#endif
+}
+
+/* Wait until *word changes from value. Returns ERROR_FAIL if the simulator
+ * went away in the meantime. */
+static int shm_wait_change(struct sim_shm *shm, uint32_t *word,
+		uint32_t *waiting, uint32_t value)
+{
+	for (unsigned int i = 0; i < SIM_SHM_SPIN; i++) {
+		if (load_acquire(word) != value)
+			return ERROR_OK;
+	}
+
+	int64_t last_keep_alive = timeval_ms();
+	while (load_acquire(word) == value) {
+		if (load_acquire(&shm->header->server_closed)) {
+			LOG_ERROR("The simulator closed the shared memory transport.");
+			return ERROR_FAIL;
+		}
+
+		store_release(waiting, 1);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (load_acquire(word) == value)
+			shm_wait(word, value);
+		store_release(waiting, 0);
+
+		if (timeval_ms() - last_keep_alive >= SIM_SHM_SLEEP_MS) {
+			keep_alive();
+			last_keep_alive = timeval_ms();
+		}
+	}
+	return ERROR_OK;
+}
+
+int sim_shm_write(struct sim_shm *shm, const void *buf, size_t len)
+{
+	struct sim_shm_ring *ring = &shm->header->to_sim;
+	const uint8_t *data = buf;
+	uint32_t head = ring->head;
+
+	while (len) {
+		uint32_t tail = load_acquire(&ring->tail);
+		uint32_t room = shm->ring_size - (head - tail);
+		if (room == 0) {
+			if (shm_wait_change(shm, &ring->tail, &ring->producer_waiting,
+					tail) != ERROR_OK)
+				return ERROR_FAIL;
+			continue;
+		}
+
+		uint32_t offset = head & (shm->ring_size - 1);
+		uint32_t chunk = MIN(MIN(room, shm->ring_size - offset), len);
+		memcpy(shm->to_sim + offset, data, chunk);
+		head += chunk;
+		data += chunk;
+		len -= chunk;
+		store_release(&ring->head, head);
+		shm_wake(&ring->head, &ring->consumer_waiting);
+	}
+	return ERROR_OK;
+}
+
+int sim_shm_read(struct sim_shm *shm, void *buf, size_t len)
+{
+	struct sim_shm_ring *ring = &shm->header->from_sim;
+	uint8_t *data = buf;
+	uint32_t tail = ring->tail;
+
+	while (len) {
+		uint32_t head = load_acquire(&ring->head);
+		uint32_t used = head - tail;
+		if (used == 0) {
+			if (shm_wait_change(shm, &ring->head, &ring->consumer_waiting,
+					head) != ERROR_OK)
+				return ERROR_FAIL;
+			continue;
+		}
+
+		uint32_t offset = tail & (shm->ring_size - 1);
+		uint32_t chunk = MIN(MIN(used, shm->ring_size - offset), len);
+		memcpy(data, shm->from_sim + offset, chunk);
+		tail += chunk;
+		data += chunk;
+		len -= chunk;
+		store_release(&ring->tail, tail);
+		shm_wake(&ring->tail, &ring->producer_waiting);
+	}
+	return ERROR_OK;
+}
+
+struct sim_shm *sim_shm_open(const char *path)
+{
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		LOG_ERROR("Can't open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct sim_shm_header)) {
+		LOG_ERROR("%s is too small to be a shared memory transport.", path);
+		close(fd);
+		return NULL;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		LOG_ERROR("Can't map %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	struct sim_shm_header *header = map;
+	uint32_t ring_size = header->ring_size;
+	if (header->magic != SIM_SHM_MAGIC || header->version != SIM_SHM_VERSION) {
+		LOG_ERROR("%s is not a version %d shared memory transport.", path,
+				SIM_SHM_VERSION);
+		goto fail;
+	}
+	if (ring_size == 0 || (ring_size & (ring_size - 1)) ||
+			sizeof(*header) + 2 * (size_t)ring_size > (size_t)st.st_size) {
+		LOG_ERROR("%s has an invalid ring size of %" PRIu32 " bytes.", path,
+				ring_size);
+		goto fail;
+	}
+	if (load_acquire(&header->server_closed)) {
+		LOG_ERROR("The simulator already closed %s.", path);
+		goto fail;
+	}
+
+	struct sim_shm *shm = calloc(1, sizeof(*shm));
+	if (!shm) {
+		LOG_ERROR("Out of memory");
+		goto fail;
+	}
+	shm->header = header;
+	shm->map_size = st.st_size;
+	shm->ring_size = ring_size;
+	shm->to_sim = (uint8_t *)(header + 1);
+	shm->from_sim = shm->to_sim + ring_size;
+
+	store_release(&header->client_attached, 1);
+	LOG_INFO("Attached to %s with %" PRIu32 " byte rings.", path, ring_size);
+	return shm;
+
+fail:
+	munmap(map, st.st_size);
+	return NULL;
+}
+
+void sim_shm_close(struct sim_shm *shm)
+{
+	if (!shm)
+		return;
+	store_release(&shm->header->client_attached, 0);
+	munmap(shm->header, shm->map_size);
+	free(shm);
+}
+
+#else
+
+struct sim_shm *sim_shm_open(const char *path)
+{
+	LOG_ERROR("The shared memory transport isn't supported on this host.");
+	return NULL;
+}
+
+void sim_shm_close(struct sim_shm *shm)
+{
+}
+
+int sim_shm_write(struct sim_shm *shm, const void *buf, size_t len)
+{
+	return ERROR_FAIL;
+}
+
+int sim_shm_read(struct sim_shm *shm, void *buf, size_t len)
+{
+	return ERROR_FAIL;
+}
+
+#endif
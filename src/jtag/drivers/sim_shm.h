@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef OPENOCD_JTAG_DRIVERS_SIM_SHM_H
+#define OPENOCD_JTAG_DRIVERS_SIM_SHM_H
+
+#include <helper/types.h>
+
+/*
+ * Shared memory transport for the simulation drivers (jtag_vpi, jtag_dpi).
+ *
+ * It carries exactly the byte stream these drivers otherwise send over TCP,
+ * through two single producer, single consumer rings in a file that both
+ * OpenOCD and the simulator mmap(). A simulator that supports it only has to
+ * swap its socket reads and writes for ring accesses.
+ *
+ * The simulator creates the file, fills in the header with magic, version
+ * and ring_size (a power of two), zeroes the rest and then waits for
+ * client_attached to become 1. It sets server_closed before going away.
+ *
+ * Ring indexes are free running 32 bit byte counts: the producer owns head,
+ * the consumer owns tail, and head - tail bytes are in the ring at
+ * data[tail % ring_size]. Updates have release semantics and are read with
+ * acquire semantics. A side that runs out of data or room spins for a while
+ * and then sets its waiting word and sleeps; the other side wakes it (with a
+ * futex wake on head or tail, on Linux) only when that word is set, so no
+ * system calls are made while both sides keep up.
+ */
+
+#define SIM_SHM_MAGIC		0x4d53434f	/* "OCSM" */
+#define SIM_SHM_VERSION		1
+
+struct sim_shm_ring {
+	uint32_t head;
+	uint32_t tail;
+	/* The consumer sleeps waiting for head to move. */
+	uint32_t consumer_waiting;
+	/* The producer sleeps waiting for tail to move. */
+	uint32_t producer_waiting;
+	uint32_t reserved[12];
+};
+
+/* The file starts with this header, followed by the data of the ring to
+ * the simulator, then that of the ring from it, ring_size bytes each. */
+struct sim_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ring_size;
+	uint32_t client_attached;
+	uint32_t server_closed;
+	uint32_t reserved[11];
+	struct sim_shm_ring to_sim;
+	struct sim_shm_ring from_sim;
+};
+
+struct sim_shm;
+
+/* Attach to the file the simulator set up at path. */
+struct sim_shm *sim_shm_open(const char *path);
+void sim_shm_close(struct sim_shm *shm);
+
+/* Blocking transfers of exactly len bytes. */
+int sim_shm_write(struct sim_shm *shm, const void *buf, size_t len);
+int sim_shm_read(struct sim_shm *shm, void *buf, size_t len);
+
+#endif /* OPENOCD_JTAG_DRIVERS_SIM_SHM_H */
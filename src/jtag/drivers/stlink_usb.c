@@ -383,158 +383,6 @@ static unsigned int stlink_usb_block(void *handle)
 
 
 
-#ifdef USE_LIBUSB_ASYNCIO
-
-static LIBUSB_CALL void sync_transfer_cb(struct libusb_transfer *transfer)
-{
-	int *completed = transfer->user_data;
-	*completed = 1;
-	/* caller interprets result and frees transfer */
-}
-
-
-static void sync_transfer_wait_for_completion(struct libusb_transfer *transfer)
-{
-	int r, *completed = transfer->user_data;
-
-	/* Assuming a single libusb context exists.  There no existing interface into this
-	 * module to pass a libusb context.
-	 */
-	struct libusb_context *ctx = NULL;
-
-	while (!*completed) {
-		r = libusb_handle_events_completed(ctx, completed);
-		if (r < 0) {
-			if (r == LIBUSB_ERROR_INTERRUPTED)
-				continue;
-			libusb_cancel_transfer(transfer);
-			continue;
-		}
-	}
-}
-
-
-static int transfer_error_status(const struct libusb_transfer *transfer)
-{
-	int r = 0;
-
-	switch (transfer->status) {
-		case LIBUSB_TRANSFER_COMPLETED:
-			r = 0;
-			break;
-		case LIBUSB_TRANSFER_TIMED_OUT:
-			r = LIBUSB_ERROR_TIMEOUT;
-			break;
-		case LIBUSB_TRANSFER_STALL:
-			r = LIBUSB_ERROR_PIPE;
-			break;
-		case LIBUSB_TRANSFER_OVERFLOW:
-			r = LIBUSB_ERROR_OVERFLOW;
-			break;
-		case LIBUSB_TRANSFER_NO_DEVICE:
-			r = LIBUSB_ERROR_NO_DEVICE;
-			break;
-		case LIBUSB_TRANSFER_ERROR:
-		case LIBUSB_TRANSFER_CANCELLED:
-			r = LIBUSB_ERROR_IO;
-			break;
-		default:
-			r = LIBUSB_ERROR_OTHER;
-			break;
-	}
-
-	return r;
-}
-
-struct jtag_xfer {
-	int ep;
-	uint8_t *buf;
-	size_t size;
-	/* Internal */
-	int retval;
-	int completed;
-	size_t transfer_size;
-	struct libusb_transfer *transfer;
-};
-
-static int jtag_libusb_bulk_transfer_n(
-		struct libusb_device_handle *dev_handle,
-		struct jtag_xfer *transfers,
-		size_t n_transfers,
-		int timeout)
-{
-	int retval = 0;
-	int returnval = ERROR_OK;
-
-
-	for (size_t i = 0; i < n_transfers; ++i) {
-		transfers[i].retval = 0;
-		transfers[i].completed = 0;
-		transfers[i].transfer_size = 0;
-		transfers[i].transfer = libusb_alloc_transfer(0);
-
-		if (transfers[i].transfer == NULL) {
-			for (size_t j = 0; j < i; ++j)
-				libusb_free_transfer(transfers[j].transfer);
-
-			LOG_DEBUG("ERROR, failed to alloc usb transfers");
-			for (size_t k = 0; k < n_transfers; ++k)
-				transfers[k].retval = LIBUSB_ERROR_NO_MEM;
-			return ERROR_FAIL;
-		}
-	}
-
-	for (size_t i = 0; i < n_transfers; ++i) {
-		libusb_fill_bulk_transfer(
-				transfers[i].transfer,
-				dev_handle,
-				transfers[i].ep, transfers[i].buf, transfers[i].size,
-				sync_transfer_cb, &transfers[i].completed, timeout);
-		transfers[i].transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
-
-		retval = libusb_submit_transfer(transfers[i].transfer);
-		if (retval < 0) {
-			LOG_DEBUG("ERROR, failed to submit transfer %zu, error %d", i, retval);
-
-			/* Probably no point continuing to submit transfers once a submission fails.
-			 * As a result, tag all remaining transfers as errors.
-			 */
-			for (size_t j = i; j < n_transfers; ++j)
-				transfers[j].retval = retval;
-
-			returnval = ERROR_FAIL;
-			break;
-		}
-	}
-
-	/* Wait for every submitted USB transfer to complete.
-	*/
-	for (size_t i = 0; i < n_transfers; ++i) {
-		if (transfers[i].retval == 0) {
-			sync_transfer_wait_for_completion(transfers[i].transfer);
-
-			retval = transfer_error_status(transfers[i].transfer);
-			if (retval) {
-				returnval = ERROR_FAIL;
-				transfers[i].retval = retval;
-				LOG_DEBUG("ERROR, transfer %zu failed, error %d", i, retval);
-			} else {
-				/* Assuming actual_length is only valid if there is no transfer error.
-				 */
-				transfers[i].transfer_size = transfers[i].transfer->actual_length;
-			}
-		}
-
-		libusb_free_transfer(transfers[i].transfer);
-		transfers[i].transfer = NULL;
-	}
-
-	return returnval;
-}
-
-#endif
-
-
 /** */
 static int stlink_usb_xfer_v1_get_status(void *handle)
 {
@@ -578,7 +426,7 @@ static int stlink_usb_xfer_rw(void *handle, int cmdsize, const uint8_t *buf, int
 	assert(handle != NULL);
 
 	size_t n_transfers = 0;
-	struct jtag_xfer transfers[2];
+	struct jtag_libusb_xfer transfers[2];
 
 	memset(transfers, 0, sizeof(transfers));
 
@@ -2111,6 +1959,68 @@ static int stlink_usb_get_rw_status(void *handle)
 	}
 }
 
+/*
+ * Transfer the memory read/write command in cmdbuf with <size> bytes of data
+ * from/to buf, then get its status. With asynchronous USB I/O the status
+ * command is submitted together with the memory command, so the probe finds
+ * it waiting and the host saves a round trip per block.
+ */
+static int stlink_usb_xfer_mem(void *handle, const uint8_t *buf, int size)
+{
+	struct stlink_usb_handle_s *h = handle;
+	int retval;
+
+	assert(handle != NULL);
+
+#ifdef USE_LIBUSB_ASYNCIO
+	if (h->version.stlink != 1 && h->version.jtag_api != STLINK_JTAG_API_V1) {
+		uint8_t status_cmd[STLINK_CMD_SIZE_V2] = { STLINK_DEBUG_COMMAND };
+		uint8_t status[12];
+		int status_size = 2;
+
+		if (h->version.flags & STLINK_F_HAS_GETLASTRWSTATUS2) {
+			status_cmd[1] = STLINK_DEBUG_APIV2_GETLASTRWSTATUS2;
+			status_size = 12;
+		} else {
+			status_cmd[1] = STLINK_DEBUG_APIV2_GETLASTRWSTATUS;
+		}
+
+		struct jtag_libusb_xfer transfers[4];
+		size_t n_transfers = 0;
+		memset(transfers, 0, sizeof(transfers));
+
+		transfers[n_transfers].ep = h->tx_ep;
+		transfers[n_transfers].buf = h->cmdbuf;
+		transfers[n_transfers++].size = STLINK_CMD_SIZE_V2;
+		if (size) {
+			transfers[n_transfers].ep = h->direction;
+			transfers[n_transfers].buf = (uint8_t *)buf;
+			transfers[n_transfers++].size = size;
+		}
+		transfers[n_transfers].ep = h->tx_ep;
+		transfers[n_transfers].buf = status_cmd;
+		transfers[n_transfers++].size = sizeof(status_cmd);
+		transfers[n_transfers].ep = h->rx_ep;
+		transfers[n_transfers].buf = status;
+		transfers[n_transfers++].size = status_size;
+
+		retval = jtag_libusb_bulk_transfer_n(h->fd, transfers, n_transfers,
+				STLINK_WRITE_TIMEOUT);
+		if (retval != ERROR_OK)
+			return retval;
+
+		memcpy(h->databuf, status, status_size);
+		return stlink_usb_error_check(handle);
+	}
+#endif
+
+	retval = stlink_usb_xfer_noerrcheck(handle, buf, size);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return stlink_usb_get_rw_status(handle);
+}
+
 /** */
 static int stlink_usb_read_mem8(void *handle, uint32_t addr, uint16_t len,
 			  uint8_t *buffer)
@@ -2137,24 +2047,21 @@ static int stlink_usb_read_mem8(void *handle, uint32_t addr, uint16_t len,
 	h->cmdidx += 2;
 
 	/* we need to fix read length for single bytes */
-	if (read_len == 1)
-		read_len++;
+	if (read_len == 1) {
+		uint8_t data[2];
 
-	res = stlink_usb_xfer_noerrcheck(handle, h->databuf, read_len);
-
-	if (res != ERROR_OK)
+		res = stlink_usb_xfer_mem(handle, data, 2);
+		buffer[0] = data[0];
 		return res;
+	}
 
-	memcpy(buffer, h->databuf, len);
-
-	return stlink_usb_get_rw_status(handle);
+	return stlink_usb_xfer_mem(handle, buffer, read_len);
 }
 
 /** */
 static int stlink_usb_write_mem8(void *handle, uint32_t addr, uint16_t len,
 			   const uint8_t *buffer)
 {
-	int res;
 	struct stlink_usb_handle_s *h = handle;
 
 	assert(handle != NULL);
@@ -2174,19 +2081,13 @@ static int stlink_usb_write_mem8(void *handle, uint32_t addr, uint16_t len,
 	h_u16_to_le(h->cmdbuf+h->cmdidx, len);
 	h->cmdidx += 2;
 
-	res = stlink_usb_xfer_noerrcheck(handle, buffer, len);
-
-	if (res != ERROR_OK)
-		return res;
-
-	return stlink_usb_get_rw_status(handle);
+	return stlink_usb_xfer_mem(handle, buffer, len);
 }
 
 /** */
 static int stlink_usb_read_mem16(void *handle, uint32_t addr, uint16_t len,
 			  uint8_t *buffer)
 {
-	int res;
 	struct stlink_usb_handle_s *h = handle;
 
 	assert(handle != NULL);
@@ -2209,21 +2110,13 @@ static int stlink_usb_read_mem16(void *handle, uint32_t addr, uint16_t len,
 	h_u16_to_le(h->cmdbuf+h->cmdidx, len);
 	h->cmdidx += 2;
 
-	res = stlink_usb_xfer_noerrcheck(handle, h->databuf, len);
-
-	if (res != ERROR_OK)
-		return res;
-
-	memcpy(buffer, h->databuf, len);
-
-	return stlink_usb_get_rw_status(handle);
+	return stlink_usb_xfer_mem(handle, buffer, len);
 }
 
 /** */
 static int stlink_usb_write_mem16(void *handle, uint32_t addr, uint16_t len,
 			   const uint8_t *buffer)
 {
-	int res;
 	struct stlink_usb_handle_s *h = handle;
 
 	assert(handle != NULL);
@@ -2246,19 +2139,13 @@ static int stlink_usb_write_mem16(void *handle, uint32_t addr, uint16_t len,
 	h_u16_to_le(h->cmdbuf+h->cmdidx, len);
 	h->cmdidx += 2;
 
-	res = stlink_usb_xfer_noerrcheck(handle, buffer, len);
-
-	if (res != ERROR_OK)
-		return res;
-
-	return stlink_usb_get_rw_status(handle);
+	return stlink_usb_xfer_mem(handle, buffer, len);
 }
 
 /** */
 static int stlink_usb_read_mem32(void *handle, uint32_t addr, uint16_t len,
 			  uint8_t *buffer)
 {
-	int res;
 	struct stlink_usb_handle_s *h = handle;
 
 	assert(handle != NULL);
@@ -2278,21 +2165,13 @@ static int stlink_usb_read_mem32(void *handle, uint32_t addr, uint16_t len,
 	h_u16_to_le(h->cmdbuf+h->cmdidx, len);
 	h->cmdidx += 2;
 
-	res = stlink_usb_xfer_noerrcheck(handle, h->databuf, len);
-
-	if (res != ERROR_OK)
-		return res;
-
-	memcpy(buffer, h->databuf, len);
-
-	return stlink_usb_get_rw_status(handle);
+	return stlink_usb_xfer_mem(handle, buffer, len);
 }
 
 /** */
 static int stlink_usb_write_mem32(void *handle, uint32_t addr, uint16_t len,
 			   const uint8_t *buffer)
 {
-	int res;
 	struct stlink_usb_handle_s *h = handle;
 
 	assert(handle != NULL);
@@ -2312,12 +2191,7 @@ static int stlink_usb_write_mem32(void *handle, uint32_t addr, uint16_t len,
 	h_u16_to_le(h->cmdbuf+h->cmdidx, len);
 	h->cmdidx += 2;
 
-	res = stlink_usb_xfer_noerrcheck(handle, buffer, len);
-
-	if (res != ERROR_OK)
-		return res;
-
-	return stlink_usb_get_rw_status(handle);
+	return stlink_usb_xfer_mem(handle, buffer, len);
 }
 
 static uint32_t stlink_max_block_size(uint32_t tar_autoincr_block, uint32_t address)
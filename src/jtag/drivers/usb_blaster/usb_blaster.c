@@ -100,6 +100,15 @@
 /* USB-Blaster II specific command */
 #define CMD_COPY_TDO_BUFFER	0x5F
 
+/*
+ * The USB-Blaster II keeps TDO until CMD_COPY_TDO_BUFFER, so a scan can
+ * collect this many bytes of it, one high-speed bulk packet, before
+ * reading them back. The original USB-Blaster has to be read after
+ * each byte-shift packet or its FIFO towards the host fills up while the
+ * host is still writing.
+ */
+#define UBLAST2_TDO_BATCH	512
+
 enum gpio_steer {
 	FIXED_0 = 0,
 	FIXED_1,
@@ -614,7 +623,8 @@ static void ublast_queue_tdi(uint8_t *bits, int nb_bits, enum scan_type scan)
 {
 	int nb8 = nb_bits / 8;
 	int nb1 = nb_bits % 8;
-	int nbfree_in_packet, i, trans = 0, read_tdos;
+	int nbfree_in_packet, i, trans = 0, read_tdos, batch_tdos;
+	int pending = 0;	/* TDO bytes held by the USB-Blaster II */
 	uint8_t *tdos = calloc(1, nb_bits / 8 + 1);
 	static uint8_t byte0[BUF_LEN];
 
@@ -633,6 +643,7 @@ static void ublast_queue_tdi(uint8_t *bits, int nb_bits, enum scan_type scan)
 	}
 
 	read_tdos = (scan == SCAN_IN || scan == SCAN_IO);
+	batch_tdos = read_tdos && (info.flags & COPY_TDO_BUFFER);
 	for (i = 0; i < nb8; i += trans) {
 		/*
 		 * Calculate number of bytes to fill USB packet of size MAX_PACKET_SIZE
@@ -654,9 +665,14 @@ static void ublast_queue_tdi(uint8_t *bits, int nb_bits, enum scan_type scan)
 			ublast_queue_bytes(&bits[i], trans);
 		else
 			ublast_queue_bytes(byte0, trans);
-		if (read_tdos) {
-			if (info.flags & COPY_TDO_BUFFER)
-				ublast_queue_byte(CMD_COPY_TDO_BUFFER);
+		if (batch_tdos) {
+			pending += trans;
+			if (pending + MAX_PACKET_SIZE <= UBLAST2_TDO_BATCH)
+				continue;
+			ublast_queue_byte(CMD_COPY_TDO_BUFFER);
+			ublast_read_byteshifted_tdos(&tdos[i + trans - pending], pending);
+			pending = 0;
+		} else if (read_tdos) {
 			ublast_read_byteshifted_tdos(&tdos[i], trans);
 		}
 	}
@@ -672,8 +688,11 @@ static void ublast_queue_tdi(uint8_t *bits, int nb_bits, enum scan_type scan)
 			ublast_clock_tdi(tdi, scan);
 	}
 	if (nb1 && read_tdos) {
+		/* one copy returns the byte-shifted TDO still held, then these */
 		if (info.flags & COPY_TDO_BUFFER)
 			ublast_queue_byte(CMD_COPY_TDO_BUFFER);
+		if (pending)
+			ublast_read_byteshifted_tdos(&tdos[nb8 - pending], pending);
 		ublast_read_bitbang_tdos(&tdos[nb8], nb1);
 	}
 
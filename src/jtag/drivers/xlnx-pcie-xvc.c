@@ -12,6 +12,8 @@
 #include <stdlib.h>
 #include <math.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/pci.h>
 
 #include <jtag/interface.h>
@@ -37,6 +39,17 @@
 #define XLNX_XVC_VSEC_ID	0x8
 #define XLNX_XVC_MAX_BITS	0x20
 
+/* Register layout of the debug bridge when it sits behind a BAR */
+#define XLNX_XVC_BAR_LEN_REG	0x00
+#define XLNX_XVC_BAR_TMS_REG	0x04
+#define XLNX_XVC_BAR_TDI_REG	0x08
+#define XLNX_XVC_BAR_TDO_REG	0x0C
+#define XLNX_XVC_BAR_CTRL_REG	0x10
+#define XLNX_XVC_BAR_REGS_SIZE	0x14
+#define XLNX_XVC_BAR_CTRL_START	BIT(0)
+/* A shift of 32 bits takes a few reads of the control register at most */
+#define XLNX_XVC_BAR_POLL_MAX	10000
+
 #define MASK_ACK(x) (((x) >> 9) & 0x7)
 #define MASK_PAR(x) ((int)((x) & 0x1))
 
@@ -44,9 +57,21 @@ struct xlnx_pcie_xvc {
 	int fd;
 	unsigned offset;
 	char *device;
+	/* BAR to use instead of the config space, or -1 */
+	int bar;
+	uint32_t bar_offset;
+	void *bar_map;
+	size_t bar_map_size;
+	volatile uint32_t *bar_regs;
+	/* Length and TMS last written, so they needn't be written again */
+	bool regs_cached;
+	uint32_t last_len;
+	uint32_t last_tms;
 };
 
-static struct xlnx_pcie_xvc xlnx_pcie_xvc_state;
+static struct xlnx_pcie_xvc xlnx_pcie_xvc_state = {
+	.bar = -1,
+};
 static struct xlnx_pcie_xvc *xlnx_pcie_xvc = &xlnx_pcie_xvc_state;
 
 static int xlnx_pcie_xvc_read_reg(const int offset, uint32_t *val)
@@ -90,26 +115,90 @@ static int xlnx_pcie_xvc_write_reg(const int offset, const uint32_t val)
 	return ERROR_OK;
 }
 
-static int xlnx_pcie_xvc_transact(size_t num_bits, uint32_t tms, uint32_t tdi,
-				  uint32_t *tdo)
+static uint32_t xlnx_pcie_xvc_bar_read(const int offset)
+{
+	uint32_t val = xlnx_pcie_xvc->bar_regs[offset / 4];
+
+	/* PCIe memory space is little endian */
+	return le_to_h_u32((uint8_t *)&val);
+}
+
+static void xlnx_pcie_xvc_bar_write(const int offset, const uint32_t val)
+{
+	uint32_t le_val;
+
+	h_u32_to_le((uint8_t *)&le_val, val);
+	xlnx_pcie_xvc->bar_regs[offset / 4] = le_val;
+}
+
+static int xlnx_pcie_xvc_bar_shift(size_t num_bits, uint32_t tms,
+				   uint32_t tdi, uint32_t *tdo)
+{
+	if (!xlnx_pcie_xvc->regs_cached || xlnx_pcie_xvc->last_len != num_bits)
+		xlnx_pcie_xvc_bar_write(XLNX_XVC_BAR_LEN_REG, num_bits);
+	if (!xlnx_pcie_xvc->regs_cached || xlnx_pcie_xvc->last_tms != tms)
+		xlnx_pcie_xvc_bar_write(XLNX_XVC_BAR_TMS_REG, tms);
+	xlnx_pcie_xvc_bar_write(XLNX_XVC_BAR_TDI_REG, tdi);
+	xlnx_pcie_xvc_bar_write(XLNX_XVC_BAR_CTRL_REG, XLNX_XVC_BAR_CTRL_START);
+
+	unsigned int poll = 0;
+	while (xlnx_pcie_xvc_bar_read(XLNX_XVC_BAR_CTRL_REG) & XLNX_XVC_BAR_CTRL_START) {
+		if (++poll == XLNX_XVC_BAR_POLL_MAX) {
+			LOG_ERROR("Timed out waiting for the shift to complete");
+			return ERROR_JTAG_DEVICE_ERROR;
+		}
+	}
+
+	/* Only go back across the link for TDO if someone wants it */
+	if (tdo)
+		*tdo = xlnx_pcie_xvc_bar_read(XLNX_XVC_BAR_TDO_REG);
+
+	return ERROR_OK;
+}
+
+static int xlnx_pcie_xvc_cfg_shift(size_t num_bits, uint32_t tms,
+				   uint32_t tdi, uint32_t *tdo)
 {
 	int err;
 
-	err = xlnx_pcie_xvc_write_reg(XLNX_XVC_LEN_REG, num_bits);
-	if (err != ERROR_OK)
-		return err;
+	if (!xlnx_pcie_xvc->regs_cached || xlnx_pcie_xvc->last_len != num_bits) {
+		err = xlnx_pcie_xvc_write_reg(XLNX_XVC_LEN_REG, num_bits);
+		if (err != ERROR_OK)
+			return err;
+	}
 
-	err = xlnx_pcie_xvc_write_reg(XLNX_XVC_TMS_REG, tms);
-	if (err != ERROR_OK)
-		return err;
+	if (!xlnx_pcie_xvc->regs_cached || xlnx_pcie_xvc->last_tms != tms) {
+		err = xlnx_pcie_xvc_write_reg(XLNX_XVC_TMS_REG, tms);
+		if (err != ERROR_OK)
+			return err;
+	}
 
 	err = xlnx_pcie_xvc_write_reg(XLNX_XVC_TDx_REG, tdi);
 	if (err != ERROR_OK)
 		return err;
 
-	err = xlnx_pcie_xvc_read_reg(XLNX_XVC_TDx_REG, tdo);
-	if (err != ERROR_OK)
+	/* Reading TDx back is also what waits for the shift to finish, so it
+	 * can't be skipped even if TDO isn't needed. */
+	return xlnx_pcie_xvc_read_reg(XLNX_XVC_TDx_REG, tdo);
+}
+
+static int xlnx_pcie_xvc_transact(size_t num_bits, uint32_t tms, uint32_t tdi,
+				  uint32_t *tdo)
+{
+	int err;
+
+	if (xlnx_pcie_xvc->bar_regs)
+		err = xlnx_pcie_xvc_bar_shift(num_bits, tms, tdi, tdo);
+	else
+		err = xlnx_pcie_xvc_cfg_shift(num_bits, tms, tdi, tdo);
+	if (err != ERROR_OK) {
+		xlnx_pcie_xvc->regs_cached = false;
 		return err;
+	}
+
+	xlnx_pcie_xvc->regs_cached = true;
+	xlnx_pcie_xvc->last_len = num_bits;
+	xlnx_pcie_xvc->last_tms = tms;
 
 	if (tdo)
 		LOG_DEBUG_IO("Transact num_bits: %zu, tms: %" PRIx32 ", tdi: %" PRIx32 ", tdo: %" PRIx32,
@@ -379,12 +468,66 @@ static int xlnx_pcie_xvc_execute_queue(void)
 }
 
 
+static int xlnx_pcie_xvc_init_bar(void)
+{
+	char filename[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	snprintf(filename, PATH_MAX, "/sys/bus/pci/devices/%s/resource%d",
+		 xlnx_pcie_xvc->device, xlnx_pcie_xvc->bar);
+	fd = open(filename, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		LOG_ERROR("Failed to open device: %s", filename);
+		return ERROR_JTAG_INIT_FAILED;
+	}
+
+	if (fstat(fd, &st) < 0 || (uint64_t)xlnx_pcie_xvc->bar_offset +
+	    XLNX_XVC_BAR_REGS_SIZE > (uint64_t)st.st_size) {
+		LOG_ERROR("Offset 0x%" PRIx32 " is outside of BAR %d",
+			  xlnx_pcie_xvc->bar_offset, xlnx_pcie_xvc->bar);
+		close(fd);
+		return ERROR_JTAG_INIT_FAILED;
+	}
+
+	/* Only map the page(s) holding the registers, BARs can be huge */
+	long page_size = sysconf(_SC_PAGESIZE);
+	off_t map_offset = xlnx_pcie_xvc->bar_offset & ~(page_size - 1);
+	xlnx_pcie_xvc->bar_map_size = xlnx_pcie_xvc->bar_offset - map_offset +
+		XLNX_XVC_BAR_REGS_SIZE;
+	xlnx_pcie_xvc->bar_map = mmap(NULL, xlnx_pcie_xvc->bar_map_size,
+				      PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+				      map_offset);
+	close(fd);
+	if (xlnx_pcie_xvc->bar_map == MAP_FAILED) {
+		LOG_ERROR("Failed to map BAR %d of %s", xlnx_pcie_xvc->bar,
+			  xlnx_pcie_xvc->device);
+		xlnx_pcie_xvc->bar_map = NULL;
+		return ERROR_JTAG_INIT_FAILED;
+	}
+	xlnx_pcie_xvc->bar_regs = (volatile uint32_t *)
+		((uint8_t *)xlnx_pcie_xvc->bar_map +
+		 (xlnx_pcie_xvc->bar_offset - map_offset));
+
+	LOG_INFO("Using Xilinx XVC registers in BAR %d at offset 0x%" PRIx32,
+		 xlnx_pcie_xvc->bar, xlnx_pcie_xvc->bar_offset);
+
+	return ERROR_OK;
+}
+
 static int xlnx_pcie_xvc_init(void)
 {
 	char filename[PATH_MAX];
 	uint32_t cap, vh;
 	int err;
 
+	xlnx_pcie_xvc->regs_cached = false;
+	if (xlnx_pcie_xvc->bar >= 0) {
+		/* Keep quit() from closing someone else's descriptor */
+		xlnx_pcie_xvc->fd = -1;
+		return xlnx_pcie_xvc_init_bar();
+	}
+
 	snprintf(filename, PATH_MAX, "/sys/bus/pci/devices/%s/config",
 		 xlnx_pcie_xvc->device);
 	xlnx_pcie_xvc->fd = open(filename, O_RDWR | O_SYNC);
@@ -438,6 +581,13 @@ static int xlnx_pcie_xvc_quit(void)
 {
 	int err;
 
+	if (xlnx_pcie_xvc->bar_map) {
+		munmap(xlnx_pcie_xvc->bar_map, xlnx_pcie_xvc->bar_map_size);
+		xlnx_pcie_xvc->bar_map = NULL;
+		xlnx_pcie_xvc->bar_regs = NULL;
+		return ERROR_OK;
+	}
+
 	err = close(xlnx_pcie_xvc->fd);
 	if (err)
 		return err;
@@ -460,6 +610,31 @@ COMMAND_HANDLER(xlnx_pcie_xvc_handle_config_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(xlnx_pcie_xvc_handle_bar_command)
+{
+	if (CMD_ARGC < 1 || CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	int bar;
+	COMMAND_PARSE_NUMBER(int, CMD_ARGV[0], bar);
+	if (bar < 0 || bar > 5) {
+		LOG_ERROR("BAR must be between 0 and 5");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	uint32_t offset = 0;
+	if (CMD_ARGC == 2)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], offset);
+	if (offset % 4) {
+		LOG_ERROR("Offset must be 32 bit aligned");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	xlnx_pcie_xvc->bar = bar;
+	xlnx_pcie_xvc->bar_offset = offset;
+	return ERROR_OK;
+}
+
 static const struct command_registration xlnx_pcie_xvc_command_handlers[] = {
 	{
 		.name = "xlnx_pcie_xvc_config",
@@ -468,6 +643,14 @@ static const struct command_registration xlnx_pcie_xvc_command_handlers[] = {
 		.help = "Configure XVC/PCIe JTAG adapter",
 		.usage = "device",
 	},
+	{
+		.name = "xlnx_pcie_xvc_bar",
+		.handler = xlnx_pcie_xvc_handle_bar_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Use XVC registers mapped in a BAR instead of the "
+			"configuration space",
+		.usage = "bar [offset]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -244,6 +244,14 @@ int jtag_get_speed_readable(int *speed);
 /** Attempt to configure the interface for the specified KHz. */
 int jtag_config_khz(unsigned khz);
 
+/**
+ * Search for the fastest speed up to @a max_khz at which patterns shifted
+ * through the bypassed scan chain come back intact, then configure that
+ * speed less a safety margin. Requires an initialized adapter running at a
+ * fixed speed that already works; @a result_khz is the speed picked.
+ */
+int jtag_config_khz_auto(unsigned max_khz, unsigned *result_khz);
+
 /**
  * Attempt to enable RTCK/RCLK. If that fails, fallback to the
  * specified frequency.
@@ -295,6 +303,9 @@ bool jtag_will_verify(void);
 void jtag_set_verify_capture_ir(bool enable);
 /** @returns True if IR scan verification will be performed. */
 bool jtag_will_verify_capture_ir(void);
+/** Verify only one IR scan in @a interval; 1 verifies every IR scan. */
+void jtag_set_verify_capture_ir_interval(unsigned interval);
+unsigned jtag_get_verify_capture_ir_interval(void);
 
 /** Initialize debug adapter upon startup.  */
 int adapter_init(struct command_context *cmd_ctx);
@@ -305,6 +316,19 @@ int adapter_quit(void);
 /** Set ms to sleep after jtag_execute_queue() flushes queue. Debug purposes. */
 void jtag_set_flush_queue_sleep(int ms);
 
+/** Flush the queue on a separate adapter I/O thread, if the host has threads. */
+int jtag_set_io_thread(bool enable);
+/** @returns True if the queue is flushed on the adapter I/O thread. */
+bool jtag_get_io_thread(void);
+
+/**
+ * Record what TDO returns for every scan of the executed queues to
+ * @a filename, for "dummy replay". Replaces any recording in progress.
+ */
+int jtag_record_start(const char *filename);
+/** Stop and close the recording, if any. */
+void jtag_record_stop(void);
+
 /**
  * Initialize JTAG chain using only a RESET reset. If init fails,
  * try reset + init.
@@ -365,6 +389,14 @@ void jtag_add_plain_ir_scan(int num_bits, const uint8_t *out_bits, uint8_t *in_b
  */
 void jtag_add_dr_scan(struct jtag_tap *tap, int num_fields,
 		const struct scan_field *fields, tap_state_t endstate);
+/**
+ * Like jtag_add_dr_scan(), but the queue refers to the out_value buffers of
+ * fields instead of copying them, so the caller must keep them unchanged
+ * until the queue has been executed.  For bulk transfers that already keep
+ * every scan in a buffer of their own.
+ */
+void jtag_add_dr_scan_nocopy(struct jtag_tap *tap, int num_fields,
+		const struct scan_field *fields, tap_state_t endstate);
 /** A version of jtag_add_dr_scan() that uses the check_value/mask fields */
 void jtag_add_dr_scan_check(struct jtag_tap *tap, int num_fields,
 		struct scan_field *fields, tap_state_t endstate);
@@ -57,6 +57,11 @@ int interface_jtag_add_plain_ir_scan(
 int interface_jtag_add_dr_scan(struct jtag_tap *active,
 		int num_fields, const struct scan_field *fields,
 		tap_state_t endstate);
+/* Only provided by the queueing driver layer in drivers/driver.c. Minidrivers
+ * don't need to define it; jtag_add_dr_scan_nocopy() copies for them. */
+int interface_jtag_add_dr_scan_nocopy(struct jtag_tap *active,
+		int num_fields, const struct scan_field *fields,
+		tap_state_t endstate);
 int interface_jtag_add_plain_dr_scan(
 		int num_bits, const uint8_t *out_bits, uint8_t *in_bits,
 		tap_state_t endstate);
@@ -861,6 +861,64 @@ COMMAND_HANDLER(handle_jtag_init_command)
 	return jtag_init(CMD_CTX);
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct jtag_queue_stats stats;
+	jtag_command_queue_stats(&stats);
+	command_print(CMD, "high water: %zu bytes in %u pages", stats.high_water_bytes,
+			stats.high_water_pages);
+	command_print(CMD, "pooled pages: %u, pages allocated: %" PRIu64,
+			stats.pooled_pages, stats.page_mallocs);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_queue_optimize_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], jtag_queue_optimize);
+	command_print(CMD, "queue optimization is %s",
+			jtag_queue_optimize ? "on" : "off");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_io_thread_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		int retval = jtag_set_io_thread(enable);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	command_print(CMD, "adapter I/O thread is %s",
+			jtag_get_io_thread() ? "on" : "off");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_record_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!strcmp(CMD_ARGV[0], "off")) {
+		jtag_record_stop();
+		return ERROR_OK;
+	}
+	return jtag_record_start(CMD_ARGV[0]);
+}
+
 static const struct command_registration jtag_subcommand_handlers[] = {
 	{
 		.name = "init",
@@ -943,6 +1001,37 @@ static const struct command_registration jtag_subcommand_handlers[] = {
 		.jim_handler = jim_jtag_names,
 		.help = "Returns list of all JTAG tap names.",
 	},
+	{
+		.name = "queue_stats",
+		.mode = COMMAND_ANY,
+		.handler = handle_jtag_queue_stats_command,
+		.help = "Show how much memory JTAG command queues have needed.",
+		.usage = "",
+	},
+	{
+		.name = "queue_optimize",
+		.mode = COMMAND_ANY,
+		.handler = handle_jtag_queue_optimize_command,
+		.help = "Drop and combine redundant commands in the JTAG queue "
+			"before it is executed (default on).",
+		.usage = "['on'|'off']",
+	},
+	{
+		.name = "io_thread",
+		.mode = COMMAND_ANY,
+		.handler = handle_jtag_io_thread_command,
+		.help = "Flush the JTAG queue on a separate adapter I/O thread, "
+			"keeping GDB alive while it runs (default off).",
+		.usage = "['on'|'off']",
+	},
+	{
+		.name = "record",
+		.mode = COMMAND_ANY,
+		.handler = handle_jtag_record_command,
+		.help = "Record what TDO returns for each scan to a file, "
+			"for replay by the dummy adapter, or stop recording.",
+		.usage = "filename|'off'",
+	},
 	{
 		.chain = jtag_command_handlers_to_move,
 	},
@@ -1170,17 +1259,32 @@ error_return:
 
 COMMAND_HANDLER(handle_verify_ircapture_command)
 {
-	if (CMD_ARGC > 1)
+	if (CMD_ARGC > 2)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	if (CMD_ARGC == 1) {
+	if (CMD_ARGC == 2) {
+		if (strcmp(CMD_ARGV[0], "every") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		unsigned interval;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], interval);
+		if (interval == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		jtag_set_verify_capture_ir(true);
+		jtag_set_verify_capture_ir_interval(interval);
+	} else if (CMD_ARGC == 1) {
 		bool enable;
 		COMMAND_PARSE_ENABLE(CMD_ARGV[0], enable);
 		jtag_set_verify_capture_ir(enable);
+		jtag_set_verify_capture_ir_interval(1);
 	}
 
-	const char *status = jtag_will_verify_capture_ir() ? "enabled" : "disabled";
-	command_print(CMD, "verify Capture-IR is %s", status);
+	if (!jtag_will_verify_capture_ir())
+		command_print(CMD, "verify Capture-IR is disabled");
+	else if (jtag_get_verify_capture_ir_interval() == 1)
+		command_print(CMD, "verify Capture-IR is enabled");
+	else
+		command_print(CMD, "verify Capture-IR is enabled for one IR scan in %u",
+				jtag_get_verify_capture_ir_interval());
 
 	return ERROR_OK;
 }
@@ -1334,8 +1438,9 @@ static const struct command_registration jtag_command_handlers[] = {
 		.handler = handle_verify_ircapture_command,
 		.mode = COMMAND_ANY,
 		.help = "Display or assign flag controlling whether to "
-			"verify values captured during Capture-IR.",
-		.usage = "['enable'|'disable']",
+			"verify values captured during Capture-IR, on every "
+			"IR scan or on one in count.",
+		.usage = "['enable'|'disable'|'every' count]",
 	},
 	{
 		.name = "verify_jtag",
@@ -125,20 +125,32 @@ static int virtex2_read_stat(struct pld_device *pld_device, uint32_t *status)
 	return ERROR_OK;
 }
 
+/* The bitstream is read, bit-reversed and shifted in chunks of this size,
+ * staying in PAUSE-DR in between, so the data register isn't updated. */
+#define VIRTEX2_LOAD_CHUNK	(1024 * 1024)
+
 static int virtex2_load(struct pld_device *pld_device, const char *filename)
 {
 	struct virtex2_pld_device *virtex2_info = pld_device->driver_priv;
 	struct xilinx_bit_file bit_file;
 	int retval;
-	unsigned int i;
+	uint32_t i, offset, count;
+	uint8_t *buffer;
 	struct scan_field field;
 
 	field.in_value = NULL;
 
-	retval = xilinx_read_bit_file(&bit_file, filename);
+	retval = xilinx_open_bit_file(&bit_file, filename);
 	if (retval != ERROR_OK)
 		return retval;
 
+	buffer = malloc(MIN(bit_file.length, (uint32_t)VIRTEX2_LOAD_CHUNK));
+	if (!buffer) {
+		LOG_ERROR("Out of memory");
+		xilinx_free_bit_file(&bit_file);
+		return ERROR_FAIL;
+	}
+
 	virtex2_set_instr(virtex2_info->tap, 0xb);	/* JPROG_B */
 	jtag_execute_queue();
 	jtag_add_sleep(1000);
@@ -146,14 +158,30 @@ static int virtex2_load(struct pld_device *pld_device, const char *filename)
 	virtex2_set_instr(virtex2_info->tap, 0x5);	/* CFG_IN */
 	jtag_execute_queue();
 
-	for (i = 0; i < bit_file.length; i++)
-		bit_file.data[i] = flip_u32(bit_file.data[i], 8);
+	for (offset = 0; offset < bit_file.length; offset += count) {
+		count = MIN(bit_file.length - offset, (uint32_t)VIRTEX2_LOAD_CHUNK);
 
-	field.num_bits = bit_file.length * 8;
-	field.out_value = bit_file.data;
+		retval = xilinx_read_bit_data(&bit_file, buffer, count);
+		if (retval != ERROR_OK)
+			break;
 
-	jtag_add_dr_scan(virtex2_info->tap, 1, &field, TAP_DRPAUSE);
-	jtag_execute_queue();
+		for (i = 0; i < count; i++)
+			buffer[i] = flip_u32(buffer[i], 8);
+
+		field.num_bits = count * 8;
+		field.out_value = buffer;
+
+		/* the buffer isn't touched again until the queue has run */
+		jtag_add_dr_scan_nocopy(virtex2_info->tap, 1, &field, TAP_DRPAUSE);
+		retval = jtag_execute_queue();
+		if (retval != ERROR_OK)
+			break;
+	}
+
+	free(buffer);
+	xilinx_free_bit_file(&bit_file);
+	if (retval != ERROR_OK)
+		return retval;
 
 	jtag_add_tlr();
 
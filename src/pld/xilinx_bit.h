@@ -20,6 +20,7 @@
 #define OPENOCD_PLD_XILINX_BIT_H
 
 #include "helper/types.h"
+#include <stdio.h>
 
 struct xilinx_bit_file {
 	uint8_t unknown_header[13];
@@ -29,8 +30,15 @@ struct xilinx_bit_file {
 	uint8_t *time;
 	uint32_t length;
 	uint8_t *data;
+	FILE *file;
 };
 
 int xilinx_read_bit_file(struct xilinx_bit_file *bit_file, const char *filename);
 
+/* Like xilinx_read_bit_file(), but leave the bitstream in the file, to be
+ * read with xilinx_read_bit_data(). */
+int xilinx_open_bit_file(struct xilinx_bit_file *bit_file, const char *filename);
+int xilinx_read_bit_data(struct xilinx_bit_file *bit_file, uint8_t *buffer, uint32_t length);
+void xilinx_free_bit_file(struct xilinx_bit_file *bit_file);
+
 #endif /* OPENOCD_PLD_XILINX_BIT_H */
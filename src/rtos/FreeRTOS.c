@@ -45,6 +45,19 @@ struct FreeRTOS_params {
 struct FreeRTOS_thread_entry {
 	threadid_t threadid;
 	target_addr_t tcb;
+	/* name read from the TCB */
+	char *name;
+	/* value of update_count when last found on a list */
+	unsigned int seen;
+};
+
+/* What a list looked like the last time its threads were read. */
+struct FreeRTOS_list_cache {
+	symbol_address_t address;
+	/* raw xLIST, list_width bytes */
+	uint8_t *header;
+	target_addr_t *tcbs;
+	unsigned int tcb_count;
 };
 
 struct FreeRTOS {
@@ -55,6 +68,10 @@ struct FreeRTOS {
 	gl_map_t entry_by_threadid;
 	/* Map from tcb to FreeRTOS_thread_entry. */
 	gl_map_t entry_by_tcb;
+	/* one per list read by FreeRTOS_update_threads() */
+	struct FreeRTOS_list_cache *list_cache;
+	unsigned int list_cache_count;
+	unsigned int update_count;
 	/* sizeof(UBaseType_t) */
 	unsigned ubasetype_size;
 	/* sizeof(void *) */
@@ -215,6 +232,8 @@ static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, threadid_t thread_id,
 static int FreeRTOS_get_thread_reg(struct rtos *rtos, threadid_t thread_id,
 		uint32_t reg_num, struct rtos_reg *reg);
 static int FreeRTOS_set_reg(struct rtos *rtos, uint32_t reg_num, uint8_t *reg_value);
+static int FreeRTOS_get_stacking_info(struct rtos *rtos, threadid_t thread_id,
+		const struct rtos_register_stacking **stacking_info, target_addr_t *stack_ptr);
 static int FreeRTOS_get_symbol_list_to_lookup(symbol_table_elem_t *symbol_list[]);
 
 struct rtos_type FreeRTOS_rtos = {
@@ -227,6 +246,7 @@ struct rtos_type FreeRTOS_rtos = {
 	.get_thread_reg = FreeRTOS_get_thread_reg,
 	.set_reg = FreeRTOS_set_reg,
 	.get_symbol_list_to_lookup = FreeRTOS_get_symbol_list_to_lookup,
+	.get_stacking_info = FreeRTOS_get_stacking_info,
 };
 
 enum FreeRTOS_symbol_values {
@@ -345,6 +365,278 @@ static unsigned populate_offset_size(struct FreeRTOS *freertos,
 	return offset;
 }
 
+/* Add a read of length bytes at address to reads, with the widest accesses
+ * the alignment allows. */
+static void FreeRTOS_add_read(struct target_memory_read *reads, unsigned int *num_reads,
+		target_addr_t address, uint32_t length, uint8_t *buffer)
+{
+	uint32_t size = 4;
+	while ((address | length) & (size - 1))
+		size /= 2;
+
+	reads[*num_reads].address = address;
+	reads[*num_reads].size = size;
+	reads[*num_reads].count = length / size;
+	reads[*num_reads].buffer = buffer;
+	(*num_reads)++;
+}
+
+static void FreeRTOS_invalidate_list_cache(struct FreeRTOS *freertos)
+{
+	for (unsigned int i = 0; i < freertos->list_cache_count; i++) {
+		free(freertos->list_cache[i].header);
+		free(freertos->list_cache[i].tcbs);
+	}
+	free(freertos->list_cache);
+	freertos->list_cache = NULL;
+	freertos->list_cache_count = 0;
+}
+
+/* Walk the list whose xLIST header is in header and collect the TCBs of at
+ * most max_count items. Each list item is read with a single access. */
+static int FreeRTOS_read_list(struct rtos *rtos, const uint8_t *header,
+		uint64_t max_count, target_addr_t **tcbs, unsigned int *tcb_count)
+{
+	struct FreeRTOS *freertos = (struct FreeRTOS *) rtos->rtos_specific_params;
+
+	*tcbs = NULL;
+	*tcb_count = 0;
+
+	uint64_t list_thread_count = buf_get_u64(header + freertos->list_uxNumberOfItems_offset,
+			0, freertos->list_uxNumberOfItems_size * 8);
+	if (list_thread_count > max_count)
+		list_thread_count = max_count;
+	if (list_thread_count == 0)
+		return ERROR_OK;
+
+	*tcbs = malloc(sizeof(target_addr_t) * list_thread_count);
+	if (!*tcbs) {
+		LOG_ERROR("Error allocating memory for %" PRIu64 " threads", list_thread_count);
+		return ERROR_FAIL;
+	}
+
+	target_addr_t prev_list_elem_ptr = -1;
+	target_addr_t list_elem_ptr = buf_get_u64(header + freertos->list_next_offset,
+			0, freertos->list_next_size * 8);
+	uint8_t item[freertos->list_item_width];
+
+	while ((*tcb_count < list_thread_count) && (list_elem_ptr != 0) &&
+			(list_elem_ptr != prev_list_elem_ptr)) {
+		int retval = target_read_buffer(rtos->target, list_elem_ptr,
+				freertos->list_item_width, item);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error reading thread list item in FreeRTOS thread list");
+			return retval;
+		}
+
+		(*tcbs)[(*tcb_count)++] = buf_get_u64(item + freertos->list_elem_content_offset,
+				0, freertos->list_elem_content_size * 8);
+
+		prev_list_elem_ptr = list_elem_ptr;
+		list_elem_ptr = buf_get_u64(item + freertos->list_elem_next_offset,
+				0, freertos->list_elem_next_size * 8);
+	}
+
+	return ERROR_OK;
+}
+
+/* Read the names of the TCBs of entries in one batch. */
+static int FreeRTOS_read_names(struct rtos *rtos, struct FreeRTOS_thread_entry **entries,
+		unsigned int count)
+{
+	struct FreeRTOS *freertos = (struct FreeRTOS *) rtos->rtos_specific_params;
+	struct target_memory_read *reads = calloc(count, sizeof(*reads));
+	char *names = malloc(count * FREERTOS_THREAD_NAME_STR_SIZE);
+	unsigned int num_reads = 0;
+	int retval;
+
+	if (!reads || !names) {
+		LOG_ERROR("Error allocating memory for %u thread names", count);
+		retval = ERROR_FAIL;
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+		FreeRTOS_add_read(reads, &num_reads,
+				entries[i]->tcb + freertos->thread_name_offset,
+				FREERTOS_THREAD_NAME_STR_SIZE,
+				(uint8_t *)names + i * FREERTOS_THREAD_NAME_STR_SIZE);
+
+	retval = target_read_memory_batch(rtos->target, reads, num_reads);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error reading thread name in FreeRTOS thread list");
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		char *name = names + i * FREERTOS_THREAD_NAME_STR_SIZE;
+
+		name[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
+		LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx64 ", value '%s'",
+				entries[i]->tcb + freertos->thread_name_offset, name);
+
+		free(entries[i]->name);
+		entries[i]->name = strdup(name[0] == '\x00' ? "No Name" : name);
+	}
+
+out:
+	free(names);
+	free(reads);
+	return retval;
+}
+
+/* Fill rtos->thread_details from the given lists, whose xLIST headers are
+ * in headers. A list is only walked if its header (item count, index, first
+ * and last item) changed since the last update. Thread names are only read
+ * for TCBs that weren't on any list at the last update, all in one batch.
+ * consistent is cleared if reusing a cached list produced a thread twice,
+ * or a total different from uxCurrentNumberOfTasks. */
+static int FreeRTOS_collect_threads(struct rtos *rtos, const symbol_address_t *list_of_lists,
+		const uint8_t *headers, unsigned int num_lists, target_addr_t pxCurrentTCB,
+		unsigned int *tasks_found, uint64_t thread_list_size, bool *consistent)
+{
+	struct FreeRTOS *freertos = (struct FreeRTOS *) rtos->rtos_specific_params;
+	bool reused = false;
+	bool duplicate = false;
+	int retval;
+
+	*consistent = true;
+
+	if (freertos->list_cache_count != num_lists) {
+		FreeRTOS_invalidate_list_cache(freertos);
+		freertos->list_cache = calloc(num_lists, sizeof(*freertos->list_cache));
+		if (!freertos->list_cache) {
+			LOG_ERROR("Error allocating memory for %u lists", num_lists);
+			return ERROR_FAIL;
+		}
+		freertos->list_cache_count = num_lists;
+	}
+	freertos->update_count++;
+
+	unsigned int first_task = *tasks_found;
+	struct FreeRTOS_thread_entry **entries = calloc(thread_list_size, sizeof(*entries));
+	struct FreeRTOS_thread_entry **unnamed = calloc(thread_list_size, sizeof(*unnamed));
+	unsigned int num_unnamed = 0;
+	if (!entries || !unnamed) {
+		LOG_ERROR("Error allocating memory for %" PRIu64 " threads", thread_list_size);
+		retval = ERROR_FAIL;
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < num_lists; i++) {
+		struct FreeRTOS_list_cache *cache = &freertos->list_cache[i];
+		const uint8_t *header = headers + i * freertos->list_width;
+
+		if (list_of_lists[i] == 0)
+			continue;
+
+		bool fresh = !cache->header || cache->address != list_of_lists[i] ||
+			memcmp(cache->header, header, freertos->list_width) != 0;
+		if (fresh) {
+			free(cache->header);
+			free(cache->tcbs);
+			cache->tcbs = NULL;
+			cache->tcb_count = 0;
+			cache->header = NULL;
+
+			target_addr_t *tcbs;
+			unsigned int tcb_count;
+			retval = FreeRTOS_read_list(rtos, header, thread_list_size, &tcbs, &tcb_count);
+			if (retval != ERROR_OK) {
+				free(tcbs);
+				goto out;
+			}
+
+			cache->header = malloc(freertos->list_width);
+			if (!cache->header) {
+				free(tcbs);
+				retval = ERROR_FAIL;
+				goto out;
+			}
+			memcpy(cache->header, header, freertos->list_width);
+			cache->address = list_of_lists[i];
+			cache->tcbs = tcbs;
+			cache->tcb_count = tcb_count;
+		} else {
+			reused = true;
+		}
+		LOG_DEBUG("FreeRTOS: list %u at 0x%" PRIx64 " has %u threads%s",
+				i, list_of_lists[i], cache->tcb_count, fresh ? "" : " (cached)");
+
+		for (unsigned int j = 0; j < cache->tcb_count && *tasks_found < thread_list_size; j++) {
+			target_addr_t tcb = cache->tcbs[j];
+			struct FreeRTOS_thread_entry *value =
+					(struct FreeRTOS_thread_entry *) gl_map_get(freertos->entry_by_tcb, &tcb);
+
+			if (value == NULL) {
+				value = calloc(1, sizeof(struct FreeRTOS_thread_entry));
+				value->tcb = tcb;
+				/* threadid can't be 0. */
+				value->threadid = ++freertos->last_threadid;
+
+				if (gl_map_nx_put(freertos->entry_by_tcb, &value->tcb, value) == -1) {
+					LOG_ERROR("gl_map_nx_put failed");
+					retval = ERROR_FAIL;
+					goto out;
+				}
+				if (gl_map_nx_put(freertos->entry_by_threadid, &value->threadid, value) == -1) {
+					LOG_ERROR("gl_map_nx_put failed");
+					retval = ERROR_FAIL;
+					goto out;
+				}
+			}
+
+			if (value->seen == freertos->update_count)
+				duplicate = true;
+			/* A TCB that wasn't around at the last update may belong to a
+			 * new task, even if it's at the address of an old one. */
+			else if (!value->name || value->seen + 1 != freertos->update_count)
+				unnamed[num_unnamed++] = value;
+			value->seen = freertos->update_count;
+
+			LOG_DEBUG("FreeRTOS: Thread %" PRId64 " has TCB 0x%" TARGET_PRIxADDR,
+					  value->threadid, value->tcb);
+
+			entries[*tasks_found - first_task] = value;
+
+			struct thread_detail *detail = &rtos->thread_details[*tasks_found];
+			detail->threadid = value->threadid;
+			detail->thread_name_str = NULL;
+			detail->exists = true;
+
+			if (value->tcb == pxCurrentTCB) {
+				char running_str[] = "State: Running";
+				rtos->current_thread = value->threadid;
+				detail->extra_info_str = malloc(sizeof(running_str));
+				strcpy(detail->extra_info_str, running_str);
+			} else
+				detail->extra_info_str = NULL;
+
+			(*tasks_found)++;
+		}
+	}
+
+	if (num_unnamed) {
+		retval = FreeRTOS_read_names(rtos, unnamed, num_unnamed);
+		if (retval != ERROR_OK)
+			goto out;
+	}
+
+	for (unsigned int i = first_task; i < *tasks_found; i++)
+		rtos->thread_details[i].thread_name_str = strdup(entries[i - first_task]->name);
+
+	/* the "Current Execution" placeholder, if any, isn't on a list */
+	if (reused && (duplicate || *tasks_found != thread_list_size))
+		*consistent = false;
+
+	retval = ERROR_OK;
+
+out:
+	free(unnamed);
+	free(entries);
+	return retval;
+}
+
 static int FreeRTOS_update_threads(struct rtos *rtos)
 {
 	int retval;
@@ -365,35 +657,37 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 		return ERROR_FAIL;
 	}
 
-	uint64_t thread_list_size;
-	retval = FreeRTOS_read_struct_value(rtos->target,
-										rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
-										0,
-										freertos->ubasetype_size,
-										&thread_list_size);
-	LOG_DEBUG("FreeRTOS: Read uxCurrentNumberOfTasks at 0x%" PRIx64 ", value %" PRIu64,
-										rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
-										thread_list_size);
-
+	/* uxCurrentNumberOfTasks, pxCurrentTCB and uxTopUsedPriority in one go */
+	uint8_t values[3][8];
+	struct target_memory_read reads[3];
+	unsigned int num_reads = 0;
+	FreeRTOS_add_read(reads, &num_reads,
+			rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
+			freertos->ubasetype_size, values[0]);
+	FreeRTOS_add_read(reads, &num_reads,
+			rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
+			freertos->pointer_size, values[1]);
+	if (rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address != 0)
+		FreeRTOS_add_read(reads, &num_reads,
+				rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address,
+				freertos->ubasetype_size, values[2]);
+
+	retval = target_read_memory_batch(rtos->target, reads, num_reads);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("Could not read FreeRTOS thread count from target");
 		return retval;
 	}
 
+	uint64_t thread_list_size = buf_get_u64(values[0], 0, freertos->ubasetype_size * 8);
+	LOG_DEBUG("FreeRTOS: Read uxCurrentNumberOfTasks at 0x%" PRIx64 ", value %" PRIu64,
+										rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
+										thread_list_size);
+
 	/* wipe out previous thread details if any */
 	rtos_free_threadlist(rtos);
 
-	/* read the current thread */
-	target_addr_t pxCurrentTCB;
-	retval = FreeRTOS_read_struct_value(rtos->target,
-										rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
-										0,
-										freertos->pointer_size,
-										&pxCurrentTCB);
-	if (retval != ERROR_OK) {
-		LOG_ERROR("Error reading current thread in FreeRTOS thread list");
-		return retval;
-	}
+	/* the current thread */
+	target_addr_t pxCurrentTCB = buf_get_u64(values[1], 0, freertos->pointer_size * 8);
 	LOG_DEBUG("FreeRTOS: Read pxCurrentTCB at 0x%" PRIx64 ", value 0x%" PRIx64,
 										rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
 										pxCurrentTCB);
@@ -440,13 +734,7 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 		 * into our FreeRTOS source. */
 		top_used_priority = 6;
 	} else {
-		retval = FreeRTOS_read_struct_value(rtos->target,
-											rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address,
-											0,
-											freertos->ubasetype_size,
-											&top_used_priority);
-		if (retval != ERROR_OK)
-			return retval;
+		top_used_priority = buf_get_u64(values[2], 0, freertos->ubasetype_size * 8);
 		LOG_DEBUG("FreeRTOS: Read uxTopUsedPriority at 0x%" PRIx64 ", value %" PRIu64,
 				  rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address,
 				  top_used_priority);
@@ -482,151 +770,54 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xSuspendedTaskList].address;
 	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xTasksWaitingTermination].address;
 
-	rtos->current_thread = 0;
-	for (unsigned int i = 0; i < num_lists; i++) {
-		if (list_of_lists[i] == 0)
-			continue;
-
-		/* Read the number of threads in this list */
-		uint64_t list_thread_count = 0;
-		retval = FreeRTOS_read_struct_value(rtos->target,
-											list_of_lists[i],
-											freertos->list_uxNumberOfItems_offset,
-											freertos->list_uxNumberOfItems_size,
-											&list_thread_count);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading number of threads in FreeRTOS thread list");
-			free(list_of_lists);
-			return retval;
-		}
-		LOG_DEBUG("FreeRTOS: Read thread count for list %u at 0x%" PRIx64 ", value %" PRIu64,
-										i, list_of_lists[i], list_thread_count);
-
-		if (list_thread_count == 0)
-			continue;
-
-		/* Read the location of first list item */
-		target_addr_t prev_list_elem_ptr = -1;
-		target_addr_t list_elem_ptr = 0;
-		retval = FreeRTOS_read_struct_value(rtos->target,
-											list_of_lists[i],
-											freertos->list_next_offset,
-											freertos->list_next_size,
-											&list_elem_ptr);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-			free(list_of_lists);
-			return retval;
-		}
-		LOG_DEBUG("FreeRTOS: Read first item for list %u at 0x%" PRIx64 ", value 0x%" PRIx64,
-				  i, list_of_lists[i] + freertos->list_next_offset, list_elem_ptr);
-
-		while ((list_thread_count > 0) && (list_elem_ptr != 0) &&
-				(list_elem_ptr != prev_list_elem_ptr) &&
-				(tasks_found < thread_list_size)) {
-			/* Get the location of the thread structure. */
-			rtos->thread_details[tasks_found].threadid = 0;
-			target_addr_t tcb;
-			retval = FreeRTOS_read_struct_value(rtos->target,
-												list_elem_ptr,
-												freertos->list_elem_content_offset,
-												freertos->list_elem_content_size,
-												&tcb);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading thread list item object in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-
-			const struct FreeRTOS_thread_entry *value =
-					gl_map_get(freertos->entry_by_tcb, &tcb);
-
-			if (value == NULL) {
-				struct FreeRTOS_thread_entry *new_value = calloc(1, sizeof(struct FreeRTOS_thread_entry));
-				new_value->tcb = tcb;
-				/* threadid can't be 0. */
-				new_value->threadid = ++freertos->last_threadid;
-
-				if (gl_map_nx_put(freertos->entry_by_tcb, &new_value->tcb, new_value) == -1) {
-					LOG_ERROR("gl_map_nx_put failed");
-					return ERROR_FAIL;
-				}
-				if (gl_map_nx_put(freertos->entry_by_threadid, &new_value->threadid, new_value) == -1) {
-					LOG_ERROR("gl_map_nx_put failed");
-					return ERROR_FAIL;
-				}
-				value = new_value;
-			}
-
-			rtos->thread_details[tasks_found].threadid = value->threadid;
-
-			LOG_DEBUG("FreeRTOS: Thread %" PRId64 " has TCB 0x%" TARGET_PRIxADDR
-					  "; read from 0x%" PRIx64,
-					  value->threadid, value->tcb,
-					  list_elem_ptr + freertos->list_elem_content_offset);
-
-			/* get thread name */
-
-			char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
-
-			/* Read the thread name */
-			retval = target_read_buffer(rtos->target,
-					value->tcb + freertos->thread_name_offset,
-					FREERTOS_THREAD_NAME_STR_SIZE,
-					(uint8_t *)&tmp_str);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			tmp_str[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
-			LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx64 ", value '%s'",
-										value->tcb + freertos->thread_name_offset,
-										tmp_str);
-
-			if (tmp_str[0] == '\x00')
-				strcpy(tmp_str, "No Name");
-
-			rtos->thread_details[tasks_found].thread_name_str =
-				malloc(strlen(tmp_str)+1);
-			strcpy(rtos->thread_details[tasks_found].thread_name_str, tmp_str);
-			rtos->thread_details[tasks_found].exists = true;
+	/* All list headers in one batch, the ready lists being one array */
+	uint8_t *headers = calloc(num_lists, freertos->list_width);
+	struct target_memory_read list_reads[6];
+	num_reads = 0;
+	if (!headers) {
+		LOG_ERROR("Error allocating memory for %u lists", num_lists);
+		free(list_of_lists);
+		return ERROR_FAIL;
+	}
+	FreeRTOS_add_read(list_reads, &num_reads, list_of_lists[0],
+			config_max_priorities * freertos->list_width, headers);
+	for (unsigned int i = config_max_priorities; i < num_lists; i++) {
+		if (list_of_lists[i] != 0)
+			FreeRTOS_add_read(list_reads, &num_reads, list_of_lists[i],
+					freertos->list_width, headers + i * freertos->list_width);
+	}
+	retval = target_read_memory_batch(rtos->target, list_reads, num_reads);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error reading FreeRTOS thread list header");
+		free(headers);
+		free(list_of_lists);
+		return retval;
+	}
 
-			if (value->tcb == pxCurrentTCB) {
-				char running_str[] = "State: Running";
-				rtos->current_thread = value->threadid;
-				rtos->thread_details[tasks_found].extra_info_str = malloc(
-						sizeof(running_str));
-				strcpy(rtos->thread_details[tasks_found].extra_info_str,
-					running_str);
-			} else
-				rtos->thread_details[tasks_found].extra_info_str = NULL;
-
-			tasks_found++;
-			list_thread_count--;
-
-			prev_list_elem_ptr = list_elem_ptr;
-			list_elem_ptr = 0;
-			retval = FreeRTOS_read_struct_value(rtos->target,
-												prev_list_elem_ptr,
-												freertos->list_elem_next_offset,
-												freertos->list_elem_next_size,
-												&list_elem_ptr);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading next thread item location in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			LOG_DEBUG("FreeRTOS: Read next thread location at " TARGET_ADDR_FMT
-					  ", value " TARGET_ADDR_FMT,
-					  prev_list_elem_ptr + freertos->list_elem_next_offset,
-					  list_elem_ptr);
+	rtos->current_thread = 0;
+	unsigned int first_task = tasks_found;
+	bool consistent;
+	retval = FreeRTOS_collect_threads(rtos, list_of_lists, headers, num_lists, pxCurrentTCB,
+			&tasks_found, thread_list_size, &consistent);
+	if (retval == ERROR_OK && !consistent) {
+		/* A list changed without changing its header. Start over without
+		 * trusting any cached list. */
+		LOG_DEBUG("FreeRTOS: cached thread lists are stale, reading all of them");
+		for (unsigned int i = first_task; i < tasks_found; i++) {
+			free(rtos->thread_details[i].thread_name_str);
+			free(rtos->thread_details[i].extra_info_str);
 		}
+		tasks_found = first_task;
+		rtos->current_thread = 0;
+		FreeRTOS_invalidate_list_cache(freertos);
+		retval = FreeRTOS_collect_threads(rtos, list_of_lists, headers, num_lists,
+				pxCurrentTCB, &tasks_found, thread_list_size, &consistent);
 	}
 
+	free(headers);
 	free(list_of_lists);
 	rtos->thread_count = tasks_found;
-	return 0;
+	return retval;
 }
 
 static int FreeRTOS_get_stacking_info(struct rtos *rtos, threadid_t thread_id,
@@ -802,10 +993,12 @@ static size_t target_addr_hash(const void *x)
 	return *a;
 }
 
-static void free_const(const void *x)
+static void free_thread_entry(const void *x)
 {
 	/* Cast away const. */
-	free((void *) x);
+	struct FreeRTOS_thread_entry *entry = (struct FreeRTOS_thread_entry *) x;
+	free(entry->name);
+	free(entry);
 }
 
 static int FreeRTOS_create(struct target *target)
@@ -828,7 +1021,7 @@ static int FreeRTOS_create(struct target *target)
 
 	struct FreeRTOS *freertos = (struct FreeRTOS *) target->rtos->rtos_specific_params;
 	freertos->entry_by_threadid = gl_map_nx_create_empty(
-		GL_LINKEDHASH_MAP, target_addr_equals, target_addr_hash, NULL, free_const);
+		GL_LINKEDHASH_MAP, target_addr_equals, target_addr_hash, NULL, free_thread_entry);
 	if (freertos->entry_by_threadid == NULL) {
 		LOG_ERROR("gl_map_nx_create_empty failed");
 		return ERROR_FAIL;
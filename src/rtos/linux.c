@@ -98,6 +98,9 @@ static int insert_into_threadlist(struct target *target, struct threads *t);
 
 static int linux_os_create(struct target *target);
 
+/* only list the tasks currently running on a core, see linux_running_only */
+static bool linux_running_only;
+
 static int linux_os_dummy_update(struct rtos *rtos)
 {
 	/*  update is done only when thread request come
@@ -128,20 +131,12 @@ static int linux_read_memory(struct target *target,
 	uint32_t address, uint32_t size, uint32_t count,
 	uint8_t *buffer)
 {
-#ifdef PHYS
-	struct linux_os *linux_os = (struct linux_os *)
-		target->rtos->rtos_specific_params;
-	uint32_t pa = (address & linux_os->phys_mask) + linux_os->phys_base;
-#endif
 	if (address < 0xc000000) {
 		LOG_ERROR("linux awareness : address in user space");
 		return ERROR_FAIL;
 	}
-#ifdef PHYS
-	target_read_phys_memory(target, pa, size, count, buffer);
-#endif
-	target_read_memory(target, address, size, count, buffer);
-	return ERROR_OK;
+	/*  the result of an extra physical read was thrown away anyway */
+	return target_read_memory(target, address, size, count, buffer);
 }
 
 static int fill_buffer(struct target *target, uint32_t addr, uint8_t *buffer)
@@ -163,6 +158,59 @@ static uint32_t get_buffer(struct target *target, const uint8_t *buffer)
 	return value;
 }
 
+/*
+ * Registers of a task that isn't running, from the cpu_context saved in its
+ * thread_info. The context is only read here, when GDB asks for it, and kept
+ * until the next task list update.
+ */
+static int linux_os_saved_reg_list(struct rtos *rtos,
+	int64_t thread_id, struct rtos_reg **reg_list, int *num_regs)
+{
+	struct target *target = rtos->target;
+	struct linux_os *linux_os = (struct linux_os *)
+		target->rtos->rtos_specific_params;
+	struct threads *t = linux_os->thread_list;
+
+	while (t != NULL && (t->threadid != thread_id || !t->status))
+		t = t->next;
+
+	if (t == NULL) {
+		LOG_ERROR("could not find thread: %" PRIx64, thread_id);
+		return ERROR_FAIL;
+	}
+
+	if (!t->context)
+		t->context = cpu_context_read(target, t->base_addr,
+				&t->thread_info_addr);
+
+	/*  r0-r3 are not saved on a context switch */
+	const uint32_t values[16] = {
+		[4] = t->context->R4,
+		[5] = t->context->R5,
+		[6] = t->context->R6,
+		[7] = t->context->R7,
+		[8] = t->context->R8,
+		[9] = t->context->R9,
+		[11] = t->context->FP,
+		[12] = t->context->IP,
+		[13] = t->context->SP,
+		[15] = t->context->PC,
+	};
+
+	*num_regs = ARRAY_SIZE(values);
+	*reg_list = calloc(*num_regs, sizeof(struct rtos_reg));
+	if (!*reg_list)
+		return ERROR_FAIL;
+
+	for (int i = 0; i < *num_regs; ++i) {
+		(*reg_list)[i].number = i;
+		(*reg_list)[i].size = 32;
+		target_buffer_set_u32(target, (*reg_list)[i].value, values[i]);
+	}
+
+	return ERROR_OK;
+}
+
 static int linux_os_thread_reg_list(struct rtos *rtos,
 	int64_t thread_id, struct rtos_reg **reg_list, int *num_regs)
 {
@@ -183,10 +231,8 @@ static int linux_os_thread_reg_list(struct rtos *rtos,
 			next = next->next;
 	} while ((found == 0) && (next != tmp) && (next != NULL));
 
-	if (found == 0) {
-		LOG_ERROR("could not find thread: %" PRIx64, thread_id);
-		return ERROR_FAIL;
-	}
+	if (found == 0)
+		return linux_os_saved_reg_list(rtos, thread_id, reg_list, num_regs);
 
 	/*  search target to perform the access  */
 	struct reg **gdb_reg_list;
@@ -293,106 +339,93 @@ int fill_task_pid(struct target *target, struct threads *t)
 }
 #endif
 
-static int fill_task(struct target *target, struct threads *t)
-{
-	int retval;
-	uint32_t pid_addr = t->base_addr + PID;
-	uint32_t mem_addr = t->base_addr + MEM;
-	uint32_t on_cpu = t->base_addr + ONCPU;
-	uint8_t *buffer = calloc(1, 4);
-	retval = fill_buffer(target, t->base_addr, buffer);
-
-	if (retval == ERROR_OK) {
-		uint32_t val = get_buffer(target, buffer);
-		t->state = val;
-	} else
-		LOG_ERROR("fill_task: unable to read memory");
-
-	retval = fill_buffer(target, pid_addr, buffer);
+/* Fields of a task_struct read by fill_task(), in batch order */
+enum {
+	TASK_STATE,
+	TASK_PID,
+	TASK_ONCPU,
+	TASK_MM,
+	TASK_NEXT,
+	TASK_COMM,
+	TASK_NUM_READS
+};
 
-	if (retval == ERROR_OK) {
-		uint32_t val = get_buffer(target, buffer);
-		t->pid = val;
-	} else
-		LOG_ERROR("fill task: unable to read memory");
+/*
+ * Read the state, pid, on_cpu, mm, tasks.next and comm fields of t in one
+ * batch, then the ASID if it has an mm. The address of the next task goes to
+ * next, if that isn't NULL.
+ */
+static int fill_task(struct target *target, struct threads *t, uint32_t *next)
+{
+	static const uint32_t offsets[TASK_NUM_READS] = {
+		[TASK_STATE] = 0,
+		[TASK_PID] = PID,
+		[TASK_ONCPU] = ONCPU,
+		[TASK_MM] = MEM,
+		[TASK_NEXT] = NEXT,
+		[TASK_COMM] = COMM,
+	};
+	uint8_t values[TASK_NUM_READS - 1][4];
+	uint8_t comm[16];
+	struct target_memory_read reads[TASK_NUM_READS];
+
+	if (t->base_addr < 0xc000000) {
+		LOG_ERROR("linux awareness : address in user space");
+		return ERROR_FAIL;
+	}
 
-	retval = fill_buffer(target, on_cpu, buffer);
+	for (unsigned int i = 0; i < TASK_NUM_READS; i++) {
+		reads[i].address = t->base_addr + offsets[i];
+		reads[i].size = 4;
+		reads[i].count = i == TASK_COMM ? sizeof(comm) / 4 : 1;
+		reads[i].buffer = i == TASK_COMM ? comm : values[i];
+	}
 
-	if (retval == ERROR_OK) {
-		uint32_t val = get_buffer(target, buffer);
-		t->oncpu = val;
-	} else
+	int retval = target_read_memory_batch(target, reads, TASK_NUM_READS);
+	if (retval != ERROR_OK) {
 		LOG_ERROR("fill task: unable to read memory");
+		return retval;
+	}
 
-	retval = fill_buffer(target, mem_addr, buffer);
-
-	if (retval == ERROR_OK) {
-		uint32_t val = get_buffer(target, buffer);
-
-		if (val != 0) {
-			uint32_t asid_addr = val + MM_CTX;
-			retval = fill_buffer(target, asid_addr, buffer);
+	t->state = get_buffer(target, values[TASK_STATE]);
+	t->pid = get_buffer(target, values[TASK_PID]);
+	t->oncpu = get_buffer(target, values[TASK_ONCPU]);
+	memcpy(t->name, comm, sizeof(comm));
+	t->name[16] = 0;
+	if (next)
+		*next = get_buffer(target, values[TASK_NEXT]) - NEXT;
 
-			if (retval == ERROR_OK) {
-				val = get_buffer(target, buffer);
-				t->asid = val;
-			} else
-				LOG_ERROR
-					("fill task: unable to read memory -- ASID");
-		} else
-			t->asid = 0;
-	} else
-		LOG_ERROR("fill task: unable to read memory");
+	uint32_t mm = get_buffer(target, values[TASK_MM]);
+	t->asid = 0;
+	if (mm != 0) {
+		uint8_t buffer[4];
+		retval = fill_buffer(target, mm + MM_CTX, buffer);
 
-	free(buffer);
+		if (retval == ERROR_OK)
+			t->asid = get_buffer(target, buffer);
+		else
+			LOG_ERROR("fill task: unable to read memory -- ASID");
+	}
 
 	return retval;
 }
 
 static int get_name(struct target *target, struct threads *t)
 {
-	int retval;
-	uint32_t full_name[4];
-	uint32_t comm = t->base_addr + COMM;
-	int i;
+	uint8_t comm[16];
 
-	for (i = 0; i < 17; i++)
-		t->name[i] = 0;
+	memset(t->name, 0, sizeof(t->name));
 
-	retval = linux_read_memory(target, comm, 4, 4, (uint8_t *) full_name);
+	int retval = linux_read_memory(target, t->base_addr + COMM, 4,
+			sizeof(comm) / 4, comm);
 
 	if (retval != ERROR_OK) {
 		LOG_ERROR("get_name: unable to read memory\n");
 		return ERROR_FAIL;
 	}
 
-	uint32_t raw_name = target_buffer_get_u32(target,
-			(const uint8_t *)
-			&full_name[0]);
-	t->name[3] = raw_name >> 24;
-	t->name[2] = raw_name >> 16;
-	t->name[1] = raw_name >> 8;
-	t->name[0] = raw_name;
-	raw_name =
-		target_buffer_get_u32(target, (const uint8_t *)&full_name[1]);
-	t->name[7] = raw_name >> 24;
-	t->name[6] = raw_name >> 16;
-	t->name[5] = raw_name >> 8;
-	t->name[4] = raw_name;
-	raw_name =
-		target_buffer_get_u32(target, (const uint8_t *)&full_name[2]);
-	t->name[11] = raw_name >> 24;
-	t->name[10] = raw_name >> 16;
-	t->name[9] = raw_name >> 8;
-	t->name[8] = raw_name;
-	raw_name =
-		target_buffer_get_u32(target, (const uint8_t *)&full_name[3]);
-	t->name[15] = raw_name >> 24;
-	t->name[14] = raw_name >> 16;
-	t->name[13] = raw_name >> 8;
-	t->name[12] = raw_name;
+	memcpy(t->name, comm, sizeof(comm));
 	return ERROR_OK;
-
 }
 
 static int get_current(struct target *target, int create)
@@ -458,8 +491,7 @@ static int get_current(struct target *target, int create)
 					struct threads *t;
 					t = calloc(1, sizeof(struct threads));
 					t->base_addr = ct->TS;
-					fill_task(target, t);
-					get_name(target, t);
+					fill_task(target, t, NULL);
 					t->oncpu = cpu;
 					insert_into_threadlist(target, t);
 					t->status = 3;
@@ -683,7 +715,7 @@ static int current_base_addr(struct linux_os *linux_os, uint32_t base_addr)
 	return 0;
 }
 
-static int linux_get_tasks(struct target *target, int context)
+static int linux_get_tasks(struct target *target)
 {
 	int loop = 0;
 	int retval = 0;
@@ -705,11 +737,12 @@ static int linux_get_tasks(struct target *target, int context)
 	/* retrieve the thread id , currently running in the different smp core */
 	get_current(target, 1);
 
-	while (((t->base_addr != linux_os->init_task_addr) &&
-		(t->base_addr != 0)) || (loop == 0)) {
+	/*  in running only mode the current threads are all there is */
+	while (!linux_running_only && (((t->base_addr != linux_os->init_task_addr) &&
+		(t->base_addr != 0)) || (loop == 0))) {
+		uint32_t base_addr = 0;
 		loop++;
-		fill_task(target, t);
-		retval = get_name(target, t);
+		retval = fill_task(target, t, &base_addr);
 
 		if (loop > MAX_THREADS) {
 			free(t);
@@ -724,7 +757,6 @@ static int linux_get_tasks(struct target *target, int context)
 
 		/*  check that this thread is not one the current threads already
 		 *  created */
-		uint32_t base_addr;
 #ifdef PID_CHECK
 
 		if (!current_pid(linux_os, t->pid)) {
@@ -740,15 +772,8 @@ static int linux_get_tasks(struct target *target, int context)
 			/* no interest to fill the context if it is a current thread. */
 			linux_os->thread_count++;
 			t->thread_info_addr = 0xdeadbeef;
-
-			if (context)
-				t->context =
-					cpu_context_read(target, t->base_addr,
-						&t->thread_info_addr);
-			base_addr = next_task(target, t);
 		} else {
 			/*LOG_INFO("thread %s is a current thread already created",t->name); */
-			base_addr = next_task(target, t);
 			free(t);
 		}
 
@@ -871,10 +896,9 @@ error_handling:
 
 			if (!found) {
 				/*  it is a new thread */
-				if (fill_task(target, t) != ERROR_OK)
+				if (fill_task(target, t, NULL) != ERROR_OK)
 					goto error_handling;
 
-				get_name(target, t);
 				insert_into_threadlist(target, t);
 				t->thread_info_addr = 0xdeadbeef;
 			}
@@ -916,7 +940,7 @@ error_handling:
 #endif
 }
 
-static int linux_task_update(struct target *target, int context)
+static int linux_task_update(struct target *target)
 {
 	struct linux_os *linux_os = (struct linux_os *)
 		target->rtos->rtos_specific_params;
@@ -949,8 +973,11 @@ static int linux_task_update(struct target *target, int context)
 	/*check that all current threads have been identified  */
 	linux_identify_current_threads(target);
 
-	while (((t->base_addr != linux_os->init_task_addr) &&
-		(t->base_addr != previous)) || (loop == 0)) {
+	/*  known tasks only cost their next pointer, new ones are read in a
+	 *  single batch; in running only mode the walk is skipped and the
+	 *  tasks not running are left dead */
+	while (!linux_running_only && (((t->base_addr != linux_os->init_task_addr) &&
+		(t->base_addr != previous)) || (loop == 0))) {
 		/*  for avoiding any permanent loop for any reason possibly due to
 		 *  target */
 		loop++;
@@ -988,11 +1015,6 @@ static int linux_task_update(struct target *target, int context)
 					thread_list->oncpu = t->oncpu;
 					thread_list->asid = t->asid;
 					*/
-					if (context)
-						thread_list->context =
-							cpu_context_read(target,
-								thread_list->base_addr,
-								&thread_list->thread_info_addr);
 				} else {
 					/*  it is a current thread no need to read context */
 				}
@@ -1007,18 +1029,11 @@ static int linux_task_update(struct target *target, int context)
 		}
 
 		if (found == 0) {
-			uint32_t base_addr;
-			fill_task(target, t);
-			get_name(target, t);
+			uint32_t base_addr = 0;
+			fill_task(target, t, &base_addr);
 			retval = insert_into_threadlist(target, t);
 			t->thread_info_addr = 0xdeadbeef;
 
-			if (context)
-				t->context =
-					cpu_context_read(target, t->base_addr,
-						&t->thread_info_addr);
-
-			base_addr = next_task(target, t);
 			t = calloc(1, sizeof(struct threads));
 			t->base_addr = base_addr;
 			linux_os->thread_count++;
@@ -1027,7 +1042,7 @@ static int linux_task_update(struct target *target, int context)
 	}
 
 	LOG_INFO("update thread done %" PRId64 ", mean%" PRId64 "\n",
-		(timeval_ms() - start), (timeval_ms() - start) / loop);
+		(timeval_ms() - start), (timeval_ms() - start) / (loop ? loop : 1));
 	free(t);
 	linux_os->threads_needs_update = 0;
 	return ERROR_OK;
@@ -1048,7 +1063,7 @@ static int linux_gdb_thread_packet(struct target *target,
 		return ERROR_OK;
 	}
 
-	retval = linux_get_tasks(target, 1);
+	retval = linux_get_tasks(target);
 
 	if (retval != ERROR_OK)
 		return ERROR_TARGET_FAILURE;
@@ -1202,7 +1217,7 @@ static int linux_gdb_T_packet(struct connection *connection,
 		return ERROR_OK;
 
 	} else {
-		retval = linux_task_update(target, 1);
+		retval = linux_task_update(target);
 		struct threads *temp = linux_os->thread_list;
 
 		while (temp != NULL) {
@@ -1421,6 +1436,31 @@ static int linux_os_smp_init(struct target *target)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_linux_running_only_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], linux_running_only);
+
+	command_print(CMD, "linux_running_only %s",
+		linux_running_only ? "on" : "off");
+	return ERROR_OK;
+}
+
+static const struct command_registration linux_commands[] = {
+	{
+		.name = "linux_running_only",
+		.handler = handle_linux_running_only_command,
+		.mode = COMMAND_ANY,
+		.usage = "['on'|'off']",
+		.help = "Only list the tasks running on a core instead of walking "
+			"the whole kernel task list.",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
 static int linux_os_create(struct target *target)
 {
 	struct linux_os *os_linux = calloc(1, sizeof(struct linux_os));
@@ -1447,6 +1487,7 @@ static int linux_os_create(struct target *target)
 	/*  initialize a default virt 2 phys translation */
 	os_linux->phys_mask = ~0xc0000000;
 	os_linux->phys_base = 0x0;
+	register_commands(target->rtos->cmd_ctx, NULL, linux_commands);
 	return JIM_OK;
 }
 
@@ -1458,10 +1499,10 @@ static char *linux_ps_command(struct target *target)
 	char *display;
 
 	if (linux_os->threads_lookup == 0)
-		retval = linux_get_tasks(target, 1);
+		retval = linux_get_tasks(target);
 	else {
 		if (linux_os->threads_needs_update != 0)
-			retval = linux_task_update(target, 0);
+			retval = linux_task_update(target);
 	}
 
 	if (retval == ERROR_OK) {
@@ -1479,20 +1520,12 @@ static char *linux_ps_command(struct target *target)
 		tmp += sprintf(tmp, "---\t\t---\t\t----\t\t----\n");
 
 		while (temp != NULL) {
-			if (temp->status) {
-				if (temp->context)
-					tmp +=
-						sprintf(tmp,
-							"%" PRIu32 "\t\t%" PRIu32 "\t\t%" PRIx32 "\t\t%s\n",
-							temp->pid, temp->oncpu,
-							temp->asid, temp->name);
-				else
-					tmp +=
-						sprintf(tmp,
-							"%" PRIu32 "\t\t%" PRIu32 "\t\t%" PRIx32 "\t\t%s\n",
-							temp->pid, temp->oncpu,
-							temp->asid, temp->name);
-			}
+			if (temp->status)
+				tmp +=
+					sprintf(tmp,
+						"%" PRIu32 "\t\t%" PRIu32 "\t\t%" PRIx32 "\t\t%s\n",
+						temp->pid, temp->oncpu,
+						temp->asid, temp->name);
 
 			temp = temp->next;
 		}
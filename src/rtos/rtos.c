@@ -58,6 +58,7 @@ static struct rtos_type *rtos_types[] = {
 };
 
 static int rtos_try_next(struct target *target);
+static void rtos_prefetch_stack_frames(struct rtos *rtos);
 
 int rtos_thread_packet(struct connection *connection, const char *packet, int packet_size);
 
@@ -91,6 +92,7 @@ static int os_alloc(struct target *target, struct rtos_type *ostype,
 	os->current_threadid = -1;
 	os->current_thread = 0;
 	os->symbols = NULL;
+	os->symbol_check = -1;
 	os->target = target;
 
 	/* RTOS drivers can override the packet handler in _create(). */
@@ -107,6 +109,7 @@ static void os_free(struct target *target)
 	if (!target->rtos)
 		return;
 
+	rtos_free_stack_frames(target->rtos);
 	free(target->rtos->symbols);
 	free(target->rtos);
 	target->rtos = NULL;
@@ -184,6 +187,25 @@ int gdb_thread_packet(struct connection *connection, char const *packet, int pac
 	return target->rtos->gdb_thread_packet(connection, packet, packet_size);
 }
 
+/* The symbol to ask for after @a s (or first, for NULL): all mandatory ones
+ * in list order, then the optional ones, so that auto-detect gives up on an
+ * RTOS as soon as possible. Returns the list terminator when done. */
+static symbol_table_elem_t *symbol_after(struct rtos *os, symbol_table_elem_t *s)
+{
+	bool optional = s ? s->optional : false;
+	s = s ? s + 1 : os->symbols;
+
+	for (;;) {
+		for (; s->symbol_name; s++)
+			if (s->optional == optional)
+				return s;
+		if (optional)
+			return s;
+		optional = true;
+		s = os->symbols;
+	}
+}
+
 static symbol_table_elem_t *next_symbol(struct rtos *os, char *cur_symbol, uint64_t cur_addr)
 {
 	symbol_table_elem_t *s;
@@ -192,18 +214,33 @@ static symbol_table_elem_t *next_symbol(struct rtos *os, char *cur_symbol, uint6
 		os->type->get_symbol_list_to_lookup(&os->symbols);
 
 	if (!cur_symbol[0])
-		return &os->symbols[0];
+		return symbol_after(os, NULL);
 
 	for (s = os->symbols; s->symbol_name; s++)
 		if (!strcmp(s->symbol_name, cur_symbol)) {
 			s->address = cur_addr;
-			s++;
-			return s;
+			return symbol_after(os, s);
 		}
 
 	return NULL;
 }
 
+/* Index of the next symbol to check against an earlier lookup, after
+ * @a check: the first one asked for, then the last one GDB found. -1 when
+ * there's nothing else to check. */
+static int symbol_check_after(struct rtos *os, int check)
+{
+	int first = symbol_after(os, NULL) - os->symbols;
+	if (check < 0)
+		return os->symbols[first].symbol_name ? first : -1;
+
+	int last = -1;
+	for (int i = 0; os->symbols[i].symbol_name; i++)
+		if (os->symbols[i].address)
+			last = i;
+	return last > check ? last : -1;
+}
+
 /* searches for 'symbol' in the lookup table for 'os' and returns TRUE,
  * if 'symbol' is not declared optional */
 static bool is_symbol_mandatory(const struct rtos *os, const char *symbol)
@@ -253,6 +290,42 @@ int rtos_qsymbol(struct connection *connection, char const *packet, int packet_s
 	size_t len = unhexify((uint8_t *)cur_sym, strchr(packet + 8, ':') + 1, strlen(strchr(packet + 8, ':') + 1));
 	cur_sym[len] = 0;
 
+	if (strcmp(packet, "qSymbol::") == 0) {
+		os->symbol_check = -1;
+		if (os->symbols_valid) {
+			/* Probably the same file as last time, check that */
+			os->symbol_check = symbol_check_after(os, -1);
+			if (os->symbol_check >= 0) {
+				next_sym = &os->symbols[os->symbol_check];
+				goto ask;
+			}
+		}
+	} else if (os->symbol_check >= 0) {
+		symbol_table_elem_t *check = &os->symbols[os->symbol_check];
+		if (!strcmp(cur_sym, check->symbol_name) &&
+				sscanf(packet, "qSymbol:%" SCNx64 ":", &addr) == 1 &&
+				(symbol_address_t)addr == check->address) {
+			os->symbol_check = symbol_check_after(os, os->symbol_check);
+			if (os->symbol_check >= 0) {
+				next_sym = &os->symbols[os->symbol_check];
+				goto ask;
+			}
+			LOG_DEBUG("RTOS %s: symbols unchanged since the last lookup", os->type->name);
+			rtos_detected = 1;
+			goto done;
+		}
+
+		/* A different file, look everything up again */
+		os->symbols_valid = false;
+		os->symbol_check = -1;
+		for (symbol_table_elem_t *s = os->symbols; s->symbol_name; s++)
+			s->address = 0;
+		addr = 0;
+		cur_sym[0] = '\x00';
+		next_sym = next_symbol(os, cur_sym, addr);
+		goto ask;
+	}
+
 	if ((strcmp(packet, "qSymbol::") != 0) &&               /* GDB is not offering symbol lookup for the first time */
 	    (!sscanf(packet, "qSymbol:%" SCNx64 ":", &addr)) && /* GDB did not find an address for a symbol */
 	    is_symbol_mandatory(os, cur_sym)) {					/* the symbol is mandatory for this RTOS */
@@ -278,12 +351,14 @@ int rtos_qsymbol(struct connection *connection, char const *packet, int packet_s
 		/* No more symbols need looking up */
 
 		if (!target->rtos_auto_detect) {
+			os->symbols_valid = true;
 			rtos_detected = 1;
 			goto done;
 		}
 
 		if (os->type->detect_rtos(target)) {
 			LOG_INFO("Auto-detected RTOS: %s", os->type->name);
+			os->symbols_valid = true;
 			rtos_detected = 1;
 			goto done;
 		} else {
@@ -292,6 +367,7 @@ int rtos_qsymbol(struct connection *connection, char const *packet, int packet_s
 		}
 	}
 
+ask:
 	if (8 + (strlen(next_sym->symbol_name) * 2) + 1 > sizeof(reply)) {
 		LOG_ERROR("ERROR: RTOS symbol '%s' name is too long for GDB!", next_sym->symbol_name);
 		goto done;
@@ -496,6 +572,8 @@ int rtos_get_gdb_reg(struct connection *connection, int reg_num)
 										current_threadid,
 										target->rtos->current_thread);
 
+		rtos_prefetch_stack_frames(target->rtos);
+
 		int retval;
 		if (target->rtos->type->get_thread_reg) {
 			reg_list = calloc(1, sizeof(*reg_list));
@@ -548,6 +626,8 @@ int rtos_get_gdb_reg_list(struct connection *connection)
 										current_threadid,
 										target->rtos->current_thread);
 
+		rtos_prefetch_stack_frames(target->rtos);
+
 		int retval = target->rtos->type->get_thread_reg_list(target->rtos,
 				current_threadid,
 				&reg_list,
@@ -579,6 +659,150 @@ int rtos_set_reg(struct connection *connection, int reg_num,
 	return ERROR_FAIL;
 }
 
+void rtos_free_stack_frames(struct rtos *rtos)
+{
+	for (unsigned int i = 0; i < rtos->stack_frame_count; i++)
+		free(rtos->stack_frames[i].data);
+	free(rtos->stack_frames);
+	rtos->stack_frames = NULL;
+	rtos->stack_frame_count = 0;
+	rtos->stack_frames_prefetched = false;
+}
+
+static target_addr_t rtos_stack_frame_address(const struct rtos_register_stacking *stacking,
+		target_addr_t stack_ptr)
+{
+	if (stacking->stack_growth_direction == 1)
+		return stack_ptr - stacking->stack_registers_size;
+	return stack_ptr;
+}
+
+static struct rtos_stack_frame *rtos_find_stack_frame(struct rtos *rtos,
+		target_addr_t address, uint32_t size)
+{
+	for (unsigned int i = 0; i < rtos->stack_frame_count; i++) {
+		struct rtos_stack_frame *frame = &rtos->stack_frames[i];
+		if (address >= frame->address &&
+				address + size <= frame->address + frame->size)
+			return frame;
+	}
+	return NULL;
+}
+
+static int rtos_add_stack_frame(struct rtos *rtos, target_addr_t address,
+		uint32_t size, const uint8_t *data)
+{
+	struct rtos_stack_frame *frames = realloc(rtos->stack_frames,
+			(rtos->stack_frame_count + 1) * sizeof(*frames));
+	if (!frames)
+		return ERROR_FAIL;
+	rtos->stack_frames = frames;
+
+	uint8_t *copy = malloc(size);
+	if (!copy)
+		return ERROR_FAIL;
+	memcpy(copy, data, size);
+
+	frames[rtos->stack_frame_count].address = address;
+	frames[rtos->stack_frame_count].size = size;
+	frames[rtos->stack_frame_count].data = copy;
+	rtos->stack_frame_count++;
+	return ERROR_OK;
+}
+
+/* Read a stack frame, from the frames read since the last stop if possible.
+ * GDB asks for the registers of a thread one at a time, and for every thread
+ * in turn on "thread apply all bt". */
+static int rtos_read_stack_frame(struct target *target, target_addr_t address,
+		uint32_t size, uint8_t *buffer)
+{
+	struct rtos *rtos = target->rtos;
+
+	if (rtos) {
+		struct rtos_stack_frame *frame = rtos_find_stack_frame(rtos, address, size);
+		if (frame) {
+			memcpy(buffer, frame->data + (address - frame->address), size);
+			return ERROR_OK;
+		}
+	}
+
+	int retval = target_read_buffer(target, address, size, buffer);
+	if (retval != ERROR_OK)
+		return retval;
+	LOG_DEBUG("RTOS: Read stack frame at " TARGET_ADDR_FMT, address);
+
+	if (rtos)
+		rtos_add_stack_frame(rtos, address, size, buffer);
+	return ERROR_OK;
+}
+
+static int rtos_frame_compare(const void *a, const void *b)
+{
+	const struct rtos_stack_frame *fa = a, *fb = b;
+	if (fa->address < fb->address)
+		return -1;
+	return fa->address > fb->address;
+}
+
+/* Frames this close together are read with a single access */
+#define RTOS_STACK_FRAME_MAX_GAP 64
+
+/* The first time registers of a thread other than the current one are
+ * asked for after a stop, read the frames of all threads. Frames that
+ * are adjacent in memory are read together. */
+static void rtos_prefetch_stack_frames(struct rtos *rtos)
+{
+	if (rtos->stack_frames_prefetched || !rtos->type->get_stacking_info)
+		return;
+	rtos->stack_frames_prefetched = true;
+
+	struct rtos_stack_frame *wanted = calloc(rtos->thread_count, sizeof(*wanted));
+	if (!wanted)
+		return;
+
+	unsigned int count = 0;
+	for (int i = 0; i < rtos->thread_count; i++) {
+		const struct rtos_register_stacking *stacking;
+		target_addr_t stack_ptr;
+
+		if (rtos->thread_details[i].threadid == rtos->current_thread)
+			continue;
+		if (rtos->type->get_stacking_info(rtos, rtos->thread_details[i].threadid,
+					&stacking, &stack_ptr) != ERROR_OK || stack_ptr == 0)
+			continue;
+
+		target_addr_t address = rtos_stack_frame_address(stacking, stack_ptr);
+		if (rtos_find_stack_frame(rtos, address, stacking->stack_registers_size))
+			continue;
+		wanted[count].address = address;
+		wanted[count].size = stacking->stack_registers_size;
+		count++;
+	}
+
+	qsort(wanted, count, sizeof(*wanted), rtos_frame_compare);
+
+	for (unsigned int first = 0; first < count; ) {
+		target_addr_t start = wanted[first].address;
+		target_addr_t end = start + wanted[first].size;
+		unsigned int last = first + 1;
+		while (last < count && wanted[last].address <= end + RTOS_STACK_FRAME_MAX_GAP) {
+			end = MAX(end, wanted[last].address + wanted[last].size);
+			last++;
+		}
+
+		uint8_t *data = malloc(end - start);
+		if (data && target_read_buffer(rtos->target, start, end - start, data) == ERROR_OK) {
+			LOG_DEBUG("RTOS: Read %u stack frames at " TARGET_ADDR_FMT,
+					last - first, start);
+			rtos_add_stack_frame(rtos, start, end - start, data);
+		}
+		free(data);
+		first = last;
+	}
+
+	free(wanted);
+}
+
 int rtos_generic_stack_read(struct target *target,
 	const struct rtos_register_stacking *stacking,
 	target_addr_t stack_ptr,
@@ -593,17 +817,14 @@ int rtos_generic_stack_read(struct target *target,
 	}
 	/* Read the stack */
 	uint8_t *stack_data = malloc(stacking->stack_registers_size);
-	target_addr_t address = stack_ptr;
+	target_addr_t address = rtos_stack_frame_address(stacking, stack_ptr);
 
-	if (stacking->stack_growth_direction == 1)
-		address -= stacking->stack_registers_size;
-	retval = target_read_buffer(target, address, stacking->stack_registers_size, stack_data);
+	retval = rtos_read_stack_frame(target, address, stacking->stack_registers_size, stack_data);
 	if (retval != ERROR_OK) {
 		free(stack_data);
 		LOG_ERROR("Error reading stack frame from thread");
 		return retval;
 	}
-	LOG_DEBUG("RTOS: Read stack frame at " TARGET_ADDR_FMT, address);
 
 #if 0
 		LOG_OUTPUT("Stack Data :");
@@ -667,15 +888,19 @@ int rtos_generic_stack_read_reg(struct target *target,
 
 	unsigned width_bytes = DIV_ROUND_UP(offsets->width_bits, 8);
 	if (offsets->offset >= 0) {
-		target_addr_t address = stack_ptr;
+		target_addr_t address = rtos_stack_frame_address(stacking, stack_ptr);
 
-		if (stacking->stack_growth_direction == 1)
-			address -= stacking->stack_registers_size;
-
-		if (target_read_buffer(
-				target, address + offsets->offset,
-				width_bytes, reg->value) != ERROR_OK)
+		/* read the whole frame, the other registers are likely next */
+		uint8_t *stack_data = malloc(stacking->stack_registers_size);
+		if (!stack_data)
+			return ERROR_FAIL;
+		if (rtos_read_stack_frame(target, address,
+				stacking->stack_registers_size, stack_data) != ERROR_OK) {
+			free(stack_data);
 			return ERROR_FAIL;
+		}
+		memcpy(reg->value, stack_data + offsets->offset, width_bytes);
+		free(stack_data);
 		LOG_DEBUG("register %d has value 0x%" PRIx64, reg->number,
 				  buf_get_u64(reg->value, 0, 64));
 	} else {
@@ -718,6 +943,14 @@ int rtos_generic_stack_write_reg(struct target *target,
 				target, address + offsets->offset,
 				width_bytes, reg_value) != ERROR_OK)
 			return ERROR_FAIL;
+
+		if (target->rtos) {
+			struct rtos_stack_frame *frame = rtos_find_stack_frame(target->rtos,
+					address + offsets->offset, width_bytes);
+			if (frame)
+				memcpy(frame->data + (address + offsets->offset - frame->address),
+						reg_value, width_bytes);
+		}
 	} else if (offsets->offset == -1) {
 		/* This register isn't on the stack, but is listed as one of those. We
 		 * read it as 0, and ignore writes. */
@@ -755,14 +988,17 @@ static int rtos_try_next(struct target *target)
 
 	free(os->symbols);
 	os->symbols = NULL;
+	os->symbols_valid = false;
 
 	return 1;
 }
 
 int rtos_update_threads(struct target *target)
 {
-	if ((target->rtos != NULL) && (target->rtos->type != NULL))
+	if ((target->rtos != NULL) && (target->rtos->type != NULL)) {
+		rtos_free_stack_frames(target->rtos);
 		target->rtos->type->update_threads(target->rtos);
+	}
 	return ERROR_OK;
 }
 
@@ -802,6 +1038,8 @@ int rtos_read_buffer(struct target *target, target_addr_t address,
 int rtos_write_buffer(struct target *target, target_addr_t address,
 		uint32_t size, const uint8_t *buffer)
 {
+	/* the write may hit a saved context */
+	rtos_free_stack_frames(target->rtos);
 	if (target->rtos->type->write_buffer)
 		return target->rtos->type->write_buffer(target->rtos, address, size, buffer);
 	return ERROR_NOT_IMPLEMENTED;
@@ -27,6 +27,7 @@ typedef int64_t threadid_t;
 typedef int64_t symbol_address_t;
 
 struct reg;
+struct rtos_register_stacking;
 
 /**
  * Table should be terminated by an element with NULL in symbol_name
@@ -44,10 +45,23 @@ struct thread_detail {
 	char *extra_info_str;
 };
 
+/* A thread's saved registers, as read from its stack. */
+struct rtos_stack_frame {
+	target_addr_t address;
+	uint32_t size;
+	uint8_t *data;
+};
+
 struct rtos {
 	const struct rtos_type *type;
 
 	symbol_table_elem_t *symbols;
+	/* Set when GDB has looked up all of symbols. A later lookup (GDB
+	 * reconnecting, or loading the same file again) only asks for a couple
+	 * of them again, and keeps the rest if those are still the same. */
+	bool symbols_valid;
+	/* Which of symbols the lookup in progress is checking, or -1. */
+	int symbol_check;
 	struct target *target;
 	/*  add a context variable instead of global variable */
 	/* The thread currently selected by gdb. */
@@ -62,6 +76,11 @@ struct rtos {
 	void *rtos_specific_params;
 	/* Populated in rtos.c, so that individual RTOSes can register commands. */
 	struct command_context *cmd_ctx;
+	/* Stack frames read since the target halted, dropped when the thread list
+	 * is updated or memory is written. */
+	struct rtos_stack_frame *stack_frames;
+	unsigned int stack_frame_count;
+	bool stack_frames_prefetched;
 };
 
 struct rtos_reg {
@@ -99,6 +118,10 @@ struct rtos_type {
 			uint8_t *buffer);
 	int (*write_buffer)(struct rtos *rtos, target_addr_t address, uint32_t size,
 			const uint8_t *buffer);
+	/* Optional. Find where a thread's registers are saved, so the frames of
+	 * all threads can be read ahead in as few accesses as possible. */
+	int (*get_stacking_info)(struct rtos *rtos, threadid_t thread_id,
+			const struct rtos_register_stacking **stacking, target_addr_t *stack_ptr);
 };
 
 struct stack_register_offset {
@@ -154,6 +177,7 @@ int rtos_get_gdb_reg(struct connection *connection, int reg_num);
 int rtos_get_gdb_reg_list(struct connection *connection);
 int rtos_update_threads(struct target *target);
 void rtos_free_threadlist(struct rtos *rtos);
+void rtos_free_stack_frames(struct rtos *rtos);
 int rtos_smp_init(struct target *target);
 /*  function for handling symbol access */
 int rtos_qsymbol(struct connection *connection, char const *packet, int packet_size);
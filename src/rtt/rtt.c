@@ -21,11 +21,22 @@
 
 #include <helper/log.h>
 #include <helper/list.h>
+#include <helper/time_support.h>
 #include <target/target.h>
 #include <target/rtt.h>
 
 #include "rtt.h"
 
+/* Most data held back for one down-channel */
+#define RTT_WRITE_QUEUE_MAX	(64 * 1024)
+
+/** Data for a down-channel, written on the next poll. */
+struct rtt_write_queue {
+	uint8_t *data;
+	size_t length;
+	size_t capacity;
+};
+
 static struct {
 	struct rtt_source source;
 	/** Control block. */
@@ -47,9 +58,22 @@ static struct {
 	bool found_cb;
 
 	struct rtt_sink_list **sink_list;
+	/** Up-channel statistics, one per entry of the sink list. */
+	struct rtt_channel_stats *stats;
 	size_t sink_list_length;
 
+	/** Down-channel write queues. */
+	struct rtt_write_queue *write_queues;
+	size_t num_write_queues;
+
+	/** Polling interval while the up-channels are empty. */
 	unsigned int polling_interval;
+	/** Polling interval while the up-channels fill up. */
+	unsigned int min_polling_interval;
+	/** Current polling interval. */
+	unsigned int interval;
+	/** Time RTT was started, in milliseconds. */
+	int64_t start_time;
 } rtt;
 
 int rtt_init(void)
@@ -57,14 +81,17 @@ int rtt_init(void)
 	rtt.sink_list_length = 1;
 	rtt.sink_list = calloc(rtt.sink_list_length,
 		sizeof(struct rtt_sink_list *));
+	rtt.stats = calloc(rtt.sink_list_length, sizeof(struct rtt_channel_stats));
 
-	if (!rtt.sink_list)
+	if (!rtt.sink_list || !rtt.stats)
 		return ERROR_FAIL;
 
 	rtt.sink_list[0] = NULL;
 	rtt.started = false;
 
 	rtt.polling_interval = 100;
+	rtt.min_polling_interval = 10;
+	rtt.interval = rtt.polling_interval;
 
 	return ERROR_OK;
 }
@@ -72,6 +99,93 @@ int rtt_init(void)
 int rtt_exit(void)
 {
 	free(rtt.sink_list);
+	free(rtt.stats);
+
+	for (size_t i = 0; i < rtt.num_write_queues; i++)
+		free(rtt.write_queues[i].data);
+
+	free(rtt.write_queues);
+
+	return ERROR_OK;
+}
+
+static int read_channel_callback(void *user_data);
+
+static void set_interval(unsigned int interval)
+{
+	if (interval == rtt.interval)
+		return;
+
+	target_unregister_timer_callback(&read_channel_callback, NULL);
+	target_register_timer_callback(&read_channel_callback, interval, 1, NULL);
+	rtt.interval = interval;
+}
+
+/*
+ * Poll faster while an up-channel is at least half full or had more data
+ * than one read takes, or a down-channel has data waiting, and back off
+ * towards the polling interval once all channels are empty.
+ */
+static void adjust_polling_interval(void)
+{
+	unsigned int min_interval = MIN(rtt.min_polling_interval,
+		rtt.polling_interval);
+	bool busy = false;
+	bool idle = true;
+
+	for (size_t i = 0; i < rtt.sink_list_length; i++) {
+		const struct rtt_channel_stats *stats = &rtt.stats[i];
+
+		if (!stats->fill)
+			continue;
+
+		idle = false;
+
+		if (stats->read < stats->fill || stats->fill >= stats->size / 2)
+			busy = true;
+	}
+
+	/* the target hasn't taken everything written to it yet */
+	for (size_t i = 0; i < rtt.num_write_queues; i++) {
+		if (rtt.write_queues[i].length)
+			busy = true;
+	}
+
+	if (busy) {
+		set_interval(MAX(rtt.interval / 2, min_interval));
+		LOG_DEBUG("rtt: Polling every %u ms", rtt.interval);
+	} else if (idle && rtt.interval < rtt.polling_interval) {
+		set_interval(MIN(rtt.interval * 2, rtt.polling_interval));
+		LOG_DEBUG("rtt: Polling every %u ms", rtt.interval);
+	}
+}
+
+/* Write as much queued data as fits into each down-channel */
+static int flush_write_queues(void)
+{
+	for (size_t i = 0; i < rtt.num_write_queues; i++) {
+		struct rtt_write_queue *queue = &rtt.write_queues[i];
+		size_t length = queue->length;
+		int ret;
+
+		if (!length)
+			continue;
+
+		if (i >= rtt.ctrl.num_down_channels) {
+			LOG_WARNING("rtt: Down-channel %zu is not available", i);
+			queue->length = 0;
+			continue;
+		}
+
+		ret = rtt.source.write(rtt.target, &rtt.ctrl, i, queue->data,
+			&length, NULL);
+
+		if (ret != ERROR_OK)
+			return ret;
+
+		memmove(queue->data, queue->data + length, queue->length - length);
+		queue->length -= length;
+	}
 
 	return ERROR_OK;
 }
@@ -80,15 +194,20 @@ static int read_channel_callback(void *user_data)
 {
 	int ret;
 
-	ret = rtt.source.read(rtt.target, &rtt.ctrl, rtt.sink_list,
+	ret = rtt.source.read(rtt.target, &rtt.ctrl, rtt.sink_list, rtt.stats,
 		rtt.sink_list_length, NULL);
 
+	if (ret == ERROR_OK)
+		ret = flush_write_queues();
+
 	if (ret != ERROR_OK) {
 		target_unregister_timer_callback(&read_channel_callback, NULL);
 		rtt.source.stop(rtt.target, NULL);
 		return ret;
 	}
 
+	adjust_polling_interval();
+
 	return ERROR_OK;
 }
 
@@ -162,6 +281,10 @@ int rtt_start(void)
 	if (ret != ERROR_OK)
 		return ret;
 
+	memset(rtt.stats, 0, rtt.sink_list_length * sizeof(struct rtt_channel_stats));
+	rtt.start_time = timeval_ms();
+	rtt.interval = rtt.polling_interval;
+
 	target_register_timer_callback(&read_channel_callback,
 		rtt.polling_interval, 1, NULL);
 	rtt.started = true;
@@ -192,6 +315,7 @@ int rtt_stop(void)
 static int adjust_sink_list(size_t length)
 {
 	struct rtt_sink_list **tmp;
+	struct rtt_channel_stats *stats;
 
 	if (length <= rtt.sink_list_length)
 		return ERROR_OK;
@@ -201,10 +325,19 @@ static int adjust_sink_list(size_t length)
 	if (!tmp)
 		return ERROR_FAIL;
 
-	for (size_t i = rtt.sink_list_length; i < length; i++)
+	rtt.sink_list = tmp;
+
+	stats = realloc(rtt.stats, sizeof(struct rtt_channel_stats) * length);
+
+	if (!stats)
+		return ERROR_FAIL;
+
+	for (size_t i = rtt.sink_list_length; i < length; i++) {
 		tmp[i] = NULL;
+		memset(&stats[i], 0, sizeof(struct rtt_channel_stats));
+	}
 
-	rtt.sink_list = tmp;
+	rtt.stats = stats;
 	rtt.sink_list_length = length;
 
 	return ERROR_OK;
@@ -281,21 +414,56 @@ int rtt_set_polling_interval(unsigned int interval)
 	if (!interval)
 		return ERROR_FAIL;
 
-	if (rtt.polling_interval != interval) {
-		target_unregister_timer_callback(&read_channel_callback, NULL);
-		target_register_timer_callback(&read_channel_callback, interval, 1,
-			NULL);
-	}
-
 	rtt.polling_interval = interval;
 
+	if (rtt.started)
+		set_interval(interval);
+	else
+		rtt.interval = interval;
+
+	return ERROR_OK;
+}
+
+int rtt_get_min_polling_interval(unsigned int *interval)
+{
+	if (!interval)
+		return ERROR_FAIL;
+
+	*interval = rtt.min_polling_interval;
+
+	return ERROR_OK;
+}
+
+int rtt_set_min_polling_interval(unsigned int interval)
+{
+	if (!interval)
+		return ERROR_FAIL;
+
+	rtt.min_polling_interval = interval;
+
+	return ERROR_OK;
+}
+
+int rtt_get_channel_stats(unsigned int channel_index,
+		struct rtt_channel_stats *stats, int64_t *elapsed)
+{
+	if (!stats || !elapsed)
+		return ERROR_FAIL;
+
+	if (channel_index < rtt.sink_list_length)
+		*stats = rtt.stats[channel_index];
+	else
+		memset(stats, 0, sizeof(*stats));
+
+	*elapsed = rtt.started ? timeval_ms() - rtt.start_time : 0;
+
 	return ERROR_OK;
 }
 
 int rtt_write_channel(unsigned int channel_index, const uint8_t *buffer,
 		size_t *length)
 {
-	if (channel_index >= rtt.ctrl.num_up_channels) {
+	if (channel_index >= rtt.ctrl.num_down_channels) {
 		LOG_WARNING("rtt: Down-channel %u is not available", channel_index);
 		return ERROR_OK;
 	}
@@ -304,6 +472,61 @@ int rtt_write_channel(unsigned int channel_index, const uint8_t *buffer,
 		length, NULL);
 }
 
+int rtt_queue_write_channel(unsigned int channel_index, const uint8_t *buffer,
+		size_t length)
+{
+	struct rtt_write_queue *queue;
+
+	if (channel_index >= rtt.num_write_queues) {
+		struct rtt_write_queue *tmp;
+
+		tmp = realloc(rtt.write_queues,
+			sizeof(struct rtt_write_queue) * (channel_index + 1));
+
+		if (!tmp)
+			return ERROR_FAIL;
+
+		for (size_t i = rtt.num_write_queues; i <= channel_index; i++)
+			memset(&tmp[i], 0, sizeof(struct rtt_write_queue));
+
+		rtt.write_queues = tmp;
+		rtt.num_write_queues = channel_index + 1;
+	}
+
+	queue = &rtt.write_queues[channel_index];
+
+	if (length > RTT_WRITE_QUEUE_MAX - queue->length) {
+		LOG_WARNING("rtt: Down-channel %u is full, dropping %zu bytes",
+			channel_index, length - (RTT_WRITE_QUEUE_MAX - queue->length));
+		length = RTT_WRITE_QUEUE_MAX - queue->length;
+	}
+
+	if (queue->length + length > queue->capacity) {
+		size_t capacity = MAX(queue->capacity * 2, 1024);
+		uint8_t *tmp;
+
+		while (capacity < queue->length + length)
+			capacity *= 2;
+
+		tmp = realloc(queue->data, MIN(capacity, RTT_WRITE_QUEUE_MAX));
+
+		if (!tmp)
+			return ERROR_FAIL;
+
+		queue->data = tmp;
+		queue->capacity = MIN(capacity, RTT_WRITE_QUEUE_MAX);
+	}
+
+	memcpy(queue->data + queue->length, buffer, length);
+	queue->length += length;
+
+	/* don't keep an interactive user waiting for a slow poll */
+	if (rtt.started)
+		set_interval(MIN(rtt.min_polling_interval, rtt.polling_interval));
+
+	return ERROR_OK;
+}
+
 bool rtt_started(void)
 {
 	return rtt.started;
@@ -88,6 +88,20 @@ struct rtt_channel_info {
 	uint32_t flags;
 };
 
+/** Up-channel statistics, updated by the source on each read. */
+struct rtt_channel_stats {
+	/** Bytes read from the channel. */
+	uint64_t bytes;
+	/** Polls that found the buffer full, the target may have dropped data. */
+	unsigned int overflows;
+	/** Buffer size in bytes at the last poll. */
+	uint32_t size;
+	/** Bytes that were in the buffer at the last poll. */
+	uint32_t fill;
+	/** Bytes read at the last poll. */
+	uint32_t read;
+};
+
 typedef int (*rtt_sink_read)(unsigned int channel, const uint8_t *buffer,
 		size_t length, void *user_data);
 
@@ -121,7 +135,8 @@ typedef int (*rtt_source_start)(struct target *target,
 typedef int (*rtt_source_stop)(struct target *target, void *user_data);
 typedef int (*rtt_source_read)(struct target *target,
 		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
-		size_t num_channels, void *user_data);
+		struct rtt_channel_stats *stats, size_t num_channels,
+		void *user_data);
 typedef int (*rtt_source_write)(struct target *target,
 		struct rtt_control *ctrl, unsigned int channel,
 		const uint8_t *buffer, size_t *length, void *user_data);
@@ -205,6 +220,40 @@ int rtt_get_polling_interval(unsigned int *interval);
  */
 int rtt_set_polling_interval(unsigned int interval);
 
+/**
+ * Get the minimum polling interval.
+ *
+ * @param[out] interval Minimum polling interval in milliseconds.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_get_min_polling_interval(unsigned int *interval);
+
+/**
+ * Set the minimum polling interval.
+ *
+ * While up-channels fill up faster than they are read, the polling interval
+ * is halved down to this value. It goes back up to the polling interval
+ * once the channels are empty.
+ *
+ * @param[in] interval Minimum polling interval in milliseconds.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_set_min_polling_interval(unsigned int interval);
+
+/**
+ * Get the statistics of an up-channel.
+ *
+ * @param[in] channel_index Channel index.
+ * @param[out] stats Channel statistics.
+ * @param[out] elapsed Milliseconds since RTT was started.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_get_channel_stats(unsigned int channel_index,
+		struct rtt_channel_stats *stats, int64_t *elapsed);
+
 /**
  * Get whether RTT is started.
  *
@@ -282,6 +331,22 @@ int rtt_unregister_sink(unsigned int channel_index, rtt_sink_read read,
 int rtt_write_channel(unsigned int channel_index, const uint8_t *buffer,
 		size_t *length);
 
+/**
+ * Queue data for an RTT channel.
+ *
+ * The data is written on the next poll, together with everything else
+ * queued for the channel until then, as far as the channel has room. The
+ * rest stays queued for the polls after that.
+ *
+ * @param[in] channel_index Channel index.
+ * @param[in] buffer Buffer with data that should be written to the channel.
+ * @param[in] length Number of bytes to write.
+ *
+ * @returns ERROR_OK on success, an error code on failure.
+ */
+int rtt_queue_write_channel(unsigned int channel_index, const uint8_t *buffer,
+		size_t length);
+
 extern const struct command_registration rtt_target_command_handlers[];
 
 #endif /* OPENOCD_RTT_RTT_H */
@@ -77,26 +77,44 @@ COMMAND_HANDLER(handle_rtt_polling_interval_command)
 	if (CMD_ARGC == 0) {
 		int ret;
 		unsigned int interval;
+		unsigned int min_interval;
 
 		ret = rtt_get_polling_interval(&interval);
 
+		if (ret == ERROR_OK)
+			ret = rtt_get_min_polling_interval(&min_interval);
+
 		if (ret != ERROR_OK) {
 			command_print(CMD, "Failed to get polling interval");
 			return ret;
 		}
 
-		command_print(CMD, "%u ms", interval);
-	} else if (CMD_ARGC == 1) {
+		command_print(CMD, "%u ms, minimum %u ms", interval, min_interval);
+	} else if (CMD_ARGC <= 2) {
 		int ret;
 		unsigned int interval;
+		unsigned int min_interval = 0;
 
 		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], interval);
+
+		if (CMD_ARGC == 2)
+			COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], min_interval);
+
 		ret = rtt_set_polling_interval(interval);
 
 		if (ret != ERROR_OK) {
 			command_print(CMD, "Failed to set polling interval");
 			return ret;
 		}
+
+		if (CMD_ARGC == 2) {
+			ret = rtt_set_min_polling_interval(min_interval);
+
+			if (ret != ERROR_OK) {
+				command_print(CMD, "Failed to set minimum polling interval");
+				return ret;
+			}
+		}
 	} else {
 		return ERROR_COMMAND_SYNTAX_ERROR;
 	}
@@ -127,6 +145,9 @@ COMMAND_HANDLER(handle_rtt_channels_command)
 	info.name_length = sizeof(channel_name);
 
 	for (unsigned int i = 0; i < ctrl->num_up_channels; i++) {
+		struct rtt_channel_stats stats;
+		int64_t elapsed;
+
 		ret = rtt_read_channel_info(i, RTT_CHANNEL_TYPE_UP, &info);
 
 		if (ret != ERROR_OK)
@@ -135,8 +156,15 @@ COMMAND_HANDLER(handle_rtt_channels_command)
 		if (!info.size)
 			continue;
 
-		command_print(CMD, "%u: %s %u %u", i, info.name, info.size,
-			info.flags);
+		ret = rtt_get_channel_stats(i, &stats, &elapsed);
+
+		if (ret != ERROR_OK)
+			return ret;
+
+		command_print(CMD, "%u: %s %u %u, %" PRIu64 " bytes, %" PRIu64
+			" bytes/s, %u overflows", i, info.name, info.size, info.flags,
+			stats.bytes, elapsed > 0 ? stats.bytes * 1000 / elapsed : 0,
+			stats.overflows);
 	}
 
 	command_print(CMD, "Down-channels:");
@@ -279,8 +307,9 @@ static const struct command_registration rtt_subcommand_handlers[] = {
 		.name = "polling_interval",
 		.handler = handle_rtt_polling_interval_command,
 		.mode = COMMAND_EXEC,
-		.help = "show or set polling interval in ms",
-		.usage = "[interval]"
+		.help = "show or set polling interval and minimum polling "
+			"interval in ms",
+		.usage = "[interval [min_interval]]"
 	},
 	{
 		.name = "channels",
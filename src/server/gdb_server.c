@@ -51,6 +51,7 @@
 #include <jtag/jtag.h>
 #include "rtos/rtos.h"
 #include "target/smp.h"
+#include <helper/perf.h>
 
 /**
  * @file
@@ -61,19 +62,23 @@
  * found in most modern embedded processors.
  */
 
-struct target_desc_format {
-	char *tdesc;
-	uint32_t tdesc_length;
-};
-
 /* private connection data for GDB */
 struct gdb_connection {
-	char buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for null-termination */
+	/* incoming bytes, GDB_BUFFER_SIZE plus an extra byte for null-termination */
+	char *buffer;
 	char *buf_p;
+	/* incoming packet, gdb_packet_size at the time of connection plus
+	 * an extra byte for null-termination */
+	char *packet_buffer;
+	int packet_size;
 	int buf_cnt;
 	bool ctrl_c;
 	enum target_state frontend_state;
 	struct image *vflash_image;
+	/* TARGET_EVENT_GDB_FLASH_WRITE_START was sent for the current load */
+	bool vflash_writing;
+	/* a streamed vFlashWrite failed, vFlashDone must fail too */
+	bool vflash_failed;
 	bool closed;
 	bool busy;
 	int noack_mode;
@@ -93,10 +98,26 @@ struct gdb_connection {
 	bool attached;
 	/* set when extended protocol is used */
 	bool extended_protocol;
-	/* temporarily used for target description support */
-	struct target_desc_format target_desc;
+	/* memory map being transferred, generated at offset 0 */
+	char *memory_map;
+	int memory_map_length;
+	/* set by QNonStop:1, where the cores of an SMP group are threads that
+	 * halt and resume on their own */
+	bool non_stop;
+	/* halted threads GDB wasn't told about yet. The first one has been
+	 * reported once stop_notified is set, and is dropped on vStopped. */
+	struct target **stop_queue;
+	unsigned stop_queue_len;
+	bool stop_notified;
+	/* while set, stops are queued but not notified */
+	bool stop_notify_deferred;
+	/* thread stopped by vCtrlC, reported with SIGINT rather than 0 */
+	struct target *stop_ctrl_c;
 	/* temporarily used for thread list support */
 	char *thread_list;
+	/* reused by packet handlers for their replies, see gdb_scratch() */
+	char *scratch;
+	size_t scratch_size;
 };
 
 #if 0
@@ -116,6 +137,7 @@ static void gdb_log_callback(void *priv, const char *file, unsigned line,
 		const char *function, const char *string);
 
 static void gdb_sig_halted(struct connection *connection);
+static void gdb_send_error(struct connection *connection, uint8_t the_error);
 
 /* number of gdb connections, mainly to suppress gdb related debugging spam
  * in helper/log.c when no gdb connections are actually active */
@@ -123,10 +145,15 @@ int gdb_actual_connections;
 
 /* set if we are sending a memory map to gdb
  * via qXfer:memory-map:read packet */
+/* largest packet advertised to and accepted from GDB */
+static int gdb_packet_size = GDB_BUFFER_SIZE;
+
 /* enabled by default*/
 static int gdb_use_memory_map = 1;
 /* enabled by default*/
 static int gdb_flash_program = 1;
+/* disabled by default */
+static int gdb_flash_stream;
 
 /* if set, data aborts cause an error to be reported in memory read packets
  * see the code in gdb_read_memory_packet() for further explanations.
@@ -357,18 +384,63 @@ static int gdb_write(struct connection *connection, void *data, int len)
 	return ERROR_SERVER_REMOTE_CLOSED;
 }
 
+static int gdb_writev(struct connection *connection,
+		const struct connection_iovec *iov, int iovcnt)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	if (gdb_con->closed)
+		return ERROR_SERVER_REMOTE_CLOSED;
+
+	int len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].len;
+
+	if (connection_writev(connection, iov, iovcnt) == len)
+		return ERROR_OK;
+	gdb_con->closed = true;
+	return ERROR_SERVER_REMOTE_CLOSED;
+}
+
+/* Sum of the bytes modulo 256. Eight bytes are added at a time, as four
+ * 16 bit lanes of even and of odd bytes, which can't overflow within
+ * 256 words. */
+static unsigned char gdb_checksum(const char *buffer, int len)
+{
+	const uint64_t mask = 0x00ff00ff00ff00ffULL;
+	uint64_t even = 0, odd = 0;
+	unsigned char sum = 0;
+	int i = 0;
+
+	while (len - i >= 8) {
+		int words = MIN((len - i) / 8, 256);
+		for (int j = 0; j < words; j++, i += 8) {
+			uint64_t w;
+			memcpy(&w, buffer + i, sizeof(w));
+			even += w & mask;
+			odd += (w >> 8) & mask;
+		}
+		for (int lane = 0; lane < 4; lane++)
+			sum += (unsigned char)((even >> (16 * lane)) + (odd >> (16 * lane)));
+		even = 0;
+		odd = 0;
+	}
+
+	for (; i < len; i++)
+		sum += buffer[i];
+
+	return sum;
+}
+
 static int gdb_put_packet_inner(struct connection *connection,
 		char *buffer, int len)
 {
-	int i;
-	unsigned char my_checksum = 0;
+	unsigned char my_checksum;
 	char *debug_buffer;
 	int reply;
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
 
-	for (i = 0; i < len; i++)
-		my_checksum += buffer[i];
+	my_checksum = gdb_checksum(buffer, len);
 
 #ifdef _DEBUG_GDB_IO_
 	/*
@@ -399,35 +471,28 @@ static int gdb_put_packet_inner(struct connection *connection,
 	}
 #endif
 
+	char trailer[4];
+	snprintf(trailer, sizeof(trailer), "#%02x", my_checksum);
+
+	/* the payload goes out straight from the caller's buffer, framed
+	 * in the same write */
+	const struct connection_iovec frame[] = {
+		{ .data = "$", .len = 1 },
+		{ .data = buffer, .len = len },
+		{ .data = trailer, .len = 3 },
+	};
+
 	while (1) {
-		debug_buffer = strndup(buffer, len);
-		LOG_DEBUG("sending packet '$%s#%2.2x'", debug_buffer, my_checksum);
-		free(debug_buffer);
-
-		char local_buffer[1024];
-		local_buffer[0] = '$';
-		if ((size_t)len + 4 <= sizeof(local_buffer)) {
-			/* performance gain on smaller packets by only a single call to gdb_write() */
-			memcpy(local_buffer + 1, buffer, len++);
-			len += snprintf(local_buffer + len, sizeof(local_buffer) - len, "#%02x", my_checksum);
-			retval = gdb_write(connection, local_buffer, len);
-			if (retval != ERROR_OK)
-				return retval;
-		} else {
-			/* larger packets are transmitted directly from caller supplied buffer
-			 * by several calls to gdb_write() to avoid dynamic allocation */
-			snprintf(local_buffer + 1, sizeof(local_buffer) - 1, "#%02x", my_checksum);
-			retval = gdb_write(connection, local_buffer, 1);
-			if (retval != ERROR_OK)
-				return retval;
-			retval = gdb_write(connection, buffer, len);
-			if (retval != ERROR_OK)
-				return retval;
-			retval = gdb_write(connection, local_buffer + 1, 3);
-			if (retval != ERROR_OK)
-				return retval;
+		if (LOG_LEVEL_IS(LOG_LVL_DEBUG)) {
+			debug_buffer = strndup(buffer, len);
+			LOG_DEBUG("sending packet '$%s#%2.2x'", debug_buffer, my_checksum);
+			free(debug_buffer);
 		}
 
+		retval = gdb_writev(connection, frame, ARRAY_SIZE(frame));
+		if (retval != ERROR_OK)
+			return retval;
+
 		if (gdb_con->noack_mode)
 			break;
 
@@ -878,6 +943,275 @@ static void gdb_fileio_reply(struct target *target, struct connection *connectio
 	}
 }
 
+/* Non-stop mode needs the cores of an SMP group to be threads, with
+ * hwthread's numbering, and to halt and resume one at a time. */
+static bool gdb_non_stop_supported(struct target *target)
+{
+	return target->smp && target->rtos &&
+		strcmp(target->rtos->type->name, "hwthread") == 0 &&
+		target_supports_non_stop(target);
+}
+
+static int64_t gdb_non_stop_threadid(struct target *target)
+{
+	return target->coreid + 1;
+}
+
+static struct target *gdb_non_stop_thread(struct target *target, int64_t thread_id)
+{
+	for (struct target_list *head = target->head; head; head = head->next) {
+		if (gdb_non_stop_threadid(head->target) == thread_id)
+			return head->target;
+	}
+	return NULL;
+}
+
+static int gdb_non_stop_stop_reply(struct connection *connection,
+		struct target *target, char *reply, size_t size)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	int signal_var;
+
+	if (gdb_connection->stop_ctrl_c == target) {
+		gdb_connection->stop_ctrl_c = NULL;
+		signal_var = 0x2;
+	} else if (target->debug_reason == DBG_REASON_DBGRQ) {
+		/* stopped with vCont;t, which GDB wants reported as signal 0 */
+		signal_var = 0;
+	} else
+		signal_var = gdb_last_signal(target);
+
+	return snprintf(reply, size, "T%2.2xthread:%" PRIx64 ";", signal_var,
+			gdb_non_stop_threadid(target));
+}
+
+/* Send a %Stop notification for the first queued stop, unless one is
+ * already waiting for GDB's vStopped. */
+static void gdb_non_stop_notify(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	if (gdb_connection->stop_notified || gdb_connection->stop_notify_deferred ||
+			!gdb_connection->stop_queue_len)
+		return;
+
+	char reply[64];
+	int len = gdb_non_stop_stop_reply(connection, gdb_connection->stop_queue[0],
+			reply + 5, sizeof(reply) - 5);
+	memcpy(reply, "Stop:", 5);
+	len += 5;
+
+	char trailer[4];
+	snprintf(trailer, sizeof(trailer), "#%02x", gdb_checksum(reply, len));
+	const struct connection_iovec frame[] = {
+		{ .data = "%", .len = 1 },
+		{ .data = reply, .len = len },
+		{ .data = trailer, .len = 3 },
+	};
+	/* notifications aren't acknowledged */
+	if (gdb_writev(connection, frame, ARRAY_SIZE(frame)) == ERROR_OK)
+		gdb_connection->stop_notified = true;
+}
+
+static void gdb_non_stop_queue_stop(struct connection *connection, struct target *target)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	for (unsigned i = 0; i < gdb_connection->stop_queue_len; i++) {
+		if (gdb_connection->stop_queue[i] == target)
+			return;
+	}
+	gdb_connection->stop_queue[gdb_connection->stop_queue_len++] = target;
+
+	gdb_non_stop_notify(connection);
+}
+
+static int gdb_non_stop_packet(struct connection *connection, bool enable)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+
+	if (enable == gdb_connection->non_stop) {
+		gdb_put_packet(connection, "OK", 2);
+		return ERROR_OK;
+	}
+
+	if (enable) {
+		if (!gdb_non_stop_supported(target)) {
+			gdb_send_error(connection, EFAULT);
+			return ERROR_OK;
+		}
+
+		unsigned count = 0;
+		for (struct target_list *head = target->head; head; head = head->next)
+			count++;
+		struct target **queue = calloc(count, sizeof(*queue));
+		if (!queue) {
+			gdb_send_error(connection, EFAULT);
+			return ERROR_OK;
+		}
+
+		if (target_set_non_stop(target, true) != ERROR_OK) {
+			free(queue);
+			target_set_non_stop(target, false);
+			gdb_send_error(connection, EFAULT);
+			return ERROR_OK;
+		}
+		free(gdb_connection->stop_queue);
+		gdb_connection->stop_queue = queue;
+	} else {
+		target_set_non_stop(target, false);
+	}
+
+	gdb_connection->non_stop = enable;
+	gdb_connection->stop_queue_len = 0;
+	gdb_connection->stop_notified = false;
+	gdb_connection->stop_ctrl_c = NULL;
+	LOG_DEBUG("non-stop mode %s", enable ? "on" : "off");
+
+	gdb_put_packet(connection, "OK", 2);
+	return ERROR_OK;
+}
+
+/* Reply with the first queued stop, or OK once there are none left */
+static void gdb_non_stop_reply_queue(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	if (!gdb_connection->stop_queue_len) {
+		gdb_connection->stop_notified = false;
+		gdb_put_packet(connection, "OK", 2);
+		return;
+	}
+
+	char reply[64];
+	int len = gdb_non_stop_stop_reply(connection, gdb_connection->stop_queue[0],
+			reply, sizeof(reply));
+	gdb_connection->stop_notified = true;
+	gdb_put_packet(connection, reply, len);
+}
+
+static void gdb_non_stop_vstopped_packet(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	if (gdb_connection->stop_notified && gdb_connection->stop_queue_len) {
+		gdb_connection->stop_queue_len--;
+		memmove(gdb_connection->stop_queue, gdb_connection->stop_queue + 1,
+				gdb_connection->stop_queue_len * sizeof(*gdb_connection->stop_queue));
+	}
+
+	gdb_non_stop_reply_queue(connection);
+}
+
+/* '?' in non-stop mode reports every halted thread again */
+static void gdb_non_stop_status_packet(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+
+	gdb_connection->stop_queue_len = 0;
+	for (struct target_list *head = target->head; head; head = head->next) {
+		if (head->target->state == TARGET_HALTED)
+			gdb_connection->stop_queue[gdb_connection->stop_queue_len++] = head->target;
+	}
+
+	gdb_non_stop_reply_queue(connection);
+}
+
+/* vCtrlC stops one running thread, preferably the selected one */
+static void gdb_non_stop_ctrl_c_packet(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+	struct target *stop = gdb_non_stop_thread(target, target->rtos->current_threadid);
+
+	if (!stop || stop->state != TARGET_RUNNING) {
+		stop = NULL;
+		for (struct target_list *head = target->head; head; head = head->next) {
+			if (head->target->state == TARGET_RUNNING) {
+				stop = head->target;
+				break;
+			}
+		}
+	}
+
+	gdb_connection->stop_notify_deferred = true;
+	if (stop) {
+		gdb_connection->stop_ctrl_c = stop;
+		if (target_halt(stop) == ERROR_OK)
+			target_poll(stop);
+	}
+	gdb_connection->stop_notify_deferred = false;
+
+	gdb_put_packet(connection, "OK", 2);
+	gdb_non_stop_notify(connection);
+}
+
+/* vCont in non-stop mode: each thread takes the first action naming it,
+ * or the first one without a thread id, and threads without an action are
+ * left alone. The reply comes right away, stops follow as notifications. */
+static void gdb_non_stop_vcont_packet(struct connection *connection, const char *parse)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+
+	gdb_connection->stop_notify_deferred = true;
+
+	for (struct target_list *head = target->head; head; head = head->next) {
+		struct target *t = head->target;
+		int64_t tid = gdb_non_stop_threadid(t);
+		char action = 0;
+
+		for (const char *p = parse; p && *p == ';'; p = strchr(p + 1, ';')) {
+			const char *colon = strchr(p + 1, ':');
+			const char *next = strchr(p + 1, ';');
+			if (colon && (!next || colon < next)) {
+				int64_t action_tid = strtoll(colon + 1, NULL, 16);
+				if (action_tid != -1 && action_tid != tid)
+					continue;
+			}
+			action = p[1];
+			break;
+		}
+
+		switch (action) {
+			case 'c':
+			case 'C':
+				if (t->state != TARGET_HALTED)
+					break;
+				LOG_DEBUG("non-stop: continue %s", target_name(t));
+				target_call_event_callbacks(t, TARGET_EVENT_GDB_START);
+				if (target_resume(t, 1, 0, 0, 0) != ERROR_OK)
+					target_poll(t);
+				break;
+			case 's':
+			case 'S':
+				if (t->state != TARGET_HALTED)
+					break;
+				LOG_DEBUG("non-stop: step %s", target_name(t));
+				target_call_event_callbacks(t, TARGET_EVENT_GDB_START);
+				if (target_step(t, 1, 0, 0) == ERROR_OK)
+					target_poll(t);
+				break;
+			case 't':
+				if (t->state != TARGET_RUNNING)
+					break;
+				LOG_DEBUG("non-stop: stop %s", target_name(t));
+				if (target_halt(t) == ERROR_OK)
+					target_poll(t);
+				break;
+			default:
+				break;
+		}
+	}
+
+	gdb_connection->stop_notify_deferred = false;
+
+	gdb_put_packet(connection, "OK", 2);
+	gdb_non_stop_notify(connection);
+}
+
 static void gdb_frontend_halted(struct target *target, struct connection *connection)
 {
 	struct gdb_connection *gdb_connection = connection->priv;
@@ -908,6 +1242,15 @@ static int gdb_target_callback_event_handler(struct target *target,
 {
 	struct connection *connection = priv;
 	struct gdb_service *gdb_service = connection->service->priv;
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	if (gdb_connection->non_stop) {
+		/* every core reports its own halts */
+		if (event == TARGET_EVENT_HALTED &&
+				gdb_non_stop_thread(gdb_service->target, gdb_non_stop_threadid(target)) == target)
+			gdb_non_stop_queue_stop(connection, target);
+		return ERROR_OK;
+	}
 
 	if (gdb_service->target != target)
 		return ERROR_OK;
@@ -926,6 +1269,26 @@ static int gdb_target_callback_event_handler(struct target *target,
 	return ERROR_OK;
 }
 
+/* Working memory for handling one packet. It is kept with the connection
+ * and only grows, so that register and memory reads don't allocate and free
+ * a buffer for every packet. Not valid across packets. */
+static void *gdb_scratch(struct connection *connection, size_t size)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+
+	if (size > gdb_con->scratch_size) {
+		char *scratch = realloc(gdb_con->scratch, size);
+		if (!scratch) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		gdb_con->scratch = scratch;
+		gdb_con->scratch_size = size;
+	}
+
+	return gdb_con->scratch;
+}
+
 static int gdb_new_connection(struct connection *connection)
 {
 	struct gdb_connection *gdb_connection = malloc(sizeof(struct gdb_connection));
@@ -933,6 +1296,19 @@ static int gdb_new_connection(struct connection *connection)
 	int retval;
 	int initial_ack;
 
+	if (!gdb_connection)
+		return ERROR_FAIL;
+	gdb_connection->packet_size = gdb_packet_size;
+	gdb_connection->packet_buffer = malloc(gdb_connection->packet_size + 1);
+	gdb_connection->buffer = malloc(GDB_BUFFER_SIZE + 1);
+	if (!gdb_connection->packet_buffer || !gdb_connection->buffer) {
+		LOG_ERROR("Out of memory");
+		free(gdb_connection->packet_buffer);
+		free(gdb_connection->buffer);
+		free(gdb_connection);
+		return ERROR_FAIL;
+	}
+
 	target = get_target_from_connection(connection);
 	connection->priv = gdb_connection;
 	connection->cmd_ctx->current_target = target;
@@ -943,6 +1319,8 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->ctrl_c = false;
 	gdb_connection->frontend_state = TARGET_HALTED;
 	gdb_connection->vflash_image = NULL;
+	gdb_connection->vflash_writing = false;
+	gdb_connection->vflash_failed = false;
 	gdb_connection->closed = false;
 	gdb_connection->busy = false;
 	gdb_connection->noack_mode = 0;
@@ -950,9 +1328,17 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->mem_write_error = false;
 	gdb_connection->attached = true;
 	gdb_connection->extended_protocol = false;
-	gdb_connection->target_desc.tdesc = NULL;
-	gdb_connection->target_desc.tdesc_length = 0;
+	gdb_connection->memory_map = NULL;
+	gdb_connection->memory_map_length = 0;
+	gdb_connection->non_stop = false;
+	gdb_connection->stop_queue = NULL;
+	gdb_connection->stop_queue_len = 0;
+	gdb_connection->stop_notified = false;
+	gdb_connection->stop_notify_deferred = false;
+	gdb_connection->stop_ctrl_c = NULL;
 	gdb_connection->thread_list = NULL;
+	gdb_connection->scratch = NULL;
+	gdb_connection->scratch_size = 0;
 
 	/* send ACK to GDB for debug request */
 	gdb_write(connection, "+", 1);
@@ -1016,6 +1402,7 @@ static int gdb_new_connection(struct connection *connection)
 			target_name(target),
 			target_state_name(target));
 
+	target_examine_on_demand(target);
 	if (!target_was_examined(target)) {
 		LOG_ERROR("Target %s not examined yet, refuse gdb connection %d!",
 				  target_name(target), gdb_actual_connections);
@@ -1061,10 +1448,20 @@ static int gdb_connection_closed(struct connection *connection)
 		free(gdb_connection->vflash_image);
 		gdb_connection->vflash_image = NULL;
 	}
+	if (gdb_connection->vflash_writing)
+		target_call_event_callbacks(target, TARGET_EVENT_GDB_FLASH_WRITE_END);
 
 	/* if this connection registered a debug-message receiver delete it */
 	delete_debug_msg_receiver(connection->cmd_ctx, target);
 
+	if (gdb_connection->non_stop)
+		target_set_non_stop(target, false);
+
+	free(gdb_connection->stop_queue);
+	free(gdb_connection->memory_map);
+	free(gdb_connection->packet_buffer);
+	free(gdb_connection->buffer);
+	free(gdb_connection->scratch);
 	free(connection->priv);
 	connection->priv = NULL;
 
@@ -1194,9 +1591,11 @@ static int gdb_get_registers_packet(struct connection *connection,
 
 	assert(reg_packet_size > 0);
 
-	reg_packet = malloc(reg_packet_size + 1); /* plus one for string termination null */
-	if (reg_packet == NULL)
+	reg_packet = gdb_scratch(connection, reg_packet_size + 1); /* plus one for string termination null */
+	if (reg_packet == NULL) {
+		free(reg_list);
 		return ERROR_FAIL;
+	}
 
 	reg_packet_p = reg_packet;
 
@@ -1207,7 +1606,6 @@ static int gdb_get_registers_packet(struct connection *connection,
 			retval = reg_list[i]->type->get(reg_list[i]);
 			if (retval != ERROR_OK && gdb_report_register_access_error) {
 				LOG_DEBUG("Couldn't get register %s.", reg_list[i]->name);
-				free(reg_packet);
 				free(reg_list);
 				return gdb_error(connection, retval);
 			}
@@ -1226,7 +1624,6 @@ static int gdb_get_registers_packet(struct connection *connection,
 #endif
 
 	gdb_put_packet(connection, reg_packet, reg_packet_size);
-	free(reg_packet);
 
 	free(reg_list);
 
@@ -1425,6 +1822,26 @@ static int gdb_error(struct connection *connection, int retval)
 /* We don't have to worry about the default 2 second timeout for GDB packets,
  * because GDB breaks up large memory reads into smaller reads.
  */
+/* Escape binary data for a reply: '#', '$', '}' and '*' become '}'
+ * followed by the character xor 0x20. out must hold 2 * len bytes. */
+static size_t gdb_escape_binary(char *out, const uint8_t *buf, size_t len)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = buf[i];
+		if (c == '#' || c == '$' || c == '}' || c == '*') {
+			out[count++] = '}';
+			c ^= 0x20;
+		}
+		out[count++] = c;
+	}
+
+	return count;
+}
+
+/* Serves both 'm', replying in hex, and 'x', replying 'b' and the
+ * binary data as is, save for escaping. */
 static int gdb_read_memory_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
@@ -1432,6 +1849,7 @@ static int gdb_read_memory_packet(struct connection *connection,
 	char *separator;
 	uint64_t addr = 0;
 	uint32_t len = 0;
+	bool binary = packet[0] == 'x';
 
 	uint8_t *buffer;
 	char *hex_buffer;
@@ -1450,13 +1868,22 @@ static int gdb_read_memory_packet(struct connection *connection,
 
 	len = strtoul(separator + 1, NULL, 16);
 
+	if (!len && binary) {
+		/* an empty read is fine, GDB may use it to tell 'x' is supported */
+		gdb_put_packet(connection, "b", 1);
+		return ERROR_OK;
+	}
+
 	if (!len) {
 		LOG_WARNING("invalid read memory packet received (len == 0)");
 		gdb_put_packet(connection, "", 0);
 		return ERROR_OK;
 	}
 
-	buffer = malloc(len);
+	/* the data, followed by room for its hex or escaped binary encoding */
+	buffer = gdb_scratch(connection, len * 3 + 1);
+	if (!buffer)
+		return ERROR_FAIL;
 
 	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1485,18 +1912,19 @@ static int gdb_read_memory_packet(struct connection *connection,
 	}
 
 	if (retval == ERROR_OK) {
-		hex_buffer = malloc(len * 2 + 1);
+		hex_buffer = (char *)buffer + len;
 
-		size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
+		size_t pkt_len;
+		if (binary) {
+			hex_buffer[0] = 'b';
+			pkt_len = 1 + gdb_escape_binary(hex_buffer + 1, buffer, len);
+		} else
+			pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
 
 		gdb_put_packet(connection, hex_buffer, pkt_len);
-
-		free(hex_buffer);
 	} else
 		retval = gdb_error(connection, retval);
 
-	free(buffer);
-
 	return retval;
 }
 
@@ -1827,8 +2255,8 @@ static int compare_bank(const void *a, const void *b)
 		return -1;
 }
 
-static int gdb_memory_map(struct connection *connection,
-		char const *packet, int packet_size)
+static int gdb_generate_memory_map(struct connection *connection,
+		char **xml_out, int *length_out)
 {
 	/* We get away with only specifying flash here. Regions that are not
 	 * specified are treated as if we provided no memory map(if not we
@@ -1844,18 +2272,9 @@ static int gdb_memory_map(struct connection *connection,
 	int pos = 0;
 	int retval = ERROR_OK;
 	struct flash_bank **banks;
-	int offset;
-	int length;
-	char *separator;
 	target_addr_t ram_start = 0;
 	unsigned int target_flash_banks = 0;
 
-	/* skip command character */
-	packet += 23;
-
-	offset = strtoul(packet, &separator, 16);
-	length = strtoul(separator + 1, &separator, 16);
-
 	xml_printf(&retval, &xml, &pos, &size, "<memory-map>\n");
 
 	/* Sort banks in ascending order.  We need to report non-flash
@@ -1871,7 +2290,7 @@ static int gdb_memory_map(struct connection *connection,
 		retval = get_flash_bank_by_num(i, &p);
 		if (retval != ERROR_OK) {
 			free(banks);
-			gdb_error(connection, retval);
+			free(xml);
 			return retval;
 		}
 		banks[target_flash_banks++] = p;
@@ -1957,20 +2376,57 @@ static int gdb_memory_map(struct connection *connection,
 
 	if (retval != ERROR_OK) {
 		free(xml);
-		gdb_error(connection, retval);
 		return retval;
 	}
 
-	if (offset + length > pos)
-		length = pos - offset;
+	*xml_out = xml;
+	*length_out = pos;
+	return ERROR_OK;
+}
+
+static int gdb_memory_map(struct connection *connection,
+		char const *packet, int packet_size)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	int offset;
+	int length;
+	char *separator;
+
+	/* skip command character */
+	packet += 23;
+
+	offset = strtoul(packet, &separator, 16);
+	length = strtoul(separator + 1, &separator, 16);
+
+	/* GDB starts each transfer at offset 0, the rest of the chunks come
+	 * from the map generated for it */
+	if (offset == 0 || !gdb_con->memory_map) {
+		free(gdb_con->memory_map);
+		gdb_con->memory_map = NULL;
+
+		int retval = gdb_generate_memory_map(connection, &gdb_con->memory_map,
+				&gdb_con->memory_map_length);
+		if (retval != ERROR_OK) {
+			gdb_error(connection, retval);
+			return retval;
+		}
+	}
+
+	if (offset > gdb_con->memory_map_length)
+		offset = gdb_con->memory_map_length;
+
+	char transfer_type = 'm';
+	if (offset + length >= gdb_con->memory_map_length) {
+		length = gdb_con->memory_map_length - offset;
+		transfer_type = 'l';
+	}
 
 	char *t = malloc(length + 1);
-	t[0] = 'l';
-	memcpy(t + 1, xml + offset, length);
+	t[0] = transfer_type;
+	memcpy(t + 1, gdb_con->memory_map + offset, length);
 	gdb_put_packet(connection, t, length + 1);
 
 	free(t);
-	free(xml);
 	return ERROR_OK;
 }
 
@@ -2429,27 +2885,89 @@ error:
 	return retval;
 }
 
-static int gdb_get_target_description_chunk(struct target *target, struct target_desc_format *target_desc,
-		char **chunk, int32_t offset, uint32_t length)
+/* FNV-1a */
+static uint32_t gdb_hash_bytes(uint32_t hash, const void *data, size_t len)
 {
-	if (target_desc == NULL) {
-		LOG_ERROR("Unable to Generate Target Description");
-		return ERROR_FAIL;
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	return hash;
+}
+
+/* Hash what the target description is generated from, so it is only
+ * generated again when registers come, go or change. */
+static int gdb_target_description_hash(struct target *target, uint32_t *hash_out)
+{
+	struct reg **reg_list = NULL;
+	int reg_list_size;
+
+	int retval = smp_reg_list_noread(target, &reg_list, &reg_list_size,
+			REG_CLASS_ALL);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint32_t hash = 2166136261u;
+
+	const char *architecture = target_get_gdb_arch(target);
+	if (architecture)
+		hash = gdb_hash_bytes(hash, architecture, strlen(architecture));
+	hash = gdb_hash_bytes(hash, &reg_list_size, sizeof(reg_list_size));
+	for (int i = 0; i < reg_list_size; i++) {
+		struct reg *reg = reg_list[i];
+		hash = gdb_hash_bytes(hash, &reg, sizeof(reg));
+		hash = gdb_hash_bytes(hash, &reg->number, sizeof(reg->number));
+		hash = gdb_hash_bytes(hash, &reg->size, sizeof(reg->size));
+		hash = gdb_hash_bytes(hash, &reg->exist, sizeof(reg->exist));
+		hash = gdb_hash_bytes(hash, &reg->hidden, sizeof(reg->hidden));
+		hash = gdb_hash_bytes(hash, &reg->feature, sizeof(reg->feature));
+		hash = gdb_hash_bytes(hash, &reg->reg_data_type, sizeof(reg->reg_data_type));
+		hash = gdb_hash_bytes(hash, &reg->group, sizeof(reg->group));
+		if (reg->name)
+			hash = gdb_hash_bytes(hash, reg->name, strlen(reg->name));
 	}
 
-	char *tdesc = target_desc->tdesc;
-	uint32_t tdesc_length = target_desc->tdesc_length;
+	free(reg_list);
+
+	*hash_out = hash;
+	return ERROR_OK;
+}
 
-	if (tdesc == NULL) {
-		int retval = gdb_generate_target_description(target, &tdesc);
+static int gdb_get_target_description_chunk(struct target *target, struct gdb_service *service,
+		char **chunk, int32_t offset, uint32_t length)
+{
+	/* GDB starts each transfer at offset 0; the description is checked
+	 * then, and the rest of the chunks come from the same copy. */
+	if (offset == 0 || service->tdesc == NULL) {
+		uint32_t hash;
+		int retval = gdb_target_description_hash(target, &hash);
 		if (retval != ERROR_OK) {
 			LOG_ERROR("Unable to Generate Target Description");
 			return ERROR_FAIL;
 		}
 
-		tdesc_length = strlen(tdesc);
+		if (service->tdesc == NULL || service->tdesc_hash != hash) {
+			char *tdesc;
+			retval = gdb_generate_target_description(target, &tdesc);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Unable to Generate Target Description");
+				return ERROR_FAIL;
+			}
+
+			free(service->tdesc);
+			service->tdesc = tdesc;
+			service->tdesc_length = strlen(tdesc);
+			service->tdesc_hash = hash;
+		}
 	}
 
+	const char *tdesc = service->tdesc;
+	uint32_t tdesc_length = service->tdesc_length;
+
+	if ((uint32_t)offset > tdesc_length)
+		offset = tdesc_length;
+
 	char transfer_type;
 
 	if (length < (tdesc_length - offset))
@@ -2470,16 +2988,8 @@ static int gdb_get_target_description_chunk(struct target *target, struct target
 	} else {
 		strncpy((*chunk) + 1, tdesc + offset, tdesc_length - offset);
 		(*chunk)[1 + (tdesc_length - offset)] = '\0';
-
-		/* After gdb-server sends out last chunk, invalidate tdesc. */
-		free(tdesc);
-		tdesc = NULL;
-		tdesc_length = 0;
 	}
 
-	target_desc->tdesc = tdesc;
-	target_desc->tdesc_length = tdesc_length;
-
 	return ERROR_OK;
 }
 
@@ -2712,10 +3222,11 @@ static int gdb_query_packet(struct connection *connection,
 			&buffer,
 			&pos,
 			&size,
-			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+;vContSupported+",
-			GDB_BUFFER_SIZE,
+			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+;vContSupported+;QNonStop%c",
+			gdb_connection->packet_size,
 			((gdb_use_memory_map == 1) && (flash_get_bank_count() > 0)) ? '+' : '-',
-			(gdb_target_desc_supported == 1) ? '+' : '-');
+			(gdb_target_desc_supported == 1) ? '+' : '-',
+			gdb_non_stop_supported(target) ? '+' : '-');
 
 		if (retval != ERROR_OK) {
 			gdb_send_error(connection, 01);
@@ -2749,7 +3260,7 @@ static int gdb_query_packet(struct connection *connection,
 		 * there are *more* chunks to transfer. 'l' for it is the *last*
 		 * chunk of target description.
 		 */
-		retval = gdb_get_target_description_chunk(target, &gdb_connection->target_desc,
+		retval = gdb_get_target_description_chunk(target, connection->service->priv,
 				&xml, offset, length);
 		if (retval != ERROR_OK) {
 			gdb_error(connection, retval);
@@ -2795,6 +3306,8 @@ static int gdb_query_packet(struct connection *connection,
 		gdb_connection->noack_mode = 1;
 		gdb_put_packet(connection, "OK", 2);
 		return ERROR_OK;
+	} else if (strncmp(packet, "QNonStop:", 9) == 0) {
+		return gdb_non_stop_packet(connection, packet[9] == '1');
 	}
 
 	gdb_put_packet(connection, "", 0);
@@ -2810,6 +3323,10 @@ static bool gdb_handle_vcont_packet(struct connection *connection, const char *p
 
 	/* query for vCont supported */
 	if (parse[0] == '?') {
+		if (gdb_connection->non_stop) {
+			gdb_put_packet(connection, "vCont;c;C;s;S;t", 15);
+			return true;
+		}
 		if (target->type->step != NULL) {
 			/* gdb doesn't accept c without C and s without S */
 			gdb_put_packet(connection, "vCont;c;C;s;S", 13);
@@ -2818,6 +3335,11 @@ static bool gdb_handle_vcont_packet(struct connection *connection, const char *p
 		return false;
 	}
 
+	if (gdb_connection->non_stop) {
+		gdb_non_stop_vcont_packet(connection, parse);
+		return true;
+	}
+
 	if (parse[0] == ';') {
 		++parse;
 		--packet_size;
@@ -3081,6 +3603,125 @@ static bool gdb_handle_vrun_packet(struct connection *connection, const char *pa
 	return true;
 }
 
+/* Write the image built from vFlashWrite packets to flash and drop it */
+static int gdb_vflash_flush(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+	uint32_t written;
+	int retval;
+
+	if (gdb_connection->vflash_image == NULL)
+		return ERROR_OK;
+
+	if (!gdb_connection->vflash_writing) {
+		target_call_event_callbacks(target,
+				TARGET_EVENT_GDB_FLASH_WRITE_START);
+		gdb_connection->vflash_writing = true;
+	}
+
+	/* No need to erase as GDB always issues a vFlashErase first. */
+	retval = flash_write(target, gdb_connection->vflash_image, &written, false);
+	if (retval == ERROR_OK)
+		LOG_DEBUG("wrote %u bytes from vFlash image to flash", (unsigned)written);
+
+	image_close(gdb_connection->vflash_image);
+	free(gdb_connection->vflash_image);
+	gdb_connection->vflash_image = NULL;
+
+	return retval;
+}
+
+static void gdb_vflash_end(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+
+	if (gdb_connection->vflash_writing) {
+		target_call_event_callbacks(target,
+				TARGET_EVENT_GDB_FLASH_WRITE_END);
+		gdb_connection->vflash_writing = false;
+	}
+}
+
+/* Find the flash sector holding addr, as [start, end) */
+static bool gdb_vflash_sector(struct target *target, target_addr_t addr,
+		target_addr_t *start, target_addr_t *end)
+{
+	struct flash_bank *bank;
+
+	if (get_flash_bank_by_addr(target, addr, false, &bank) != ERROR_OK || !bank)
+		return false;
+
+	for (unsigned int i = 0; i < bank->num_sectors; i++) {
+		target_addr_t sector_start = bank->base + bank->sectors[i].offset;
+		target_addr_t sector_end = sector_start + bank->sectors[i].size;
+		if (addr >= sector_start && addr < sector_end) {
+			*start = sector_start;
+			*end = sector_end;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Add vFlashWrite data to the image, and program each sector as soon as
+ * GDB has moved past it. GDB sends the data of a load in address order,
+ * so only the sector being filled is kept in memory. */
+static int gdb_vflash_stream(struct connection *connection,
+		target_addr_t addr, uint32_t length, const uint8_t *data)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct target *target = get_target_from_connection(connection);
+	struct image *image = gdb_connection->vflash_image;
+	target_addr_t start, end;
+	int retval;
+
+	/* data outside of the sector being filled completes it */
+	if (image && image->num_sections) {
+		struct imagesection *last = &image->sections[image->num_sections - 1];
+		target_addr_t last_end = last->base_address + last->size;
+		if (addr != last_end &&
+				(!gdb_vflash_sector(target, last_end - 1, &start, &end) ||
+				addr < start || addr >= end)) {
+			retval = gdb_vflash_flush(connection);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+	}
+
+	while (length) {
+		uint32_t chunk = length;
+		bool sector_done = false;
+
+		if (gdb_vflash_sector(target, addr, &start, &end) && end - addr <= length) {
+			chunk = end - addr;
+			sector_done = true;
+		}
+
+		if (gdb_connection->vflash_image == NULL) {
+			gdb_connection->vflash_image = malloc(sizeof(struct image));
+			image_open(gdb_connection->vflash_image, "", "build");
+		}
+		retval = image_add_section(gdb_connection->vflash_image,
+				addr, chunk, 0x0, data);
+		if (retval != ERROR_OK)
+			return retval;
+
+		if (sector_done) {
+			retval = gdb_vflash_flush(connection);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+
+		addr += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+
+	return ERROR_OK;
+}
+
 static int gdb_v_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
@@ -3107,6 +3748,16 @@ static int gdb_v_packet(struct connection *connection,
 		return ERROR_OK;
 	}
 
+	if (gdb_connection->non_stop && strncmp(packet, "vStopped", 8) == 0) {
+		gdb_non_stop_vstopped_packet(connection);
+		return ERROR_OK;
+	}
+
+	if (gdb_connection->non_stop && strncmp(packet, "vCtrlC", 6) == 0) {
+		gdb_non_stop_ctrl_c_packet(connection);
+		return ERROR_OK;
+	}
+
 	if (strncmp(packet, "vRun", 4) == 0) {
 		bool handled;
 
@@ -3197,6 +3848,27 @@ static int gdb_v_packet(struct connection *connection,
 		}
 		length = packet_size - (parse - packet);
 
+		if (gdb_flash_stream) {
+			if (gdb_connection->vflash_failed) {
+				gdb_send_error(connection, EIO);
+				return ERROR_OK;
+			}
+
+			result = gdb_vflash_stream(connection, addr, length,
+					(uint8_t const *)parse);
+			if (result != ERROR_OK) {
+				gdb_connection->vflash_failed = true;
+				gdb_vflash_end(connection);
+				if (result == ERROR_FLASH_DST_OUT_OF_BANK)
+					gdb_put_packet(connection, "E.memtype", 9);
+				else
+					gdb_send_error(connection, EIO);
+			} else
+				gdb_put_packet(connection, "OK", 2);
+
+			return ERROR_OK;
+		}
+
 		/* create a new image if there isn't already one */
 		if (gdb_connection->vflash_image == NULL) {
 			gdb_connection->vflash_image = malloc(sizeof(struct image));
@@ -3215,29 +3887,21 @@ static int gdb_v_packet(struct connection *connection,
 	}
 
 	if (strncmp(packet, "vFlashDone", 10) == 0) {
-		uint32_t written;
+		/* process the flashing buffer, or what is left of it when
+		 * streaming */
+		result = gdb_vflash_flush(connection);
+		if (result == ERROR_OK && gdb_connection->vflash_failed)
+			result = ERROR_FAIL;
+		gdb_connection->vflash_failed = false;
+		gdb_vflash_end(connection);
 
-		/* process the flashing buffer. No need to erase as GDB
-		 * always issues a vFlashErase first. */
-		target_call_event_callbacks(target,
-				TARGET_EVENT_GDB_FLASH_WRITE_START);
-		result = flash_write(target, gdb_connection->vflash_image,
-			&written, false);
-		target_call_event_callbacks(target,
-			TARGET_EVENT_GDB_FLASH_WRITE_END);
 		if (result != ERROR_OK) {
 			if (result == ERROR_FLASH_DST_OUT_OF_BANK)
 				gdb_put_packet(connection, "E.memtype", 9);
 			else
 				gdb_send_error(connection, EIO);
-		} else {
-			LOG_DEBUG("wrote %u bytes from vFlash image to flash", (unsigned)written);
+		} else
 			gdb_put_packet(connection, "OK", 2);
-		}
-
-		image_close(gdb_connection->vflash_image);
-		free(gdb_connection->vflash_image);
-		gdb_connection->vflash_image = NULL;
 
 		return ERROR_OK;
 	}
@@ -3311,7 +3975,8 @@ static void gdb_log_callback(void *priv, const char *file, unsigned line,
 	struct connection *connection = priv;
 	struct gdb_connection *gdb_con = connection->priv;
 
-	if (gdb_con->busy) {
+	/* in non-stop mode, O packets are only allowed as a reply to vCont */
+	if (gdb_con->busy || gdb_con->non_stop) {
 		/* do not reply this using the O packet */
 		return;
 	}
@@ -3328,14 +3993,12 @@ static void gdb_sig_halted(struct connection *connection)
 
 static int gdb_input_inner(struct connection *connection)
 {
-	/* Do not allocate this on the stack */
-	static char gdb_packet_buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for null-termination */
-
 	struct target *target;
-	char const *packet = gdb_packet_buffer;
 	int packet_size;
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
+	char *gdb_packet_buffer = gdb_con->packet_buffer;
+	char const *packet = gdb_packet_buffer;
 	static bool warn_use_ext;
 
 	target = get_target_from_connection(connection);
@@ -3352,7 +4015,7 @@ static int gdb_input_inner(struct connection *connection)
 	 * drain the rest of the buffer.
 	 */
 	do {
-		packet_size = GDB_BUFFER_SIZE;
+		packet_size = gdb_con->packet_size;
 		retval = gdb_get_packet(connection, gdb_packet_buffer, &packet_size);
 		if (retval != ERROR_OK)
 			return retval;
@@ -3381,6 +4044,7 @@ static int gdb_input_inner(struct connection *connection)
 		}
 
 		if (packet_size > 0) {
+			int64_t start = perf_now();
 			retval = ERROR_OK;
 			switch (packet[0]) {
 				case 'T':	/* Is thread alive? */
@@ -3409,6 +4073,7 @@ static int gdb_input_inner(struct connection *connection)
 					retval = gdb_set_register_packet(connection, packet, packet_size);
 					break;
 				case 'm':
+				case 'x':
 					retval = gdb_read_memory_packet(connection, packet, packet_size);
 					break;
 				case 'M':
@@ -3419,7 +4084,10 @@ static int gdb_input_inner(struct connection *connection)
 					retval = gdb_breakpoint_watchpoint_packet(connection, packet, packet_size);
 					break;
 				case '?':
-					gdb_last_signal_packet(connection, packet, packet_size);
+					if (gdb_con->non_stop)
+						gdb_non_stop_status_packet(connection);
+					else
+						gdb_last_signal_packet(connection, packet, packet_size);
 					/* '?' is sent after the eventual '!' */
 					if (!warn_use_ext && !gdb_con->extended_protocol) {
 						warn_use_ext = true;
@@ -3556,6 +4224,7 @@ static int gdb_input_inner(struct connection *connection)
 					gdb_put_packet(connection, "", 0);
 					break;
 			}
+			perf_record_gdb(packet[0], start);
 
 			/* if a packet handler returned an error, exit input loop */
 			if (retval != ERROR_OK)
@@ -3613,6 +4282,9 @@ static int gdb_target_start(struct target *target, const char *port)
 	gdb_service->target = target;
 	gdb_service->core[0] = -1;
 	gdb_service->core[1] = -1;
+	gdb_service->tdesc = NULL;
+	gdb_service->tdesc_length = 0;
+	gdb_service->tdesc_hash = 0;
 	target->gdb_service = gdb_service;
 
 	ret = add_service("gdb",
@@ -3750,6 +4422,15 @@ COMMAND_HANDLER(handle_gdb_flash_program_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_gdb_flash_stream_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ENABLE(CMD_ARGV[0], gdb_flash_stream);
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_gdb_report_data_abort_command)
 {
 	if (CMD_ARGC != 1)
@@ -3768,6 +4449,26 @@ COMMAND_HANDLER(handle_gdb_report_register_access_error)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_gdb_packet_size_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		int size;
+		COMMAND_PARSE_NUMBER(int, CMD_ARGV[0], size);
+		if (size < 1024 || size > GDB_MAX_PACKET_SIZE) {
+			command_print(CMD, "packet size must be between 1024 and %d",
+					GDB_MAX_PACKET_SIZE);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		gdb_packet_size = size;
+	}
+	command_print(CMD, "%d", gdb_packet_size);
+
+	return ERROR_OK;
+}
+
 /* gdb_breakpoint_override */
 COMMAND_HANDLER(handle_gdb_breakpoint_override_command)
 {
@@ -3882,6 +4583,14 @@ static const struct command_registration gdb_command_handlers[] = {
 		.help = "enable or disable flash program",
 		.usage = "('enable'|'disable')"
 	},
+	{
+		.name = "gdb_flash_stream",
+		.handler = handle_gdb_flash_stream_command,
+		.mode = COMMAND_CONFIG,
+		.help = "enable or disable programming flash sectors while "
+			"GDB is still sending the image",
+		.usage = "('enable'|'disable')"
+	},
 	{
 		.name = "gdb_report_data_abort",
 		.handler = handle_gdb_report_data_abort_command,
@@ -3896,6 +4605,14 @@ static const struct command_registration gdb_command_handlers[] = {
 		.help = "enable or disable reporting register access errors",
 		.usage = "('enable'|'disable')"
 	},
+	{
+		.name = "gdb_packet_size",
+		.handler = handle_gdb_packet_size_command,
+		.mode = COMMAND_ANY,
+		.help = "Set or show the largest packet advertised to GDB, "
+			"new connections use it.",
+		.usage = "[bytes]"
+	},
 	{
 		.name = "gdb_breakpoint_override",
 		.handler = handle_gdb_breakpoint_override_command,
@@ -92,7 +92,6 @@ static int rtt_input(struct connection *connection)
 	int bytes_read;
 	unsigned char buffer[1024];
 	struct rtt_service *service;
-	size_t length;
 
 	service = (struct rtt_service *)connection->service->priv;
 	bytes_read = connection_read(connection, buffer, sizeof(buffer));
@@ -104,10 +103,7 @@ static int rtt_input(struct connection *connection)
 		return ERROR_SERVER_REMOTE_CLOSED;
 	}
 
-	length = bytes_read;
-	rtt_write_channel(service->channel, buffer, &length);
-
-	return ERROR_OK;
+	return rtt_queue_write_channel(service->channel, buffer, bytes_read);
 }
 
 COMMAND_HANDLER(handle_rtt_start_command)
@@ -45,8 +45,42 @@
 #include <netinet/tcp.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define SERVER_USE_EPOLL
+#elif defined(HAVE_SYS_EVENT_H)
+#include <sys/event.h>
+#define SERVER_USE_KQUEUE
+#endif
+
 static struct service *services;
 
+static bool server_flush_output(void);
+
+/* How long server_loop() sleeps at most while output is queued */
+#define SERVER_OUTPUT_RETRY_MS	10
+
+/* Events handled per wakeup of epoll or kqueue. */
+#define SERVER_MAX_EVENTS	64
+
+/* epoll or kqueue instance watching all services and connections, or -1 if
+ * server_loop() has to rebuild an fd_set and use select() instead. */
+static int event_fd = -1;
+/* Set once event_fd couldn't watch a descriptor (epoll refuses regular
+ * files, for instance), after which select() is used for good. */
+static bool event_fd_failed;
+/* Set when a descriptor stops being watched. The rest of the current batch
+ * of events may then point at a freed service or connection. */
+static bool events_stale;
+
+/* The data of an event is a pointer to the connection or, with this bit
+ * set, to the service. */
+#define EVENT_TAG_SERVICE	((uintptr_t)1)
+
 enum shutdown_reason {
 	CONTINUE_MAIN_LOOP,			/* stay in main event loop */
 	SHUTDOWN_REQUESTED,			/* set by shutdown command; exit the event loop and quit the debugger */
@@ -64,6 +98,66 @@ static int polling_period = 100;
 /* address by name on which to listen for incoming TCP/IP connections */
 static char *bindto_name;
 
+static void event_watch(int fd, void *owner, bool is_service)
+{
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+	if (fd < 0 || event_fd_failed)
+		return;
+
+	if (event_fd < 0) {
+#ifdef SERVER_USE_EPOLL
+		event_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+		event_fd = kqueue();
+#endif
+		if (event_fd < 0) {
+			LOG_DEBUG("using select(): %s", strerror(errno));
+			event_fd_failed = true;
+			return;
+		}
+	}
+
+	uintptr_t data = (uintptr_t)owner | (is_service ? EVENT_TAG_SERVICE : 0);
+#ifdef SERVER_USE_EPOLL
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = (void *)data,
+	};
+	if (epoll_ctl(event_fd, EPOLL_CTL_ADD, fd, &event) == 0)
+		return;
+#else
+	struct kevent event;
+	EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, (void *)data);
+	if (kevent(event_fd, &event, 1, NULL, 0, NULL) == 0)
+		return;
+#endif
+
+	/* The descriptors watched so far will simply be found by select(). */
+	LOG_DEBUG("using select(), can't watch fd %d: %s", fd, strerror(errno));
+	close(event_fd);
+	event_fd = -1;
+	event_fd_failed = true;
+#endif
+}
+
+static void event_unwatch(int fd)
+{
+	events_stale = true;
+
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+	if (fd < 0 || event_fd < 0)
+		return;
+
+#ifdef SERVER_USE_EPOLL
+	epoll_ctl(event_fd, EPOLL_CTL_DEL, fd, NULL);
+#else
+	struct kevent event;
+	EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	kevent(event_fd, &event, 1, NULL, 0, NULL);
+#endif
+#endif
+}
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -78,6 +172,10 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	c->cmd_ctx = copy_command_context(cmd_ctx);
 	c->service = service;
 	c->input_pending = false;
+	c->out_buf = NULL;
+	c->out_len = 0;
+	c->out_size = 0;
+	c->out_error = false;
 	c->priv = NULL;
 	c->next = NULL;
 
@@ -117,6 +215,7 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 #endif
 
 		/* do not check for new connections again on stdin */
+		event_unwatch(service->fd);
 		service->fd = -1;
 
 		LOG_INFO("accepting '%s' connection from pipe", service->name);
@@ -130,6 +229,7 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	} else if (service->type == CONNECTION_PIPE) {
 		c->fd = service->fd;
 		/* do not check for new connections again on stdin */
+		event_unwatch(service->fd);
 		service->fd = -1;
 
 		char *out_file = alloc_printf("%so", service->port);
@@ -157,6 +257,8 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 		;
 	*p = c;
 
+	event_watch(c->fd, c, false);
+
 	if (service->max_connections != CONNECTION_LIMIT_UNLIMITED)
 		service->max_connections--;
 
@@ -172,17 +274,21 @@ static int remove_connection(struct service *service, struct connection *connect
 	while ((c = *p)) {
 		if (c->fd == connection->fd) {
 			service->connection_closed(c);
+			event_unwatch(c->fd);
 			if (service->type == CONNECTION_TCP)
 				close_socket(c->fd);
 			else if (service->type == CONNECTION_PIPE) {
 				/* The service will listen to the pipe again */
 				c->service->fd = c->fd;
+				event_watch(c->service->fd, c->service, true);
 			}
 
+			target_release_session(c->cmd_ctx);
 			command_done(c->cmd_ctx);
 
 			/* delete connection */
 			*p = c->next;
+			free(c->out_buf);
 			free(c);
 
 			if (service->max_connections != CONNECTION_LIMIT_UNLIMITED)
@@ -348,6 +454,8 @@ int add_service(char *name,
 		;
 	*p = c;
 
+	event_watch(c->fd, c, true);
+
 	/* if new_service is not NULL, return the created service into it */
 	if (new_service)
 		*new_service = c;
@@ -386,6 +494,7 @@ int remove_service(const char *name, const char *port)
 			else
 				prev->next = tmp->next;
 
+			event_unwatch(tmp->fd);
 			if (tmp->type != CONNECTION_STDINOUT)
 				close_socket(tmp->fd);
 
@@ -408,6 +517,7 @@ static int remove_services(void)
 		struct service *next = c->next;
 
 		remove_connections(c);
+		event_unwatch(c->fd);
 
 		free(c->name);
 
@@ -426,18 +536,168 @@ static int remove_services(void)
 
 	services = NULL;
 
+	if (event_fd >= 0) {
+		close(event_fd);
+		event_fd = -1;
+	}
+	event_fd_failed = false;
+
 	return ERROR_OK;
 }
 
-int server_loop(struct command_context *command_context)
+static void server_accept(struct service *service,
+		struct command_context *command_context)
+{
+	if (service->max_connections != 0) {
+		add_connection(service, command_context);
+		return;
+	}
+
+	if (service->type == CONNECTION_TCP) {
+		struct sockaddr_in sin;
+		socklen_t address_size = sizeof(sin);
+		int tmp_fd;
+		tmp_fd = accept(service->fd,
+				(struct sockaddr *)&service->sin,
+				&address_size);
+		close_socket(tmp_fd);
+	}
+	LOG_INFO("rejected '%s' connection, no more connections allowed",
+		service->name);
+}
+
+static void server_input(struct service *service, struct connection *c)
+{
+	if (service->input(c) == ERROR_OK)
+		return;
+
+	if (service->type == CONNECTION_PIPE ||
+			service->type == CONNECTION_STDINOUT) {
+		/* if connection uses a pipe then
+		 * shutdown openocd on error */
+		shutdown_openocd = SHUTDOWN_REQUESTED;
+	}
+	remove_connection(service, c);
+	LOG_INFO("dropped '%s' connection", service->name);
+}
+
+static int server_select(fd_set *read_fds, int timeout_ms)
 {
-	struct service *service;
+	int fd_max = 0;
+	FD_ZERO(read_fds);
+
+	/* add service and connection fds to read_fds */
+	for (struct service *service = services; service; service = service->next) {
+		if (service->fd != -1) {
+			/* listen for new connections */
+			FD_SET(service->fd, read_fds);
+
+			if (service->fd > fd_max)
+				fd_max = service->fd;
+		}
+
+		for (struct connection *c = service->connections; c; c = c->next) {
+			/* check for activity on the connection */
+			FD_SET(c->fd, read_fds);
+			if (c->fd > fd_max)
+				fd_max = c->fd;
+		}
+	}
 
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	return socket_select(fd_max + 1, read_fds, NULL, NULL, &tv);
+}
+
+static void server_handle_select(fd_set *read_fds,
+		struct command_context *command_context)
+{
+	for (struct service *service = services; service; service = service->next) {
+		/* handle new connections on listeners */
+		if ((service->fd != -1) && (FD_ISSET(service->fd, read_fds)))
+			server_accept(service, command_context);
+
+		/* handle activity on connections */
+		for (struct connection *c = service->connections; c; ) {
+			struct connection *next = c->next;
+			if ((c->fd >= 0 && FD_ISSET(c->fd, read_fds)) || c->input_pending)
+				server_input(service, c);
+			c = next;
+		}
+	}
+}
+
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+
+#ifdef SERVER_USE_EPOLL
+typedef struct epoll_event server_event_t;
+#define SERVER_EVENT_DATA(event)	((uintptr_t)(event).data.ptr)
+#else
+typedef struct kevent server_event_t;
+#define SERVER_EVENT_DATA(event)	((uintptr_t)(event).udata)
+#endif
+
+static int server_wait_events(server_event_t *events, int timeout_ms)
+{
+#ifdef SERVER_USE_EPOLL
+	return epoll_wait(event_fd, events, SERVER_MAX_EVENTS, timeout_ms);
+#else
+	struct timespec timeout = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = (timeout_ms % 1000) * 1000000L,
+	};
+	return kevent(event_fd, NULL, 0, events, SERVER_MAX_EVENTS, &timeout);
+#endif
+}
+
+static void server_handle_events(server_event_t *events, int count,
+		struct command_context *command_context)
+{
+	struct connection *handled[SERVER_MAX_EVENTS];
+	int num_handled = 0;
+
+	events_stale = false;
+	for (int i = 0; i < count && !events_stale; i++) {
+		uintptr_t data = SERVER_EVENT_DATA(events[i]);
+		if (data & EVENT_TAG_SERVICE) {
+			server_accept((struct service *)(data & ~EVENT_TAG_SERVICE),
+					command_context);
+		} else {
+			struct connection *c = (struct connection *)data;
+			handled[num_handled++] = c;
+			server_input(c->service, c);
+		}
+	}
+
+	/* Input that has already been read into a buffer doesn't make the
+	 * descriptor readable. */
+	for (struct service *service = services; service; service = service->next) {
+		for (struct connection *c = service->connections; c; ) {
+			struct connection *next = c->next;
+			if (c->input_pending) {
+				int i = 0;
+				while (i < num_handled && handled[i] != c)
+					i++;
+				if (i == num_handled)
+					server_input(service, c);
+			}
+			c = next;
+		}
+	}
+}
+
+#endif
+
+int server_loop(struct command_context *command_context)
+{
 	bool poll_ok = true;
 
 	/* used in select() */
 	fd_set read_fds;
-	int fd_max;
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+	server_event_t events[SERVER_MAX_EVENTS];
+#endif
 
 	/* used in accept() */
 	int retval;
@@ -450,70 +710,52 @@ int server_loop(struct command_context *command_context)
 #endif
 
 	while (shutdown_openocd == CONTINUE_MAIN_LOOP) {
-		/* monitor sockets for activity */
-		fd_max = 0;
-		FD_ZERO(&read_fds);
-
-		/* add service and connection fds to read_fds */
-		for (service = services; service; service = service->next) {
-			if (service->fd != -1) {
-				/* listen for new connections */
-				FD_SET(service->fd, &read_fds);
-
-				if (service->fd > fd_max)
-					fd_max = service->fd;
-			}
-
-			if (service->connections) {
-				struct connection *c;
-
-				for (c = service->connections; c; c = c->next) {
-					/* check for activity on the connection */
-					FD_SET(c->fd, &read_fds);
-					if (c->fd > fd_max)
-						fd_max = c->fd;
-				}
-			}
-		}
+		/* monitor sockets for activity, with epoll or kqueue if they could
+		 * take all descriptors and select() otherwise */
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+		bool use_events = event_fd >= 0;
+#endif
+		int timeout_ms = 0;
+		bool output_pending = server_flush_output();
 
-		struct timeval tv;
-		tv.tv_sec = 0;
-		if (poll_ok) {
-			/* we're just polling this iteration, this is faster on embedded
-			 * hosts */
-			tv.tv_usec = 0;
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
-		} else {
+		/* when we're just polling this iteration, the timeout stays 0,
+		 * this is faster on embedded hosts */
+		if (!poll_ok) {
 			/* Every 100ms, can be changed with "poll_period" command */
-			int timeout_ms = next_event - timeval_ms();
+			timeout_ms = next_event - timeval_ms();
 			if (timeout_ms < 0)
 				timeout_ms = 0;
 			else if (timeout_ms > polling_period)
 				timeout_ms = polling_period;
-			tv.tv_usec = timeout_ms * 1000;
+			/* come back soon for slow readers with queued output */
+			if (output_pending && timeout_ms > SERVER_OUTPUT_RETRY_MS)
+				timeout_ms = SERVER_OUTPUT_RETRY_MS;
 			/* Only while we're sleeping we'll let others run */
 			openocd_sleep_prelude();
 			kept_alive();
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
-			openocd_sleep_postlude();
+			log_flush();
 		}
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+		if (use_events)
+			retval = server_wait_events(events, timeout_ms);
+		else
+#endif
+			retval = server_select(&read_fds, timeout_ms);
+		if (!poll_ok)
+			openocd_sleep_postlude();
 
 		if (retval == -1) {
 #ifdef _WIN32
 
 			errno = WSAGetLastError();
 
-			if (errno == WSAEINTR)
-				FD_ZERO(&read_fds);
-			else {
+			if (errno != WSAEINTR) {
 				LOG_ERROR("error during select: %s", strerror(errno));
 				return ERROR_FAIL;
 			}
 #else
 
-			if (errno == EINTR)
-				FD_ZERO(&read_fds);
-			else {
+			if (errno != EINTR) {
 				LOG_ERROR("error during select: %s", strerror(errno));
 				return ERROR_FAIL;
 			}
@@ -526,8 +768,6 @@ int server_loop(struct command_context *command_context)
 			target_call_timer_callbacks(&next_event);
 			process_jim_events(command_context);
 
-			FD_ZERO(&read_fds);	/* eCos leaves read_fds unchanged in this case!  */
-
 			/* We timed out/there was nothing to do, timeout rather than poll next time
 			 **/
 			poll_ok = false;
@@ -543,53 +783,16 @@ int server_loop(struct command_context *command_context)
 		 */
 		poll_ok = poll_ok || target_got_message();
 
-		for (service = services; service; service = service->next) {
-			/* handle new connections on listeners */
-			if ((service->fd != -1)
-				&& (FD_ISSET(service->fd, &read_fds))) {
-				if (service->max_connections != 0)
-					add_connection(service, command_context);
-				else {
-					if (service->type == CONNECTION_TCP) {
-						struct sockaddr_in sin;
-						socklen_t address_size = sizeof(sin);
-						int tmp_fd;
-						tmp_fd = accept(service->fd,
-								(struct sockaddr *)&service->sin,
-								&address_size);
-						close_socket(tmp_fd);
-					}
-					LOG_INFO(
-						"rejected '%s' connection, no more connections allowed",
-						service->name);
-				}
-			}
-
-			/* handle activity on connections */
-			if (service->connections) {
-				struct connection *c;
-
-				for (c = service->connections; c; ) {
-					if ((c->fd >= 0 && FD_ISSET(c->fd, &read_fds)) || c->input_pending) {
-						retval = service->input(c);
-						if (retval != ERROR_OK) {
-							struct connection *next = c->next;
-							if (service->type == CONNECTION_PIPE ||
-									service->type == CONNECTION_STDINOUT) {
-								/* if connection uses a pipe then
-								 * shutdown openocd on error */
-								shutdown_openocd = SHUTDOWN_REQUESTED;
-							}
-							remove_connection(service, c);
-							LOG_INFO("dropped '%s' connection",
-								service->name);
-							c = next;
-							continue;
-						}
-					}
-					c = c->next;
-				}
-			}
+#if defined(SERVER_USE_EPOLL) || defined(SERVER_USE_KQUEUE)
+		if (use_events) {
+			server_handle_events(events, MAX(retval, 0), command_context);
+		} else
+#endif
+		{
+			/* eCos leaves read_fds unchanged on timeout! */
+			if (retval <= 0)
+				FD_ZERO(&read_fds);
+			server_handle_select(&read_fds, command_context);
 		}
 
 #ifdef _WIN32
@@ -749,6 +952,203 @@ int connection_write(struct connection *connection, const void *data, int len)
 		return write(connection->fd_out, data, len);
 }
 
+/* Write as much as the peer takes without waiting for it. Sockets are
+ * blocking on some hosts, but stdout and pipes aren't worth waiting for. */
+static int connection_write_nowait(struct connection *connection,
+		const void *data, int len)
+{
+#ifdef MSG_DONTWAIT
+	if (connection->service->type == CONNECTION_TCP)
+		return send(connection->fd_out, data, len, MSG_DONTWAIT);
+#endif
+	return connection_write(connection, data, len);
+}
+
+static bool connection_would_block(void)
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+/**
+ * Send data without stalling the server loop on a peer that doesn't read.
+ * What the peer doesn't take right away is queued, after anything queued
+ * before, and sent by server_loop() as the peer catches up.
+ * @returns ERROR_OK, or ERROR_SERVER_REMOTE_CLOSED once the connection
+ * failed or queued more than CONNECTION_OUTPUT_MAX.
+ */
+int connection_send(struct connection *connection, const void *data, int len)
+{
+	if (connection->out_error)
+		return ERROR_SERVER_REMOTE_CLOSED;
+
+	if (connection->out_len == 0 && len > 0) {
+		int written = connection_write_nowait(connection, data, len);
+		if (written < 0) {
+			if (!connection_would_block()) {
+				connection->out_error = true;
+				return ERROR_SERVER_REMOTE_CLOSED;
+			}
+			written = 0;
+		}
+		data = (const char *)data + written;
+		len -= written;
+	}
+	if (len <= 0)
+		return ERROR_OK;
+
+	if (connection->out_len + len > CONNECTION_OUTPUT_MAX) {
+		/* set first, the log message may come back to this connection */
+		connection->out_error = true;
+		LOG_ERROR("'%s' client doesn't read its output, closing the connection",
+				connection->service->name);
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	if (connection->out_len + len > connection->out_size) {
+		size_t size = MAX(connection->out_size * 2, connection->out_len + len);
+		size = MAX(size, 4096u);
+		char *buf = realloc(connection->out_buf, size);
+		if (!buf) {
+			connection->out_error = true;
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+		connection->out_buf = buf;
+		connection->out_size = size;
+	}
+	memcpy(connection->out_buf + connection->out_len, data, len);
+	connection->out_len += len;
+
+	return ERROR_OK;
+}
+
+size_t connection_output_pending(struct connection *connection)
+{
+	return connection->out_len;
+}
+
+static void connection_flush(struct connection *connection)
+{
+	if (connection->out_len == 0 || connection->out_error)
+		return;
+
+	int written = connection_write_nowait(connection, connection->out_buf,
+			connection->out_len);
+	if (written < 0) {
+		if (!connection_would_block()) {
+			/* the input handler finds out about the closed peer */
+			connection->out_error = true;
+			connection->out_len = 0;
+		}
+		return;
+	}
+
+	connection->out_len -= written;
+	memmove(connection->out_buf, connection->out_buf + written, connection->out_len);
+}
+
+/* Send what connection_send() queued, returns true if some is left */
+static bool server_flush_output(void)
+{
+	bool pending = false;
+
+	for (struct service *service = services; service; service = service->next) {
+		for (struct connection *c = service->connections; c; c = c->next) {
+			connection_flush(c);
+			if (c->out_len)
+				pending = true;
+		}
+	}
+
+	return pending;
+}
+
+/* Most frames have fewer pieces, connection_writev() splits up longer lists */
+#define CONNECTION_MAX_IOV 8
+
+/* A single attempt at writing count <= CONNECTION_MAX_IOV pieces */
+static int connection_writev_once(struct connection *connection,
+		const struct connection_iovec *iov, int count)
+{
+#ifdef _WIN32
+	if (connection->service->type == CONNECTION_TCP) {
+		WSABUF bufs[CONNECTION_MAX_IOV];
+		DWORD sent;
+
+		for (int i = 0; i < count; i++) {
+			bufs[i].buf = (char *)iov[i].data;
+			bufs[i].len = iov[i].len;
+		}
+		if (WSASend(connection->fd_out, bufs, count, &sent, 0, NULL, NULL) != 0)
+			return -1;
+		return sent;
+	}
+#elif defined(HAVE_SYS_UIO_H)
+	struct iovec vec[CONNECTION_MAX_IOV];
+
+	for (int i = 0; i < count; i++) {
+		vec[i].iov_base = (void *)iov[i].data;
+		vec[i].iov_len = iov[i].len;
+	}
+	return writev(connection->fd_out, vec, count);
+#endif
+
+#if defined(_WIN32) || !defined(HAVE_SYS_UIO_H)
+	int written = 0;
+
+	for (int i = 0; i < count; i++) {
+		int retval = connection_write(connection, iov[i].data, iov[i].len);
+		if (retval < 0)
+			return written ? written : -1;
+		written += retval;
+		if (retval != iov[i].len)
+			break;
+	}
+	return written;
+#endif
+}
+
+/**
+ * Write several pieces of data back to back, with one system call where the
+ * host has scatter-gather writes, so that framing a payload needs neither a
+ * copy nor a call per piece. Short writes are carried on with.
+ * @returns the number of bytes written, or -1 if nothing could be written.
+ */
+int connection_writev(struct connection *connection,
+		const struct connection_iovec *iov, int iovcnt)
+{
+	struct connection_iovec vec[CONNECTION_MAX_IOV];
+	int total = 0;
+	/* bytes of iov[0] that went out already */
+	int skip = 0;
+
+	while (iovcnt > 0) {
+		int count = MIN(iovcnt, CONNECTION_MAX_IOV);
+
+		memcpy(vec, iov, count * sizeof(*vec));
+		vec[0].data = (const char *)vec[0].data + skip;
+		vec[0].len -= skip;
+
+		int written = connection_writev_once(connection, vec, count);
+		if (written <= 0)
+			return total ? total : written;
+		total += written;
+
+		written += skip;
+		while (iovcnt > 0 && written >= iov->len) {
+			written -= iov->len;
+			iov++;
+			iovcnt--;
+		}
+		skip = written;
+	}
+
+	return total;
+}
+
 int connection_read(struct connection *connection, void *data, int len)
 {
 	if (connection->service->type == CONNECTION_TCP)
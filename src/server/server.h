@@ -51,6 +51,12 @@ struct connection {
 	struct command_context *cmd_ctx;
 	struct service *service;
 	bool input_pending;
+	/* output connection_send() couldn't write without blocking, sent
+	 * from server_loop() as the peer reads */
+	char *out_buf;
+	size_t out_len;
+	size_t out_size;
+	bool out_error;
 	void *priv;
 	struct connection *next;
 };
@@ -94,9 +100,26 @@ int server_loop(struct command_context *command_context);
 
 int server_register_commands(struct command_context *context);
 
+/** One piece of the data passed to connection_writev(). */
+struct connection_iovec {
+	const void *data;
+	int len;
+};
+
 int connection_write(struct connection *connection, const void *data, int len);
+int connection_writev(struct connection *connection,
+		const struct connection_iovec *iov, int iovcnt);
 int connection_read(struct connection *connection, void *data, int len);
 
+/* Above this much queued output, services drop output that only observes
+ * (log messages, notifications) instead of queueing more. */
+#define CONNECTION_OUTPUT_HIGH_WATER	(64 * 1024)
+/* A connection with more queued output than this is considered dead */
+#define CONNECTION_OUTPUT_MAX			(16 * 1024 * 1024)
+
+int connection_send(struct connection *connection, const void *data, int len);
+size_t connection_output_pending(struct connection *connection);
+
 /**
  * Used by server_loop(), defined in server_stubs.c
  */
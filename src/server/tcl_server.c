@@ -22,12 +22,32 @@
 
 #include "tcl_server.h"
 #include <target/target.h>
+#include <target/register.h>
 #include <helper/binarybuffer.h>
 
 #define TCL_SERVER_VERSION		"TCL Server 0.1"
 #define TCL_LINE_INITIAL		(4*1024)
 #define TCL_LINE_MAX			(4*1024*1024)
 
+/* Binary mode frames, requests and replies alike, are an 8 byte header
+ * (opcode, status, two reserved bytes, little endian payload length)
+ * followed by the payload. */
+#define TCL_BINARY_HEADER		8
+#define TCL_BINARY_MAX			TCL_LINE_MAX
+
+enum tcl_binary_op {
+	/* u64 address, u32 count -> data */
+	TCL_BINARY_READ_MEMORY = 'r',
+	/* u64 address, data -> nothing */
+	TCL_BINARY_WRITE_MEMORY = 'w',
+	/* register name -> value, little endian */
+	TCL_BINARY_GET_REGISTER = 'g',
+	/* u16 name length, name, value -> nothing */
+	TCL_BINARY_SET_REGISTER = 's',
+	/* back to Tcl commands */
+	TCL_BINARY_QUIT = 'q',
+};
+
 struct tcl_connection {
 	int tc_linedrop;
 	int tc_lineoffset;
@@ -37,6 +57,10 @@ struct tcl_connection {
 	enum target_state tc_laststate;
 	bool tc_notify;
 	bool tc_trace;
+	/* tc_line holds binary frames instead of Tcl commands */
+	bool tc_binary;
+	/* notifications and trace data dropped since the client fell behind */
+	unsigned int tc_dropped;
 };
 
 static char *tcl_port;
@@ -45,6 +69,7 @@ static char *tcl_port;
 static int tcl_new_connection(struct connection *connection);
 static int tcl_input(struct connection *connection);
 static int tcl_output(struct connection *connection, const void *buf, ssize_t len);
+static int tcl_output_event(struct connection *connection, const void *buf, ssize_t len);
 static int tcl_closed(struct connection *connection);
 
 static int tcl_target_callback_event_handler(struct target *target,
@@ -58,14 +83,14 @@ static int tcl_target_callback_event_handler(struct target *target,
 
 	if (tclc->tc_notify) {
 		snprintf(buf, sizeof(buf), "type target_event event %s\r\n\x1a", target_event_name(event));
-		tcl_output(connection, buf, strlen(buf));
+		tcl_output_event(connection, buf, strlen(buf));
 	}
 
 	if (tclc->tc_laststate != target->state) {
 		tclc->tc_laststate = target->state;
 		if (tclc->tc_notify) {
 			snprintf(buf, sizeof(buf), "type target_state state %s\r\n\x1a", target_state_name(target));
-			tcl_output(connection, buf, strlen(buf));
+			tcl_output_event(connection, buf, strlen(buf));
 		}
 	}
 
@@ -83,7 +108,7 @@ static int tcl_target_callback_reset_handler(struct target *target,
 
 	if (tclc->tc_notify) {
 		snprintf(buf, sizeof(buf), "type target_reset mode %s\r\n\x1a", target_reset_mode_name(reset_mode));
-		tcl_output(connection, buf, strlen(buf));
+		tcl_output_event(connection, buf, strlen(buf));
 	}
 
 	return ERROR_OK;
@@ -107,7 +132,7 @@ static int tcl_target_callback_trace_handler(struct target *target,
 		buf = malloc(max_len);
 		hexify(hex, data, len, hex_len);
 		snprintf(buf, max_len, "%s%s%s", header, hex, trailer);
-		tcl_output(connection, buf, strlen(buf));
+		tcl_output_event(connection, buf, strlen(buf));
 		free(hex);
 		free(buf);
 	}
@@ -117,28 +142,45 @@ static int tcl_target_callback_trace_handler(struct target *target,
 
 /* write data out to a socket.
  *
- * this is a blocking write, so the return value must equal the length, if
- * that is not the case then flag the connection with an output error.
+ * what the client doesn't take right away is queued and sent from the
+ * server loop. If that fails, flag the connection with an output error.
  */
 int tcl_output(struct connection *connection, const void *data, ssize_t len)
 {
-	ssize_t wlen;
 	struct tcl_connection *tclc;
 
 	tclc = connection->priv;
 	if (tclc->tc_outerror)
 		return ERROR_SERVER_REMOTE_CLOSED;
 
-	wlen = connection_write(connection, data, len);
-
-	if (wlen == len)
+	if (connection_send(connection, data, len) == ERROR_OK)
 		return ERROR_OK;
 
-	LOG_ERROR("error during write: %d != %d", (int)wlen, (int)len);
+	LOG_ERROR("error during write of %d bytes", (int)len);
 	tclc->tc_outerror = 1;
 	return ERROR_SERVER_REMOTE_CLOSED;
 }
 
+/* Notifications and trace data are dropped rather than queued for a
+ * client that doesn't keep up. */
+static int tcl_output_event(struct connection *connection, const void *data, ssize_t len)
+{
+	struct tcl_connection *tclc = connection->priv;
+
+	if (connection_output_pending(connection) > CONNECTION_OUTPUT_HIGH_WATER) {
+		if (!tclc->tc_dropped++)
+			LOG_WARNING("tcl client doesn't keep up, dropping its notifications");
+		return ERROR_OK;
+	}
+	if (tclc->tc_dropped) {
+		LOG_INFO("tcl client caught up, %u notifications were dropped",
+				tclc->tc_dropped);
+		tclc->tc_dropped = 0;
+	}
+
+	return tcl_output(connection, data, len);
+}
+
 /* connections */
 static int tcl_new_connection(struct connection *connection)
 {
@@ -171,6 +213,167 @@ static int tcl_new_connection(struct connection *connection)
 	return ERROR_OK;
 }
 
+static int tcl_binary_reply(struct connection *connection, uint8_t op,
+		bool ok, const void *data, uint32_t len)
+{
+	uint8_t header[TCL_BINARY_HEADER] = { op, ok ? 0 : 1, 0, 0 };
+	h_u32_to_le(header + 4, len);
+
+	int retval = tcl_output(connection, header, sizeof(header));
+	if (retval == ERROR_OK && len)
+		retval = tcl_output(connection, data, len);
+	return retval;
+}
+
+static int tcl_binary_error(struct connection *connection, uint8_t op,
+		const char *msg)
+{
+	return tcl_binary_reply(connection, op, false, msg, strlen(msg));
+}
+
+static int tcl_binary_register(struct connection *connection, struct target *target,
+		uint8_t op, const uint8_t *payload, uint32_t len)
+{
+	const char *name_start = (const char *)payload;
+	uint32_t name_len = len;
+
+	if (op == TCL_BINARY_SET_REGISTER) {
+		if (len < 2)
+			return tcl_binary_error(connection, op, "short request");
+		name_start += 2;
+		name_len = le_to_h_u16(payload);
+		if (name_len > len - 2)
+			return tcl_binary_error(connection, op, "short request");
+	}
+
+	char *name = strndup(name_start, name_len);
+	if (!name)
+		return tcl_binary_error(connection, op, "out of memory");
+	struct reg *reg = register_get_by_name(target->reg_cache, name, true);
+	free(name);
+	if (!reg || !reg->exist)
+		return tcl_binary_error(connection, op, "no such register");
+
+	uint32_t size = DIV_ROUND_UP(reg->size, 8);
+
+	if (op == TCL_BINARY_GET_REGISTER) {
+		if (!reg->valid && reg->type->get(reg) != ERROR_OK)
+			return tcl_binary_error(connection, op, "couldn't read register");
+		return tcl_binary_reply(connection, op, true, reg->value, size);
+	}
+
+	if (len - 2 - name_len != size)
+		return tcl_binary_error(connection, op, "wrong value size");
+	uint8_t *buf = malloc(size);
+	if (!buf)
+		return tcl_binary_error(connection, op, "out of memory");
+	memcpy(buf, name_start + name_len, size);
+	int retval = reg->type->set(reg, buf);
+	free(buf);
+	if (retval != ERROR_OK)
+		return tcl_binary_error(connection, op, "couldn't write register");
+	return tcl_binary_reply(connection, op, true, NULL, 0);
+}
+
+static int tcl_binary_request(struct connection *connection, uint8_t op,
+		const uint8_t *payload, uint32_t len)
+{
+	struct tcl_connection *tclc = connection->priv;
+	struct target *target = get_current_target_or_null(connection->cmd_ctx);
+	int retval;
+
+	if (op == TCL_BINARY_QUIT) {
+		tclc->tc_binary = false;
+		return tcl_binary_reply(connection, op, true, NULL, 0);
+	}
+
+	if (!target)
+		return tcl_binary_error(connection, op, "no current target");
+
+	switch (op) {
+		case TCL_BINARY_READ_MEMORY: {
+			if (len != 12)
+				return tcl_binary_error(connection, op, "bad request size");
+			target_addr_t address = le_to_h_u64(payload);
+			uint32_t count = le_to_h_u32(payload + 8);
+			if (count > TCL_BINARY_MAX)
+				return tcl_binary_error(connection, op, "read too large");
+
+			uint8_t *buf = malloc(count ? count : 1);
+			if (!buf)
+				return tcl_binary_error(connection, op, "out of memory");
+			retval = target_read_buffer(target, address, count, buf);
+			if (retval == ERROR_OK)
+				retval = tcl_binary_reply(connection, op, true, buf, count);
+			else
+				retval = tcl_binary_error(connection, op, "couldn't read memory");
+			free(buf);
+			return retval;
+		}
+		case TCL_BINARY_WRITE_MEMORY:
+			if (len < 8)
+				return tcl_binary_error(connection, op, "bad request size");
+			retval = target_write_buffer(target, le_to_h_u64(payload), len - 8,
+					payload + 8);
+			if (retval != ERROR_OK)
+				return tcl_binary_error(connection, op, "couldn't write memory");
+			return tcl_binary_reply(connection, op, true, NULL, 0);
+		case TCL_BINARY_GET_REGISTER:
+		case TCL_BINARY_SET_REGISTER:
+			return tcl_binary_register(connection, target, op, payload, len);
+		default:
+			return tcl_binary_error(connection, op, "unknown request");
+	}
+}
+
+/* Collect binary frames in tc_line and carry out the complete ones. A
+ * request leaving binary mode hands the rest of the input back to Tcl. */
+static int tcl_binary_input(struct connection *connection, const uint8_t *in,
+		size_t len, size_t *used)
+{
+	struct tcl_connection *tclc = connection->priv;
+
+	*used = 0;
+	while (tclc->tc_binary && *used < len) {
+		/* take the header first, then exactly the payload it announces */
+		size_t want = TCL_BINARY_HEADER;
+		if (tclc->tc_lineoffset >= TCL_BINARY_HEADER)
+			want += le_to_h_u32((uint8_t *)tclc->tc_line + 4);
+		if (want > TCL_BINARY_HEADER + TCL_BINARY_MAX) {
+			LOG_ERROR("tcl: binary request too large, closing connection");
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+
+		if ((size_t)tclc->tc_line_size < want) {
+			char *line = realloc(tclc->tc_line, want);
+			if (!line)
+				return ERROR_SERVER_REMOTE_CLOSED;
+			tclc->tc_line = line;
+			tclc->tc_line_size = want;
+		}
+
+		size_t n = MIN(want - tclc->tc_lineoffset, len - *used);
+		memcpy(tclc->tc_line + tclc->tc_lineoffset, in + *used, n);
+		tclc->tc_lineoffset += n;
+		*used += n;
+
+		if ((size_t)tclc->tc_lineoffset < want)
+			continue;
+		/* the header just arrived, go on with its payload */
+		if (want == TCL_BINARY_HEADER && le_to_h_u32((uint8_t *)tclc->tc_line + 4))
+			continue;
+
+		const uint8_t *frame = (const uint8_t *)tclc->tc_line;
+		tclc->tc_lineoffset = 0;
+		int retval = tcl_binary_request(connection, frame[0],
+				frame + TCL_BINARY_HEADER, want - TCL_BINARY_HEADER);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
 static int tcl_input(struct connection *connection)
 {
 	Jim_Interp *interp = (Jim_Interp *)connection->cmd_ctx->interp;
@@ -197,6 +400,15 @@ static int tcl_input(struct connection *connection)
 
 	/* push as much data into the line as possible */
 	for (i = 0; i < rlen; i++) {
+		if (tclc->tc_binary) {
+			size_t used;
+			retval = tcl_binary_input(connection, in + i, rlen - i, &used);
+			if (retval != ERROR_OK)
+				return retval;
+			i += used - 1;
+			continue;
+		}
+
 		/* buffer the data */
 		tclc->tc_line[tclc->tc_lineoffset] = in[i];
 		if (tclc->tc_lineoffset + 1 < tclc->tc_line_size) {
@@ -310,6 +522,24 @@ COMMAND_HANDLER(handle_tcl_notifications_command)
 	}
 }
 
+COMMAND_HANDLER(handle_tcl_binary_command)
+{
+	struct connection *connection = CMD_CTX->output_handler_priv;
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (connection == NULL || strcmp(connection->service->name, "tcl")) {
+		LOG_ERROR("%s: can only be called from the tcl server", CMD_NAME);
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	/* takes effect after the reply to this command */
+	struct tcl_connection *tclc = connection->priv;
+	tclc->tc_binary = true;
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_tcl_trace_command)
 {
 	struct connection *connection = NULL;
@@ -351,6 +581,14 @@ static const struct command_registration tcl_command_handlers[] = {
 		.help = "Target trace output",
 		.usage = "[on|off]",
 	},
+	{
+		.name = "tcl_binary",
+		.handler = handle_tcl_binary_command,
+		.mode = COMMAND_EXEC,
+		.help = "Switch this Tcl RPC connection to binary memory and "
+			"register requests",
+		.usage = "",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
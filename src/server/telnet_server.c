@@ -52,7 +52,7 @@ static int telnet_write(struct connection *connection, const void *data,
 	if (t_con->closed)
 		return ERROR_SERVER_REMOTE_CLOSED;
 
-	if (connection_write(connection, data, len) == len)
+	if (connection_send(connection, data, len) == ERROR_OK)
 		return ERROR_OK;
 	t_con->closed = true;
 	return ERROR_SERVER_REMOTE_CLOSED;
@@ -104,6 +104,19 @@ static void telnet_log_callback(void *priv, const char *file, unsigned line,
 	size_t i;
 	size_t tmp;
 
+	/* Don't let a client that doesn't keep up hold back everyone else */
+	if (connection_output_pending(connection) > CONNECTION_OUTPUT_HIGH_WATER) {
+		t_con->log_dropped++;
+		return;
+	}
+	if (t_con->log_dropped) {
+		char msg[64];
+		snprintf(msg, sizeof(msg), "(%u log messages dropped, output too slow)",
+				t_con->log_dropped);
+		t_con->log_dropped = 0;
+		telnet_log_callback(priv, file, line, function, msg);
+	}
+
 	/* If the prompt is not visible, simply output the message. */
 	if (!t_con->prompt_visible) {
 		telnet_outputline(connection, string);
@@ -56,6 +56,8 @@ struct telnet_connection {
 	size_t next_history;
 	size_t current_history;
 	bool closed;
+	/* log messages dropped since the client fell behind */
+	unsigned int log_dropped;
 };
 
 struct telnet_service {
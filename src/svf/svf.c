@@ -207,9 +207,12 @@ struct svf_check_tdo_para {
 	int bit_len;		/* bit length to check */
 };
 
+/* Initial size of svf_check_tdo_para, which grows as needed, so that
+ * scans are only committed when the buffers fill up */
 #define SVF_CHECK_TDO_PARA_SIZE 1024
 static struct svf_check_tdo_para *svf_check_tdo_para;
 static int svf_check_tdo_para_index;
+static int svf_check_tdo_para_size;
 
 static int svf_read_command_from_file(FILE *fd);
 static int svf_check_tdo(void);
@@ -224,6 +227,12 @@ static char *svf_command_buffer;
 static size_t svf_command_buffer_size;
 static int svf_line_number;
 static int svf_getline(char **lineptr, size_t *n, FILE *stream);
+static void svf_rewind(FILE *stream);
+
+/* svf_getline() reads the file in blocks of this size */
+#define SVF_FILE_BUFFER_SIZE	(64 * 1024)
+static char *svf_file_buffer;
+static size_t svf_file_buffer_pos, svf_file_buffer_len;
 
 #define SVF_MAX_BUFFER_SIZE_TO_COMMIT   (1024 * 1024)
 static uint8_t *svf_tdi_buffer, *svf_tdo_buffer, *svf_mask_buffer;
@@ -317,17 +326,300 @@ static void svf_free_xxd_para(struct svf_xxr_para *para)
 	}
 }
 
+/*
+ * "svf -compile" writes the JTAG operations an SVF file turns into, after
+ * parsing and padding, to a binary file that "svf" can play back without
+ * parsing any hex. All fields are little-endian 32 bit words and scan data
+ * is padded to a multiple of 4 bytes, so the scan buffers are used in place
+ * from the loaded image.
+ */
+#define SVF_COMPILED_MAGIC	"OCDBSVF1"
+#define SVF_COMPILED_MAGIC_LEN	8
+
+enum svf_compiled_op {
+	SVF_OP_TLR = 1,		/* */
+	SVF_OP_PATHMOVE,	/* num_states, states... */
+	SVF_OP_DR_SCAN,		/* num_bits, end_state, line, check, tdi[, tdo, mask] */
+	SVF_OP_IR_SCAN,		/* same as SVF_OP_DR_SCAN */
+	SVF_OP_CLOCKS,		/* num_cycles */
+	SVF_OP_SLEEP,		/* usec */
+	SVF_OP_RESET,		/* trst */
+	SVF_OP_SPEED,		/* khz */
+};
+
+static FILE *svf_compile_fd;
+static int svf_compile_error;
+/* what cmd_queue_cur_state would be if the operations had been queued */
+static tap_state_t svf_compile_state;
+
+static void svf_compile_word(uint32_t value)
+{
+	uint8_t buf[4];
+
+	h_u32_to_le(buf, value);
+	if (fwrite(buf, sizeof(buf), 1, svf_compile_fd) != 1)
+		svf_compile_error = 1;
+}
+
+static void svf_compile_bytes(const uint8_t *data, int num_bits)
+{
+	static const uint8_t zero[4];
+	size_t len = DIV_ROUND_UP(num_bits, 8);
+
+	if (len && fwrite(data, len, 1, svf_compile_fd) != 1)
+		svf_compile_error = 1;
+	if (len % 4 && fwrite(zero, 4 - len % 4, 1, svf_compile_fd) != 1)
+		svf_compile_error = 1;
+}
+
+static tap_state_t svf_cur_state(void)
+{
+	return svf_compile_fd ? svf_compile_state : cmd_queue_cur_state;
+}
+
+static void svf_add_tlr(void)
+{
+	if (svf_compile_fd) {
+		svf_compile_word(SVF_OP_TLR);
+		svf_compile_state = TAP_RESET;
+	} else if (!svf_nil)
+		jtag_add_tlr();
+}
+
+static void svf_add_pathmove(int num_states, const tap_state_t *path)
+{
+	if (svf_compile_fd) {
+		svf_compile_word(SVF_OP_PATHMOVE);
+		svf_compile_word(num_states);
+		for (int i = 0; i < num_states; i++)
+			svf_compile_word(path[i]);
+		svf_compile_state = path[num_states - 1];
+	} else if (!svf_nil)
+		jtag_add_pathmove(num_states, path);
+}
+
+/* Queue a scan of svf_tdi_buffer at svf_buffer_index, capturing into the
+ * same place when check is set. */
+static void svf_add_scan(bool ir, int num_bits, bool check, tap_state_t end_state)
+{
+	uint8_t *data = &svf_tdi_buffer[svf_buffer_index];
+
+	if (svf_compile_fd) {
+		svf_compile_word(ir ? SVF_OP_IR_SCAN : SVF_OP_DR_SCAN);
+		svf_compile_word(num_bits);
+		svf_compile_word(end_state);
+		svf_compile_word(svf_line_number);
+		svf_compile_word(check);
+		svf_compile_bytes(data, num_bits);
+		if (check) {
+			svf_compile_bytes(&svf_tdo_buffer[svf_buffer_index], num_bits);
+			svf_compile_bytes(&svf_mask_buffer[svf_buffer_index], num_bits);
+		}
+		svf_compile_state = end_state;
+	} else if (!svf_nil) {
+		/* NOTE:  doesn't use SVF-specified state paths */
+		if (ir)
+			jtag_add_plain_ir_scan(num_bits, data, check ? data : NULL, end_state);
+		else
+			jtag_add_plain_dr_scan(num_bits, data, check ? data : NULL, end_state);
+	}
+}
+
+static void svf_add_clocks(int num_cycles)
+{
+	if (svf_compile_fd) {
+		svf_compile_word(SVF_OP_CLOCKS);
+		svf_compile_word(num_cycles);
+	} else if (!svf_nil)
+		jtag_add_clocks(num_cycles);
+}
+
+static void svf_add_sleep(uint32_t usec)
+{
+	if (svf_compile_fd) {
+		svf_compile_word(SVF_OP_SLEEP);
+		svf_compile_word(usec);
+	} else if (!svf_nil)
+		jtag_add_sleep(usec);
+}
+
+static void svf_add_reset(int trst)
+{
+	if (svf_compile_fd) {
+		svf_compile_word(SVF_OP_RESET);
+		svf_compile_word(trst);
+		if (trst)
+			svf_compile_state = TAP_RESET;
+	} else if (!svf_nil)
+		jtag_add_reset(trst, 0);
+}
+
+static int svf_set_speed(struct command_context *cmd_ctx, int khz)
+{
+	if (svf_compile_fd) {
+		svf_compile_word(SVF_OP_SPEED);
+		svf_compile_word(khz);
+		return ERROR_OK;
+	}
+	return command_run_linef(cmd_ctx, "adapter speed %d", khz);
+}
+
+static bool svf_compiled_word(const uint8_t **p, const uint8_t *end, uint32_t *value)
+{
+	if (end - *p < 4)
+		return false;
+	*value = le_to_h_u32(*p);
+	*p += 4;
+	return true;
+}
+
+/* Play back a file written by "svf -compile". The operations go through the
+ * same svf_add_*() helpers and TDO checks as a parsed SVF file. */
+static int svf_play_compiled(struct command_context *cmd_ctx, FILE *fd, int *num_ops)
+{
+	uint8_t *image;
+	tap_state_t *path = NULL;
+	long size;
+	int len, padded;
+	int ret = ERROR_OK;
+
+	if (fseek(fd, 0, SEEK_END) != 0 || (size = ftell(fd)) < 0 || fseek(fd, 0, SEEK_SET) != 0) {
+		LOG_ERROR("can't get the size of the compiled SVF file");
+		return ERROR_FAIL;
+	}
+	image = malloc(size);
+	if (!image) {
+		LOG_ERROR("not enough memory");
+		return ERROR_FAIL;
+	}
+	if (fread(image, 1, size, fd) != (size_t)size) {
+		LOG_ERROR("can't read the compiled SVF file");
+		free(image);
+		return ERROR_FAIL;
+	}
+
+	const uint8_t *p = image + SVF_COMPILED_MAGIC_LEN;
+	const uint8_t *end = image + size;
+	uint32_t op, num, end_state, line, check;
+
+	while (ret == ERROR_OK && p < end) {
+		if (!svf_compiled_word(&p, end, &op))
+			goto truncated;
+
+		switch (op) {
+		case SVF_OP_TLR:
+			svf_add_tlr();
+			break;
+		case SVF_OP_PATHMOVE:
+			if (!svf_compiled_word(&p, end, &num) || num == 0 || (end - p) / 4 < num)
+				goto truncated;
+			path = malloc(num * sizeof(*path));
+			if (!path) {
+				LOG_ERROR("not enough memory");
+				ret = ERROR_FAIL;
+				break;
+			}
+			for (uint32_t i = 0; i < num; i++) {
+				svf_compiled_word(&p, end, &end_state);
+				/* both tap_state_t encodings use 0 to 15 */
+				if (end_state > 15)
+					goto corrupt;
+				path[i] = end_state;
+			}
+			svf_add_pathmove(num, path);
+			free(path);
+			path = NULL;
+			break;
+		case SVF_OP_DR_SCAN:
+		case SVF_OP_IR_SCAN:
+			if (!svf_compiled_word(&p, end, &num)
+					|| !svf_compiled_word(&p, end, &end_state)
+					|| !svf_compiled_word(&p, end, &line)
+					|| !svf_compiled_word(&p, end, &check))
+				goto truncated;
+			if (num == 0 || num > INT_MAX - 7 || end_state > 15
+					|| !svf_tap_state_is_stable(end_state))
+				goto corrupt;
+
+			len = DIV_ROUND_UP(num, 8);
+			padded = (len + 3) & ~3;
+			if ((end - p) / padded < (check ? 3 : 1))
+				goto truncated;
+
+			if (svf_buffer_size - svf_buffer_index < len
+					&& svf_realloc_buffers(svf_buffer_index + len) != ERROR_OK) {
+				LOG_ERROR("not enough memory");
+				ret = ERROR_FAIL;
+				break;
+			}
+			svf_line_number = line;
+			memcpy(&svf_tdi_buffer[svf_buffer_index], p, len);
+			p += padded;
+			if (check) {
+				memcpy(&svf_tdo_buffer[svf_buffer_index], p, len);
+				p += padded;
+				memcpy(&svf_mask_buffer[svf_buffer_index], p, len);
+				p += padded;
+			}
+			ret = svf_add_check_para(check, svf_buffer_index, num);
+			svf_add_scan(op == SVF_OP_IR_SCAN, num, check, end_state);
+			svf_buffer_index += len;
+			if (ret == ERROR_OK && svf_buffer_index >= SVF_MAX_BUFFER_SIZE_TO_COMMIT)
+				ret = svf_execute_tap();
+			break;
+		case SVF_OP_CLOCKS:
+			if (!svf_compiled_word(&p, end, &num))
+				goto truncated;
+			svf_add_clocks(num);
+			break;
+		case SVF_OP_SLEEP:
+			if (!svf_compiled_word(&p, end, &num))
+				goto truncated;
+			svf_add_sleep(num);
+			break;
+		case SVF_OP_RESET:
+			if (!svf_compiled_word(&p, end, &num))
+				goto truncated;
+			ret = svf_execute_tap();
+			svf_add_reset(num);
+			break;
+		case SVF_OP_SPEED:
+			if (!svf_compiled_word(&p, end, &num))
+				goto truncated;
+			ret = svf_execute_tap();
+			if (ret == ERROR_OK)
+				ret = svf_set_speed(cmd_ctx, num);
+			break;
+		default:
+			goto corrupt;
+		}
+		(*num_ops)++;
+	}
+
+	if (ret == ERROR_OK)
+		ret = svf_execute_tap();
+	free(image);
+	return ret;
+
+truncated:
+	LOG_ERROR("compiled SVF file is truncated");
+	free(image);
+	return ERROR_FAIL;
+corrupt:
+	LOG_ERROR("compiled SVF file is corrupt at offset %ld", (long)(p - image));
+	free(path);
+	free(image);
+	return ERROR_FAIL;
+}
+
 int svf_add_statemove(tap_state_t state_to)
 {
-	tap_state_t state_from = cmd_queue_cur_state;
+	tap_state_t state_from = svf_cur_state();
 	unsigned index_var;
 
 	/* when resetting, be paranoid and ignore current state */
 	if (state_to == TAP_RESET) {
-		if (svf_nil)
-			return ERROR_OK;
-
-		jtag_add_tlr();
+		svf_add_tlr();
 		return ERROR_OK;
 	}
 
@@ -339,10 +631,10 @@ int svf_add_statemove(tap_state_t state_to)
 						/* recorded path includes current state ... avoid
 						 *extra TCKs! */
 			if (svf_statemoves[index_var].num_of_moves > 1)
-				jtag_add_pathmove(svf_statemoves[index_var].num_of_moves - 1,
+				svf_add_pathmove(svf_statemoves[index_var].num_of_moves - 1,
 					svf_statemoves[index_var].paths + 1);
 			else
-				jtag_add_pathmove(svf_statemoves[index_var].num_of_moves,
+				svf_add_pathmove(svf_statemoves[index_var].num_of_moves,
 					svf_statemoves[index_var].paths);
 			return ERROR_OK;
 		}
@@ -354,11 +646,14 @@ int svf_add_statemove(tap_state_t state_to)
 COMMAND_HANDLER(handle_svf_command)
 {
 #define SVF_MIN_NUM_OF_OPTIONS 1
-#define SVF_MAX_NUM_OF_OPTIONS 5
+#define SVF_MAX_NUM_OF_OPTIONS 7
 	int command_num = 0;
 	int ret = ERROR_OK;
 	int64_t time_measure_ms;
 	int time_measure_s, time_measure_m;
+	const char *compile_name = NULL;
+	bool compiled = false;
+	char magic[SVF_COMPILED_MAGIC_LEN];
 
 	/* use NULL to indicate a "plain" svf file which accounts for
 	 * any additional devices in the scan chain, otherwise the device
@@ -382,6 +677,10 @@ COMMAND_HANDLER(handle_svf_command)
 				return ERROR_FAIL;
 			}
 			i++;
+		} else if (strcmp(CMD_ARGV[i], "-compile") == 0) {
+			if (i + 1 >= CMD_ARGC)
+				return ERROR_COMMAND_SYNTAX_ERROR;
+			compile_name = CMD_ARGV[++i];
 		} else if ((strcmp(CMD_ARGV[i],
 				"quiet") == 0) || (strcmp(CMD_ARGV[i], "-quiet") == 0))
 			svf_quiet = 1;
@@ -408,6 +707,31 @@ COMMAND_HANDLER(handle_svf_command)
 	if (svf_fd == NULL)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
+	compiled = fread(magic, sizeof(magic), 1, svf_fd) == 1
+			&& memcmp(magic, SVF_COMPILED_MAGIC, sizeof(magic)) == 0;
+	rewind(svf_fd);
+
+	if (compile_name) {
+		if (compiled) {
+			command_print(CMD, "svf file is already compiled");
+			fclose(svf_fd);
+			svf_fd = NULL;
+			return ERROR_FAIL;
+		}
+		svf_compile_fd = fopen(compile_name, "wb");
+		if (!svf_compile_fd) {
+			command_print(CMD, "open(\"%s\"): %s", compile_name, strerror(errno));
+			fclose(svf_fd);
+			svf_fd = NULL;
+			return ERROR_FAIL;
+		}
+		svf_compile_error = 0;
+		svf_compile_state = cmd_queue_cur_state;
+		fwrite(SVF_COMPILED_MAGIC, SVF_COMPILED_MAGIC_LEN, 1, svf_compile_fd);
+		/* the operations are recorded whether or not nil is given */
+		svf_nil = 0;
+	}
+
 	/* get time */
 	time_measure_ms = timeval_ms();
 
@@ -417,6 +741,7 @@ COMMAND_HANDLER(handle_svf_command)
 
 	svf_check_tdo_para_index = 0;
 	svf_check_tdo_para = malloc(sizeof(struct svf_check_tdo_para) * SVF_CHECK_TDO_PARA_SIZE);
+	svf_check_tdo_para_size = SVF_CHECK_TDO_PARA_SIZE;
 	if (NULL == svf_check_tdo_para) {
 		LOG_ERROR("not enough memory");
 		ret = ERROR_FAIL;
@@ -435,11 +760,15 @@ COMMAND_HANDLER(handle_svf_command)
 
 	memcpy(&svf_para, &svf_para_init, sizeof(svf_para));
 
-	if (!svf_nil) {
-		/* TAP_RESET */
-		jtag_add_tlr();
+	if (compiled) {
+		/* the compiled file starts with its own TAP_RESET */
+		ret = svf_play_compiled(CMD_CTX, svf_fd, &command_num);
+		goto print_time;
 	}
 
+	/* TAP_RESET */
+	svf_add_tlr();
+
 	if (tap) {
 		/* Tap is specified, set header/trailer paddings */
 		int header_ir_len = 0, header_dr_len = 0, trailer_ir_len = 0, trailer_dr_len = 0;
@@ -484,13 +813,21 @@ COMMAND_HANDLER(handle_svf_command)
 		}
 	}
 
+	svf_file_buffer = malloc(SVF_FILE_BUFFER_SIZE);
+	if (!svf_file_buffer) {
+		LOG_ERROR("not enough memory");
+		ret = ERROR_FAIL;
+		goto free_all;
+	}
+	svf_file_buffer_pos = 0;
+	svf_file_buffer_len = 0;
+
 	if (svf_progress_enabled) {
 		/* Count total lines in file. */
-		while (!feof(svf_fd)) {
-			svf_getline(&svf_command_buffer, &svf_command_buffer_size, svf_fd);
+		while (svf_getline(&svf_command_buffer, &svf_command_buffer_size, svf_fd) > 0)
 			svf_total_lines++;
-		}
-		rewind(svf_fd);
+		svf_total_lines++;
+		svf_rewind(svf_fd);
 	}
 	while (ERROR_OK == svf_read_command_from_file(svf_fd)) {
 		/* Log Output */
@@ -518,11 +855,10 @@ COMMAND_HANDLER(handle_svf_command)
 		command_num++;
 	}
 
-	if ((!svf_nil) && (ERROR_OK != jtag_execute_queue()))
-		ret = ERROR_FAIL;
-	else if (ERROR_OK != svf_check_tdo())
+	if (ERROR_OK != svf_execute_tap())
 		ret = ERROR_FAIL;
 
+print_time:
 	/* print time */
 	time_measure_ms = timeval_ms() - time_measure_ms;
 	time_measure_s = time_measure_ms / 1000;
@@ -541,7 +877,20 @@ free_all:
 	fclose(svf_fd);
 	svf_fd = 0;
 
+	if (svf_compile_fd) {
+		if (fclose(svf_compile_fd) != 0)
+			svf_compile_error = 1;
+		svf_compile_fd = NULL;
+		if (svf_compile_error) {
+			LOG_ERROR("failed to write \"%s\"", compile_name);
+			ret = ERROR_FAIL;
+		}
+	}
+
 	/* free buffers */
+	free(svf_file_buffer);
+	svf_file_buffer = NULL;
+
 	free(svf_command_buffer);
 	svf_command_buffer = NULL;
 	svf_command_buffer_size = 0;
@@ -549,6 +898,7 @@ free_all:
 	free(svf_check_tdo_para);
 	svf_check_tdo_para = NULL;
 	svf_check_tdo_para_index = 0;
+	svf_check_tdo_para_size = 0;
 
 	free(svf_tdi_buffer);
 	svf_tdi_buffer = NULL;
@@ -569,7 +919,10 @@ free_all:
 	svf_free_xxd_para(&svf_para.sdr_para);
 	svf_free_xxd_para(&svf_para.sir_para);
 
-	if (ERROR_OK == ret)
+	if (ERROR_OK == ret && compile_name)
+		command_print(CMD, "svf file compiled to \"%s\" for %d commands",
+				compile_name, command_num);
+	else if (ERROR_OK == ret)
 		command_print(CMD,
 			      "svf file programmed %s for %d commands with %d errors",
 			      (svf_ignore_error > 1) ? "unsuccessfully" : "successfully",
@@ -582,34 +935,68 @@ free_all:
 	return ret;
 }
 
+/* Make sure the buffer at *lineptr has room for size bytes. It at least
+ * doubles, so that long lines of hex don't cost a realloc() every few bytes. */
+static int svf_grow_buffer(char **lineptr, size_t *n, size_t size)
+{
+#define MIN_CHUNK 16
+	if (size <= *n && *lineptr)
+		return ERROR_OK;
+
+	size_t new_size = MAX(MAX(*n * 2, size), (size_t)MIN_CHUNK);
+	char *p = realloc(*lineptr, new_size);
+	if (!p) {
+		LOG_ERROR("not enough memory");
+		return ERROR_FAIL;
+	}
+	*lineptr = p;
+	*n = new_size;
+	return ERROR_OK;
+}
+
+static void svf_rewind(FILE *stream)
+{
+	rewind(stream);
+	svf_file_buffer_pos = 0;
+	svf_file_buffer_len = 0;
+}
+
+/* Read a line, including its '\n', from the file through svf_file_buffer.
+ * Returns -1 if there's no complete line left. */
 static int svf_getline(char **lineptr, size_t *n, FILE *stream)
 {
-#define MIN_CHUNK 16	/* Buffer is increased by this size each time as required */
 	size_t i = 0;
 
-	if (*lineptr == NULL) {
-		*n = MIN_CHUNK;
-		*lineptr = malloc(*n);
-		if (!*lineptr)
-			return -1;
-	}
+	for (;;) {
+		if (svf_file_buffer_pos == svf_file_buffer_len) {
+			svf_file_buffer_pos = 0;
+			svf_file_buffer_len = fread(svf_file_buffer, 1,
+					SVF_FILE_BUFFER_SIZE, stream);
+			if (svf_file_buffer_len == 0)
+				break;
+		}
+
+		const char *start = svf_file_buffer + svf_file_buffer_pos;
+		size_t len = svf_file_buffer_len - svf_file_buffer_pos;
+		const char *end = memchr(start, '\n', len);
+		if (end)
+			len = end - start + 1;
 
-	(*lineptr)[0] = fgetc(stream);
-	while ((*lineptr)[i] != '\n') {
-		(*lineptr)[++i] = fgetc(stream);
-		if (feof(stream)) {
-			(*lineptr)[0] = 0;
+		if (svf_grow_buffer(lineptr, n, i + len + 1) != ERROR_OK)
 			return -1;
-		}
-		if ((i + 2) > *n) {
-			*n += MIN_CHUNK;
-			*lineptr = realloc(*lineptr, *n);
+		memcpy(*lineptr + i, start, len);
+		i += len;
+		svf_file_buffer_pos += len;
+
+		if (end) {
+			(*lineptr)[i] = 0;
+			return i;
 		}
 	}
 
-	(*lineptr)[++i] = 0;
-
-	return sizeof(*lineptr);
+	if (*lineptr)
+		(*lineptr)[0] = 0;
+	return -1;
 }
 
 #define SVFP_CMD_INC_CNT 1024
@@ -672,14 +1059,9 @@ static int svf_read_command_from_file(FILE *fd)
 				 *  - added space.
 				 *  - terminating NUL ('\0')
 				 */
-				if (cmd_pos + 3 > svf_command_buffer_size) {
-					svf_command_buffer = realloc(svf_command_buffer, cmd_pos + 3);
-					svf_command_buffer_size = cmd_pos + 3;
-					if (svf_command_buffer == NULL) {
-						LOG_ERROR("not enough memory");
-						return ERROR_FAIL;
-					}
-				}
+				if (svf_grow_buffer(&svf_command_buffer, &svf_command_buffer_size,
+						cmd_pos + 3) != ERROR_OK)
+					return ERROR_FAIL;
 
 				/* insert a space before '(' */
 				if ('(' == ch)
@@ -877,9 +1259,15 @@ static int svf_check_tdo(void)
 
 static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len)
 {
-	if (svf_check_tdo_para_index >= SVF_CHECK_TDO_PARA_SIZE) {
-		LOG_ERROR("toooooo many operation undone");
-		return ERROR_FAIL;
+	if (svf_check_tdo_para_index >= svf_check_tdo_para_size) {
+		struct svf_check_tdo_para *para = realloc(svf_check_tdo_para,
+				sizeof(*para) * svf_check_tdo_para_size * 2);
+		if (!para) {
+			LOG_ERROR("not enough memory");
+			return ERROR_FAIL;
+		}
+		svf_check_tdo_para = para;
+		svf_check_tdo_para_size *= 2;
 	}
 
 	svf_check_tdo_para[svf_check_tdo_para_index].line_num = svf_line_number;
@@ -893,7 +1281,10 @@ static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len)
 
 static int svf_execute_tap(void)
 {
-	if ((!svf_nil) && (ERROR_OK != jtag_execute_queue()))
+	if (svf_compile_fd)
+		/* nothing was queued, so there's nothing to check either */
+		svf_check_tdo_para_index = 0;
+	else if ((!svf_nil) && (ERROR_OK != jtag_execute_queue()))
 		return ERROR_FAIL;
 	else if (ERROR_OK != svf_check_tdo())
 		return ERROR_FAIL;
@@ -917,7 +1308,6 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 	/* for XXR */
 	struct svf_xxr_para *xxr_para_tmp;
 	uint8_t **pbuffer_tmp;
-	struct scan_field field;
 	/* for STATE */
 	tap_state_t *path = NULL, state;
 	/* flag padding commands skipped due to -tap command */
@@ -976,9 +1366,7 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 				svf_para.frequency = atof(argus[1]);
 				/* TODO: set jtag speed to */
 				if (svf_para.frequency > 0) {
-					command_run_linef(cmd_ctx,
-							"adapter speed %d",
-							(int)svf_para.frequency / 1000);
+					svf_set_speed(cmd_ctx, (int)svf_para.frequency / 1000);
 					LOG_DEBUG("\tfrequency = %f", svf_para.frequency);
 				}
 			}
@@ -1189,16 +1577,8 @@ XXR_common:
 					svf_add_check_para(1, svf_buffer_index, i);
 				} else
 					svf_add_check_para(0, svf_buffer_index, i);
-				field.num_bits = i;
-				field.out_value = &svf_tdi_buffer[svf_buffer_index];
-				field.in_value = (xxr_para_tmp->data_mask & XXR_TDO) ? &svf_tdi_buffer[svf_buffer_index] : NULL;
-				if (!svf_nil) {
-					/* NOTE:  doesn't use SVF-specified state paths */
-					jtag_add_plain_dr_scan(field.num_bits,
-							field.out_value,
-							field.in_value,
-							svf_para.dr_end_state);
-				}
+				svf_add_scan(false, i, xxr_para_tmp->data_mask & XXR_TDO,
+						svf_para.dr_end_state);
 
 				svf_buffer_index += (i + 7) >> 3;
 			} else if (SIR == command) {
@@ -1279,16 +1659,8 @@ XXR_common:
 					svf_add_check_para(1, svf_buffer_index, i);
 				} else
 					svf_add_check_para(0, svf_buffer_index, i);
-				field.num_bits = i;
-				field.out_value = &svf_tdi_buffer[svf_buffer_index];
-				field.in_value = (xxr_para_tmp->data_mask & XXR_TDO) ? &svf_tdi_buffer[svf_buffer_index] : NULL;
-				if (!svf_nil) {
-					/* NOTE:  doesn't use SVF-specified state paths */
-					jtag_add_plain_ir_scan(field.num_bits,
-							field.out_value,
-							field.in_value,
-							svf_para.ir_end_state);
-				}
+				svf_add_scan(true, i, xxr_para_tmp->data_mask & XXR_TDO,
+						svf_para.ir_end_state);
 
 				svf_buffer_index += (i + 7) >> 3;
 			}
@@ -1376,19 +1748,15 @@ XXR_common:
 				uint32_t min_usec = 1000000 * min_time;
 
 				/* enter into run_state if necessary */
-				if (cmd_queue_cur_state != svf_para.runtest_run_state)
+				if (svf_cur_state() != svf_para.runtest_run_state)
 					svf_add_statemove(svf_para.runtest_run_state);
 
 				/* add clocks and/or min wait */
-				if (run_count > 0) {
-					if (!svf_nil)
-						jtag_add_clocks(run_count);
-				}
+				if (run_count > 0)
+					svf_add_clocks(run_count);
 
-				if (min_usec > 0) {
-					if (!svf_nil)
-						jtag_add_sleep(min_usec);
-				}
+				if (min_usec > 0)
+					svf_add_sleep(min_usec);
 
 				/* move to end_state if necessary */
 				if (svf_para.runtest_end_state != svf_para.runtest_run_state)
@@ -1436,12 +1804,9 @@ XXR_common:
 					/* OpenOCD refuses paths containing TAP_RESET */
 					if (TAP_RESET == path[i]) {
 						/* FIXME last state MUST be stable! */
-						if (i > 0) {
-							if (!svf_nil)
-								jtag_add_pathmove(i, path);
-						}
-						if (!svf_nil)
-							jtag_add_tlr();
+						if (i > 0)
+							svf_add_pathmove(i, path);
+						svf_add_tlr();
 						num_of_argu -= i + 1;
 						i = -1;
 					}
@@ -1450,8 +1815,7 @@ XXR_common:
 					/* execute last path if necessary */
 					if (svf_tap_state_is_stable(path[num_of_argu - 1])) {
 						/* last state MUST be stable state */
-						if (!svf_nil)
-							jtag_add_pathmove(num_of_argu, path);
+						svf_add_pathmove(num_of_argu, path);
 						LOG_DEBUG("\tmove to %s by path_move",
 								tap_state_name(path[num_of_argu - 1]));
 					} else {
@@ -1494,13 +1858,11 @@ XXR_common:
 						ARRAY_SIZE(svf_trst_mode_name));
 				switch (i_tmp) {
 				case TRST_ON:
-					if (!svf_nil)
-						jtag_add_reset(1, 0);
+					svf_add_reset(1);
 					break;
 				case TRST_Z:
 				case TRST_OFF:
-					if (!svf_nil)
-						jtag_add_reset(0, 0);
+					svf_add_reset(0);
 					break;
 				case TRST_ABSENT:
 					break;
@@ -1541,8 +1903,7 @@ XXR_common:
 	} else {
 		/* for fast executing, execute tap if necessary */
 		/* half of the buffer is for the next command */
-		if (((svf_buffer_index >= SVF_MAX_BUFFER_SIZE_TO_COMMIT) ||
-				(svf_check_tdo_para_index >= SVF_CHECK_TDO_PARA_SIZE / 2)) &&
+		if ((svf_buffer_index >= SVF_MAX_BUFFER_SIZE_TO_COMMIT) &&
 				(((command != STATE) && (command != RUNTEST)) ||
 						((command == STATE) && (num_of_argu == 2))))
 			return svf_execute_tap();
@@ -1557,7 +1918,7 @@ static const struct command_registration svf_command_handlers[] = {
 		.handler = handle_svf_command,
 		.mode = COMMAND_EXEC,
 		.help = "Runs a SVF file.",
-		.usage = "[-tap device.tap] <file> [quiet] [nil] [progress] [ignore_error]",
+		.usage = "[-tap device.tap] [-compile out_file] <file> [quiet] [nil] [progress] [ignore_error]",
 	},
 	COMMAND_REGISTRATION_DONE
 };
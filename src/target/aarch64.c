@@ -1808,9 +1808,10 @@ static int aarch64_write_cpu_memory_fast(struct target *target,
 
 	armv8_reg_current(arm, 1)->dirty = true;
 
-	/* Step 1.d   - Change DCC to memory mode */
+	/* Step 1.d   - Change DCC to memory mode, queued so it goes out
+	 * in the same DAP run as the data */
 	*dscr |= DSCR_MA;
-	retval =  mem_ap_write_atomic_u32(armv8->debug_ap,
+	retval =  mem_ap_write_u32(armv8->debug_ap,
 			armv8->debug_base + CPUV8_DBG_DSCR, *dscr);
 	if (retval != ERROR_OK)
 		return retval;
@@ -1824,12 +1825,8 @@ static int aarch64_write_cpu_memory_fast(struct target *target,
 
 	/* Step 3.a   - Switch DTR mode back to Normal mode */
 	*dscr &= ~DSCR_MA;
-	retval = mem_ap_write_atomic_u32(armv8->debug_ap,
+	return mem_ap_write_atomic_u32(armv8->debug_ap,
 				armv8->debug_base + CPUV8_DBG_DSCR, *dscr);
-	if (retval != ERROR_OK)
-		return retval;
-
-	return ERROR_OK;
 }
 
 static int aarch64_write_cpu_memory(struct target *target,
@@ -1931,7 +1928,7 @@ static int aarch64_read_cpu_memory_slow(struct target *target,
 
 	/* change DCC to normal mode (if necessary) */
 	if (*dscr & DSCR_MA) {
-		*dscr &= DSCR_MA;
+		*dscr &= ~DSCR_MA;
 		retval =  mem_ap_write_atomic_u32(armv8->debug_ap,
 				armv8->debug_base + CPUV8_DBG_DSCR, *dscr);
 		if (retval != ERROR_OK)
@@ -2001,15 +1998,18 @@ static int aarch64_read_cpu_memory_fast(struct target *target,
 	if (retval != ERROR_OK)
 		return retval;
 
+	/* Steps 1.e to 3.b are queued and go out in at most two DAP runs, the
+	 * first one ending with the bulk read of step 2.a */
+
 	/* Step 1.e - Change DCC to memory mode */
 	*dscr |= DSCR_MA;
-	retval =  mem_ap_write_atomic_u32(armv8->debug_ap,
+	retval =  mem_ap_write_u32(armv8->debug_ap,
 			armv8->debug_base + CPUV8_DBG_DSCR, *dscr);
 	if (retval != ERROR_OK)
 		return retval;
 
 	/* Step 1.f - read DBGDTRTX and discard the value */
-	retval = mem_ap_read_atomic_u32(armv8->debug_ap,
+	retval = mem_ap_read_u32(armv8->debug_ap,
 			armv8->debug_base + CPUV8_DBG_DTRTX, &value);
 	if (retval != ERROR_OK)
 		return retval;
@@ -2032,7 +2032,7 @@ static int aarch64_read_cpu_memory_fast(struct target *target,
 
 	/* Step 3.a - set DTR access mode back to Normal mode	*/
 	*dscr &= ~DSCR_MA;
-	retval =  mem_ap_write_atomic_u32(armv8->debug_ap,
+	retval =  mem_ap_write_u32(armv8->debug_ap,
 					armv8->debug_base + CPUV8_DBG_DSCR, *dscr);
 	if (retval != ERROR_OK)
 		return retval;
@@ -2107,7 +2107,19 @@ static int aarch64_read_cpu_memory(struct target *target,
 
 	if (size == 4 && (address % 4) == 0)
 		retval = aarch64_read_cpu_memory_fast(target, count, buffer, &dscr);
-	else
+	else if (size == 4 && count > 2) {
+		/* Unaligned words: bytes up to the first word boundary, the words
+		 * after it in memory access mode, then the bytes that are left.
+		 * X0 keeps incrementing across all three; aborts are sticky, so
+		 * they are checked once at the end. */
+		uint32_t head = 4 - address % 4;
+		retval = aarch64_read_cpu_memory_slow(target, 1, head, buffer, &dscr);
+		if (retval == ERROR_OK)
+			retval = aarch64_read_cpu_memory_fast(target, count - 1, buffer + head, &dscr);
+		if (retval == ERROR_OK)
+			retval = aarch64_read_cpu_memory_slow(target, 1, 4 - head,
+					buffer + head + 4 * (count - 1), &dscr);
+	} else
 		retval = aarch64_read_cpu_memory_slow(target, size, count, buffer, &dscr);
 
 	if (dscr & DSCR_MA) {
@@ -1332,6 +1332,7 @@ static int arc_init_target(struct command_context *cmd_ctx, struct target *targe
 
 static void arc_free_reg_cache(struct reg_cache *cache)
 {
+	register_cache_free_index(cache);
 	free(cache->reg_list);
 	free(cache);
 }
@@ -1714,6 +1715,7 @@ void arc_reset_actionpoints(struct target *target)
 		free(target->watchpoints);
 		target->watchpoints = next_w;
 	}
+	breakpoint_index_reset(target);
 	for (unsigned int i = 0; i < arc->actionpoints_num; i++) {
 		if ((ap_list[i].used) && (ap_list[i].reg_address))
 			arc_remove_auxreg_actionpoint(target, ap_list[i].reg_address);
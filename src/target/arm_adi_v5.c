@@ -313,20 +313,20 @@ int mem_ap_write_atomic_u32(struct adiv5_ap *ap, uint32_t address,
 	return dap_run(ap->dap);
 }
 
-/**
- * Synchronous write of a block of memory, using a specific access size.
- *
- * @param ap The MEM-AP to access.
- * @param buffer The data buffer to write. No particular alignment is assumed.
- * @param size Which access size to use, in bytes. 1, 2 or 4.
- * @param count The number of writes to do (in size units, not bytes).
- * @param address Address to be written; it must be writable by the currently selected MEM-AP.
- * @param addrinc Whether the target address should be increased for each write or not. This
- *  should normally be true, except when writing to e.g. a FIFO.
- * @return ERROR_OK on success, otherwise an error code.
- */
-static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t size, uint32_t count,
-		uint32_t address, bool addrinc)
+/* Number of size units from address on that fit in one TAR autoincrement block, at least
+ * one and at most count. Failed transfers are replayed in pieces of this size. */
+static uint32_t mem_ap_replay_count(struct adiv5_ap *ap, uint32_t size, uint32_t count,
+		uint32_t address)
+{
+	uint32_t n = max_tar_block_size(ap->tar_autoincr_block, address) / size;
+	if (n == 0)
+		n = 1;
+	return MIN(n, count);
+}
+
+/* Queue up the DRW writes for a mem_ap_write(), without running them */
+static int mem_ap_write_queue(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t size,
+		uint32_t count, uint32_t address, bool addrinc)
 {
 	struct adiv5_dap *dap = ap->dap;
 	size_t nbytes = size * count;
@@ -428,37 +428,73 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 			address += this_size;
 	}
 
-	/* REVISIT: Might want to have a queued version of this function that does not run. */
+	return retval;
+}
+
+/**
+ * Synchronous write of a block of memory, using a specific access size.
+ *
+ * The whole transfer, TAR updates at autoincrement block boundaries included, is queued
+ * and run at once, so the sticky error flags are only checked at the end. If that fails,
+ * an incrementing write is replayed one TAR block at a time to find the failing block;
+ * should the error not come back, the write succeeded after all.
+ *
+ * @param ap The MEM-AP to access.
+ * @param buffer The data buffer to write. No particular alignment is assumed.
+ * @param size Which access size to use, in bytes. 1, 2 or 4.
+ * @param count The number of writes to do (in size units, not bytes).
+ * @param address Address to be written; it must be writable by the currently selected MEM-AP.
+ * @param addrinc Whether the target address should be increased for each write or not. This
+ *  should normally be true, except when writing to e.g. a FIFO.
+ * @return ERROR_OK on success, otherwise an error code.
+ */
+static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t size, uint32_t count,
+		uint32_t address, bool addrinc)
+{
+	int retval = mem_ap_write_queue(ap, buffer, size, count, address, addrinc);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = dap_run(ap->dap);
 	if (retval == ERROR_OK)
-		retval = dap_run(dap);
+		return ERROR_OK;
 
-	if (retval != ERROR_OK) {
+	if (!addrinc) {
+		/* writing a FIFO again would push the data twice */
 		uint32_t tar;
 		if (mem_ap_read_tar(ap, &tar) == ERROR_OK)
 			LOG_ERROR("Failed to write memory at 0x%08"PRIx32, tar);
 		else
 			LOG_ERROR("Failed to write memory and, additionally, failed to find out where");
+		return retval;
 	}
 
-	return retval;
+	ap->tar_valid = false;
+	ap->csw_value = 0;
+	while (count > 0) {
+		uint32_t n = mem_ap_replay_count(ap, size, count, address);
+		retval = mem_ap_write_queue(ap, buffer, size, n, address, true);
+		if (retval == ERROR_OK)
+			retval = dap_run(ap->dap);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Failed to write memory at 0x%08"PRIx32, address);
+			ap->tar_valid = false;
+			ap->csw_value = 0;
+			return retval;
+		}
+		buffer += size * n;
+		address += size * n;
+		count -= n;
+	}
+
+	LOG_DEBUG("memory write succeeded when replayed");
+	return ERROR_OK;
 }
 
-/**
- * Synchronous read of a block of memory, using a specific access size.
- *
- * @param ap The MEM-AP to access.
- * @param buffer The data buffer to receive the data. No particular alignment is assumed.
- * @param size Which access size to use, in bytes. 1, 2 or 4.
- * @param count The number of reads to do (in size units, not bytes).
- * @param adr Address to be read; it must be readable by the currently selected MEM-AP.
- * @param addrinc Whether the target address should be increased after each read or not. This
- *  should normally be true, except when reading from e.g. a FIFO.
- * @return ERROR_OK on success, otherwise an error code.
- */
-static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint32_t count,
-		uint32_t adr, bool addrinc)
+/* Queue up the DRW reads for a mem_ap_read(), into a buffer allocated here */
+static int mem_ap_read_queue(struct adiv5_ap *ap, uint32_t **read_buf, uint32_t size,
+		uint32_t count, uint32_t adr, bool addrinc)
 {
-	struct adiv5_dap *dap = ap->dap;
 	size_t nbytes = size * count;
 	const uint32_t csw_addrincr = addrinc ? CSW_ADDRINC_SINGLE : CSW_ADDRINC_OFF;
 	uint32_t csw_size;
@@ -487,10 +523,10 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 	/* Allocate buffer to hold the sequence of DRW reads that will be made. This is a significant
 	 * over-allocation if packed transfers are going to be used, but determining the real need at
 	 * this point would be messy. */
-	uint32_t *read_buf = calloc(count, sizeof(uint32_t));
+	*read_buf = calloc(count, sizeof(uint32_t));
 	/* Multiplication count * sizeof(uint32_t) may overflow, calloc() is safe */
-	uint32_t *read_ptr = read_buf;
-	if (read_buf == NULL) {
+	uint32_t *read_ptr = *read_buf;
+	if (*read_buf == NULL) {
 		LOG_ERROR("Failed to allocate read buffer");
 		return ERROR_FAIL;
 	}
@@ -527,30 +563,16 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		mem_ap_update_tar_cache(ap);
 	}
 
-	if (retval == ERROR_OK)
-		retval = dap_run(dap);
-
-	/* Restore state */
-	address = adr;
-	nbytes = size * count;
-	read_ptr = read_buf;
+	return retval;
+}
 
-	/* If something failed, read TAR to find out how much data was successfully read, so we can
-	 * at least give the caller what we have. */
-	if (retval != ERROR_OK) {
-		uint32_t tar;
-		if (mem_ap_read_tar(ap, &tar) == ERROR_OK) {
-			/* TAR is incremented after failed transfer on some devices (eg Cortex-M4) */
-			LOG_ERROR("Failed to read memory at 0x%08"PRIx32, tar);
-			if (nbytes > tar - address)
-				nbytes = tar - address;
-		} else {
-			LOG_ERROR("Failed to read memory and, additionally, failed to find out where");
-			nbytes = 0;
-		}
-	}
+/* Replay loop to populate caller's buffer from the correct word and byte lane */
+static void mem_ap_read_unpack(struct adiv5_ap *ap, uint8_t *buffer, const uint32_t *read_buf,
+		uint32_t size, size_t nbytes, uint32_t address, bool addrinc)
+{
+	struct adiv5_dap *dap = ap->dap;
+	const uint32_t *read_ptr = read_buf;
 
-	/* Replay loop to populate caller's buffer from the correct word and byte lane */
 	while (nbytes > 0) {
 		uint32_t this_size = size;
 
@@ -588,11 +610,143 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		read_ptr++;
 		nbytes -= this_size;
 	}
+}
+
+/**
+ * Synchronous read of a block of memory, using a specific access size.
+ *
+ * @param ap The MEM-AP to access.
+ * @param buffer The data buffer to receive the data. No particular alignment is assumed.
+ * @param size Which access size to use, in bytes. 1, 2 or 4.
+ * @param count The number of reads to do (in size units, not bytes).
+ * @param adr Address to be read; it must be readable by the currently selected MEM-AP.
+ * @param addrinc Whether the target address should be increased after each read or not. This
+ *  should normally be true, except when reading from e.g. a FIFO.
+ * @return ERROR_OK on success, otherwise an error code.
+ */
+static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint32_t count,
+		uint32_t adr, bool addrinc)
+{
+	struct adiv5_dap *dap = ap->dap;
+	size_t nbytes = size * count;
+	uint32_t *read_buf = NULL;
+
+	int retval = mem_ap_read_queue(ap, &read_buf, size, count, adr, addrinc);
+	if (read_buf == NULL)
+		return retval;
+
+	bool queued = retval == ERROR_OK;
+	if (queued)
+		retval = dap_run(dap);
+
+	if (retval != ERROR_OK && queued && addrinc) {
+		/* Replay one TAR block at a time. That gives the caller everything up to the
+		 * failing block, and gets past errors that don't come back. */
+		free(read_buf);
+		ap->tar_valid = false;
+		ap->csw_value = 0;
+		while (count > 0) {
+			uint32_t n = mem_ap_replay_count(ap, size, count, adr);
+			read_buf = NULL;
+			retval = mem_ap_read_queue(ap, &read_buf, size, n, adr, true);
+			if (retval == ERROR_OK)
+				retval = dap_run(dap);
+			if (retval == ERROR_OK)
+				mem_ap_read_unpack(ap, buffer, read_buf, size, size * n, adr, true);
+			free(read_buf);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Failed to read memory at 0x%08"PRIx32, adr);
+				ap->tar_valid = false;
+				ap->csw_value = 0;
+				return retval;
+			}
+			buffer += size * n;
+			adr += size * n;
+			count -= n;
+		}
+		LOG_DEBUG("memory read succeeded when replayed");
+		return ERROR_OK;
+	}
+
+	/* If something failed, read TAR to find out how much data was successfully read, so we can
+	 * at least give the caller what we have. */
+	if (retval != ERROR_OK) {
+		uint32_t tar;
+		if (mem_ap_read_tar(ap, &tar) == ERROR_OK) {
+			/* TAR is incremented after failed transfer on some devices (eg Cortex-M4) */
+			LOG_ERROR("Failed to read memory at 0x%08"PRIx32, tar);
+			if (nbytes > tar - adr)
+				nbytes = tar - adr;
+		} else {
+			LOG_ERROR("Failed to read memory and, additionally, failed to find out where");
+			nbytes = 0;
+		}
+	}
+
+	mem_ap_read_unpack(ap, buffer, read_buf, size, nbytes, adr, addrinc);
 
 	free(read_buf);
 	return retval;
 }
 
+int mem_ap_read_buf_batch(struct adiv5_ap *ap,
+		struct target_memory_read *reads, unsigned int num_reads)
+{
+	uint32_t **read_bufs = calloc(num_reads, sizeof(*read_bufs));
+	if (read_bufs == NULL)
+		return ERROR_FAIL;
+
+	int retval = ERROR_OK;
+	for (unsigned int i = 0; i < num_reads && retval == ERROR_OK; i++)
+		retval = mem_ap_read_queue(ap, &read_bufs[i], reads[i].size, reads[i].count,
+				reads[i].address, true);
+
+	if (retval == ERROR_OK)
+		retval = dap_run(ap->dap);
+
+	if (retval == ERROR_OK) {
+		for (unsigned int i = 0; i < num_reads; i++)
+			mem_ap_read_unpack(ap, reads[i].buffer, read_bufs[i], reads[i].size,
+					reads[i].size * reads[i].count, reads[i].address, true);
+	} else {
+		/* there's no telling which read failed, replay them one by one */
+		ap->tar_valid = false;
+		ap->csw_value = 0;
+		retval = ERROR_OK;
+		for (unsigned int i = 0; i < num_reads && retval == ERROR_OK; i++)
+			retval = mem_ap_read(ap, reads[i].buffer, reads[i].size, reads[i].count,
+					reads[i].address, true);
+	}
+
+	for (unsigned int i = 0; i < num_reads; i++)
+		free(read_bufs[i]);
+	free(read_bufs);
+	return retval;
+}
+
+int mem_ap_write_buf_batch(struct adiv5_ap *ap,
+		struct target_memory_write *writes, unsigned int num_writes)
+{
+	int retval = ERROR_OK;
+	for (unsigned int i = 0; i < num_writes && retval == ERROR_OK; i++)
+		retval = mem_ap_write_queue(ap, writes[i].buffer, writes[i].size,
+				writes[i].count, writes[i].address, true);
+
+	if (retval == ERROR_OK)
+		retval = dap_run(ap->dap);
+	if (retval == ERROR_OK)
+		return ERROR_OK;
+
+	/* there's no telling which write failed, replay them one by one */
+	ap->tar_valid = false;
+	ap->csw_value = 0;
+	retval = ERROR_OK;
+	for (unsigned int i = 0; i < num_writes && retval == ERROR_OK; i++)
+		retval = mem_ap_write(ap, writes[i].buffer, writes[i].size, writes[i].count,
+				writes[i].address, true);
+	return retval;
+}
+
 int mem_ap_read_buf(struct adiv5_ap *ap,
 		uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address)
 {
@@ -1476,6 +1630,12 @@ int dap_info_command(struct command_invocation *cmd,
 	 */
 	mem_ap = (apid & IDR_CLASS) == AP_CLASS_MEM_AP;
 	if (mem_ap) {
+		retval = mem_ap_init(ap);
+		if (retval != ERROR_OK)
+			return retval;
+		command_print(cmd, "\tPacked transfers %s",
+				ap->packed_transfers ? "supported" : "not supported");
+
 		command_print(cmd, "MEM-AP BASE 0x%8.8" PRIx32, dbgbase);
 
 		if (dbgbase == 0xFFFFFFFF || (dbgbase & 0x3) == 0x2) {
@@ -542,6 +542,14 @@ int mem_ap_read_buf(struct adiv5_ap *ap,
 int mem_ap_write_buf(struct adiv5_ap *ap,
 		const uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
 
+/* Several independent block reads, run in one go. */
+struct target_memory_read;
+int mem_ap_read_buf_batch(struct adiv5_ap *ap,
+		struct target_memory_read *reads, unsigned int num_reads);
+struct target_memory_write;
+int mem_ap_write_buf_batch(struct adiv5_ap *ap,
+		struct target_memory_write *writes, unsigned int num_writes);
+
 /* Synchronous, non-incrementing buffer functions for accessing fifos. */
 int mem_ap_read_buf_noincr(struct adiv5_ap *ap,
 		uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
@@ -87,6 +87,14 @@ struct arm_dpm {
 	int (*instr_write_data_r0_64)(struct arm_dpm *dpm,
 			uint32_t opcode, uint64_t data);
 
+	/**
+	 * Optional: runs one instruction @a count times, with R0 set to
+	 * @a data, @a data + @a step, ... before each run, without waiting
+	 * for completion between runs. Used for cache maintenance by VA.
+	 */
+	int (*instr_write_data_r0_range)(struct arm_dpm *dpm,
+			uint32_t opcode, uint32_t data, uint32_t step, uint32_t count);
+
 	/** Optional core-specific operation invoked after CPSR writes. */
 	int (*instr_cpsr_sync)(struct arm_dpm *dpm);
 
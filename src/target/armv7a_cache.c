@@ -158,6 +158,34 @@ int armv7a_cache_auto_flush_all_data(struct target *target)
 }
 
 
+/*
+ * Run a by-VA maintenance operation on each cache line in [va_line, va_end),
+ * batched through the DPM when the core supports it.
+ */
+static int armv7a_cache_line_op(struct arm_dpm *dpm, uint32_t opcode,
+		uint32_t va_line, uint32_t va_end, uint32_t linelen)
+{
+	int retval = ERROR_OK, i = 0;
+
+	if (va_line >= va_end)
+		return ERROR_OK;
+
+	if (dpm->instr_write_data_r0_range)
+		return dpm->instr_write_data_r0_range(dpm, opcode, va_line, linelen,
+				(va_end - va_line + linelen - 1) / linelen);
+
+	while (va_line < va_end) {
+		if ((i++ & 0x3f) == 0)
+			keep_alive();
+		retval = dpm->instr_write_data_r0(dpm, opcode, va_line);
+		if (retval != ERROR_OK)
+			return retval;
+		va_line += linelen;
+	}
+
+	return retval;
+}
+
 int armv7a_l1_d_cache_inval_virt(struct target *target, uint32_t virt,
 					uint32_t size)
 {
@@ -166,7 +194,7 @@ int armv7a_l1_d_cache_inval_virt(struct target *target, uint32_t virt,
 	struct armv7a_cache_common *armv7a_cache = &armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->dminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_d_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -199,16 +227,11 @@ int armv7a_l1_d_cache_inval_virt(struct target *target, uint32_t virt,
 			goto done;
 	}
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* DCIMVAC - Invalidate data cache line by VA to PoC. */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 6, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DCIMVAC - Invalidate data cache line by VA to PoC. */
+	retval = armv7a_cache_line_op(dpm, ARMV4_5_MCR(15, 0, 0, 7, 6, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	keep_alive();
 	dpm->finish(dpm);
@@ -230,7 +253,7 @@ int armv7a_l1_d_cache_clean_virt(struct target *target, uint32_t virt,
 	struct armv7a_cache_common *armv7a_cache = &armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->dminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_d_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -243,16 +266,11 @@ int armv7a_l1_d_cache_clean_virt(struct target *target, uint32_t virt,
 	va_line = virt & (-linelen);
 	va_end = virt + size;
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* DCCMVAC - Data Cache Clean by MVA to PoC */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 10, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DCCMVAC - Data Cache Clean by MVA to PoC */
+	retval = armv7a_cache_line_op(dpm, ARMV4_5_MCR(15, 0, 0, 7, 10, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	keep_alive();
 	dpm->finish(dpm);
@@ -274,7 +292,7 @@ int armv7a_l1_d_cache_flush_virt(struct target *target, uint32_t virt,
 	struct armv7a_cache_common *armv7a_cache = &armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->dminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_d_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -287,16 +305,11 @@ int armv7a_l1_d_cache_flush_virt(struct target *target, uint32_t virt,
 	va_line = virt & (-linelen);
 	va_end = virt + size;
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* DCCIMVAC */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 14, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* DCCIMVAC */
+	retval = armv7a_cache_line_op(dpm, ARMV4_5_MCR(15, 0, 0, 7, 14, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 
 	keep_alive();
 	dpm->finish(dpm);
@@ -356,7 +369,7 @@ int armv7a_l1_i_cache_inval_virt(struct target *target, uint32_t virt,
 				&armv7a->armv7a_mmu.armv7a_cache;
 	uint32_t linelen = armv7a_cache->iminline;
 	uint32_t va_line, va_end;
-	int retval, i = 0;
+	int retval;
 
 	retval = armv7a_l1_i_cache_sanity_check(target);
 	if (retval != ERROR_OK)
@@ -369,21 +382,16 @@ int armv7a_l1_i_cache_inval_virt(struct target *target, uint32_t virt,
 	va_line = virt & (-linelen);
 	va_end = virt + size;
 
-	while (va_line < va_end) {
-		if ((i++ & 0x3f) == 0)
-			keep_alive();
-		/* ICIMVAU - Invalidate instruction cache by VA to PoU. */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 5, 1), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		/* BPIMVA */
-		retval = dpm->instr_write_data_r0(dpm,
-				ARMV4_5_MCR(15, 0, 0, 7, 5, 7), va_line);
-		if (retval != ERROR_OK)
-			goto done;
-		va_line += linelen;
-	}
+	/* ICIMVAU - Invalidate instruction cache by VA to PoU. */
+	retval = armv7a_cache_line_op(dpm, ARMV4_5_MCR(15, 0, 0, 7, 5, 1),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
+	/* BPIMVA */
+	retval = armv7a_cache_line_op(dpm, ARMV4_5_MCR(15, 0, 0, 7, 5, 7),
+			va_line, va_end, linelen);
+	if (retval != ERROR_OK)
+		goto done;
 	keep_alive();
 	dpm->finish(dpm);
 	return retval;
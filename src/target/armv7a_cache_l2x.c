@@ -46,6 +46,29 @@ static int arm7a_l2x_sanity_check(struct target *target)
 
 	return ERROR_OK;
 }
+
+/*
+ * Translations are at least 4 KiB granular, so walk the page tables once
+ * per page rather than once per cache line. *page starts out as an
+ * unaligned value so the first call always translates.
+ */
+static int arm7a_l2x_virt2phys(struct target *target, target_addr_t virt,
+		target_addr_t *page, target_addr_t *page_pa, target_addr_t *pa)
+{
+	target_addr_t va_page = virt & ~(target_addr_t)0xfff;
+	int retval;
+
+	if (va_page != *page) {
+		retval = target->type->virt2phys(target, va_page, page_pa);
+		if (retval != ERROR_OK)
+			return retval;
+		*page = va_page;
+	}
+
+	*pa = *page_pa + (virt & 0xfff);
+	return ERROR_OK;
+}
+
 /*
  * clean and invalidate complete l2x cache
  */
@@ -76,6 +99,7 @@ int armv7a_l2x_cache_flush_virt(struct target *target, target_addr_t virt,
 		(armv7a->armv7a_mmu.armv7a_cache.outer_cache);
 	/* FIXME: different controllers have different linelen? */
 	uint32_t i, linelen = 32;
+	target_addr_t page = 1, page_pa = 0;
 	int retval;
 
 	retval = arm7a_l2x_sanity_check(target);
@@ -85,8 +109,7 @@ int armv7a_l2x_cache_flush_virt(struct target *target, target_addr_t virt,
 	for (i = 0; i < size; i += linelen) {
 		target_addr_t pa, offs = virt + i;
 
-		/* FIXME: use less verbose virt2phys? */
-		retval = target->type->virt2phys(target, offs, &pa);
+		retval = arm7a_l2x_virt2phys(target, offs, &page, &page_pa, &pa);
 		if (retval != ERROR_OK)
 			goto done;
 
@@ -111,6 +134,7 @@ static int armv7a_l2x_cache_inval_virt(struct target *target, target_addr_t virt
 		(armv7a->armv7a_mmu.armv7a_cache.outer_cache);
 	/* FIXME: different controllers have different linelen */
 	uint32_t i, linelen = 32;
+	target_addr_t page = 1, page_pa = 0;
 	int retval;
 
 	retval = arm7a_l2x_sanity_check(target);
@@ -120,8 +144,7 @@ static int armv7a_l2x_cache_inval_virt(struct target *target, target_addr_t virt
 	for (i = 0; i < size; i += linelen) {
 		target_addr_t pa, offs = virt + i;
 
-		/* FIXME: use less verbose virt2phys? */
-		retval = target->type->virt2phys(target, offs, &pa);
+		retval = arm7a_l2x_virt2phys(target, offs, &page, &page_pa, &pa);
 		if (retval != ERROR_OK)
 			goto done;
 
@@ -146,6 +169,7 @@ static int armv7a_l2x_cache_clean_virt(struct target *target, target_addr_t virt
 		(armv7a->armv7a_mmu.armv7a_cache.outer_cache);
 	/* FIXME: different controllers have different linelen */
 	uint32_t i, linelen = 32;
+	target_addr_t page = 1, page_pa = 0;
 	int retval;
 
 	retval = arm7a_l2x_sanity_check(target);
@@ -155,8 +179,7 @@ static int armv7a_l2x_cache_clean_virt(struct target *target, target_addr_t virt
 	for (i = 0; i < size; i += linelen) {
 		target_addr_t pa, offs = virt + i;
 
-		/* FIXME: use less verbose virt2phys? */
-		retval = target->type->virt2phys(target, offs, &pa);
+		retval = arm7a_l2x_virt2phys(target, offs, &page, &page_pa, &pa);
 		if (retval != ERROR_OK)
 			goto done;
 
@@ -226,7 +226,7 @@ static int armv7m_set_core_reg(struct reg *reg, uint8_t *buf)
 	return ERROR_OK;
 }
 
-static uint32_t armv7m_map_id_to_regsel(unsigned int arm_reg_id)
+uint32_t armv7m_map_id_to_regsel(unsigned int arm_reg_id)
 {
 	switch (arm_reg_id) {
 	case ARMV7M_R0 ... ARMV7M_R14:
@@ -1014,6 +1014,74 @@ cleanup1:
 	return retval;
 }
 
+/** Finds the first occurrence of a byte pattern in a memory region. */
+int armv7m_search_memory(struct target *target, target_addr_t address,
+	uint32_t size, const uint8_t *pattern, uint32_t pattern_size,
+	target_addr_t *found_address, bool *found)
+{
+	struct working_area *search_algorithm;
+	struct armv7m_algorithm armv7m_info;
+	struct reg_param reg_params[4];
+	int retval;
+
+	static const uint8_t search_code[] = {
+#include "../../contrib/loaders/search/armv7m_search.inc"
+	};
+
+	const uint32_t code_size = sizeof(search_code);
+
+	/* the pattern goes right after the code */
+	if (target_alloc_working_area(target, code_size + pattern_size,
+		&search_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	retval = target_write_buffer(target, search_algorithm->address,
+			code_size, search_code);
+	if (retval != ERROR_OK)
+		goto cleanup;
+
+	retval = target_write_buffer(target, search_algorithm->address + code_size,
+			pattern_size, pattern);
+	if (retval != ERROR_OK)
+		goto cleanup;
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARM_MODE_THREAD;
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);
+
+	buf_set_u32(reg_params[0].value, 0, 32, address);
+	buf_set_u32(reg_params[1].value, 0, 32, size);
+	buf_set_u32(reg_params[2].value, 0, 32, search_algorithm->address + code_size);
+	buf_set_u32(reg_params[3].value, 0, 32, pattern_size);
+
+	int timeout = 20000 * (1 + (size / (1024 * 1024)));
+
+	retval = target_run_algorithm(target, 0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			search_algorithm->address,
+			search_algorithm->address + (code_size - 2),
+			timeout, &armv7m_info);
+
+	if (retval == ERROR_OK) {
+		*found = buf_get_u32(reg_params[1].value, 0, 32) != 0;
+		*found_address = buf_get_u32(reg_params[0].value, 0, 32);
+	} else {
+		LOG_ERROR("error executing cortex_m search algorithm");
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+cleanup:
+	target_free_working_area(target, search_algorithm);
+
+	return retval;
+}
+
 int armv7m_maybe_skip_bkpt_inst(struct target *target, bool *inst_found)
 {
 	struct armv7m_common *armv7m = target_to_armv7m(target);
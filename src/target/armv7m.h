@@ -258,12 +258,18 @@ int armv7m_wait_algorithm(struct target *target,
 
 int armv7m_invalidate_core_regs(struct target *target);
 
+/** DCRSR.REGSEL for a register, the low word of it for 64-bit registers */
+uint32_t armv7m_map_id_to_regsel(unsigned int arm_reg_id);
+
 int armv7m_restore_context(struct target *target);
 
 int armv7m_checksum_memory(struct target *target,
 		target_addr_t address, uint32_t count, uint32_t *checksum);
 int armv7m_blank_check_memory(struct target *target,
 		struct target_memory_check_block *blocks, int num_blocks, uint8_t erased_value);
+int armv7m_search_memory(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *pattern, uint32_t pattern_size,
+		target_addr_t *found_address, bool *found);
 
 int armv7m_maybe_skip_bkpt_inst(struct target *target, bool *inst_found);
 
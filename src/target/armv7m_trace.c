@@ -26,25 +26,108 @@
 #include <jtag/interface.h>
 
 #define TRACE_BUF_SIZE	4096
+/* Adapter polls per timer tick while the adapter keeps filling the buffer */
+#define TRACE_POLL_MAX	16
+/* Trace a TCP client may have queued before new data is dropped for it */
+#define TRACE_BACKLOG_MAX	(256 * 1024)
+
+#define ITM_PORTS		32
+#define ITM_LINE_MAX	128
+
+struct itm_decoder {
+	/* payload bytes of the current source packet still to come */
+	unsigned int payload_left;
+	unsigned int port;
+	bool software;
+	/* skipping the continuation bytes of a protocol packet */
+	bool continuation;
+	/* zero bytes seen in a row, the start of a synchronization packet */
+	unsigned int zeros;
+	unsigned int overflows;
+	unsigned int hardware_packets;
+	unsigned int line_len[ITM_PORTS];
+	char line[ITM_PORTS][ITM_LINE_MAX];
+};
 
-static int armv7m_poll_trace(void *target)
+static void itm_flush_line(struct itm_decoder *decoder, unsigned int port)
+{
+	if (!decoder->line_len[port])
+		return;
+
+	LOG_USER("itm%u: %.*s", port, (int)decoder->line_len[port], decoder->line[port]);
+	decoder->line_len[port] = 0;
+}
+
+/* Log what the target writes to ITM stimulus ports, one line at a time
+ * per port. Only works on the raw ITM stream, i.e. without the TPIU
+ * formatter. Hardware source (DWT) packets are only counted. */
+static void itm_decode(struct itm_decoder *decoder, const uint8_t *buf, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		uint8_t c = buf[i];
+
+		if (decoder->payload_left) {
+			decoder->payload_left--;
+			if (!decoder->software || c == '\0' || c == '\r')
+				continue;
+			if (c == '\n') {
+				itm_flush_line(decoder, decoder->port);
+				continue;
+			}
+			if (decoder->line_len[decoder->port] == ITM_LINE_MAX)
+				itm_flush_line(decoder, decoder->port);
+			decoder->line[decoder->port][decoder->line_len[decoder->port]++] = c;
+			continue;
+		}
+
+		if (decoder->continuation) {
+			decoder->continuation = c & 0x80;
+			continue;
+		}
+
+		if (c == 0x00) {
+			decoder->zeros++;
+			continue;
+		}
+		bool sync = decoder->zeros && c == 0x80;
+		decoder->zeros = 0;
+		if (sync)
+			continue;
+
+		if (c == 0x70) {
+			decoder->overflows++;
+		} else if (c & 0x03) {
+			/* source packet, 1, 2 or 4 payload bytes */
+			decoder->payload_left = (c & 0x03) == 0x03 ? 4 : c & 0x03;
+			decoder->software = !(c & 0x04);
+			decoder->port = c >> 3;
+			if (!decoder->software)
+				decoder->hardware_packets++;
+		} else {
+			/* timestamp or extension packet, continued while bit 7 is set */
+			decoder->continuation = c & 0x80;
+		}
+	}
+}
+
+static int armv7m_trace_dispatch(struct target *target, const uint8_t *buf, size_t size)
 {
 	struct armv7m_common *armv7m = target_to_armv7m(target);
-	uint8_t buf[TRACE_BUF_SIZE];
-	size_t size = sizeof(buf);
-	int retval;
+	struct armv7m_trace_config *trace_config = &armv7m->trace_config;
 
-	retval = adapter_poll_trace(buf, &size);
-	if (retval != ERROR_OK || !size)
-		return retval;
+	trace_config->bytes_received += size;
 
-	target_call_trace_callbacks(target, size, buf);
+	target_call_trace_callbacks(target, size, (uint8_t *)buf);
 
-	switch (armv7m->trace_config.internal_channel) {
+	if (trace_config->itm_decoder && trace_config->pin_protocol != TPIU_PIN_PROTOCOL_SYNC
+			&& !trace_config->formatter)
+		itm_decode(trace_config->itm_decoder, buf, size);
+
+	switch (trace_config->internal_channel) {
 	case TRACE_INTERNAL_CHANNEL_FILE:
-		if (armv7m->trace_config.trace_file != NULL) {
-			if (fwrite(buf, 1, size, armv7m->trace_config.trace_file) == size)
-				fflush(armv7m->trace_config.trace_file);
+		if (trace_config->trace_file != NULL) {
+			if (fwrite(buf, 1, size, trace_config->trace_file) == size)
+				fflush(trace_config->trace_file);
 			else {
 				LOG_ERROR("Error writing to the trace destination file");
 				return ERROR_FAIL;
@@ -52,21 +135,19 @@ static int armv7m_poll_trace(void *target)
 		}
 		break;
 	case TRACE_INTERNAL_CHANNEL_TCP:
-		if (armv7m->trace_config.trace_service != NULL) {
-			/* broadcast to all service connections */
-			struct connection *connection = armv7m->trace_config.trace_service->connections;
-			retval = ERROR_OK;
+		if (trace_config->trace_service != NULL) {
+			/* broadcast to all service connections. A client that doesn't
+			 * keep up loses data instead of stalling the others; one that
+			 * went away is closed by the server loop. */
+			struct connection *connection = trace_config->trace_service->connections;
 			while (connection) {
-				if (connection_write(connection, buf, size) != (int) size)
-					retval = ERROR_FAIL;
+				if (connection_output_pending(connection) + size > TRACE_BACKLOG_MAX)
+					trace_config->bytes_dropped += size;
+				else
+					connection_send(connection, buf, size);
 
 				connection = connection->next;
 			}
-
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error streaming the trace to TCP/IP port");
-				return ERROR_FAIL;
-			}
 		}
 		break;
 	case TRACE_INTERNAL_CHANNEL_TCL_ONLY:
@@ -82,6 +163,33 @@ static int armv7m_poll_trace(void *target)
 	return ERROR_OK;
 }
 
+static int armv7m_poll_trace(void *target)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	uint8_t buf[TRACE_BUF_SIZE];
+	int retval;
+
+	/* At high trace rates one buffer per timer tick isn't enough, keep
+	 * reading while the adapter fills it. */
+	for (unsigned int i = 0; i < TRACE_POLL_MAX; i++) {
+		size_t size = sizeof(buf);
+
+		retval = adapter_poll_trace(buf, &size);
+		if (retval != ERROR_OK || !size)
+			return retval;
+
+		retval = armv7m_trace_dispatch(target, buf, size);
+		if (retval != ERROR_OK)
+			return retval;
+
+		if (size < sizeof(buf))
+			break;
+		armv7m->trace_config.full_polls++;
+	}
+
+	return ERROR_OK;
+}
+
 int armv7m_trace_tpiu_config(struct target *target)
 {
 	struct armv7m_common *armv7m = target_to_armv7m(target);
@@ -143,9 +251,18 @@ int armv7m_trace_tpiu_config(struct target *target)
 	if (retval != ERROR_OK)
 		return retval;
 
-	if (trace_config->config_type == TRACE_CONFIG_TYPE_INTERNAL)
+	if (trace_config->config_type == TRACE_CONFIG_TYPE_INTERNAL) {
+		trace_config->bytes_received = 0;
+		trace_config->bytes_dropped = 0;
+		trace_config->full_polls = 0;
+		if (trace_config->itm_decoder) {
+			memset(trace_config->itm_decoder, 0, sizeof(*trace_config->itm_decoder));
+			if (trace_config->pin_protocol == TPIU_PIN_PROTOCOL_SYNC || trace_config->formatter)
+				LOG_WARNING("ITM decoding needs asynchronous output without the TPIU formatter");
+		}
 		target_register_timer_callback(armv7m_poll_trace, 1,
 		TARGET_TIMER_TYPE_PERIODIC, target);
+	}
 
 	target_call_event_callbacks(target, TARGET_EVENT_TRACE_CONFIG);
 
@@ -403,6 +520,54 @@ COMMAND_HANDLER(handle_itm_ports_command)
 		return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_itm_decode_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct armv7m_trace_config *trace_config = &armv7m->trace_config;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], trace_config->itm_decode);
+		if (trace_config->itm_decode && !trace_config->itm_decoder) {
+			trace_config->itm_decoder = calloc(1, sizeof(*trace_config->itm_decoder));
+			if (!trace_config->itm_decoder) {
+				trace_config->itm_decode = false;
+				LOG_ERROR("Out of memory");
+				return ERROR_FAIL;
+			}
+		} else if (!trace_config->itm_decode) {
+			free(trace_config->itm_decoder);
+			trace_config->itm_decoder = NULL;
+		}
+	}
+
+	command_print(CMD, "ITM decoding is %s", trace_config->itm_decode ? "on" : "off");
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_tpiu_stats_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct armv7m_trace_config *trace_config = &armv7m->trace_config;
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	command_print(CMD, "received %" PRIu64 " bytes, dropped %" PRIu64
+			" bytes for slow TCP clients, %u adapter polls filled the buffer",
+			trace_config->bytes_received, trace_config->bytes_dropped,
+			trace_config->full_polls);
+	if (trace_config->itm_decoder)
+		command_print(CMD, "ITM: %u overflow packets, %u hardware source packets",
+				trace_config->itm_decoder->overflows,
+				trace_config->itm_decoder->hardware_packets);
+	return ERROR_OK;
+}
+
 static const struct command_registration tpiu_command_handlers[] = {
 	{
 		.name = "config",
@@ -414,6 +579,13 @@ static const struct command_registration tpiu_command_handlers[] = {
 		"(sync <port width> | ((manchester | uart) <formatter enable>)) "
 		"<TRACECLKIN freq> [<trace freq>]))",
 	},
+	{
+		.name = "stats",
+		.handler = handle_tpiu_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "Show how much trace data was captured and dropped",
+		.usage = "",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -432,6 +604,13 @@ static const struct command_registration itm_command_handlers[] = {
 		.help = "Enable or disable all ITM stimulus ports",
 		.usage = "(0|1|on|off)",
 	},
+	{
+		.name = "decode",
+		.handler = handle_itm_decode_command,
+		.mode = COMMAND_ANY,
+		.help = "Log ITM stimulus port output captured in internal mode",
+		.usage = "[(0|1|on|off)]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -87,6 +87,17 @@ struct armv7m_trace_config {
 	FILE *trace_file;
 	/** Handle to output trace data in INTERNAL capture mode via tcp */
 	struct service *trace_service;
+
+	/** Trace bytes received from the adapter in INTERNAL capture mode */
+	uint64_t bytes_received;
+	/** Trace bytes not sent to TCP clients that fell too far behind */
+	uint64_t bytes_dropped;
+	/** Adapter polls that filled the whole trace buffer */
+	unsigned int full_polls;
+	/** Decode ITM stimulus port output into the log */
+	bool itm_decode;
+	/** ITM packet decoder state while itm_decode is set */
+	struct itm_decoder *itm_decoder;
 };
 
 extern const struct command_registration armv7m_trace_command_handlers[];
@@ -0,0 +1,395 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * Standard workloads for comparing debug throughput and latency across
+ * adapters, targets and releases: "benchmark memory", "benchmark
+ * registers", "benchmark commands" and "benchmark step". Flash has
+ * "flash benchmark".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/perf.h>
+#include <helper/time_support.h>
+#include <jtag/jtag.h>
+
+#include "benchmark.h"
+#include "register.h"
+#include "target.h"
+
+#define BENCHMARK_RANDOM_READS	256
+#define BENCHMARK_BATCH_READS	16
+
+static int benchmark_compare_latency(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Print the distribution of @a num latencies in us, sorting them */
+static void benchmark_print_latency(struct command_invocation *cmd, const char *what,
+		int64_t *latency, unsigned int num)
+{
+	if (num == 0)
+		return;
+
+	qsort(latency, num, sizeof(*latency), benchmark_compare_latency);
+	command_print(cmd, "%s latency: p50 %" PRId64 " us, p90 %" PRId64 " us, "
+			"p99 %" PRId64 " us, max %" PRId64 " us", what,
+			latency[num / 2], latency[num * 9 / 10], latency[num * 99 / 100],
+			latency[num - 1]);
+}
+
+static void benchmark_print_throughput(struct command_invocation *cmd, const char *what,
+		struct duration *bench, uint32_t bytes, int flushes)
+{
+	command_print(cmd, "%s: %" PRIu32 " bytes in %.3f ms, %.1f KiB/s, %d queue flushes",
+			what, bytes, duration_elapsed(bench) * 1000, duration_kbps(bench, bytes), flushes);
+}
+
+COMMAND_HANDLER(handle_benchmark_memory_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	uint32_t size = 16384;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], size);
+
+	size = MIN(size, target_get_working_area_avail(target)) & ~7u;
+	if (size < 64) {
+		command_print(CMD, "not enough working area");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	struct working_area *area;
+	int retval = target_alloc_working_area(target, size, &area);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint8_t *pattern = malloc(size);
+	uint8_t *readback = malloc(size);
+	int64_t *latency = calloc(BENCHMARK_RANDOM_READS, sizeof(*latency));
+	if (!pattern || !readback || !latency) {
+		retval = ERROR_FAIL;
+		goto out;
+	}
+	for (uint32_t i = 0; i < size; i++)
+		pattern[i] = rand();
+
+	/* sequential transfers at each access size */
+	unsigned int max_access = target_data_bits(target) / 8;
+	for (unsigned int access = 1; access <= MAX(max_access, 4u); access *= 2) {
+		char what[32];
+		struct duration bench;
+		int flushes;
+
+		snprintf(what, sizeof(what), "write %u-byte", access);
+		flushes = jtag_get_flush_queue_count();
+		duration_start(&bench);
+		retval = target_write_memory(target, area->address, access, size / access, pattern);
+		duration_measure(&bench);
+		if (retval != ERROR_OK) {
+			command_print(CMD, "%s: failed", what);
+			continue;
+		}
+		benchmark_print_throughput(CMD, what, &bench, size,
+				jtag_get_flush_queue_count() - flushes);
+
+		snprintf(what, sizeof(what), "read %u-byte", access);
+		flushes = jtag_get_flush_queue_count();
+		duration_start(&bench);
+		retval = target_read_memory(target, area->address, access, size / access, readback);
+		duration_measure(&bench);
+		if (retval != ERROR_OK) {
+			command_print(CMD, "%s: failed", what);
+			continue;
+		}
+		benchmark_print_throughput(CMD, what, &bench, size,
+				jtag_get_flush_queue_count() - flushes);
+		if (memcmp(pattern, readback, size))
+			command_print(CMD, "%s: data mismatch", what);
+	}
+
+	/* small reads at random places, one at a time and batched */
+	target_addr_t addresses[BENCHMARK_RANDOM_READS];
+	for (unsigned int i = 0; i < BENCHMARK_RANDOM_READS; i++)
+		addresses[i] = area->address + (rand() % (size / 4)) * 4;
+
+	int flushes = jtag_get_flush_queue_count();
+	for (unsigned int i = 0; i < BENCHMARK_RANDOM_READS; i++) {
+		int64_t start = perf_now();
+		retval = target_read_memory(target, addresses[i], 4, 1, readback);
+		latency[i] = perf_now() - start;
+		if (retval != ERROR_OK)
+			goto out;
+	}
+	command_print(CMD, "random 4-byte reads: %d queue flushes for %d reads",
+			jtag_get_flush_queue_count() - flushes, BENCHMARK_RANDOM_READS);
+	benchmark_print_latency(CMD, "random 4-byte read", latency, BENCHMARK_RANDOM_READS);
+
+	flushes = jtag_get_flush_queue_count();
+	unsigned int batches = 0;
+	for (unsigned int i = 0; i < BENCHMARK_RANDOM_READS; i += BENCHMARK_BATCH_READS) {
+		struct target_memory_read reads[BENCHMARK_BATCH_READS];
+		for (unsigned int j = 0; j < BENCHMARK_BATCH_READS; j++) {
+			reads[j].address = addresses[i + j];
+			reads[j].size = 4;
+			reads[j].count = 1;
+			reads[j].buffer = readback + j * 4;
+		}
+		int64_t start = perf_now();
+		retval = target_read_memory_batch(target, reads, BENCHMARK_BATCH_READS);
+		latency[batches++] = perf_now() - start;
+		if (retval != ERROR_OK)
+			goto out;
+	}
+	command_print(CMD, "batched random 4-byte reads: %d queue flushes for %d reads in batches of %d",
+			jtag_get_flush_queue_count() - flushes, BENCHMARK_RANDOM_READS,
+			BENCHMARK_BATCH_READS);
+	benchmark_print_latency(CMD, "batch", latency, batches);
+
+out:
+	free(latency);
+	free(readback);
+	free(pattern);
+	target_free_working_area(target, area);
+	return retval;
+}
+
+COMMAND_HANDLER(handle_benchmark_registers_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	unsigned int count = 20;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], count);
+	if (count == 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (target->state != TARGET_HALTED) {
+		command_print(CMD, "target must be halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	struct reg **reg_list;
+	int reg_list_size;
+	int retval = target_get_gdb_reg_list(target, &reg_list, &reg_list_size,
+			REG_CLASS_GENERAL);
+	if (retval != ERROR_OK)
+		return retval;
+
+	int64_t *latency = calloc(count, sizeof(*latency));
+	if (!latency) {
+		free(reg_list);
+		return ERROR_FAIL;
+	}
+
+	int flushes = jtag_get_flush_queue_count();
+	unsigned int regs = 0;
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++) {
+		int64_t start = perf_now();
+		regs = 0;
+		for (int r = 0; r < reg_list_size && retval == ERROR_OK; r++) {
+			struct reg *reg = reg_list[r];
+			/* leave registers with pending writes alone */
+			if (!reg->exist || reg->dirty)
+				continue;
+			reg->valid = false;
+			retval = reg->type->get(reg);
+			regs++;
+		}
+		latency[i] = perf_now() - start;
+	}
+
+	if (retval == ERROR_OK) {
+		command_print(CMD, "%u dumps of %u registers: %d queue flushes", count, regs,
+				jtag_get_flush_queue_count() - flushes);
+		benchmark_print_latency(CMD, "register dump", latency, count);
+	}
+
+	free(latency);
+	free(reg_list);
+	return retval;
+}
+
+COMMAND_HANDLER(handle_benchmark_step_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	unsigned int count = 100;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], count);
+	if (count == 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (target->state != TARGET_HALTED) {
+		command_print(CMD, "target must be halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	int64_t *latency = calloc(count, sizeof(*latency));
+	if (!latency)
+		return ERROR_FAIL;
+
+	int retval = ERROR_OK;
+	int flushes = jtag_get_flush_queue_count();
+	struct duration bench;
+	duration_start(&bench);
+	unsigned int steps;
+	for (steps = 0; steps < count; steps++) {
+		int64_t start = perf_now();
+		retval = target_step(target, 1, 0, 0);
+		if (retval == ERROR_OK)
+			retval = target_wait_state(target, TARGET_HALTED, 1000);
+		if (retval != ERROR_OK)
+			break;
+		latency[steps] = perf_now() - start;
+	}
+	duration_measure(&bench);
+
+	if (steps) {
+		command_print(CMD, "%u steps in %.3f ms, %.1f steps/s, %d queue flushes", steps,
+				duration_elapsed(&bench) * 1000, steps / duration_elapsed(&bench),
+				jtag_get_flush_queue_count() - flushes);
+		benchmark_print_latency(CMD, "step", latency, steps);
+	}
+
+	free(latency);
+	return retval;
+}
+
+/* Scripted "mdw" against the same read done directly, the difference is
+ * what command dispatch costs per call */
+COMMAND_HANDLER(handle_benchmark_commands_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	unsigned int count = 1000;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], count);
+	if (count == 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct working_area *area;
+	int retval = target_alloc_working_area(target, 4, &area);
+	if (retval != ERROR_OK)
+		return retval;
+
+	Jim_Interp *interp = CMD_CTX->interp;
+	char *script = alloc_printf("mdw " TARGET_ADDR_FMT, area->address);
+	int64_t *latency = calloc(count, sizeof(*latency));
+	if (!script || !latency) {
+		retval = ERROR_FAIL;
+		goto out;
+	}
+
+	struct duration direct;
+	duration_start(&direct);
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++) {
+		uint32_t value;
+		retval = target_read_u32(target, area->address, &value);
+	}
+	duration_measure(&direct);
+	if (retval != ERROR_OK)
+		goto out;
+
+	/* Jim keeps the parsed script with the object, as in a loop body */
+	Jim_Obj *obj = Jim_NewStringObj(interp, script, -1);
+	Jim_IncrRefCount(obj);
+	struct duration scripted;
+	duration_start(&scripted);
+	for (unsigned int i = 0; i < count; i++) {
+		int64_t start = perf_now();
+		if (Jim_EvalObj(interp, obj) != JIM_OK) {
+			retval = ERROR_FAIL;
+			break;
+		}
+		latency[i] = perf_now() - start;
+	}
+	duration_measure(&scripted);
+	Jim_DecrRefCount(interp, obj);
+	if (retval != ERROR_OK)
+		goto out;
+
+	float overhead = duration_elapsed(&scripted) - duration_elapsed(&direct);
+	command_print(CMD, "%u reads: direct %.3f ms, mdw %.3f ms, %.1f us dispatch per command",
+			count, duration_elapsed(&direct) * 1000, duration_elapsed(&scripted) * 1000,
+			overhead * 1000000 / count);
+	benchmark_print_latency(CMD, "mdw", latency, count);
+
+out:
+	free(latency);
+	free(script);
+	target_free_working_area(target, area);
+	return retval;
+}
+
+static const struct command_registration benchmark_subcommand_handlers[] = {
+	{
+		.name = "memory",
+		.handler = handle_benchmark_memory_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure sequential reads and writes at each access size "
+			"and random small reads, in the working area",
+		.usage = "[size]",
+	},
+	{
+		.name = "registers",
+		.handler = handle_benchmark_registers_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure reading all general registers from the target",
+		.usage = "[count]",
+	},
+	{
+		.name = "commands",
+		.handler = handle_benchmark_commands_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure the cost of running mdw from a script "
+			"against the same read done directly",
+		.usage = "[count]",
+	},
+	{
+		.name = "step",
+		.handler = handle_benchmark_step_command,
+		.mode = COMMAND_EXEC,
+		.help = "measure single steps, executing the target's code",
+		.usage = "[count]",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+const struct command_registration benchmark_command_handlers[] = {
+	{
+		.name = "benchmark",
+		.mode = COMMAND_ANY,
+		.help = "standard workloads for measuring debug performance",
+		.usage = "",
+		.chain = benchmark_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -41,44 +41,178 @@ static const char * const watchpoint_rw_strings[] = {
 /* monotonic counter/id-number for breakpoints and watch points */
 static int bpwp_unique_id;
 
+/*
+ * Breakpoints and watchpoints are kept in the target's lists, which target
+ * code walks, and also hashed by address so that lookups don't depend on
+ * how many there are. Context breakpoints have address 0 and share a bucket.
+ */
+#define BREAKPOINT_INDEX_SIZE 256
+
+struct breakpoint_index {
+	struct breakpoint *breakpoints[BREAKPOINT_INDEX_SIZE];
+	struct watchpoint *watchpoints[BREAKPOINT_INDEX_SIZE];
+	/* end of the breakpoint list, if known, so adding many is cheap */
+	struct breakpoint *last;
+	/* addresses of breakpoint_hit_once() breakpoints, in the order hit */
+	target_addr_t *hits;
+	unsigned int hit_count;
+	unsigned int hit_alloc;
+};
+
+static unsigned int breakpoint_hash(target_addr_t address)
+{
+	/* instructions are at least 2-byte aligned */
+	address >>= 1;
+	return (address ^ (address >> 8) ^ (address >> 16)) & (BREAKPOINT_INDEX_SIZE - 1);
+}
+
+static struct breakpoint_index *breakpoint_index_get(struct target *target)
+{
+	if (!target->breakpoint_index) {
+		target->breakpoint_index = calloc(1, sizeof(struct breakpoint_index));
+		if (!target->breakpoint_index)
+			LOG_ERROR("Out of memory");
+	}
+	return target->breakpoint_index;
+}
+
+void breakpoint_index_reset(struct target *target)
+{
+	if (target->breakpoint_index)
+		free(target->breakpoint_index->hits);
+	free(target->breakpoint_index);
+	target->breakpoint_index = NULL;
+}
+
+/* First breakpoint at @a address, whatever its asid */
+static struct breakpoint *breakpoint_index_find(struct target *target, target_addr_t address)
+{
+	if (!target->breakpoint_index)
+		return NULL;
+
+	struct breakpoint *breakpoint =
+		target->breakpoint_index->breakpoints[breakpoint_hash(address)];
+	while (breakpoint && breakpoint->address != address)
+		breakpoint = breakpoint->index_next;
+	return breakpoint;
+}
+
+static void breakpoint_index_remove(struct target *target, struct breakpoint *breakpoint)
+{
+	if (!target->breakpoint_index)
+		return;
+
+	struct breakpoint **p =
+		&target->breakpoint_index->breakpoints[breakpoint_hash(breakpoint->address)];
+	while (*p && *p != breakpoint)
+		p = &(*p)->index_next;
+	if (*p)
+		*p = breakpoint->index_next;
+}
+
+static struct watchpoint *watchpoint_index_find(struct target *target, target_addr_t address)
+{
+	if (!target->breakpoint_index)
+		return NULL;
+
+	struct watchpoint *watchpoint =
+		target->breakpoint_index->watchpoints[breakpoint_hash(address)];
+	while (watchpoint && watchpoint->address != address)
+		watchpoint = watchpoint->index_next;
+	return watchpoint;
+}
+
+static void watchpoint_index_remove(struct target *target, struct watchpoint *watchpoint)
+{
+	if (!target->breakpoint_index)
+		return;
+
+	struct watchpoint **p =
+		&target->breakpoint_index->watchpoints[breakpoint_hash(watchpoint->address)];
+	while (*p && *p != watchpoint)
+		p = &(*p)->index_next;
+	if (*p)
+		*p = watchpoint->index_next;
+}
+
+/* Append a new breakpoint to the target's list, or return NULL */
+static struct breakpoint *breakpoint_new(struct target *target, target_addr_t address,
+		uint32_t asid, uint32_t length, enum breakpoint_type type)
+{
+	struct breakpoint_index *index = breakpoint_index_get(target);
+	if (!index)
+		return NULL;
+
+	struct breakpoint **breakpoint_p = &target->breakpoints;
+	if (index->last && !index->last->next)
+		breakpoint_p = &index->last->next;
+	while (*breakpoint_p)
+		breakpoint_p = &(*breakpoint_p)->next;
+
+	struct breakpoint *breakpoint = malloc(sizeof(struct breakpoint));
+	if (!breakpoint)
+		return NULL;
+	breakpoint->address = address;
+	breakpoint->asid = asid;
+	breakpoint->length = length;
+	breakpoint->type = type;
+	breakpoint->set = 0;
+	breakpoint->orig_instr = malloc(length);
+	breakpoint->next = NULL;
+	breakpoint->unique_id = bpwp_unique_id++;
+	breakpoint->from_set = false;
+	breakpoint->once = false;
+	*breakpoint_p = breakpoint;
+	index->last = breakpoint;
+	return breakpoint;
+}
+
+/* Index a breakpoint once the target took it, it may have adjusted the address */
+static void breakpoint_index_add(struct target *target, struct breakpoint *breakpoint)
+{
+	unsigned int hash = breakpoint_hash(breakpoint->address);
+	breakpoint->index_next = target->breakpoint_index->breakpoints[hash];
+	target->breakpoint_index->breakpoints[hash] = breakpoint;
+}
+
+/* Undo breakpoint_new() after the target refused the breakpoint */
+static void breakpoint_discard(struct target *target, struct breakpoint *breakpoint)
+{
+	struct breakpoint **breakpoint_p = &target->breakpoints;
+	while (*breakpoint_p != breakpoint)
+		breakpoint_p = &(*breakpoint_p)->next;
+	*breakpoint_p = NULL;
+	target->breakpoint_index->last = NULL;
+
+	free(breakpoint->orig_instr);
+	free(breakpoint);
+}
+
 static int breakpoint_add_internal(struct target *target,
 	target_addr_t address,
 	uint32_t length,
 	enum breakpoint_type type)
 {
-	struct breakpoint *breakpoint = target->breakpoints;
-	struct breakpoint **breakpoint_p = &target->breakpoints;
+	struct breakpoint *breakpoint;
 	const char *reason;
 	int retval;
-	int n;
 
-	n = 0;
-	while (breakpoint) {
-		n++;
-		if (breakpoint->address == address) {
-			/* FIXME don't assume "same address" means "same
-			 * breakpoint" ... check all the parameters before
-			 * succeeding.
-			 */
-			LOG_ERROR("Duplicate Breakpoint address: " TARGET_ADDR_FMT " (BP %" PRIu32 ")",
-				address, breakpoint->unique_id);
-			return ERROR_TARGET_DUPLICATE_BREAKPOINT;
-		}
-		breakpoint_p = &breakpoint->next;
-		breakpoint = breakpoint->next;
+	breakpoint = breakpoint_index_find(target, address);
+	if (breakpoint) {
+		/* FIXME don't assume "same address" means "same
+		 * breakpoint" ... check all the parameters before
+		 * succeeding.
+		 */
+		LOG_ERROR("Duplicate Breakpoint address: " TARGET_ADDR_FMT " (BP %" PRIu32 ")",
+			address, breakpoint->unique_id);
+		return ERROR_TARGET_DUPLICATE_BREAKPOINT;
 	}
 
-	(*breakpoint_p) = malloc(sizeof(struct breakpoint));
-	(*breakpoint_p)->address = address;
-	(*breakpoint_p)->asid = 0;
-	(*breakpoint_p)->length = length;
-	(*breakpoint_p)->type = type;
-	(*breakpoint_p)->set = 0;
-	(*breakpoint_p)->orig_instr = malloc(length);
-	(*breakpoint_p)->next = NULL;
-	(*breakpoint_p)->unique_id = bpwp_unique_id++;
-
-	retval = target_add_breakpoint(target, *breakpoint_p);
+	breakpoint = breakpoint_new(target, address, 0, length, type);
+	if (!breakpoint)
+		return ERROR_FAIL;
+
+	retval = target_add_breakpoint(target, breakpoint);
 	switch (retval) {
 		case ERROR_OK:
 			break;
@@ -92,18 +226,17 @@ static int breakpoint_add_internal(struct target *target,
 			reason = "unknown reason";
 fail:
 			LOG_ERROR("can't add breakpoint: %s", reason);
-			free((*breakpoint_p)->orig_instr);
-			free(*breakpoint_p);
-			*breakpoint_p = NULL;
+			breakpoint_discard(target, breakpoint);
 			return retval;
 	}
+	breakpoint_index_add(target, breakpoint);
 
 	LOG_DEBUG("[%d] added %s breakpoint at " TARGET_ADDR_FMT
 			" of length 0x%8.8x, (BPID: %" PRIu32 ")",
 		target->coreid,
-		breakpoint_type_strings[(*breakpoint_p)->type],
-		(*breakpoint_p)->address, (*breakpoint_p)->length,
-		(*breakpoint_p)->unique_id);
+		breakpoint_type_strings[breakpoint->type],
+		breakpoint->address, breakpoint->length,
+		breakpoint->unique_id);
 
 	return ERROR_OK;
 }
@@ -114,13 +247,9 @@ static int context_breakpoint_add_internal(struct target *target,
 	enum breakpoint_type type)
 {
 	struct breakpoint *breakpoint = target->breakpoints;
-	struct breakpoint **breakpoint_p = &target->breakpoints;
 	int retval;
-	int n;
 
-	n = 0;
 	while (breakpoint) {
-		n++;
 		if (breakpoint->asid == asid) {
 			/* FIXME don't assume "same address" means "same
 			 * breakpoint" ... check all the parameters before
@@ -130,32 +259,25 @@ static int context_breakpoint_add_internal(struct target *target,
 				asid, breakpoint->unique_id);
 			return ERROR_TARGET_DUPLICATE_BREAKPOINT;
 		}
-		breakpoint_p = &breakpoint->next;
 		breakpoint = breakpoint->next;
 	}
 
-	(*breakpoint_p) = malloc(sizeof(struct breakpoint));
-	(*breakpoint_p)->address = 0;
-	(*breakpoint_p)->asid = asid;
-	(*breakpoint_p)->length = length;
-	(*breakpoint_p)->type = type;
-	(*breakpoint_p)->set = 0;
-	(*breakpoint_p)->orig_instr = malloc(length);
-	(*breakpoint_p)->next = NULL;
-	(*breakpoint_p)->unique_id = bpwp_unique_id++;
-	retval = target_add_context_breakpoint(target, *breakpoint_p);
+	breakpoint = breakpoint_new(target, 0, asid, length, type);
+	if (!breakpoint)
+		return ERROR_FAIL;
+
+	retval = target_add_context_breakpoint(target, breakpoint);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("could not add breakpoint");
-		free((*breakpoint_p)->orig_instr);
-		free(*breakpoint_p);
-		*breakpoint_p = NULL;
+		breakpoint_discard(target, breakpoint);
 		return retval;
 	}
+	breakpoint_index_add(target, breakpoint);
 
 	LOG_DEBUG("added %s Context breakpoint at 0x%8.8" PRIx32 " of length 0x%8.8x, (BPID: %" PRIu32 ")",
-		breakpoint_type_strings[(*breakpoint_p)->type],
-		(*breakpoint_p)->asid, (*breakpoint_p)->length,
-		(*breakpoint_p)->unique_id);
+		breakpoint_type_strings[breakpoint->type],
+		breakpoint->asid, breakpoint->length,
+		breakpoint->unique_id);
 
 	return ERROR_OK;
 }
@@ -166,13 +288,12 @@ static int hybrid_breakpoint_add_internal(struct target *target,
 	uint32_t length,
 	enum breakpoint_type type)
 {
-	struct breakpoint *breakpoint = target->breakpoints;
-	struct breakpoint **breakpoint_p = &target->breakpoints;
+	struct breakpoint *breakpoint = NULL;
 	int retval;
-	int n;
-	n = 0;
+
+	if (target->breakpoint_index)
+		breakpoint = target->breakpoint_index->breakpoints[breakpoint_hash(address)];
 	while (breakpoint) {
-		n++;
 		if ((breakpoint->asid == asid) && (breakpoint->address == address)) {
 			/* FIXME don't assume "same address" means "same
 			 * breakpoint" ... check all the parameters before
@@ -187,34 +308,26 @@ static int hybrid_breakpoint_add_internal(struct target *target,
 			return ERROR_TARGET_DUPLICATE_BREAKPOINT;
 
 		}
-		breakpoint_p = &breakpoint->next;
-		breakpoint = breakpoint->next;
+		breakpoint = breakpoint->index_next;
 	}
-	(*breakpoint_p) = malloc(sizeof(struct breakpoint));
-	(*breakpoint_p)->address = address;
-	(*breakpoint_p)->asid = asid;
-	(*breakpoint_p)->length = length;
-	(*breakpoint_p)->type = type;
-	(*breakpoint_p)->set = 0;
-	(*breakpoint_p)->orig_instr = malloc(length);
-	(*breakpoint_p)->next = NULL;
-	(*breakpoint_p)->unique_id = bpwp_unique_id++;
-
-
-	retval = target_add_hybrid_breakpoint(target, *breakpoint_p);
+
+	breakpoint = breakpoint_new(target, address, asid, length, type);
+	if (!breakpoint)
+		return ERROR_FAIL;
+
+	retval = target_add_hybrid_breakpoint(target, breakpoint);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("could not add breakpoint");
-		free((*breakpoint_p)->orig_instr);
-		free(*breakpoint_p);
-		*breakpoint_p = NULL;
+		breakpoint_discard(target, breakpoint);
 		return retval;
 	}
+	breakpoint_index_add(target, breakpoint);
 	LOG_DEBUG(
 		"added %s Hybrid breakpoint at address " TARGET_ADDR_FMT " of length 0x%8.8x, (BPID: %" PRIu32 ")",
-		breakpoint_type_strings[(*breakpoint_p)->type],
-		(*breakpoint_p)->address,
-		(*breakpoint_p)->length,
-		(*breakpoint_p)->unique_id);
+		breakpoint_type_strings[breakpoint->type],
+		breakpoint->address,
+		breakpoint->length,
+		breakpoint->unique_id);
 
 	return ERROR_OK;
 }
@@ -290,39 +403,45 @@ int hybrid_breakpoint_add(struct target *target,
 }
 
 /* free up a breakpoint */
-static void breakpoint_free(struct target *target, struct breakpoint *breakpoint_to_remove)
+/* remove the breakpoint *breakpoint_p from the target and free it */
+static void breakpoint_unlink(struct target *target, struct breakpoint **breakpoint_p)
 {
-	struct breakpoint *breakpoint = target->breakpoints;
-	struct breakpoint **breakpoint_p = &target->breakpoints;
+	struct breakpoint *breakpoint = *breakpoint_p;
 	int retval;
 
-	while (breakpoint) {
-		if (breakpoint == breakpoint_to_remove)
-			break;
-		breakpoint_p = &breakpoint->next;
-		breakpoint = breakpoint->next;
-	}
-
-	if (breakpoint == NULL)
-		return;
-
 	retval = target_remove_breakpoint(target, breakpoint);
 
 	LOG_DEBUG("free BPID: %" PRIu32 " --> %d", breakpoint->unique_id, retval);
 	(*breakpoint_p) = breakpoint->next;
+	breakpoint_index_remove(target, breakpoint);
+	if (target->breakpoint_index && target->breakpoint_index->last == breakpoint)
+		target->breakpoint_index->last = NULL;
 	free(breakpoint->orig_instr);
 	free(breakpoint);
 }
 
+static void breakpoint_free(struct target *target, struct breakpoint *breakpoint_to_remove)
+{
+	struct breakpoint **breakpoint_p = &target->breakpoints;
+
+	while (*breakpoint_p && *breakpoint_p != breakpoint_to_remove)
+		breakpoint_p = &(*breakpoint_p)->next;
+
+	if (*breakpoint_p == NULL)
+		return;
+
+	breakpoint_unlink(target, breakpoint_p);
+}
+
 static int breakpoint_remove_internal(struct target *target, target_addr_t address)
 {
-	struct breakpoint *breakpoint = target->breakpoints;
+	struct breakpoint *breakpoint = breakpoint_index_find(target, address);
 
-	while (breakpoint) {
-		if ((breakpoint->address == address) ||
-		    (breakpoint->address == 0 && breakpoint->asid == address))
-			break;
-		breakpoint = breakpoint->next;
+	/* context breakpoints are removed by asid */
+	if (!breakpoint && target->breakpoint_index) {
+		breakpoint = target->breakpoint_index->breakpoints[breakpoint_hash(0)];
+		while (breakpoint && !(breakpoint->address == 0 && breakpoint->asid == address))
+			breakpoint = breakpoint->index_next;
 	}
 
 	if (breakpoint) {
@@ -406,44 +525,118 @@ void breakpoint_clear_target(struct target *target)
 
 struct breakpoint *breakpoint_find(struct target *target, target_addr_t address)
 {
-	struct breakpoint *breakpoint = target->breakpoints;
+	return breakpoint_index_find(target, address);
+}
 
-	while (breakpoint) {
-		if (breakpoint->address == address)
-			return breakpoint;
-		breakpoint = breakpoint->next;
+/* Software breakpoints of an SMP group live on its first target */
+static struct target *breakpoint_set_target(struct target *target)
+{
+	return target->smp ? target->head->target : target;
+}
+
+int breakpoint_set_add(struct target *target, target_addr_t address,
+		uint32_t length, bool once)
+{
+	target = breakpoint_set_target(target);
+
+	int retval = breakpoint_add_internal(target, address, length, BKPT_SOFT);
+	if (retval != ERROR_OK)
+		return retval;
+
+	struct breakpoint *breakpoint = breakpoint_index_find(target, address);
+	breakpoint->from_set = true;
+	breakpoint->once = once;
+	return ERROR_OK;
+}
+
+unsigned int breakpoint_set_remove(struct target *target)
+{
+	target = breakpoint_set_target(target);
+
+	unsigned int removed = 0;
+	struct breakpoint **breakpoint_p = &target->breakpoints;
+	while (*breakpoint_p) {
+		if ((*breakpoint_p)->from_set) {
+			breakpoint_unlink(target, breakpoint_p);
+			removed++;
+		} else {
+			breakpoint_p = &(*breakpoint_p)->next;
+		}
 	}
 
-	return NULL;
+	if (target->breakpoint_index)
+		target->breakpoint_index->hit_count = 0;
+	return removed;
+}
+
+bool breakpoint_hit_once(struct target *target, target_addr_t address)
+{
+	target = breakpoint_set_target(target);
+
+	struct breakpoint *breakpoint = breakpoint_index_find(target, address);
+	if (!breakpoint || !breakpoint->once)
+		return false;
+
+	struct breakpoint_index *index = target->breakpoint_index;
+	if (index->hit_count == index->hit_alloc) {
+		unsigned int alloc = index->hit_alloc ? 2 * index->hit_alloc : 64;
+		target_addr_t *hits = realloc(index->hits, alloc * sizeof(*hits));
+		if (!hits) {
+			LOG_ERROR("Out of memory");
+			return false;
+		}
+		index->hits = hits;
+		index->hit_alloc = alloc;
+	}
+	index->hits[index->hit_count++] = address;
+
+	LOG_DEBUG("[%d] hit once breakpoint at " TARGET_ADDR_FMT, target->coreid, address);
+	breakpoint_free(target, breakpoint);
+	return true;
+}
+
+const target_addr_t *breakpoint_set_hits(struct target *target, unsigned int *count)
+{
+	target = breakpoint_set_target(target);
+
+	if (!target->breakpoint_index) {
+		*count = 0;
+		return NULL;
+	}
+	*count = target->breakpoint_index->hit_count;
+	return target->breakpoint_index->hits;
 }
 
 int watchpoint_add_internal(struct target *target, target_addr_t address,
 		uint32_t length, enum watchpoint_rw rw, uint32_t value, uint32_t mask)
 {
-	struct watchpoint *watchpoint = target->watchpoints;
+	struct watchpoint *watchpoint = watchpoint_index_find(target, address);
 	struct watchpoint **watchpoint_p = &target->watchpoints;
 	int retval;
 	const char *reason;
 
-	while (watchpoint) {
-		if (watchpoint->address == address) {
-			if (watchpoint->length != length
-				|| watchpoint->value != value
-				|| watchpoint->mask != mask
-				|| watchpoint->rw != rw) {
-				LOG_ERROR("address " TARGET_ADDR_FMT
-					" already has watchpoint %d",
-					address, watchpoint->unique_id);
-				return ERROR_FAIL;
-			}
-
-			/* ignore duplicate watchpoint */
-			return ERROR_OK;
+	if (watchpoint) {
+		if (watchpoint->length != length
+			|| watchpoint->value != value
+			|| watchpoint->mask != mask
+			|| watchpoint->rw != rw) {
+			LOG_ERROR("address " TARGET_ADDR_FMT
+				" already has watchpoint %d",
+				address, watchpoint->unique_id);
+			return ERROR_FAIL;
 		}
-		watchpoint_p = &watchpoint->next;
-		watchpoint = watchpoint->next;
+
+		/* ignore duplicate watchpoint */
+		return ERROR_OK;
 	}
 
+	struct breakpoint_index *index = breakpoint_index_get(target);
+	if (!index)
+		return ERROR_FAIL;
+
+	while (*watchpoint_p)
+		watchpoint_p = &(*watchpoint_p)->next;
+
 	(*watchpoint_p) = calloc(1, sizeof(struct watchpoint));
 	(*watchpoint_p)->address = address;
 	(*watchpoint_p)->length = length;
@@ -473,6 +666,10 @@ bye:
 			return retval;
 	}
 
+	unsigned int hash = breakpoint_hash((*watchpoint_p)->address);
+	(*watchpoint_p)->index_next = index->watchpoints[hash];
+	index->watchpoints[hash] = *watchpoint_p;
+
 	LOG_DEBUG("added %s watchpoint at " TARGET_ADDR_FMT
 		" of length 0x%8.8" PRIx32 " (WPID: %d)",
 		watchpoint_rw_strings[(*watchpoint_p)->rw],
@@ -524,18 +721,13 @@ static void watchpoint_free(struct target *target, struct watchpoint *watchpoint
 	retval = target_remove_watchpoint(target, watchpoint);
 	LOG_DEBUG("free WPID: %d --> %d", watchpoint->unique_id, retval);
 	(*watchpoint_p) = watchpoint->next;
+	watchpoint_index_remove(target, watchpoint);
 	free(watchpoint);
 }
 
 int watchpoint_remove_internal(struct target *target, target_addr_t address)
 {
-	struct watchpoint *watchpoint = target->watchpoints;
-
-	while (watchpoint) {
-		if (watchpoint->address == address)
-			break;
-		watchpoint = watchpoint->next;
-	}
+	struct watchpoint *watchpoint = watchpoint_index_find(target, address);
 
 	if (watchpoint) {
 		watchpoint_free(target, watchpoint);
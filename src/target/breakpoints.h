@@ -42,8 +42,13 @@ struct breakpoint {
 	int set;
 	uint8_t *orig_instr;
 	struct breakpoint *next;
+	struct breakpoint *index_next;
 	uint32_t unique_id;
 	int linked_BRP;
+	/* added by breakpoint_set_add() */
+	bool from_set;
+	/* removed by breakpoint_hit_once() when hit */
+	bool once;
 };
 
 struct watchpoint {
@@ -54,6 +59,7 @@ struct watchpoint {
 	enum watchpoint_rw rw;
 	int set;
 	struct watchpoint *next;
+	struct watchpoint *index_next;
 	int unique_id;
 };
 
@@ -69,12 +75,30 @@ void breakpoint_remove_all(struct target *target);
 
 struct breakpoint *breakpoint_find(struct target *target, target_addr_t address);
 
+/* Large sets of software breakpoints, e.g. one per basic block for coverage.
+ * Targets with lazy software breakpoints insert and remove these in bulk
+ * when the target resumes. */
+int breakpoint_set_add(struct target *target, target_addr_t address,
+		uint32_t length, bool once);
+/* Remove all breakpoints of the set, returns how many there were */
+unsigned int breakpoint_set_remove(struct target *target);
+/* Called by targets that halted on a software breakpoint at @a address.
+ * If it is a once breakpoint of the set, it is logged and removed and the
+ * target should resume, which this returns true for. */
+bool breakpoint_hit_once(struct target *target, target_addr_t address);
+/* Addresses of the once breakpoints that were hit, in order */
+const target_addr_t *breakpoint_set_hits(struct target *target, unsigned int *count);
+
 void watchpoint_clear_target(struct target *target);
 int watchpoint_add(struct target *target,
 		target_addr_t address, uint32_t length,
 		enum watchpoint_rw rw, uint32_t value, uint32_t mask);
 void watchpoint_remove(struct target *target, target_addr_t address);
 
+/* Forget the address index, after freeing breakpoints and watchpoints
+ * without the functions above */
+void breakpoint_index_reset(struct target *target);
+
 /* report type and address of just hit watchpoint */
 int watchpoint_hit(struct target *target, enum watchpoint_rw *rw,
 		target_addr_t *address);
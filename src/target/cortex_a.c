@@ -79,6 +79,8 @@ static int cortex_a_virt2phys(struct target *target,
 	target_addr_t virt, target_addr_t *phys);
 static int cortex_a_read_cpu_memory(struct target *target,
 	uint32_t address, uint32_t size, uint32_t count, uint8_t *buffer);
+static int cortex_a_set_dcc_mode(struct target *target, uint32_t mode, uint32_t *dscr);
+static int cortex_a_queue_dcc_mode(struct target *target, uint32_t mode, uint32_t *dscr);
 
 
 /*  restore cp15_control_reg at resume */
@@ -466,6 +468,59 @@ static int cortex_a_instr_write_data_r0(struct arm_dpm *dpm,
 	return retval;
 }
 
+static int cortex_a_instr_write_data_r0_range(struct arm_dpm *dpm,
+	uint32_t opcode, uint32_t data, uint32_t step, uint32_t count)
+{
+	struct cortex_a_common *a = dpm_to_a(dpm);
+	struct armv7a_common *armv7a = &a->armv7a_common;
+	struct target *target = armv7a->arm.target;
+	uint32_t dscr;
+	int retval, final_retval;
+
+	retval = mem_ap_read_atomic_u32(armv7a->debug_ap,
+			armv7a->debug_base + CPUDBG_DSCR, &dscr);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* In stall mode the DAP holds off each DTRRX write until the previous
+	 * value has been consumed and each ITR write until the previous
+	 * instruction has completed, so the whole range can be queued without
+	 * polling DSCR in between. */
+	retval = cortex_a_queue_dcc_mode(target, DSCR_EXT_DCC_STALL_MODE, &dscr);
+
+	for (uint32_t i = 0; i < count && retval == ERROR_OK; i++) {
+		retval = mem_ap_write_u32(armv7a->debug_ap,
+				armv7a->debug_base + CPUDBG_DTRRX, data);
+		if (retval == ERROR_OK)
+			/* DCCRX to R0, "MRC p14, 0, R0, c0, c5, 0" */
+			retval = mem_ap_write_u32(armv7a->debug_ap,
+					armv7a->debug_base + CPUDBG_ITR, ARMV4_5_MRC(14, 0, 0, 0, 5, 0));
+		if (retval == ERROR_OK)
+			retval = mem_ap_write_u32(armv7a->debug_ap,
+					armv7a->debug_base + CPUDBG_ITR, opcode);
+		data += step;
+
+		/* keep the DAP queue bounded */
+		if (retval == ERROR_OK && (i & 0xff) == 0xff) {
+			retval = dap_run(armv7a->debug_ap->dap);
+			keep_alive();
+		}
+	}
+
+	final_retval = retval;
+
+	retval = cortex_a_set_dcc_mode(target, DSCR_EXT_DCC_NON_BLOCKING, &dscr);
+	if (final_retval == ERROR_OK)
+		final_retval = retval;
+
+	if (final_retval == ERROR_OK) {
+		dscr = 0;
+		final_retval = cortex_a_wait_instrcmpl(target, &dscr, true);
+	}
+
+	return final_retval;
+}
+
 static int cortex_a_instr_cpsr_sync(struct arm_dpm *dpm)
 {
 	struct target *target = dpm->arm->target;
@@ -607,6 +662,7 @@ static int cortex_a_dpm_setup(struct cortex_a_common *a, uint32_t didr)
 
 	dpm->instr_write_data_dcc = cortex_a_instr_write_data_dcc;
 	dpm->instr_write_data_r0 = cortex_a_instr_write_data_r0;
+	dpm->instr_write_data_r0_range = cortex_a_instr_write_data_r0_range;
 	dpm->instr_cpsr_sync = cortex_a_instr_cpsr_sync;
 
 	dpm->instr_read_data_dcc = cortex_a_instr_read_data_dcc;
@@ -1757,6 +1813,24 @@ static int cortex_a_set_dcc_mode(struct target *target, uint32_t mode, uint32_t
 	}
 }
 
+static int cortex_a_queue_dcc_mode(struct target *target, uint32_t mode, uint32_t *dscr)
+{
+	/* Like cortex_a_set_dcc_mode(), but only queues the DSCR write so it
+	 * goes out in the same DAP run as the transfer that follows it. Any
+	 * error shows up when that transfer runs.
+	 */
+	uint32_t new_dscr = (*dscr & ~DSCR_EXT_DCC_MASK) | mode;
+	if (new_dscr == *dscr)
+		return ERROR_OK;
+
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+	int retval = mem_ap_write_u32(armv7a->debug_ap,
+			armv7a->debug_base + CPUDBG_DSCR, new_dscr);
+	if (retval == ERROR_OK)
+		*dscr = new_dscr;
+	return retval;
+}
+
 static int cortex_a_wait_dscr_bits(struct target *target, uint32_t mask,
 	uint32_t value, uint32_t *dscr)
 {
@@ -2006,17 +2080,18 @@ static int cortex_a_write_cpu_memory_fast(struct target *target,
 	int retval;
 
 	/* Switch to fast mode if not already in that mode. */
-	retval = cortex_a_set_dcc_mode(target, DSCR_EXT_DCC_FAST_MODE, dscr);
+	retval = cortex_a_queue_dcc_mode(target, DSCR_EXT_DCC_FAST_MODE, dscr);
 	if (retval != ERROR_OK)
 		return retval;
 
 	/* Latch STC instruction. */
-	retval = mem_ap_write_atomic_u32(armv7a->debug_ap,
+	retval = mem_ap_write_u32(armv7a->debug_ap,
 			armv7a->debug_base + CPUDBG_ITR, ARMV4_5_STC(0, 1, 0, 1, 14, 5, 0, 4));
 	if (retval != ERROR_OK)
 		return retval;
 
-	/* Transfer all the data and issue all the instructions. */
+	/* Transfer all the data and issue all the instructions, in the same
+	 * DAP run as the mode switch and the ITR write above. */
 	return mem_ap_write_buf_noincr(armv7a->debug_ap, buffer,
 			4, count, armv7a->debug_base + CPUDBG_DTRRX);
 }
@@ -2078,6 +2153,22 @@ static int cortex_a_write_cpu_memory(struct target *target,
 	if (size == 4 && (address % 4) == 0) {
 		/* We are doing a word-aligned transfer, so use fast mode. */
 		retval = cortex_a_write_cpu_memory_fast(target, count, buffer, &dscr);
+	} else if (size == 4 && count > 2) {
+		/* Unaligned words: bytes up to the first word boundary, the words
+		 * after it in fast mode, then the bytes that are left. R0 keeps
+		 * incrementing across all three. */
+		uint32_t head = 4 - address % 4;
+		retval = cortex_a_write_cpu_memory_slow(target, 1, head, buffer, &dscr);
+		if (retval == ERROR_OK && !(dscr & (DSCR_STICKY_ABORT_PRECISE | DSCR_STICKY_ABORT_IMPRECISE)))
+			retval = cortex_a_write_cpu_memory_fast(target, count - 1, buffer + head, &dscr);
+		/* The last STC must be done with DTRRX before it is written again */
+		if (retval == ERROR_OK)
+			retval = cortex_a_set_dcc_mode(target, DSCR_EXT_DCC_NON_BLOCKING, &dscr);
+		if (retval == ERROR_OK)
+			retval = cortex_a_wait_instrcmpl(target, &dscr, true);
+		if (retval == ERROR_OK && !(dscr & (DSCR_STICKY_ABORT_PRECISE | DSCR_STICKY_ABORT_IMPRECISE)))
+			retval = cortex_a_write_cpu_memory_slow(target, 1, 4 - head,
+					buffer + head + 4 * (count - 1), &dscr);
 	} else {
 		/* Use slow path. Adjust size for aligned accesses */
 		switch (address % 4) {
@@ -2280,12 +2371,12 @@ static int cortex_a_read_cpu_memory_fast(struct target *target,
 
 	if (count > 0) {
 		/* Switch to fast mode if not already in that mode. */
-		retval = cortex_a_set_dcc_mode(target, DSCR_EXT_DCC_FAST_MODE, dscr);
+		retval = cortex_a_queue_dcc_mode(target, DSCR_EXT_DCC_FAST_MODE, dscr);
 		if (retval != ERROR_OK)
 			return retval;
 
 		/* Latch LDC instruction. */
-		retval = mem_ap_write_atomic_u32(armv7a->debug_ap,
+		retval = mem_ap_write_u32(armv7a->debug_ap,
 				armv7a->debug_base + CPUDBG_ITR, ARMV4_5_LDC(0, 1, 0, 1, 14, 5, 0, 4));
 		if (retval != ERROR_OK)
 			return retval;
@@ -2295,6 +2386,7 @@ static int cortex_a_read_cpu_memory_fast(struct target *target,
 		 * then reissues the read instruction to read the next word from
 		 * memory. The last read of DTRTX in this call reads the second-to-last
 		 * word from memory and issues the read instruction for the last word.
+		 * The mode switch and ITR write above go out in the same DAP run.
 		 */
 		retval = mem_ap_read_buf_noincr(armv7a->debug_ap, buffer,
 				4, count, armv7a->debug_base + CPUDBG_DTRTX);
@@ -2396,6 +2488,15 @@ static int cortex_a_read_cpu_memory(struct target *target,
 	if (size == 4 && (address % 4) == 0) {
 		/* We are doing a word-aligned transfer, so use fast mode. */
 		retval = cortex_a_read_cpu_memory_fast(target, count, buffer, &dscr);
+	} else if (size == 4 && count > 2) {
+		/* Unaligned words, split up like in cortex_a_write_cpu_memory() */
+		uint32_t head = 4 - address % 4;
+		retval = cortex_a_read_cpu_memory_slow(target, 1, head, buffer, &dscr);
+		if (retval == ERROR_OK && !(dscr & (DSCR_STICKY_ABORT_PRECISE | DSCR_STICKY_ABORT_IMPRECISE)))
+			retval = cortex_a_read_cpu_memory_fast(target, count - 1, buffer + head, &dscr);
+		if (retval == ERROR_OK && !(dscr & (DSCR_STICKY_ABORT_PRECISE | DSCR_STICKY_ABORT_IMPRECISE)))
+			retval = cortex_a_read_cpu_memory_slow(target, 1, 4 - head,
+					buffer + head + 4 * (count - 1), &dscr);
 	} else {
 		/* Use slow path. Adjust size for aligned accesses */
 		switch (address % 4) {
@@ -90,6 +90,94 @@ static int cortex_m_load_core_reg_u32(struct target *target,
 	return retval;
 }
 
+/* Read all registers that aren't cached yet in one DAP run. For each word
+ * this queues the DCRSR write, a DHCSR read and the DCRDR read; the
+ * transfer normally completes long before the DCRDR read reaches the core,
+ * and the DHCSR reads check S_REGRDY afterwards. Fails if any transfer
+ * wasn't ready, leaving the registers to be read one by one. */
+static int cortex_m_fast_read_all_regs(struct target *target)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct reg_cache *cache = armv7m->arm.core_cache;
+	uint32_t dcrdr;
+	int retval;
+
+	/* two words at most per register */
+	uint32_t *values = calloc(cache->num_regs * 2, sizeof(uint32_t));
+	uint32_t *dhcsr = calloc(cache->num_regs * 2, sizeof(uint32_t));
+	if (!values || !dhcsr) {
+		free(values);
+		free(dhcsr);
+		return ERROR_FAIL;
+	}
+
+	/* because the DCB_DCRDR is used for the emulated dcc channel
+	 * we have to save/restore the DCB_DCRDR when used */
+	if (target->dbg_msg_enabled) {
+		retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &dcrdr);
+		if (retval != ERROR_OK)
+			goto out;
+	}
+
+	unsigned int words = 0;
+	for (unsigned int i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+		/* 8-bit registers come from their container register */
+		if (r->valid || !r->exist || r->size <= 8)
+			continue;
+
+		struct arm_reg *arm_reg = r->arch_info;
+		uint32_t regsel = armv7m_map_id_to_regsel(arm_reg->num);
+		for (unsigned int k = 0; k < r->size / 32; k++) {
+			retval = mem_ap_write_u32(armv7m->debug_ap, DCB_DCRSR, regsel + k);
+			if (retval == ERROR_OK)
+				retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DHCSR, &dhcsr[words]);
+			if (retval == ERROR_OK)
+				retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &values[words]);
+			if (retval != ERROR_OK)
+				goto out;
+			words++;
+		}
+	}
+
+	retval = dap_run(armv7m->debug_ap->dap);
+
+	if (target->dbg_msg_enabled) {
+		/* restore DCB_DCRDR - this needs to be in a separate
+		 * transaction otherwise the emulated DCC channel breaks */
+		int retval2 = mem_ap_write_atomic_u32(armv7m->debug_ap, DCB_DCRDR, dcrdr);
+		if (retval == ERROR_OK)
+			retval = retval2;
+	}
+	if (retval != ERROR_OK)
+		goto out;
+
+	for (unsigned int w = 0; w < words; w++) {
+		if (!(dhcsr[w] & S_REGRDY)) {
+			LOG_DEBUG("register transfer not ready, reading registers one by one");
+			retval = ERROR_FAIL;
+			goto out;
+		}
+	}
+
+	words = 0;
+	for (unsigned int i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+		if (r->valid || !r->exist || r->size <= 8)
+			continue;
+
+		for (unsigned int k = 0; k < r->size / 32; k++)
+			buf_set_u32(r->value + 4 * k, 0, 32, values[words++]);
+		r->valid = true;
+		r->dirty = false;
+	}
+
+out:
+	free(values);
+	free(dhcsr);
+	return retval;
+}
+
 static int cortex_m_store_core_reg_u32(struct target *target,
 		uint32_t regsel, uint32_t value)
 {
@@ -519,6 +607,10 @@ static int cortex_m_debug_entry(struct target *target)
 	 * First load register accessible through core debug port */
 	int num_regs = arm->core_cache->num_regs;
 
+	/* Read what's possible in one go; the loop below reads the 8-bit
+	 * registers and, should that fail, all the others. */
+	cortex_m_fast_read_all_regs(target);
+
 	for (i = 0; i < num_regs; i++) {
 		r = &armv7m->arm.core_cache->reg_list[i];
 		if (!r->valid)
@@ -1622,6 +1714,20 @@ static int cortex_m_read_memory(struct target *target, target_addr_t address,
 	return mem_ap_read_buf(armv7m->debug_ap, buffer, size, count, address);
 }
 
+static int cortex_m_read_memory_batch(struct target *target,
+	struct target_memory_read *reads, unsigned int num_reads)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	for (unsigned int i = 0; i < num_reads; i++) {
+		/* leave what cortex_m_read_memory() would refuse to it */
+		if (armv7m->arm.is_armv6m && reads[i].address % reads[i].size)
+			return ERROR_NOT_IMPLEMENTED;
+	}
+
+	return mem_ap_read_buf_batch(armv7m->debug_ap, reads, num_reads);
+}
+
 static int cortex_m_write_memory(struct target *target, target_addr_t address,
 	uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -1636,6 +1742,20 @@ static int cortex_m_write_memory(struct target *target, target_addr_t address,
 	return mem_ap_write_buf(armv7m->debug_ap, buffer, size, count, address);
 }
 
+static int cortex_m_write_memory_batch(struct target *target,
+	struct target_memory_write *writes, unsigned int num_writes)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	for (unsigned int i = 0; i < num_writes; i++) {
+		/* leave what cortex_m_write_memory() would refuse to it */
+		if (armv7m->arm.is_armv6m && writes[i].address % writes[i].size)
+			return ERROR_NOT_IMPLEMENTED;
+	}
+
+	return mem_ap_write_buf_batch(armv7m->debug_ap, writes, num_writes);
+}
+
 static int cortex_m_init_target(struct command_context *cmd_ctx,
 	struct target *target)
 {
@@ -1693,19 +1813,24 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 	}
 
 	uint32_t sample_count = 0;
+	uint32_t idle_count = 0;
 
 	for (;;) {
+		uint32_t read_count = 1;
+
 		if (armv7m && armv7m->debug_ap) {
-			uint32_t read_count = max_num_samples - sample_count;
+			read_count = max_num_samples - sample_count;
 			if (read_count > 1024)
 				read_count = 1024;
 
 			retval = mem_ap_read_buf_noincr(armv7m->debug_ap,
 						(void *)&samples[sample_count],
 						4, read_count, DWT_PCSR);
-			sample_count += read_count;
+			if (retval == ERROR_OK)
+				target_buffer_get_u32_array(target, (uint8_t *)&samples[sample_count],
+						read_count, &samples[sample_count]);
 		} else {
-			target_read_u32(target, DWT_PCSR, &samples[sample_count++]);
+			retval = target_read_u32(target, DWT_PCSR, &samples[sample_count]);
 		}
 
 		if (retval != ERROR_OK) {
@@ -1713,10 +1838,23 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 			return retval;
 		}
 
+		/* PCSR reads as all ones while the core is sleeping, halted or
+		 * otherwise not executing; those are not PCs, and would stretch
+		 * the histogram over the whole address space. */
+		uint32_t *burst = &samples[sample_count];
+		for (uint32_t i = 0; i < read_count; i++) {
+			if (burst[i] == 0xffffffff)
+				idle_count++;
+			else
+				samples[sample_count++] = burst[i];
+		}
 
 		gettimeofday(&now, NULL);
 		if (sample_count >= max_num_samples || timeval_compare(&now, &timeout) > 0) {
 			LOG_INFO("Profiling completed. %" PRIu32 " samples.", sample_count);
+			if (idle_count)
+				LOG_INFO("%" PRIu32 " more samples were taken while the core was not running.",
+						idle_count);
 			break;
 		}
 	}
@@ -2519,9 +2657,12 @@ struct target_type cortexm_target = {
 	.get_gdb_reg_list = armv7m_get_gdb_reg_list,
 
 	.read_memory = cortex_m_read_memory,
+	.read_memory_batch = cortex_m_read_memory_batch,
+	.write_memory_batch = cortex_m_write_memory_batch,
 	.write_memory = cortex_m_write_memory,
 	.checksum_memory = armv7m_checksum_memory,
 	.blank_check_memory = armv7m_blank_check_memory,
+	.search_memory = armv7m_search_memory,
 
 	.run_algorithm = armv7m_run_algorithm,
 	.start_algorithm = armv7m_start_algorithm,
@@ -335,7 +335,8 @@ static int esirisc_trace_read_memory(struct target *target, target_addr_t addres
 	if (target->state != TARGET_HALTED)
 		return ERROR_TARGET_NOT_HALTED;
 
-	retval = target_read_memory(target, address, 1, size, buffer);
+	/* let target_read_buffer() use word reads, four bytes per JTAG transaction */
+	retval = target_read_buffer(target, address, size, buffer);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("%s: failed to read trace data", target_name(target));
 		return retval;
@@ -32,6 +32,7 @@
 #include "image.h"
 #include "target.h"
 #include <helper/log.h>
+#include <helper/binarybuffer.h>
 
 /* convert ELF header field to host endianness */
 #define field16(elf, field) \
@@ -115,212 +116,353 @@ static int identify_image_type(struct image *image, const char *type_string, con
 	return ERROR_OK;
 }
 
-static int image_ihex_buffer_complete_inner(struct image *image,
-	char *lpszLine,
-	struct imagesection *section)
-{
-	struct image_ihex *ihex = image->type_private;
-	struct fileio *fileio = ihex->fileio;
-	uint32_t full_address;
-	uint32_t cooked_bytes;
-	bool end_rec = false;
+/* one decoded ihex or S19 record */
+struct image_record {
+	unsigned int type;
+	uint32_t address;
+	uint32_t count;			/* number of data bytes */
+	const uint8_t *data;
+	bool data_record;
+	bool end_record;
+	bool checksum_ok;
+	uint8_t bytes[256 + 4];	/* the raw record, as decoded from hex */
+};
 
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
+typedef int (*image_record_parser)(const char *line, size_t len,
+		struct image_record *record);
 
+/**
+ * Get the record text into memory: map the file if possible, so nothing is
+ * copied, otherwise read it into a buffer.
+ */
+static int image_records_load(struct image_records *records, struct fileio *fileio)
+{
+	const uint8_t *data;
 	size_t filesize;
 	int retval;
+
+	records->buffer = NULL;
+	records->sections = NULL;
+	records->cursor_section = -1;
+
 	retval = fileio_size(fileio, &filesize);
 	if (retval != ERROR_OK)
 		return retval;
 
-	ihex->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
-	image->num_sections = 0;
+	if (fileio_map(fileio, &data) == ERROR_OK) {
+		records->text = (const char *)data;
+		records->size = filesize;
+		return ERROR_OK;
+	}
+
+	records->buffer = malloc(filesize ? filesize : 1);
+	if (records->buffer == NULL) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	retval = fileio_read(fileio, filesize, records->buffer, &records->size);
+	if (retval != ERROR_OK)
+		return retval;
+
+	records->text = records->buffer;
+	return ERROR_OK;
+}
+
+static void image_records_free(struct image_records *records)
+{
+	free(records->buffer);
+	records->buffer = NULL;
+	free(records->sections);
+	records->sections = NULL;
+}
 
-	while (!fileio_feof(fileio)) {
-		full_address = 0x0;
-		section[image->num_sections].private = &ihex->buffer[cooked_bytes];
-		section[image->num_sections].base_address = 0x0;
+/**
+ * Find the next record at or after @a pos, skipping comments and blank
+ * lines. On return @a start is the offset of the record and @a pos the
+ * offset of the line following it.
+ */
+static bool image_records_next(const struct image_records *records, size_t *pos,
+		size_t *start, const char **line, size_t *len)
+{
+	while (*pos < records->size) {
+		const char *text = records->text + *pos;
+		const char *eol = memchr(text, '\n', records->size - *pos);
+		size_t n = eol ? (size_t)(eol - text) : records->size - *pos;
+
+		*start = *pos;
+		*pos += eol ? n + 1 : n;
+
+		while (n > 0 && strchr("\n\t\r ", text[n - 1]))
+			n--;
+		if (n == 0 || text[0] == '#')
+			continue;
+
+		*line = text;
+		*len = n;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Move the current section to @a base; if it already holds data, start a new
+ * section whose records begin at @a start instead.
+ */
+static int image_records_rebase(struct image *image, struct imagesection *section,
+		struct image_records_section *extent, uint32_t base, size_t start,
+		const char *format)
+{
+	if (section[image->num_sections].size != 0) {
+		image->num_sections++;
+		if (image->num_sections >= IMAGE_MAX_SECTIONS) {
+			/* too many sections */
+			LOG_ERROR("Too many sections found in %s file", format);
+			return ERROR_IMAGE_FORMAT_ERROR;
+		}
 		section[image->num_sections].size = 0x0;
 		section[image->num_sections].flags = 0;
+		extent[image->num_sections].start = start;
+		extent[image->num_sections].end = start;
+	}
+	section[image->num_sections].base_address = base;
 
-		while (fileio_fgets(fileio, 1023, lpszLine) == ERROR_OK) {
-			uint32_t count;
-			uint32_t address;
-			uint32_t record_type;
-			uint32_t checksum;
-			uint8_t cal_checksum = 0;
-			size_t bytes_read = 0;
+	return ERROR_OK;
+}
 
-			/* skip comments and blank lines */
-			if ((lpszLine[0] == '#') || (strlen(lpszLine + strspn(lpszLine, "\n\t\r ")) == 0))
-				continue;
+/* start an empty section at address zero, e.g. after an end-of-file record */
+static int image_records_restart(struct image *image, struct imagesection *section,
+		struct image_records_section *extent, size_t start, const char *format)
+{
+	if (image->num_sections >= IMAGE_MAX_SECTIONS) {
+		LOG_ERROR("Too many sections found in %s file", format);
+		return ERROR_IMAGE_FORMAT_ERROR;
+	}
+	section[image->num_sections].base_address = 0x0;
+	section[image->num_sections].size = 0x0;
+	section[image->num_sections].flags = 0;
+	extent[image->num_sections].start = start;
+	extent[image->num_sections].end = start;
 
-			if (sscanf(&lpszLine[bytes_read], ":%2" SCNx32 "%4" SCNx32 "%2" SCNx32, &count,
-				&address, &record_type) != 3)
-				return ERROR_IMAGE_FORMAT_ERROR;
-			bytes_read += 9;
-
-			cal_checksum += (uint8_t)count;
-			cal_checksum += (uint8_t)(address >> 8);
-			cal_checksum += (uint8_t)address;
-			cal_checksum += (uint8_t)record_type;
-
-			if (record_type == 0) {	/* Data Record */
-				if ((full_address & 0xffff) != address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff0000) | address;
-					full_address = (full_address & 0xffff0000) | address;
-				}
+	return ERROR_OK;
+}
 
-				while (count-- > 0) {
-					unsigned value;
-					sscanf(&lpszLine[bytes_read], "%2x", &value);
-					ihex->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)ihex->buffer[cooked_bytes];
-					bytes_read += 2;
-					cooked_bytes += 1;
-					section[image->num_sections].size += 1;
-					full_address++;
-				}
-			} else if (record_type == 1) {	/* End of File Record */
-				/* finish the current section */
-				image->num_sections++;
-
-				/* copy section information */
-				image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-				for (unsigned int i = 0; i < image->num_sections; i++) {
-					image->sections[i].private = section[i].private;
-					image->sections[i].base_address = section[i].base_address;
-					image->sections[i].size = section[i].size;
-					image->sections[i].flags = section[i].flags;
-				}
+/* hand the sections found by a scan over to the image */
+static int image_records_finish(struct image *image, struct image_records *records,
+		const struct imagesection *section, const struct image_records_section *extent)
+{
+	image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
+	records->sections = malloc(sizeof(struct image_records_section) * image->num_sections);
+	if (image->sections == NULL || records->sections == NULL) {
+		free(image->sections);
+		image->sections = NULL;
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
 
-				end_rec = true;
-				break;
-			} else if (record_type == 2) {	/* Linear Address Record */
-				uint16_t upper_address;
-
-				sscanf(&lpszLine[bytes_read], "%4hx", &upper_address);
-				cal_checksum += (uint8_t)(upper_address >> 8);
-				cal_checksum += (uint8_t)upper_address;
-				bytes_read += 4;
-
-				if ((full_address >> 4) != upper_address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff) | (upper_address << 4);
-					full_address = (full_address & 0xffff) | (upper_address << 4);
-				}
-			} else if (record_type == 3) {	/* Start Segment Address Record */
-				uint32_t dummy;
-
-				/* "Start Segment Address Record" will not be supported
-				 * but we must consume it, and do not create an error.  */
-				while (count-- > 0) {
-					sscanf(&lpszLine[bytes_read], "%2" SCNx32, &dummy);
-					cal_checksum += (uint8_t)dummy;
-					bytes_read += 2;
-				}
-			} else if (record_type == 4) {	/* Extended Linear Address Record */
-				uint16_t upper_address;
-
-				sscanf(&lpszLine[bytes_read], "%4hx", &upper_address);
-				cal_checksum += (uint8_t)(upper_address >> 8);
-				cal_checksum += (uint8_t)upper_address;
-				bytes_read += 4;
-
-				if ((full_address >> 16) != upper_address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff) | (upper_address << 16);
-					full_address = (full_address & 0xffff) | (upper_address << 16);
-				}
-			} else if (record_type == 5) {	/* Start Linear Address Record */
-				uint32_t start_address;
-
-				sscanf(&lpszLine[bytes_read], "%8" SCNx32, &start_address);
-				cal_checksum += (uint8_t)(start_address >> 24);
-				cal_checksum += (uint8_t)(start_address >> 16);
-				cal_checksum += (uint8_t)(start_address >> 8);
-				cal_checksum += (uint8_t)start_address;
-				bytes_read += 8;
-
-				image->start_address_set = true;
-				image->start_address = be_to_h_u32((uint8_t *)&start_address);
-			} else {
-				LOG_ERROR("unhandled IHEX record type: %i", (int)record_type);
-				return ERROR_IMAGE_FORMAT_ERROR;
-			}
+	for (unsigned int i = 0; i < image->num_sections; i++) {
+		records->sections[i] = extent[i];
+		image->sections[i].private = &records->sections[i];
+		image->sections[i].base_address = section[i].base_address;
+		image->sections[i].size = section[i].size;
+		image->sections[i].flags = section[i].flags;
+	}
+
+	return ERROR_OK;
+}
+
+/**
+ * Decode the data records of one section. The records were validated when
+ * the image was opened, so this only has to convert hex to binary.
+ */
+static int image_records_read_section(struct image *image,
+	struct image_records *records,
+	image_record_parser parse,
+	int section,
+	uint32_t offset,
+	uint32_t size,
+	uint8_t *buffer,
+	size_t *size_read)
+{
+	struct image_records_section *extent = image->sections[section].private;
+	struct image_record record;
+	size_t pos = extent->start;
+	size_t start;
+	uint32_t at = 0;	/* section offset of the next record's data */
+	const char *line;
+	size_t len;
+
+	/* sequential reads continue at the record where the last one stopped */
+	if (records->cursor_section == section && records->cursor_offset <= offset) {
+		pos = records->cursor_pos;
+		at = records->cursor_offset;
+	}
+
+	*size_read = 0;
+	while (*size_read < size) {
+		if (pos >= extent->end || !image_records_next(records, &pos, &start, &line, &len))
+			return ERROR_IMAGE_FORMAT_ERROR;
+		if (parse(line, len, &record) != ERROR_OK)
+			return ERROR_IMAGE_FORMAT_ERROR;
+		if (!record.data_record)
+			continue;
+
+		if (at + record.count > offset) {
+			uint32_t skip = offset - at;
+			uint32_t count = MIN(record.count - skip, size - *size_read);
+
+			memcpy(buffer + *size_read, record.data + skip, count);
+			*size_read += count;
+			offset += count;
+
+			records->cursor_section = section;
+			records->cursor_pos = start;
+			records->cursor_offset = at;
+		}
+		at += record.count;
+	}
+
+	return ERROR_OK;
+}
+
+static int image_ihex_parse_record(const char *line, size_t len,
+		struct image_record *record)
+{
+	size_t count;
+	uint8_t sum = 0;
+
+	/* ":" count(1) address(2) type(1) data(count) checksum(1) */
+	if (len < 11 || line[0] != ':' || unhexify(record->bytes, line + 1, 1) != 1)
+		return ERROR_IMAGE_FORMAT_ERROR;
+
+	count = record->bytes[0] + 5;
+	if (len < 1 + 2 * count || unhexify(record->bytes, line + 1, count) != count)
+		return ERROR_IMAGE_FORMAT_ERROR;
+
+	for (size_t i = 0; i < count; i++)
+		sum += record->bytes[i];
+
+	record->count = record->bytes[0];
+	record->address = be_to_h_u16(&record->bytes[1]);
+	record->type = record->bytes[3];
+	record->data = &record->bytes[4];
+	record->data_record = record->type == 0;
+	record->end_record = record->type == 1;
+	record->checksum_ok = sum == 0;
+
+	return ERROR_OK;
+}
 
-			sscanf(&lpszLine[bytes_read], "%2" SCNx32, &checksum);
+/**
+ * Validate the whole file and work out the section layout. Data isn't kept;
+ * image_records_read_section() decodes it again when a section is read.
+ */
+static int image_ihex_scan(struct image *image, struct imagesection *section,
+		struct image_records_section *extent)
+{
+	struct image_ihex *ihex = image->type_private;
+	struct image_records *records = &ihex->records;
+	struct image_record record;
+	uint32_t full_address = 0x0;
+	bool end_rec = false;
+	size_t pos = 0, start;
+	const char *line;
+	size_t len;
+	int retval;
 
-			if ((uint8_t)checksum != (uint8_t)(~cal_checksum + 1)) {
-				/* checksum failed */
-				LOG_ERROR("incorrect record checksum found in IHEX file");
-				return ERROR_IMAGE_CHECKSUM;
+	/* we can't determine the number of sections that we'll have to create ahead of time,
+	 * so we locally hold them until parsing is finished */
+	image->num_sections = 0;
+	image_records_restart(image, section, extent, 0, "IHEX");
+
+	while (image_records_next(records, &pos, &start, &line, &len)) {
+		if (image_ihex_parse_record(line, len, &record) != ERROR_OK)
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		if (end_rec) {
+			end_rec = false;
+			LOG_WARNING("continuing after end-of-file record: %.*s",
+					(int)MIN(len, 40), line);
+			full_address = 0x0;
+			retval = image_records_restart(image, section, extent, start, "IHEX");
+			if (retval != ERROR_OK)
+				return retval;
+		}
+
+		if (record.end_record) {	/* End of File Record */
+			/* finish the current section */
+			image->num_sections++;
+			end_rec = true;
+			continue;
+		}
+
+		if (!record.checksum_ok) {
+			/* checksum failed */
+			LOG_ERROR("incorrect record checksum found in IHEX file");
+			return ERROR_IMAGE_CHECKSUM;
+		}
+
+		if (record.type == 0) {	/* Data Record */
+			if ((full_address & 0xffff) != record.address) {
+				/* we encountered a nonconsecutive location, create a new section,
+				 * unless the current section has zero size, in which case this specifies
+				 * the current section's base address
+				 */
+				full_address = (full_address & 0xffff0000) | record.address;
+				retval = image_records_rebase(image, section, extent,
+						full_address, start, "IHEX");
+				if (retval != ERROR_OK)
+					return retval;
 			}
 
-			if (end_rec) {
-				end_rec = false;
-				LOG_WARNING("continuing after end-of-file record: %.40s", lpszLine);
+			section[image->num_sections].size += record.count;
+			extent[image->num_sections].end = pos;
+			full_address += record.count;
+		} else if (record.type == 2 || record.type == 4) {
+			/* Linear Address Record, Extended Linear Address Record */
+			unsigned int shift = (record.type == 2) ? 4 : 16;
+			uint32_t upper_address;
+
+			if (record.count < 2)
+				return ERROR_IMAGE_FORMAT_ERROR;
+			upper_address = be_to_h_u16(record.data);
+
+			if ((full_address >> shift) != upper_address) {
+				/* we encountered a nonconsecutive location, create a new section,
+				 * unless the current section has zero size, in which case this specifies
+				 * the current section's base address
+				 */
+				full_address = (full_address & 0xffff) | (upper_address << shift);
+				retval = image_records_rebase(image, section, extent,
+						full_address, start, "IHEX");
+				if (retval != ERROR_OK)
+					return retval;
 			}
+		} else if (record.type == 3) {	/* Start Segment Address Record */
+			/* "Start Segment Address Record" will not be supported
+			 * but we must consume it, and do not create an error.  */
+		} else if (record.type == 5) {	/* Start Linear Address Record */
+			uint32_t start_address;
+
+			if (record.count < 4)
+				return ERROR_IMAGE_FORMAT_ERROR;
+			start_address = be_to_h_u32(record.data);
+
+			image->start_address_set = true;
+			image->start_address = be_to_h_u32((uint8_t *)&start_address);
+		} else {
+			LOG_ERROR("unhandled IHEX record type: %i", (int)record.type);
+			return ERROR_IMAGE_FORMAT_ERROR;
 		}
 	}
 
-	if (end_rec)
-		return ERROR_OK;
-	else {
+	if (!end_rec) {
 		LOG_ERROR("premature end of IHEX file, no matching end-of-file record found");
 		return ERROR_IMAGE_FORMAT_ERROR;
 	}
+
+	return image_records_finish(image, records, section, extent);
 }
 
 /**
@@ -329,23 +471,27 @@ static int image_ihex_buffer_complete_inner(struct image *image,
  */
 static int image_ihex_buffer_complete(struct image *image)
 {
-	char *lpszLine = malloc(1023);
-	if (lpszLine == NULL) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
+	struct image_ihex *ihex = image->type_private;
 	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (section == NULL) {
-		free(lpszLine);
+	struct image_records_section *extent =
+		malloc(sizeof(struct image_records_section) * IMAGE_MAX_SECTIONS);
+	int retval;
+
+	if (section == NULL || extent == NULL) {
+		free(section);
+		free(extent);
 		LOG_ERROR("Out of memory");
 		return ERROR_FAIL;
 	}
-	int retval;
 
-	retval = image_ihex_buffer_complete_inner(image, lpszLine, section);
+	retval = image_records_load(&ihex->records, ihex->fileio);
+	if (retval == ERROR_OK)
+		retval = image_ihex_scan(image, section, extent);
+	if (retval != ERROR_OK)
+		image_records_free(&ihex->records);
 
+	free(extent);
 	free(section);
-	free(lpszLine);
 
 	return retval;
 }
@@ -498,6 +644,13 @@ static int image_elf_read_section(struct image *image,
 		read_size = MIN(size, field32(elf, segment->p_filesz) - offset);
 		LOG_DEBUG("read elf: size = 0x%zx at 0x%" PRIx32 "", read_size,
 			field32(elf, segment->p_offset) + offset);
+		/* copy straight out of the mapped file when it holds the whole area */
+		size_t file_offset = (size_t)field32(elf, segment->p_offset) + offset;
+		if (elf->data && file_offset <= elf->size && read_size <= elf->size - file_offset) {
+			memcpy(buffer, elf->data + file_offset, read_size);
+			*size_read += read_size;
+			return ERROR_OK;
+		}
 		/* read initialized area of the segment */
 		retval = fileio_seek(elf->fileio, field32(elf, segment->p_offset) + offset);
 		if (retval != ERROR_OK) {
@@ -519,180 +672,126 @@ static int image_elf_read_section(struct image *image,
 	return ERROR_OK;
 }
 
-static int image_mot_buffer_complete_inner(struct image *image,
-	char *lpszLine,
-	struct imagesection *section)
+static int image_mot_parse_record(const char *line, size_t len,
+		struct image_record *record)
 {
-	struct image_mot *mot = image->type_private;
-	struct fileio *fileio = mot->fileio;
-	uint32_t full_address;
-	uint32_t cooked_bytes;
-	bool end_rec = false;
-
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
-
-	int retval;
-	size_t filesize;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
-
-	mot->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
-	image->num_sections = 0;
-
-	while (!fileio_feof(fileio)) {
-		full_address = 0x0;
-		section[image->num_sections].private = &mot->buffer[cooked_bytes];
-		section[image->num_sections].base_address = 0x0;
-		section[image->num_sections].size = 0x0;
-		section[image->num_sections].flags = 0;
-
-		while (fileio_fgets(fileio, 1023, lpszLine) == ERROR_OK) {
-			uint32_t count;
-			uint32_t address;
-			uint32_t record_type;
-			uint32_t checksum;
-			uint8_t cal_checksum = 0;
-			uint32_t bytes_read = 0;
-
-			/* skip comments and blank lines */
-			if ((lpszLine[0] == '#') || (strlen(lpszLine + strspn(lpszLine, "\n\t\r ")) == 0))
-				continue;
-
-			/* get record type and record length */
-			if (sscanf(&lpszLine[bytes_read], "S%1" SCNx32 "%2" SCNx32, &record_type,
-				&count) != 2)
-				return ERROR_IMAGE_FORMAT_ERROR;
+	/* address bytes of S0 .. S9, S4 doesn't exist */
+	static const uint8_t address_bytes[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+	size_t count;
+	unsigned int address_len;
+	uint8_t sum = 0;
+
+	/* "S" type count(1) address(2..4) data checksum(1), count covers
+	 * everything after itself */
+	if (len < 6 || line[0] != 'S' || !isxdigit((unsigned char)line[1])
+			|| unhexify(record->bytes, line + 2, 1) != 1)
+		return ERROR_IMAGE_FORMAT_ERROR;
 
-			bytes_read += 4;
-			cal_checksum += (uint8_t)count;
+	count = record->bytes[0] + 1;
+	if (len < 2 + 2 * count || unhexify(record->bytes, line + 2, count) != count)
+		return ERROR_IMAGE_FORMAT_ERROR;
 
-			/* skip checksum byte */
-			count -= 1;
+	record->type = isdigit((unsigned char)line[1]) ? line[1] - '0' : 10;
+	address_len = (record->type < 10) ? address_bytes[record->type] : 0;
+	if (record->bytes[0] < address_len + 1)
+		return ERROR_IMAGE_FORMAT_ERROR;
 
-			if (record_type == 0) {
-				/* S0 - starting record (optional) */
-				int iValue;
+	for (size_t i = 0; i < count; i++)
+		sum += record->bytes[i];
 
-				while (count-- > 0) {
-					sscanf(&lpszLine[bytes_read], "%2x", &iValue);
-					cal_checksum += (uint8_t)iValue;
-					bytes_read += 2;
-				}
-			} else if (record_type >= 1 && record_type <= 3) {
-				switch (record_type) {
-					case 1:
-						/* S1 - 16 bit address data record */
-						sscanf(&lpszLine[bytes_read], "%4" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 4;
-						count -= 2;
-						break;
-
-					case 2:
-						/* S2 - 24 bit address data record */
-						sscanf(&lpszLine[bytes_read], "%6" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 16);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 6;
-						count -= 3;
-						break;
-
-					case 3:
-						/* S3 - 32 bit address data record */
-						sscanf(&lpszLine[bytes_read], "%8" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 24);
-						cal_checksum += (uint8_t)(address >> 16);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 8;
-						count -= 4;
-						break;
+	record->address = 0;
+	for (unsigned int i = 0; i < address_len; i++)
+		record->address = (record->address << 8) | record->bytes[1 + i];
+	record->count = record->bytes[0] - address_len - 1;
+	record->data = &record->bytes[1 + address_len];
+	record->data_record = record->type >= 1 && record->type <= 3;
+	record->end_record = record->type >= 7 && record->type <= 9;
+	record->checksum_ok = sum == 0xFF;
 
-				}
+	return ERROR_OK;
+}
 
-				if (full_address != address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&mot->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address = address;
-					full_address = address;
-				}
+/**
+ * Validate the whole file and work out the section layout. Data isn't kept;
+ * image_records_read_section() decodes it again when a section is read.
+ */
+static int image_mot_scan(struct image *image, struct imagesection *section,
+		struct image_records_section *extent)
+{
+	struct image_mot *mot = image->type_private;
+	struct image_records *records = &mot->records;
+	struct image_record record;
+	uint32_t full_address = 0x0;
+	bool end_rec = false;
+	size_t pos = 0, start;
+	const char *line;
+	size_t len;
+	int retval;
 
-				while (count-- > 0) {
-					unsigned value;
-					sscanf(&lpszLine[bytes_read], "%2x", &value);
-					mot->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)mot->buffer[cooked_bytes];
-					bytes_read += 2;
-					cooked_bytes += 1;
-					section[image->num_sections].size += 1;
-					full_address++;
-				}
-			} else if (record_type == 5 || record_type == 6) {
-				/* S5 and S6 are the data count records, we ignore them */
-				uint32_t dummy;
-
-				while (count-- > 0) {
-					sscanf(&lpszLine[bytes_read], "%2" SCNx32, &dummy);
-					cal_checksum += (uint8_t)dummy;
-					bytes_read += 2;
-				}
-			} else if (record_type >= 7 && record_type <= 9) {
-				/* S7, S8, S9 - ending records for 32, 24 and 16bit */
-				image->num_sections++;
-
-				/* copy section information */
-				image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-				for (unsigned int i = 0; i < image->num_sections; i++) {
-					image->sections[i].private = section[i].private;
-					image->sections[i].base_address = section[i].base_address;
-					image->sections[i].size = section[i].size;
-					image->sections[i].flags = section[i].flags;
-				}
+	/* we can't determine the number of sections that we'll have to create ahead of time,
+	 * so we locally hold them until parsing is finished */
+	image->num_sections = 0;
+	image_records_restart(image, section, extent, 0, "S19");
+
+	while (image_records_next(records, &pos, &start, &line, &len)) {
+		if (image_mot_parse_record(line, len, &record) != ERROR_OK)
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		if (end_rec) {
+			end_rec = false;
+			LOG_WARNING("continuing after end-of-file record: %.*s",
+					(int)MIN(len, 40), line);
+			full_address = 0x0;
+			retval = image_records_restart(image, section, extent, start, "S19");
+			if (retval != ERROR_OK)
+				return retval;
+		}
 
-				end_rec = true;
-				break;
-			} else {
-				LOG_ERROR("unhandled S19 record type: %i", (int)(record_type));
-				return ERROR_IMAGE_FORMAT_ERROR;
-			}
+		if (record.end_record) {
+			/* S7, S8, S9 - ending records for 32, 24 and 16bit */
+			image->num_sections++;
+			end_rec = true;
+			continue;
+		}
 
-			/* account for checksum, will always be 0xFF */
-			sscanf(&lpszLine[bytes_read], "%2" SCNx32, &checksum);
-			cal_checksum += (uint8_t)checksum;
+		if (!record.checksum_ok) {
+			/* checksum failed */
+			LOG_ERROR("incorrect record checksum found in S19 file");
+			return ERROR_IMAGE_CHECKSUM;
+		}
 
-			if (cal_checksum != 0xFF) {
-				/* checksum failed */
-				LOG_ERROR("incorrect record checksum found in S19 file");
-				return ERROR_IMAGE_CHECKSUM;
+		if (record.data_record) {
+			/* S1, S2, S3 - 16, 24 and 32 bit address data records */
+			if (full_address != record.address) {
+				/* we encountered a nonconsecutive location, create a new section,
+				 * unless the current section has zero size, in which case this specifies
+				 * the current section's base address
+				 */
+				full_address = record.address;
+				retval = image_records_rebase(image, section, extent,
+						full_address, start, "S19");
+				if (retval != ERROR_OK)
+					return retval;
 			}
 
-			if (end_rec) {
-				end_rec = false;
-				LOG_WARNING("continuing after end-of-file record: %.40s", lpszLine);
-			}
+			section[image->num_sections].size += record.count;
+			extent[image->num_sections].end = pos;
+			full_address += record.count;
+		} else if (record.type == 0 || record.type == 5 || record.type == 6) {
+			/* S0 is the optional starting record, S5 and S6 are the data
+			 * count records, we ignore them */
+		} else {
+			LOG_ERROR("unhandled S19 record type: %i", (int)(record.type));
+			return ERROR_IMAGE_FORMAT_ERROR;
 		}
 	}
 
-	if (end_rec)
-		return ERROR_OK;
-	else {
+	if (!end_rec) {
 		LOG_ERROR("premature end of S19 file, no matching end-of-file record found");
 		return ERROR_IMAGE_FORMAT_ERROR;
 	}
+
+	return image_records_finish(image, records, section, extent);
 }
 
 /**
@@ -701,23 +800,27 @@ static int image_mot_buffer_complete_inner(struct image *image,
  */
 static int image_mot_buffer_complete(struct image *image)
 {
-	char *lpszLine = malloc(1023);
-	if (lpszLine == NULL) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
+	struct image_mot *mot = image->type_private;
 	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (section == NULL) {
-		free(lpszLine);
+	struct image_records_section *extent =
+		malloc(sizeof(struct image_records_section) * IMAGE_MAX_SECTIONS);
+	int retval;
+
+	if (section == NULL || extent == NULL) {
+		free(section);
+		free(extent);
 		LOG_ERROR("Out of memory");
 		return ERROR_FAIL;
 	}
-	int retval;
 
-	retval = image_mot_buffer_complete_inner(image, lpszLine, section);
+	retval = image_records_load(&mot->records, mot->fileio);
+	if (retval == ERROR_OK)
+		retval = image_mot_scan(image, section, extent);
+	if (retval != ERROR_OK)
+		image_records_free(&mot->records);
 
+	free(extent);
 	free(section);
-	free(lpszLine);
 
 	return retval;
 }
@@ -750,6 +853,9 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		image->sections[0].base_address = 0x0;
 		image->sections[0].size = filesize;
 		image->sections[0].flags = 0;
+
+		if (fileio_map(image_binary->fileio, &image_binary->data) != ERROR_OK)
+			image_binary->data = NULL;
 	} else if (image->type == IMAGE_IHEX) {
 		struct image_ihex *image_ihex;
 
@@ -780,6 +886,10 @@ int image_open(struct image *image, const char *url, const char *type_string)
 			fileio_close(image_elf->fileio);
 			return retval;
 		}
+
+		if (fileio_size(image_elf->fileio, &image_elf->size) != ERROR_OK
+				|| fileio_map(image_elf->fileio, &image_elf->data) != ERROR_OK)
+			image_elf->data = NULL;
 	} else if (image->type == IMAGE_MEMORY) {
 		struct target *target = get_target(url);
 
@@ -864,6 +974,12 @@ int image_read_section(struct image *image,
 		if (section != 0)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 
+		if (image_binary->data) {
+			memcpy(buffer, image_binary->data + offset, size);
+			*size_read = size;
+			return ERROR_OK;
+		}
+
 		/* seek to offset */
 		retval = fileio_seek(image_binary->fileio, offset);
 		if (retval != ERROR_OK)
@@ -874,10 +990,10 @@ int image_read_section(struct image *image,
 		if (retval != ERROR_OK)
 			return retval;
 	} else if (image->type == IMAGE_IHEX) {
-		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
-		*size_read = size;
+		struct image_ihex *image_ihex = image->type_private;
 
-		return ERROR_OK;
+		return image_records_read_section(image, &image_ihex->records,
+				image_ihex_parse_record, section, offset, size, buffer, size_read);
 	} else if (image->type == IMAGE_ELF)
 		return image_elf_read_section(image, section, offset, size, buffer, size_read);
 	else if (image->type == IMAGE_MEMORY) {
@@ -919,10 +1035,10 @@ int image_read_section(struct image *image,
 			address += (size_in_cache > size) ? size : size_in_cache;
 		}
 	} else if (image->type == IMAGE_SRECORD) {
-		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
-		*size_read = size;
+		struct image_mot *image_mot = image->type_private;
 
-		return ERROR_OK;
+		return image_records_read_section(image, &image_mot->records,
+				image_mot_parse_record, section, offset, size, buffer, size_read);
 	} else if (image->type == IMAGE_BUILDER) {
 		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
 		*size_read = size;
@@ -979,10 +1095,8 @@ void image_close(struct image *image)
 	} else if (image->type == IMAGE_IHEX) {
 		struct image_ihex *image_ihex = image->type_private;
 
+		image_records_free(&image_ihex->records);
 		fileio_close(image_ihex->fileio);
-
-		free(image_ihex->buffer);
-		image_ihex->buffer = NULL;
 	} else if (image->type == IMAGE_ELF) {
 		struct image_elf *image_elf = image->type_private;
 
@@ -1001,10 +1115,8 @@ void image_close(struct image *image)
 	} else if (image->type == IMAGE_SRECORD) {
 		struct image_mot *image_mot = image->type_private;
 
+		image_records_free(&image_mot->records);
 		fileio_close(image_mot->fileio);
-
-		free(image_mot->buffer);
-		image_mot->buffer = NULL;
 	} else if (image->type == IMAGE_BUILDER) {
 		for (unsigned int i = 0; i < image->num_sections; i++) {
 			free(image->sections[i].private);
@@ -1019,35 +1131,58 @@ void image_close(struct image *image)
 	image->sections = NULL;
 }
 
+/* slice-by-8 tables for the (non-reflected) CRC-32 gdb uses: crc32_table[0] is
+ * the classic byte table, crc32_table[k] advances a byte through k more zero
+ * bytes, so eight input bytes cost eight independent lookups */
+static uint32_t crc32_table[8][256];
+
+static void image_init_crc32_table(void)
+{
+	static bool first_init;
+	if (first_init)
+		return;
+
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t c = i << 24;
+		/* as per gdb */
+		for (unsigned int j = 8; j > 0; --j)
+			c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
+		crc32_table[0][i] = c;
+	}
+	for (unsigned int k = 1; k < 8; k++)
+		for (unsigned int i = 0; i < 256; i++)
+			crc32_table[k][i] = (crc32_table[k - 1][i] << 8) ^
+				crc32_table[0][crc32_table[k - 1][i] >> 24];
+
+	first_init = true;
+}
+
 int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
 {
 	uint32_t crc = 0xffffffff;
 	LOG_DEBUG("Calculating checksum");
 
-	static uint32_t crc32_table[256];
-
-	static bool first_init;
-	if (!first_init) {
-		/* Initialize the CRC table and the decoding table.  */
-		unsigned int i, j, c;
-		for (i = 0; i < 256; i++) {
-			/* as per gdb */
-			for (c = i << 24, j = 8; j > 0; --j)
-				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
-			crc32_table[i] = c;
-		}
-
-		first_init = true;
-	}
+	image_init_crc32_table();
 
 	while (nbytes > 0) {
-		int run = nbytes;
+		uint32_t run = nbytes;
 		if (run > 32768)
 			run = 32768;
 		nbytes -= run;
+		for (; run >= 8; run -= 8, buffer += 8) {
+			crc ^= be_to_h_u32(buffer);
+			crc = crc32_table[7][crc >> 24] ^
+				crc32_table[6][(crc >> 16) & 255] ^
+				crc32_table[5][(crc >> 8) & 255] ^
+				crc32_table[4][crc & 255] ^
+				crc32_table[3][buffer[4]] ^
+				crc32_table[2][buffer[5]] ^
+				crc32_table[1][buffer[6]] ^
+				crc32_table[0][buffer[7]];
+		}
 		while (run--) {
 			/* as per gdb */
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buffer++) & 255];
+			crc = (crc << 8) ^ crc32_table[0][((crc >> 24) ^ *buffer++) & 255];
 		}
 		keep_alive();
 	}
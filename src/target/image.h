@@ -66,11 +66,30 @@ struct image {
 
 struct image_binary {
 	struct fileio *fileio;
+	const uint8_t *data;	/* mapped file contents, NULL if the file isn't mapped */
+};
+
+/* part of the record text that holds one ihex/S19 section */
+struct image_records_section {
+	size_t start;	/* offset of the first record belonging to the section */
+	size_t end;		/* offset just past its last data record */
+};
+
+/* ihex and S19 images keep the record text and decode it as sections are read */
+struct image_records {
+	const char *text;	/* mapped or buffered file contents */
+	size_t size;
+	char *buffer;		/* file contents, if they couldn't be mapped */
+	struct image_records_section *sections;
+	/* where the last read left off, so sequential reads don't rescan */
+	int cursor_section;
+	size_t cursor_pos;
+	uint32_t cursor_offset;
 };
 
 struct image_ihex {
 	struct fileio *fileio;
-	uint8_t *buffer;
+	struct image_records records;
 };
 
 struct image_memory {
@@ -85,11 +104,13 @@ struct image_elf {
 	Elf32_Phdr *segments;
 	uint32_t segment_count;
 	uint8_t endianness;
+	const uint8_t *data;	/* mapped file contents, NULL if the file isn't mapped */
+	size_t size;
 };
 
 struct image_mot {
 	struct fileio *fileio;
-	uint8_t *buffer;
+	struct image_records records;
 };
 
 int image_open(struct image *image, const char *url, const char *type_string);
@@ -830,13 +830,14 @@ int mips32_checksum_memory(struct target *target, target_addr_t address,
 	return retval;
 }
 
-/** Checks whether a memory region is erased. */
+/** Checks an array of memory regions whether they are erased. */
 int mips32_blank_check_memory(struct target *target,
 		struct target_memory_check_block *blocks, int num_blocks,
 		uint8_t erased_value)
 {
 	struct working_area *erase_check_algorithm;
-	struct reg_param reg_params[3];
+	struct working_area *erase_check_params;
+	struct reg_param reg_params[1];
 	struct mips32_algorithm mips32_info;
 
 	struct mips32_common *mips32 = target_to_mips32(target);
@@ -849,15 +850,32 @@ int mips32_blank_check_memory(struct target *target,
 	}
 	uint32_t isa = ejtag_info->isa ? 1 : 0;
 	uint32_t erase_check_code[] = {
+		/* $a0 points to { address, size, result } blocks, ended by size 0 */
+						/* block: */
+		MIPS32_LW(isa, 9, 4, 4),			/* lw		$t1, 4($a0) */
+		MIPS32_BEQ(isa, 9, 0, 10 << isa),		/* beq		$t1, $zero, done */
+		MIPS32_LW(isa, 8, 0, 4),			/* lw		$t0, 0($a0) */
+		MIPS32_ORI(isa, 6, 0, 0xff),			/* ori		$a2, $zero, 0xff */
 						/* nbyte: */
-		MIPS32_LB(isa, 8, 0, 4),			/* lb		$t0, ($a0) */
-		MIPS32_AND(isa, 6, 6, 8),			/* and		$a2, $a2, $t0 */
-		MIPS32_ADDIU(isa, 5, 5, NEG16(1)),		/* addiu	$a1, $a1, -1 */
-		MIPS32_BNE(isa, 5, 0, NEG16(4 << isa)),		/* bne		$a1, $zero, nbyte */
-		MIPS32_ADDIU(isa, 4, 4, 1),			/* addiu	$a0, $a0, 1 */
+		MIPS32_LB(isa, 10, 0, 8),			/* lb		$t2, ($t0) */
+		MIPS32_AND(isa, 6, 6, 10),			/* and		$a2, $a2, $t2 */
+		MIPS32_ADDIU(isa, 9, 9, NEG16(1)),		/* addiu	$t1, $t1, -1 */
+		MIPS32_BNE(isa, 9, 0, NEG16(4 << isa)),		/* bne		$t1, $zero, nbyte */
+		MIPS32_ADDIU(isa, 8, 8, 1),			/* addiu	$t0, $t0, 1 */
+		MIPS32_SW(isa, 6, 8, 4),			/* sw		$a2, 8($a0) */
+		MIPS32_B(isa, NEG16(11 << isa)),		/* b		block */
+		MIPS32_ADDIU(isa, 4, 4, 12),			/* addiu	$a0, $a0, 12 */
+						/* done: */
 		MIPS32_SDBBP(isa)				/* sdbbp */
 	};
 
+	/* prepare blocks array for algo */
+	struct algo_block {
+		uint32_t address;
+		uint32_t size;
+		uint32_t result;
+	};
+
 	/* make sure we have a working area */
 	if (target_alloc_working_area(target, sizeof(erase_check_code), &erase_check_algorithm) != ERROR_OK)
 		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
@@ -872,37 +890,90 @@ int mips32_blank_check_memory(struct target *target,
 	int retval = target_write_buffer(target, erase_check_algorithm->address,
 						sizeof(erase_check_code), erase_check_code_8);
 	if (retval != ERROR_OK)
-		goto cleanup;
+		goto cleanup1;
+
+	uint32_t avail = target_get_working_area_avail(target);
+	int blocks_to_check = avail / sizeof(struct algo_block) - 1;
+	if (num_blocks < blocks_to_check)
+		blocks_to_check = num_blocks;
+	if (blocks_to_check < 1) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto cleanup1;
+	}
+
+	uint32_t param_size = (blocks_to_check + 1) * sizeof(struct algo_block);
+	struct algo_block *params = calloc(blocks_to_check + 1, sizeof(struct algo_block));
+	if (params == NULL) {
+		retval = ERROR_FAIL;
+		goto cleanup1;
+	}
+
+	int i;
+	uint32_t total_size = 0;
+	for (i = 0; i < blocks_to_check; i++) {
+		/* a zero size would end the list early */
+		if (blocks[i].size == 0)
+			break;
+		total_size += blocks[i].size;
+		target_buffer_set_u32(target, (uint8_t *)&params[i].address, blocks[i].address);
+		target_buffer_set_u32(target, (uint8_t *)&params[i].size, blocks[i].size);
+		target_buffer_set_u32(target, (uint8_t *)&params[i].result, UINT32_MAX);
+	}
+	blocks_to_check = i;
+	if (blocks_to_check == 0) {
+		blocks[0].result = 1;
+		retval = 1;
+		goto cleanup2;
+	}
+
+	if (target_alloc_working_area(target, param_size, &erase_check_params) != ERROR_OK) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto cleanup2;
+	}
+
+	retval = target_write_buffer(target, erase_check_params->address,
+			param_size, (uint8_t *)params);
+	if (retval != ERROR_OK)
+		goto cleanup3;
 
 	mips32_info.common_magic = MIPS32_COMMON_MAGIC;
 	mips32_info.isa_mode = isa ? MIPS32_ISA_MMIPS32 : MIPS32_ISA_MIPS32;
 
 	init_reg_param(&reg_params[0], "r4", 32, PARAM_OUT);
-	buf_set_u32(reg_params[0].value, 0, 32, blocks[0].address);
+	buf_set_u32(reg_params[0].value, 0, 32, erase_check_params->address);
 
-	init_reg_param(&reg_params[1], "r5", 32, PARAM_OUT);
-	buf_set_u32(reg_params[1].value, 0, 32, blocks[0].size);
-
-	init_reg_param(&reg_params[2], "r6", 32, PARAM_IN_OUT);
-	buf_set_u32(reg_params[2].value, 0, 32, erased_value);
+	/* assume CPU clk at least 1 MHz */
+	int timeout = 10000 + total_size * 3 / 1000;
 
-	retval = target_run_algorithm(target, 0, NULL, 3, reg_params, erase_check_algorithm->address,
-			erase_check_algorithm->address + (sizeof(erase_check_code) - 4), 10000, &mips32_info);
+	retval = target_run_algorithm(target, 0, NULL, 1, reg_params, erase_check_algorithm->address,
+			erase_check_algorithm->address + (sizeof(erase_check_code) - 4), timeout, &mips32_info);
+	destroy_reg_param(&reg_params[0]);
+	if (retval != ERROR_OK && retval != ERROR_TARGET_TIMEOUT)
+		goto cleanup3;
 
-	if (retval == ERROR_OK)
-		blocks[0].result = buf_get_u32(reg_params[2].value, 0, 32);
+	/* after a timeout, use what was checked before it */
+	int algo_retval = retval;
+	retval = target_read_buffer(target, erase_check_params->address,
+			param_size, (uint8_t *)params);
+	if (retval != ERROR_OK)
+		goto cleanup3;
 
-	destroy_reg_param(&reg_params[0]);
-	destroy_reg_param(&reg_params[1]);
-	destroy_reg_param(&reg_params[2]);
+	for (i = 0; i < blocks_to_check; i++) {
+		uint32_t result = target_buffer_get_u32(target, (uint8_t *)&params[i].result);
+		if (result == UINT32_MAX)
+			break;
+		blocks[i].result = result == erased_value;
+	}
+	retval = i ? i : algo_retval;	/* number of blocks really checked */
 
-cleanup:
+cleanup3:
+	target_free_working_area(target, erase_check_params);
+cleanup2:
+	free(params);
+cleanup1:
 	target_free_working_area(target, erase_check_algorithm);
 
-	if (retval != ERROR_OK)
-		return retval;
-
-	return 1;       /* only one block has been checked */
+	return retval;
 }
 
 static int mips32_verify_pointer(struct command_invocation *cmd,
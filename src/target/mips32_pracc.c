@@ -482,7 +482,7 @@ int mips32_pracc_read_mem(struct mips_ejtag *ejtag_info, uint32_t addr, int size
 
 	uint32_t *data = NULL;
 	if (size != 4) {
-		data = malloc(256 * sizeof(uint32_t));
+		data = malloc(PRACC_READ_BATCH * sizeof(uint32_t));
 		if (data == NULL) {
 			LOG_ERROR("Out of memory");
 			goto exit;
@@ -497,7 +497,7 @@ int mips32_pracc_read_mem(struct mips_ejtag *ejtag_info, uint32_t addr, int size
 		ctx.code_count = 0;
 		ctx.store_count = 0;
 
-		int this_round_count = (count > 256) ? 256 : count;
+		int this_round_count = MIN(count, PRACC_READ_BATCH);
 		uint32_t last_upper_base_addr = UPPER16((addr + 0x8000));
 
 		pracc_add(&ctx, 0, MIPS32_LUI(ctx.isa, 15, PRACC_UPPER_BASE_ADDR)); /* $15 = MIPS32_PRACC_BASE_ADDR */
@@ -732,7 +732,7 @@ static int mips32_pracc_write_mem_generic(struct mips_ejtag *ejtag_info,
 		ctx.code_count = 0;
 		ctx.store_count = 0;
 
-		int this_round_count = (count > 128) ? 128 : count;
+		int this_round_count = MIN(count, PRACC_WRITE_BATCH);
 		uint32_t last_upper_base_addr = UPPER16((addr + 0x8000));
 			      /* load $15 with memory base address */
 		pracc_add(&ctx, 0, MIPS32_LUI(ctx.isa, 15, last_upper_base_addr));
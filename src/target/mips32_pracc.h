@@ -47,6 +47,12 @@
 
 #define PRACC_BLOCK	128	/* 1 Kbyte */
 
+/* Words moved per queue by mips32_pracc_read_mem() (two instructions each)
+ * and mips32_pracc_write_mem() (up to three), leaving room for the setup
+ * code within PRACC_MAX_INSTRUCTIONS. */
+#define PRACC_READ_BATCH	896
+#define PRACC_WRITE_BATCH	512
+
 typedef struct {
 	uint32_t instr;
 	uint32_t addr;
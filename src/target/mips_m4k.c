@@ -47,6 +47,8 @@ static int mips_m4k_internal_restore(struct target *target, int current,
 static int mips_m4k_halt(struct target *target);
 static int mips_m4k_bulk_write_memory(struct target *target, target_addr_t address,
 		uint32_t count, const uint8_t *buffer);
+static int mips_m4k_bulk_read_memory(struct target *target, target_addr_t address,
+		uint32_t count, uint8_t *buffer);
 
 static int mips_m4k_examine_debug_reason(struct target *target)
 {
@@ -1040,6 +1042,13 @@ static int mips_m4k_read_memory(struct target *target, target_addr_t address,
 	if (((size == 4) && (address & 0x3u)) || ((size == 2) && (address & 0x1u)))
 		return ERROR_TARGET_UNALIGNED_ACCESS;
 
+	if (size == 4 && count > 32) {
+		int retval = mips_m4k_bulk_read_memory(target, address, count, buffer);
+		if (retval == ERROR_OK)
+			return ERROR_OK;
+		LOG_WARNING("Falling back to non-bulk read");
+	}
+
 	/* since we don't know if buffer is aligned, we allocate new mem that is always aligned */
 	void *t = NULL;
 
@@ -1202,21 +1211,15 @@ static int mips_m4k_examine(struct target *target)
 	return mips32_examine(target);
 }
 
-static int mips_m4k_bulk_write_memory(struct target *target, target_addr_t address,
-		uint32_t count, const uint8_t *buffer)
+/* Make sure mips32->fast_data_area holds the fastdata handler and doesn't
+ * overlap the count words at address. */
+static int mips_m4k_fastdata_area(struct target *target, target_addr_t address,
+		uint32_t count)
 {
 	struct mips32_common *mips32 = target_to_mips32(target);
 	struct mips_ejtag *ejtag_info = &mips32->ejtag_info;
 	struct working_area *fast_data_area;
 	int retval;
-	int write_t = 1;
-
-	LOG_DEBUG("address: " TARGET_ADDR_FMT ", count: 0x%8.8" PRIx32 "",
-			  address, count);
-
-	/* check alignment */
-	if (address & 0x3u)
-		return ERROR_TARGET_UNALIGNED_ACCESS;
 
 	if (mips32->fast_data_area == NULL) {
 		/* Get memory for block write handler
@@ -1238,14 +1241,36 @@ static int mips_m4k_bulk_write_memory(struct target *target, target_addr_t addre
 	fast_data_area = mips32->fast_data_area;
 
 	if (address <= fast_data_area->address + fast_data_area->size &&
-			fast_data_area->address <= address + count) {
-		LOG_ERROR("fast_data (" TARGET_ADDR_FMT ") is within write area "
+			fast_data_area->address <= address + count * 4) {
+		LOG_ERROR("fast_data (" TARGET_ADDR_FMT ") is within access area "
 			  "(" TARGET_ADDR_FMT "-" TARGET_ADDR_FMT ").",
-			  fast_data_area->address, address, address + count);
+			  fast_data_area->address, address, address + count * 4);
 		LOG_ERROR("Change work-area-phys or load_image address!");
 		return ERROR_FAIL;
 	}
 
+	return ERROR_OK;
+}
+
+static int mips_m4k_bulk_write_memory(struct target *target, target_addr_t address,
+		uint32_t count, const uint8_t *buffer)
+{
+	struct mips32_common *mips32 = target_to_mips32(target);
+	struct mips_ejtag *ejtag_info = &mips32->ejtag_info;
+	int retval;
+	int write_t = 1;
+
+	LOG_DEBUG("address: " TARGET_ADDR_FMT ", count: 0x%8.8" PRIx32 "",
+			  address, count);
+
+	/* check alignment */
+	if (address & 0x3u)
+		return ERROR_TARGET_UNALIGNED_ACCESS;
+
+	retval = mips_m4k_fastdata_area(target, address, count);
+	if (retval != ERROR_OK)
+		return retval;
+
 	/* mips32_pracc_fastdata_xfer requires uint32_t in host endianness, */
 	/* but byte array represents target endianness                      */
 	uint32_t *t = NULL;
@@ -1268,6 +1293,39 @@ static int mips_m4k_bulk_write_memory(struct target *target, target_addr_t addre
 	return retval;
 }
 
+/* The handler in mips32_pracc_fastdata_xfer() works both ways, and moves a
+ * word per 33 bit FASTDATA scan instead of a PrAcc round per word. */
+static int mips_m4k_bulk_read_memory(struct target *target, target_addr_t address,
+		uint32_t count, uint8_t *buffer)
+{
+	struct mips32_common *mips32 = target_to_mips32(target);
+	struct mips_ejtag *ejtag_info = &mips32->ejtag_info;
+	int retval;
+
+	LOG_DEBUG("address: " TARGET_ADDR_FMT ", count: 0x%8.8" PRIx32 "",
+			  address, count);
+
+	retval = mips_m4k_fastdata_area(target, address, count);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint32_t *t = malloc(count * sizeof(uint32_t));
+	if (t == NULL) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	retval = mips32_pracc_fastdata_xfer(ejtag_info, mips32->fast_data_area, 0, address,
+			count, t);
+	if (retval == ERROR_OK)
+		target_buffer_set_u32_array(target, buffer, count, t);
+	else
+		LOG_ERROR("Fastdata access Failed");
+
+	free(t);
+	return retval;
+}
+
 static int mips_m4k_verify_pointer(struct command_invocation *cmd,
 		struct mips_m4k_common *mips_m4k)
 {
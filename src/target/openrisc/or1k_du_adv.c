@@ -135,7 +135,9 @@
 #define BURST_READ_READY		1
 #define MAX_BUS_ERRORS			2
 
-#define MAX_BURST_SIZE			(4 * 1024)
+/* Burst length is a 16-bit word count; a CRC error retries the whole
+ * burst, so stay well below the limit. */
+#define MAX_BURST_SIZE			(16 * 1024)
 
 #define STATUS_BYTES			1
 #define CRC_LEN				4
@@ -436,9 +438,11 @@ static int adbg_burst_command(struct or1k_jtag *jtag_info, uint32_t opcode,
 	field.out_value = (uint8_t *)&data[0];
 	field.in_value = NULL;
 
+	/* Only queued: the data scan that follows goes out with it, saving
+	 * one round trip per burst. jtag_add_dr_scan() copies data[]. */
 	jtag_add_dr_scan(jtag_info->tap, 1, &field, TAP_IDLE);
 
-	return jtag_execute_queue();
+	return ERROR_OK;
 }
 
 static int adbg_wb_burst_read(struct or1k_jtag *jtag_info, int size,
@@ -497,7 +501,7 @@ static int adbg_wb_burst_read(struct or1k_jtag *jtag_info, int size,
 
 retry_read_full:
 
-	/* Send the BURST READ command, returns TAP to idle state */
+	/* Queue the BURST READ command, returns TAP to idle state */
 	retval = adbg_burst_command(jtag_info, opcode, start_address, count);
 	if (retval != ERROR_OK)
 		goto out;
@@ -648,7 +652,7 @@ static int adbg_wb_burst_write(struct or1k_jtag *jtag_info, const uint8_t *data,
 
 retry_full_write:
 
-	/* Send the BURST WRITE command, returns TAP to idle state */
+	/* Queue the BURST WRITE command, returns TAP to idle state */
 	retval = adbg_burst_command(jtag_info, opcode, start_address, count);
 	if (retval != ERROR_OK)
 		return retval;
@@ -25,6 +25,7 @@
 
 #include "register.h"
 #include <helper/log.h>
+#include "gnulib/gl_linkedhash_map.h"
 
 /**
  * @file
@@ -59,6 +60,78 @@ struct reg *register_get_by_number(struct reg_cache *first,
 	return NULL;
 }
 
+/* Caches with fewer registers are searched linearly, that's as fast. */
+#define REG_NAME_INDEX_MIN_REGS	64
+
+/* Name index of one cache, valid as long as reg_list and num_regs are those
+ * it was built for. Register names must not change once the cache is in use
+ * (they don't; targets name their registers when building the cache). */
+struct reg_name_index {
+	const struct reg *reg_list;
+	unsigned num_regs;
+	gl_map_t map;
+};
+
+static bool reg_name_equals(const void *x1, const void *x2)
+{
+	return strcmp(x1, x2) == 0;
+}
+
+static size_t reg_name_hash(const void *x)
+{
+	size_t hash = 5381;
+	for (const unsigned char *s = x; *s; s++)
+		hash = hash * 33 + *s;
+	return hash;
+}
+
+void register_cache_free_index(struct reg_cache *cache)
+{
+	if (!cache->name_index)
+		return;
+	gl_map_free(cache->name_index->map);
+	free(cache->name_index);
+	cache->name_index = NULL;
+}
+
+/** Returns the up to date name index of @a cache, NULL if it has none. */
+static gl_map_t register_cache_name_index(struct reg_cache *cache)
+{
+	struct reg_name_index *index = cache->name_index;
+	if (index && index->reg_list == cache->reg_list &&
+			index->num_regs == cache->num_regs)
+		return index->map;
+
+	register_cache_free_index(cache);
+	if (cache->num_regs < REG_NAME_INDEX_MIN_REGS)
+		return NULL;
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+	index->map = gl_map_nx_create_empty(GL_LINKEDHASH_MAP, reg_name_equals,
+			reg_name_hash, NULL, NULL);
+	if (!index->map) {
+		free(index);
+		return NULL;
+	}
+	for (unsigned i = 0; i < cache->num_regs; i++) {
+		struct reg *reg = &cache->reg_list[i];
+		/* keep the first of duplicate names, like the linear search */
+		if (!reg->name || gl_map_get(index->map, reg->name))
+			continue;
+		if (gl_map_nx_put(index->map, reg->name, reg) == -1) {
+			gl_map_free(index->map);
+			free(index);
+			return NULL;
+		}
+	}
+	index->reg_list = cache->reg_list;
+	index->num_regs = cache->num_regs;
+	cache->name_index = index;
+	return index->map;
+}
+
 struct reg *register_get_by_name(struct reg_cache *first,
 		const char *name, bool search_all)
 {
@@ -66,11 +139,19 @@ struct reg *register_get_by_name(struct reg_cache *first,
 	struct reg_cache *cache = first;
 
 	while (cache) {
-		for (i = 0; i < cache->num_regs; i++) {
-			if (cache->reg_list[i].exist == false)
-				continue;
-			if (strcmp(cache->reg_list[i].name, name) == 0)
-				return &(cache->reg_list[i]);
+		gl_map_t map = register_cache_name_index(cache);
+		struct reg *reg = map ? (struct reg *)gl_map_get(map, name) : NULL;
+		if (reg && reg->exist)
+			return reg;
+
+		/* a register that doesn't exist may have an existing namesake */
+		if (!map || reg) {
+			for (i = 0; i < cache->num_regs; i++) {
+				if (cache->reg_list[i].exist == false)
+					continue;
+				if (strcmp(cache->reg_list[i].name, name) == 0)
+					return &(cache->reg_list[i]);
+			}
 		}
 
 		if (search_all)
@@ -114,6 +195,23 @@ void register_cache_invalidate(struct reg_cache *cache)
 		reg->valid = false;
 		reg->dirty = false;
 	}
+	cache->generation++;
+}
+
+/**
+ * Marks the registers that may have changed although the target did not run
+ * as invalid. Stable registers and pending writes are kept, so this is what
+ * to use when the target was found still halted.
+ */
+void register_cache_invalidate_halted(struct reg_cache *cache)
+{
+	struct reg *reg = cache->reg_list;
+
+	for (unsigned n = cache->num_regs; n != 0; n--, reg++) {
+		if (!reg->exist || reg->stable || reg->dirty)
+			continue;
+		reg->valid = false;
+	}
 }
 
 static int register_get_dummy_core_reg(struct reg *reg)
@@ -139,6 +139,9 @@ struct reg {
 	bool exist;
 	/* Hide the register from gdb and omit it in 'reg' cmd output */
 	bool hidden;
+	/* The value can't change while the target is halted, so a cached value
+	 * stays valid until the target runs again. */
+	bool stable;
 	/* Size of the register in bits. */
 	uint32_t size;
 	/* Used for generating XML description of registers. Can be set to NULL for
@@ -157,6 +160,12 @@ struct reg_cache {
 	struct reg_cache *next;
 	struct reg *reg_list;
 	unsigned num_regs;
+	/* Bumped by register_cache_invalidate(), so users can tell whether
+	 * values they saw earlier may be stale. */
+	unsigned int generation;
+	/* Name index built by register_get_by_name() for large caches, see
+	 * register_cache_free_index(). */
+	struct reg_name_index *name_index;
 };
 
 struct reg_arch_type {
@@ -168,9 +177,11 @@ struct reg *register_get_by_number(struct reg_cache *first,
 		uint32_t reg_num, bool search_all);
 struct reg *register_get_by_name(struct reg_cache *first,
 		const char *name, bool search_all);
+void register_cache_free_index(struct reg_cache *cache);
 struct reg_cache **register_get_last_cache_p(struct reg_cache **first);
 void register_unlink_cache(struct reg_cache **cache_p, const struct reg_cache *cache);
 void register_cache_invalidate(struct reg_cache *cache);
+void register_cache_invalidate_halted(struct reg_cache *cache);
 
 void register_init_dummy(struct reg *reg);
 
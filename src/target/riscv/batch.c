@@ -6,6 +6,7 @@
 
 #include "batch.h"
 #include "debug_defines.h"
+#include "dmi_trace.h"
 #include "riscv.h"
 
 #define get_field(reg, mask) (((reg) & (mask)) / ((mask) & ~((mask) << 1)))
@@ -17,47 +18,93 @@
 
 static void dump_field(int idle, const struct scan_field *field);
 
+/* Number of scans a batch starts out with. It grows from there as scans are
+ * added, up to the limit given to riscv_batch_alloc(). */
+#define RISCV_BATCH_INITIAL_SCANS	64
+
+/* Scans reserved at the end of every batch, e.g. for the trailing NOP that
+ * riscv_batch_run() adds. */
+#define RISCV_BATCH_RESERVED_SCANS	4
+
+static int batch_resize(struct riscv_batch *batch, size_t scans)
+{
+	uint8_t *data_out = realloc(batch->data_out, scans * DMI_SCAN_BUF_SIZE);
+	if (!data_out)
+		return ERROR_FAIL;
+	batch->data_out = data_out;
+
+	uint8_t *data_in = realloc(batch->data_in, scans * DMI_SCAN_BUF_SIZE);
+	if (!data_in)
+		return ERROR_FAIL;
+	batch->data_in = data_in;
+
+	struct scan_field *fields = realloc(batch->fields, scans * sizeof(*fields));
+	if (!fields)
+		return ERROR_FAIL;
+	batch->fields = fields;
+
+	if (bscan_tunnel_ir_width != 0) {
+		riscv_bscan_tunneled_scan_context_t *bscan_ctxt =
+			realloc(batch->bscan_ctxt, scans * sizeof(*bscan_ctxt));
+		if (!bscan_ctxt)
+			return ERROR_FAIL;
+		batch->bscan_ctxt = bscan_ctxt;
+	}
+
+	size_t *read_keys = realloc(batch->read_keys, scans * sizeof(*read_keys));
+	if (!read_keys)
+		return ERROR_FAIL;
+	batch->read_keys = read_keys;
+
+	size_t *scan_idle = realloc(batch->scan_idle, scans * sizeof(*scan_idle));
+	if (!scan_idle)
+		return ERROR_FAIL;
+	batch->scan_idle = scan_idle;
+
+	/* The scans already queued point into the old buffers. */
+	for (size_t i = 0; i < batch->used_scans; ++i) {
+		batch->fields[i].out_value = batch->data_out + i * DMI_SCAN_BUF_SIZE;
+		batch->fields[i].in_value = batch->data_in + i * DMI_SCAN_BUF_SIZE;
+	}
+
+	batch->allocated_scans = scans;
+	return ERROR_OK;
+}
+
+/* Make sure there is room for one more scan, growing the batch if needed. */
+static bool batch_make_room(struct riscv_batch *batch)
+{
+	if (batch->used_scans < batch->allocated_scans)
+		return true;
+
+	if (!batch->alloc_failed) {
+		size_t scans = MIN(batch->allocated_scans * 2, batch->max_scans);
+		if (scans > batch->allocated_scans &&
+				batch_resize(batch, scans) == ERROR_OK)
+			return true;
+		LOG_ERROR("Unable to grow batch to %zu scans.", scans);
+		batch->alloc_failed = true;
+	}
+	return false;
+}
+
 struct riscv_batch *riscv_batch_alloc(struct target *target, size_t scans, size_t idle)
 {
-	scans += 4;
+	if (scans == 0)
+		scans = RISCV_BATCH_DEFAULT_MAX_SCANS;
+	scans += RISCV_BATCH_RESERVED_SCANS;
 	struct riscv_batch *out = calloc(1, sizeof(*out));
 	if (!out)
-		goto error0;
+		return NULL;
 	out->target = target;
-	out->allocated_scans = scans;
+	out->max_scans = scans;
 	out->idle_count = idle;
-	out->data_out = malloc(sizeof(*out->data_out) * (scans) * DMI_SCAN_BUF_SIZE);
-	if (!out->data_out)
-		goto error1;
-	out->data_in = malloc(sizeof(*out->data_in) * (scans) * DMI_SCAN_BUF_SIZE);
-	if (!out->data_in)
-		goto error2;
-	out->fields = malloc(sizeof(*out->fields) * (scans));
-	if (!out->fields)
-		goto error3;
-	if (bscan_tunnel_ir_width != 0) {
-		out->bscan_ctxt = malloc(sizeof(*out->bscan_ctxt) * (scans));
-		if (!out->bscan_ctxt)
-			goto error4;
-	}
 	out->last_scan = RISCV_SCAN_TYPE_INVALID;
-	out->read_keys = malloc(sizeof(*out->read_keys) * (scans));
-	if (!out->read_keys)
-		goto error5;
+	if (batch_resize(out, MIN(scans, RISCV_BATCH_INITIAL_SCANS)) != ERROR_OK) {
+		riscv_batch_free(out);
+		return NULL;
+	}
 	return out;
-
-error5:
-	free(out->bscan_ctxt);
-error4:
-	free(out->fields);
-error3:
-	free(out->data_in);
-error2:
-	free(out->data_out);
-error1:
-	free(out);
-error0:
-	return NULL;
 }
 
 void riscv_batch_free(struct riscv_batch *batch)
@@ -67,12 +114,13 @@ void riscv_batch_free(struct riscv_batch *batch)
 	free(batch->fields);
 	free(batch->bscan_ctxt);
 	free(batch->read_keys);
+	free(batch->scan_idle);
 	free(batch);
 }
 
 bool riscv_batch_full(struct riscv_batch *batch)
 {
-	return batch->used_scans > (batch->allocated_scans - 4);
+	return batch->used_scans > (batch->max_scans - RISCV_BATCH_RESERVED_SCANS);
 }
 
 int riscv_batch_run(struct riscv_batch *batch)
@@ -82,22 +130,57 @@ int riscv_batch_run(struct riscv_batch *batch)
 		return ERROR_OK;
 	}
 
+	if (batch->alloc_failed) {
+		LOG_ERROR("Refusing to run a batch that is missing scans.");
+		return ERROR_FAIL;
+	}
+
 	keep_alive();
 
 	riscv_batch_add_nop(batch);
 
-	for (size_t i = 0; i < batch->used_scans; ++i) {
-		if (bscan_tunnel_ir_width != 0)
-			riscv_add_bscan_tunneled_scan(batch->target, batch->fields+i, batch->bscan_ctxt+i);
-		else
-			jtag_add_dr_scan(batch->target->tap, 1, batch->fields + i, TAP_IDLE);
+	int64_t start_us = riscv_dmi_trace_now();
+	/* Keep each flush within what the adapter can take in one go. A busy DMI
+	 * response is sticky until dmireset, so splitting the batch doesn't
+	 * change how the results are interpreted. */
+	size_t flush_scans = riscv_batch_flush_scans > 0 ?
+		riscv_batch_flush_scans : batch->used_scans;
+	for (size_t first = 0; first < batch->used_scans; first += flush_scans) {
+		size_t count = MIN(flush_scans, batch->used_scans - first);
+		if (bscan_tunnel_ir_width != 0) {
+			/* The tunnel frames a whole run of scans with one idle count,
+			 * and packing them matters more than a few idle cycles. */
+			size_t idle = 0;
+			for (size_t i = first; i < first + count; i++)
+				idle = MAX(idle, batch->scan_idle[i]);
+			riscv_add_bscan_tunneled_scans(batch->target, batch->fields + first,
+					batch->bscan_ctxt + first, count, idle);
+		} else {
+			/* The scans stay in the batch until it is freed, so the queue
+			 * doesn't need copies of them. */
+			for (size_t i = first; i < first + count; i++) {
+				jtag_add_dr_scan_nocopy(batch->target->tap, 1, batch->fields + i,
+						TAP_IDLE);
+				if (batch->scan_idle[i] > 0)
+					jtag_add_runtest(batch->scan_idle[i], TAP_IDLE);
+			}
+		}
 
-		if (batch->idle_count > 0)
-			jtag_add_runtest(batch->idle_count, TAP_IDLE);
+		if (first + count < batch->used_scans) {
+			if (jtag_execute_queue() != ERROR_OK) {
+				LOG_ERROR("Unable to execute JTAG queue");
+				riscv_dmi_trace_batch(batch->fields, batch->used_scans,
+						start_us, true);
+				vjtag_vir_invalidate(batch->target->tap);
+				return ERROR_FAIL;
+			}
+		}
 	}
 
 	if (jtag_execute_queue() != ERROR_OK) {
 		LOG_ERROR("Unable to execute JTAG queue");
+		riscv_dmi_trace_batch(batch->fields, batch->used_scans, start_us, true);
+		vjtag_vir_invalidate(batch->target->tap);
 		return ERROR_FAIL;
 	}
 
@@ -108,14 +191,16 @@ int riscv_batch_run(struct riscv_batch *batch)
 	}
 
 	for (size_t i = 0; i < batch->used_scans; ++i)
-		dump_field(batch->idle_count, batch->fields + i);
+		dump_field(batch->scan_idle[i], batch->fields + i);
+	riscv_dmi_trace_batch(batch->fields, batch->used_scans, start_us, false);
 
 	return ERROR_OK;
 }
 
 void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data)
 {
-	assert(batch->used_scans < batch->allocated_scans);
+	if (!batch_make_room(batch))
+		return;
 	struct scan_field *field = batch->fields + batch->used_scans;
 	field->num_bits = riscv_dmi_write_u64_bits(batch->target);
 	field->out_value = (void *)(batch->data_out + batch->used_scans * DMI_SCAN_BUF_SIZE);
@@ -123,12 +208,16 @@ void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint
 	riscv_fill_dmi_write_u64(batch->target, (char *)field->out_value, address, data);
 	riscv_fill_dmi_nop_u64(batch->target, (char *)field->in_value);
 	batch->last_scan = RISCV_SCAN_TYPE_WRITE;
+	batch->scan_idle[batch->used_scans] = batch->idle_count;
 	batch->used_scans++;
 }
 
 size_t riscv_batch_add_dmi_read(struct riscv_batch *batch, unsigned address)
 {
-	assert(batch->used_scans < batch->allocated_scans);
+	/* On failure the key is handed out anyway; riscv_batch_run() refuses
+	 * to run the batch, so it is never used to look up a result. */
+	if (!batch_make_room(batch))
+		return batch->read_keys_used;
 	struct scan_field *field = batch->fields + batch->used_scans;
 	field->num_bits = riscv_dmi_write_u64_bits(batch->target);
 	field->out_value = (void *)(batch->data_out + batch->used_scans * DMI_SCAN_BUF_SIZE);
@@ -136,6 +225,7 @@ size_t riscv_batch_add_dmi_read(struct riscv_batch *batch, unsigned address)
 	riscv_fill_dmi_read_u64(batch->target, (char *)field->out_value, address);
 	riscv_fill_dmi_nop_u64(batch->target, (char *)field->in_value);
 	batch->last_scan = RISCV_SCAN_TYPE_READ;
+	batch->scan_idle[batch->used_scans] = batch->idle_count;
 	batch->used_scans++;
 
 	batch->read_keys[batch->read_keys_used] = batch->used_scans;
@@ -162,9 +252,17 @@ uint32_t riscv_batch_get_dmi_read_data(struct riscv_batch *batch, size_t key)
 	return buf_get_u32(base, DTM_DMI_DATA_OFFSET, DTM_DMI_DATA_LENGTH);
 }
 
+void riscv_batch_add_idle(struct riscv_batch *batch, size_t idle)
+{
+	/* If the scan was dropped, so is its idle time; the batch won't run. */
+	if (batch->used_scans > 0 && !batch->alloc_failed)
+		batch->scan_idle[batch->used_scans - 1] += idle;
+}
+
 void riscv_batch_add_nop(struct riscv_batch *batch)
 {
-	assert(batch->used_scans < batch->allocated_scans);
+	if (!batch_make_room(batch))
+		return;
 	struct scan_field *field = batch->fields + batch->used_scans;
 	field->num_bits = riscv_dmi_write_u64_bits(batch->target);
 	field->out_value = (void *)(batch->data_out + batch->used_scans * DMI_SCAN_BUF_SIZE);
@@ -172,6 +270,7 @@ void riscv_batch_add_nop(struct riscv_batch *batch)
 	riscv_fill_dmi_nop_u64(batch->target, (char *)field->out_value);
 	riscv_fill_dmi_nop_u64(batch->target, (char *)field->in_value);
 	batch->last_scan = RISCV_SCAN_TYPE_NOP;
+	batch->scan_idle[batch->used_scans] = batch->idle_count;
 	batch->used_scans++;
 }
 
@@ -209,5 +308,5 @@ void dump_field(int idle, const struct scan_field *field)
 
 size_t riscv_batch_available_scans(struct riscv_batch *batch)
 {
-	return batch->allocated_scans - batch->used_scans - 4;
+	return batch->max_scans - batch->used_scans - RISCV_BATCH_RESERVED_SCANS;
 }
@@ -14,6 +14,9 @@ enum riscv_scan_type {
 	RISCV_SCAN_TYPE_WRITE,
 };
 
+/* Growth limit for batches whose creator doesn't pick one. */
+#define RISCV_BATCH_DEFAULT_MAX_SCANS	1024
+
 /* A batch of multiple JTAG scans, which are grouped together to avoid the
  * overhead of some JTAG adapters when sending single commands.  This is
  * designed to support block copies, as that's what we actually need to go
@@ -21,10 +24,21 @@ enum riscv_scan_type {
 struct riscv_batch {
 	struct target *target;
 
+	/* Buffers are allocated for allocated_scans scans, and grown on demand
+	 * until max_scans is reached. */
 	size_t allocated_scans;
+	size_t max_scans;
 	size_t used_scans;
 
+	/* Set when growing the buffers failed. Scans added after that point
+	 * are dropped, and the batch refuses to run. */
+	bool alloc_failed;
+
+	/* Idle cycles after every scan, and after each scan in particular. The
+	 * latter start out as idle_count, and riscv_batch_add_idle() adds to
+	 * them for scans that start something slow. */
 	size_t idle_count;
+	size_t *scan_idle;
 
 	uint8_t *data_out;
 	uint8_t *data_in;
@@ -47,15 +61,18 @@ struct riscv_batch {
 };
 
 /* Allocates (or frees) a new scan set.  "scans" is the maximum number of JTAG
- * scans that can be issued to this object, and idle is the number of JTAG idle
- * cycles between every real scan. */
+ * scans that can be issued to this object (0 picks
+ * RISCV_BATCH_DEFAULT_MAX_SCANS), and idle is the number of JTAG idle cycles
+ * after every real scan, see also riscv_batch_add_idle().  Memory is only
+ * allocated as scans are added. */
 struct riscv_batch *riscv_batch_alloc(struct target *target, size_t scans, size_t idle);
 void riscv_batch_free(struct riscv_batch *batch);
 
 /* Checks to see if this batch is full. */
 bool riscv_batch_full(struct riscv_batch *batch);
 
-/* Executes this scan batch. */
+/* Executes this scan batch.  If riscv_batch_flush_scans is set, the JTAG
+ * queue is flushed every that many scans. */
 int riscv_batch_run(struct riscv_batch *batch);
 
 /* Adds a DMI write to this batch. */
@@ -71,6 +88,12 @@ uint32_t riscv_batch_get_dmi_read_data(struct riscv_batch *batch, size_t key);
 /* Scans in a NOP. */
 void riscv_batch_add_nop(struct riscv_batch *batch);
 
+/* Clock idle more cycles after the last scan that was added, on top of the
+ * idle count of the batch. This is for scans that start an operation (an
+ * abstract command, a system bus access) which needs more time than just
+ * another DMI access would. */
+void riscv_batch_add_idle(struct riscv_batch *batch, size_t idle);
+
 /* Returns the number of available scans. */
 size_t riscv_batch_available_scans(struct riscv_batch *batch);
 
@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "dmi_trace.h"
+#include "debug_defines.h"
+#include "helper/log.h"
+
+#define get_field(reg, mask) (((reg) & (mask)) / ((mask) & ~((mask) << 1)))
+
+/* Values of the op field, see dmi_op_t and dmi_status_t in riscv-013.c. */
+#define DMI_OP_READ		1
+#define DMI_OP_WRITE	2
+#define DMI_STATUS_BUSY	3
+
+/* Bucket i counts scans that took [2^i, 2^(i+1)) us, except that bucket 0
+ * also counts faster ones and the last bucket also counts slower ones. */
+#define DMI_TRACE_BUCKETS	24
+
+enum dmi_trace_class {
+	DMI_TRACE_NOP,
+	DMI_TRACE_READ,
+	DMI_TRACE_WRITE,
+	DMI_TRACE_BATCH,
+	DMI_TRACE_CLASS_COUNT
+};
+
+static const char * const dmi_trace_class_name[] = {
+	[DMI_TRACE_NOP] = "nop",
+	[DMI_TRACE_READ] = "read",
+	[DMI_TRACE_WRITE] = "write",
+	[DMI_TRACE_BATCH] = "batch",
+};
+
+struct dmi_trace_stats {
+	uint64_t count;
+	/* Scans, which is more than count for batches. */
+	uint64_t scans;
+	uint64_t busy;
+	uint64_t failed;
+	int64_t total_us;
+	int64_t max_us;
+	uint64_t histogram[DMI_TRACE_BUCKETS];
+};
+
+/* One recorded scan. The status and data_in a scan returns belong to the
+ * operation of the scan before it, just like on the wire. */
+struct dmi_trace_entry {
+	int64_t timestamp_us;
+	/* 0 for scans that weren't part of a batch. */
+	uint32_t batch_id;
+	uint32_t address;
+	uint32_t data_out;
+	uint32_t data_in;
+	uint8_t op;
+	uint8_t status;
+};
+
+static struct dmi_trace_stats dmi_stats[DMI_TRACE_CLASS_COUNT];
+/* When the stats were last cleared. 0 until the first scan. */
+static int64_t dmi_stats_since_us;
+
+static struct dmi_trace_entry *dmi_trace;
+static unsigned int dmi_trace_entries;
+/* Total number of scans recorded, of which the last dmi_trace_entries are
+ * still in the buffer. */
+static uint64_t dmi_trace_recorded;
+static uint32_t dmi_trace_batch_id;
+
+int64_t riscv_dmi_trace_now(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void account(enum dmi_trace_class class, size_t scans, unsigned int busy,
+		int64_t start_us, int64_t end_us, bool failed)
+{
+	struct dmi_trace_stats *stats = &dmi_stats[class];
+	int64_t elapsed = end_us - start_us;
+
+	if (dmi_stats_since_us == 0)
+		dmi_stats_since_us = start_us;
+
+	stats->count++;
+	stats->scans += scans;
+	stats->busy += busy;
+	if (failed)
+		stats->failed++;
+	stats->total_us += elapsed;
+	if (elapsed > stats->max_us)
+		stats->max_us = elapsed;
+
+	unsigned int bucket = 0;
+	while (bucket + 1 < DMI_TRACE_BUCKETS && elapsed >= (2LL << bucket))
+		bucket++;
+	stats->histogram[bucket]++;
+}
+
+/* Decode one scan, and record it if there's a trace buffer. Returns whether
+ * it came back busy. */
+static bool record(const struct scan_field *field, uint32_t batch_id,
+		int64_t timestamp_us)
+{
+	uint64_t out = buf_get_u64(field->out_value, 0, field->num_bits);
+	uint64_t in = field->in_value ?
+		buf_get_u64(field->in_value, 0, field->num_bits) : 0;
+	unsigned int status = get_field(in, DTM_DMI_OP);
+
+	if (dmi_trace_entries) {
+		struct dmi_trace_entry *entry =
+			&dmi_trace[dmi_trace_recorded % dmi_trace_entries];
+		entry->timestamp_us = timestamp_us;
+		entry->batch_id = batch_id;
+		entry->address = out >> DTM_DMI_ADDRESS_OFFSET;
+		entry->data_out = get_field(out, DTM_DMI_DATA);
+		entry->data_in = get_field(in, DTM_DMI_DATA);
+		entry->op = get_field(out, DTM_DMI_OP);
+		entry->status = status;
+		dmi_trace_recorded++;
+	}
+
+	return field->in_value && status == DMI_STATUS_BUSY;
+}
+
+void riscv_dmi_trace_scan(const struct scan_field *field, int64_t start_us,
+		bool failed)
+{
+	int64_t end_us = riscv_dmi_trace_now();
+	uint64_t out = buf_get_u64(field->out_value, 0, field->num_bits);
+	enum dmi_trace_class class;
+	switch (get_field(out, DTM_DMI_OP)) {
+		case DMI_OP_READ:
+			class = DMI_TRACE_READ;
+			break;
+		case DMI_OP_WRITE:
+			class = DMI_TRACE_WRITE;
+			break;
+		default:
+			class = DMI_TRACE_NOP;
+			break;
+	}
+	bool busy = !failed && record(field, 0, end_us);
+	account(class, 1, busy, start_us, end_us, failed);
+}
+
+void riscv_dmi_trace_batch(const struct scan_field *fields, size_t count,
+		int64_t start_us, bool failed)
+{
+	int64_t end_us = riscv_dmi_trace_now();
+	unsigned int busy = 0;
+	if (++dmi_trace_batch_id == 0)
+		dmi_trace_batch_id = 1;
+	if (!failed) {
+		for (size_t i = 0; i < count; i++)
+			busy += record(fields + i, dmi_trace_batch_id, end_us);
+	}
+	account(DMI_TRACE_BATCH, count, busy, start_us, end_us, failed);
+}
+
+void riscv_dmi_stats_show(struct command_invocation *cmd)
+{
+	int64_t adapter_us = 0;
+	uint64_t total = 0;
+
+	command_print(cmd, "%-6s %10s %10s %8s %7s %12s %9s %9s", "class",
+			"count", "scans", "busy", "failed", "total ms", "avg us", "max us");
+	for (unsigned int c = 0; c < DMI_TRACE_CLASS_COUNT; c++) {
+		const struct dmi_trace_stats *stats = &dmi_stats[c];
+		adapter_us += stats->total_us;
+		total += stats->count;
+		command_print(cmd, "%-6s %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %7"
+				PRIu64 " %12.3f %9.1f %9" PRId64, dmi_trace_class_name[c],
+				stats->count, stats->scans, stats->busy, stats->failed,
+				stats->total_us / 1000.0,
+				stats->count ? (double)stats->total_us / stats->count : 0.0,
+				stats->max_us);
+	}
+	if (total == 0)
+		return;
+
+	command_print(cmd, "latency histogram (us):");
+	for (unsigned int b = 0; b < DMI_TRACE_BUCKETS; b++) {
+		bool used = false;
+		for (unsigned int c = 0; c < DMI_TRACE_CLASS_COUNT; c++)
+			used |= dmi_stats[c].histogram[b] != 0;
+		if (!used)
+			continue;
+		char line[128];
+		int len = snprintf(line, sizeof(line), "  %s%9lld", b ? ">=" : " <",
+				b ? 1LL << b : 2LL);
+		for (unsigned int c = 0; c < DMI_TRACE_CLASS_COUNT && len > 0 &&
+				(size_t)len < sizeof(line); c++)
+			len += snprintf(line + len, sizeof(line) - len, " %s=%" PRIu64,
+					dmi_trace_class_name[c], dmi_stats[c].histogram[b]);
+		command_print(cmd, "%s", line);
+	}
+
+	int64_t wall_us = riscv_dmi_trace_now() - dmi_stats_since_us;
+	command_print(cmd, "%.3f ms of %.3f ms since the stats were cleared were "
+			"spent scanning (%.1f%%).", adapter_us / 1000.0, wall_us / 1000.0,
+			wall_us > 0 ? 100.0 * adapter_us / wall_us : 0.0);
+}
+
+void riscv_dmi_stats_clear(void)
+{
+	memset(dmi_stats, 0, sizeof(dmi_stats));
+	dmi_stats_since_us = riscv_dmi_trace_now();
+}
+
+int riscv_dmi_trace_resize(unsigned int entries)
+{
+	free(dmi_trace);
+	dmi_trace = NULL;
+	dmi_trace_entries = 0;
+	dmi_trace_recorded = 0;
+	if (entries == 0)
+		return ERROR_OK;
+
+	dmi_trace = calloc(entries, sizeof(*dmi_trace));
+	if (!dmi_trace) {
+		LOG_ERROR("Couldn't allocate a trace buffer of %u entries.", entries);
+		return ERROR_FAIL;
+	}
+	dmi_trace_entries = entries;
+	return ERROR_OK;
+}
+
+unsigned int riscv_dmi_trace_size(void)
+{
+	return dmi_trace_entries;
+}
+
+int riscv_dmi_trace_dump(const char *filename)
+{
+	static const char * const op_string[] = {"nop", "read", "write", "?"};
+	static const char * const status_string[] = {"success", "?", "failed", "busy"};
+
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		LOG_ERROR("Couldn't open %s: %s", filename, strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	fprintf(file, "# timestamp_us batch address op data_out status data_in\n");
+	uint64_t first = 0;
+	if (dmi_trace_recorded > dmi_trace_entries)
+		first = dmi_trace_recorded - dmi_trace_entries;
+	for (uint64_t i = first; i < dmi_trace_recorded; i++) {
+		const struct dmi_trace_entry *entry = &dmi_trace[i % dmi_trace_entries];
+		fprintf(file, "%" PRId64 " %" PRIu32 " 0x%02" PRIx32 " %s 0x%08" PRIx32
+				" %s 0x%08" PRIx32 "\n", entry->timestamp_us, entry->batch_id,
+				entry->address, op_string[entry->op & 3], entry->data_out,
+				status_string[entry->status & 3], entry->data_in);
+	}
+
+	if (fclose(file) != 0) {
+		LOG_ERROR("Couldn't write %s: %s", filename, strerror(errno));
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
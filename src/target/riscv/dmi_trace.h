@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef TARGET__RISCV__DMI_TRACE_H
+#define TARGET__RISCV__DMI_TRACE_H
+
+#include "helper/command.h"
+#include "jtag/jtag.h"
+
+/* Low overhead accounting of DMI scans, to tell time spent in the adapter
+ * from time spent on busy retries or in OpenOCD itself. Latency histograms
+ * are always kept. Individual scans are only recorded once a trace buffer
+ * has been allocated with riscv_dmi_trace_resize(). */
+
+/* Returns a timestamp in microseconds, to pass to the functions below. */
+int64_t riscv_dmi_trace_now(void);
+
+/* Account for a single DMI scan that was started at start_us. failed is set
+ * when the JTAG queue couldn't be executed. */
+void riscv_dmi_trace_scan(const struct scan_field *field, int64_t start_us,
+		bool failed);
+
+/* Account for a batch of count DMI scans that was started at start_us. */
+void riscv_dmi_trace_batch(const struct scan_field *fields, size_t count,
+		int64_t start_us, bool failed);
+
+void riscv_dmi_stats_show(struct command_invocation *cmd);
+void riscv_dmi_stats_clear(void);
+
+/* Keep the last entries scans, or stop recording them if entries is 0. */
+int riscv_dmi_trace_resize(unsigned int entries);
+unsigned int riscv_dmi_trace_size(void);
+
+/* Write the recorded scans, oldest first, to filename. */
+int riscv_dmi_trace_dump(const char *filename);
+
+#endif
@@ -347,6 +347,18 @@ static uint32_t vmv_s_x(unsigned int vd, unsigned int rs1)
 	return (rs1 << 15) | (vd << 7) | MATCH_VMV_S_X;
 }
 
+static uint32_t vs1r_v(unsigned int vs3, unsigned int rs1) __attribute__((unused));
+static uint32_t vs1r_v(unsigned int vs3, unsigned int rs1)
+{
+	return (rs1 << 15) | (vs3 << 7) | MATCH_VS1R_V;
+}
+
+static uint32_t vl1re8_v(unsigned int vd, unsigned int rs1) __attribute__((unused));
+static uint32_t vl1re8_v(unsigned int vd, unsigned int rs1)
+{
+	return (rs1 << 15) | (vd << 7) | MATCH_VL1RE8_V;
+}
+
 static uint32_t vslide1down_vx(unsigned int vd, unsigned int vs2,
 		unsigned int rs1, unsigned int vm) __attribute__((unused));
 static uint32_t vslide1down_vx(unsigned int vd, unsigned int vs2,
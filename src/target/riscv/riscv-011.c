@@ -1983,6 +1983,272 @@ static int deassert_reset(struct target *target)
 		return wait_for_state(target, TARGET_RUNNING);
 }
 
+/* Block transfers move several words each time the debugger sets debug
+ * interrupt, instead of one. Debug RAM holds an unrolled program with a load
+ * and a store for each word, the data words it moves, and the target address
+ * of the block:
+ *   0              load S0 from the address slot
+ *   1 .. 2n        move word i between data slot i and S0 + i * size
+ *   2n + 1         jump back to the debug ROM
+ *   data .. +n-1   data slots
+ *   address        target address of the block (2 words on RV64)
+ * The last two words of Debug RAM hold S1, so they are left alone. Writing
+ * the address slot with interrupt set runs the program for the next block, so
+ * the scans for one block are the n data words plus the address. Returns the
+ * number of words per block, or 0 if Debug RAM is too small to be worth it. */
+static unsigned int block_layout(struct target *target, unsigned int *data,
+		unsigned int *address)
+{
+	riscv011_info_t *info = get_info(target);
+	unsigned int usable = MIN(info->dramsize, DRAM_CACHE_SIZE);
+	if (usable < 2)
+		return 0;
+	usable -= 2;
+	unsigned int address_words = riscv_xlen(target) / 32;
+
+	for (unsigned int n = usable / 3; n >= 2; n--) {
+		unsigned int a = 3 * n + 2;
+		/* ld needs an aligned address. */
+		a = (a + address_words - 1) / address_words * address_words;
+		if (a + address_words <= usable) {
+			*data = 2 * n + 2;
+			*address = a;
+			return n;
+		}
+	}
+	return 0;
+}
+
+static int setup_block_program(struct target *target, uint32_t size,
+		unsigned int n, unsigned int data, unsigned int address, bool read)
+{
+	cache_set32(target, 0, load(target, S0, ZERO, DEBUG_RAM_START + 4 * address));
+	for (unsigned int i = 0; i < n; i++) {
+		uint16_t slot = DEBUG_RAM_START + 4 * (data + i);
+		uint16_t offset = size * i;
+		uint32_t load_insn, store_insn;
+		switch (size) {
+			case 1:
+				load_insn = read ? lb(S1, S0, offset) : lb(S1, ZERO, slot);
+				store_insn = read ? sw(S1, ZERO, slot) : sb(S1, S0, offset);
+				break;
+			case 2:
+				load_insn = read ? lh(S1, S0, offset) : lh(S1, ZERO, slot);
+				store_insn = read ? sw(S1, ZERO, slot) : sh(S1, S0, offset);
+				break;
+			case 4:
+				load_insn = read ? lw(S1, S0, offset) : lw(S1, ZERO, slot);
+				store_insn = read ? sw(S1, ZERO, slot) : sw(S1, S0, offset);
+				break;
+			default:
+				LOG_ERROR("Unsupported size: %d", size);
+				return ERROR_FAIL;
+		}
+		cache_set32(target, 1 + 2 * i, load_insn);
+		cache_set32(target, 2 + 2 * i, store_insn);
+	}
+	cache_set_jump(target, 2 * n + 1);
+	return cache_write(target, CACHE_NO_READ, false);
+}
+
+/* Queue the scans that write the address of a block, which starts the program
+ * on it. */
+static void scans_add_block_address(scans_t *scans, unsigned int slot,
+		target_addr_t address)
+{
+	if (riscv_xlen(scans->target) > 32) {
+		scans_add_write32(scans, slot, address, false);
+		scans_add_write32(scans, slot + 1, address >> 32, true);
+	} else {
+		scans_add_write32(scans, slot, address, true);
+	}
+}
+
+/* Check the status and interrupt bit of every scan in a block transfer batch.
+ * Sets *retry if the batch has to be repeated, after increasing the delays
+ * and waiting for the program to finish. */
+static int check_block_scans(struct target *target, scans_t *scans, bool *retry)
+{
+	int dbus_busy = 0;
+	int execute_busy = 0;
+	for (unsigned int j = 0; j < scans->next_scan; j++) {
+		dbus_status_t status = scans_get_u32(scans, j, DBUS_OP_START,
+				DBUS_OP_SIZE);
+		switch (status) {
+			case DBUS_STATUS_SUCCESS:
+				break;
+			case DBUS_STATUS_FAILED:
+				LOG_ERROR("Debug RAM write failed. Hardware error?");
+				return ERROR_FAIL;
+			case DBUS_STATUS_BUSY:
+				dbus_busy++;
+				break;
+			default:
+				LOG_ERROR("Got invalid bus access status: %d", status);
+				return ERROR_FAIL;
+		}
+		if (scans_get_u32(scans, j, DBUS_DATA_START + 33, 1))
+			execute_busy++;
+	}
+	if (dbus_busy)
+		increase_dbus_busy_delay(target);
+	if (execute_busy)
+		increase_interrupt_high_delay(target);
+	*retry = dbus_busy || execute_busy;
+	if (*retry)
+		return wait_for_debugint_clear(target, false);
+	return ERROR_OK;
+}
+
+/* Read count words, which must be a multiple of the block size n, a block at
+ * a time. */
+static int read_memory_block(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, uint8_t *buffer, unsigned int n,
+		unsigned int data, unsigned int address_slot)
+{
+	riscv011_info_t *info = get_info(target);
+	unsigned int address_words = riscv_xlen(target) / 32;
+	unsigned int block_scans = n + address_words;
+	const unsigned int max_blocks = MAX(1, 256 / block_scans);
+	uint32_t blocks = count / n;
+
+	if (setup_block_program(target, size, n, data, address_slot, true) != ERROR_OK)
+		return ERROR_FAIL;
+
+	scans_t *scans = scans_new(target, max_blocks * block_scans + 2);
+	if (!scans)
+		return ERROR_FAIL;
+
+	int result = ERROR_FAIL;
+	uint32_t b = 0;
+	while (b < blocks) {
+		unsigned int batch_blocks = MIN(blocks - b, max_blocks);
+		scans_reset(scans);
+
+		/* Start block b, then read each block's data while starting the
+		 * next one. The value a scan reads comes back in the scan after it. */
+		for (unsigned int k = 0; k < batch_blocks; k++) {
+			scans_add_block_address(scans, address_slot,
+					address + (target_addr_t)size * n * (b + k));
+			for (unsigned int i = 0; i < n; i++)
+				scans_add_read32(scans, data + i, false);
+		}
+		/* Scan out the last word, and check for an exception. */
+		scans_add_read32(scans, info->dramsize - 1, false);
+		scans_add_read32(scans, info->dramsize - 1, false);
+
+		if (scans_execute(scans) != ERROR_OK) {
+			LOG_ERROR("JTAG execute failed.");
+			goto out;
+		}
+
+		bool retry;
+		if (check_block_scans(target, scans, &retry) != ERROR_OK)
+			goto out;
+		if (retry) {
+			LOG_INFO("Retrying memory read starting from 0x%" TARGET_PRIxADDR
+					" with more delays", address + (target_addr_t)size * n * b);
+			continue;
+		}
+
+		for (unsigned int k = 0; k < batch_blocks; k++) {
+			for (unsigned int i = 0; i < n; i++) {
+				unsigned int scan = k * block_scans + address_words + i + 1;
+				uint32_t value = scans_get_u32(scans, scan, DBUS_DATA_START, 32);
+				buf_set_u32(buffer + size * (n * (b + k) + i), 0, 8 * size, value);
+			}
+		}
+
+		uint32_t exception = scans_get_u32(scans, scans->next_scan - 1,
+				DBUS_DATA_START, 32);
+		if (exception != 0) {
+			LOG_USER("Core got an exception (0x%x) while reading from 0x%"
+					TARGET_PRIxADDR "-0x%" TARGET_PRIxADDR, exception,
+					address + (target_addr_t)size * n * b,
+					address + (target_addr_t)size * n * (b + batch_blocks) - 1);
+			goto out;
+		}
+		b += batch_blocks;
+	}
+	result = ERROR_OK;
+
+out:
+	scans_delete(scans);
+	cache_clean(target);
+	return result;
+}
+
+/* Write count words, which must be a multiple of the block size n, a block at
+ * a time. */
+static int write_memory_block(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, const uint8_t *buffer, unsigned int n,
+		unsigned int data, unsigned int address_slot)
+{
+	riscv011_info_t *info = get_info(target);
+	unsigned int address_words = riscv_xlen(target) / 32;
+	unsigned int block_scans = n + address_words;
+	const unsigned int max_blocks = MAX(1, 256 / block_scans);
+	uint32_t blocks = count / n;
+
+	if (setup_block_program(target, size, n, data, address_slot, false) != ERROR_OK)
+		return ERROR_FAIL;
+
+	scans_t *scans = scans_new(target, max_blocks * block_scans + 2);
+	if (!scans)
+		return ERROR_FAIL;
+
+	int result = ERROR_FAIL;
+	uint32_t b = 0;
+	while (b < blocks) {
+		unsigned int batch_blocks = MIN(blocks - b, max_blocks);
+		scans_reset(scans);
+
+		for (unsigned int k = 0; k < batch_blocks; k++) {
+			for (unsigned int i = 0; i < n; i++) {
+				uint32_t value = buf_get_u32(buffer + size * (n * (b + k) + i),
+						0, 8 * size);
+				scans_add_write32(scans, data + i, value, false);
+			}
+			scans_add_block_address(scans, address_slot,
+					address + (target_addr_t)size * n * (b + k));
+		}
+		/* Check for an exception. */
+		scans_add_read32(scans, info->dramsize - 1, false);
+		scans_add_read32(scans, info->dramsize - 1, false);
+
+		if (scans_execute(scans) != ERROR_OK) {
+			LOG_ERROR("JTAG execute failed.");
+			goto out;
+		}
+
+		bool retry;
+		if (check_block_scans(target, scans, &retry) != ERROR_OK)
+			goto out;
+		if (retry) {
+			LOG_INFO("Retrying memory write starting from 0x%" TARGET_PRIxADDR
+					" with more delays", address + (target_addr_t)size * n * b);
+			continue;
+		}
+
+		uint32_t exception = scans_get_u32(scans, scans->next_scan - 1,
+				DBUS_DATA_START, 32);
+		if (exception != 0) {
+			LOG_ERROR("Core got an exception (0x%x) while writing to 0x%"
+					TARGET_PRIxADDR "-0x%" TARGET_PRIxADDR, exception,
+					address + (target_addr_t)size * n * b,
+					address + (target_addr_t)size * n * (b + batch_blocks) - 1);
+			goto out;
+		}
+		b += batch_blocks;
+	}
+	result = ERROR_OK;
+
+out:
+	scans_delete(scans);
+	cache_clean(target);
+	return result;
+}
+
 static int read_memory(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer, uint32_t increment)
 {
@@ -1993,6 +2259,20 @@ static int read_memory(struct target *target, target_addr_t address,
 
 	jtag_add_ir_scan(target->tap, &select_dbus, TAP_IDLE);
 
+	unsigned int data_slot, address_slot;
+	unsigned int n = block_layout(target, &data_slot, &address_slot);
+	if (n && count >= 2 * n) {
+		uint32_t block_count = count - count % n;
+		if (read_memory_block(target, address, size, block_count, buffer, n,
+					data_slot, address_slot) != ERROR_OK)
+			return ERROR_FAIL;
+		if (block_count == count)
+			return ERROR_OK;
+		address += (target_addr_t)size * block_count;
+		buffer += size * block_count;
+		count -= block_count;
+	}
+
 	cache_set32(target, 0, lw(S0, ZERO, DEBUG_RAM_START + 16));
 	switch (size) {
 		case 1:
@@ -2159,6 +2439,20 @@ static int write_memory(struct target *target, target_addr_t address,
 	riscv011_info_t *info = get_info(target);
 	jtag_add_ir_scan(target->tap, &select_dbus, TAP_IDLE);
 
+	unsigned int data_slot, address_slot;
+	unsigned int n = block_layout(target, &data_slot, &address_slot);
+	if (n && count >= 2 * n) {
+		uint32_t block_count = count - count % n;
+		if (write_memory_block(target, address, size, block_count, buffer, n,
+					data_slot, address_slot) != ERROR_OK)
+			return ERROR_FAIL;
+		if (block_count == count)
+			return ERROR_OK;
+		address += (target_addr_t)size * block_count;
+		buffer += size * block_count;
+		count -= block_count;
+	}
+
 	/* Set up the address. */
 	cache_set_store(target, 0, T0, SLOT1);
 	cache_set_load(target, 1, T0, SLOT0);
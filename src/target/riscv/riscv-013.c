@@ -6,6 +6,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -28,13 +29,11 @@
 #include "program.h"
 #include "asm.h"
 #include "batch.h"
+#include "dmi_trace.h"
 
 #define DM_DATA1 (DM_DATA0 + 1)
 #define DM_PROGBUF1 (DM_PROGBUF0 + 1)
 
-extern bool use_vjtag;
-extern int vjtag_vir_scan(struct jtag_tap *tap, uint32_t vir);
-
 static int riscv013_on_step_or_resume(struct target *target, bool step);
 static int riscv013_step_or_resume_current_hart(struct target *target,
 		bool step, bool use_hasel);
@@ -47,9 +46,21 @@ static int riscv013_set_register(struct target *target, int regid, uint64_t valu
 static int riscv013_select_current_hart(struct target *target);
 static int riscv013_halt_prep(struct target *target);
 static int riscv013_halt_go(struct target *target);
+static int riscv013_sample_pc(struct target *target, uint32_t *samples,
+		unsigned max, unsigned *count);
+static int riscv013_group_halted(struct target *target, bool *halted);
+static int riscv013_write_memory_parallel(unsigned count,
+		struct target * const *targets, const target_addr_t *address,
+		const uint8_t * const *buffer, const uint32_t *words);
 static int riscv013_resume_go(struct target *target);
 static int riscv013_step_current_hart(struct target *target);
 static int riscv013_on_halt(struct target *target);
+static int riscv013_prefetch_registers(struct target *target);
+static int riscv013_snapshot_group(struct target *target);
+static int riscv013_read_csrs(struct target *target, const unsigned *regnos,
+		unsigned count, riscv_reg_t *values, bool *valid);
+static int riscv013_read_triggers(struct target *target, unsigned max,
+		riscv_reg_t *tselect, riscv_reg_t *tdata1, unsigned *count);
 static int riscv013_on_step(struct target *target);
 static int riscv013_resume_prep(struct target *target);
 static bool riscv013_is_halted(struct target *target);
@@ -64,6 +75,12 @@ static void riscv013_fill_dmi_read_u64(struct target *target, char *buf, int a);
 static int riscv013_dmi_write_u64_bits(struct target *target);
 static void riscv013_fill_dmi_nop_u64(struct target *target, char *buf);
 static int register_read(struct target *target, uint64_t *value, uint32_t number);
+static int batch_run(const struct target *target, struct riscv_batch *batch);
+static int group_batch_status(struct target *target, struct riscv_batch *batch,
+		size_t last_key);
+static int batch_get_status_read(struct target *target,
+		struct riscv_batch *batch, size_t key, uint32_t address,
+		uint32_t *value, bool *dmi_busy_encountered);
 static int register_read_direct(struct target *target, uint64_t *value, uint32_t number);
 static int register_write_direct(struct target *target, unsigned number,
 		uint64_t value);
@@ -71,6 +88,8 @@ static int read_memory(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer, uint32_t increment);
 static int write_memory(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer);
+static int read_memory_batch(struct target *target,
+		struct target_memory_read *reads, unsigned int num_reads);
 static int riscv013_test_sba_config_reg(struct target *target, target_addr_t legal_address,
 		uint32_t num_words, target_addr_t illegal_address, bool run_sbbusyerror_test);
 void write_memory_sba_simple(struct target *target, target_addr_t addr, uint32_t *write_data,
@@ -157,17 +176,70 @@ typedef struct {
 	/* The currently selected hartid on this DM. */
 	int current_hartid;
 	bool hasel_supported;
+	/* assert_reset_group() reset every hart in an SMP group, and the first
+	 * deassert_reset() will take all of them out of reset. */
+	bool group_reset_asserted;
 
 	/* The program buffer stores executable code. 0 is an illegal instruction,
 	 * so we use 0 to mean the cached value is invalid. */
 	uint32_t progbuf_cache[16];
+
+	/* The last value written to DM registers that only change when we write
+	 * them, so a write of the same value again can be skipped, and dmcontrol
+	 * doesn't have to be read to change hartsel. Only the fields that read
+	 * back what was written are kept (see DMCONTROL_SHADOW_MASK and
+	 * SBCS_SHADOW_MASK). dm_shadow_invalidate() forgets all of it. */
+	struct {
+		bool dmcontrol_valid;
+		uint32_t dmcontrol;
+		bool abstractauto_valid;
+		uint32_t abstractauto;
+		bool sbcs_valid;
+		uint32_t sbcs;
+		/* sbaddress1..3; sbaddress0 is never skipped since writing it can
+		 * start a bus read. */
+		bool sbaddress_valid[4];
+		uint32_t sbaddress[4];
+	} shadow;
+
+	/* What examine() found out about each hart that can't change, so that
+	 * examining it again (eg. after a reset) doesn't have to ask. */
+	struct list_head hart_discovery;
 } dm013_info_t;
 
+typedef struct {
+	struct list_head list;
+	int hartid;
+	int xlen;
+	unsigned vlenb;
+	yes_no_maybe_t progbuf_writable;
+	riscv_addr_t progbuf_address;
+} hart_discovery_t;
+
 typedef struct {
 	struct list_head list;
 	struct target *target;
 } target_list_t;
 
+/* Each kind of operation learns its own busy delay, so that a single slow
+ * operation of one kind doesn't slow down all the others. */
+typedef enum {
+	DELAY_DMI,
+	DELAY_ABSTRACT,
+	DELAY_MEMORY,
+	DELAY_SB_READ,
+	DELAY_SB_WRITE,
+	DELAY_CLASS_COUNT
+} delay_class_t;
+
+typedef struct {
+	uint8_t instruction_count;
+	/* Index of the addi that advances s0, whose immediate is patched in for
+	 * each use. */
+	uint8_t addi;
+	uint32_t insn[8];
+} mem_program_template_t;
+
 typedef struct {
 	/* The indexed used to address this hart in its DM. */
 	unsigned index;
@@ -185,6 +257,10 @@ typedef struct {
 	/* We only need the address so that we know the alignment of the buffer. */
 	riscv_addr_t progbuf_address;
 
+	/* idcode and the static fields of dmstatus, hartinfo, abstractcs and
+	 * sbcs. Identifies this kind of hart in the capability cache file. */
+	uint32_t fingerprint[5];
+
 	/* Number of run-test/idle cycles the target requests we do after each dbus
 	 * access. */
 	unsigned int dtmcs_idle;
@@ -205,12 +281,23 @@ typedef struct {
 	 * go low. */
 	unsigned int ac_busy_delay;
 
+	/* Like ac_busy_delay, but for the streamed abstract commands that bulk
+	 * memory accesses use. */
+	unsigned int memory_busy_delay;
+
+	/* Number of operations of each class that succeeded since its delay was
+	 * last changed. */
+	unsigned int delay_successes[DELAY_CLASS_COUNT];
+
 	bool abstract_read_csr_supported;
 	bool abstract_write_csr_supported;
 	bool abstract_read_fpr_supported;
 	bool abstract_write_fpr_supported;
 
 	yes_no_maybe_t has_aampostincrement;
+	/* Whether register reads can be streamed with aarpostincrement and
+	 * autoexecdata. */
+	yes_no_maybe_t has_aarpostincrement;
 
 	/* When a function returns some error due to a failure indicated by the
 	 * target in cmderr, the caller can look here to see what that error was.
@@ -227,6 +314,13 @@ typedef struct {
 
 	/* DM that provides access to this target. */
 	dm013_info_t *dm;
+
+	/* This hart's reset is handled by the group reset of its SMP group. */
+	bool group_reset;
+
+	/* Memory access programs, assembled the first time each one is needed.
+	 * See memory_program(). */
+	mem_program_template_t mem_program[3 * 4 * 2 * 2];
 } riscv013_info_t;
 
 LIST_HEAD(dm_list);
@@ -270,6 +364,7 @@ dm013_info_t *get_dm(struct target *target)
 		dm->current_hartid = -1;
 		dm->hart_count = -1;
 		INIT_LIST_HEAD(&dm->target_list);
+		INIT_LIST_HEAD(&dm->hart_discovery);
 		list_add(&dm->list, &dm_list);
 	}
 
@@ -290,6 +385,254 @@ dm013_info_t *get_dm(struct target *target)
 	return dm;
 }
 
+static hart_discovery_t *find_hart_discovery(dm013_info_t *dm, int hartid)
+{
+	hart_discovery_t *entry;
+	list_for_each_entry(entry, &dm->hart_discovery, list) {
+		if (entry->hartid == hartid)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Look this hart up in the capability cache file. The last matching line
+ * wins, except that it can't forget what's known about the progbuf. */
+static hart_discovery_t *capability_cache_load(struct target *target)
+{
+	RISCV013_INFO(info);
+	RISCV_INFO(r);
+
+	if (!riscv_capability_cache_file)
+		return NULL;
+	FILE *file = fopen(riscv_capability_cache_file, "r");
+	if (!file)
+		return NULL;
+
+	hart_discovery_t found = { .progbuf_writable = YNM_MAYBE };
+	bool have = false;
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		uint32_t fingerprint[ARRAY_SIZE(info->fingerprint)];
+		int hartid, xlen, progbuf_writable;
+		unsigned vlenb;
+		uint64_t progbuf_address;
+		if (sscanf(line, "hart %" SCNx32 " %" SCNx32 " %" SCNx32 " %" SCNx32
+					" %" SCNx32 " %d %d %u %d %" SCNx64,
+					&fingerprint[0], &fingerprint[1], &fingerprint[2],
+					&fingerprint[3], &fingerprint[4], &hartid, &xlen, &vlenb,
+					&progbuf_writable, &progbuf_address) != 10)
+			continue;
+		if (memcmp(fingerprint, info->fingerprint, sizeof(fingerprint)) ||
+				hartid != r->current_hartid || (xlen != 32 && xlen != 64))
+			continue;
+		found.xlen = xlen;
+		found.vlenb = vlenb;
+		if (progbuf_writable == YNM_YES || progbuf_writable == YNM_NO) {
+			found.progbuf_writable = progbuf_writable;
+			found.progbuf_address = progbuf_address;
+		}
+		have = true;
+	}
+	fclose(file);
+	if (!have)
+		return NULL;
+
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return NULL;
+	hart_discovery_t *discovery = malloc(sizeof(*discovery));
+	if (!discovery)
+		return NULL;
+	*discovery = found;
+	discovery->hartid = r->current_hartid;
+	list_add(&discovery->list, &dm->hart_discovery);
+	LOG_DEBUG("[%s] Using capabilities cached in %s.", target_name(target),
+			riscv_capability_cache_file);
+	return discovery;
+}
+
+static void capability_cache_save(struct target *target,
+		const hart_discovery_t *discovery)
+{
+	RISCV013_INFO(info);
+
+	if (!riscv_capability_cache_file)
+		return;
+	FILE *file = fopen(riscv_capability_cache_file, "a");
+	if (!file) {
+		LOG_WARNING("Couldn't open %s: %s", riscv_capability_cache_file,
+				strerror(errno));
+		return;
+	}
+	fprintf(file, "hart %08" PRIx32 " %08" PRIx32 " %08" PRIx32 " %08" PRIx32
+			" %08" PRIx32 " %d %d %u %d %" PRIx64 "\n",
+			info->fingerprint[0], info->fingerprint[1], info->fingerprint[2],
+			info->fingerprint[3], info->fingerprint[4], discovery->hartid,
+			discovery->xlen, discovery->vlenb, discovery->progbuf_writable,
+			(uint64_t)discovery->progbuf_address);
+	fclose(file);
+}
+
+static unsigned int *busy_delay(riscv013_info_t *info, delay_class_t class)
+{
+	switch (class) {
+		case DELAY_DMI:
+			return &info->dmi_busy_delay;
+		case DELAY_ABSTRACT:
+			return &info->ac_busy_delay;
+		case DELAY_MEMORY:
+			return &info->memory_busy_delay;
+		case DELAY_SB_READ:
+			return &info->bus_master_read_delay;
+		case DELAY_SB_WRITE:
+		default:
+			return &info->bus_master_write_delay;
+	}
+}
+
+/* The last scan added to batch starts an operation of this class. Give it
+ * the time that operation has been found to need before the next scan. */
+static void batch_add_delay(const struct target *target,
+		struct riscv_batch *batch, delay_class_t class)
+{
+	unsigned int delay = *busy_delay(get_info(target), class);
+	if (class != DELAY_DMI && delay)
+		riscv_batch_add_idle(batch, delay);
+}
+
+static void log_busy_delays(riscv013_info_t *info)
+{
+	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d, "
+			"memory_busy_delay=%d, bus_master_read_delay=%d, "
+			"bus_master_write_delay=%d",
+			info->dtmcs_idle, info->dmi_busy_delay, info->ac_busy_delay,
+			info->memory_busy_delay, info->bus_master_read_delay,
+			info->bus_master_write_delay);
+}
+
+/* Start from the busy delays a previous session tuned for this DM, if the
+ * capability cache file has them. The last matching line wins. */
+static void busy_delay_cache_load(struct target *target)
+{
+	RISCV013_INFO(info);
+
+	if (!riscv_capability_cache_file)
+		return;
+	FILE *file = fopen(riscv_capability_cache_file, "r");
+	if (!file)
+		return;
+
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		uint32_t fingerprint[ARRAY_SIZE(info->fingerprint)];
+		unsigned int delay[DELAY_CLASS_COUNT];
+		if (sscanf(line, "delays %" SCNx32 " %" SCNx32 " %" SCNx32 " %" SCNx32
+					" %" SCNx32 " %u %u %u %u %u",
+					&fingerprint[0], &fingerprint[1], &fingerprint[2],
+					&fingerprint[3], &fingerprint[4], &delay[DELAY_DMI],
+					&delay[DELAY_ABSTRACT], &delay[DELAY_MEMORY],
+					&delay[DELAY_SB_READ], &delay[DELAY_SB_WRITE]) != 10)
+			continue;
+		if (memcmp(fingerprint, info->fingerprint, sizeof(fingerprint)))
+			continue;
+		for (unsigned i = 0; i < DELAY_CLASS_COUNT; i++)
+			*busy_delay(info, i) = delay[i];
+	}
+	fclose(file);
+	log_busy_delays(info);
+}
+
+static void busy_delay_cache_save(struct target *target)
+{
+	RISCV013_INFO(info);
+
+	if (!riscv_capability_cache_file)
+		return;
+	unsigned int delay[DELAY_CLASS_COUNT];
+	bool any = false;
+	for (unsigned i = 0; i < DELAY_CLASS_COUNT; i++) {
+		delay[i] = *busy_delay(info, i);
+		any |= delay[i] != 0;
+	}
+	if (!any)
+		return;
+	FILE *file = fopen(riscv_capability_cache_file, "a");
+	if (!file) {
+		LOG_WARNING("Couldn't open %s: %s", riscv_capability_cache_file,
+				strerror(errno));
+		return;
+	}
+	fprintf(file, "delays %08" PRIx32 " %08" PRIx32 " %08" PRIx32 " %08" PRIx32
+			" %08" PRIx32 " %u %u %u %u %u\n",
+			info->fingerprint[0], info->fingerprint[1], info->fingerprint[2],
+			info->fingerprint[3], info->fingerprint[4], delay[DELAY_DMI],
+			delay[DELAY_ABSTRACT], delay[DELAY_MEMORY], delay[DELAY_SB_READ],
+			delay[DELAY_SB_WRITE]);
+	fclose(file);
+}
+
+/* Forget what we think is in progbuf words [first, first + count). Anything
+ * that changes the program buffer without going through
+ * riscv013_write_debug_buffer() (the hart storing into it, or using it as
+ * scratch space) must call this, or a later program may be skipped because
+ * the cache claims it is already loaded. */
+static void progbuf_cache_invalidate(struct target *target, unsigned first,
+		unsigned count)
+{
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return;
+	for (unsigned i = first; i < first + count && i < ARRAY_SIZE(dm->progbuf_cache); i++)
+		dm->progbuf_cache[i] = 0;
+}
+
+#define DMCONTROL_SHADOW_MASK	(DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_NDMRESET | \
+		DM_DMCONTROL_HARTRESET | DM_DMCONTROL_HASEL | \
+		DM_DMCONTROL_HARTSELLO | DM_DMCONTROL_HARTSELHI)
+#define SBCS_SHADOW_MASK	(DM_SBCS_SBREADONADDR | DM_SBCS_SBACCESS | \
+		DM_SBCS_SBAUTOINCREMENT | DM_SBCS_SBREADONDATA)
+
+static void dm_shadow_invalidate(dm013_info_t *dm)
+{
+	memset(&dm->shadow, 0, sizeof(dm->shadow));
+}
+
+/* Keep the shadow up to date with a DMI write that the DTM accepted. */
+static void dm_shadow_update(dm013_info_t *dm, uint32_t address, uint32_t value)
+{
+	switch (address) {
+		case DM_DMCONTROL:
+			if (!get_field(value, DM_DMCONTROL_DMACTIVE))
+				/* This resets the whole DM. */
+				dm_shadow_invalidate(dm);
+			dm->shadow.dmcontrol = value & DMCONTROL_SHADOW_MASK;
+			dm->shadow.dmcontrol_valid = true;
+			break;
+		case DM_ABSTRACTAUTO:
+			dm->shadow.abstractauto = value;
+			dm->shadow.abstractauto_valid = true;
+			break;
+		case DM_SBCS:
+			dm->shadow.sbcs = value & SBCS_SHADOW_MASK;
+			dm->shadow.sbcs_valid = true;
+			/* With autoincrement, a transfer may carry into sbaddress1. */
+			if (get_field(value, DM_SBCS_SBAUTOINCREMENT))
+				memset(dm->shadow.sbaddress_valid, 0,
+						sizeof(dm->shadow.sbaddress_valid));
+			break;
+		case DM_SBADDRESS1:
+		case DM_SBADDRESS2:
+		case DM_SBADDRESS3:
+		{
+			unsigned i = address == DM_SBADDRESS1 ? 1 :
+				address == DM_SBADDRESS2 ? 2 : 3;
+			dm->shadow.sbaddress[i] = value;
+			dm->shadow.sbaddress_valid[i] = true;
+			break;
+		}
+	}
+}
+
 static uint32_t set_hartsel(uint32_t initial, uint32_t index)
 {
 	initial &= ~DM_DMCONTROL_HARTSELLO;
@@ -458,6 +801,7 @@ static uint32_t dtmcontrol_scan(struct target *target, uint32_t out)
 	int retval = jtag_execute_queue();
 	if (retval != ERROR_OK) {
 		LOG_ERROR("failed jtag scan: %d", retval);
+		vjtag_vir_invalidate(target->tap);
 		return retval;
 	}
 
@@ -467,14 +811,38 @@ static uint32_t dtmcontrol_scan(struct target *target, uint32_t out)
 	return in;
 }
 
-static void increase_dmi_busy_delay(struct target *target)
+/* The target was busy during an operation of this class. */
+static void increase_busy_delay(struct target *target, delay_class_t class)
+{
+	riscv013_info_t *info = get_info(target);
+	unsigned int *delay = busy_delay(info, class);
+	*delay += *delay / 10 + 1;
+	info->delay_successes[class] = 0;
+	log_busy_delays(info);
+}
+
+/* count operations of this class completed without the target being busy.
+ * Once enough of them have, try a slightly shorter delay, so that one slow
+ * operation doesn't slow everything down for the rest of the session. If
+ * that turns out to be too short, increase_busy_delay() will put it back. */
+static void busy_delay_succeeded(struct target *target, delay_class_t class,
+		unsigned int count)
 {
 	riscv013_info_t *info = get_info(target);
-	info->dmi_busy_delay += info->dmi_busy_delay / 10 + 1;
-	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
-			info->dtmcs_idle, info->dmi_busy_delay,
-			info->ac_busy_delay);
+	unsigned int *delay = busy_delay(info, class);
+	if (riscv_busy_delay_decay == 0 || *delay == 0)
+		return;
+	info->delay_successes[class] += count;
+	if (info->delay_successes[class] < riscv_busy_delay_decay)
+		return;
+	info->delay_successes[class] = 0;
+	*delay -= *delay / 20 + 1;
+	log_busy_delays(info);
+}
 
+static void increase_dmi_busy_delay(struct target *target)
+{
+	increase_busy_delay(target, DELAY_DMI);
 	dtmcontrol_scan(target, DTM_DTMCS_DMIRESET);
 }
 
@@ -504,6 +872,7 @@ static dmi_status_t dmi_scan(struct target *target, uint32_t *address_in,
 		if (r->reset_delays_wait < 0) {
 			info->dmi_busy_delay = 0;
 			info->ac_busy_delay = 0;
+			info->memory_busy_delay = 0;
 		}
 	}
 
@@ -536,9 +905,12 @@ static dmi_status_t dmi_scan(struct target *target, uint32_t *address_in,
 	if (idle_count)
 		jtag_add_runtest(idle_count, TAP_IDLE);
 
+	int64_t start_us = riscv_dmi_trace_now();
 	int retval = jtag_execute_queue();
 	if (retval != ERROR_OK) {
 		LOG_ERROR("dmi_scan failed jtag scan");
+		riscv_dmi_trace_scan(&field, start_us, true);
+		vjtag_vir_invalidate(target->tap);
 		if (data_in)
 			*data_in = ~0;
 		return DMI_STATUS_FAILED;
@@ -555,7 +927,11 @@ static dmi_status_t dmi_scan(struct target *target, uint32_t *address_in,
 	if (address_in)
 		*address_in = buf_get_u32(in, DTM_DMI_ADDRESS_OFFSET, info->abits);
 	dump_field(idle_count, &field);
-	return buf_get_u32(in, DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH);
+	riscv_dmi_trace_scan(&field, start_us, false);
+	dmi_status_t status = buf_get_u32(in, DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH);
+	if (status == DMI_STATUS_SUCCESS)
+		busy_delay_succeeded(target, DELAY_DMI, 1);
+	return status;
 }
 
 /**
@@ -578,6 +954,8 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 		bool *dmi_busy_encountered, int dmi_op, uint32_t address,
 		uint32_t data_out, int timeout_sec, bool exec, bool ensure_success)
 {
+	RISCV013_INFO(info);
+
 	select_dmi(target);
 
 	dmi_status_t status;
@@ -627,6 +1005,9 @@ static int dmi_op_timeout(struct target *target, uint32_t *data_in,
 		return ERROR_FAIL;
 	}
 
+	if (dmi_op == DMI_OP_WRITE && info->dm)
+		dm_shadow_update(info->dm, address, data_out);
+
 	if (ensure_success) {
 		/* This second loop ensures the request succeeded, and gets back data.
 		 * Note that NOP can result in a 'busy' result as well, but that would be
@@ -664,6 +1045,12 @@ static int dmi_op(struct target *target, uint32_t *data_in,
 {
 	int result = dmi_op_timeout(target, data_in, dmi_busy_encountered, dmi_op,
 			address, data_out, riscv_command_timeout_sec, exec, ensure_success);
+	if (result != ERROR_OK) {
+		/* We don't know what state the DM was left in. */
+		RISCV013_INFO(info);
+		if (info->dm)
+			dm_shadow_invalidate(info->dm);
+	}
 	if (result == ERROR_TIMEOUT_REACHED) {
 		LOG_ERROR("DMI operation didn't complete in %d seconds. The target is "
 				"either really slow or broken. You could increase the "
@@ -695,6 +1082,38 @@ static int dmi_write_exec(struct target *target, uint32_t address,
 	return dmi_op(target, NULL, NULL, DMI_OP_WRITE, address, value, true, ensure_success);
 }
 
+/* "riscv dmi_write" lets the user change DM registers in ways the shadow
+ * can't follow (eg. WARL fields that don't read back what was written). */
+static int riscv013_dmi_write(struct target *target, uint32_t address,
+		uint32_t value)
+{
+	int result = dmi_write(target, address, value);
+	RISCV013_INFO(info);
+	if (info->dm)
+		dm_shadow_invalidate(info->dm);
+	return result;
+}
+
+static int abstractauto_write(struct target *target, uint32_t value)
+{
+	RISCV013_INFO(info);
+	if (info->dm && info->dm->shadow.abstractauto_valid &&
+			info->dm->shadow.abstractauto == value)
+		return ERROR_OK;
+	return dmi_write(target, DM_ABSTRACTAUTO, value);
+}
+
+/* Write the sbcs fields that configure bus accesses. Use dmi_write() to clear
+ * sberror or sbbusyerror. */
+static int sbcs_config_write(struct target *target, uint32_t value)
+{
+	RISCV013_INFO(info);
+	assert((value & ~SBCS_SHADOW_MASK) == 0);
+	if (info->dm && info->dm->shadow.sbcs_valid && info->dm->shadow.sbcs == value)
+		return ERROR_OK;
+	return dmi_write(target, DM_SBCS, value);
+}
+
 int dmstatus_read_timeout(struct target *target, uint32_t *dmstatus,
 		bool authenticated, unsigned timeout_sec)
 {
@@ -726,11 +1145,7 @@ int dmstatus_read(struct target *target, uint32_t *dmstatus,
 
 static void increase_ac_busy_delay(struct target *target)
 {
-	riscv013_info_t *info = get_info(target);
-	info->ac_busy_delay += info->ac_busy_delay / 10 + 1;
-	LOG_DEBUG("dtmcs_idle=%d, dmi_busy_delay=%d, ac_busy_delay=%d",
-			info->dtmcs_idle, info->dmi_busy_delay,
-			info->ac_busy_delay);
+	increase_busy_delay(target, DELAY_ABSTRACT);
 }
 
 uint32_t abstract_register_size(unsigned width)
@@ -820,6 +1235,7 @@ static int execute_abstract_command(struct target *target, uint32_t command)
 		return ERROR_FAIL;
 	}
 
+	busy_delay_succeeded(target, DELAY_ABSTRACT, 1);
 	return ERROR_OK;
 }
 
@@ -1019,13 +1435,10 @@ static uint32_t access_memory_command(struct target *target, bool virtual,
 	return command;
 }
 
-static int examine_progbuf(struct target *target)
+static int discover_progbuf(struct target *target)
 {
 	riscv013_info_t *info = get_info(target);
 
-	if (info->progbuf_writable != YNM_MAYBE)
-		return ERROR_OK;
-
 	/* Figure out if progbuf is writable. */
 
 	if (info->progbufsize < 1) {
@@ -1050,6 +1463,8 @@ static int examine_progbuf(struct target *target)
 	riscv_program_init(&program, target);
 	riscv_program_insert(&program, sw(S0, S0, 0));
 	int result = riscv_program_exec(&program, target);
+	/* The sw (if it worked) just overwrote itself. */
+	progbuf_cache_invalidate(target, 0, 1);
 
 	if (register_write_direct(target, GDB_REGNO_S0, s0) != ERROR_OK)
 		return ERROR_FAIL;
@@ -1078,6 +1493,27 @@ static int examine_progbuf(struct target *target)
 	return ERROR_OK;
 }
 
+static int examine_progbuf(struct target *target)
+{
+	riscv013_info_t *info = get_info(target);
+	RISCV_INFO(r);
+
+	if (info->progbuf_writable != YNM_MAYBE)
+		return ERROR_OK;
+
+	int result = discover_progbuf(target);
+
+	dm013_info_t *dm = get_dm(target);
+	hart_discovery_t *discovery = dm ?
+		find_hart_discovery(dm, r->current_hartid) : NULL;
+	if (result == ERROR_OK && discovery && info->progbuf_writable != YNM_MAYBE) {
+		discovery->progbuf_writable = info->progbuf_writable;
+		discovery->progbuf_address = info->progbuf_address;
+		capability_cache_save(target, discovery);
+	}
+	return result;
+}
+
 static int is_fpu_reg(uint32_t gdb_regno)
 {
 	return (gdb_regno >= GDB_REGNO_FPR0 && gdb_regno <= GDB_REGNO_FPR31) ||
@@ -1211,6 +1647,10 @@ static int scratch_reserve(struct target *target,
 static int scratch_release(struct target *target,
 		scratch_mem_t *scratch)
 {
+	/* The hart may have stored into progbuf scratch space behind our back. */
+	if (scratch->memory_space == SPACE_DMI_PROGBUF)
+		progbuf_cache_invalidate(target, scratch->debug_address, 2);
+
 	if (scratch->area)
 		return target_free_working_area(target, scratch->area);
 
@@ -1266,6 +1706,7 @@ static int scratch_write64(struct target *target, scratch_mem_t *scratch,
 			dmi_write(target, DM_DATA1 + scratch->debug_address, value >> 32);
 			break;
 		case SPACE_DMI_PROGBUF:
+			progbuf_cache_invalidate(target, scratch->debug_address, 2);
 			dmi_write(target, DM_PROGBUF0 + scratch->debug_address, value);
 			dmi_write(target, DM_PROGBUF1 + scratch->debug_address, value >> 32);
 			break;
@@ -1421,7 +1862,9 @@ static int register_read(struct target *target, uint64_t *value, uint32_t number
 		return ERROR_FAIL;
 	if (target->reg_cache) {
 		struct reg *reg = &target->reg_cache->reg_list[number];
-		buf_set_u64(reg->value, 0, reg->size, *value);
+		/* Don't clobber a write that hasn't been flushed to the hart yet. */
+		if (!reg->dirty)
+			buf_set_u64(reg->value, 0, reg->size, *value);
 	}
 	return ERROR_OK;
 }
@@ -1540,6 +1983,8 @@ static void deinit_target(struct target *target)
 {
 	LOG_DEBUG("riscv_deinit_target()");
 	riscv_info_t *info = (riscv_info_t *) target->arch_info;
+	if (info->version_specific && target_was_examined(target))
+		busy_delay_cache_save(target);
 	free(info->version_specific);
 	/* TODO: free register arch_info */
 	info->version_specific = NULL;
@@ -1547,13 +1992,16 @@ static void deinit_target(struct target *target)
 
 static int set_haltgroup(struct target *target, bool *supported)
 {
-	uint32_t write = set_field(DM_DMCS2_HGWRITE, DM_DMCS2_GROUP, target->smp);
+	RISCV_INFO(r);
+	/* group 0 halts on its own */
+	unsigned group = r->non_stop ? 0 : target->smp;
+	uint32_t write = set_field(DM_DMCS2_HGWRITE, DM_DMCS2_GROUP, group);
 	if (dmi_write(target, DM_DMCS2, write) != ERROR_OK)
 		return ERROR_FAIL;
 	uint32_t read;
 	if (dmi_read(target, &read, DM_DMCS2) != ERROR_OK)
 		return ERROR_FAIL;
-	*supported = get_field(read, DM_DMCS2_GROUP) == (unsigned)target->smp;
+	*supported = get_field(read, DM_DMCS2_GROUP) == group;
 	return ERROR_OK;
 }
 
@@ -1575,6 +2023,76 @@ static int discover_vlenb(struct target *target)
 	return ERROR_OK;
 }
 
+/* Count the harts on this DM, and acknowledge any that were reset. Selecting
+ * a hart and reading dmstatus are queued for 32 harts at a time, instead of
+ * taking two round trips for every hart. */
+static int enumerate_harts(struct target *target)
+{
+	RISCV013_INFO(info);
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return ERROR_FAIL;
+
+	unsigned hart_limit = MIN(RISCV_MAX_HARTS, 1 << info->hartsellen);
+	unsigned first = 0;
+	dm->hart_count = 0;
+	while (first < hart_limit) {
+		unsigned n = MIN(hart_limit - first, 32);
+		size_t keys[32];
+
+		struct riscv_batch *batch = riscv_batch_alloc(target, n * 2,
+				info->dmi_busy_delay);
+		if (!batch)
+			return ERROR_FAIL;
+		for (unsigned k = 0; k < n; k++) {
+			riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+					set_hartsel(DM_DMCONTROL_DMACTIVE, first + k));
+			keys[k] = riscv_batch_add_dmi_read(batch, DM_DMSTATUS);
+		}
+		/* hartsel no longer matches what select_current_hart() thinks. */
+		dm->current_hartid = -1;
+		if (batch_run(target, batch) != ERROR_OK) {
+			riscv_batch_free(batch);
+			return ERROR_FAIL;
+		}
+
+		bool done = false;
+		bool retry = false;
+		for (unsigned k = 0; k < n && !done; k++) {
+			uint32_t s;
+			if (riscv_batch_get_dmi_read_op(batch, keys[k]) != DMI_STATUS_SUCCESS) {
+				/* Clear the busy state, and do this group again. */
+				batch_get_status_read(target, batch, keys[k], DM_DMSTATUS, &s,
+						NULL);
+				retry = true;
+				break;
+			}
+			s = riscv_batch_get_dmi_read_data(batch, keys[k]);
+			if (get_field(s, DM_DMSTATUS_ANYNONEXISTENT)) {
+				done = true;
+				break;
+			}
+			dm->hart_count = first + k + 1;
+
+			if (get_field(s, DM_DMSTATUS_ANYHAVERESET))
+				dmi_write(target, DM_DMCONTROL,
+						set_hartsel(DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_ACKHAVERESET,
+							first + k));
+		}
+		riscv_batch_free(batch);
+
+		if (done)
+			break;
+		if (retry) {
+			first = dm->hart_count;
+			continue;
+		}
+		first += n;
+	}
+
+	return ERROR_OK;
+}
+
 static int examine(struct target *target)
 {
 	/* Don't need to select dbus, since the first thing we do is read dtmcontrol. */
@@ -1610,6 +2128,8 @@ static int examine(struct target *target)
 		dmi_write(target, DM_DMCONTROL, 0);
 		dmi_write(target, DM_DMCONTROL, DM_DMCONTROL_DMACTIVE);
 		dm->was_reset = true;
+		memset(dm->progbuf_cache, 0, sizeof(dm->progbuf_cache));
+		dm_shadow_invalidate(dm);
 	}
 
 	dmi_write(target, DM_DMCONTROL, DM_DMCONTROL_HARTSELLO |
@@ -1679,6 +2199,19 @@ static int examine(struct target *target)
 
 	LOG_INFO("datacount=%d progbufsize=%d", info->datacount, info->progbufsize);
 
+	info->fingerprint[0] = target->tap->hasidcode ? target->tap->idcode : 0;
+	info->fingerprint[1] = dmstatus & (DM_DMSTATUS_IMPEBREAK |
+			DM_DMSTATUS_HASRESETHALTREQ | DM_DMSTATUS_CONFSTRPTRVALID |
+			DM_DMSTATUS_VERSION);
+	info->fingerprint[2] = hartinfo;
+	info->fingerprint[3] = abstractcs & (DM_ABSTRACTCS_PROGBUFSIZE |
+			DM_ABSTRACTCS_DATACOUNT);
+	info->fingerprint[4] = info->sbcs & (DM_SBCS_SBVERSION | DM_SBCS_SBASIZE |
+			DM_SBCS_SBACCESS128 | DM_SBCS_SBACCESS64 | DM_SBCS_SBACCESS32 |
+			DM_SBCS_SBACCESS16 | DM_SBCS_SBACCESS8);
+
+	busy_delay_cache_load(target);
+
 	RISCV_INFO(r);
 	r->impebreak = get_field(dmstatus, DM_DMSTATUS_IMPEBREAK);
 
@@ -1698,23 +2231,8 @@ static int examine(struct target *target)
 
 	/* Before doing anything else we must first enumerate the harts. */
 	if (dm->hart_count < 0) {
-		for (int i = 0; i < MIN(RISCV_MAX_HARTS, 1 << info->hartsellen); ++i) {
-			r->current_hartid = i;
-			if (riscv013_select_current_hart(target) != ERROR_OK)
-				return ERROR_FAIL;
-
-			uint32_t s;
-			if (dmstatus_read(target, &s, true) != ERROR_OK)
-				return ERROR_FAIL;
-			if (get_field(s, DM_DMSTATUS_ANYNONEXISTENT))
-				break;
-			dm->hart_count = i + 1;
-
-			if (get_field(s, DM_DMSTATUS_ANYHAVERESET))
-				dmi_write(target, DM_DMCONTROL,
-						set_hartsel(DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_ACKHAVERESET, i));
-		}
-
+		if (enumerate_harts(target) != ERROR_OK)
+			return ERROR_FAIL;
 		LOG_DEBUG("Detected %d harts.", dm->hart_count);
 	}
 
@@ -1743,11 +2261,22 @@ static int examine(struct target *target)
 		* program buffer. */
 	r->debug_buffer_size = info->progbufsize;
 
-	int result = register_read_abstract(target, NULL, GDB_REGNO_S0, 64);
-	if (result == ERROR_OK)
-		r->xlen = 64;
-	else
-		r->xlen = 32;
+	hart_discovery_t *discovery = find_hart_discovery(dm, r->current_hartid);
+	if (!discovery)
+		discovery = capability_cache_load(target);
+	if (discovery) {
+		r->xlen = discovery->xlen;
+		if (discovery->progbuf_writable != YNM_MAYBE) {
+			info->progbuf_writable = discovery->progbuf_writable;
+			info->progbuf_address = discovery->progbuf_address;
+		}
+	} else {
+		int result = register_read_abstract(target, NULL, GDB_REGNO_S0, 64);
+		if (result == ERROR_OK)
+			r->xlen = 64;
+		else
+			r->xlen = 32;
+	}
 
 	if (register_read(target, &r->misa, GDB_REGNO_MISA)) {
 		LOG_ERROR("Fatal: Failed to read MISA from hart %d.", r->current_hartid);
@@ -1755,8 +2284,23 @@ static int examine(struct target *target)
 	}
 
 	if (riscv_supports_extension(target, 'V')) {
-		if (discover_vlenb(target) != ERROR_OK)
+		if (discovery) {
+			r->vlenb = discovery->vlenb;
+		} else if (discover_vlenb(target) != ERROR_OK) {
+			return ERROR_FAIL;
+		}
+	}
+
+	if (!discovery) {
+		discovery = calloc(1, sizeof(*discovery));
+		if (!discovery)
 			return ERROR_FAIL;
+		discovery->hartid = r->current_hartid;
+		discovery->xlen = r->xlen;
+		discovery->vlenb = r->vlenb;
+		discovery->progbuf_writable = YNM_MAYBE;
+		list_add(&discovery->list, &dm->hart_discovery);
+		capability_cache_save(target, discovery);
 	}
 
 	/* Now init registers based on what we discovered. */
@@ -1964,6 +2508,59 @@ static int cleanup_after_vector_access(struct target *target, uint64_t vtype,
 	return ERROR_OK;
 }
 
+/**
+ * Move a whole vector register through a working area using vs1r.v/vl1re8.v.
+ * Whole-register moves ignore vtype and vl, so this avoids saving/restoring
+ * them and executing one program per element. The caller must have saved s0
+ * and enabled mstatus.VS. Anything other than ERROR_OK means the register was
+ * not transferred and the caller should use the element-by-element path.
+ */
+static int vector_transfer_via_ram(struct target *target, unsigned vnum,
+		uint8_t *read_value, const uint8_t *write_value)
+{
+	RISCV_INFO(r);
+	unsigned size = r->vlenb;
+	if (size == 0 || size % 4 || !has_sufficient_progbuf(target, 2))
+		return ERROR_FAIL;
+
+	/* Whole-register moves start at vstart, which would leave a hole. */
+	riscv_reg_t vstart;
+	if (register_read(target, &vstart, GDB_REGNO_VSTART) != ERROR_OK || vstart != 0)
+		return ERROR_FAIL;
+
+	/* DM data and progbuf scratch space is too small to hold a vector
+	 * register on any real implementation, so only use a working area. */
+	scratch_mem_t scratch = { .memory_space = SPACE_DMI_RAM };
+	if (target_alloc_working_area_try(target, size + 3, &scratch.area) != ERROR_OK)
+		return ERROR_FAIL;
+	scratch.hart_address = (scratch.area->address + 3) & ~3ULL;
+	scratch.debug_address = scratch.hart_address;
+
+	struct riscv_program program;
+	riscv_program_init(&program, target);
+	if (write_value)
+		riscv_program_insert(&program, vl1re8_v(vnum, S0));
+	else
+		riscv_program_insert(&program, vs1r_v(vnum, S0));
+
+	int result = ERROR_FAIL;
+	if (write_value && write_memory(target, scratch.debug_address, 4,
+				size / 4, write_value) != ERROR_OK)
+		goto release;
+	if (register_write_direct(target, GDB_REGNO_S0, scratch.hart_address) != ERROR_OK)
+		goto release;
+	if (riscv_program_exec(&program, target) != ERROR_OK)
+		goto release;
+	if (read_value && read_memory(target, scratch.debug_address, 4,
+				size / 4, read_value, 4) != ERROR_OK)
+		goto release;
+	result = ERROR_OK;
+
+release:
+	scratch_release(target, &scratch);
+	return result;
+}
+
 static int riscv013_get_register_buf(struct target *target,
 		uint8_t *value, int regno)
 {
@@ -1980,12 +2577,18 @@ static int riscv013_get_register_buf(struct target *target,
 	if (prep_for_register_access(target, &mstatus, regno) != ERROR_OK)
 		return ERROR_FAIL;
 
+	unsigned vnum = regno - GDB_REGNO_V0;
+	if (vector_transfer_via_ram(target, vnum, value, NULL) == ERROR_OK) {
+		if (cleanup_after_register_access(target, mstatus, regno) != ERROR_OK)
+			return ERROR_FAIL;
+		return register_write_direct(target, GDB_REGNO_S0, s0);
+	}
+
 	uint64_t vtype, vl;
 	unsigned debug_vl;
 	if (prep_for_vector_access(target, &vtype, &vl, &debug_vl) != ERROR_OK)
 		return ERROR_FAIL;
 
-	unsigned vnum = regno - GDB_REGNO_V0;
 	unsigned xlen = riscv_xlen(target);
 
 	struct riscv_program program;
@@ -2039,12 +2642,18 @@ static int riscv013_set_register_buf(struct target *target,
 	if (prep_for_register_access(target, &mstatus, regno) != ERROR_OK)
 		return ERROR_FAIL;
 
+	unsigned vnum = regno - GDB_REGNO_V0;
+	if (vector_transfer_via_ram(target, vnum, NULL, value) == ERROR_OK) {
+		if (cleanup_after_register_access(target, mstatus, regno) != ERROR_OK)
+			return ERROR_FAIL;
+		return register_write_direct(target, GDB_REGNO_S0, s0);
+	}
+
 	uint64_t vtype, vl;
 	unsigned debug_vl;
 	if (prep_for_vector_access(target, &vtype, &vl, &debug_vl) != ERROR_OK)
 		return ERROR_FAIL;
 
-	unsigned vnum = regno - GDB_REGNO_V0;
 	unsigned xlen = riscv_xlen(target);
 
 	struct riscv_program program;
@@ -2095,16 +2704,42 @@ static int sb_write_address(struct target *target, target_addr_t address,
 	RISCV013_INFO(info);
 	unsigned sbasize = get_field(info->sbcs, DM_SBCS_SBASIZE);
 	/* There currently is no support for >64-bit addresses in OpenOCD. */
-	if (sbasize > 96)
-		dmi_op(target, NULL, NULL, DMI_OP_WRITE, DM_SBADDRESS3, 0, false, false);
-	if (sbasize > 64)
-		dmi_op(target, NULL, NULL, DMI_OP_WRITE, DM_SBADDRESS2, 0, false, false);
-	if (sbasize > 32)
-		dmi_op(target, NULL, NULL, DMI_OP_WRITE, DM_SBADDRESS1, address >> 32, false, false);
+	uint32_t high[4] = {0, address >> 32, 0, 0};
+	for (unsigned i = 3; i >= 1; i--) {
+		if (sbasize <= 32 * i)
+			continue;
+		if (info->dm && info->dm->shadow.sbaddress_valid[i] &&
+				info->dm->shadow.sbaddress[i] == high[i])
+			continue;
+		static const uint32_t sbaddress[4] = {DM_SBADDRESS0, DM_SBADDRESS1,
+			DM_SBADDRESS2, DM_SBADDRESS3};
+		dmi_op(target, NULL, NULL, DMI_OP_WRITE, sbaddress[i], high[i],
+				false, false);
+	}
 	return dmi_op(target, NULL, NULL, DMI_OP_WRITE, DM_SBADDRESS0, address,
 				  false, ensure_success);
 }
 
+static bool batch_writes_shadowed(const riscv013_info_t *info,
+		const struct riscv_batch *batch)
+{
+	for (size_t i = 0; i < batch->used_scans; i++) {
+		const uint8_t *out = batch->fields[i].out_value;
+		if (buf_get_u32(out, DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH) != DMI_OP_WRITE)
+			continue;
+		switch (buf_get_u32(out, DTM_DMI_ADDRESS_OFFSET, info->abits)) {
+			case DM_DMCONTROL:
+			case DM_ABSTRACTAUTO:
+			case DM_SBCS:
+			case DM_SBADDRESS1:
+			case DM_SBADDRESS2:
+			case DM_SBADDRESS3:
+				return true;
+		}
+	}
+	return false;
+}
+
 static int batch_run(const struct target *target, struct riscv_batch *batch)
 {
 	RISCV013_INFO(info);
@@ -2113,20 +2748,63 @@ static int batch_run(const struct target *target, struct riscv_batch *batch)
 		r->reset_delays_wait -= batch->used_scans;
 		if (r->reset_delays_wait <= 0) {
 			batch->idle_count = 0;
+			memset(batch->scan_idle, 0,
+					batch->used_scans * sizeof(*batch->scan_idle));
 			info->dmi_busy_delay = 0;
 			info->ac_busy_delay = 0;
+			info->memory_busy_delay = 0;
 		}
 	}
-	return riscv_batch_run(batch);
+	/* Batches don't keep the DM shadow up to date, so forget it if this one
+	 * writes any of the registers in there. */
+	if (info->dm && batch_writes_shadowed(info, batch))
+		dm_shadow_invalidate(info->dm);
+	int result = riscv_batch_run(batch);
+	if (result == ERROR_OK)
+		busy_delay_succeeded((struct target *)target, DELAY_DMI, batch->used_scans);
+	return result;
 }
 
-static int sba_supports_access(struct target *target, unsigned size_bytes)
+/* Get the result of a status register read that was queued at the end of a
+ * batch. This lets bulk transfers check how they did without a separate
+ * round trip after every batch. If the DMI was busy at any point in the batch
+ * (busy is sticky, so the last read sees it), the busy state is cleared, the
+ * register is read again directly, and dmi_busy_encountered is set. */
+static int batch_get_status_read(struct target *target,
+		struct riscv_batch *batch, size_t key, uint32_t address,
+		uint32_t *value, bool *dmi_busy_encountered)
 {
-	RISCV013_INFO(info);
-	switch (size_bytes) {
-		case 1:
-			return get_field(info->sbcs, DM_SBCS_SBACCESS8);
-		case 2:
+	dmi_status_t status = riscv_batch_get_dmi_read_op(batch, key);
+
+	if (dmi_busy_encountered)
+		*dmi_busy_encountered = false;
+
+	if (status == DMI_STATUS_SUCCESS) {
+		*value = riscv_batch_get_dmi_read_data(batch, key);
+		return ERROR_OK;
+	}
+
+	if (status == DMI_STATUS_BUSY) {
+		increase_dmi_busy_delay(target);
+		if (dmi_busy_encountered)
+			*dmi_busy_encountered = true;
+	}
+
+	bool busy_again;
+	int result = dmi_op(target, value, &busy_again, DMI_OP_READ, address, 0,
+			false, true);
+	if (dmi_busy_encountered && busy_again)
+		*dmi_busy_encountered = true;
+	return result;
+}
+
+static int sba_supports_access(struct target *target, unsigned size_bytes)
+{
+	RISCV013_INFO(info);
+	switch (size_bytes) {
+		case 1:
+			return get_field(info->sbcs, DM_SBCS_SBACCESS8);
+		case 2:
 			return get_field(info->sbcs, DM_SBCS_SBACCESS16);
 		case 4:
 			return get_field(info->sbcs, DM_SBCS_SBACCESS32);
@@ -2139,6 +2817,19 @@ static int sba_supports_access(struct target *target, unsigned size_bytes)
 	}
 }
 
+static bool riscv013_can_access_memory_running(struct target *target,
+		uint32_t size)
+{
+	RISCV_INFO(r);
+	if (!sba_supports_access(target, size))
+		return false;
+	for (unsigned i = 0; i < RISCV_NUM_MEM_ACCESS_METHODS; i++) {
+		if (r->mem_access_methods[i] == RISCV_MEM_ACCESS_SYSBUS)
+			return true;
+	}
+	return false;
+}
+
 static int sample_memory_bus_v1(struct target *target,
 								riscv_sample_buf_t *buf,
 								const riscv_sample_config_t *config,
@@ -2180,8 +2871,7 @@ static int sample_memory_bus_v1(struct target *target,
 		 * loop.
 		 */
 		struct riscv_batch *batch = riscv_batch_alloc(
-			target, 1 + enabled_count * 5 * repeat,
-			info->dmi_busy_delay + info->bus_master_read_delay);
+			target, 1 + enabled_count * 5 * repeat, info->dmi_busy_delay);
 
 		unsigned result_bytes = 0;
 		for (unsigned n = 0; n < repeat; n++) {
@@ -2214,11 +2904,14 @@ static int sample_memory_bus_v1(struct target *target,
 							sbaddress0 != (config->bucket[i].address & 0xffffffff)) {
 						sbaddress0 = config->bucket[i].address;
 						riscv_batch_add_dmi_write(batch, DM_SBADDRESS0, sbaddress0);
+						batch_add_delay(target, batch, DELAY_SB_READ);
 						sbaddress0_valid = true;
 					}
 					if (config->bucket[i].size_bytes > 4)
 						riscv_batch_add_dmi_read(batch, DM_SBDATA1);
 					riscv_batch_add_dmi_read(batch, DM_SBDATA0);
+					if (enabled_count == 1)
+						batch_add_delay(target, batch, DELAY_SB_READ);
 					result_bytes += 1 + config->bucket[i].size_bytes;
 				}
 			}
@@ -2239,7 +2932,7 @@ static int sample_memory_bus_v1(struct target *target,
 		if (get_field(sbcs_read, DM_SBCS_SBBUSYERROR)) {
 			/* Discard this batch (too much hassle to try to recover partial
 			 * data) and try again with a larger delay. */
-			info->bus_master_read_delay += info->bus_master_read_delay / 10 + 1;
+			increase_busy_delay(target, DELAY_SB_READ);
 			dmi_write(target, DM_SBCS, sbcs_read | DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR);
 			riscv_batch_free(batch);
 			continue;
@@ -2300,6 +2993,10 @@ static int init_target(struct command_context *cmd_ctx,
 	generic_info->resume_go = &riscv013_resume_go;
 	generic_info->step_current_hart = &riscv013_step_current_hart;
 	generic_info->on_halt = &riscv013_on_halt;
+	generic_info->prefetch_registers = &riscv013_prefetch_registers;
+	generic_info->read_csrs = &riscv013_read_csrs;
+	generic_info->read_triggers = &riscv013_read_triggers;
+	generic_info->can_access_memory_running = &riscv013_can_access_memory_running;
 	generic_info->resume_prep = &riscv013_resume_prep;
 	generic_info->halt_prep = &riscv013_halt_prep;
 	generic_info->halt_go = &riscv013_halt_go;
@@ -2315,8 +3012,9 @@ static int init_target(struct command_context *cmd_ctx,
 	generic_info->authdata_read = &riscv013_authdata_read;
 	generic_info->authdata_write = &riscv013_authdata_write;
 	generic_info->dmi_read = &dmi_read;
-	generic_info->dmi_write = &dmi_write;
+	generic_info->dmi_write = &riscv013_dmi_write;
 	generic_info->read_memory = read_memory;
+	generic_info->read_memory_batch = read_memory_batch;
 	generic_info->test_sba_config_reg = &riscv013_test_sba_config_reg;
 	generic_info->hart_count = &riscv013_hart_count;
 	generic_info->data_bits = &riscv013_data_bits;
@@ -2325,6 +3023,11 @@ static int init_target(struct command_context *cmd_ctx,
 	if (!generic_info->version_specific)
 		return ERROR_FAIL;
 	generic_info->sample_memory = sample_memory;
+	generic_info->sample_pc = riscv013_sample_pc;
+	generic_info->group_halted = riscv013_group_halted;
+	generic_info->snapshot_group = riscv013_snapshot_group;
+	generic_info->set_halt_group = set_haltgroup;
+	generic_info->write_memory_parallel = riscv013_write_memory_parallel;
 	riscv013_info_t *info = get_info(target);
 
 	info->progbufsize = -1;
@@ -2345,7 +3048,172 @@ static int init_target(struct command_context *cmd_ctx,
 	info->abstract_write_fpr_supported = true;
 
 	info->has_aampostincrement = YNM_MAYBE;
+	info->has_aarpostincrement = YNM_MAYBE;
+
+	return ERROR_OK;
+}
+
+/* Whether the whole SMP group can be reset at once through hasel: every hart
+ * is on this target's DM, and none of them has a reset-assert script. */
+static bool group_reset_supported(struct target *target)
+{
+	dm013_info_t *dm = get_dm(target);
+	if (!dm || !dm->hasel_supported || !dm->hart_count || !target->smp ||
+			target->rtos)
+		return false;
+
+	unsigned window_count = (dm->hart_count + 31) / 32;
+	unsigned count = 0;
+	for (struct target_list *list = target->head; list; list = list->next) {
+		struct target *t = list->target;
+		if (get_dm(t) != dm || get_info(t)->index >= window_count * 32 ||
+				target_has_event_action(t, TARGET_EVENT_RESET_ASSERT))
+			return false;
+		count++;
+	}
+	return count > 1;
+}
+
+static void set_group_reset(struct target *target, bool group_reset)
+{
+	get_dm(target)->group_reset_asserted = group_reset;
+	for (struct target_list *list = target->head; list; list = list->next)
+		get_info(list->target)->group_reset = group_reset;
+}
+
+/* Queue the writes that put every hart of the SMP group in the hart array
+ * window, then write dmcontrol with hasel and the given fields set. */
+static void batch_add_group_dmcontrol(struct target *target,
+		struct riscv_batch *batch, uint32_t control)
+{
+	RISCV013_INFO(info);
+	dm013_info_t *dm = get_dm(target);
+	unsigned window_count = (dm->hart_count + 31) / 32;
+	uint32_t hawindow[window_count];
+	memset(hawindow, 0, sizeof(uint32_t) * window_count);
+
+	for (struct target_list *list = target->head; list; list = list->next) {
+		unsigned index = get_info(list->target)->index;
+		hawindow[index / 32] |= 1 << (index % 32);
+	}
+
+	for (unsigned i = 0; i < window_count; i++) {
+		riscv_batch_add_dmi_write(batch, DM_HAWINDOWSEL, i);
+		riscv_batch_add_dmi_write(batch, DM_HAWINDOW, hawindow[i]);
+	}
+	riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+			set_hartsel(control | DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_HASEL,
+				info->index));
+	dm->current_hartid = -1;
+}
+
+/* Assert ndmreset with haltreq set for all harts of the SMP group in one
+ * batch, instead of once per hart. */
+static int assert_reset_group(struct target *target)
+{
+	RISCV013_INFO(info);
+	dm013_info_t *dm = get_dm(target);
+	unsigned window_count = (dm->hart_count + 31) / 32;
+
+	struct riscv_batch *batch = riscv_batch_alloc(target, 2 * window_count + 2,
+			info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+
+	uint32_t control = set_field(0, DM_DMCONTROL_HALTREQ, target->reset_halt ? 1 : 0);
+	control = set_field(control, DM_DMCONTROL_NDMRESET, 1);
+	batch_add_group_dmcontrol(target, batch, control);
+	size_t key = riscv_batch_add_dmi_read(batch, DM_DMSTATUS);
+
+	int result = batch_run(target, batch);
+	if (result == ERROR_OK)
+		result = group_batch_status(target, batch, key);
+	riscv_batch_free(batch);
+	if (result != ERROR_OK) {
+		LOG_DEBUG("group reset failed; resetting harts one at a time");
+		return result;
+	}
+
+	LOG_DEBUG("asserted reset for all harts in the group");
+	set_group_reset(target, true);
+	return ERROR_OK;
+}
+
+/* Take the whole SMP group out of reset, wait until all of its harts are
+ * available (and halted, for reset halt) and acknowledge havereset for all
+ * of them at once. dmstatus is read with hasel set, so its any/all fields
+ * cover the group. Polling starts without a delay and backs off to 10 ms. */
+static int deassert_reset_group(struct target *target)
+{
+	RISCV013_INFO(info);
+	dm013_info_t *dm = get_dm(target);
+	unsigned window_count = (dm->hart_count + 31) / 32;
+	int dmi_busy_delay = info->dmi_busy_delay;
+
+	uint32_t control = set_field(0, DM_DMCONTROL_HALTREQ, target->reset_halt ? 1 : 0);
+
+	struct riscv_batch *batch = riscv_batch_alloc(target, 2 * window_count + 2,
+			info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+	batch_add_group_dmcontrol(target, batch, control);
+	size_t key = riscv_batch_add_dmi_read(batch, DM_DMSTATUS);
+	int result = batch_run(target, batch);
+	if (result == ERROR_OK)
+		result = group_batch_status(target, batch, key);
+	uint32_t dmstatus = riscv_batch_get_dmi_read_data(batch, key);
+	riscv_batch_free(batch);
+	if (result != ERROR_OK)
+		return result;
+
+	time_t start = time(NULL);
+	unsigned delay_us = 0;
+	while (get_field(dmstatus, DM_DMSTATUS_ANYUNAVAIL) ||
+			get_field(dmstatus, DM_DMSTATUS_ANYNONEXISTENT) ||
+			(target->reset_halt && !get_field(dmstatus, DM_DMSTATUS_ALLHALTED))) {
+		if (time(NULL) - start > riscv_reset_timeout_sec) {
+			LOG_ERROR("Harts in the group didn't leave reset in %ds; "
+					"dmstatus=0x%x; "
+					"Increase the timeout with riscv set_reset_timeout_sec.",
+					riscv_reset_timeout_sec, dmstatus);
+			return ERROR_FAIL;
+		}
+		if (delay_us) {
+			usleep(delay_us);
+			keep_alive();
+		}
+		delay_us = delay_us ? MIN(2 * delay_us, 10000) : 100;
+
+		result = dmstatus_read_timeout(target, &dmstatus, true,
+				riscv_reset_timeout_sec);
+		if (result == ERROR_TIMEOUT_REACHED)
+			LOG_ERROR("Group didn't complete a DMI read coming out of "
+					"reset in %ds; Increase the timeout with riscv "
+					"set_reset_timeout_sec.", riscv_reset_timeout_sec);
+		if (result != ERROR_OK)
+			return result;
+	}
+
+	/* Ack reset for every hart, then stop selecting the group. */
+	batch = riscv_batch_alloc(target, 2, info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+	if (get_field(dmstatus, DM_DMSTATUS_ANYHAVERESET))
+		riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+				set_hartsel(control | DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_HASEL |
+					DM_DMCONTROL_ACKHAVERESET, info->index));
+	riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+			set_hartsel(control | DM_DMCONTROL_DMACTIVE, info->index));
+	result = batch_run(target, batch);
+	riscv_batch_free(batch);
+	if (result != ERROR_OK)
+		return result;
 
+	for (struct target_list *list = target->head; list; list = list->next)
+		list->target->state = TARGET_HALTED;
+
+	info->dmi_busy_delay = dmi_busy_delay;
+	LOG_DEBUG("all harts in the group are out of reset");
 	return ERROR_OK;
 }
 
@@ -2360,6 +3228,11 @@ static int assert_reset(struct target *target)
 	if (target_has_event_action(target, TARGET_EVENT_RESET_ASSERT)) {
 		/* Run the user-supplied script if there is one. */
 		target_handle_event(target, TARGET_EVENT_RESET_ASSERT);
+	} else if (get_info(target)->group_reset) {
+		/* Another hart in the SMP group already reset all of them. */
+	} else if (group_reset_supported(target) &&
+			assert_reset_group(target) == ERROR_OK) {
+		/* Reset the whole SMP group at once. */
 	} else if (target->rtos) {
 		/* There's only one target, and OpenOCD thinks each hart is a thread.
 		 * We must reset them all. */
@@ -2397,6 +3270,7 @@ static int assert_reset(struct target *target)
 	 * involves SRST being toggled. So clear our cache which may be out of
 	 * date. */
 	memset(dm->progbuf_cache, 0, sizeof(dm->progbuf_cache));
+	dm_shadow_invalidate(dm);
 
 	return ERROR_OK;
 }
@@ -2407,6 +3281,23 @@ static int deassert_reset(struct target *target)
 	RISCV013_INFO(info);
 	select_dmi(target);
 
+	dm013_info_t *dm = get_dm(target);
+	if (dm && dm->group_reset_asserted) {
+		int result = deassert_reset_group(target);
+		if (result == ERROR_OK) {
+			dm->group_reset_asserted = false;
+			info->group_reset = false;
+			return ERROR_OK;
+		}
+		/* Let every hart come out of reset on its own. */
+		LOG_DEBUG("group deassert failed; waiting for harts one at a time");
+		set_group_reset(target, false);
+	} else if (info->group_reset) {
+		/* deassert_reset_group() took care of this hart. */
+		info->group_reset = false;
+		return ERROR_OK;
+	}
+
 	/* Clear the reset, but make sure haltreq is still set */
 	uint32_t control = 0;
 	control = set_field(control, DM_DMCONTROL_HALTREQ, target->reset_halt ? 1 : 0);
@@ -2558,8 +3449,14 @@ static int read_sbcs_nonbusy(struct target *target, uint32_t *sbcs)
 	while (1) {
 		if (dmi_read(target, sbcs, DM_SBCS) != ERROR_OK)
 			return ERROR_FAIL;
-		if (!get_field(*sbcs, DM_SBCS_SBBUSY))
+		if (!get_field(*sbcs, DM_SBCS_SBBUSY)) {
+			RISCV013_INFO(info);
+			if (info->dm) {
+				info->dm->shadow.sbcs = *sbcs & SBCS_SHADOW_MASK;
+				info->dm->shadow.sbcs_valid = true;
+			}
 			return ERROR_OK;
+		}
 		if (time(NULL) - start > riscv_command_timeout_sec) {
 			LOG_ERROR("Timed out after %ds waiting for sbbusy to go low (sbcs=0x%x). "
 					"Increase the timeout with riscv set_command_timeout_sec.",
@@ -2708,7 +3605,7 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 			sbcs_write = set_field(sbcs_write, DM_SBCS_SBAUTOINCREMENT, 1);
 		if (count > 1)
 			sbcs_write = set_field(sbcs_write, DM_SBCS_SBREADONDATA, count > 1);
-		if (dmi_write(target, DM_SBCS, sbcs_write) != ERROR_OK)
+		if (sbcs_config_write(target, sbcs_write) != ERROR_OK)
 			return ERROR_FAIL;
 
 		/* This address write will trigger the first read. */
@@ -2783,7 +3680,7 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 				return ERROR_FAIL;
 
 			sbcs_write = set_field(sbcs_write, DM_SBCS_SBREADONDATA, 0);
-			if (dmi_write(target, DM_SBCS, sbcs_write) != ERROR_OK)
+			if (sbcs_config_write(target, sbcs_write) != ERROR_OK)
 				return ERROR_FAIL;
 		}
 
@@ -2803,12 +3700,14 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 			if (dmi_write(target, DM_SBCS, sbcs_read | DM_SBCS_SBBUSYERROR) != ERROR_OK)
 				return ERROR_FAIL;
 			next_address = sb_read_address(target);
-			info->bus_master_read_delay += info->bus_master_read_delay / 10 + 1;
+			increase_busy_delay(target, DELAY_SB_READ);
 			continue;
 		}
 
 		unsigned error = get_field(sbcs_read, DM_SBCS_SBERROR);
 		if (error == 0) {
+			busy_delay_succeeded(target, DELAY_SB_READ,
+					(end_address - next_address) / size);
 			next_address = end_address;
 		} else {
 			/* Some error indicating the bus access failed, but not because of
@@ -2954,6 +3853,212 @@ static bool mem_should_skip_abstract(struct target *target, target_addr_t addres
 	return false;
 }
 
+/* A memory access streamed with autoexecdata stopped because the hart was
+ * still busy with the previous element. Clear the error, turn off autoexec,
+ * and work out from arg1 (which aampostincrement keeps pointing at the next
+ * element) how far we got. */
+static int abstract_autoexec_recover(struct target *target,
+		target_addr_t address, uint32_t size, uint32_t *next_index)
+{
+	increase_busy_delay(target, DELAY_MEMORY);
+	riscv013_clear_abstract_error(target);
+	if (abstractauto_write(target, 0) != ERROR_OK)
+		return ERROR_FAIL;
+
+	riscv_reg_t next_address = read_abstract_arg(target, 1, riscv_xlen(target));
+	*next_index = (next_address - address) / size;
+	return ERROR_OK;
+}
+
+/* Wait for the last command of a streamed batch to finish, and return cmderr
+ * in info->cmderr. */
+static int abstract_autoexec_status(struct target *target,
+		struct riscv_batch *batch, size_t abstractcs_key)
+{
+	RISCV013_INFO(info);
+
+	uint32_t abstractcs;
+	bool dmi_busy_encountered;
+	if (batch_get_status_read(target, batch, abstractcs_key, DM_ABSTRACTCS,
+				&abstractcs, &dmi_busy_encountered) != ERROR_OK)
+		return ERROR_FAIL;
+	if (dmi_busy_encountered) {
+		/* Accesses were dropped, and we can't tell which of them started
+		 * a command. Let the caller fall back on something slower. */
+		LOG_WARNING("Abstract memory access encountered DMI busy. "
+				"Falling back on slower accesses.");
+		return ERROR_FAIL;
+	}
+	while (get_field(abstractcs, DM_ABSTRACTCS_BUSY))
+		if (dmi_read(target, &abstractcs, DM_ABSTRACTCS) != ERROR_OK)
+			return ERROR_FAIL;
+	info->cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+	if (info->cmderr != CMDERR_NONE && info->cmderr != CMDERR_BUSY) {
+		LOG_DEBUG("error when accessing memory, abstractcs=0x%08lx",
+				(long)abstractcs);
+		riscv013_clear_abstract_error(target);
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+/*
+ * Read elements index..count-1 using autoexecdata: after command is written,
+ * every read of data0 returns one element and starts reading the next. arg1
+ * must already hold the address of element index, and command must have
+ * aampostincrement set.
+ */
+static int read_memory_abstract_autoexec(struct target *target,
+		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer,
+		uint32_t command, uint32_t index)
+{
+	RISCV013_INFO(info);
+	unsigned words = size > 4 ? 2 : 1;
+	int result = ERROR_OK;
+
+	size_t *keys = malloc(sizeof(*keys) * RISCV_BATCH_DEFAULT_MAX_SCANS);
+	if (!keys)
+		return ERROR_FAIL;
+
+	while (index < count) {
+		struct riscv_batch *batch = riscv_batch_alloc(target, 0,
+				info->dmi_busy_delay);
+		if (!batch) {
+			result = ERROR_FAIL;
+			break;
+		}
+
+		riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO,
+				1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND, command);
+		batch_add_delay(target, batch, DELAY_MEMORY);
+		/* Leave room for clearing abstractauto and reading abstractcs. */
+		uint32_t reads = MIN(count - index,
+				(riscv_batch_available_scans(batch) - 2) / words);
+		for (uint32_t j = 0; j < reads; j++) {
+			/* Don't start a read past the ones we want. */
+			if (j + 1 == reads)
+				riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO, 0);
+			if (words > 1)
+				riscv_batch_add_dmi_read(batch, DM_DATA1);
+			keys[j] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+			batch_add_delay(target, batch, DELAY_MEMORY);
+		}
+		size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+		result = batch_run(target, batch);
+		if (result == ERROR_OK)
+			result = abstract_autoexec_status(target, batch, abstractcs_key);
+		if (result != ERROR_OK) {
+			riscv_batch_free(batch);
+			break;
+		}
+
+		/* A read of data0 only starts the next command if the previous one
+		 * is done, so every element before the last one that was started
+		 * was read correctly. */
+		uint32_t next_index = index + reads;
+		uint32_t good = reads;
+		if (info->cmderr == CMDERR_BUSY) {
+			LOG_DEBUG("abstract memory read resulted in busy response");
+			result = abstract_autoexec_recover(target, address, size,
+					&next_index);
+			if (result != ERROR_OK) {
+				riscv_batch_free(batch);
+				break;
+			}
+			if (next_index > index) {
+				/* The last element that went through is still in arg0. */
+				riscv_reg_t value = read_abstract_arg(target, 0,
+						words > 1 ? 64 : 32);
+				buf_set_u64(buffer + (next_index - 1) * size, 0, 8 * size,
+						value);
+				good = next_index - index - 1;
+			} else {
+				good = 0;
+				next_index = index;
+			}
+		} else {
+			busy_delay_succeeded(target, DELAY_MEMORY, reads);
+		}
+
+		for (uint32_t j = 0; j < good; j++) {
+			riscv_reg_t value = riscv_batch_get_dmi_read_data(batch, keys[j]);
+			if (words > 1)
+				value |= ((riscv_reg_t)riscv_batch_get_dmi_read_data(batch,
+							keys[j] - 1)) << 32;
+			buf_set_u64(buffer + (index + j) * size, 0, 8 * size, value);
+		}
+
+		riscv_batch_free(batch);
+		index = next_index;
+	}
+
+	if (result != ERROR_OK)
+		abstractauto_write(target, 0);
+	free(keys);
+	return result;
+}
+
+/*
+ * Write elements index..count-1 using autoexecdata: every write of data0
+ * starts a command that stores it. arg1 must already hold the address of
+ * element index, and the last command executed must be command, which must
+ * have aampostincrement set.
+ */
+static int write_memory_abstract_autoexec(struct target *target,
+		target_addr_t address, uint32_t size, uint32_t count,
+		const uint8_t *buffer, uint32_t index)
+{
+	RISCV013_INFO(info);
+	int result = ERROR_OK;
+
+	while (index < count) {
+		struct riscv_batch *batch = riscv_batch_alloc(target, 0,
+				info->dmi_busy_delay);
+		if (!batch)
+			return ERROR_FAIL;
+
+		riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO,
+				1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
+		uint32_t writes = 0;
+		while (index + writes < count && riscv_batch_available_scans(batch) > 4) {
+			riscv_reg_t value = buf_get_u64(buffer + (index + writes) * size,
+					0, 8 * size);
+			if (riscv_xlen(target) > 32)
+				riscv_batch_add_dmi_write(batch, DM_DATA1, value >> 32);
+			riscv_batch_add_dmi_write(batch, DM_DATA0, value);
+			batch_add_delay(target, batch, DELAY_MEMORY);
+			writes++;
+		}
+		riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO, 0);
+		size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+		result = batch_run(target, batch);
+		if (result == ERROR_OK)
+			result = abstract_autoexec_status(target, batch, abstractcs_key);
+		riscv_batch_free(batch);
+		if (result != ERROR_OK)
+			break;
+
+		uint32_t next_index = index + writes;
+		if (info->cmderr == CMDERR_BUSY) {
+			LOG_DEBUG("abstract memory write resulted in busy response");
+			result = abstract_autoexec_recover(target, address, size,
+					&next_index);
+			if (result != ERROR_OK)
+				break;
+		} else {
+			busy_delay_succeeded(target, DELAY_MEMORY, writes);
+		}
+		index = next_index;
+	}
+
+	if (result != ERROR_OK)
+		abstractauto_write(target, 0);
+	return result;
+}
+
 /*
  * Performs a memory read using memory access abstract commands. The read sizes
  * supported are 1, 2, and 4 bytes despite the spec's support of 8 and 16 byte
@@ -3028,6 +4133,11 @@ static int read_memory_abstract(struct target *target, target_addr_t address,
 		if (info->has_aampostincrement == YNM_YES)
 			updateaddr = false;
 		p += size;
+
+		/* With aampostincrement working, stream the rest of the reads. */
+		if (info->has_aampostincrement == YNM_YES && c + 1 < count)
+			return read_memory_abstract_autoexec(target, address, size, count,
+					buffer, command, c + 1);
 	}
 
 	return result;
@@ -3107,6 +4217,11 @@ static int write_memory_abstract(struct target *target, target_addr_t address,
 		if (info->has_aampostincrement == YNM_YES)
 			updateaddr = false;
 		p += size;
+
+		/* With aampostincrement working, stream the rest of the writes. */
+		if (info->has_aampostincrement == YNM_YES && c + 1 < count)
+			return write_memory_abstract_autoexec(target, address, size,
+					count, buffer, c + 1);
 	}
 
 	return result;
@@ -3148,7 +4263,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		return ERROR_OK;
 	}
 
-	if (dmi_write(target, DM_ABSTRACTAUTO,
+	if (abstractauto_write(target,
 			1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET) != ERROR_OK)
 		goto error;
 	/* Read garbage from dmi_data0, which triggers another execution of the
@@ -3171,8 +4286,8 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		 * dm_data0 contains[read_addr-size*2]
 		 */
 
-		struct riscv_batch *batch = riscv_batch_alloc(target, 32,
-				info->dmi_busy_delay + info->ac_busy_delay);
+		struct riscv_batch *batch = riscv_batch_alloc(target, 0,
+				info->dmi_busy_delay);
 		if (!batch)
 			return ERROR_FAIL;
 
@@ -3181,11 +4296,13 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 			if (size > 4)
 				riscv_batch_add_dmi_read(batch, DM_DATA1);
 			riscv_batch_add_dmi_read(batch, DM_DATA0);
+			batch_add_delay(target, batch, DELAY_MEMORY);
 
 			reads++;
 			if (riscv_batch_full(batch))
 				break;
 		}
+		size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
 
 		batch_run(target, batch);
 
@@ -3193,8 +4310,11 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		 * and update our copy of cmderr. If we see that DMI is busy here,
 		 * dmi_busy_delay will be incremented. */
 		uint32_t abstractcs;
-		if (dmi_read(target, &abstractcs, DM_ABSTRACTCS) != ERROR_OK)
+		if (batch_get_status_read(target, batch, abstractcs_key, DM_ABSTRACTCS,
+					&abstractcs, NULL) != ERROR_OK) {
+			riscv_batch_free(batch);
 			return ERROR_FAIL;
+		}
 		while (get_field(abstractcs, DM_ABSTRACTCS_BUSY))
 			if (dmi_read(target, &abstractcs, DM_ABSTRACTCS) != ERROR_OK)
 				return ERROR_FAIL;
@@ -3206,14 +4326,15 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 			case CMDERR_NONE:
 				LOG_DEBUG("successful (partial?) memory read");
 				next_index = index + reads;
+				busy_delay_succeeded(target, DELAY_MEMORY, reads);
 				break;
 			case CMDERR_BUSY:
 				LOG_DEBUG("memory read resulted in busy response");
 
-				increase_ac_busy_delay(target);
+				increase_busy_delay(target, DELAY_MEMORY);
 				riscv013_clear_abstract_error(target);
 
-				dmi_write(target, DM_ABSTRACTAUTO, 0);
+				abstractauto_write(target, 0);
 
 				uint32_t dmi_data0, dmi_data1 = 0;
 				/* This is definitely a good version of the value that we
@@ -3254,7 +4375,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 				dmi_write_exec(target, DM_COMMAND, command, true);
 				next_index++;
 
-				dmi_write(target, DM_ABSTRACTAUTO,
+				abstractauto_write(target,
 						1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
 
 				ignore_last = 1;
@@ -3320,7 +4441,7 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 		riscv_batch_free(batch);
 	}
 
-	dmi_write(target, DM_ABSTRACTAUTO, 0);
+	abstractauto_write(target, 0);
 
 	if (count > 1) {
 		/* Read the penultimate word. */
@@ -3345,87 +4466,439 @@ static int read_memory_progbuf_inner(struct target *target, target_addr_t addres
 	return ERROR_OK;
 
 error:
-	dmi_write(target, DM_ABSTRACTAUTO, 0);
+	abstractauto_write(target, 0);
 
 	return result;
 }
 
-/* Only need to save/restore one GPR to read a single word, and the progbuf
- * program doesn't need to increment. */
-static int read_memory_progbuf_one(struct target *target, target_addr_t address,
-		uint32_t size, uint8_t *buffer)
+typedef enum {
+	/* Load from s0 into s0. */
+	MEM_PROGRAM_READ_ONE,
+	/* Load from s0 into s1, then advance s0, or count in s2. */
+	MEM_PROGRAM_READ,
+	/* Store s1 to s0, then advance s0. */
+	MEM_PROGRAM_WRITE
+} mem_program_t;
+
+/* Set up program to access memory of the given size. The instructions only
+ * depend on a handful of parameters, so each variant is assembled once and
+ * copied from then on, with the increment patched into its addi. */
+static int memory_program(struct target *target, struct riscv_program *program,
+		mem_program_t kind, uint32_t size, bool mprven, int increment)
 {
-	uint64_t mstatus = 0;
-	uint64_t mstatus_old = 0;
-	if (modify_privilege(target, &mstatus, &mstatus_old) != ERROR_OK)
-		return ERROR_FAIL;
-
-	uint64_t s0;
-	int result = ERROR_FAIL;
-
-	if (register_read(target, &s0, GDB_REGNO_S0) != ERROR_OK)
-		goto restore_mstatus;
+	RISCV013_INFO(info);
 
-	/* Write the program (load, increment) */
-	struct riscv_program program;
-	riscv_program_init(&program, target);
-	if (riscv_enable_virtual && has_sufficient_progbuf(target, 5) && get_field(mstatus, MSTATUS_MPRV))
-		riscv_program_csrrsi(&program, GDB_REGNO_ZERO, CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
+	unsigned size_index;
 	switch (size) {
 		case 1:
-			riscv_program_lbr(&program, GDB_REGNO_S0, GDB_REGNO_S0, 0);
+			size_index = 0;
 			break;
 		case 2:
-			riscv_program_lhr(&program, GDB_REGNO_S0, GDB_REGNO_S0, 0);
+			size_index = 1;
 			break;
 		case 4:
-			riscv_program_lwr(&program, GDB_REGNO_S0, GDB_REGNO_S0, 0);
+			size_index = 2;
 			break;
 		case 8:
-			riscv_program_ldr(&program, GDB_REGNO_S0, GDB_REGNO_S0, 0);
+			size_index = 3;
 			break;
 		default:
 			LOG_ERROR("Unsupported size: %d", size);
-			goto restore_mstatus;
+			return ERROR_FAIL;
 	}
-	if (riscv_enable_virtual && has_sufficient_progbuf(target, 5) && get_field(mstatus, MSTATUS_MPRV))
-		riscv_program_csrrci(&program, GDB_REGNO_ZERO,  CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
+	bool counter = kind == MEM_PROGRAM_READ && increment == 0;
+	unsigned index = ((kind * 4 + size_index) * 2 + mprven) * 2 + counter;
+	assert(index < ARRAY_SIZE(info->mem_program));
+	mem_program_template_t *template = &info->mem_program[index];
 
-	if (riscv_program_ebreak(&program) != ERROR_OK)
-		goto restore_mstatus;
-	if (riscv_program_write(&program) != ERROR_OK)
-		goto restore_mstatus;
+	riscv_program_init(program, target);
+	if (template->instruction_count) {
+		memcpy(program->debug_buffer, template->insn,
+				template->instruction_count * sizeof(template->insn[0]));
+		program->instruction_count = template->instruction_count;
+	} else {
+		enum gdb_regno data = kind == MEM_PROGRAM_READ_ONE ? GDB_REGNO_S0 :
+			GDB_REGNO_S1;
+		if (mprven)
+			riscv_program_csrrsi(program, GDB_REGNO_ZERO, CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
+		if (kind == MEM_PROGRAM_WRITE) {
+			static int (* const store[])(struct riscv_program *, enum gdb_regno,
+					enum gdb_regno, int) = {
+				riscv_program_sbr, riscv_program_shr, riscv_program_swr,
+				riscv_program_sdr
+			};
+			store[size_index](program, data, GDB_REGNO_S0, 0);
+		} else {
+			static int (* const load[])(struct riscv_program *, enum gdb_regno,
+					enum gdb_regno, int) = {
+				riscv_program_lbr, riscv_program_lhr, riscv_program_lwr,
+				riscv_program_ldr
+			};
+			load[size_index](program, data, GDB_REGNO_S0, 0);
+		}
+		if (mprven)
+			riscv_program_csrrci(program, GDB_REGNO_ZERO, CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
+		template->addi = program->instruction_count;
+		if (counter)
+			riscv_program_addi(program, GDB_REGNO_S2, GDB_REGNO_S2, 1);
+		else if (kind != MEM_PROGRAM_READ_ONE)
+			riscv_program_addi(program, GDB_REGNO_S0, GDB_REGNO_S0, 0);
+		if (riscv_program_ebreak(program) != ERROR_OK)
+			return ERROR_FAIL;
 
-	/* Write address to S0, and execute buffer. */
-	if (write_abstract_arg(target, 0, address, riscv_xlen(target)) != ERROR_OK)
-		goto restore_mstatus;
-	uint32_t command = access_register_command(target, GDB_REGNO_S0,
-			riscv_xlen(target), AC_ACCESS_REGISTER_WRITE |
-			AC_ACCESS_REGISTER_TRANSFER | AC_ACCESS_REGISTER_POSTEXEC);
-	if (execute_abstract_command(target, command) != ERROR_OK)
-		goto restore_s0;
+		assert(program->instruction_count <= ARRAY_SIZE(template->insn));
+		memcpy(template->insn, program->debug_buffer,
+				program->instruction_count * sizeof(template->insn[0]));
+		template->instruction_count = program->instruction_count;
+	}
 
-	uint64_t value;
-	if (register_read(target, &value, GDB_REGNO_S0) != ERROR_OK)
-		goto restore_s0;
-	buf_set_u64(buffer, 0, 8 * size, value);
-	log_memory_access(address, value, size, true);
-	result = ERROR_OK;
+	if (kind != MEM_PROGRAM_READ_ONE && !counter) {
+		int imm = kind == MEM_PROGRAM_WRITE ? (int)size : increment;
+		program->debug_buffer[template->addi] =
+			(template->insn[template->addi] & 0xfffff) | ((uint32_t)imm << 20);
+	}
+	return ERROR_OK;
+}
 
-restore_s0:
-	if (riscv_set_register(target, GDB_REGNO_S0, s0) != ERROR_OK)
-		result = ERROR_FAIL;
+/* How many words one execution of a block transfer program moves, using
+ * data0..data<n-1> as seen by the hart (hartinfo.dataaccess/dataaddr), or 0
+ * if the DM and program buffer can't do better than one word at a time. The
+ * program is a load and a store per word, an addi and an ebreak. */
+static unsigned memory_block_words(struct target *target, uint32_t size,
+		bool mprven)
+{
+	RISCV013_INFO(info);
 
-restore_mstatus:
-	if (mstatus != mstatus_old)
-		if (register_write_direct(target, GDB_REGNO_MSTATUS, mstatus_old))
-			result = ERROR_FAIL;
+	if (size != 4 || mprven || info->datasize == 0)
+		return 0;
 
-	return result;
+	unsigned n = MIN(info->datacount, info->datasize);
+	while (n >= 2 && !has_sufficient_progbuf(target, 2 * n + 2))
+		n--;
+	if (info->dataaccess == 1) {
+		/* Data registers are memory mapped, reached as an offset from x0. */
+		int16_t base = info->dataaddr;
+		if (base & (1 << 11))
+			base -= 1 << 12;
+		while (n >= 2 && base + 4 * (int)(n - 1) > 2047)
+			n--;
+	}
+	return n >= 2 ? n : 0;
 }
 
-/**
- * Read the requested memory, silently handling memory access errors.
+/* Program that moves n words between memory at s0 and the data registers,
+ * then advances s0 past them. */
+static int memory_block_program(struct target *target,
+		struct riscv_program *program, bool write, unsigned n)
+{
+	RISCV013_INFO(info);
+
+	int16_t base = info->dataaddr;
+	if (info->dataaccess == 1 && (base & (1 << 11)))
+		base -= 1 << 12;
+
+	riscv_program_init(program, target);
+	for (unsigned k = 0; k < n; k++) {
+		if (write) {
+			if (info->dataaccess == 1)
+				riscv_program_lwr(program, GDB_REGNO_S1, GDB_REGNO_ZERO, base + 4 * k);
+			else
+				riscv_program_csrr(program, GDB_REGNO_S1,
+						GDB_REGNO_CSR0 + info->dataaddr + k);
+			riscv_program_swr(program, GDB_REGNO_S1, GDB_REGNO_S0, 4 * k);
+		} else {
+			riscv_program_lwr(program, GDB_REGNO_S1, GDB_REGNO_S0, 4 * k);
+			if (info->dataaccess == 1)
+				riscv_program_swr(program, GDB_REGNO_S1, GDB_REGNO_ZERO, base + 4 * k);
+			else
+				riscv_program_csrw(program, GDB_REGNO_S1,
+						GDB_REGNO_CSR0 + info->dataaddr + k);
+		}
+	}
+	riscv_program_addi(program, GDB_REGNO_S0, GDB_REGNO_S0, 4 * n);
+	return riscv_program_ebreak(program);
+}
+
+/* Wait for the last autoexec'd program of a batch and pick up cmderr. */
+static int memory_block_status(struct target *target, struct riscv_batch *batch,
+		size_t abstractcs_key, bool *dmi_busy_encountered)
+{
+	RISCV013_INFO(info);
+	uint32_t abstractcs;
+
+	if (batch_get_status_read(target, batch, abstractcs_key, DM_ABSTRACTCS,
+				&abstractcs, dmi_busy_encountered) != ERROR_OK)
+		return ERROR_FAIL;
+	while (get_field(abstractcs, DM_ABSTRACTCS_BUSY))
+		if (dmi_read(target, &abstractcs, DM_ABSTRACTCS) != ERROR_OK)
+			return ERROR_FAIL;
+	info->cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+	return ERROR_OK;
+}
+
+/* Read blocks of n words, each with one execution of the program. Reading
+ * data<n-1> starts the next execution. If the DM reports busy, s0 tells how
+ * many executions completed; the last of those is still in the data
+ * registers and the ones before it were all read before their successor
+ * started, so every word is still read from memory exactly once. */
+static int read_memory_progbuf_blocks(struct target *target,
+		target_addr_t address, uint32_t blocks, unsigned n, uint8_t *buffer)
+{
+	RISCV013_INFO(info);
+	uint32_t command = access_register_command(target, GDB_REGNO_S0,
+			riscv_xlen(target), AC_ACCESS_REGISTER_POSTEXEC);
+	uint32_t autoexec = set_field(0, DM_ABSTRACTAUTO_AUTOEXECDATA, 1 << (n - 1));
+	uint32_t block_size = 4 * n;
+	uint32_t next = 0;	/* next block to be executed */
+	int result = ERROR_OK;
+
+	if (register_write_direct(target, GDB_REGNO_S0, address) != ERROR_OK)
+		return ERROR_FAIL;
+
+	while (next < blocks) {
+		/* Block next goes into the data registers. */
+		if (execute_abstract_command(target, command) != ERROR_OK)
+			return ERROR_FAIL;
+		uint32_t done = next;	/* block now in the data registers */
+		next++;
+
+		if (next < blocks && abstractauto_write(target, autoexec) != ERROR_OK)
+			return ERROR_FAIL;
+
+		while (next < blocks) {
+			struct riscv_batch *batch = riscv_batch_alloc(target, 0,
+					info->dmi_busy_delay);
+			if (!batch) {
+				result = ERROR_FAIL;
+				goto out;
+			}
+			/* Each pass reads block first + i and starts block next. */
+			uint32_t first = done;
+			uint32_t start = next;
+			for (; next < blocks; next++) {
+				for (unsigned k = 0; k < n; k++)
+					riscv_batch_add_dmi_read(batch, DM_DATA0 + k);
+				batch_add_delay(target, batch, DELAY_MEMORY);
+				if (riscv_batch_full(batch)) {
+					next++;
+					break;
+				}
+			}
+			size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+			if (batch_run(target, batch) != ERROR_OK ||
+					memory_block_status(target, batch, abstractcs_key, NULL) != ERROR_OK) {
+				riscv_batch_free(batch);
+				result = ERROR_FAIL;
+				goto out;
+			}
+
+			uint32_t batch_blocks = next - start;
+			uint32_t good = batch_blocks;
+			if (info->cmderr == CMDERR_BUSY) {
+				LOG_DEBUG("block memory read resulted in busy response");
+				increase_busy_delay(target, DELAY_MEMORY);
+				riscv013_clear_abstract_error(target);
+				abstractauto_write(target, 0);
+				uint64_t s0;
+				if (register_read_direct(target, &s0, GDB_REGNO_S0) != ERROR_OK) {
+					riscv_batch_free(batch);
+					result = ERROR_FAIL;
+					goto out;
+				}
+				next = (s0 - address) / block_size;
+				good = next - 1 - first;
+			} else if (info->cmderr != CMDERR_NONE) {
+				LOG_DEBUG("error when reading memory, cmderr=%d", info->cmderr);
+				riscv013_clear_abstract_error(target);
+				riscv_batch_free(batch);
+				result = ERROR_FAIL;
+				goto out;
+			} else {
+				busy_delay_succeeded(target, DELAY_MEMORY, batch_blocks);
+			}
+
+			for (uint32_t b = 0; b < good; b++) {
+				for (unsigned k = 0; k < n; k++) {
+					size_t key = b * n + k;
+					if (riscv_batch_get_dmi_read_op(batch, key) != DMI_STATUS_SUCCESS) {
+						LOG_WARNING("Batch memory read encountered a DMI error. "
+								"Falling back on slower reads.");
+						riscv_batch_free(batch);
+						result = ERROR_FAIL;
+						goto out;
+					}
+					buf_set_u32(buffer + (first + b) * block_size + 4 * k, 0, 32,
+							riscv_batch_get_dmi_read_data(batch, key));
+				}
+			}
+			riscv_batch_free(batch);
+			done = first + good;
+			if (info->cmderr == CMDERR_BUSY)
+				break;
+		}
+
+		/* The last block executed is left in the data registers. */
+		if (abstractauto_write(target, 0) != ERROR_OK)
+			return ERROR_FAIL;
+		for (unsigned k = 0; k < n; k++) {
+			uint32_t value;
+			if (dmi_read(target, &value, DM_DATA0 + k) != ERROR_OK)
+				return ERROR_FAIL;
+			buf_set_u32(buffer + done * block_size + 4 * k, 0, 32, value);
+		}
+	}
+
+out:
+	abstractauto_write(target, 0);
+	return result;
+}
+
+/* Write blocks of n words, each with one execution of the program. Writing
+ * data<n-1> starts it. If the DM reports busy, start over from the block s0
+ * points at. */
+static int write_memory_progbuf_blocks(struct target *target,
+		target_addr_t address, uint32_t blocks, unsigned n, const uint8_t *buffer)
+{
+	RISCV013_INFO(info);
+	uint32_t command = access_register_command(target, GDB_REGNO_S0,
+			riscv_xlen(target), AC_ACCESS_REGISTER_POSTEXEC);
+	uint32_t autoexec = set_field(0, DM_ABSTRACTAUTO_AUTOEXECDATA, 1 << (n - 1));
+	uint32_t block_size = 4 * n;
+	uint32_t next = 0;
+	int result = ERROR_OK;
+
+	while (next < blocks) {
+		/* The first block is written without autoexec and started by hand. */
+		const uint8_t *p = buffer + next * block_size;
+		if (register_write_direct(target, GDB_REGNO_S0,
+					address + next * block_size) != ERROR_OK)
+			return ERROR_FAIL;
+		for (unsigned k = 0; k < n; k++)
+			if (dmi_write(target, DM_DATA0 + k, buf_get_u32(p + 4 * k, 0, 32)) != ERROR_OK)
+				return ERROR_FAIL;
+		if (execute_abstract_command(target, command) != ERROR_OK)
+			return ERROR_FAIL;
+		next++;
+		if (next == blocks)
+			break;
+		if (abstractauto_write(target, autoexec) != ERROR_OK)
+			return ERROR_FAIL;
+
+		while (next < blocks) {
+			struct riscv_batch *batch = riscv_batch_alloc(target, 0,
+					info->dmi_busy_delay);
+			if (!batch) {
+				result = ERROR_FAIL;
+				goto out;
+			}
+			uint32_t first = next;
+			for (; next < blocks; next++) {
+				p = buffer + next * block_size;
+				for (unsigned k = 0; k < n; k++)
+					riscv_batch_add_dmi_write(batch, DM_DATA0 + k,
+							buf_get_u32(p + 4 * k, 0, 32));
+				batch_add_delay(target, batch, DELAY_MEMORY);
+				if (riscv_batch_full(batch)) {
+					next++;
+					break;
+				}
+			}
+			size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+			bool dmi_busy_encountered;
+			if (batch_run(target, batch) != ERROR_OK ||
+					memory_block_status(target, batch, abstractcs_key,
+						&dmi_busy_encountered) != ERROR_OK) {
+				riscv_batch_free(batch);
+				result = ERROR_FAIL;
+				goto out;
+			}
+			riscv_batch_free(batch);
+
+			if (info->cmderr == CMDERR_NONE && !dmi_busy_encountered) {
+				busy_delay_succeeded(target, DELAY_MEMORY, next - first);
+			} else if (info->cmderr == CMDERR_BUSY || dmi_busy_encountered) {
+				LOG_DEBUG("block memory write resulted in busy response");
+				riscv013_clear_abstract_error(target);
+				increase_busy_delay(target, DELAY_MEMORY);
+				abstractauto_write(target, 0);
+				uint64_t s0;
+				if (register_read_direct(target, &s0, GDB_REGNO_S0) != ERROR_OK) {
+					result = ERROR_FAIL;
+					goto out;
+				}
+				next = (s0 - address) / block_size;
+				break;
+			} else {
+				LOG_DEBUG("error when writing memory, cmderr=%d", info->cmderr);
+				riscv013_clear_abstract_error(target);
+				result = ERROR_FAIL;
+				goto out;
+			}
+		}
+	}
+
+out:
+	abstractauto_write(target, 0);
+	return result;
+}
+
+/* Only need to save/restore one GPR to read a single word, and the progbuf
+ * program doesn't need to increment. */
+static int read_memory_progbuf_one(struct target *target, target_addr_t address,
+		uint32_t size, uint8_t *buffer)
+{
+	uint64_t mstatus = 0;
+	uint64_t mstatus_old = 0;
+	if (modify_privilege(target, &mstatus, &mstatus_old) != ERROR_OK)
+		return ERROR_FAIL;
+
+	uint64_t s0;
+	int result = ERROR_FAIL;
+
+	if (register_read(target, &s0, GDB_REGNO_S0) != ERROR_OK)
+		goto restore_mstatus;
+
+	/* Write the program (load) */
+	struct riscv_program program;
+	if (memory_program(target, &program, MEM_PROGRAM_READ_ONE, size,
+				riscv_enable_virtual && has_sufficient_progbuf(target, 5) &&
+				get_field(mstatus, MSTATUS_MPRV), 0) != ERROR_OK)
+		goto restore_mstatus;
+	if (riscv_program_write(&program) != ERROR_OK)
+		goto restore_mstatus;
+
+	/* Write address to S0, and execute buffer. */
+	if (write_abstract_arg(target, 0, address, riscv_xlen(target)) != ERROR_OK)
+		goto restore_mstatus;
+	uint32_t command = access_register_command(target, GDB_REGNO_S0,
+			riscv_xlen(target), AC_ACCESS_REGISTER_WRITE |
+			AC_ACCESS_REGISTER_TRANSFER | AC_ACCESS_REGISTER_POSTEXEC);
+	if (execute_abstract_command(target, command) != ERROR_OK)
+		goto restore_s0;
+
+	uint64_t value;
+	if (register_read(target, &value, GDB_REGNO_S0) != ERROR_OK)
+		goto restore_s0;
+	buf_set_u64(buffer, 0, 8 * size, value);
+	log_memory_access(address, value, size, true);
+	result = ERROR_OK;
+
+restore_s0:
+	if (riscv_set_register(target, GDB_REGNO_S0, s0) != ERROR_OK)
+		result = ERROR_FAIL;
+
+restore_mstatus:
+	if (mstatus != mstatus_old)
+		if (register_write_direct(target, GDB_REGNO_MSTATUS, mstatus_old))
+			result = ERROR_FAIL;
+
+	return result;
+}
+
+/**
+ * Read the requested memory, silently handling memory access errors.
  */
 static int read_memory_progbuf(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer, uint32_t increment)
@@ -3468,38 +4941,36 @@ static int read_memory_progbuf(struct target *target, target_addr_t address,
 	if (increment == 0 && register_read(target, &s2, GDB_REGNO_S1) != ERROR_OK)
 		return ERROR_FAIL;
 
-	/* Write the program (load, increment) */
-	struct riscv_program program;
-	riscv_program_init(&program, target);
-	if (riscv_enable_virtual && has_sufficient_progbuf(target, 5) && get_field(mstatus, MSTATUS_MPRV))
-		riscv_program_csrrsi(&program, GDB_REGNO_ZERO, CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
+	bool mprven = riscv_enable_virtual && has_sufficient_progbuf(target, 5) &&
+			get_field(mstatus, MSTATUS_MPRV);
 
-	switch (size) {
-		case 1:
-			riscv_program_lbr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		case 2:
-			riscv_program_lhr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		case 4:
-			riscv_program_lwr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		case 8:
-			riscv_program_ldr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		default:
-			LOG_ERROR("Unsupported size: %d", size);
-			return ERROR_FAIL;
+	/* Move as many words per program execution as the data registers hold.
+	 * Whatever is left over, or everything if that fails, goes through the
+	 * one word at a time program below. */
+	struct riscv_program program;
+	unsigned block_words = increment == size ?
+			memory_block_words(target, size, mprven) : 0;
+	if (block_words && count >= 2 * block_words &&
+			memory_block_program(target, &program, false, block_words) == ERROR_OK &&
+			riscv_program_write(&program) == ERROR_OK) {
+		uint32_t blocks = count / block_words;
+		if (read_memory_progbuf_blocks(target, address, blocks, block_words,
+					buffer) == ERROR_OK) {
+			address += blocks * block_words * size;
+			buffer += blocks * block_words * size;
+			count -= blocks * block_words;
+		} else {
+			LOG_DEBUG("block read failed, falling back to one word at a time");
+			memset(buffer, 0, count * size);
+		}
 	}
 
-	if (riscv_enable_virtual && has_sufficient_progbuf(target, 5) && get_field(mstatus, MSTATUS_MPRV))
-		riscv_program_csrrci(&program, GDB_REGNO_ZERO,  CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
-	if (increment == 0)
-		riscv_program_addi(&program, GDB_REGNO_S2, GDB_REGNO_S2, 1);
-	else
-		riscv_program_addi(&program, GDB_REGNO_S0, GDB_REGNO_S0, increment);
+	if (count == 0)
+		goto restore;
 
-	if (riscv_program_ebreak(&program) != ERROR_OK)
+	/* Write the program (load, increment) */
+	if (memory_program(target, &program, MEM_PROGRAM_READ, size, mprven,
+				increment) != ERROR_OK)
 		return ERROR_FAIL;
 	if (riscv_program_write(&program) != ERROR_OK)
 		return ERROR_FAIL;
@@ -3531,6 +5002,7 @@ static int read_memory_progbuf(struct target *target, target_addr_t address,
 		result = ERROR_OK;
 	}
 
+restore:
 	riscv_set_register(target, GDB_REGNO_S0, s0);
 	riscv_set_register(target, GDB_REGNO_S1, s1);
 	if (increment == 0)
@@ -3556,15 +5028,19 @@ static int read_memory(struct target *target, target_addr_t address,
 	}
 
 	int ret = ERROR_FAIL;
-	RISCV_INFO(r);
 	RISCV013_INFO(info);
 
 	char *progbuf_result = "disabled";
 	char *sysbus_result = "disabled";
 	char *abstract_result = "disabled";
 
+	int methods[RISCV_NUM_MEM_ACCESS_METHODS];
+	riscv_mem_access_order(target, address, size, count, false, methods);
+
 	for (unsigned i = 0; i < RISCV_NUM_MEM_ACCESS_METHODS; i++) {
-		int method = r->mem_access_methods[i];
+		int method = methods[i];
+		struct duration bench;
+		duration_start(&bench);
 
 		if (method == RISCV_MEM_ACCESS_PROGBUF) {
 			if (mem_should_skip_progbuf(target, address, size, true, &progbuf_result))
@@ -3598,6 +5074,9 @@ static int read_memory(struct target *target, target_addr_t address,
 			break;
 
 		log_mem_access_result(target, ret == ERROR_OK, method, true);
+		duration_measure(&bench);
+		riscv_mem_access_record(target, address, size, count, false, method,
+				ret == ERROR_OK, duration_elapsed(&bench));
 
 		if (ret == ERROR_OK)
 			return ret;
@@ -3605,9 +5084,131 @@ static int read_memory(struct target *target, target_addr_t address,
 
 	LOG_ERROR("Target %s: Failed to read memory (addr=0x%" PRIx64 ")", target_name(target), address);
 	LOG_ERROR("  progbuf=%s, sysbus=%s, abstract=%s", progbuf_result, sysbus_result, abstract_result);
+	if (target->state != TARGET_HALTED)
+		LOG_ERROR("  %s is running, only system bus access leaves it alone",
+				target_name(target));
 	return ret;
 }
 
+/* Elements (single accesses) read per DMI batch by read_memory_batch() */
+#define READ_BATCH_ELEMENTS	128
+
+/*
+ * Read all of reads over the system bus, with as few DMI batches as
+ * possible. Returns ERROR_NOT_IMPLEMENTED unless read_memory() would use
+ * the system bus for each of them anyway, so the caller reads them one by
+ * one.
+ */
+static int read_memory_batch(struct target *target,
+		struct target_memory_read *reads, unsigned int num_reads)
+{
+	RISCV013_INFO(info);
+	unsigned sbasize = get_field(info->sbcs, DM_SBCS_SBASIZE);
+	if (get_field(info->sbcs, DM_SBCS_SBVERSION) != 1 || sbasize > 64)
+		return ERROR_NOT_IMPLEMENTED;
+
+	for (unsigned int i = 0; i < num_reads; i++) {
+		int methods[RISCV_NUM_MEM_ACCESS_METHODS];
+		char *skip_reason;
+		riscv_mem_access_order(target, reads[i].address, reads[i].size,
+				reads[i].count, false, methods);
+		if (methods[0] != RISCV_MEM_ACCESS_SYSBUS || reads[i].size > 8 ||
+				mem_should_skip_sysbus(target, reads[i].address, reads[i].size,
+					reads[i].size, true, &skip_reason))
+			return ERROR_NOT_IMPLEMENTED;
+	}
+
+	unsigned int i = 0;	/* current read */
+	uint32_t e = 0;		/* current element of it */
+	while (i < num_reads) {
+		struct riscv_batch *batch = riscv_batch_alloc(target,
+				1 + 5 * READ_BATCH_ELEMENTS, info->dmi_busy_delay);
+		if (!batch)
+			return ERROR_FAIL;
+
+		unsigned int first_i = i;
+		uint32_t first_e = e;
+		size_t key_lo[READ_BATCH_ELEMENTS];
+		size_t key_hi[READ_BATCH_ELEMENTS];
+		uint32_t sbcs = 0;
+		uint32_t sbaddress1 = 0;
+		bool sbaddress1_valid = false;
+		unsigned int n = 0;
+
+		for (; i < num_reads && n < READ_BATCH_ELEMENTS; n++) {
+			uint32_t size = reads[i].size;
+			target_addr_t address = reads[i].address + e * size;
+
+			uint32_t sbcs_write = DM_SBCS_SBREADONADDR | sb_sbaccess(size);
+			if (sbcs_write != sbcs) {
+				riscv_batch_add_dmi_write(batch, DM_SBCS, sbcs_write);
+				sbcs = sbcs_write;
+			}
+			if (sbasize > 32 && (!sbaddress1_valid || sbaddress1 != address >> 32)) {
+				sbaddress1 = address >> 32;
+				riscv_batch_add_dmi_write(batch, DM_SBADDRESS1, sbaddress1);
+				sbaddress1_valid = true;
+			}
+			/* triggers the read */
+			riscv_batch_add_dmi_write(batch, DM_SBADDRESS0, address);
+			batch_add_delay(target, batch, DELAY_SB_READ);
+			if (size > 4)
+				key_hi[n] = riscv_batch_add_dmi_read(batch, DM_SBDATA1);
+			key_lo[n] = riscv_batch_add_dmi_read(batch, DM_SBDATA0);
+
+			if (++e == reads[i].count) {
+				e = 0;
+				i++;
+			}
+		}
+
+		size_t sbcs_key = riscv_batch_add_dmi_read(batch, DM_SBCS);
+
+		int result = batch_run(target, batch);
+		if (result != ERROR_OK) {
+			riscv_batch_free(batch);
+			return result;
+		}
+
+		uint32_t sbcs_read = riscv_batch_get_dmi_read_data(batch, sbcs_key);
+		if (get_field(sbcs_read, DM_SBCS_SBBUSYERROR)) {
+			/* Read too fast. Slow down and do this batch again. */
+			increase_busy_delay(target, DELAY_SB_READ);
+			dmi_write(target, DM_SBCS, sbcs_read | DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR);
+			riscv_batch_free(batch);
+			i = first_i;
+			e = first_e;
+			continue;
+		}
+		if (get_field(sbcs_read, DM_SBCS_SBERROR)) {
+			/* Let the caller find out which read failed. */
+			dmi_write(target, DM_SBCS, DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR);
+			riscv_batch_free(batch);
+			return ERROR_FAIL;
+		}
+
+		i = first_i;
+		e = first_e;
+		for (unsigned int k = 0; k < n; k++) {
+			uint32_t size = reads[i].size;
+			uint64_t value = riscv_batch_get_dmi_read_data(batch, key_lo[k]);
+			if (size > 4)
+				value |= (uint64_t)riscv_batch_get_dmi_read_data(batch, key_hi[k]) << 32;
+			buf_set_u64(reads[i].buffer + e * size, 0, 8 * size, value);
+			log_memory_access(reads[i].address + e * size, value, size, true);
+
+			if (++e == reads[i].count) {
+				e = 0;
+				i++;
+			}
+		}
+
+		riscv_batch_free(batch);
+	}
+
+	return ERROR_OK;
+}
+
 static int write_memory_bus_v0(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -3665,9 +5266,22 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer)
 {
 	RISCV013_INFO(info);
+	RISCV_INFO(r);
+
+	/* Where allowed, use the widest access the bus supports. Then only
+	 * sbdata0 needs to be written for words whose upper half didn't change,
+	 * and the bus sees fewer, larger transactions. */
+	if (r->sba_wide_writes) {
+		while (size < 16 && sba_supports_access(target, size * 2) &&
+				address % (size * 2) == 0 && count % 2 == 0) {
+			size *= 2;
+			count /= 2;
+		}
+	}
+
 	uint32_t sbcs = sb_sbaccess(size);
 	sbcs = set_field(sbcs, DM_SBCS_SBAUTOINCREMENT, 1);
-	dmi_write(target, DM_SBCS, sbcs);
+	sbcs_config_write(target, sbcs);
 
 	target_addr_t next_address = address;
 	target_addr_t end_address = address + count * size;
@@ -3679,62 +5293,58 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 		LOG_DEBUG("transferring burst starting at address 0x%" TARGET_PRIxADDR,
 				next_address);
 
+		target_addr_t batch_address = next_address;
 		struct riscv_batch *batch = riscv_batch_alloc(
 				target,
-				32,
-				info->dmi_busy_delay + info->bus_master_write_delay);
+				0,
+				info->dmi_busy_delay);
 		if (!batch)
 			return ERROR_FAIL;
 
+		/* What this batch left in sbdata1..3. Anything from an earlier batch
+		 * may have been lost to a busy DMI, so start over each time. */
+		uint32_t sbdata_upper[3];
+		bool sbdata_upper_known = false;
+
 		for (uint32_t i = (next_address - address) / size; i < count; i++) {
 			const uint8_t *p = buffer + i * size;
 
 			if (riscv_batch_available_scans(batch) < (size + 3) / 4)
 				break;
 
-			if (size > 12)
-				riscv_batch_add_dmi_write(batch, DM_SBDATA3,
-						((uint32_t) p[12]) |
-						(((uint32_t) p[13]) << 8) |
-						(((uint32_t) p[14]) << 16) |
-						(((uint32_t) p[15]) << 24));
-
-			if (size > 8)
-				riscv_batch_add_dmi_write(batch, DM_SBDATA2,
-						((uint32_t) p[8]) |
-						(((uint32_t) p[9]) << 8) |
-						(((uint32_t) p[10]) << 16) |
-						(((uint32_t) p[11]) << 24));
-			if (size > 4)
-				riscv_batch_add_dmi_write(batch, DM_SBDATA1,
-						((uint32_t) p[4]) |
-						(((uint32_t) p[5]) << 8) |
-						(((uint32_t) p[6]) << 16) |
-						(((uint32_t) p[7]) << 24));
-			uint32_t value = p[0];
-			if (size > 2) {
-				value |= ((uint32_t) p[2]) << 16;
-				value |= ((uint32_t) p[3]) << 24;
+			for (unsigned word = (size + 3) / 4 - 1; word > 0; word--) {
+				uint32_t value = buf_get_u32(p + word * 4, 0, 32);
+				if (sbdata_upper_known && sbdata_upper[word - 1] == value)
+					continue;
+				riscv_batch_add_dmi_write(batch, DM_SBDATA0 + word, value);
+				sbdata_upper[word - 1] = value;
 			}
-			if (size > 1)
-				value |= ((uint32_t) p[1]) << 8;
+			sbdata_upper_known = true;
+
+			uint32_t value = buf_get_u32(p, 0, 8 * MIN(size, 4));
 			riscv_batch_add_dmi_write(batch, DM_SBDATA0, value);
+			batch_add_delay(target, batch, DELAY_SB_WRITE);
 
-			log_memory_access(address + i * size, value, size, false);
+			log_memory_access(address + i * size, value, MIN(size, 4), false);
 			next_address += size;
 		}
 
+		/* Read sbcs value at the end of the batch.
+		 * At the same time, detect if DMI busy has occurred during the batch write. */
+		size_t sbcs_key = riscv_batch_add_dmi_read(batch, DM_SBCS);
+
 		/* Execute the batch of writes */
 		result = batch_run(target, batch);
-		riscv_batch_free(batch);
-		if (result != ERROR_OK)
+		if (result != ERROR_OK) {
+			riscv_batch_free(batch);
 			return result;
+		}
 
-		/* Read sbcs value.
-		 * At the same time, detect if DMI busy has occurred during the batch write. */
 		bool dmi_busy_encountered;
-		if (dmi_op(target, &sbcs, &dmi_busy_encountered, DMI_OP_READ,
-				DM_SBCS, 0, false, true) != ERROR_OK)
+		result = batch_get_status_read(target, batch, sbcs_key, DM_SBCS, &sbcs,
+				&dmi_busy_encountered);
+		riscv_batch_free(batch);
+		if (result != ERROR_OK)
 			return ERROR_FAIL;
 		if (dmi_busy_encountered)
 			LOG_DEBUG("DMI busy encountered during system bus write.");
@@ -3758,7 +5368,7 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 			/* Clear the sticky error flag. */
 			dmi_write(target, DM_SBCS, sbcs | DM_SBCS_SBBUSYERROR);
 			/* Slow down before trying again. */
-			info->bus_master_write_delay += info->bus_master_write_delay / 10 + 1;
+			increase_busy_delay(target, DELAY_SB_WRITE);
 		}
 
 		if (get_field(sbcs, DM_SBCS_SBBUSYERROR) || dmi_busy_encountered) {
@@ -3796,6 +5406,9 @@ static int write_memory_bus_v1(struct target *target, target_addr_t address,
 			/* Fail the whole operation */
 			return ERROR_FAIL;
 		}
+
+		busy_delay_succeeded(target, DELAY_SB_WRITE,
+				(next_address - batch_address) / size);
 	}
 
 	return ERROR_OK;
@@ -3832,36 +5445,31 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 	if (register_read(target, &s1, GDB_REGNO_S1) != ERROR_OK)
 		return ERROR_FAIL;
 
-	/* Write the program (store, increment) */
+	bool mprven = riscv_enable_virtual && has_sufficient_progbuf(target, 5) &&
+			get_field(mstatus, MSTATUS_MPRV);
+
+	/* Move as many words per program execution as the data registers hold.
+	 * Whatever is left over, or from the first block that fails, goes
+	 * through the one word at a time program below. */
 	struct riscv_program program;
-	riscv_program_init(&program, target);
-	if (riscv_enable_virtual && has_sufficient_progbuf(target, 5) && get_field(mstatus, MSTATUS_MPRV))
-		riscv_program_csrrsi(&program, GDB_REGNO_ZERO, CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
-
-	switch (size) {
-		case 1:
-			riscv_program_sbr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		case 2:
-			riscv_program_shr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		case 4:
-			riscv_program_swr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		case 8:
-			riscv_program_sdr(&program, GDB_REGNO_S1, GDB_REGNO_S0, 0);
-			break;
-		default:
-			LOG_ERROR("write_memory_progbuf(): Unsupported size: %d", size);
-			result = ERROR_FAIL;
-			goto error;
+	unsigned block_words = memory_block_words(target, size, mprven);
+	if (block_words && count >= 2 * block_words &&
+			memory_block_program(target, &program, true, block_words) == ERROR_OK &&
+			riscv_program_write(&program) == ERROR_OK) {
+		uint32_t blocks = count / block_words;
+		if (write_memory_progbuf_blocks(target, address, blocks, block_words,
+					buffer) == ERROR_OK) {
+			address += blocks * block_words * size;
+			buffer += blocks * block_words * size;
+			count -= blocks * block_words;
+		} else {
+			LOG_DEBUG("block write failed, falling back to one word at a time");
+		}
 	}
 
-	if (riscv_enable_virtual && has_sufficient_progbuf(target, 5) && get_field(mstatus, MSTATUS_MPRV))
-		riscv_program_csrrci(&program, GDB_REGNO_ZERO,  CSR_DCSR_MPRVEN, GDB_REGNO_DCSR);
-	riscv_program_addi(&program, GDB_REGNO_S0, GDB_REGNO_S0, size);
-
-	result = riscv_program_ebreak(&program);
+	/* Write the program (store, increment) */
+	result = memory_program(target, &program, MEM_PROGRAM_WRITE, size,
+			mprven, size);
 	if (result != ERROR_OK)
 		goto error;
 	riscv_program_write(&program);
@@ -3876,8 +5484,8 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 
 		struct riscv_batch *batch = riscv_batch_alloc(
 				target,
-				32,
-				info->dmi_busy_delay + info->ac_busy_delay);
+				0,
+				info->dmi_busy_delay);
 		if (!batch)
 			goto error;
 
@@ -3919,7 +5527,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 				}
 
 				/* Turn on autoexec */
-				dmi_write(target, DM_ABSTRACTAUTO,
+				abstractauto_write(target,
 						1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
 
 				setup_needed = false;
@@ -3927,15 +5535,19 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 				if (size > 4)
 					riscv_batch_add_dmi_write(batch, DM_DATA1, value >> 32);
 				riscv_batch_add_dmi_write(batch, DM_DATA0, value);
+				batch_add_delay(target, batch, DELAY_MEMORY);
 				if (riscv_batch_full(batch))
 					break;
 			}
 		}
 
+		size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
 		result = batch_run(target, batch);
-		riscv_batch_free(batch);
-		if (result != ERROR_OK)
+		if (result != ERROR_OK) {
+			riscv_batch_free(batch);
 			goto error;
+		}
 
 		/* Note that if the scan resulted in a Busy DMI response, it
 		 * is this read to abstractcs that will cause the dmi_busy_delay
@@ -3943,8 +5555,9 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 
 		uint32_t abstractcs;
 		bool dmi_busy_encountered;
-		result = dmi_op(target, &abstractcs, &dmi_busy_encountered,
-				DMI_OP_READ, DM_ABSTRACTCS, 0, false, true);
+		result = batch_get_status_read(target, batch, abstractcs_key,
+				DM_ABSTRACTCS, &abstractcs, &dmi_busy_encountered);
+		riscv_batch_free(batch);
 		if (result != ERROR_OK)
 			goto error;
 		while (get_field(abstractcs, DM_ABSTRACTCS_BUSY))
@@ -3953,15 +5566,17 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 		info->cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
 		if (info->cmderr == CMDERR_NONE && !dmi_busy_encountered) {
 			LOG_DEBUG("successful (partial?) memory write");
+			busy_delay_succeeded(target, DELAY_MEMORY,
+					(cur_addr - address) / size - start);
 		} else if (info->cmderr == CMDERR_BUSY || dmi_busy_encountered) {
 			if (info->cmderr == CMDERR_BUSY)
 				LOG_DEBUG("Memory write resulted in abstract command busy response.");
 			else if (dmi_busy_encountered)
 				LOG_DEBUG("Memory write resulted in DMI busy response.");
 			riscv013_clear_abstract_error(target);
-			increase_ac_busy_delay(target);
+			increase_busy_delay(target, DELAY_MEMORY);
 
-			dmi_write(target, DM_ABSTRACTAUTO, 0);
+			abstractauto_write(target, 0);
 			result = register_read_direct(target, &cur_addr, GDB_REGNO_S0);
 			if (result != ERROR_OK)
 				goto error;
@@ -3975,7 +5590,7 @@ static int write_memory_progbuf(struct target *target, target_addr_t address,
 	}
 
 error:
-	dmi_write(target, DM_ABSTRACTAUTO, 0);
+	abstractauto_write(target, 0);
 
 	if (register_write_direct(target, GDB_REGNO_S1, s1) != ERROR_OK)
 		return ERROR_FAIL;
@@ -3987,7 +5602,8 @@ error:
 		if (register_write_direct(target, GDB_REGNO_MSTATUS, mstatus_old))
 			return ERROR_FAIL;
 
-	if (execute_fence(target) != ERROR_OK)
+	RISCV_INFO(r);
+	if (!r->defer_fence && execute_fence(target) != ERROR_OK)
 		return ERROR_FAIL;
 
 	return result;
@@ -4002,15 +5618,19 @@ static int write_memory(struct target *target, target_addr_t address,
 	}
 
 	int ret = ERROR_FAIL;
-	RISCV_INFO(r);
 	RISCV013_INFO(info);
 
 	char *progbuf_result = "disabled";
 	char *sysbus_result = "disabled";
 	char *abstract_result = "disabled";
 
+	int methods[RISCV_NUM_MEM_ACCESS_METHODS];
+	riscv_mem_access_order(target, address, size, count, true, methods);
+
 	for (unsigned i = 0; i < RISCV_NUM_MEM_ACCESS_METHODS; i++) {
-		int method = r->mem_access_methods[i];
+		int method = methods[i];
+		struct duration bench;
+		duration_start(&bench);
 
 		if (method == RISCV_MEM_ACCESS_PROGBUF) {
 			if (mem_should_skip_progbuf(target, address, size, false, &progbuf_result))
@@ -4044,6 +5664,9 @@ static int write_memory(struct target *target, target_addr_t address,
 			break;
 
 		log_mem_access_result(target, ret == ERROR_OK, method, false);
+		duration_measure(&bench);
+		riscv_mem_access_record(target, address, size, count, true, method,
+				ret == ERROR_OK, duration_elapsed(&bench));
 
 		if (ret == ERROR_OK)
 			return ret;
@@ -4051,6 +5674,9 @@ static int write_memory(struct target *target, target_addr_t address,
 
 	LOG_ERROR("Target %s: Failed to write memory (addr=0x%" PRIx64 ")", target_name(target), address);
 	LOG_ERROR("  progbuf=%s, sysbus=%s, abstract=%s", progbuf_result, sysbus_result, abstract_result);
+	if (target->state != TARGET_HALTED)
+		LOG_ERROR("  %s is running, only system bus access leaves it alone",
+				target_name(target));
 	return ret;
 }
 
@@ -4104,200 +5730,1545 @@ static int riscv013_get_register(struct target *target,
 			*value = -1;
 	}
 
-	return result;
+	return result;
+}
+
+static int riscv013_set_register(struct target *target, int rid, uint64_t value)
+{
+	riscv013_select_current_hart(target);
+	LOG_DEBUG("[%d] writing 0x%" PRIx64 " to register %s",
+			target->coreid, value, gdb_regno_name(rid));
+
+	if (rid <= GDB_REGNO_XPR31) {
+		return register_write_direct(target, rid, value);
+	} else if (rid == GDB_REGNO_PC) {
+		LOG_DEBUG("[%d] writing PC to DPC: 0x%" PRIx64, target->coreid, value);
+		register_write_direct(target, GDB_REGNO_DPC, value);
+		uint64_t actual_value;
+		register_read_direct(target, &actual_value, GDB_REGNO_DPC);
+		LOG_DEBUG("[%d]   actual DPC written: 0x%016" PRIx64, target->coreid, actual_value);
+		if (value != actual_value) {
+			LOG_ERROR("Written PC (0x%" PRIx64 ") does not match read back "
+					"value (0x%" PRIx64 ")", value, actual_value);
+			return ERROR_FAIL;
+		}
+	} else if (rid == GDB_REGNO_PRIV) {
+		uint64_t dcsr;
+		register_read(target, &dcsr, GDB_REGNO_DCSR);
+		dcsr = set_field(dcsr, CSR_DCSR_PRV, value);
+		return register_write_direct(target, GDB_REGNO_DCSR, dcsr);
+	} else {
+		return register_write_direct(target, rid, value);
+	}
+
+	return ERROR_OK;
+}
+
+static int riscv013_select_current_hart(struct target *target)
+{
+	RISCV_INFO(r);
+
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return ERROR_FAIL;
+	if (r->current_hartid == dm->current_hartid)
+		return ERROR_OK;
+
+	uint32_t dmcontrol;
+	if (dm->shadow.dmcontrol_valid)
+		dmcontrol = dm->shadow.dmcontrol;
+	else if (dmi_read(target, &dmcontrol, DM_DMCONTROL) != ERROR_OK)
+		return ERROR_FAIL;
+	dmcontrol = set_hartsel(dmcontrol, r->current_hartid);
+	int result = dmi_write(target, DM_DMCONTROL, dmcontrol);
+	dm->current_hartid = r->current_hartid;
+	return result;
+}
+
+/* Select all harts that were prepped and that are selectable, clearing the
+ * prepped flag on the harts that actually were selected. */
+static int select_prepped_harts(struct target *target, bool *use_hasel)
+{
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return ERROR_FAIL;
+	if (!dm->hasel_supported) {
+		RISCV_INFO(r);
+		r->prepped = false;
+		*use_hasel = false;
+		return ERROR_OK;
+	}
+
+	assert(dm->hart_count);
+	unsigned hawindow_count = (dm->hart_count + 31) / 32;
+	uint32_t hawindow[hawindow_count];
+
+	memset(hawindow, 0, sizeof(uint32_t) * hawindow_count);
+
+	target_list_t *entry;
+	unsigned total_selected = 0;
+	list_for_each_entry(entry, &dm->target_list, list) {
+		struct target *t = entry->target;
+		riscv_info_t *r = riscv_info(t);
+		riscv013_info_t *info = get_info(t);
+		unsigned index = info->index;
+		LOG_DEBUG("index=%d, coreid=%d, prepped=%d", index, t->coreid, r->prepped);
+		r->selected = r->prepped;
+		if (r->prepped) {
+			hawindow[index / 32] |= 1 << (index % 32);
+			r->prepped = false;
+			total_selected++;
+		}
+		index++;
+	}
+
+	/* Don't use hasel if we only need to talk to one hart. */
+	if (total_selected <= 1) {
+		*use_hasel = false;
+		return ERROR_OK;
+	}
+
+	for (unsigned i = 0; i < hawindow_count; i++) {
+		if (dmi_write(target, DM_HAWINDOWSEL, i) != ERROR_OK)
+			return ERROR_FAIL;
+		if (dmi_write(target, DM_HAWINDOW, hawindow[i]) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	*use_hasel = true;
+	return ERROR_OK;
+}
+
+/* DMI busy is sticky, so if the last read of a batch succeeded, so did
+ * everything before it. */
+static int group_batch_status(struct target *target, struct riscv_batch *batch,
+		size_t last_key)
+{
+	dmi_status_t status = riscv_batch_get_dmi_read_op(batch, last_key);
+	if (status == DMI_STATUS_SUCCESS)
+		return ERROR_OK;
+	if (status == DMI_STATUS_BUSY)
+		increase_dmi_busy_delay(target);
+	return ERROR_FAIL;
+}
+
+#define MAX_GROUP_DMS	16
+
+/* Scans that carry one DMI operation for each of several targets, each with
+ * its own DM on its own TAP, with any other TAP in BYPASS. That only works
+ * on a plain JTAG chain, where the IR of every TAP can be set in one scan. */
+typedef struct {
+	unsigned count;
+	struct {
+		struct target *target;
+		unsigned offset;
+		unsigned bits;
+	} dm[MAX_GROUP_DMS];
+	unsigned ir_bits;
+	unsigned dr_bits;
+} multi_dmi_t;
+
+static int multi_dmi_init(multi_dmi_t *m, struct target * const *targets,
+		unsigned count)
+{
+	if (use_vjtag || bscan_tunnel_ir_width != 0 || count == 0 ||
+			count > MAX_GROUP_DMS)
+		return ERROR_NOT_IMPLEMENTED;
+
+	m->count = count;
+	for (unsigned i = 0; i < count; i++) {
+		riscv013_info_t *info = get_info(targets[i]);
+		if (info->abits == 0 || info->abits > 32)
+			return ERROR_NOT_IMPLEMENTED;
+		for (unsigned j = 0; j < i; j++) {
+			if (targets[j]->tap == targets[i]->tap)
+				return ERROR_NOT_IMPLEMENTED;
+		}
+		m->dm[i].target = targets[i];
+		m->dm[i].bits = info->abits + DTM_DMI_OP_LENGTH + DTM_DMI_DATA_LENGTH;
+	}
+
+	m->ir_bits = 0;
+	m->dr_bits = 0;
+	unsigned found = 0;
+	for (struct jtag_tap *tap = jtag_tap_next_enabled(NULL); tap;
+			tap = jtag_tap_next_enabled(tap)) {
+		unsigned i;
+		for (i = 0; i < count; i++) {
+			if (m->dm[i].target->tap == tap)
+				break;
+		}
+		if (i < count) {
+			if (tap->ir_length != select_dbus.num_bits)
+				return ERROR_NOT_IMPLEMENTED;
+			m->dm[i].offset = m->dr_bits;
+			m->dr_bits += m->dm[i].bits;
+			found++;
+		} else {
+			/* A TAP in BYPASS has a 1-bit DR. */
+			m->dr_bits++;
+		}
+		m->ir_bits += tap->ir_length;
+	}
+	return found == count ? ERROR_OK : ERROR_NOT_IMPLEMENTED;
+}
+
+/* Queue the IR scan that selects DMI on every TAP of m. */
+static int multi_dmi_select(const multi_dmi_t *m)
+{
+	uint8_t *ir_out = calloc(1, DIV_ROUND_UP(m->ir_bits, 8));
+	if (!ir_out)
+		return ERROR_FAIL;
+
+	unsigned ir_offset = 0;
+	for (struct jtag_tap *tap = jtag_tap_next_enabled(NULL); tap;
+			tap = jtag_tap_next_enabled(tap)) {
+		bool selected = false;
+		for (unsigned i = 0; i < m->count; i++)
+			selected |= m->dm[i].target->tap == tap;
+		for (int bit = 0; bit < tap->ir_length; bit++) {
+			bool one = selected ?
+				buf_get_u32(select_dbus.out_value, bit, 1) : true;
+			buf_set_u32(ir_out, ir_offset + bit, 1, one);
+		}
+		ir_offset += tap->ir_length;
+	}
+
+	jtag_add_plain_ir_scan(m->ir_bits, ir_out, NULL, TAP_IDLE);
+	free(ir_out);
+	return ERROR_OK;
+}
+
+/* Put the IR of the other TAPs back to BYPASS, which is what the rest of the
+ * code (and the JTAG layer's idea of each TAP) expects. */
+static void multi_dmi_deselect(const multi_dmi_t *m)
+{
+	select_dmi(m->dm[0].target);
+}
+
+static void multi_dmi_set(const multi_dmi_t *m, uint8_t *out, unsigned i,
+		dmi_op_t op, uint32_t address, uint32_t data)
+{
+	buf_set_u32(out, m->dm[i].offset + DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH, op);
+	buf_set_u32(out, m->dm[i].offset + DTM_DMI_DATA_OFFSET,
+			DTM_DMI_DATA_LENGTH, data);
+	buf_set_u32(out, m->dm[i].offset + DTM_DMI_ADDRESS_OFFSET,
+			get_info(m->dm[i].target)->abits, address);
+}
+
+static dmi_status_t multi_dmi_status(const multi_dmi_t *m, const uint8_t *in,
+		unsigned i)
+{
+	return buf_get_u32(in, m->dm[i].offset + DTM_DMI_OP_OFFSET,
+			DTM_DMI_OP_LENGTH);
+}
+
+static uint32_t multi_dmi_data(const multi_dmi_t *m, const uint8_t *in,
+		unsigned i)
+{
+	return buf_get_u32(in, m->dm[i].offset + DTM_DMI_DATA_OFFSET,
+			DTM_DMI_DATA_LENGTH);
+}
+
+/* Find the halt state of a group whose harts are on several DMs, each on its
+ * own TAP, by reading every DM's haltsum0 in the same DR scans. So the whole
+ * group costs one round trip, however many DMs it spans. */
+static int group_halted_across_dms(struct target *target, bool *halted)
+{
+	struct target *targets[MAX_GROUP_DMS] = {NULL};
+	unsigned dm_count = 0;
+
+	for (struct target_list *list = target->head; list; list = list->next) {
+		struct target *t = list->target;
+		dm013_info_t *dm = get_dm(t);
+		if (!dm || t->state == TARGET_RESET || get_info(t)->index >= 32)
+			return ERROR_NOT_IMPLEMENTED;
+		unsigned i;
+		for (i = 0; i < dm_count; i++) {
+			if (get_dm(targets[i]) == dm)
+				break;
+		}
+		if (i < dm_count)
+			continue;
+		if (dm_count == MAX_GROUP_DMS)
+			return ERROR_NOT_IMPLEMENTED;
+		targets[dm_count++] = t;
+	}
+
+	multi_dmi_t m;
+	int result = multi_dmi_init(&m, targets, dm_count);
+	if (result != ERROR_OK)
+		return result;
+
+	size_t idle = 0;
+	for (unsigned i = 0; i < dm_count; i++)
+		idle = MAX(idle, get_info(targets[i])->dmi_busy_delay);
+
+	uint8_t *dr_out = calloc(1, DIV_ROUND_UP(m.dr_bits, 8));
+	uint8_t *dr_nop = calloc(1, DIV_ROUND_UP(m.dr_bits, 8));
+	uint8_t *dr_in = calloc(1, DIV_ROUND_UP(m.dr_bits, 8));
+	result = ERROR_FAIL;
+	if (!dr_out || !dr_nop || !dr_in)
+		goto out;
+
+	for (unsigned i = 0; i < dm_count; i++)
+		multi_dmi_set(&m, dr_out, i, DMI_OP_READ, DM_HALTSUM0, 0);
+
+	if (multi_dmi_select(&m) != ERROR_OK)
+		goto out;
+	jtag_add_plain_dr_scan(m.dr_bits, dr_out, NULL, TAP_IDLE);
+	if (idle)
+		jtag_add_runtest(idle, TAP_IDLE);
+	jtag_add_plain_dr_scan(m.dr_bits, dr_nop, dr_in, TAP_IDLE);
+	multi_dmi_deselect(&m);
+	if (jtag_execute_queue() != ERROR_OK)
+		goto out;
+
+	uint32_t haltsum0[MAX_GROUP_DMS];
+	result = ERROR_OK;
+	for (unsigned i = 0; i < dm_count; i++) {
+		dmi_status_t status = multi_dmi_status(&m, dr_in, i);
+		if (status != DMI_STATUS_SUCCESS) {
+			LOG_DEBUG("[%s] haltsum0 read got status %d; polling harts one "
+					"at a time", target_name(targets[i]), status);
+			if (status == DMI_STATUS_BUSY)
+				increase_dmi_busy_delay(targets[i]);
+			result = ERROR_FAIL;
+			continue;
+		}
+		haltsum0[i] = multi_dmi_data(&m, dr_in, i);
+		LOG_DEBUG("[%s] haltsum0=0x%08" PRIx32, target_name(targets[i]),
+				haltsum0[i]);
+	}
+	if (result != ERROR_OK)
+		goto out;
+
+	unsigned n = 0;
+	for (struct target_list *list = target->head; list; list = list->next, n++) {
+		struct target *t = list->target;
+		for (unsigned i = 0; i < dm_count; i++) {
+			if (get_dm(targets[i]) == get_dm(t))
+				halted[n] = (haltsum0[i] >> get_info(t)->index) & 1;
+		}
+	}
+
+out:
+	free(dr_out);
+	free(dr_nop);
+	free(dr_in);
+	return result;
+}
+
+/* Scans queued per flush by riscv013_write_memory_parallel(). */
+#define PARALLEL_WRITE_SCANS	256
+
+/* Write words[i] 32-bit words from buffer[i] to address[i] through the system
+ * bus of targets[i], for all the targets at once. Each DR scan carries the
+ * next sbdata0 write for every target, so the per-scan overhead, and the
+ * time spent waiting for the slowest bus, is shared between them. A target
+ * whose DMI or bus was busy during a flush drops out, and the rest of its
+ * data is written the normal way afterwards. */
+static int riscv013_write_memory_parallel(unsigned count,
+		struct target * const *targets, const target_addr_t *address,
+		const uint8_t * const *buffer, const uint32_t *words)
+{
+	multi_dmi_t m;
+	int result = multi_dmi_init(&m, targets, count);
+	if (result != ERROR_OK)
+		return result;
+	for (unsigned i = 0; i < count; i++) {
+		if (!sba_supports_access(targets[i], 4) || address[i] % 4)
+			return ERROR_NOT_IMPLEMENTED;
+		for (unsigned j = 0; j < i; j++) {
+			if (get_dm(targets[j]) == get_dm(targets[i]))
+				return ERROR_NOT_IMPLEMENTED;
+		}
+	}
+
+	/* Words known to have been written, and whether the target still takes
+	 * part. */
+	uint32_t done[MAX_GROUP_DMS] = {0};
+	bool active[MAX_GROUP_DMS];
+	size_t idle = 0;
+	uint32_t max_words = 0;
+	for (unsigned i = 0; i < count; i++) {
+		struct target *t = targets[i];
+		riscv013_info_t *info = get_info(t);
+		uint32_t sbcs = set_field(sb_sbaccess(4), DM_SBCS_SBAUTOINCREMENT, 1);
+		if (dmi_write(t, DM_SBCS, sbcs) != ERROR_OK ||
+				sb_write_address(t, address[i], true) != ERROR_OK)
+			return ERROR_FAIL;
+		active[i] = words[i] > 0;
+		idle = MAX(idle, info->dmi_busy_delay + info->bus_master_write_delay);
+		max_words = MAX(max_words, words[i]);
+	}
+
+	size_t scan_bytes = DIV_ROUND_UP(m.dr_bits, 8);
+	uint8_t *out = malloc(scan_bytes);
+	uint8_t *in = malloc(scan_bytes * 2);
+	if (!out || !in) {
+		result = ERROR_FAIL;
+		goto out;
+	}
+
+	for (uint32_t round = 0; round < max_words; ) {
+		uint32_t rounds = MIN(max_words - round, PARALLEL_WRITE_SCANS);
+		bool any = false;
+		for (unsigned i = 0; i < count; i++)
+			any |= active[i];
+		if (!any)
+			break;
+
+		if (multi_dmi_select(&m) != ERROR_OK) {
+			result = ERROR_FAIL;
+			goto out;
+		}
+		/* A busy status comes back in the scan after the one that caused it,
+		 * and sticks until it's cleared, so only the final sbcs read needs to
+		 * be looked at. */
+		for (uint32_t r = 0; r < rounds; r++) {
+			memset(out, 0, scan_bytes);
+			for (unsigned i = 0; i < count; i++) {
+				uint32_t w = round + r;
+				if (active[i] && w < words[i])
+					multi_dmi_set(&m, out, i, DMI_OP_WRITE, DM_SBDATA0,
+							buf_get_u32(buffer[i] + 4 * w, 0, 32));
+			}
+			jtag_add_plain_dr_scan(m.dr_bits, out, NULL, TAP_IDLE);
+			if (idle)
+				jtag_add_runtest(idle, TAP_IDLE);
+		}
+		memset(out, 0, scan_bytes);
+		for (unsigned i = 0; i < count; i++)
+			multi_dmi_set(&m, out, i, DMI_OP_READ, DM_SBCS, 0);
+		jtag_add_plain_dr_scan(m.dr_bits, out, in, TAP_IDLE);
+		if (idle)
+			jtag_add_runtest(idle, TAP_IDLE);
+		memset(out, 0, scan_bytes);
+		jtag_add_plain_dr_scan(m.dr_bits, out, in + scan_bytes, TAP_IDLE);
+		multi_dmi_deselect(&m);
+		if (jtag_execute_queue() != ERROR_OK) {
+			result = ERROR_FAIL;
+			goto out;
+		}
+
+		for (unsigned i = 0; i < count; i++) {
+			if (!active[i])
+				continue;
+			struct target *t = targets[i];
+			dmi_status_t status = multi_dmi_status(&m, in, i);
+			dmi_status_t sbcs_status = multi_dmi_status(&m, in + scan_bytes, i);
+			uint32_t sbcs = multi_dmi_data(&m, in + scan_bytes, i);
+			if (status == DMI_STATUS_BUSY || sbcs_status != DMI_STATUS_SUCCESS) {
+				LOG_DEBUG("[%s] DMI busy during parallel write", target_name(t));
+				increase_dmi_busy_delay(t);
+				active[i] = false;
+			} else if (get_field(sbcs, DM_SBCS_SBBUSYERROR) ||
+					get_field(sbcs, DM_SBCS_SBERROR)) {
+				LOG_DEBUG("[%s] sbcs=0x%" PRIx32 " after parallel write",
+						target_name(t), sbcs);
+				if (get_field(sbcs, DM_SBCS_SBBUSYERROR))
+					increase_busy_delay(t, DELAY_SB_WRITE);
+				dmi_write(t, DM_SBCS, sbcs | DM_SBCS_SBBUSYERROR | DM_SBCS_SBERROR);
+				active[i] = false;
+			} else {
+				done[i] = MIN(words[i], round + rounds);
+				active[i] = done[i] < words[i];
+			}
+		}
+		round += rounds;
+	}
+
+	/* Whatever didn't make it is written one target at a time, which also
+	 * waits for sbbusy and reports errors properly. */
+	for (unsigned i = 0; i < count; i++) {
+		if (done[i] == words[i])
+			continue;
+		LOG_DEBUG("[%s] writing the remaining %" PRIu32 " words on its own",
+				target_name(targets[i]), words[i] - done[i]);
+		if (write_memory_bus_v1(targets[i], address[i] + 4 * done[i], 4,
+					words[i] - done[i], buffer[i] + 4 * done[i]) != ERROR_OK)
+			result = ERROR_FAIL;
+	}
+
+	/* Make sure the last writes have completed. */
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t sbcs;
+		if (read_sbcs_nonbusy(targets[i], &sbcs) != ERROR_OK)
+			result = ERROR_FAIL;
+	}
+
+out:
+	free(out);
+	free(in);
+	return result;
+}
+
+/* Find the halt state of every hart in the group from the summary registers,
+ * without selecting each hart.
+ *
+ * The first batch reads dmstatus over the whole group (through hasel), to
+ * show whether any hart needs a closer look because it was reset or is
+ * unavailable. With more than 32 harts it then reads haltsum1, which has one
+ * bit per window of 32 harts. A clear bit means every hart in that window is
+ * running, so haltsum0 is only read (in a second batch) for windows that have
+ * a halted hart in them. When nothing is halted, which is the common case
+ * while polling, this costs one batch no matter how many harts there are. */
+static int riscv013_group_halted(struct target *target, bool *halted)
+{
+	RISCV013_INFO(info);
+
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return ERROR_FAIL;
+	if (!target->smp)
+		return ERROR_NOT_IMPLEMENTED;
+
+	for (struct target_list *list = target->head; list; list = list->next) {
+		if (get_dm(list->target) != dm)
+			return group_halted_across_dms(target, halted);
+	}
+
+	if (!dm->hasel_supported || !dm->hart_count)
+		return ERROR_NOT_IMPLEMENTED;
+
+	unsigned window_count = (dm->hart_count + 31) / 32;
+	/* haltsum1 covers the first 1024 harts. */
+	if (window_count > 32)
+		return ERROR_NOT_IMPLEMENTED;
+	uint32_t hawindow[window_count];
+	memset(hawindow, 0, sizeof(uint32_t) * window_count);
+
+	for (struct target_list *list = target->head; list; list = list->next) {
+		struct target *t = list->target;
+		/* Resetting harts need dmcontrol left alone, and harts on other
+		 * DMs can't be reached from here. */
+		if (t->state == TARGET_RESET || get_dm(t) != dm)
+			return ERROR_NOT_IMPLEMENTED;
+		unsigned index = get_info(t)->index;
+		if (index >= window_count * 32)
+			return ERROR_NOT_IMPLEMENTED;
+		hawindow[index / 32] |= 1 << (index % 32);
+	}
+
+	struct riscv_batch *batch = riscv_batch_alloc(target, 2 * window_count + 4,
+			info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+
+	for (unsigned i = 0; i < window_count; i++) {
+		riscv_batch_add_dmi_write(batch, DM_HAWINDOWSEL, i);
+		riscv_batch_add_dmi_write(batch, DM_HAWINDOW, hawindow[i]);
+	}
+	riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+			set_hartsel(DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_HASEL, info->index));
+	size_t dmstatus_key = riscv_batch_add_dmi_read(batch, DM_DMSTATUS);
+	riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+			set_hartsel(DM_DMCONTROL_DMACTIVE, 0));
+	size_t summary_key = riscv_batch_add_dmi_read(batch,
+			window_count > 1 ? DM_HALTSUM1 : DM_HALTSUM0);
+
+	/* hartsel no longer matches any target. */
+	dm->current_hartid = -1;
+
+	int result = batch_run(target, batch);
+	if (result == ERROR_OK)
+		result = group_batch_status(target, batch, summary_key);
+	if (result != ERROR_OK) {
+		riscv_batch_free(batch);
+		return result;
+	}
+
+	uint32_t dmstatus = riscv_batch_get_dmi_read_data(batch, dmstatus_key);
+	uint32_t summary = riscv_batch_get_dmi_read_data(batch, summary_key);
+	riscv_batch_free(batch);
+	if (get_field(dmstatus, DM_DMSTATUS_ANYUNAVAIL) ||
+			get_field(dmstatus, DM_DMSTATUS_ANYNONEXISTENT) ||
+			get_field(dmstatus, DM_DMSTATUS_ANYHAVERESET)) {
+		LOG_DEBUG("dmstatus=0x%x; polling harts one at a time", dmstatus);
+		return ERROR_FAIL;
+	}
+
+	uint32_t haltsum0[window_count];
+	memset(haltsum0, 0, sizeof(uint32_t) * window_count);
+	if (window_count == 1) {
+		haltsum0[0] = summary;
+	} else if (summary) {
+		batch = riscv_batch_alloc(target, 2 * window_count,
+				info->dmi_busy_delay);
+		if (!batch)
+			return ERROR_FAIL;
+		size_t haltsum0_keys[window_count];
+		size_t last_key = 0;
+		bool any_reads = false;
+		for (unsigned i = 0; i < window_count; i++) {
+			if (!(summary & (1 << i)) || !hawindow[i])
+				continue;
+			riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+					set_hartsel(DM_DMCONTROL_DMACTIVE, i * 32));
+			haltsum0_keys[i] = riscv_batch_add_dmi_read(batch, DM_HALTSUM0);
+			last_key = haltsum0_keys[i];
+			any_reads = true;
+		}
+		if (any_reads) {
+			result = batch_run(target, batch);
+			if (result == ERROR_OK)
+				result = group_batch_status(target, batch, last_key);
+			if (result != ERROR_OK) {
+				riscv_batch_free(batch);
+				return result;
+			}
+			for (unsigned i = 0; i < window_count; i++)
+				if ((summary & (1 << i)) && hawindow[i])
+					haltsum0[i] = riscv_batch_get_dmi_read_data(batch,
+							haltsum0_keys[i]);
+		}
+		riscv_batch_free(batch);
+	}
+
+	unsigned i = 0;
+	for (struct target_list *list = target->head; list; list = list->next, i++) {
+		unsigned index = get_info(list->target)->index;
+		halted[i] = (haltsum0[index / 32] >> (index % 32)) & 1;
+	}
+
+	return ERROR_OK;
+}
+
+static int riscv013_halt_prep(struct target *target)
+{
+	return ERROR_OK;
+}
+
+static int riscv013_halt_go(struct target *target)
+{
+	bool use_hasel = false;
+	if (select_prepped_harts(target, &use_hasel) != ERROR_OK)
+		return ERROR_FAIL;
+
+	RISCV_INFO(r);
+	LOG_DEBUG("halting hart %d", r->current_hartid);
+
+	/* Issue the halt command, and then wait for the current hart to halt. */
+	uint32_t dmcontrol = DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_HALTREQ;
+	if (use_hasel)
+		dmcontrol |= DM_DMCONTROL_HASEL;
+	dmcontrol = set_hartsel(dmcontrol, r->current_hartid);
+	dmi_write(target, DM_DMCONTROL, dmcontrol);
+	for (size_t i = 0; i < 256; ++i)
+		if (riscv_is_halted(target))
+			break;
+
+	if (!riscv_is_halted(target)) {
+		uint32_t dmstatus;
+		if (dmstatus_read(target, &dmstatus, true) != ERROR_OK)
+			return ERROR_FAIL;
+		if (dmi_read(target, &dmcontrol, DM_DMCONTROL) != ERROR_OK)
+			return ERROR_FAIL;
+
+		LOG_ERROR("unable to halt hart %d", r->current_hartid);
+		LOG_ERROR("  dmcontrol=0x%08x", dmcontrol);
+		LOG_ERROR("  dmstatus =0x%08x", dmstatus);
+		return ERROR_FAIL;
+	}
+
+	dmcontrol = set_field(dmcontrol, DM_DMCONTROL_HALTREQ, 0);
+	dmi_write(target, DM_DMCONTROL, dmcontrol);
+
+	if (use_hasel) {
+		target_list_t *entry;
+		dm013_info_t *dm = get_dm(target);
+		if (!dm)
+			return ERROR_FAIL;
+		list_for_each_entry(entry, &dm->target_list, list) {
+			struct target *t = entry->target;
+			t->state = TARGET_HALTED;
+			if (t->debug_reason == DBG_REASON_NOTHALTED)
+				t->debug_reason = DBG_REASON_DBGRQ;
+		}
+	}
+	/* The "else" case is handled in halt_go(). */
+
+	return ERROR_OK;
+}
+
+static int riscv013_resume_go(struct target *target)
+{
+	bool use_hasel = false;
+	if (select_prepped_harts(target, &use_hasel) != ERROR_OK)
+		return ERROR_FAIL;
+
+	return riscv013_step_or_resume_current_hart(target, false, use_hasel);
+}
+
+/* Every sample is a halt request, a read of dpc and a resume request, all
+ * queued up in one batch. cmderr is sticky, so if any of the halts didn't
+ * complete before its dpc read, the whole batch is thrown away and retried
+ * with more time between scans. */
+static int riscv013_sample_pc(struct target *target, uint32_t *samples,
+		unsigned max, unsigned *count)
+{
+	RISCV013_INFO(info);
+	RISCV_INFO(r);
+
+	*count = 0;
+
+	bool use_hasel = false;
+	if (select_prepped_harts(target, &use_hasel) != ERROR_OK)
+		return ERROR_FAIL;
+
+	uint32_t dmcontrol = set_hartsel(DM_DMCONTROL_DMACTIVE, r->current_hartid);
+	if (use_hasel)
+		dmcontrol |= DM_DMCONTROL_HASEL;
+	/* Only the low 32 bits of the pc are used, which are in data0 even for
+	 * a 64-bit access. */
+	uint32_t command = access_register_command(target, GDB_REGNO_DPC,
+			riscv_xlen(target), AC_ACCESS_REGISTER_TRANSFER);
+
+	struct riscv_batch *batch = riscv_batch_alloc(target, 0,
+			info->dmi_busy_delay + info->ac_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+
+	unsigned n = MIN(max, (riscv_batch_available_scans(batch) - 1) / 6);
+	size_t keys[n];
+	for (unsigned i = 0; i < n; i++) {
+		riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+				dmcontrol | DM_DMCONTROL_HALTREQ);
+		riscv_batch_add_dmi_write(batch, DM_DMCONTROL, dmcontrol);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND, command);
+		keys[i] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+		riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+				dmcontrol | DM_DMCONTROL_RESUMEREQ);
+		riscv_batch_add_dmi_write(batch, DM_DMCONTROL, dmcontrol);
+	}
+	size_t abstractcs_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+
+	if (batch_run(target, batch) != ERROR_OK) {
+		riscv_batch_free(batch);
+		return ERROR_FAIL;
+	}
+
+	uint32_t abstractcs;
+	bool dmi_busy_encountered;
+	if (batch_get_status_read(target, batch, abstractcs_key, DM_ABSTRACTCS,
+				&abstractcs, &dmi_busy_encountered) != ERROR_OK) {
+		riscv_batch_free(batch);
+		return ERROR_FAIL;
+	}
+
+	int result = ERROR_OK;
+	unsigned cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+	switch (cmderr) {
+		case CMDERR_NONE:
+			if (dmi_busy_encountered)
+				break;
+			for (unsigned i = 0; i < n; i++)
+				samples[i] = riscv_batch_get_dmi_read_data(batch, keys[i]);
+			*count = n;
+			break;
+		case CMDERR_BUSY:
+		case CMDERR_HALT_RESUME:
+			LOG_DEBUG("pc sampling batch failed; abstractcs=0x%x", abstractcs);
+			increase_ac_busy_delay(target);
+			riscv013_clear_abstract_error(target);
+			break;
+		case CMDERR_NOT_SUPPORTED:
+			riscv013_clear_abstract_error(target);
+			result = ERROR_NOT_IMPLEMENTED;
+			break;
+		default:
+			LOG_ERROR("pc sampling failed; abstractcs=0x%x", abstractcs);
+			riscv013_clear_abstract_error(target);
+			result = ERROR_FAIL;
+			break;
+	}
+
+	riscv_batch_free(batch);
+	return result;
+}
+
+static int riscv013_resume_prep(struct target *target)
+{
+	return riscv013_on_step_or_resume(target, false);
+}
+
+static int riscv013_on_step(struct target *target)
+{
+	return riscv013_on_step_or_resume(target, true);
+}
+
+static int riscv013_on_halt(struct target *target)
+{
+	return ERROR_OK;
+}
+
+/* Queue abstract commands that read registers first..last into the batch,
+ * followed by a read of abstractcs.  Returns the key of the abstractcs read. */
+static size_t prefetch_queue_reads(struct target *target,
+		struct riscv_batch *batch, unsigned first, unsigned last,
+		size_t *keys)
+{
+	unsigned xlen = riscv_xlen(target);
+	for (unsigned regno = first; regno <= last; regno++) {
+		uint32_t command = access_register_command(target, regno, xlen,
+				AC_ACCESS_REGISTER_TRANSFER);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND, command);
+		batch_add_delay(target, batch, DELAY_ABSTRACT);
+		if (xlen > 32)
+			riscv_batch_add_dmi_read(batch, DM_DATA1);
+		keys[regno - first] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+	}
+	return riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+}
+
+/* Like prefetch_queue_reads(), but only write command once, with
+ * aarpostincrement set, and let autoexecdata run it again on every read of
+ * data0.  autoexecdata is turned off before the last read, so the command
+ * isn't executed for the register after last.  *abstractauto_key is set to
+ * the key of a read of abstractauto, to tell whether autoexec took. */
+static size_t prefetch_queue_autoexec_reads(struct target *target,
+		struct riscv_batch *batch, unsigned first, unsigned last,
+		size_t *keys, size_t *abstractauto_key)
+{
+	unsigned xlen = riscv_xlen(target);
+	uint32_t command = access_register_command(target, first, xlen,
+			AC_ACCESS_REGISTER_TRANSFER |
+			AC_ACCESS_REGISTER_AARPOSTINCREMENT);
+	riscv_batch_add_dmi_write(batch, DM_COMMAND, command);
+	batch_add_delay(target, batch, DELAY_ABSTRACT);
+	riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO,
+			1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET);
+	*abstractauto_key = riscv_batch_add_dmi_read(batch, DM_ABSTRACTAUTO);
+	for (unsigned regno = first; regno <= last; regno++) {
+		if (regno == last)
+			riscv_batch_add_dmi_write(batch, DM_ABSTRACTAUTO, 0);
+		if (xlen > 32)
+			riscv_batch_add_dmi_read(batch, DM_DATA1);
+		keys[regno - first] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+		batch_add_delay(target, batch, DELAY_ABSTRACT);
+	}
+	return riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+}
+
+static void prefetch_store(struct target *target, struct riscv_batch *batch,
+		unsigned regno, size_t key)
+{
+	riscv_reg_t value = riscv_batch_get_dmi_read_data(batch, key);
+	if (riscv_xlen(target) > 32)
+		value |= ((riscv_reg_t)riscv_batch_get_dmi_read_data(batch, key - 1)) << 32;
+
+	struct reg *reg = &target->reg_cache->reg_list[regno];
+	if (reg->dirty)
+		return;
+	buf_set_u64(reg->value, 0, reg->size, value);
+	reg->valid = true;
+}
+
+/* Check how a group of prefetch commands did. cmderr is sticky, so a clean
+ * abstractcs at the end of the group means every command in it completed
+ * before its result was read. */
+static bool prefetch_group_ok(struct target *target, uint32_t abstractcs)
+{
+	RISCV013_INFO(info);
+
+	unsigned cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+	if (cmderr == CMDERR_NONE)
+		return true;
+
+	LOG_DEBUG("register prefetch failed; abstractcs=0x%x", abstractcs);
+	if (cmderr == CMDERR_BUSY)
+		increase_ac_busy_delay(target);
+	wait_for_idle(target, &abstractcs);
+	dmi_write(target, DM_ABSTRACTCS, DM_ABSTRACTCS_CMDERR);
+	info->cmderr = cmderr;
+	return false;
+}
+
+/* Read GPRs first..last, and dpc if read_dpc is set, in one batch.  With
+ * autoexec set the GPRs are streamed through a single abstract command.
+ * Returns ERROR_OK if the GPRs were read. */
+static int prefetch_registers_batch(struct target *target, unsigned first,
+		unsigned last, bool read_dpc, bool autoexec)
+{
+	RISCV013_INFO(info);
+
+	size_t gpr_keys[GDB_REGNO_XPR31 + 1];
+	size_t dpc_key;
+
+	struct riscv_batch *batch = riscv_batch_alloc(target,
+			(last - first + 2) * 3 + 8,
+			info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+
+	size_t abstractauto_key = 0;
+	size_t gpr_status_key;
+	if (autoexec)
+		gpr_status_key = prefetch_queue_autoexec_reads(target, batch, first,
+				last, gpr_keys, &abstractauto_key);
+	else
+		gpr_status_key = prefetch_queue_reads(target, batch, first, last,
+				gpr_keys);
+	/* dpc goes in its own group, so that a DM without abstract CSR access
+	 * doesn't spoil the GPRs. */
+	size_t dpc_status_key = 0;
+	if (read_dpc)
+		dpc_status_key = prefetch_queue_reads(target, batch, GDB_REGNO_DPC,
+				GDB_REGNO_DPC, &dpc_key);
+
+	int result = batch_run(target, batch);
+	if (result != ERROR_OK) {
+		if (autoexec)
+			abstractauto_write(target, 0);
+		riscv_batch_free(batch);
+		return result;
+	}
+
+	uint32_t abstractcs;
+	bool dmi_busy_encountered;
+	result = batch_get_status_read(target, batch, gpr_status_key,
+			DM_ABSTRACTCS, &abstractcs, &dmi_busy_encountered);
+	if (result == ERROR_OK && dmi_busy_encountered)
+		result = ERROR_FAIL;
+	if (result == ERROR_OK && !prefetch_group_ok(target, abstractcs)) {
+		if (autoexec && info->cmderr == CMDERR_NOT_SUPPORTED) {
+			LOG_DEBUG("aarpostincrement is not supported.");
+			info->has_aarpostincrement = YNM_NO;
+		}
+		info->cmderr = CMDERR_NONE;
+		result = ERROR_FAIL;
+	}
+	if (result == ERROR_OK && autoexec) {
+		uint32_t abstractauto = riscv_batch_get_dmi_read_data(batch,
+				abstractauto_key);
+		if (!(abstractauto & (1 << DM_ABSTRACTAUTO_AUTOEXECDATA_OFFSET))) {
+			LOG_DEBUG("autoexecdata is not supported.");
+			info->has_aarpostincrement = YNM_NO;
+			result = ERROR_FAIL;
+		} else {
+			info->has_aarpostincrement = YNM_YES;
+		}
+	}
+	if (result != ERROR_OK) {
+		if (autoexec)
+			abstractauto_write(target, 0);
+		riscv_batch_free(batch);
+		return result;
+	}
+
+	for (unsigned regno = first; regno <= last; regno++)
+		prefetch_store(target, batch, regno, gpr_keys[regno - first]);
+
+	if (read_dpc) {
+		result = batch_get_status_read(target, batch, dpc_status_key,
+				DM_ABSTRACTCS, &abstractcs, &dmi_busy_encountered);
+		if (result == ERROR_OK && !dmi_busy_encountered) {
+			if (prefetch_group_ok(target, abstractcs)) {
+				/* pc is read through dpc. Only the pc entry is filled
+				 * in, since writes to pc go to dpc without updating
+				 * its entry. */
+				prefetch_store(target, batch, GDB_REGNO_PC, dpc_key);
+			}
+			info->cmderr = CMDERR_NONE;
+		}
+	}
+
+	riscv_batch_free(batch);
+	return ERROR_OK;
+}
+
+/* Read all GPRs, and dpc when abstract CSR access works, with a single batch
+ * of abstract commands.  This is what gdb is going to ask for first after
+ * every halt (and in every 'g' packet), and it saves a round trip per
+ * register.  Where the DM supports aarpostincrement and autoexecdata, the
+ * GPRs are streamed by reading data0 over and over. */
+static int riscv013_prefetch_registers(struct target *target)
+{
+	RISCV013_INFO(info);
+
+	/* Nothing to do before examine() has figured out the register width. */
+	if (riscv_xlen(target) != 32 && riscv_xlen(target) != 64)
+		return ERROR_OK;
+
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	unsigned last = riscv_supports_extension(target, 'E') ?
+		GDB_REGNO_XPR15 : GDB_REGNO_XPR31;
+	bool read_dpc = info->abstract_read_csr_supported;
+
+	if (info->has_aarpostincrement != YNM_NO &&
+			prefetch_registers_batch(target, GDB_REGNO_RA, last, read_dpc,
+				true) == ERROR_OK)
+		return ERROR_OK;
+
+	return prefetch_registers_batch(target, GDB_REGNO_RA, last, read_dpc,
+			false);
+}
+
+/* How many harts riscv013_snapshot_group() reads in one batch */
+#define SNAPSHOT_BATCH_HARTS	16
+
+/* Read sp and dpc of the harts in one batch, selecting each in turn. */
+static int snapshot_batch(struct target *target, struct target **harts,
+		unsigned count)
+{
+	dm013_info_t *dm = get_dm(target);
+	RISCV013_INFO(info);
+
+	uint32_t dmcontrol;
+	if (dmi_read(target, &dmcontrol, DM_DMCONTROL) != ERROR_OK)
+		return ERROR_FAIL;
+
+	/* dmcontrol, two reads of up to three scans and their abstractcs */
+	struct riscv_batch *batch = riscv_batch_alloc(target, count * 9,
+			info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+
+	size_t sp_keys[SNAPSHOT_BATCH_HARTS];
+	size_t dpc_keys[SNAPSHOT_BATCH_HARTS];
+	size_t status_keys[SNAPSHOT_BATCH_HARTS];
+	for (unsigned i = 0; i < count; i++) {
+		riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+				set_hartsel(dmcontrol, riscv_info(harts[i])->current_hartid));
+		prefetch_queue_reads(harts[i], batch, GDB_REGNO_SP, GDB_REGNO_SP,
+				&sp_keys[i]);
+		/* cmderr is sticky, so this status covers both reads */
+		status_keys[i] = prefetch_queue_reads(harts[i], batch, GDB_REGNO_DPC,
+				GDB_REGNO_DPC, &dpc_keys[i]);
+	}
+
+	int result = batch_run(target, batch);
+	dm->current_hartid = riscv_info(harts[count - 1])->current_hartid;
+	if (result != ERROR_OK) {
+		dm->current_hartid = -1;
+		riscv_batch_free(batch);
+		return result;
+	}
+
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t abstractcs;
+		bool dmi_busy_encountered;
+		result = batch_get_status_read(harts[i], batch, status_keys[i],
+				DM_ABSTRACTCS, &abstractcs, &dmi_busy_encountered);
+		if (result == ERROR_OK && dmi_busy_encountered)
+			result = ERROR_FAIL;
+		if (result == ERROR_OK && !prefetch_group_ok(harts[i], abstractcs)) {
+			/* The harts after this one saw the same cmderr. */
+			get_info(harts[i])->cmderr = CMDERR_NONE;
+			result = ERROR_FAIL;
+		}
+		if (result != ERROR_OK)
+			break;
+
+		prefetch_store(harts[i], batch, GDB_REGNO_SP, sp_keys[i]);
+		/* Only the pc entry is filled in, as in prefetch_registers_batch() */
+		prefetch_store(harts[i], batch, GDB_REGNO_PC, dpc_keys[i]);
+	}
+
+	riscv_batch_free(batch);
+	return result;
+}
+
+/* Read sp and pc of all halted harts of the SMP group on this DM, which is
+ * enough for a debugger to list them, with one batch per
+ * SNAPSHOT_BATCH_HARTS harts instead of one per hart. The remaining
+ * registers of a hart are read when they are asked for. */
+static int riscv013_snapshot_group(struct target *target)
+{
+	dm013_info_t *dm = get_dm(target);
+	if (!dm)
+		return ERROR_FAIL;
+
+	struct target *harts[SNAPSHOT_BATCH_HARTS];
+	unsigned count = 0;
+	int result = ERROR_OK;
+	for (struct target_list *list = target->head; list; list = list->next) {
+		struct target *t = list->target;
+		if (t->state != TARGET_HALTED || !t->reg_cache || get_dm(t) != dm ||
+				!get_info(t)->abstract_read_csr_supported)
+			continue;
+		if (riscv_xlen(t) != 32 && riscv_xlen(t) != 64)
+			continue;
+		if (t->reg_cache->reg_list[GDB_REGNO_SP].valid &&
+				t->reg_cache->reg_list[GDB_REGNO_PC].valid)
+			continue;
+
+		harts[count++] = t;
+		if (count == SNAPSHOT_BATCH_HARTS) {
+			if (snapshot_batch(target, harts, count) != ERROR_OK)
+				result = ERROR_FAIL;
+			count = 0;
+		}
+	}
+
+	if (count > 0 && snapshot_batch(target, harts, count) != ERROR_OK)
+		result = ERROR_FAIL;
+	return result;
+}
+
+/* How many CSRs go in one batch. A CSR that can't be read spoils the rest of
+ * its batch (cmderr is sticky), so this is a compromise. */
+#define READ_CSRS_BATCH		64
+
+static void read_csrs_clear_cmderr(struct target *target)
+{
+	uint32_t abstractcs;
+	wait_for_idle(target, &abstractcs);
+	dmi_write(target, DM_ABSTRACTCS, DM_ABSTRACTCS_CMDERR);
+}
+
+/* Get the abstractcs read with the given key out of a batch. Returns false if
+ * the DMI was busy before that read, in which case everything after the busy
+ * response was lost and has to be done again. */
+static bool read_csrs_status(struct target *target, struct riscv_batch *batch,
+		size_t key, uint32_t *abstractcs)
+{
+	if (riscv_batch_get_dmi_read_op(batch, key) == DMI_STATUS_SUCCESS) {
+		*abstractcs = riscv_batch_get_dmi_read_data(batch, key);
+		return true;
+	}
+
+	batch_get_status_read(target, batch, key, DM_ABSTRACTCS, abstractcs, NULL);
+	if (get_field(*abstractcs, DM_ABSTRACTCS_CMDERR) != CMDERR_NONE)
+		read_csrs_clear_cmderr(target);
+	return false;
 }
 
-static int riscv013_set_register(struct target *target, int rid, uint64_t value)
+static riscv_reg_t read_csrs_value(struct riscv_batch *batch, size_t key,
+		unsigned size)
 {
-	riscv013_select_current_hart(target);
-	LOG_DEBUG("[%d] writing 0x%" PRIx64 " to register %s",
-			target->coreid, value, gdb_regno_name(rid));
+	riscv_reg_t value = riscv_batch_get_dmi_read_data(batch, key);
+	if (size > 32)
+		value |= ((riscv_reg_t)riscv_batch_get_dmi_read_data(batch, key - 1)) << 32;
+	return value;
+}
 
-	if (rid <= GDB_REGNO_XPR31) {
-		return register_write_direct(target, rid, value);
-	} else if (rid == GDB_REGNO_PC) {
-		LOG_DEBUG("[%d] writing PC to DPC: 0x%" PRIx64, target->coreid, value);
-		register_write_direct(target, GDB_REGNO_DPC, value);
-		uint64_t actual_value;
-		register_read_direct(target, &actual_value, GDB_REGNO_DPC);
-		LOG_DEBUG("[%d]   actual DPC written: 0x%016" PRIx64, target->coreid, actual_value);
-		if (value != actual_value) {
-			LOG_ERROR("Written PC (0x%" PRIx64 ") does not match read back "
-					"value (0x%" PRIx64 ")", value, actual_value);
+/* Read CSRs with abstract commands, READ_CSRS_BATCH at a time. Stops at the
+ * first CSR that can't be read this way, and sets *done to its index. */
+static int read_csrs_abstract(struct target *target, const unsigned *regnos,
+		unsigned count, riscv_reg_t *values, bool *valid, unsigned *done)
+{
+	RISCV013_INFO(info);
+
+	unsigned i = 0;
+	while (i < count) {
+		unsigned n = MIN(count - i, READ_CSRS_BATCH);
+		size_t data_keys[READ_CSRS_BATCH];
+		size_t status_keys[READ_CSRS_BATCH];
+
+		struct riscv_batch *batch = riscv_batch_alloc(target, n * 4,
+				info->dmi_busy_delay);
+		if (!batch)
+			break;
+		for (unsigned k = 0; k < n; k++) {
+			unsigned size = register_size(target, regnos[i + k]);
+			riscv_batch_add_dmi_write(batch, DM_COMMAND,
+					access_register_command(target, regnos[i + k], size,
+						AC_ACCESS_REGISTER_TRANSFER));
+			batch_add_delay(target, batch, DELAY_ABSTRACT);
+			if (size > 32)
+				riscv_batch_add_dmi_read(batch, DM_DATA1);
+			data_keys[k] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+			status_keys[k] = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+		}
+		if (batch_run(target, batch) != ERROR_OK) {
+			riscv_batch_free(batch);
+			*done = i;
 			return ERROR_FAIL;
 		}
-	} else if (rid == GDB_REGNO_PRIV) {
-		uint64_t dcsr;
-		register_read(target, &dcsr, GDB_REGNO_DCSR);
-		dcsr = set_field(dcsr, CSR_DCSR_PRV, value);
-		return register_write_direct(target, GDB_REGNO_DCSR, dcsr);
-	} else {
-		return register_write_direct(target, rid, value);
+
+		unsigned k;
+		unsigned cmderr = CMDERR_NONE;
+		for (k = 0; k < n; k++) {
+			uint32_t abstractcs;
+			if (!read_csrs_status(target, batch, status_keys[k], &abstractcs))
+				break;
+			cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+			if (cmderr != CMDERR_NONE)
+				break;
+			values[i + k] = read_csrs_value(batch, data_keys[k],
+					register_size(target, regnos[i + k]));
+			valid[i + k] = true;
+		}
+		riscv_batch_free(batch);
+		i += k;
+
+		if (cmderr == CMDERR_NONE)
+			continue;
+		read_csrs_clear_cmderr(target);
+		if (cmderr == CMDERR_BUSY) {
+			increase_ac_busy_delay(target);
+			continue;
+		}
+		if (cmderr == CMDERR_NOT_SUPPORTED) {
+			info->abstract_read_csr_supported = false;
+			LOG_INFO("Disabling abstract command reads from CSRs.");
+		}
+		break;
 	}
 
+	*done = i;
 	return ERROR_OK;
 }
 
-static int riscv013_select_current_hart(struct target *target)
+/* Read CSRs by running csrr s0, <csr> from the program buffer. Each command
+ * both transfers s0 (the previous CSR) to data0 and runs the program for the
+ * next CSR, so every CSR costs a progbuf write, a command and a data0 read,
+ * all in the same batch. Stops at the first CSR that can't be read, and sets
+ * *done to its index. */
+static int read_csrs_progbuf(struct target *target, const unsigned *regnos,
+		unsigned count, riscv_reg_t *values, bool *valid, unsigned *done)
 {
+	RISCV013_INFO(info);
 	RISCV_INFO(r);
 
-	dm013_info_t *dm = get_dm(target);
-	if (!dm)
+	*done = 0;
+
+	riscv_reg_t s0;
+	if (register_read(target, &s0, GDB_REGNO_S0) != ERROR_OK)
 		return ERROR_FAIL;
-	if (r->current_hartid == dm->current_hartid)
-		return ERROR_OK;
 
-	uint32_t dmcontrol;
-	/* TODO: can't we just "dmcontrol = DMI_DMACTIVE"? */
-	if (dmi_read(target, &dmcontrol, DM_DMCONTROL) != ERROR_OK)
+	if (riscv_debug_buffer_size(target) > 1 || !r->impebreak) {
+		if (riscv013_write_debug_buffer(target, 1, ebreak()) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	unsigned xlen = riscv_xlen(target);
+	uint32_t run = access_register_command(target, GDB_REGNO_S0, xlen,
+			AC_ACCESS_REGISTER_POSTEXEC);
+	uint32_t read_and_run = access_register_command(target, GDB_REGNO_S0, xlen,
+			AC_ACCESS_REGISTER_TRANSFER | AC_ACCESS_REGISTER_POSTEXEC);
+	uint32_t read = access_register_command(target, GDB_REGNO_S0, xlen,
+			AC_ACCESS_REGISTER_TRANSFER);
+
+	int result = ERROR_OK;
+	unsigned i = 0;
+	while (i < count) {
+		unsigned n = MIN(count - i, READ_CSRS_BATCH);
+		size_t data_keys[READ_CSRS_BATCH];
+		size_t status_keys[READ_CSRS_BATCH + 1];
+
+		struct riscv_batch *batch = riscv_batch_alloc(target, n * 5 + 4,
+				info->dmi_busy_delay);
+		if (!batch) {
+			result = ERROR_FAIL;
+			break;
+		}
+		for (unsigned k = 0; k <= n; k++) {
+			if (k < n)
+				riscv_batch_add_dmi_write(batch, DM_PROGBUF0,
+						csrr(S0, regnos[i + k] - GDB_REGNO_CSR0));
+			riscv_batch_add_dmi_write(batch, DM_COMMAND,
+					k == 0 ? run : (k < n ? read_and_run : read));
+			batch_add_delay(target, batch, DELAY_ABSTRACT);
+			if (k > 0) {
+				if (xlen > 32)
+					riscv_batch_add_dmi_read(batch, DM_DATA1);
+				data_keys[k - 1] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+			}
+			status_keys[k] = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+		}
+		/* progbuf0 was written behind the cache's back. */
+		progbuf_cache_invalidate(target, 0, 1);
+		if (batch_run(target, batch) != ERROR_OK) {
+			riscv_batch_free(batch);
+			result = ERROR_FAIL;
+			break;
+		}
+
+		/* status_keys[k] says whether CSR k - 1 made it into data0, and
+		 * whether the csrr for CSR k ran. */
+		unsigned k;
+		unsigned cmderr = CMDERR_NONE;
+		for (k = 0; k <= n; k++) {
+			uint32_t abstractcs;
+			if (!read_csrs_status(target, batch, status_keys[k], &abstractcs))
+				break;
+			cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+			if (cmderr == CMDERR_EXCEPTION && k > 0 && k < n) {
+				/* The transfer happens before the program runs, so
+				 * the previous CSR was still read. */
+				values[i + k - 1] = read_csrs_value(batch, data_keys[k - 1], xlen);
+				valid[i + k - 1] = true;
+			}
+			if (cmderr != CMDERR_NONE)
+				break;
+			if (k > 0) {
+				values[i + k - 1] = read_csrs_value(batch, data_keys[k - 1], xlen);
+				valid[i + k - 1] = true;
+			}
+		}
+		riscv_batch_free(batch);
+
+		if (k > n) {
+			i += n;
+			continue;
+		}
+		if (cmderr == CMDERR_EXCEPTION && k < n) {
+			/* CSR k doesn't exist. */
+			read_csrs_clear_cmderr(target);
+			i += k;
+			break;
+		}
+		/* Start again from the first CSR that wasn't read. */
+		i += k > 0 ? k - 1 : 0;
+		if (cmderr == CMDERR_NONE)
+			continue;
+		read_csrs_clear_cmderr(target);
+		if (cmderr == CMDERR_BUSY) {
+			increase_ac_busy_delay(target);
+			continue;
+		}
+		LOG_DEBUG("csrr from progbuf failed; cmderr=%d", cmderr);
+		break;
+	}
+	*done = i;
+
+	if (register_write_direct(target, GDB_REGNO_S0, s0) != ERROR_OK)
 		return ERROR_FAIL;
-	dmcontrol = set_hartsel(dmcontrol, r->current_hartid);
-	int result = dmi_write(target, DM_DMCONTROL, dmcontrol);
-	dm->current_hartid = r->current_hartid;
 	return result;
 }
 
-/* Select all harts that were prepped and that are selectable, clearing the
- * prepped flag on the harts that actually were selected. */
-static int select_prepped_harts(struct target *target, bool *use_hasel)
+/* Read count CSRs, given as GDB register numbers, into values. valid[i] is
+ * set for every CSR that could be read; the others probably don't exist.
+ * Abstract reads are tried first and progbuf reads after that, the same order
+ * register_read_direct() uses, but many CSRs go into each batch. FPU and
+ * vector CSRs may need mstatus changed first, so they're read one by one. */
+static int riscv013_read_csrs(struct target *target, const unsigned *regnos,
+		unsigned count, riscv_reg_t *values, bool *valid)
 {
-	dm013_info_t *dm = get_dm(target);
-	if (!dm)
-		return ERROR_FAIL;
-	if (!dm->hasel_supported) {
-		RISCV_INFO(r);
-		r->prepped = false;
-		*use_hasel = false;
-		return ERROR_OK;
-	}
+	RISCV013_INFO(info);
 
-	assert(dm->hart_count);
-	unsigned hawindow_count = (dm->hart_count + 31) / 32;
-	uint32_t hawindow[hawindow_count];
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
 
-	memset(hawindow, 0, sizeof(uint32_t) * hawindow_count);
+	for (unsigned i = 0; i < count; i++)
+		valid[i] = false;
 
-	target_list_t *entry;
-	unsigned total_selected = 0;
-	list_for_each_entry(entry, &dm->target_list, list) {
-		struct target *t = entry->target;
-		riscv_info_t *r = riscv_info(t);
-		riscv013_info_t *info = get_info(t);
-		unsigned index = info->index;
-		LOG_DEBUG("index=%d, coreid=%d, prepped=%d", index, t->coreid, r->prepped);
-		r->selected = r->prepped;
-		if (r->prepped) {
-			hawindow[index / 32] |= 1 << (index % 32);
-			r->prepped = false;
-			total_selected++;
+	unsigned i = 0;
+	while (i < count) {
+		if (is_fpu_reg(regnos[i]) || is_vector_reg(regnos[i])) {
+			valid[i] = register_read_direct(target, &values[i], regnos[i]) == ERROR_OK;
+			i++;
+			continue;
+		}
+		unsigned end = i + 1;
+		while (end < count && !is_fpu_reg(regnos[end]) && !is_vector_reg(regnos[end]))
+			end++;
+
+		unsigned done = 0;
+		if (info->abstract_read_csr_supported) {
+			if (read_csrs_abstract(target, regnos + i, end - i, values + i,
+						valid + i, &done) != ERROR_OK)
+				return ERROR_FAIL;
+			i += done;
+			if (i == end)
+				continue;
 		}
-		index++;
-	}
-
-	/* Don't use hasel if we only need to talk to one hart. */
-	if (total_selected <= 1) {
-		*use_hasel = false;
-		return ERROR_OK;
-	}
 
-	for (unsigned i = 0; i < hawindow_count; i++) {
-		if (dmi_write(target, DM_HAWINDOWSEL, i) != ERROR_OK)
-			return ERROR_FAIL;
-		if (dmi_write(target, DM_HAWINDOW, hawindow[i]) != ERROR_OK)
+		if (!has_sufficient_progbuf(target, 2)) {
+			/* Nothing else to try for this one. */
+			i++;
+			continue;
+		}
+		/* While abstract reads still work, only use progbuf for the
+		 * CSR they just failed on. */
+		unsigned n = info->abstract_read_csr_supported ? 1 : end - i;
+		if (read_csrs_progbuf(target, regnos + i, n, values + i, valid + i,
+					&done) != ERROR_OK)
 			return ERROR_FAIL;
+		i += done;
+		if (done < n)
+			i++;
 	}
 
-	*use_hasel = true;
 	return ERROR_OK;
 }
 
-static int riscv013_halt_prep(struct target *target)
+/* Write 0..max-1 to tselect, reading back tselect and tdata1 after each
+ * write, all in one batch of abstract commands. *count is set to the number of
+ * triggers for which the results are good. */
+static int riscv013_read_triggers(struct target *target, unsigned max,
+		riscv_reg_t *tselect, riscv_reg_t *tdata1, unsigned *count)
 {
-	return ERROR_OK;
-}
+	RISCV013_INFO(info);
 
-static int riscv013_halt_go(struct target *target)
-{
-	bool use_hasel = false;
-	if (select_prepped_harts(target, &use_hasel) != ERROR_OK)
+	*count = 0;
+	if (!info->abstract_read_csr_supported || !info->abstract_write_csr_supported)
+		return ERROR_FAIL;
+	if (riscv_select_current_hart(target) != ERROR_OK)
 		return ERROR_FAIL;
 
-	RISCV_INFO(r);
-	LOG_DEBUG("halting hart %d", r->current_hartid);
+	unsigned xlen = riscv_xlen(target);
+	size_t tselect_keys[RISCV_MAX_TRIGGERS];
+	size_t tdata1_keys[RISCV_MAX_TRIGGERS];
+	size_t status_keys[RISCV_MAX_TRIGGERS];
+	max = MIN(max, RISCV_MAX_TRIGGERS);
+
+	struct riscv_batch *batch = riscv_batch_alloc(target, max * 10,
+			info->dmi_busy_delay);
+	if (!batch)
+		return ERROR_FAIL;
+	for (unsigned t = 0; t < max; t++) {
+		if (xlen > 32)
+			riscv_batch_add_dmi_write(batch, DM_DATA1, 0);
+		riscv_batch_add_dmi_write(batch, DM_DATA0, t);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND,
+				access_register_command(target, GDB_REGNO_TSELECT, xlen,
+					AC_ACCESS_REGISTER_TRANSFER | AC_ACCESS_REGISTER_WRITE));
+		batch_add_delay(target, batch, DELAY_ABSTRACT);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND,
+				access_register_command(target, GDB_REGNO_TSELECT, xlen,
+					AC_ACCESS_REGISTER_TRANSFER));
+		batch_add_delay(target, batch, DELAY_ABSTRACT);
+		if (xlen > 32)
+			riscv_batch_add_dmi_read(batch, DM_DATA1);
+		tselect_keys[t] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+		riscv_batch_add_dmi_write(batch, DM_COMMAND,
+				access_register_command(target, GDB_REGNO_TDATA1, xlen,
+					AC_ACCESS_REGISTER_TRANSFER));
+		batch_add_delay(target, batch, DELAY_ABSTRACT);
+		if (xlen > 32)
+			riscv_batch_add_dmi_read(batch, DM_DATA1);
+		tdata1_keys[t] = riscv_batch_add_dmi_read(batch, DM_DATA0);
+		status_keys[t] = riscv_batch_add_dmi_read(batch, DM_ABSTRACTCS);
+	}
+	if (batch_run(target, batch) != ERROR_OK) {
+		riscv_batch_free(batch);
+		return ERROR_FAIL;
+	}
 
-	/* Issue the halt command, and then wait for the current hart to halt. */
-	uint32_t dmcontrol = DM_DMCONTROL_DMACTIVE | DM_DMCONTROL_HALTREQ;
-	if (use_hasel)
-		dmcontrol |= DM_DMCONTROL_HASEL;
-	dmcontrol = set_hartsel(dmcontrol, r->current_hartid);
-	dmi_write(target, DM_DMCONTROL, dmcontrol);
-	for (size_t i = 0; i < 256; ++i)
-		if (riscv_is_halted(target))
+	int result = ERROR_OK;
+	unsigned t;
+	for (t = 0; t < max; t++) {
+		uint32_t abstractcs;
+		if (!read_csrs_status(target, batch, status_keys[t], &abstractcs)) {
+			result = ERROR_FAIL;
+			break;
+		}
+		unsigned cmderr = get_field(abstractcs, DM_ABSTRACTCS_CMDERR);
+		if (cmderr != CMDERR_NONE) {
+			read_csrs_clear_cmderr(target);
+			/* An exception means this trigger doesn't exist, which is
+			 * a perfectly good answer. Anything else means we don't
+			 * know. */
+			if (cmderr != CMDERR_EXCEPTION)
+				result = ERROR_FAIL;
+			if (cmderr == CMDERR_BUSY)
+				increase_ac_busy_delay(target);
 			break;
+		}
+		tselect[t] = read_csrs_value(batch, tselect_keys[t], xlen);
+		tdata1[t] = read_csrs_value(batch, tdata1_keys[t], xlen);
+	}
+	riscv_batch_free(batch);
 
-	if (!riscv_is_halted(target)) {
-		uint32_t dmstatus;
-		if (dmstatus_read(target, &dmstatus, true) != ERROR_OK)
-			return ERROR_FAIL;
-		if (dmi_read(target, &dmcontrol, DM_DMCONTROL) != ERROR_OK)
-			return ERROR_FAIL;
+	*count = t;
+	return result;
+}
 
-		LOG_ERROR("unable to halt hart %d", r->current_hartid);
-		LOG_ERROR("  dmcontrol=0x%08x", dmcontrol);
-		LOG_ERROR("  dmstatus =0x%08x", dmstatus);
+/* Step the current hart, and read its GPRs and dpc, in one batch. Returns
+ * ERROR_OK if the hart stepped, whether or not the registers came back. */
+static int riscv013_step_fused(struct target *target)
+{
+	RISCV013_INFO(info);
+	RISCV_INFO(r);
+
+	unsigned last = riscv_supports_extension(target, 'E') ?
+		GDB_REGNO_XPR15 : GDB_REGNO_XPR31;
+	size_t gpr_keys[GDB_REGNO_XPR31 + 1];
+	size_t dpc_key;
+	bool read_dpc = info->abstract_read_csr_supported;
+
+	struct riscv_batch *batch = riscv_batch_alloc(target, (last + 2) * 3 + 8,
+			info->dmi_busy_delay);
+	if (!batch)
 		return ERROR_FAIL;
+
+	/* The resume request goes first. Every earlier DMI access has
+	 * completed, so it can't be dropped because the DMI is busy. A step
+	 * takes at least as long as an abstract command. */
+	uint32_t dmcontrol = set_hartsel(DM_DMCONTROL_DMACTIVE, r->current_hartid);
+	riscv_batch_add_dmi_write(batch, DM_DMCONTROL,
+			dmcontrol | DM_DMCONTROL_RESUMEREQ);
+	batch_add_delay(target, batch, DELAY_ABSTRACT);
+	riscv_batch_add_dmi_write(batch, DM_DMCONTROL, dmcontrol);
+	size_t dmstatus_key = riscv_batch_add_dmi_read(batch, DM_DMSTATUS);
+	size_t gpr_status_key = prefetch_queue_reads(target, batch, GDB_REGNO_RA,
+			last, gpr_keys);
+	size_t dpc_status_key = 0;
+	if (read_dpc)
+		dpc_status_key = prefetch_queue_reads(target, batch, GDB_REGNO_DPC,
+				GDB_REGNO_DPC, &dpc_key);
+
+	int result = batch_run(target, batch);
+	if (result != ERROR_OK) {
+		riscv_batch_free(batch);
+		return result;
 	}
 
-	dmcontrol = set_field(dmcontrol, DM_DMCONTROL_HALTREQ, 0);
-	dmi_write(target, DM_DMCONTROL, dmcontrol);
+	/* The registers are only good if the step had finished before the first
+	 * command was started. Otherwise that command fails because the hart
+	 * isn't halted, and cmderr keeps the rest of them from running. */
+	bool stepped = false;
+	if (riscv_batch_get_dmi_read_op(batch, dmstatus_key) == DMI_STATUS_SUCCESS) {
+		uint32_t dmstatus = riscv_batch_get_dmi_read_data(batch, dmstatus_key);
+		stepped = get_field(dmstatus, DM_DMSTATUS_ALLRESUMEACK) &&
+			get_field(dmstatus, DM_DMSTATUS_ALLHALTED);
+	}
 
-	if (use_hasel) {
-		target_list_t *entry;
-		dm013_info_t *dm = get_dm(target);
-		if (!dm)
-			return ERROR_FAIL;
-		list_for_each_entry(entry, &dm->target_list, list) {
-			struct target *t = entry->target;
-			t->state = TARGET_HALTED;
-			if (t->debug_reason == DBG_REASON_NOTHALTED)
-				t->debug_reason = DBG_REASON_DBGRQ;
+	uint32_t abstractcs;
+	bool dmi_busy_encountered;
+	result = batch_get_status_read(target, batch, gpr_status_key,
+			DM_ABSTRACTCS, &abstractcs, &dmi_busy_encountered);
+	if (result == ERROR_OK && !dmi_busy_encountered &&
+			prefetch_group_ok(target, abstractcs) && stepped) {
+		for (unsigned regno = GDB_REGNO_RA; regno <= last; regno++)
+			prefetch_store(target, batch, regno, gpr_keys[regno - GDB_REGNO_RA]);
+		if (read_dpc) {
+			result = batch_get_status_read(target, batch, dpc_status_key,
+					DM_ABSTRACTCS, &abstractcs, &dmi_busy_encountered);
+			if (result == ERROR_OK && !dmi_busy_encountered &&
+					prefetch_group_ok(target, abstractcs))
+				prefetch_store(target, batch, GDB_REGNO_PC, dpc_key);
 		}
 	}
-	/* The "else" case is handled in halt_go(). */
+	info->cmderr = CMDERR_NONE;
+	riscv_batch_free(batch);
 
-	return ERROR_OK;
-}
+	if (stepped)
+		return ERROR_OK;
 
-static int riscv013_resume_go(struct target *target)
-{
-	bool use_hasel = false;
-	if (select_prepped_harts(target, &use_hasel) != ERROR_OK)
-		return ERROR_FAIL;
+	/* The step took longer than the batch. Wait for it like
+	 * riscv013_step_or_resume_current_hart() does. */
+	uint32_t dmstatus;
+	for (size_t i = 0; i < 256; ++i) {
+		if (dmstatus_read(target, &dmstatus, true) != ERROR_OK)
+			return ERROR_FAIL;
+		if (get_field(dmstatus, DM_DMSTATUS_ALLRESUMEACK) &&
+				get_field(dmstatus, DM_DMSTATUS_ALLHALTED))
+			return ERROR_OK;
+		usleep(10);
+	}
 
-	return riscv013_step_or_resume_current_hart(target, false, use_hasel);
+	LOG_ERROR("unable to step hart %d", r->current_hartid);
+	LOG_ERROR("  dmstatus =0x%08x", dmstatus);
+	LOG_ERROR("  was stepping, halting");
+	riscv_halt(target);
+	return ERROR_OK;
 }
 
 static int riscv013_step_current_hart(struct target *target)
 {
+	if (target->reg_cache && riscv_is_halted(target) &&
+			(riscv_xlen(target) == 32 || riscv_xlen(target) == 64))
+		return riscv013_step_fused(target);
 	return riscv013_step_or_resume_current_hart(target, true, false);
 }
 
-static int riscv013_resume_prep(struct target *target)
-{
-	return riscv013_on_step_or_resume(target, false);
-}
-
-static int riscv013_on_step(struct target *target)
-{
-	return riscv013_on_step_or_resume(target, true);
-}
-
-static int riscv013_on_halt(struct target *target)
-{
-	return ERROR_OK;
-}
-
 static bool riscv013_is_halted(struct target *target)
 {
 	uint32_t dmstatus;
@@ -4867,4 +7838,9 @@ void riscv013_clear_abstract_error(struct target *target)
 	}
 	/* Clear the error status. */
 	dmi_write(target, DM_ABSTRACTCS, DM_ABSTRACTCS_CMDERR);
+
+	/* Writes to abstractauto while busy are ignored. */
+	RISCV013_INFO(info);
+	if (info->dm)
+		info->dm->shadow.abstractauto_valid = false;
 }
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -15,9 +16,11 @@
 #include "jtag/jtag.h"
 #include "target/register.h"
 #include "target/breakpoints.h"
+#include "target/image.h"
 #include "helper/base64.h"
 #include "helper/time_support.h"
 #include "riscv.h"
+#include "dmi_trace.h"
 #include "gdb_regs.h"
 #include "rtos/rtos.h"
 
@@ -126,10 +129,9 @@ struct scan_field select_idcode = {
 };
 
 bscan_tunnel_type_t bscan_tunnel_type;
+bscan_tunnel_batch_t bscan_tunnel_batch = BSCAN_TUNNEL_BATCH_SELECT;
 int bscan_tunnel_ir_width; /* if zero, then tunneling is not present/active */
 
-extern int riscv_tap_vjtag_init(struct jtag_tap *tap);
-extern int vjtag_vir_scan(struct jtag_tap *tap, uint32_t vir);
 /*
 	tcl use_vjtag command are read after examine,
 	however, examine checks dmi register via jtag(and fail,
@@ -215,6 +217,20 @@ int riscv_command_timeout_sec = DEFAULT_COMMAND_TIMEOUT_SEC;
 /* Wall-clock timeout after reset. Settable via RISC-V Target commands.*/
 int riscv_reset_timeout_sec = DEFAULT_RESET_TIMEOUT_SEC;
 
+char *riscv_capability_cache_file;
+
+/* Successful operations before a busy delay is shortened again. Settable via
+ * RISC-V Target commands.*/
+unsigned riscv_busy_delay_decay = DEFAULT_BUSY_DELAY_DECAY;
+
+/* Maximum number of scans in a single JTAG flush of a batch. Settable via
+ * RISC-V Target commands.*/
+unsigned riscv_batch_flush_scans;
+
+/* Defer inserting and removing breakpoints until the hart runs. Settable via
+ * RISC-V Target commands.*/
+bool riscv_lazy_breakpoints = true;
+
 bool riscv_enable_virt2phys = true;
 bool riscv_ebreakm = true;
 bool riscv_ebreaks = true;
@@ -283,6 +299,7 @@ void riscv_sample_buf_maybe_add_timestamp(struct target *target, bool before)
 }
 
 static int riscv_resume_go_all_harts(struct target *target);
+static int riscv_fast_poll(void *priv);
 
 void select_dmi_via_bscan(struct target *target)
 {
@@ -410,6 +427,7 @@ static uint32_t dtmcontrol_scan(struct target *target, uint32_t out)
 	int retval = jtag_execute_queue();
 	if (retval != ERROR_OK) {
 		LOG_ERROR("failed jtag scan: %d", retval);
+		vjtag_vir_invalidate(target->tap);
 		return retval;
 	}
 
@@ -486,6 +504,11 @@ static int riscv_init_target(struct command_context *cmd_ctx,
 
 static void riscv_free_registers(struct target *target)
 {
+	RISCV_INFO(info);
+
+	free(info->reg_cache_values);
+	info->reg_cache_values = NULL;
+
 	/* Free the shared structure use for most registers. */
 	if (target->reg_cache) {
 		if (target->reg_cache->reg_list) {
@@ -495,10 +518,13 @@ static void riscv_free_registers(struct target *target)
 				free(target->reg_cache->reg_list[i].arch_info);
 			free(target->reg_cache->reg_list);
 		}
+		register_cache_free_index(target->reg_cache);
 		free(target->reg_cache);
 	}
 }
 
+static void async_dump_stop(struct target *target);
+
 static void riscv_deinit_target(struct target *target)
 {
 	LOG_DEBUG("riscv_deinit_target()");
@@ -506,11 +532,25 @@ static void riscv_deinit_target(struct target *target)
 	riscv_info_t *info = (riscv_info_t *) target->arch_info;
 	struct target_type *tt = get_target_type(target);
 
+	if (info->version_specific && target->state == TARGET_HALTED)
+		riscv_sync_breakpoints(target);
+	free(info->sw_breakpoints);
+
 	if (tt && info->version_specific)
 		tt->deinit_target(target);
 
 	riscv_free_registers(target);
 
+	if (info->fast_poll_scheduled)
+		target_unregister_timer_callback(riscv_fast_poll, target);
+
+	if (info->sample_stream)
+		fclose(info->sample_stream);
+	free(info->sample_buf.buf);
+	free(info->mem_cache.data);
+	async_dump_stop(target);
+	riscv_semihosting_buffer_set(target, false, 0, 0);
+
 	range_list_t *entry, *tmp;
 	list_for_each_entry_safe(entry, tmp, &info->expose_csr, list) {
 		free(entry->name);
@@ -689,6 +729,7 @@ static int add_trigger(struct target *target, struct trigger *trigger)
 		LOG_DEBUG("[%d] Using trigger %d (type %d) for bp %d", target->coreid,
 				i, type, trigger->unique_id);
 		r->trigger_unique_id[i] = trigger->unique_id;
+		r->trigger_lazy[i].clear_pending = false;
 		break;
 	}
 
@@ -820,6 +861,371 @@ int riscv_read_by_any_size(struct target *target, target_addr_t address, uint32_
 	return ERROR_FAIL;
 }
 
+/* sw_breakpoints is sorted by address. Returns the index of the first entry
+ * at or above address. */
+static unsigned sw_breakpoint_index(struct target *target, target_addr_t address)
+{
+	RISCV_INFO(r);
+	unsigned lo = 0, hi = r->sw_breakpoint_count;
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (r->sw_breakpoints[mid].address < address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static struct riscv_sw_breakpoint *find_sw_breakpoint(struct target *target,
+		target_addr_t address)
+{
+	RISCV_INFO(r);
+	unsigned i = sw_breakpoint_index(target, address);
+	if (i < r->sw_breakpoint_count && r->sw_breakpoints[i].address == address)
+		return &r->sw_breakpoints[i];
+	return NULL;
+}
+
+static void delete_sw_breakpoint(struct target *target,
+		struct riscv_sw_breakpoint *bp)
+{
+	RISCV_INFO(r);
+	struct riscv_sw_breakpoint *end = r->sw_breakpoints + r->sw_breakpoint_count;
+	memmove(bp, bp + 1, (end - bp - 1) * sizeof(*bp));
+	r->sw_breakpoint_count--;
+}
+
+/* Index of the first software breakpoint that may overlap memory at or above
+ * address. An ebreak is at most 4 bytes long. */
+static unsigned sw_breakpoint_overlap_index(struct target *target,
+		target_addr_t address)
+{
+	return sw_breakpoint_index(target, address < 3 ? 0 : address - 3);
+}
+
+/* Returns a software breakpoint of target whose ebreak is in memory that
+ * overlaps [address, address + length), but that has been removed. */
+static struct riscv_sw_breakpoint *find_removed_sw_breakpoint(
+		struct target *target, target_addr_t address, target_addr_t length)
+{
+	RISCV_INFO(r);
+	for (unsigned i = sw_breakpoint_overlap_index(target, address);
+			i < r->sw_breakpoint_count; i++) {
+		struct riscv_sw_breakpoint *bp = &r->sw_breakpoints[i];
+		if (bp->address >= address + length)
+			break;
+		if (bp->inserted && !bp->wanted && address < bp->address + bp->length)
+			return bp;
+	}
+	return NULL;
+}
+
+static int restore_sw_breakpoint(struct target *target,
+		struct riscv_sw_breakpoint *bp)
+{
+	struct riscv_sw_breakpoint copy = *bp;
+	/* Delete it first, so the write below doesn't find it again. */
+	delete_sw_breakpoint(target, bp);
+	if (riscv_write_by_any_size(target, copy.address, copy.length,
+				copy.orig_instr) != ERROR_OK) {
+		LOG_ERROR("Failed to restore instruction for %d-byte breakpoint at "
+				"0x%" TARGET_PRIxADDR, copy.length, copy.address);
+		return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+static int insert_sw_breakpoint(struct target *target,
+		struct riscv_sw_breakpoint *bp)
+{
+	/* Read the original instruction. */
+	if (riscv_read_by_any_size(target, bp->address, bp->length,
+				bp->orig_instr) != ERROR_OK) {
+		LOG_ERROR("Failed to read original instruction at 0x%" TARGET_PRIxADDR,
+				bp->address);
+		return ERROR_FAIL;
+	}
+
+	uint8_t buff[4] = { 0 };
+	buf_set_u32(buff, 0, bp->length * CHAR_BIT, bp->length == 4 ? ebreak() : ebreak_c());
+	/* Write the ebreak instruction. */
+	if (riscv_write_by_any_size(target, bp->address, bp->length, buff) != ERROR_OK) {
+		LOG_ERROR("Failed to write %d-byte breakpoint instruction at 0x%"
+				TARGET_PRIxADDR, bp->length, bp->address);
+		return ERROR_FAIL;
+	}
+	bp->inserted = true;
+
+	struct breakpoint *breakpoint = breakpoint_find(target, bp->address);
+	if (breakpoint && breakpoint->type == BKPT_SOFT)
+		memcpy(breakpoint->orig_instr, bp->orig_instr, bp->length);
+	return ERROR_OK;
+}
+
+/* Restore memory under every removed software breakpoint of the group target
+ * is in that overlaps [address, address + length), before it is written. */
+static int restore_removed_sw_breakpoints(struct target *target,
+		target_addr_t address, target_addr_t length)
+{
+	struct target_list head = { .target = target, .next = NULL };
+	for (struct target_list *list = target->smp ? target->head : &head; list;
+			list = list->next) {
+		struct riscv_sw_breakpoint *bp;
+		while ((bp = find_removed_sw_breakpoint(list->target, address, length))) {
+			if (restore_sw_breakpoint(list->target, bp) != ERROR_OK)
+				return ERROR_FAIL;
+		}
+	}
+	return ERROR_OK;
+}
+
+/* Make buffer, just read from [address, address + length), show what memory
+ * holds under removed software breakpoints whose ebreak is still there. */
+static void hide_removed_sw_breakpoints(struct target *target,
+		target_addr_t address, target_addr_t length, uint8_t *buffer)
+{
+	struct target_list head = { .target = target, .next = NULL };
+	for (struct target_list *list = target->smp ? target->head : &head; list;
+			list = list->next) {
+		riscv_info_t *r = riscv_info(list->target);
+		for (unsigned i = sw_breakpoint_overlap_index(list->target, address);
+				i < r->sw_breakpoint_count; i++) {
+			const struct riscv_sw_breakpoint *bp = &r->sw_breakpoints[i];
+			if (bp->address >= address + length)
+				break;
+			if (!bp->inserted || bp->wanted)
+				continue;
+			for (unsigned j = 0; j < bp->length; j++) {
+				if (bp->address + j >= address && bp->address + j < address + length)
+					buffer[bp->address + j - address] = bp->orig_instr[j];
+			}
+		}
+	}
+}
+
+/* Clear the triggers of hardware breakpoints that have been removed. */
+static int clear_lazy_triggers(struct target *target)
+{
+	RISCV_INFO(r);
+
+	bool clear_triggers = false;
+	for (unsigned i = 0; i < r->trigger_count; i++)
+		clear_triggers |= r->trigger_lazy[i].clear_pending;
+	if (!clear_triggers)
+		return ERROR_OK;
+
+	riscv_reg_t tselect;
+	if (riscv_get_register(target, &tselect, GDB_REGNO_TSELECT) != ERROR_OK)
+		return ERROR_FAIL;
+	for (unsigned i = 0; i < r->trigger_count; i++) {
+		if (!r->trigger_lazy[i].clear_pending)
+			continue;
+		LOG_DEBUG("[%d] Clearing trigger %d", target->coreid, i);
+		riscv_set_register(target, GDB_REGNO_TSELECT, i);
+		riscv_set_register(target, GDB_REGNO_TDATA1, 0);
+		r->trigger_lazy[i].clear_pending = false;
+	}
+	riscv_set_register(target, GDB_REGNO_TSELECT, tselect);
+
+	return ERROR_OK;
+}
+
+/* Bring the software breakpoints from sw_breakpoints[first] on that are close
+ * together up to date with one read and one write of the word-aligned range
+ * that covers them: ebreaks are written for new ones, and the original
+ * instructions come back for removed ones, which are then deleted. Sets *next
+ * to the entry after the group and returns true, or returns false if there's
+ * nothing to coalesce there or the range couldn't be accessed, in which case
+ * the caller handles them one at a time. */
+static bool sync_sw_breakpoint_group(struct target *target, unsigned first,
+		unsigned *next)
+{
+	RISCV_INFO(r);
+	struct riscv_sw_breakpoint *bps = r->sw_breakpoints + first;
+	unsigned count = r->sw_breakpoint_count - first;
+
+	if (bps[0].inserted && bps[0].wanted)
+		return false;
+	target_addr_t start = bps[0].address & ~(target_addr_t)3;
+	unsigned n = 1, pending = 1;
+	while (n < count &&
+			bps[n].address - (bps[n - 1].address + bps[n - 1].length) <=
+			RISCV_BREAKPOINT_COALESCE &&
+			bps[n].address + bps[n].length - start <= RISCV_BREAKPOINT_SPAN) {
+		/* Overlapping breakpoints would each see the other's ebreak as their
+		 * original instruction. */
+		if (bps[n].address < bps[n - 1].address + bps[n - 1].length)
+			break;
+		pending += !bps[n].inserted || !bps[n].wanted;
+		n++;
+	}
+	if (pending < 2)
+		return false;
+
+	target_addr_t end = bps[n - 1].address + bps[n - 1].length;
+	uint32_t words = DIV_ROUND_UP(end - start, 4);
+	uint8_t *buffer = malloc(words * 4);
+	if (!buffer)
+		return false;
+	/* This shows the original instructions under removed breakpoints. */
+	if (target_read_memory(target, start, 4, words, buffer) != ERROR_OK) {
+		LOG_DEBUG("[%d] Couldn't read 0x%" TARGET_PRIxADDR "-0x%" TARGET_PRIxADDR
+				" to update breakpoints there", target->coreid, start,
+				start + words * 4 - 1);
+		free(buffer);
+		return false;
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		uint8_t *p = buffer + (bps[i].address - start);
+		if (!bps[i].wanted) {
+			/* Keep the write below from restoring it on its own. */
+			bps[i].inserted = false;
+		} else if (!bps[i].inserted) {
+			memcpy(bps[i].orig_instr, p, bps[i].length);
+			buf_set_u32(p, 0, bps[i].length * CHAR_BIT,
+					bps[i].length == 4 ? ebreak() : ebreak_c());
+		}
+	}
+
+	int result = target_write_memory(target, start, 4, words, buffer);
+	free(buffer);
+	if (result != ERROR_OK) {
+		LOG_DEBUG("[%d] Couldn't write 0x%" TARGET_PRIxADDR "-0x%" TARGET_PRIxADDR
+				" to update breakpoints there", target->coreid, start,
+				start + words * 4 - 1);
+		for (unsigned i = 0; i < n; i++) {
+			if (!bps[i].wanted)
+				bps[i].inserted = true;
+		}
+		return false;
+	}
+
+	LOG_DEBUG("[%d] Updated %d breakpoints at 0x%" TARGET_PRIxADDR "-0x%"
+			TARGET_PRIxADDR, target->coreid, pending, start, end - 1);
+	unsigned kept = first;
+	for (unsigned i = 0; i < n; i++) {
+		if (!bps[i].wanted)
+			continue;
+		if (!bps[i].inserted) {
+			bps[i].inserted = true;
+			struct breakpoint *breakpoint = breakpoint_find(target, bps[i].address);
+			if (breakpoint && breakpoint->type == BKPT_SOFT)
+				memcpy(breakpoint->orig_instr, bps[i].orig_instr, bps[i].length);
+		}
+		r->sw_breakpoints[kept++] = bps[i];
+	}
+	memmove(r->sw_breakpoints + kept, bps + n,
+			(count - n) * sizeof(*r->sw_breakpoints));
+	r->sw_breakpoint_count -= first + n - kept;
+	*next = kept;
+	return true;
+}
+
+int riscv_sync_breakpoints(struct target *target)
+{
+	RISCV_INFO(r);
+	int result = ERROR_OK;
+
+	/* Whatever resumes the hart next executes a fence anyway, so the
+	 * individual writes below don't need to. */
+	r->defer_fence = true;
+
+	/* Reads hide removed ebreaks, so a breakpoint that is inserted here
+	 * never saves one of those as its original instruction. */
+	for (unsigned i = 0; i < r->sw_breakpoint_count; ) {
+		unsigned next;
+		if (sync_sw_breakpoint_group(target, i, &next)) {
+			i = next;
+			continue;
+		}
+		struct riscv_sw_breakpoint *bp = &r->sw_breakpoints[i];
+		if (!bp->wanted) {
+			/* This deletes the entry. */
+			if (restore_sw_breakpoint(target, bp) != ERROR_OK)
+				result = ERROR_FAIL;
+			continue;
+		}
+		if (!bp->inserted && insert_sw_breakpoint(target, bp) != ERROR_OK) {
+			/* Don't keep the hart from running over a breakpoint that can't
+			 * be set. */
+			struct breakpoint *breakpoint = breakpoint_find(target, bp->address);
+			if (breakpoint)
+				breakpoint->set = false;
+			delete_sw_breakpoint(target, bp);
+			continue;
+		}
+		i++;
+	}
+	r->defer_fence = false;
+
+	if (clear_lazy_triggers(target) != ERROR_OK)
+		return ERROR_FAIL;
+	return result;
+}
+
+/* Add a software breakpoint to the list, to be inserted when the hart runs.
+ * If the previous stop left an ebreak of the same length there, it is simply
+ * kept. */
+static int add_lazy_sw_breakpoint(struct target *target,
+		struct breakpoint *breakpoint)
+{
+	RISCV_INFO(r);
+
+	struct riscv_sw_breakpoint *bp = find_sw_breakpoint(target, breakpoint->address);
+	if (bp && bp->length != (unsigned)breakpoint->length) {
+		if (restore_sw_breakpoint(target, bp) != ERROR_OK)
+			return ERROR_FAIL;
+		bp = NULL;
+	}
+
+	if (bp) {
+		LOG_DEBUG("[%d] Keeping ebreak at 0x%" TARGET_PRIxADDR, target->coreid,
+				breakpoint->address);
+		memcpy(breakpoint->orig_instr, bp->orig_instr, bp->length);
+	} else {
+		struct riscv_sw_breakpoint *list = realloc(r->sw_breakpoints,
+				(r->sw_breakpoint_count + 1) * sizeof(*list));
+		if (!list) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		r->sw_breakpoints = list;
+		unsigned i = sw_breakpoint_index(target, breakpoint->address);
+		memmove(list + i + 1, list + i,
+				(r->sw_breakpoint_count - i) * sizeof(*list));
+		r->sw_breakpoint_count++;
+		bp = &list[i];
+		bp->address = breakpoint->address;
+		bp->length = breakpoint->length;
+		bp->inserted = false;
+		memset(breakpoint->orig_instr, 0, breakpoint->length);
+	}
+	bp->wanted = true;
+	return ERROR_OK;
+}
+
+/* Hand a trigger that is still programmed for a removed breakpoint at the same
+ * address over to this one. Returns whether there was one. */
+static bool reuse_lazy_trigger(struct target *target,
+		const struct breakpoint *breakpoint)
+{
+	RISCV_INFO(r);
+	for (unsigned i = 0; i < r->trigger_count; i++) {
+		if (r->trigger_lazy[i].clear_pending &&
+				r->trigger_lazy[i].address == breakpoint->address &&
+				r->trigger_lazy[i].length == (uint32_t)breakpoint->length) {
+			LOG_DEBUG("[%d] Reusing trigger %d for bp %d", target->coreid, i,
+					breakpoint->unique_id);
+			r->trigger_lazy[i].clear_pending = false;
+			r->trigger_unique_id[i] = breakpoint->unique_id;
+			return true;
+		}
+	}
+	return false;
+}
+
 int riscv_add_breakpoint(struct target *target, struct breakpoint *breakpoint)
 {
 	LOG_DEBUG("[%d] @0x%" TARGET_PRIxADDR, target->coreid, breakpoint->address);
@@ -836,6 +1242,13 @@ int riscv_add_breakpoint(struct target *target, struct breakpoint *breakpoint)
 			return ERROR_FAIL;
 		}
 
+		if (riscv_lazy_breakpoints) {
+			if (add_lazy_sw_breakpoint(target, breakpoint) != ERROR_OK)
+				return ERROR_FAIL;
+			breakpoint->set = true;
+			return ERROR_OK;
+		}
+
 		/* Read the original instruction. */
 		if (riscv_read_by_any_size(
 				target, breakpoint->address, breakpoint->length, breakpoint->orig_instr) != ERROR_OK) {
@@ -854,6 +1267,13 @@ int riscv_add_breakpoint(struct target *target, struct breakpoint *breakpoint)
 		}
 
 	} else if (breakpoint->type == BKPT_HARD) {
+		if (reuse_lazy_trigger(target, breakpoint)) {
+			breakpoint->set = true;
+			return ERROR_OK;
+		}
+		/* A trigger that is waiting to be cleared still looks in use. */
+		if (clear_lazy_triggers(target) != ERROR_OK)
+			return ERROR_FAIL;
 		struct trigger trigger;
 		trigger_from_breakpoint(&trigger, breakpoint);
 		int const result = add_trigger(target, &trigger);
@@ -868,7 +1288,8 @@ int riscv_add_breakpoint(struct target *target, struct breakpoint *breakpoint)
 	return ERROR_OK;
 }
 
-static int remove_trigger(struct target *target, struct trigger *trigger)
+static int remove_trigger(struct target *target, struct trigger *trigger,
+		bool lazy)
 {
 	RISCV_INFO(r);
 
@@ -888,6 +1309,14 @@ static int remove_trigger(struct target *target, struct trigger *trigger)
 	LOG_DEBUG("[%d] Stop using resource %d for bp %d", target->coreid, i,
 			trigger->unique_id);
 
+	if (lazy) {
+		r->trigger_lazy[i].clear_pending = true;
+		r->trigger_lazy[i].address = trigger->address;
+		r->trigger_lazy[i].length = trigger->length;
+		r->trigger_unique_id[i] = -1;
+		return ERROR_OK;
+	}
+
 	riscv_reg_t tselect;
 	int result = riscv_get_register(target, &tselect, GDB_REGNO_TSELECT);
 	if (result != ERROR_OK)
@@ -904,6 +1333,24 @@ int riscv_remove_breakpoint(struct target *target,
 		struct breakpoint *breakpoint)
 {
 	if (breakpoint->type == BKPT_SOFT) {
+		struct riscv_sw_breakpoint *bp = find_sw_breakpoint(target,
+				breakpoint->address);
+		if (bp) {
+			if (!bp->inserted) {
+				delete_sw_breakpoint(target, bp);
+			} else if (riscv_lazy_breakpoints) {
+				LOG_DEBUG("[%d] Leaving ebreak at 0x%" TARGET_PRIxADDR " until "
+						"the hart runs", target->coreid, breakpoint->address);
+				bp->wanted = false;
+			} else if (restore_sw_breakpoint(target, bp) != ERROR_OK) {
+				return ERROR_FAIL;
+			}
+			breakpoint->set = false;
+			return ERROR_OK;
+		}
+		if (!breakpoint->set)
+			return ERROR_OK;
+
 		/* Write the original instruction. */
 		if (riscv_write_by_any_size(
 				target, breakpoint->address, breakpoint->length, breakpoint->orig_instr) != ERROR_OK) {
@@ -915,7 +1362,7 @@ int riscv_remove_breakpoint(struct target *target,
 	} else if (breakpoint->type == BKPT_HARD) {
 		struct trigger trigger;
 		trigger_from_breakpoint(&trigger, breakpoint);
-		int result = remove_trigger(target, &trigger);
+		int result = remove_trigger(target, &trigger, riscv_lazy_breakpoints);
 		if (result != ERROR_OK)
 			return result;
 
@@ -964,7 +1411,7 @@ int riscv_remove_watchpoint(struct target *target,
 	struct trigger trigger;
 	trigger_from_watchpoint(&trigger, watchpoint);
 
-	int result = remove_trigger(target, &trigger);
+	int result = remove_trigger(target, &trigger, false);
 	if (result != ERROR_OK)
 		return result;
 	watchpoint->set = false;
@@ -978,34 +1425,105 @@ int riscv_remove_watchpoint(struct target *target,
  * The GDB server uses this information to tell GDB what data address has
  * been hit, which enables GDB to print the hit variable along with its old
  * and new value. */
+static void invalidate_watchpoint_insn_cache(struct target *target)
+{
+	RISCV_INFO(r);
+	for (unsigned i = 0; i < RISCV_WATCHPOINT_INSN_CACHE; i++)
+		r->watchpoint_insn_cache[i].valid = false;
+}
+
+/* Find the watchpoint whose trigger has its hit bit set, and clear the hit
+ * bits so the next halt doesn't see them. The hit bit is optional, so if none
+ * is set that doesn't mean no watchpoint was hit. */
+static struct watchpoint *watchpoint_hit_by_trigger(struct target *target)
+{
+	RISCV_INFO(r);
+	const riscv_reg_t mcontrol_hit = 1 << 20;
+
+	if (!target->watchpoints || riscv_enumerate_triggers(target) != ERROR_OK)
+		return NULL;
+
+	riscv_reg_t tselect;
+	if (riscv_get_register(target, &tselect, GDB_REGNO_TSELECT) != ERROR_OK)
+		return NULL;
+
+	struct watchpoint *hit = NULL;
+	for (unsigned i = 0; i < r->trigger_count; i++) {
+		if (r->trigger_unique_id[i] == -1)
+			continue;
+		struct watchpoint *wp = target->watchpoints;
+		while (wp && (int)wp->unique_id != r->trigger_unique_id[i])
+			wp = wp->next;
+		if (!wp)
+			continue;
+
+		riscv_reg_t tdata1;
+		if (riscv_set_register(target, GDB_REGNO_TSELECT, i) != ERROR_OK ||
+				riscv_get_register(target, &tdata1, GDB_REGNO_TDATA1) != ERROR_OK)
+			break;
+		if (get_field(tdata1, MCONTROL_TYPE(riscv_xlen(target))) !=
+				MCONTROL_TYPE_MATCH || !(tdata1 & mcontrol_hit))
+			continue;
+
+		LOG_DEBUG("[%d] trigger %d for watchpoint %d has hit set",
+				target->coreid, i, wp->unique_id);
+		riscv_set_register(target, GDB_REGNO_TDATA1, tdata1 & ~mcontrol_hit);
+		if (!hit)
+			hit = wp;
+	}
+
+	riscv_set_register(target, GDB_REGNO_TSELECT, tselect);
+	return hit;
+}
+
+/* Read the 4 bytes at address, or take them from the cache. */
+static int read_watchpoint_insn(struct target *target, target_addr_t address,
+		uint32_t *instruction)
+{
+	RISCV_INFO(r);
+	unsigned index = (address >> 1) % RISCV_WATCHPOINT_INSN_CACHE;
+	if (r->watchpoint_insn_cache[index].valid &&
+			r->watchpoint_insn_cache[index].address == address) {
+		*instruction = r->watchpoint_insn_cache[index].instruction;
+		return ERROR_OK;
+	}
+
+	uint8_t buffer[4];
+	if (target_read_buffer(target, address, sizeof(buffer), buffer) != ERROR_OK)
+		return ERROR_FAIL;
+	*instruction = buf_get_u32(buffer, 0, 32);
+
+	r->watchpoint_insn_cache[index].valid = true;
+	r->watchpoint_insn_cache[index].address = address;
+	r->watchpoint_insn_cache[index].instruction = *instruction;
+	return ERROR_OK;
+}
+
 int riscv_hit_watchpoint(struct target *target, struct watchpoint **hit_watchpoint)
 {
 	struct watchpoint *wp = target->watchpoints;
 
 	LOG_DEBUG("Current hartid = %d", riscv_current_hartid(target));
 
-	/*TODO instead of disassembling the instruction that we think caused the
-	 * trigger, check the hit bit of each watchpoint first. The hit bit is
-	 * simpler and more reliable to check but as it is optional and relatively
-	 * new, not all hardware will implement it  */
+	/* The hit bit is simpler and more reliable than disassembling the
+	 * instruction that we think caused the trigger, but as it is optional and
+	 * relatively new, not all hardware will implement it. */
+	*hit_watchpoint = watchpoint_hit_by_trigger(target);
+	if (*hit_watchpoint) {
+		LOG_DEBUG("Hit address=%" TARGET_PRIxADDR, (*hit_watchpoint)->address);
+		return ERROR_OK;
+	}
+
 	riscv_reg_t dpc;
 	riscv_get_register(target, &dpc, GDB_REGNO_DPC);
-	const uint8_t length = 4;
 	LOG_DEBUG("dpc is 0x%" PRIx64, dpc);
 
 	/* fetch the instruction at dpc */
-	uint8_t buffer[length];
-	if (target_read_buffer(target, dpc, length, buffer) != ERROR_OK) {
+	uint32_t instruction;
+	if (read_watchpoint_insn(target, dpc, &instruction) != ERROR_OK) {
 		LOG_ERROR("Failed to read instruction at dpc 0x%" PRIx64, dpc);
 		return ERROR_FAIL;
 	}
-
-	uint32_t instruction = 0;
-
-	for (int i = 0; i < length; i++) {
-		LOG_DEBUG("Next byte is %x", buffer[i]);
-		instruction += (buffer[i] << 8 * i);
-	}
 	LOG_DEBUG("Full instruction is %x", instruction);
 
 	/* find out which memory address is accessed by the instruction at dpc */
@@ -1067,6 +1585,8 @@ static int old_or_new_riscv_step(struct target *target, int current,
 {
 	RISCV_INFO(r);
 	LOG_DEBUG("handle_breakpoints=%d", handle_breakpoints);
+	if (riscv_sync_breakpoints(target) != ERROR_OK)
+		return ERROR_FAIL;
 	if (r->is_halted == NULL)
 		return oldriscv_step(target, current, address, handle_breakpoints);
 	else
@@ -1121,55 +1641,188 @@ static int old_or_new_riscv_poll(struct target *target)
 		return riscv_openocd_poll(target);
 }
 
-int riscv_select_current_hart(struct target *target)
+/* While the target is running, make each poll wait twice as long as the one
+ * before it, up to poll_max_ms. Polls that come in early are skipped, so an
+ * idle session stops generating traffic at the default polling rate. */
+static int riscv_poll(struct target *target)
 {
-	return riscv_set_current_hartid(target, target->coreid);
+	RISCV_INFO(r);
+
+	int64_t now = timeval_ms();
+	if (target->state == TARGET_RUNNING &&
+			r->poll_max_ms > TARGET_DEFAULT_POLLING_INTERVAL &&
+			now < r->next_poll_ms)
+		return ERROR_OK;
+
+	int result = old_or_new_riscv_poll(target);
+
+	if (target->state == TARGET_RUNNING) {
+		r->next_poll_ms = now + r->poll_interval_ms;
+		r->poll_interval_ms = MIN(MAX(2 * r->poll_interval_ms, 1),
+				r->poll_max_ms);
+	} else {
+		r->poll_interval_ms = r->poll_min_ms;
+	}
+
+	return result;
 }
 
-int halt_prep(struct target *target)
+/* riscv_openocd_poll() looks at the whole group at once, with a single
+ * group status read where the debug module supports that. */
+static int riscv_poll_smp(struct target *target)
 {
 	RISCV_INFO(r);
+	if (r->is_halted)
+		return riscv_poll(target);
 
-	LOG_DEBUG("[%s] prep hart, debug_reason=%d", target_name(target),
-				target->debug_reason);
-	if (riscv_select_current_hart(target) != ERROR_OK)
-		return ERROR_FAIL;
-	if (riscv_is_halted(target)) {
-		LOG_DEBUG("[%s] Hart is already halted (reason=%d).",
-				target_name(target), target->debug_reason);
-	} else {
-		if (r->halt_prep(target) != ERROR_OK)
-			return ERROR_FAIL;
-		r->prepped = true;
+	int result = ERROR_OK;
+	for (struct target_list *list = target->head; list; list = list->next) {
+		if (riscv_poll(list->target) != ERROR_OK)
+			result = ERROR_FAIL;
+	}
+	return result;
+}
+
+static int riscv_fast_poll(void *priv)
+{
+	struct target *target = priv;
+	RISCV_INFO(r);
+
+	r->fast_poll_scheduled = false;
+	if (target->state != TARGET_RUNNING || !is_jtag_poll_safe())
+		return ERROR_OK;
+
+	target_poll(target);
+
+	/* The regular poll takes over once the interval reaches its rate. */
+	if (target->state == TARGET_RUNNING &&
+			r->poll_interval_ms < TARGET_DEFAULT_POLLING_INTERVAL) {
+		if (target_register_timer_callback(riscv_fast_poll,
+					r->poll_interval_ms, TARGET_TIMER_TYPE_ONESHOT,
+					target) == ERROR_OK)
+			r->fast_poll_scheduled = true;
 	}
 
 	return ERROR_OK;
 }
 
-int riscv_halt_go_all_harts(struct target *target)
+/* Right after a resume is when the target is most likely to halt again (a
+ * step over a call, or a short continue), so poll it quickly for a while. */
+static void riscv_fast_poll_start(struct target *target)
 {
 	RISCV_INFO(r);
 
-	if (riscv_select_current_hart(target) != ERROR_OK)
-		return ERROR_FAIL;
-	if (riscv_is_halted(target)) {
-		LOG_DEBUG("[%s] Hart is already halted.", target_name(target));
-	} else {
-		if (r->halt_go(target) != ERROR_OK)
-			return ERROR_FAIL;
-	}
+	r->poll_interval_ms = r->poll_min_ms;
+	r->next_poll_ms = timeval_ms() + r->poll_interval_ms;
 
-	riscv_invalidate_register_cache(target);
+	if (r->fast_poll_scheduled || r->poll_min_ms == 0 ||
+			r->poll_min_ms >= TARGET_DEFAULT_POLLING_INTERVAL)
+		return;
 
-	return ERROR_OK;
+	if (target_register_timer_callback(riscv_fast_poll, r->poll_min_ms,
+				TARGET_TIMER_TYPE_ONESHOT, target) == ERROR_OK)
+		r->fast_poll_scheduled = true;
 }
 
-int halt_go(struct target *target)
+int riscv_select_current_hart(struct target *target)
 {
-	riscv_info_t *r = riscv_info(target);
-	int result;
-	if (r->is_halted == NULL) {
-		struct target_type *tt = get_target_type(target);
+	return riscv_set_current_hartid(target, target->coreid);
+}
+
+/* Ask the DM which harts of target's SMP group are halted, all at once.
+ * Returns ERROR_OK and fills in halted[] (in target->head order) if that
+ * worked. Otherwise the caller has to ask each hart. */
+static int riscv_group_halted(struct target *target, bool *halted)
+{
+	RISCV_INFO(r);
+
+	if (!r->group_halted || !target->smp)
+		return ERROR_NOT_IMPLEMENTED;
+
+	unsigned count = 0;
+	for (struct target_list *list = target->head; list; list = list->next)
+		count++;
+	if (count > RISCV_MAX_HARTS)
+		return ERROR_NOT_IMPLEMENTED;
+
+	return r->group_halted(target, halted);
+}
+
+/* Prep a hart whose halt state is already known. */
+static int halt_prep_hart(struct target *target, bool halted)
+{
+	RISCV_INFO(r);
+
+	if (halted) {
+		LOG_DEBUG("[%s] Hart is already halted (reason=%d).",
+				target_name(target), target->debug_reason);
+	} else {
+		if (r->halt_prep(target) != ERROR_OK)
+			return ERROR_FAIL;
+		r->prepped = true;
+	}
+
+	return ERROR_OK;
+}
+
+int halt_prep(struct target *target)
+{
+	LOG_DEBUG("[%s] prep hart, debug_reason=%d", target_name(target),
+				target->debug_reason);
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+	return halt_prep_hart(target, riscv_is_halted(target));
+}
+
+/* In an all-stop SMP group a halt only reads sp and pc of each hart, all of
+ * them in one go, and the other registers of a hart are read when gdb asks
+ * for them, which it usually only does for the hart it reports the stop on.
+ * Otherwise every hart reads all its GPRs on every halt. */
+static bool riscv_snapshot_halts(struct target *target)
+{
+	RISCV_INFO(r);
+	return target->smp && !r->non_stop && r->snapshot_group;
+}
+
+static void riscv_snapshot_group(struct target *target)
+{
+	RISCV_INFO(r);
+
+	if (!riscv_snapshot_halts(target))
+		return;
+	if (r->snapshot_group(target) != ERROR_OK)
+		LOG_DEBUG("[%s] group register snapshot failed", target_name(target));
+}
+
+int riscv_halt_go_all_harts(struct target *target)
+{
+	RISCV_INFO(r);
+
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+	if (riscv_is_halted(target) && target->state == TARGET_HALTED) {
+		/* It hasn't run since the registers were cached. */
+		LOG_DEBUG("[%s] Hart is already halted.", target_name(target));
+		register_cache_invalidate_halted(target->reg_cache);
+	} else {
+		if (!riscv_is_halted(target) && r->halt_go(target) != ERROR_OK)
+			return ERROR_FAIL;
+		riscv_invalidate_register_cache(target);
+	}
+
+	riscv_invalidate_memory_cache(target);
+	if (!riscv_snapshot_halts(target))
+		riscv_prefetch_registers(target);
+
+	return ERROR_OK;
+}
+
+int halt_go(struct target *target)
+{
+	riscv_info_t *r = riscv_info(target);
+	int result;
+	if (r->is_halted == NULL) {
+		struct target_type *tt = get_target_type(target);
 		result = tt->halt(target);
 	} else {
 		result = riscv_halt_go_all_harts(target);
@@ -1198,11 +1851,21 @@ int riscv_halt(struct target *target)
 	LOG_DEBUG("[%d] halting all harts", target->coreid);
 
 	int result = ERROR_OK;
-	if (target->smp) {
-		for (struct target_list *tlist = target->head; tlist; tlist = tlist->next) {
+	if (target->smp && !r->non_stop) {
+		bool group_halted[RISCV_MAX_HARTS];
+		bool use_group = riscv_group_halted(target, group_halted) == ERROR_OK;
+		unsigned index = 0;
+		for (struct target_list *tlist = target->head; tlist;
+				tlist = tlist->next, index++) {
 			struct target *t = tlist->target;
-			if (halt_prep(t) != ERROR_OK)
+			if (use_group) {
+				LOG_DEBUG("[%s] prep hart, debug_reason=%d", target_name(t),
+						t->debug_reason);
+				if (halt_prep_hart(t, group_halted[index]) != ERROR_OK)
+					result = ERROR_FAIL;
+			} else if (halt_prep(t) != ERROR_OK) {
 				result = ERROR_FAIL;
+			}
 		}
 
 		for (struct target_list *tlist = target->head; tlist; tlist = tlist->next) {
@@ -1213,6 +1876,7 @@ int riscv_halt(struct target *target)
 					result = ERROR_FAIL;
 			}
 		}
+		riscv_snapshot_group(target);
 
 		for (struct target_list *tlist = target->head; tlist; tlist = tlist->next) {
 			struct target *t = tlist->target;
@@ -1236,7 +1900,12 @@ static int riscv_assert_reset(struct target *target)
 {
 	LOG_DEBUG("[%d]", target->coreid);
 	struct target_type *tt = get_target_type(target);
+	/* Don't leave ebreaks behind for breakpoints that were removed. */
+	if (target->state == TARGET_HALTED)
+		riscv_sync_breakpoints(target);
 	riscv_invalidate_register_cache(target);
+	riscv_invalidate_memory_cache(target);
+	invalidate_watchpoint_insn_cache(target);
 	return tt->assert_reset(target);
 }
 
@@ -1366,6 +2035,12 @@ static int resume_prep(struct target *target, int current,
 	if (!current)
 		riscv_set_register(target, GDB_REGNO_PC, address);
 
+	if (riscv_sync_breakpoints(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	if (riscv_flush_registers(target) != ERROR_OK)
+		return ERROR_FAIL;
+
 	if (target->debug_reason == DBG_REASON_WATCHPOINT) {
 		/* To be able to run off a trigger, disable all the triggers, step, and
 		 * then resume as usual. */
@@ -1433,9 +2108,10 @@ int riscv_resume(
 		int debug_execution,
 		bool single_hart)
 {
+	RISCV_INFO(r);
 	LOG_DEBUG("handle_breakpoints=%d", handle_breakpoints);
 	int result = ERROR_OK;
-	if (target->smp && !single_hart) {
+	if (target->smp && !single_hart && !r->non_stop) {
 		for (struct target_list *tlist = target->head; tlist; tlist = tlist->next) {
 			struct target *t = tlist->target;
 			if (resume_prep(t, current, address, handle_breakpoints,
@@ -1473,11 +2149,38 @@ int riscv_resume(
 	return result;
 }
 
+static int riscv_set_non_stop(struct target *target, bool enable)
+{
+	struct target_list single = { .target = target };
+	int result = ERROR_OK;
+
+	for (struct target_list *list = target->smp ? target->head : &single;
+			list; list = list->next) {
+		struct target *t = list->target;
+		riscv_info_t *r = riscv_info(t);
+		r->non_stop = enable;
+
+		if (!target_was_examined(t) || !t->smp || !r->set_halt_group)
+			continue;
+		bool supported;
+		if (r->set_halt_group(t, &supported) != ERROR_OK || !supported) {
+			LOG_ERROR("[%s] couldn't %s halt group %d", target_name(t),
+					enable ? "leave" : "join", t->smp);
+			result = ERROR_FAIL;
+		}
+	}
+
+	return result;
+}
+
 static int riscv_target_resume(struct target *target, int current, target_addr_t address,
 		int handle_breakpoints, int debug_execution)
 {
-	return riscv_resume(target, current, address, handle_breakpoints,
+	int result = riscv_resume(target, current, address, handle_breakpoints,
 			debug_execution, false);
+	if (result == ERROR_OK)
+		riscv_fast_poll_start(target);
+	return result;
 }
 
 static int riscv_mmu(struct target *target, int *enabled)
@@ -1487,6 +2190,14 @@ static int riscv_mmu(struct target *target, int *enabled)
 		return ERROR_OK;
 	}
 
+	/* Finding out takes registers a running hart can't give us, and the
+	 * system bus, the only way to reach memory then, uses physical
+	 * addresses anyway. */
+	if (target->state != TARGET_HALTED) {
+		*enabled = 0;
+		return ERROR_OK;
+	}
+
 	/* Don't use MMU in explicit or effective M (machine) mode */
 	riscv_reg_t priv;
 	if (riscv_get_register(target, &priv, GDB_REGNO_PRIV) != ERROR_OK) {
@@ -1525,8 +2236,80 @@ static int riscv_mmu(struct target *target, int *enabled)
 	return ERROR_OK;
 }
 
-static int riscv_address_translate(struct target *target,
-		target_addr_t virtual, target_addr_t *physical)
+/* Read the PTE at pte_address, and also up to prefetch PTEs after it in the
+ * same page table, going through the translation cache. */
+static int read_pte(struct target *target, const virt2phys_info_t *info,
+		target_addr_t pte_address, unsigned prefetch, uint64_t *pte)
+{
+	RISCV_INFO(r);
+	riscv_translation_cache_t *cache = &r->translation_cache;
+	bool use_cache = target->state == TARGET_HALTED;
+
+	if (use_cache) {
+		for (unsigned i = 0; i < RISCV_PTE_CACHE_ENTRIES; i++) {
+			if (cache->pte[i].valid && cache->pte[i].address == pte_address) {
+				*pte = cache->pte[i].pte;
+				return ERROR_OK;
+			}
+		}
+	}
+
+	unsigned pte_size = 1 << info->pte_shift;
+	target_addr_t table_end = (pte_address | (RISCV_PGSIZE - 1)) + 1;
+	unsigned count = MIN(1 + prefetch, (table_end - pte_address) / pte_size);
+	count = MIN(count, RISCV_PTE_PREFETCH);
+	if (!use_cache)
+		count = 1;
+
+	uint8_t buffer[RISCV_PTE_PREFETCH * 8];
+	assert(info->pte_shift <= 3);
+	if (r->read_memory(target, pte_address, 4, count * pte_size / 4, buffer,
+				4) != ERROR_OK)
+		return ERROR_FAIL;
+
+	for (unsigned i = 0; i < count; i++) {
+		uint64_t value;
+		if (info->pte_shift == 2)
+			value = buf_get_u32(buffer + i * pte_size, 0, 32);
+		else
+			value = buf_get_u64(buffer + i * pte_size, 0, 64);
+		if (i == 0)
+			*pte = value;
+		if (!use_cache)
+			break;
+		cache->pte[cache->pte_next].valid = true;
+		cache->pte[cache->pte_next].address = pte_address + i * pte_size;
+		cache->pte[cache->pte_next].pte = value;
+		cache->pte_next = (cache->pte_next + 1) % RISCV_PTE_CACHE_ENTRIES;
+	}
+	return ERROR_OK;
+}
+
+/* Physical address of virtual, given the leaf PTE found at level i. */
+static target_addr_t leaf_physical(const virt2phys_info_t *info,
+		target_addr_t virtual, uint64_t pte, int i)
+{
+	/* Make sure to clear out the high bits that may be set. */
+	target_addr_t physical = virtual & (((target_addr_t)1 << info->va_bits) - 1);
+
+	while (i < info->level) {
+		uint64_t ppn_value = pte >> info->pte_ppn_shift[i];
+		ppn_value &= info->pte_ppn_mask[i];
+		physical &= ~(((target_addr_t)info->pa_ppn_mask[i]) <<
+				info->pa_ppn_shift[i]);
+		physical |= (ppn_value << info->pa_ppn_shift[i]);
+		i++;
+	}
+	return physical;
+}
+
+/* Translate virtual. If page_size is not NULL, it's set to the size of the
+ * page virtual is in. length is how many bytes the caller is going to access
+ * from virtual, so that the leaf PTEs for the pages after it can be read
+ * along with the first one. */
+static int riscv_address_translate_range(struct target *target,
+		target_addr_t virtual, target_addr_t length, target_addr_t *physical,
+		target_addr_t *page_size)
 {
 	RISCV_INFO(r);
 	riscv_reg_t satp_value;
@@ -1573,6 +2356,28 @@ static int riscv_address_translate(struct target *target,
 		return ERROR_FAIL;
 	}
 
+	riscv_translation_cache_t *cache = &r->translation_cache;
+	if (target->state == TARGET_HALTED) {
+		for (unsigned n = 0; n < RISCV_TLB_ENTRIES; n++) {
+			if (cache->tlb[n].valid && cache->tlb[n].satp == satp_value &&
+					cache->tlb[n].vpage ==
+					virtual >> info->vpn_shift[cache->tlb[n].level]) {
+				i = cache->tlb[n].level;
+				*physical = leaf_physical(info, virtual, cache->tlb[n].pte, i);
+				if (page_size)
+					*page_size = (target_addr_t)1 << info->vpn_shift[i];
+				return ERROR_OK;
+			}
+		}
+	}
+
+	/* Leaf PTEs for the following pages, if they're 4 KiB pages too. */
+	target_addr_t page_offset = virtual & (RISCV_PGSIZE - 1);
+	unsigned prefetch = 0;
+	if (length > RISCV_PGSIZE - page_offset)
+		prefetch = (length - (RISCV_PGSIZE - page_offset) + RISCV_PGSIZE - 1) /
+			RISCV_PGSIZE;
+
 	ppn_value = get_field(satp_value, RISCV_SATP_PPN(xlen));
 	table_address = ppn_value << RISCV_PGSHIFT;
 	i = info->level - 1;
@@ -1581,18 +2386,10 @@ static int riscv_address_translate(struct target *target,
 		vpn &= info->vpn_mask[i];
 		target_addr_t pte_address = table_address +
 									(vpn << info->pte_shift);
-		uint8_t buffer[8];
-		assert(info->pte_shift <= 3);
-		int retval = r->read_memory(target, pte_address,
-				4, (1 << info->pte_shift) / 4, buffer, 4);
-		if (retval != ERROR_OK)
+		if (read_pte(target, info, pte_address, i == 0 ? prefetch : 0,
+					&pte) != ERROR_OK)
 			return ERROR_FAIL;
 
-		if (info->pte_shift == 2)
-			pte = buf_get_u32(buffer, 0, 32);
-		else
-			pte = buf_get_u64(buffer, 0, 64);
-
 		LOG_DEBUG("i=%d; PTE @0x%" TARGET_PRIxADDR " = 0x%" PRIx64, i,
 				pte_address, pte);
 
@@ -1614,23 +2411,30 @@ static int riscv_address_translate(struct target *target,
 		return ERROR_FAIL;
 	}
 
-	/* Make sure to clear out the high bits that may be set. */
-	*physical = virtual & (((target_addr_t)1 << info->va_bits) - 1);
-
-	while (i < info->level) {
-		ppn_value = pte >> info->pte_ppn_shift[i];
-		ppn_value &= info->pte_ppn_mask[i];
-		*physical &= ~(((target_addr_t)info->pa_ppn_mask[i]) <<
-				info->pa_ppn_shift[i]);
-		*physical |= (ppn_value << info->pa_ppn_shift[i]);
-		i++;
+	if (target->state == TARGET_HALTED) {
+		cache->tlb[cache->tlb_next].valid = true;
+		cache->tlb[cache->tlb_next].satp = satp_value;
+		cache->tlb[cache->tlb_next].level = i;
+		cache->tlb[cache->tlb_next].vpage = virtual >> info->vpn_shift[i];
+		cache->tlb[cache->tlb_next].pte = pte;
+		cache->tlb_next = (cache->tlb_next + 1) % RISCV_TLB_ENTRIES;
 	}
+
+	*physical = leaf_physical(info, virtual, pte, i);
+	if (page_size)
+		*page_size = (target_addr_t)1 << info->vpn_shift[i];
 	LOG_DEBUG("0x%" TARGET_PRIxADDR " -> 0x%" TARGET_PRIxADDR, virtual,
 			*physical);
 
 	return ERROR_OK;
 }
 
+static int riscv_address_translate(struct target *target,
+		target_addr_t virtual, target_addr_t *physical)
+{
+	return riscv_address_translate_range(target, virtual, 1, physical, NULL);
+}
+
 static int riscv_virt2phys(struct target *target, target_addr_t virtual, target_addr_t *physical)
 {
 	int enabled;
@@ -1645,12 +2449,121 @@ static int riscv_virt2phys(struct target *target, target_addr_t virtual, target_
 	return ERROR_FAIL;
 }
 
+/* Work out where the access of length bytes at address goes, and how much of
+ * it is physically contiguous. Without translation that's all of it at the
+ * same address. */
+static void translate_range(struct target *target, bool mmu_enabled,
+		target_addr_t address, target_addr_t length, target_addr_t *physical,
+		target_addr_t *contiguous)
+{
+	*physical = address;
+	*contiguous = length;
+	if (!mmu_enabled)
+		return;
+
+	target_addr_t page_size;
+	if (riscv_address_translate_range(target, address, length, physical,
+				&page_size) != ERROR_OK) {
+		*physical = address;
+		return;
+	}
+
+	target_addr_t done = page_size - (address & (page_size - 1));
+	while (done < length) {
+		target_addr_t next;
+		if (riscv_address_translate_range(target, address + done,
+					length - done, &next, &page_size) != ERROR_OK ||
+				next != *physical + done)
+			break;
+		done += page_size;
+	}
+	*contiguous = MIN(done, length);
+}
+
+static bool mem_cache_allowed(struct target *target, target_addr_t address,
+		uint32_t length)
+{
+	RISCV_INFO(r);
+	riscv_mem_cache_t *cache = &r->mem_cache;
+
+	if (cache->line_size == 0 || !cache->data ||
+			target->state != TARGET_HALTED)
+		return false;
+
+	bool any_region = false;
+	for (unsigned i = 0; i < ARRAY_SIZE(cache->region); i++) {
+		if (!cache->region[i].enabled)
+			continue;
+		any_region = true;
+		if (address >= cache->region[i].address &&
+				address - cache->region[i].address + length <= cache->region[i].size)
+			return true;
+	}
+	return !any_region;
+}
+
+/* Satisfy a read from the memory cache, filling lines as needed. Returns
+ * ERROR_FAIL if the read can't be cached, or a line couldn't be filled, in
+ * which case the caller should read memory directly. */
+static int mem_cache_read(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, uint8_t *buffer)
+{
+	RISCV_INFO(r);
+	riscv_mem_cache_t *cache = &r->mem_cache;
+
+	/* Lines are one aligned block each, so reads have to stay inside the
+	 * regions that whole lines cover. */
+	target_addr_t first_line = address & ~(target_addr_t)(cache->line_size - 1);
+	target_addr_t end = address + size * count;
+	target_addr_t end_line = (end + cache->line_size - 1) &
+		~(target_addr_t)(cache->line_size - 1);
+	if (end_line <= first_line)
+		return ERROR_FAIL;
+	/* Big reads won't be read again soon, and would flush everything else. */
+	if ((end_line - first_line) / cache->line_size > RISCV_MEM_CACHE_LINES / 2)
+		return ERROR_FAIL;
+	if (!mem_cache_allowed(target, first_line, end_line - first_line))
+		return ERROR_FAIL;
+
+	for (target_addr_t line_address = first_line; line_address < end_line;
+			line_address += cache->line_size) {
+		unsigned line;
+		for (line = 0; line < RISCV_MEM_CACHE_LINES; line++) {
+			if (cache->line[line].valid &&
+					cache->line[line].address == line_address)
+				break;
+		}
+		uint8_t *data;
+		if (line < RISCV_MEM_CACHE_LINES) {
+			data = cache->data + line * cache->line_size;
+		} else {
+			line = cache->next;
+			cache->next = (cache->next + 1) % RISCV_MEM_CACHE_LINES;
+			data = cache->data + line * cache->line_size;
+			cache->line[line].valid = false;
+			if (r->read_memory(target, line_address, 4, cache->line_size / 4,
+						data, 4) != ERROR_OK)
+				return ERROR_FAIL;
+			cache->line[line].valid = true;
+			cache->line[line].address = line_address;
+		}
+
+		target_addr_t from = MAX(address, line_address);
+		target_addr_t to = MIN(end, line_address + cache->line_size);
+		memcpy(buffer + (from - address), data + (from - line_address), to - from);
+	}
+
+	return ERROR_OK;
+}
+
 static int riscv_read_phys_memory(struct target *target, target_addr_t phys_address,
 			uint32_t size, uint32_t count, uint8_t *buffer)
 {
 	RISCV_INFO(r);
 	if (riscv_select_current_hart(target) != ERROR_OK)
 		return ERROR_FAIL;
+	if (mem_cache_read(target, phys_address, size, count, buffer) == ERROR_OK)
+		return ERROR_OK;
 	return r->read_memory(target, phys_address, size, count, buffer, size);
 }
 
@@ -1665,12 +2578,58 @@ static int riscv_read_memory(struct target *target, target_addr_t address,
 	if (riscv_select_current_hart(target) != ERROR_OK)
 		return ERROR_FAIL;
 
-	target_addr_t physical_addr;
-	if (target->type->virt2phys(target, address, &physical_addr) == ERROR_OK)
-		address = physical_addr;
+	int mmu_enabled;
+	if (riscv_mmu(target, &mmu_enabled) != ERROR_OK)
+		mmu_enabled = 0;
+
+	RISCV_INFO(r);
+	target_addr_t start = address;
+	uint8_t *start_buffer = buffer;
+	/* Pages that are contiguous in virtual memory may not be physically, so
+	 * split the read where that changes. */
+	while (count > 0) {
+		target_addr_t physical, contiguous;
+		translate_range(target, mmu_enabled, address, (target_addr_t)size * count,
+				&physical, &contiguous);
+		uint32_t chunk = MAX(contiguous / size, 1);
+
+		if (mem_cache_read(target, physical, size, chunk, buffer) != ERROR_OK &&
+				r->read_memory(target, physical, size, chunk, buffer,
+					size) != ERROR_OK)
+			return ERROR_FAIL;
+
+		address += chunk * size;
+		buffer += chunk * size;
+		count -= chunk;
+	}
+	hide_removed_sw_breakpoints(target, start, buffer - start_buffer,
+			start_buffer);
+	return ERROR_OK;
+}
 
+static int riscv_read_memory_batch(struct target *target,
+		struct target_memory_read *reads, unsigned int num_reads)
+{
 	RISCV_INFO(r);
-	return r->read_memory(target, address, size, count, buffer, size);
+	if (!r->read_memory_batch)
+		return ERROR_NOT_IMPLEMENTED;
+
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	/* the batch takes physical addresses */
+	int mmu_enabled;
+	if (riscv_mmu(target, &mmu_enabled) != ERROR_OK || mmu_enabled)
+		return ERROR_NOT_IMPLEMENTED;
+
+	int retval = r->read_memory_batch(target, reads, num_reads);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < num_reads; i++)
+		hide_removed_sw_breakpoints(target, reads[i].address,
+				(target_addr_t)reads[i].size * reads[i].count, reads[i].buffer);
+	return ERROR_OK;
 }
 
 static int riscv_write_phys_memory(struct target *target, target_addr_t phys_address,
@@ -1678,6 +2637,8 @@ static int riscv_write_phys_memory(struct target *target, target_addr_t phys_add
 {
 	if (riscv_select_current_hart(target) != ERROR_OK)
 		return ERROR_FAIL;
+	riscv_invalidate_memory_cache(target);
+	invalidate_watchpoint_insn_cache(target);
 	struct target_type *tt = get_target_type(target);
 	return tt->write_memory(target, phys_address, size, count, buffer);
 }
@@ -1693,12 +2654,45 @@ static int riscv_write_memory(struct target *target, target_addr_t address,
 	if (riscv_select_current_hart(target) != ERROR_OK)
 		return ERROR_FAIL;
 
-	target_addr_t physical_addr;
-	if (target->type->virt2phys(target, address, &physical_addr) == ERROR_OK)
-		address = physical_addr;
+	if (restore_removed_sw_breakpoints(target, address,
+				(target_addr_t)size * count) != ERROR_OK)
+		return ERROR_FAIL;
 
+	int mmu_enabled;
+	if (riscv_mmu(target, &mmu_enabled) != ERROR_OK)
+		mmu_enabled = 0;
+
+	/* Translate the whole range before writing anything, since the write
+	 * could change the page tables. */
+	struct {
+		target_addr_t physical;
+		uint32_t count;
+	} chunks[16];
+	unsigned num_chunks = 0;
+	target_addr_t next = address;
+	uint32_t left = count;
+	while (left > 0 && num_chunks < ARRAY_SIZE(chunks)) {
+		target_addr_t contiguous;
+		translate_range(target, mmu_enabled, next, (target_addr_t)size * left,
+				&chunks[num_chunks].physical, &contiguous);
+		chunks[num_chunks].count = MAX(contiguous / size, 1);
+		next += chunks[num_chunks].count * size;
+		left -= chunks[num_chunks].count;
+		num_chunks++;
+	}
+
+	riscv_invalidate_memory_cache(target);
+	invalidate_watchpoint_insn_cache(target);
 	struct target_type *tt = get_target_type(target);
-	return tt->write_memory(target, address, size, count, buffer);
+	for (unsigned i = 0; i < num_chunks; i++) {
+		if (tt->write_memory(target, chunks[i].physical, size, chunks[i].count,
+					buffer) != ERROR_OK)
+			return ERROR_FAIL;
+		buffer += chunks[i].count * size;
+	}
+	if (left > 0)
+		return riscv_write_memory(target, next, size, left, buffer);
+	return ERROR_OK;
 }
 
 static int riscv_get_gdb_reg_list_internal(struct target *target,
@@ -1733,10 +2727,51 @@ static int riscv_get_gdb_reg_list_internal(struct target *target,
 	if (!*reg_list)
 		return ERROR_FAIL;
 
+	/* A 'g' packet wants all the GPRs and pc. If any of them aren't cached,
+	 * fetch them all in one go rather than one register at a time. */
+	if (read && target->state == TARGET_HALTED) {
+		for (int i = GDB_REGNO_ZERO; i <= GDB_REGNO_PC; i++) {
+			struct reg *reg = &target->reg_cache->reg_list[i];
+			if (reg->exist && !reg->valid) {
+				riscv_prefetch_registers(target);
+				break;
+			}
+		}
+	}
+
+	/* Same for the CSRs when gdb wants everything. Most CSRs can't be
+	 * cached, but the values just read are as good as reading them one by
+	 * one below. */
+	bool csr_fetched[GDB_REGNO_CSR4095 - GDB_REGNO_CSR0 + 1] = { false };
+	if (read && reg_class == REG_CLASS_ALL && target->state == TARGET_HALTED) {
+		unsigned regnos[ARRAY_SIZE(csr_fetched)];
+		unsigned count = 0;
+		for (unsigned i = GDB_REGNO_CSR0; i <= GDB_REGNO_CSR4095; i++) {
+			struct reg *reg = &target->reg_cache->reg_list[i];
+			if (reg->exist && !reg->valid)
+				regnos[count++] = i;
+		}
+		riscv_reg_t *values = malloc(count * sizeof(*values));
+		bool *valid = malloc(count * sizeof(*valid));
+		if (count > 0 && values && valid) {
+			if (riscv_read_csrs(target, regnos, count, values, valid) == ERROR_OK) {
+				for (unsigned i = 0; i < count; i++)
+					csr_fetched[regnos[i] - GDB_REGNO_CSR0] = valid[i];
+			} else {
+				LOG_DEBUG("[%s] CSR prefetch failed", target_name(target));
+			}
+		}
+		free(values);
+		free(valid);
+	}
+
 	for (int i = 0; i < *reg_list_size; i++) {
 		assert(!target->reg_cache->reg_list[i].valid ||
 				target->reg_cache->reg_list[i].size > 0);
 		(*reg_list)[i] = &target->reg_cache->reg_list[i];
+		if (i >= GDB_REGNO_CSR0 && i <= GDB_REGNO_CSR4095 &&
+				csr_fetched[i - GDB_REGNO_CSR0])
+			continue;
 		if (read &&
 				target->reg_cache->reg_list[i].exist &&
 				!target->reg_cache->reg_list[i].valid) {
@@ -1772,10 +2807,10 @@ static int riscv_arch_state(struct target *target)
 }
 
 /* Algorithm must end with a software breakpoint instruction. */
-static int riscv_run_algorithm(struct target *target, int num_mem_params,
+static int riscv_start_algorithm(struct target *target, int num_mem_params,
 		struct mem_param *mem_params, int num_reg_params,
 		struct reg_param *reg_params, target_addr_t entry_point,
-		target_addr_t exit_point, int timeout_ms, void *arch_info)
+		target_addr_t exit_point, void *arch_info)
 {
 	RISCV_INFO(info);
 
@@ -1789,14 +2824,16 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 		return ERROR_TARGET_NOT_HALTED;
 	}
 
+	if (riscv_sync_breakpoints(target) != ERROR_OK)
+		return ERROR_FAIL;
+
 	/* Save registers */
 	struct reg *reg_pc = register_get_by_name(target->reg_cache, "pc", 1);
 	if (!reg_pc || reg_pc->type->get(reg_pc) != ERROR_OK)
 		return ERROR_FAIL;
-	uint64_t saved_pc = buf_get_u64(reg_pc->value, 0, reg_pc->size);
-	LOG_DEBUG("saved_pc=0x%" PRIx64, saved_pc);
+	info->algorithm_saved.pc = buf_get_u64(reg_pc->value, 0, reg_pc->size);
+	LOG_DEBUG("saved_pc=0x%" PRIx64, info->algorithm_saved.pc);
 
-	uint64_t saved_regs[32];
 	for (int i = 0; i < num_reg_params; i++) {
 		LOG_DEBUG("save %s", reg_params[i].reg_name);
 		struct reg *r = register_get_by_name(target->reg_cache, reg_params[i].reg_name, 0);
@@ -1818,7 +2855,7 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 
 		if (r->type->get(r) != ERROR_OK)
 			return ERROR_FAIL;
-		saved_regs[r->number] = buf_get_u64(r->value, 0, r->size);
+		info->algorithm_saved.regs[r->number] = buf_get_u64(r->value, 0, r->size);
 
 		if (reg_params[i].direction == PARAM_OUT || reg_params[i].direction == PARAM_IN_OUT) {
 			if (r->type->set(r, reg_params[i].value) != ERROR_OK)
@@ -1828,7 +2865,6 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 
 
 	/* Disable Interrupts before attempting to run the algorithm. */
-	uint64_t current_mstatus;
 	uint8_t mstatus_bytes[8] = { 0 };
 
 	LOG_DEBUG("Disabling Interrupts");
@@ -1840,9 +2876,9 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 	}
 
 	reg_mstatus->type->get(reg_mstatus);
-	current_mstatus = buf_get_u64(reg_mstatus->value, 0, reg_mstatus->size);
+	info->algorithm_saved.mstatus = buf_get_u64(reg_mstatus->value, 0, reg_mstatus->size);
 	uint64_t ie_mask = MSTATUS_MIE | MSTATUS_HIE | MSTATUS_SIE | MSTATUS_UIE;
-	buf_set_u64(mstatus_bytes, 0, info->xlen, set_field(current_mstatus,
+	buf_set_u64(mstatus_bytes, 0, info->xlen, set_field(info->algorithm_saved.mstatus,
 				ie_mask, 0));
 
 	reg_mstatus->type->set(reg_mstatus, mstatus_bytes);
@@ -1852,6 +2888,23 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 	if (riscv_resume(target, 0, entry_point, 0, 0, true) != ERROR_OK)
 		return ERROR_FAIL;
 
+	return ERROR_OK;
+}
+
+static int riscv_wait_algorithm(struct target *target, int num_mem_params,
+		struct mem_param *mem_params, int num_reg_params,
+		struct reg_param *reg_params, target_addr_t exit_point, int timeout_ms,
+		void *arch_info)
+{
+	RISCV_INFO(info);
+
+	struct reg *reg_pc = register_get_by_name(target->reg_cache, "pc", 1);
+	struct reg *reg_mstatus = register_get_by_name(target->reg_cache,
+			"mstatus", 1);
+	if (!reg_pc || !reg_mstatus)
+		return ERROR_FAIL;
+	uint8_t mstatus_bytes[8] = { 0 };
+
 	int64_t start = timeval_ms();
 	while (target->state != TARGET_HALTED) {
 		LOG_DEBUG("poll()");
@@ -1902,12 +2955,12 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 
 	/* Restore Interrupts */
 	LOG_DEBUG("Restoring Interrupts");
-	buf_set_u64(mstatus_bytes, 0, info->xlen, current_mstatus);
+	buf_set_u64(mstatus_bytes, 0, info->xlen, info->algorithm_saved.mstatus);
 	reg_mstatus->type->set(reg_mstatus, mstatus_bytes);
 
 	/* Restore registers */
 	uint8_t buf[8] = { 0 };
-	buf_set_u64(buf, 0, info->xlen, saved_pc);
+	buf_set_u64(buf, 0, info->xlen, info->algorithm_saved.pc);
 	if (reg_pc->type->set(reg_pc, buf) != ERROR_OK)
 		return ERROR_FAIL;
 
@@ -1923,7 +2976,7 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 		}
 		LOG_DEBUG("restore %s", reg_params[i].reg_name);
 		struct reg *r = register_get_by_name(target->reg_cache, reg_params[i].reg_name, 0);
-		buf_set_u64(buf, 0, info->xlen, saved_regs[r->number]);
+		buf_set_u64(buf, 0, info->xlen, info->algorithm_saved.regs[r->number]);
 		if (r->type->set(r, buf) != ERROR_OK) {
 			LOG_ERROR("set(%s) failed", r->name);
 			return ERROR_FAIL;
@@ -1933,64 +2986,282 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 	return ERROR_OK;
 }
 
-static int riscv_checksum_memory(struct target *target,
-		target_addr_t address, uint32_t count,
-		uint32_t *checksum)
+static int riscv_run_algorithm(struct target *target, int num_mem_params,
+		struct mem_param *mem_params, int num_reg_params,
+		struct reg_param *reg_params, target_addr_t entry_point,
+		target_addr_t exit_point, int timeout_ms, void *arch_info)
 {
-	struct working_area *crc_algorithm;
-	struct reg_param reg_params[2];
-	int retval;
+	int retval = riscv_start_algorithm(target, num_mem_params, mem_params,
+			num_reg_params, reg_params, entry_point, exit_point, arch_info);
+	if (retval != ERROR_OK)
+		return retval;
 
-	LOG_DEBUG("address=0x%" TARGET_PRIxADDR "; count=0x%x", address, count);
+	return riscv_wait_algorithm(target, num_mem_params, mem_params,
+			num_reg_params, reg_params, exit_point, timeout_ms, arch_info);
+}
 
-	static const uint8_t riscv32_crc_code[] = {
-#include "../../contrib/loaders/checksum/riscv32_crc.inc"
-	};
-	static const uint8_t riscv64_crc_code[] = {
-#include "../../contrib/loaders/checksum/riscv64_crc.inc"
-	};
+/**
+ * Whether memory can be accessed while the hart runs, which is what
+ * target_run_flash_async_algorithm() needs to stream data to a loader.
+ */
+bool riscv_can_access_memory_running(struct target *target, uint32_t size)
+{
+	RISCV_INFO(r);
+	if (!r->can_access_memory_running)
+		return false;
+	return r->can_access_memory_running(target, size);
+}
 
-	static const uint8_t *crc_code;
+/**
+ * Save the state riscv_resident_algorithm_run() will change and disable
+ * interrupts, once for any number of runs.
+ */
+int riscv_resident_algorithm_begin(struct target *target,
+		struct riscv_resident_algorithm *algo)
+{
+	RISCV_INFO(r);
 
-	int xlen = riscv_xlen(target);
-	unsigned crc_code_size;
-	if (xlen == 32) {
-		crc_code = riscv32_crc_code;
-		crc_code_size = sizeof(riscv32_crc_code);
-	} else {
-		crc_code = riscv64_crc_code;
-		crc_code_size = sizeof(riscv64_crc_code);
+	if (target->state != TARGET_HALTED) {
+		LOG_WARNING("target not halted");
+		return ERROR_TARGET_NOT_HALTED;
 	}
 
-	if (count < crc_code_size * 4) {
-		/* Don't use the algorithm for relatively small buffers. It's faster
-		 * just to read the memory.  target_checksum_memory() will take care of
-		 * that if we fail. */
+	algo->saved_mask = 0;
+	algo->active = true;
+
+	/* Without is_halted (0.11 targets) every run is a regular
+	 * target_run_algorithm(), which saves and restores on its own. */
+	if (!r->is_halted)
+		return ERROR_OK;
+
+	if (riscv_get_register(target, &algo->saved_pc, GDB_REGNO_PC) != ERROR_OK ||
+			riscv_get_register(target, &algo->saved_mstatus, GDB_REGNO_MSTATUS) != ERROR_OK) {
+		algo->active = false;
+		return ERROR_FAIL;
+	}
+
+	uint64_t ie_mask = MSTATUS_MIE | MSTATUS_HIE | MSTATUS_SIE | MSTATUS_UIE;
+	if (riscv_set_register(target, GDB_REGNO_MSTATUS,
+				set_field(algo->saved_mstatus, ie_mask, 0)) != ERROR_OK) {
+		algo->active = false;
 		return ERROR_FAIL;
 	}
 
-	retval = target_alloc_working_area(target, crc_code_size, &crc_algorithm);
+	return ERROR_OK;
+}
+
+/** Allocate a working area for code, write it there, and begin. */
+int riscv_resident_algorithm_load(struct target *target,
+		struct riscv_resident_algorithm *algo, const uint8_t *code,
+		unsigned size)
+{
+	algo->area = NULL;
+	algo->active = false;
+
+	int retval = target_alloc_working_area(target, size, &algo->area);
 	if (retval != ERROR_OK)
 		return retval;
 
-	if (crc_algorithm->address + crc_algorithm->size > address &&
-			crc_algorithm->address < address + count) {
-		/* Region to checksum overlaps with the work area we've been assigned.
-		 * Bail. (Would be better to manually checksum what we read there, and
-		 * use the algorithm for the rest.) */
-		target_free_working_area(target, crc_algorithm);
+	retval = target_write_buffer(target, algo->area->address, size, code);
+	if (retval == ERROR_OK)
+		retval = riscv_resident_algorithm_begin(target, algo);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, algo->area);
+		algo->area = NULL;
+	}
+	return retval;
+}
+
+/**
+ * Run an algorithm between riscv_resident_algorithm_begin() and _end().
+ * Only the argument registers and pc are written, and the hart is resumed and
+ * waited for directly, without going through the full resume and poll paths
+ * (and their register cache refills) every time.
+ */
+int riscv_resident_algorithm_run(struct target *target,
+		struct riscv_resident_algorithm *algo, int num_reg_params,
+		struct reg_param *reg_params, target_addr_t entry_point,
+		target_addr_t exit_point, int timeout_ms)
+{
+	RISCV_INFO(r);
+
+	if (!algo->active) {
+		LOG_ERROR("BUG: resident algorithm run without begin.");
+		return ERROR_FAIL;
+	}
+
+	if (!r->is_halted)
+		return target_run_algorithm(target, 0, NULL, num_reg_params, reg_params,
+				entry_point, exit_point, timeout_ms, NULL);
+
+	if (target->state != TARGET_HALTED) {
+		LOG_WARNING("target not halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	for (int i = 0; i < num_reg_params; i++) {
+		struct reg *reg = register_get_by_name(target->reg_cache,
+				reg_params[i].reg_name, 0);
+		if (!reg) {
+			LOG_ERROR("Couldn't find register named '%s'", reg_params[i].reg_name);
+			return ERROR_FAIL;
+		}
+		if (reg->size != reg_params[i].size) {
+			LOG_ERROR("Register %s is %d bits instead of %d bits.",
+					reg_params[i].reg_name, reg->size, reg_params[i].size);
+			return ERROR_FAIL;
+		}
+		if (reg->number > GDB_REGNO_XPR31) {
+			LOG_ERROR("Only GPRs can be use as argument registers.");
+			return ERROR_FAIL;
+		}
+
+		if (!(algo->saved_mask & (1u << reg->number))) {
+			if (riscv_get_register(target, &algo->saved_regs[reg->number],
+						reg->number) != ERROR_OK)
+				return ERROR_FAIL;
+			algo->saved_mask |= 1u << reg->number;
+		}
+
+		if (reg_params[i].direction == PARAM_OUT ||
+				reg_params[i].direction == PARAM_IN_OUT) {
+			if (riscv_set_register(target, reg->number,
+						buf_get_u64(reg_params[i].value, 0, reg->size)) != ERROR_OK)
+				return ERROR_FAIL;
+		}
+	}
+
+	if (riscv_set_register(target, GDB_REGNO_PC, entry_point) != ERROR_OK)
 		return ERROR_FAIL;
+	if (riscv_flush_registers(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	LOG_DEBUG("resume at 0x%" TARGET_PRIxADDR, entry_point);
+	if (riscv_resume_prep_all_harts(target) != ERROR_OK ||
+			riscv_resume_go_all_harts(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	/* target->state stays halted, so nobody else sees this run. */
+	int64_t start = timeval_ms();
+	while (!riscv_is_halted(target)) {
+		if (timeval_ms() - start > timeout_ms) {
+			LOG_ERROR("Algorithm timed out after %d ms.", timeout_ms);
+			target->state = TARGET_RUNNING;
+			riscv_halt(target);
+			old_or_new_riscv_poll(target);
+			return ERROR_TARGET_TIMEOUT;
+		}
+		keep_alive();
+	}
+
+	if (exit_point) {
+		riscv_reg_t final_pc;
+		if (riscv_get_register(target, &final_pc, GDB_REGNO_PC) != ERROR_OK)
+			return ERROR_FAIL;
+		if (final_pc != exit_point) {
+			LOG_ERROR("PC ended up at 0x%" PRIx64 " instead of 0x%"
+					TARGET_PRIxADDR, final_pc, exit_point);
+			return ERROR_FAIL;
+		}
+	}
+
+	for (int i = 0; i < num_reg_params; i++) {
+		if (reg_params[i].direction != PARAM_IN &&
+				reg_params[i].direction != PARAM_IN_OUT)
+			continue;
+		struct reg *reg = register_get_by_name(target->reg_cache,
+				reg_params[i].reg_name, 0);
+		riscv_reg_t value;
+		if (riscv_get_register(target, &value, reg->number) != ERROR_OK)
+			return ERROR_FAIL;
+		buf_set_u64(reg_params[i].value, 0, reg_params[i].size, value);
+	}
+
+	return ERROR_OK;
+}
+
+/** Restore what riscv_resident_algorithm_begin() and runs changed. */
+int riscv_resident_algorithm_end(struct target *target,
+		struct riscv_resident_algorithm *algo)
+{
+	RISCV_INFO(r);
+	int retval = ERROR_OK;
+
+	if (algo->active && r->is_halted) {
+		for (unsigned i = 0; i < 32; i++) {
+			if ((algo->saved_mask & (1u << i)) &&
+					riscv_set_register(target, i, algo->saved_regs[i]) != ERROR_OK)
+				retval = ERROR_FAIL;
+		}
+		if (riscv_set_register(target, GDB_REGNO_MSTATUS, algo->saved_mstatus) != ERROR_OK)
+			retval = ERROR_FAIL;
+		if (riscv_set_register(target, GDB_REGNO_PC, algo->saved_pc) != ERROR_OK)
+			retval = ERROR_FAIL;
+	}
+	algo->active = false;
+
+	if (algo->area) {
+		target_free_working_area(target, algo->area);
+		algo->area = NULL;
+	}
+
+	return retval;
+}
+
+/* The CRC algorithm that matches the hart's XLEN. */
+static const uint8_t *crc_algorithm_code(struct target *target, unsigned *size)
+{
+	static const uint8_t riscv32_crc_code[] = {
+#include "../../contrib/loaders/checksum/riscv32_crc.inc"
+	};
+	static const uint8_t riscv64_crc_code[] = {
+#include "../../contrib/loaders/checksum/riscv64_crc.inc"
+	};
+
+	if (riscv_xlen(target) == 32) {
+		*size = sizeof(riscv32_crc_code);
+		return riscv32_crc_code;
 	}
+	*size = sizeof(riscv64_crc_code);
+	return riscv64_crc_code;
+}
+
+static int crc_algorithm_load(struct target *target,
+		struct working_area **crc_algorithm)
+{
+	unsigned crc_code_size;
+	const uint8_t *crc_code = crc_algorithm_code(target, &crc_code_size);
+	bool fresh;
 
-	retval = target_write_buffer(target, crc_algorithm->address, crc_code_size,
-			crc_code);
+	/* stays resident, so back to back checksums only download it once */
+	int retval = target_alloc_pinned_working_area(target,
+			riscv_xlen(target) == 64 ? "riscv64 crc" : "riscv32 crc",
+			crc_code_size, crc_algorithm, &fresh);
+	if (retval != ERROR_OK)
+		return retval;
+	if (!fresh)
+		return ERROR_OK;
+
+	retval = target_write_buffer(target, (*crc_algorithm)->address,
+			crc_code_size, crc_code);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("Failed to write code to " TARGET_ADDR_FMT ": %d",
-				crc_algorithm->address, retval);
-		target_free_working_area(target, crc_algorithm);
+				(*crc_algorithm)->address, retval);
+		target_unpin_working_area(*crc_algorithm);
+		target_free_working_area(target, *crc_algorithm);
 		return retval;
 	}
 
+	return ERROR_OK;
+}
+
+static int crc_algorithm_run(struct target *target,
+		struct working_area *crc_algorithm, target_addr_t address,
+		uint32_t count, uint32_t *checksum)
+{
+	struct reg_param reg_params[2];
+	int xlen = riscv_xlen(target);
+
 	init_reg_param(&reg_params[0], "a0", xlen, PARAM_IN_OUT);
 	init_reg_param(&reg_params[1], "a1", xlen, PARAM_OUT);
 	buf_set_u64(reg_params[0].value, 0, xlen, address);
@@ -1999,7 +3270,7 @@ static int riscv_checksum_memory(struct target *target,
 	/* 20 second timeout/megabyte */
 	int timeout = 20000 * (1 + (count / (1024 * 1024)));
 
-	retval = target_run_algorithm(target, 0, NULL, 2, reg_params,
+	int retval = target_run_algorithm(target, 0, NULL, 2, reg_params,
 			crc_algorithm->address,
 			0,	/* Leave exit point unspecified because we don't know. */
 			timeout, NULL);
@@ -2012,137 +3283,514 @@ static int riscv_checksum_memory(struct target *target,
 	destroy_reg_param(&reg_params[0]);
 	destroy_reg_param(&reg_params[1]);
 
-	target_free_working_area(target, crc_algorithm);
-
-	LOG_DEBUG("checksum=0x%x, result=%d", *checksum, retval);
-
 	return retval;
 }
 
-/*** OpenOCD Helper Functions ***/
+static bool overlaps_working_area(struct working_area *area,
+		target_addr_t address, uint32_t count)
+{
+	return area->address + area->size > address &&
+		area->address < address + count;
+}
 
-enum riscv_poll_hart {
-	RPH_NO_CHANGE,
-	RPH_DISCOVERED_HALTED,
-	RPH_DISCOVERED_RUNNING,
-	RPH_ERROR
-};
-static enum riscv_poll_hart riscv_poll_hart(struct target *target, int hartid)
+static int riscv_checksum_memory(struct target *target,
+		target_addr_t address, uint32_t count,
+		uint32_t *checksum)
 {
-	RISCV_INFO(r);
-	if (riscv_set_current_hartid(target, hartid) != ERROR_OK)
-		return RPH_ERROR;
+	struct working_area *crc_algorithm;
+	int retval;
 
-	LOG_DEBUG("polling hart %d, target->state=%d", hartid, target->state);
+	LOG_DEBUG("address=0x%" TARGET_PRIxADDR "; count=0x%x", address, count);
 
-	/* If OpenOCD thinks we're running but this hart is halted then it's time
-	 * to raise an event. */
-	bool halted = riscv_is_halted(target);
-	if (target->state != TARGET_HALTED && halted) {
-		LOG_DEBUG("  triggered a halt");
-		r->on_halt(target);
-		return RPH_DISCOVERED_HALTED;
-	} else if (target->state != TARGET_RUNNING && !halted) {
-		LOG_DEBUG("  triggered running");
-		target->state = TARGET_RUNNING;
-		target->debug_reason = DBG_REASON_NOTHALTED;
-		return RPH_DISCOVERED_RUNNING;
+	unsigned crc_code_size;
+	crc_algorithm_code(target, &crc_code_size);
+	if (count < crc_code_size * 4) {
+		/* Don't use the algorithm for relatively small buffers. It's faster
+		 * just to read the memory.  target_checksum_memory() will take care of
+		 * that if we fail. */
+		return ERROR_FAIL;
 	}
 
-	return RPH_NO_CHANGE;
-}
+	retval = crc_algorithm_load(target, &crc_algorithm);
+	if (retval != ERROR_OK)
+		return retval;
 
-int set_debug_reason(struct target *target, enum riscv_halt_reason halt_reason)
-{
-	switch (halt_reason) {
-		case RISCV_HALT_BREAKPOINT:
-			target->debug_reason = DBG_REASON_BREAKPOINT;
-			break;
-		case RISCV_HALT_TRIGGER:
-			target->debug_reason = DBG_REASON_WATCHPOINT;
-			break;
-		case RISCV_HALT_INTERRUPT:
-		case RISCV_HALT_GROUP:
-			target->debug_reason = DBG_REASON_DBGRQ;
-			break;
-		case RISCV_HALT_SINGLESTEP:
-			target->debug_reason = DBG_REASON_SINGLESTEP;
-			break;
-		case RISCV_HALT_UNKNOWN:
-			target->debug_reason = DBG_REASON_UNDEFINED;
-			break;
-		case RISCV_HALT_ERROR:
-			return ERROR_FAIL;
+	if (overlaps_working_area(crc_algorithm, address, count)) {
+		/* Region to checksum overlaps with the work area we've been assigned.
+		 * Bail. (Would be better to manually checksum what we read there, and
+		 * use the algorithm for the rest.) */
+		target_free_working_area(target, crc_algorithm);
+		return ERROR_FAIL;
 	}
-	LOG_DEBUG("[%s] debug_reason=%d", target_name(target), target->debug_reason);
-	return ERROR_OK;
+
+	retval = crc_algorithm_run(target, crc_algorithm, address, count, checksum);
+
+	target_free_working_area(target, crc_algorithm);
+
+	LOG_DEBUG("checksum=0x%x, result=%d", *checksum, retval);
+
+	return retval;
 }
 
-int sample_memory(struct target *target)
+/**
+ * Compute the CRC of every chunk_size bytes of [address, address + count),
+ * the last chunk possibly being shorter, into crcs. The algorithm is only
+ * downloaded once, so this is much cheaper than calling
+ * riscv_checksum_memory() for every chunk.
+ */
+static int riscv_checksum_blocks(struct target *target,
+		target_addr_t address, uint32_t count, uint32_t chunk_size,
+		uint32_t *crcs)
 {
-	RISCV_INFO(r);
-
-	if (!r->sample_buf.buf || !r->sample_config.enabled)
-		return ERROR_OK;
+	struct working_area *crc_algorithm;
 
-	LOG_DEBUG("buf used/size: %d/%d", r->sample_buf.used, r->sample_buf.size);
+	int retval = crc_algorithm_load(target, &crc_algorithm);
+	if (retval != ERROR_OK)
+		return retval;
 
-	uint64_t start = timeval_ms();
-	riscv_sample_buf_maybe_add_timestamp(target, true);
-	int result = ERROR_OK;
-	if (r->sample_memory) {
-		result = r->sample_memory(target, &r->sample_buf, &r->sample_config,
-									  start + TARGET_DEFAULT_POLLING_INTERVAL);
-		if (result != ERROR_NOT_IMPLEMENTED)
-			goto exit;
+	if (overlaps_working_area(crc_algorithm, address, count)) {
+		target_free_working_area(target, crc_algorithm);
+		return ERROR_FAIL;
 	}
 
-	/* Default slow path. */
-	while (timeval_ms() - start < TARGET_DEFAULT_POLLING_INTERVAL) {
-		for (unsigned i = 0; i < DIM(r->sample_config.bucket); i++) {
-			if (r->sample_config.bucket[i].enabled &&
-					r->sample_buf.used + 1 + r->sample_config.bucket[i].size_bytes < r->sample_buf.size) {
-				assert(i < RISCV_SAMPLE_BUF_TIMESTAMP_BEFORE);
-				r->sample_buf.buf[r->sample_buf.used] = i;
-				result = riscv_read_phys_memory(
-					target, r->sample_config.bucket[i].address,
-					r->sample_config.bucket[i].size_bytes, 1,
-					r->sample_buf.buf + r->sample_buf.used + 1);
-				if (result == ERROR_OK)
-					r->sample_buf.used += 1 + r->sample_config.bucket[i].size_bytes;
-				else
-					goto exit;
-			}
-		}
+	for (uint32_t offset = 0; offset < count; offset += chunk_size) {
+		retval = crc_algorithm_run(target, crc_algorithm, address + offset,
+				MIN(chunk_size, count - offset), &crcs[offset / chunk_size]);
+		if (retval != ERROR_OK)
+			break;
 	}
 
-exit:
-	riscv_sample_buf_maybe_add_timestamp(target, false);
-	if (result != ERROR_OK) {
-		LOG_INFO("Turning off memory sampling because it failed.");
-		r->sample_config.enabled = false;
-	}
-	return result;
+	target_free_working_area(target, crc_algorithm);
+	return retval;
 }
 
-/*** OpenOCD Interface ***/
-int riscv_openocd_poll(struct target *target)
+/** Checks an array of memory regions whether they are erased. */
+static int riscv_blank_check_memory(struct target *target,
+		struct target_memory_check_block *blocks, int num_blocks,
+		uint8_t erased_value)
 {
-	LOG_DEBUG("polling all harts");
-	int halted_hart = -1;
+	struct working_area *erase_check_algorithm;
+	struct working_area *erase_check_params;
+	struct reg_param reg_params[2];
+	int xlen = riscv_xlen(target);
+	/* { address, size in words / result }, each xlen wide */
+	unsigned int block_bytes = 2 * xlen / 8;
+
+	static const uint8_t riscv32_erase_check_code[] = {
+#include "../../contrib/loaders/erase_check/riscv32_erase_check.inc"
+	};
+	static const uint8_t riscv64_erase_check_code[] = {
+#include "../../contrib/loaders/erase_check/riscv64_erase_check.inc"
+	};
+	const uint8_t *erase_check_code = riscv32_erase_check_code;
+	size_t code_size = sizeof(riscv32_erase_check_code);
+	if (xlen == 64) {
+		erase_check_code = riscv64_erase_check_code;
+		code_size = sizeof(riscv64_erase_check_code);
+	}
+
+	int blocks_to_check = 0;
+	uint32_t total_size = 0;
+	while (blocks_to_check < num_blocks) {
+		struct target_memory_check_block *block = &blocks[blocks_to_check];
+		/* a zero size would end the list early */
+		if (block->address % 4 || block->size % 4 || block->size == 0)
+			break;
+		blocks_to_check++;
+		total_size += block->size;
+	}
+	if (blocks_to_check == 0)
+		return ERROR_FAIL;
+
+	bool fresh;
+	if (target_alloc_pinned_working_area(target,
+				xlen == 64 ? "riscv64 erase check" : "riscv32 erase check",
+				code_size, &erase_check_algorithm, &fresh) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	int retval = ERROR_OK;
+	if (fresh) {
+		retval = target_write_buffer(target, erase_check_algorithm->address,
+				code_size, erase_check_code);
+		if (retval != ERROR_OK) {
+			target_unpin_working_area(erase_check_algorithm);
+			goto cleanup1;
+		}
+	}
+
+	uint32_t avail = target_get_working_area_avail(target);
+	if (avail / block_bytes < 2) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto cleanup1;
+	}
+	if ((uint32_t)blocks_to_check > avail / block_bytes - 1)
+		blocks_to_check = avail / block_bytes - 1;
+
+	uint32_t param_size = (blocks_to_check + 1) * block_bytes;
+	uint8_t *params = calloc(1, param_size);
+	if (!params) {
+		retval = ERROR_FAIL;
+		goto cleanup1;
+	}
+	for (int i = 0; i < blocks_to_check; i++) {
+		uint8_t *param = params + i * block_bytes;
+		buf_set_u64(param, 0, xlen, blocks[i].address);
+		buf_set_u64(param + block_bytes / 2, 0, xlen, blocks[i].size / 4);
+	}
+
+	if (target_alloc_working_area(target, param_size,
+				&erase_check_params) != ERROR_OK) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto cleanup2;
+	}
+
+	retval = target_write_buffer(target, erase_check_params->address,
+			param_size, params);
+	if (retval != ERROR_OK)
+		goto cleanup3;
+
+	/* lw sign extends on RV64, so the word to compare against must be too. */
+	int32_t erased_word = erased_value | (erased_value << 8) |
+		(erased_value << 16) | ((uint32_t)erased_value << 24);
+
+	init_reg_param(&reg_params[0], "a0", xlen, PARAM_OUT);
+	buf_set_u64(reg_params[0].value, 0, xlen, erase_check_params->address);
+	init_reg_param(&reg_params[1], "a1", xlen, PARAM_OUT);
+	buf_set_u64(reg_params[1].value, 0, xlen, (int64_t)erased_word);
+
+	LOG_DEBUG("Starting erase check of %d blocks, parameters@" TARGET_ADDR_FMT,
+			blocks_to_check, erase_check_params->address);
+
+	/* assume CPU clk at least 1 MHz */
+	int timeout = 2000 + total_size * 3 / 1000;
+
+	retval = target_run_algorithm(target, 0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			erase_check_algorithm->address, 0, timeout, NULL);
+	destroy_reg_param(&reg_params[0]);
+	destroy_reg_param(&reg_params[1]);
+	if (retval != ERROR_OK && retval != ERROR_TARGET_TIMEOUT) {
+		LOG_ERROR("error executing RISC-V erase check algorithm");
+		goto cleanup3;
+	}
+
+	/* after a timeout, use what was checked before it */
+	int algo_retval = retval;
+	retval = target_read_buffer(target, erase_check_params->address,
+			param_size, params);
+	if (retval != ERROR_OK)
+		goto cleanup3;
+
+	int i;
+	for (i = 0; i < blocks_to_check; i++) {
+		uint64_t result = buf_get_u64(params + i * block_bytes + block_bytes / 2,
+				0, xlen);
+		/* unchecked blocks still hold their size, ambiguous for one word */
+		if (result > 1 || (result == 1 && blocks[i].size == 4 && algo_retval != ERROR_OK))
+			break;
+		blocks[i].result = result;
+	}
+	if (i && algo_retval != ERROR_OK)
+		LOG_INFO("Slow CPU clock: %d blocks checked, %d remain. Continuing...",
+				i, num_blocks - i);
+	retval = i ? i : algo_retval;	/* number of blocks really checked */
+
+cleanup3:
+	target_free_working_area(target, erase_check_params);
+cleanup2:
+	free(params);
+cleanup1:
+	target_free_working_area(target, erase_check_algorithm);
+
+	return retval;
+}
+
+/** Finds the first occurrence of a byte pattern in target memory. */
+static int riscv_search_memory(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *pattern, uint32_t pattern_size,
+		target_addr_t *found_address, bool *found)
+{
+	struct working_area *search_algorithm;
+	struct reg_param reg_params[4];
+	int xlen = riscv_xlen(target);
+
+	static const uint8_t search_code[] = {
+#include "../../contrib/loaders/search/riscv_search.inc"
+	};
+
+	/* the pattern goes right after the code */
+	if (target_alloc_working_area(target, sizeof(search_code) + pattern_size,
+				&search_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	uint8_t *buffer = malloc(sizeof(search_code) + pattern_size);
+	if (!buffer) {
+		target_free_working_area(target, search_algorithm);
+		return ERROR_FAIL;
+	}
+	memcpy(buffer, search_code, sizeof(search_code));
+	memcpy(buffer + sizeof(search_code), pattern, pattern_size);
+
+	int retval = target_write_buffer(target, search_algorithm->address,
+			sizeof(search_code) + pattern_size, buffer);
+	free(buffer);
+	if (retval != ERROR_OK)
+		goto cleanup;
+
+	init_reg_param(&reg_params[0], "a0", xlen, PARAM_IN_OUT);
+	init_reg_param(&reg_params[1], "a1", xlen, PARAM_IN_OUT);
+	init_reg_param(&reg_params[2], "a2", xlen, PARAM_OUT);
+	init_reg_param(&reg_params[3], "a3", xlen, PARAM_OUT);
+	buf_set_u64(reg_params[0].value, 0, xlen, address);
+	buf_set_u64(reg_params[1].value, 0, xlen, size);
+	buf_set_u64(reg_params[2].value, 0, xlen,
+			search_algorithm->address + sizeof(search_code));
+	buf_set_u64(reg_params[3].value, 0, xlen, pattern_size);
+
+	/* 20 second timeout/megabyte */
+	int timeout = 20000 * (1 + (size / (1024 * 1024)));
+
+	retval = target_run_algorithm(target, 0, NULL, ARRAY_SIZE(reg_params),
+			reg_params, search_algorithm->address, 0, timeout, NULL);
+
+	if (retval == ERROR_OK) {
+		*found = buf_get_u64(reg_params[1].value, 0, xlen) != 0;
+		*found_address = buf_get_u64(reg_params[0].value, 0, xlen);
+	} else {
+		LOG_ERROR("error executing RISC-V search algorithm");
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+cleanup:
+	target_free_working_area(target, search_algorithm);
+
+	return retval;
+}
+
+/** Expands an LZ4 block already in target memory. */
+static int riscv_decompress_memory(struct target *target, target_addr_t src,
+		uint32_t src_size, target_addr_t dst, uint32_t dst_size)
+{
+	struct working_area *lz4_algorithm;
+	struct reg_param reg_params[3];
+	int xlen = riscv_xlen(target);
+
+	static const uint8_t lz4_code[] = {
+#include "../../contrib/loaders/lz4/riscv_lz4.inc"
+	};
+
+	if (target_alloc_working_area(target, sizeof(lz4_code),
+				&lz4_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	int retval = target_write_buffer(target, lz4_algorithm->address,
+			sizeof(lz4_code), lz4_code);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, lz4_algorithm);
+		return retval;
+	}
+
+	init_reg_param(&reg_params[0], "a0", xlen, PARAM_IN_OUT);
+	buf_set_u64(reg_params[0].value, 0, xlen, src);
+	init_reg_param(&reg_params[1], "a1", xlen, PARAM_OUT);
+	buf_set_u64(reg_params[1].value, 0, xlen, src + src_size);
+	init_reg_param(&reg_params[2], "a2", xlen, PARAM_OUT);
+	buf_set_u64(reg_params[2].value, 0, xlen, dst);
+
+	/* assume CPU clk at least 1 MHz, and ~10 cycles per byte */
+	int timeout = 2000 + dst_size * 10 / 1000;
+
+	retval = target_run_algorithm(target, 0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			lz4_algorithm->address, 0, timeout, NULL);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("error executing RISC-V LZ4 decompression algorithm");
+	} else {
+		target_addr_t end = buf_get_u64(reg_params[0].value, 0, xlen);
+		if (end != dst + dst_size) {
+			LOG_ERROR("LZ4 decompression ended at " TARGET_ADDR_FMT
+					" instead of " TARGET_ADDR_FMT, end, dst + dst_size);
+			retval = ERROR_FAIL;
+		}
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	target_free_working_area(target, lz4_algorithm);
+
+	return retval;
+}
+
+/*** OpenOCD Helper Functions ***/
+
+enum riscv_poll_hart {
+	RPH_NO_CHANGE,
+	RPH_DISCOVERED_HALTED,
+	RPH_DISCOVERED_RUNNING,
+	RPH_ERROR
+};
+static enum riscv_poll_hart riscv_poll_hart(struct target *target, int hartid)
+{
+	RISCV_INFO(r);
+	if (riscv_set_current_hartid(target, hartid) != ERROR_OK)
+		return RPH_ERROR;
+
+	LOG_DEBUG("polling hart %d, target->state=%d", hartid, target->state);
+
+	/* If OpenOCD thinks we're running but this hart is halted then it's time
+	 * to raise an event. */
+	bool halted = riscv_is_halted(target);
+	if (target->state != TARGET_HALTED && halted) {
+		LOG_DEBUG("  triggered a halt");
+		r->on_halt(target);
+		if (!riscv_snapshot_halts(target))
+			riscv_prefetch_registers(target);
+		return RPH_DISCOVERED_HALTED;
+	} else if (target->state != TARGET_RUNNING && !halted) {
+		LOG_DEBUG("  triggered running");
+		/* Something other than us let it run. */
+		riscv_invalidate_register_cache(target);
+		target->state = TARGET_RUNNING;
+		target->debug_reason = DBG_REASON_NOTHALTED;
+		return RPH_DISCOVERED_RUNNING;
+	}
+
+	return RPH_NO_CHANGE;
+}
+
+int set_debug_reason(struct target *target, enum riscv_halt_reason halt_reason)
+{
+	switch (halt_reason) {
+		case RISCV_HALT_BREAKPOINT:
+			target->debug_reason = DBG_REASON_BREAKPOINT;
+			break;
+		case RISCV_HALT_TRIGGER:
+			target->debug_reason = DBG_REASON_WATCHPOINT;
+			break;
+		case RISCV_HALT_INTERRUPT:
+		case RISCV_HALT_GROUP:
+			target->debug_reason = DBG_REASON_DBGRQ;
+			break;
+		case RISCV_HALT_SINGLESTEP:
+			target->debug_reason = DBG_REASON_SINGLESTEP;
+			break;
+		case RISCV_HALT_UNKNOWN:
+			target->debug_reason = DBG_REASON_UNDEFINED;
+			break;
+		case RISCV_HALT_ERROR:
+			return ERROR_FAIL;
+	}
+	LOG_DEBUG("[%s] debug_reason=%d", target_name(target), target->debug_reason);
+	return ERROR_OK;
+}
+
+/* Write out and empty the sample buffer, if it's being streamed to a file. */
+static void sample_buf_drain(struct target *target)
+{
+	RISCV_INFO(r);
+
+	if (!r->sample_stream || r->sample_buf.used == 0)
+		return;
+
+	if (fwrite(r->sample_buf.buf, 1, r->sample_buf.used, r->sample_stream) !=
+			r->sample_buf.used || fflush(r->sample_stream) != 0) {
+		LOG_ERROR("Failed to write memory samples; closing the sample stream.");
+		fclose(r->sample_stream);
+		r->sample_stream = NULL;
+		return;
+	}
+	r->sample_buf.used = 0;
+}
+
+static int sample_memory(struct target *target, int64_t until_ms)
+{
+	RISCV_INFO(r);
+
+	if (!r->sample_buf.buf || !r->sample_config.enabled)
+		return ERROR_OK;
+
+	LOG_DEBUG("buf used/size: %d/%d", r->sample_buf.used, r->sample_buf.size);
+
+	riscv_sample_buf_maybe_add_timestamp(target, true);
+	int result = ERROR_OK;
+	if (r->sample_memory) {
+		result = r->sample_memory(target, &r->sample_buf, &r->sample_config,
+									  until_ms);
+		if (result != ERROR_NOT_IMPLEMENTED)
+			goto exit;
+	}
+
+	/* Default slow path. */
+	while (timeval_ms() < until_ms) {
+		for (unsigned i = 0; i < DIM(r->sample_config.bucket); i++) {
+			if (r->sample_config.bucket[i].enabled &&
+					r->sample_buf.used + 1 + r->sample_config.bucket[i].size_bytes < r->sample_buf.size) {
+				assert(i < RISCV_SAMPLE_BUF_TIMESTAMP_BEFORE);
+				r->sample_buf.buf[r->sample_buf.used] = i;
+				result = riscv_read_phys_memory(
+					target, r->sample_config.bucket[i].address,
+					r->sample_config.bucket[i].size_bytes, 1,
+					r->sample_buf.buf + r->sample_buf.used + 1);
+				if (result == ERROR_OK)
+					r->sample_buf.used += 1 + r->sample_config.bucket[i].size_bytes;
+				else
+					goto exit;
+			}
+		}
+	}
+
+exit:
+	riscv_sample_buf_maybe_add_timestamp(target, false);
+	sample_buf_drain(target);
+	if (result != ERROR_OK) {
+		LOG_INFO("Turning off memory sampling because it failed.");
+		r->sample_config.enabled = false;
+	}
+	return result;
+}
+
+/* If the hart stopped on a once breakpoint of a breakpoint set, remove it
+ * and return true, so the caller resumes the hart. */
+static bool riscv_hit_once_breakpoint(struct target *target)
+{
+	riscv_reg_t pc;
+	if (riscv_get_register(target, &pc, GDB_REGNO_PC) != ERROR_OK)
+		return false;
+	return breakpoint_hit_once(target, pc);
+}
+
+/*** OpenOCD Interface ***/
+int riscv_openocd_poll(struct target *target)
+{
+	LOG_DEBUG("polling all harts");
+	int halted_hart = -1;
 
 	if (target->smp) {
 		unsigned halts_discovered = 0;
 		bool newly_halted[RISCV_MAX_HARTS] = {0};
+		/* semihosting handled, only used in non-stop mode */
+		bool hart_should_resume[RISCV_MAX_HARTS] = {0};
 		unsigned should_remain_halted = 0;
 		unsigned should_resume = 0;
+		/* Get the state of the whole group in one go, and only talk to the
+		 * harts whose state changed. */
+		bool group_halted[RISCV_MAX_HARTS];
+		bool use_group = riscv_group_halted(target, group_halted) == ERROR_OK;
 		unsigned i = 0;
 		for (struct target_list *list = target->head; list != NULL;
 				list = list->next, i++) {
 			struct target *t = list->target;
 			riscv_info_t *r = riscv_info(t);
 			assert(i < DIM(newly_halted));
-			enum riscv_poll_hart out = riscv_poll_hart(t, r->current_hartid);
+			enum riscv_poll_hart out;
+			if (use_group && ((group_halted[i] && t->state == TARGET_HALTED) ||
+						(!group_halted[i] && t->state == TARGET_RUNNING)))
+				out = RPH_NO_CHANGE;
+			else
+				out = riscv_poll_hart(t, r->current_hartid);
 			switch (out) {
 			case RPH_NO_CHANGE:
 				break;
@@ -2159,7 +3807,11 @@ int riscv_openocd_poll(struct target *target)
 				if (set_debug_reason(t, halt_reason) != ERROR_OK)
 					return ERROR_FAIL;
 
-				if (halt_reason == RISCV_HALT_BREAKPOINT) {
+				if (halt_reason == RISCV_HALT_BREAKPOINT &&
+						riscv_hit_once_breakpoint(t)) {
+					should_resume++;
+					hart_should_resume[i] = true;
+				} else if (halt_reason == RISCV_HALT_BREAKPOINT) {
 					int retval;
 					switch (riscv_semihosting(t, &retval)) {
 					case SEMI_NONE:
@@ -2171,6 +3823,7 @@ int riscv_openocd_poll(struct target *target)
 						/* This hart should be resumed, along with any other
 							 * harts that halted due to haltgroups. */
 						should_resume++;
+						hart_should_resume[i] = true;
 						break;
 					case SEMI_ERROR:
 						return retval;
@@ -2185,27 +3838,58 @@ int riscv_openocd_poll(struct target *target)
 			}
 		}
 
+		if (halts_discovered)
+			riscv_snapshot_group(target);
+
 		LOG_DEBUG("should_remain_halted=%d, should_resume=%d",
 				  should_remain_halted, should_resume);
-		if (should_remain_halted && should_resume) {
-			LOG_WARNING("%d harts should remain halted, and %d should resume.",
-						should_remain_halted, should_resume);
-		}
-		if (should_remain_halted) {
-			LOG_DEBUG("halt all");
-			riscv_halt(target);
-		} else if (should_resume) {
-			LOG_DEBUG("resume all");
-			riscv_resume(target, true, 0, 0, 0, false);
+		if (riscv_info(target)->non_stop) {
+			/* Every hart halted on its own and is dealt with on its own */
+			i = 0;
+			for (struct target_list *list = target->head; list != NULL;
+					list = list->next, i++) {
+				struct target *t = list->target;
+				if (!newly_halted[i])
+					continue;
+				if (hart_should_resume[i]) {
+					if (riscv_resume(t, true, 0, 0, 0, true) != ERROR_OK)
+						return ERROR_FAIL;
+				} else if (halt_finish(t) != ERROR_OK) {
+					return ERROR_FAIL;
+				}
+			}
+		} else {
+			if (should_remain_halted && should_resume) {
+				LOG_WARNING("%d harts should remain halted, and %d should resume.",
+							should_remain_halted, should_resume);
+			}
+			if (should_remain_halted) {
+				LOG_DEBUG("halt all");
+				riscv_halt(target);
+			} else if (should_resume) {
+				LOG_DEBUG("resume all");
+				riscv_resume(target, true, 0, 0, 0, false);
+			}
 		}
 
-		/* Sample memory if any target is running. */
+		/* Sample memory on every running hart that has sampling set up,
+		 * sharing one polling interval between them. */
+		unsigned sampling = 0;
 		for (struct target_list *list = target->head; list != NULL;
-				list = list->next, i++) {
+				list = list->next) {
 			struct target *t = list->target;
-			if (t->state == TARGET_RUNNING) {
-				sample_memory(target);
-				break;
+			riscv_info_t *r = riscv_info(t);
+			if (t->state == TARGET_RUNNING && r->sample_config.enabled)
+				sampling++;
+		}
+		int64_t until_ms = timeval_ms();
+		for (struct target_list *list = target->head; list != NULL &&
+				sampling > 0; list = list->next) {
+			struct target *t = list->target;
+			riscv_info_t *r = riscv_info(t);
+			if (t->state == TARGET_RUNNING && r->sample_config.enabled) {
+				until_ms += TARGET_DEFAULT_POLLING_INTERVAL / sampling;
+				sample_memory(t, until_ms);
 			}
 		}
 
@@ -2216,7 +3900,7 @@ int riscv_openocd_poll(struct target *target)
 				riscv_current_hartid(target));
 		if (out == RPH_NO_CHANGE || out == RPH_DISCOVERED_RUNNING) {
 			if (target->state == TARGET_RUNNING)
-				sample_memory(target);
+				sample_memory(target, timeval_ms() + TARGET_DEFAULT_POLLING_INTERVAL);
 			return ERROR_OK;
 		}
 		else if (out == RPH_ERROR)
@@ -2231,7 +3915,10 @@ int riscv_openocd_poll(struct target *target)
 		target->state = TARGET_HALTED;
 	}
 
-	if (target->debug_reason == DBG_REASON_BREAKPOINT) {
+	if (target->debug_reason == DBG_REASON_BREAKPOINT &&
+			riscv_hit_once_breakpoint(target)) {
+		return riscv_resume(target, true, 0, 0, 0, false);
+	} else if (target->debug_reason == DBG_REASON_BREAKPOINT) {
 		int retval;
 		switch (riscv_semihosting(target, &retval)) {
 			case SEMI_NONE:
@@ -2245,158 +3932,947 @@ int riscv_openocd_poll(struct target *target)
 			case SEMI_ERROR:
 				return retval;
 		}
-	} else {
-		target_call_event_callbacks(target, TARGET_EVENT_HALTED);
+	} else {
+		target_call_event_callbacks(target, TARGET_EVENT_HALTED);
+	}
+
+	return ERROR_OK;
+}
+
+int riscv_openocd_step(struct target *target, int current,
+		target_addr_t address, int handle_breakpoints)
+{
+	LOG_DEBUG("stepping rtos hart");
+
+	if (!current)
+		riscv_set_register(target, GDB_REGNO_PC, address);
+
+	riscv_reg_t trigger_state[RISCV_MAX_HWBPS] = {0};
+	if (disable_triggers(target, trigger_state) != ERROR_OK)
+		return ERROR_FAIL;
+
+	int out = riscv_step_rtos_hart(target);
+	if (out != ERROR_OK) {
+		LOG_ERROR("unable to step rtos hart");
+		return out;
+	}
+
+	if (enable_triggers(target, trigger_state) != ERROR_OK)
+		return ERROR_FAIL;
+
+	target->state = TARGET_RUNNING;
+	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
+	target->state = TARGET_HALTED;
+	target->debug_reason = DBG_REASON_SINGLESTEP;
+	target_call_event_callbacks(target, TARGET_EVENT_HALTED);
+	return out;
+}
+
+/* Command Handlers */
+COMMAND_HANDLER(riscv_set_command_timeout_sec)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+	int timeout = atoi(CMD_ARGV[0]);
+	if (timeout <= 0) {
+		LOG_ERROR("%s is not a valid integer argument for command.", CMD_ARGV[0]);
+		return ERROR_FAIL;
+	}
+
+	riscv_command_timeout_sec = timeout;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_reset_timeout_sec)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+	int timeout = atoi(CMD_ARGV[0]);
+	if (timeout <= 0) {
+		LOG_ERROR("%s is not a valid integer argument for command.", CMD_ARGV[0]);
+		return ERROR_FAIL;
+	}
+
+	riscv_reset_timeout_sec = timeout;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_capability_cache)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	free(riscv_capability_cache_file);
+	riscv_capability_cache_file = NULL;
+	if (strcmp(CMD_ARGV[0], "off")) {
+		riscv_capability_cache_file = strdup(CMD_ARGV[0]);
+		if (!riscv_capability_cache_file) {
+			LOG_ERROR("strdup failed");
+			return ERROR_FAIL;
+		}
+	}
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_busy_delay_decay)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], riscv_busy_delay_decay);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_batch_flush_scans)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], riscv_batch_flush_scans);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_poll_interval)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+
+	if (CMD_ARGC == 0) {
+		command_print(CMD, "%u %u", r->poll_min_ms, r->poll_max_ms);
+		return ERROR_OK;
+	}
+	if (CMD_ARGC != 2) {
+		LOG_ERROR("Command takes 0 or 2 parameters");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	unsigned min_ms, max_ms;
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], min_ms);
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], max_ms);
+	if (min_ms > max_ms) {
+		LOG_ERROR("The minimum interval can't be larger than the maximum.");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	r->poll_min_ms = min_ms;
+	r->poll_max_ms = max_ms;
+	r->poll_interval_ms = MIN(MAX(r->poll_interval_ms, min_ms), max_ms);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_pc_sample_address)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	if (!strcmp(CMD_ARGV[0], "none")) {
+		r->pc_sample_address_set = false;
+		return ERROR_OK;
+	}
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], r->pc_sample_address);
+	r->pc_sample_address_set = true;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_prefer_sba)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	bool prefer_sba;
+	LOG_WARNING("`riscv set_prefer_sba` is deprecated. Please use `riscv set_mem_access` instead.");
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], prefer_sba);
+	if (prefer_sba) {
+		/* Use system bus with highest priority */
+		r->mem_access_methods[0] = RISCV_MEM_ACCESS_SYSBUS;
+		r->mem_access_methods[1] = RISCV_MEM_ACCESS_PROGBUF;
+		r->mem_access_methods[2] = RISCV_MEM_ACCESS_ABSTRACT;
+	} else {
+		/* Use progbuf with highest priority */
+		r->mem_access_methods[0] = RISCV_MEM_ACCESS_PROGBUF;
+		r->mem_access_methods[1] = RISCV_MEM_ACCESS_SYSBUS;
+		r->mem_access_methods[2] = RISCV_MEM_ACCESS_ABSTRACT;
+	}
+
+	/* Reset warning flags */
+	r->poll_min_ms = 1;
+	r->poll_max_ms = TARGET_DEFAULT_POLLING_INTERVAL;
+	r->poll_interval_ms = r->poll_min_ms;
+
+	r->mem_access_progbuf_warn = true;
+	r->mem_access_sysbus_warn = true;
+	r->mem_access_abstract_warn = true;
+
+	return ERROR_OK;
+}
+
+static riscv_mem_access_stat_t *mem_access_stat_find(struct target *target,
+		target_addr_t address, uint32_t size, uint32_t count, bool write,
+		bool create)
+{
+	RISCV_INFO(r);
+	target_addr_t region = address >> RISCV_MEM_ACCESS_REGION_SHIFT;
+	bool bulk = size * count > RISCV_MEM_ACCESS_SMALL_BYTES;
+
+	for (unsigned i = 0; i < RISCV_MEM_ACCESS_STATS; i++) {
+		riscv_mem_access_stat_t *stat = &r->mem_access_stats[i];
+		if (stat->valid && stat->region == region && stat->size == size &&
+				stat->write == write && stat->bulk == bulk)
+			return stat;
+	}
+
+	if (!create)
+		return NULL;
+
+	riscv_mem_access_stat_t *stat = &r->mem_access_stats[r->mem_access_stats_next];
+	r->mem_access_stats_next = (r->mem_access_stats_next + 1) % RISCV_MEM_ACCESS_STATS;
+	memset(stat, 0, sizeof(*stat));
+	stat->valid = true;
+	stat->region = region;
+	stat->size = size;
+	stat->write = write;
+	stat->bulk = bulk;
+	return stat;
+}
+
+/* Bytes per second, or -1 if the method hasn't been tried often enough. */
+static double mem_access_throughput(const riscv_mem_access_stat_t *stat, int method)
+{
+	unsigned i = method - RISCV_MEM_ACCESS_PROGBUF;
+	if (stat->method[i].failures >= RISCV_MEM_ACCESS_MIN_SAMPLES)
+		return 0;
+	if (stat->method[i].samples < RISCV_MEM_ACCESS_MIN_SAMPLES)
+		return -1;
+	return stat->method[i].bytes / MAX(stat->method[i].seconds, 1e-6);
+}
+
+/**
+ * Fill in methods with the order in which memory access methods should be
+ * tried for the given access. Normally that's just mem_access_methods. In auto
+ * mode, methods that haven't been measured enough for this kind of access go
+ * first (so they get measured), followed by the others, fastest first.
+ */
+void riscv_mem_access_order(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, bool write, int *methods)
+{
+	RISCV_INFO(r);
+	memcpy(methods, r->mem_access_methods, sizeof(r->mem_access_methods));
+
+	/* The system bus leaves a running hart alone, so it goes first no
+	 * matter how fast the others were while halted. */
+	if (target->state != TARGET_HALTED) {
+		for (unsigned i = 1; i < RISCV_NUM_MEM_ACCESS_METHODS; i++) {
+			if (methods[i] != RISCV_MEM_ACCESS_SYSBUS)
+				continue;
+			memmove(methods + 1, methods, i * sizeof(*methods));
+			methods[0] = RISCV_MEM_ACCESS_SYSBUS;
+			break;
+		}
+		return;
+	}
+
+	if (!r->mem_access_auto)
+		return;
+
+	riscv_mem_access_stat_t *stat = mem_access_stat_find(target, address, size,
+			count, write, false);
+	if (!stat)
+		return;
+
+	/* Stable insertion sort, so unmeasured methods keep their priority. */
+	for (unsigned i = 1; i < RISCV_NUM_MEM_ACCESS_METHODS; i++) {
+		int method = methods[i];
+		if (method == RISCV_MEM_ACCESS_UNSPECIFIED)
+			break;
+		double speed = mem_access_throughput(stat, method);
+		unsigned j = i;
+		while (j > 0) {
+			double other = mem_access_throughput(stat, methods[j - 1]);
+			bool before = speed < 0 ? other >= 0 : (other >= 0 && speed > other);
+			if (!before)
+				break;
+			methods[j] = methods[j - 1];
+			j--;
+		}
+		methods[j] = method;
+	}
+}
+
+void riscv_mem_access_record(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, bool write, int method, bool success,
+		float seconds)
+{
+	RISCV_INFO(r);
+	if (!r->mem_access_auto || method == RISCV_MEM_ACCESS_UNSPECIFIED)
+		return;
+
+	riscv_mem_access_stat_t *stat = mem_access_stat_find(target, address, size,
+			count, write, true);
+	unsigned i = method - RISCV_MEM_ACCESS_PROGBUF;
+	if (success) {
+		stat->method[i].samples++;
+		stat->method[i].bytes += size * count;
+		stat->method[i].seconds += seconds;
+	} else {
+		stat->method[i].failures++;
+	}
+}
+
+static const char *mem_access_method_name(int method)
+{
+	switch (method) {
+		case RISCV_MEM_ACCESS_PROGBUF:
+			return "progbuf";
+		case RISCV_MEM_ACCESS_SYSBUS:
+			return "sysbus";
+		case RISCV_MEM_ACCESS_ABSTRACT:
+			return "abstract";
+	}
+	return "unspecified";
+}
+
+COMMAND_HANDLER(riscv_dmi_stats)
+{
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "clear")) {
+		riscv_dmi_stats_clear();
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	riscv_dmi_stats_show(CMD);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_dmi_trace)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 0) {
+		command_print(CMD, "%u", riscv_dmi_trace_size());
+		return ERROR_OK;
+	}
+
+	unsigned entries;
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], entries);
+	return riscv_dmi_trace_resize(entries);
+}
+
+COMMAND_HANDLER(riscv_dmi_trace_dump_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (riscv_dmi_trace_size() == 0) {
+		command_print(CMD, "No DMI trace buffer. Use 'riscv dmi_trace' to "
+				"allocate one.");
+		return ERROR_FAIL;
+	}
+	return riscv_dmi_trace_dump(CMD_ARGV[0]);
+}
+
+COMMAND_HANDLER(riscv_mem_access_stats)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "clear")) {
+		memset(r->mem_access_stats, 0, sizeof(r->mem_access_stats));
+		r->mem_access_stats_next = 0;
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!r->mem_access_auto)
+		command_print(CMD, "Memory access method selection is not automatic.");
+
+	for (unsigned i = 0; i < RISCV_MEM_ACCESS_STATS; i++) {
+		const riscv_mem_access_stat_t *stat = &r->mem_access_stats[i];
+		if (!stat->valid)
+			continue;
+		target_addr_t base = stat->region << RISCV_MEM_ACCESS_REGION_SHIFT;
+		command_print(CMD, "0x%" TARGET_PRIxADDR "-0x%" TARGET_PRIxADDR
+				" %s size %d %s:", base,
+				base + ((target_addr_t)1 << RISCV_MEM_ACCESS_REGION_SHIFT) - 1,
+				stat->write ? "write" : "read", stat->size,
+				stat->bulk ? "bulk" : "small");
+		for (int method = RISCV_MEM_ACCESS_PROGBUF;
+				method <= RISCV_MEM_ACCESS_ABSTRACT; method++) {
+			unsigned m = method - RISCV_MEM_ACCESS_PROGBUF;
+			if (stat->method[m].samples == 0 && stat->method[m].failures == 0)
+				continue;
+			double seconds = stat->method[m].seconds;
+			command_print(CMD, "  %-8s %u ok, %u failed, %.1f KiB/s",
+					mem_access_method_name(method),
+					stat->method[m].samples, stat->method[m].failures,
+					seconds > 0 ? stat->method[m].bytes / seconds / 1024 : 0);
+		}
+	}
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_mem_access)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	int progbuf_cnt = 0;
+	int sysbus_cnt = 0;
+	int abstract_cnt = 0;
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "auto")) {
+		r->mem_access_methods[0] = RISCV_MEM_ACCESS_PROGBUF;
+		r->mem_access_methods[1] = RISCV_MEM_ACCESS_SYSBUS;
+		r->mem_access_methods[2] = RISCV_MEM_ACCESS_ABSTRACT;
+		r->mem_access_auto = true;
+		memset(r->mem_access_stats, 0, sizeof(r->mem_access_stats));
+		r->mem_access_stats_next = 0;
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC < 1 || CMD_ARGC > RISCV_NUM_MEM_ACCESS_METHODS) {
+		LOG_ERROR("Command takes 1 to %d parameters", RISCV_NUM_MEM_ACCESS_METHODS);
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	/* Check argument validity */
+	for (unsigned i = 0; i < CMD_ARGC; i++) {
+		if (strcmp("progbuf", CMD_ARGV[i]) == 0)
+			progbuf_cnt++;
+		else if (strcmp("sysbus", CMD_ARGV[i]) == 0)
+			sysbus_cnt++;
+		else if (strcmp("abstract", CMD_ARGV[i]) == 0)
+			abstract_cnt++;
+		else {
+			LOG_ERROR("Unknown argument '%s'. "
+				"Must be one of: 'progbuf', 'sysbus' or 'abstract'.", CMD_ARGV[i]);
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		}
+	}
+	if (progbuf_cnt > 1 || sysbus_cnt > 1 || abstract_cnt > 1) {
+		LOG_ERROR("Syntax error - duplicate arguments to `riscv set_mem_access`.");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	/* Args are valid, store them */
+	r->mem_access_auto = false;
+	for (unsigned i = 0; i < RISCV_NUM_MEM_ACCESS_METHODS; i++)
+		r->mem_access_methods[i] = RISCV_MEM_ACCESS_UNSPECIFIED;
+	for (unsigned i = 0; i < CMD_ARGC; i++) {
+		if (strcmp("progbuf", CMD_ARGV[i]) == 0)
+			r->mem_access_methods[i] = RISCV_MEM_ACCESS_PROGBUF;
+		else if (strcmp("sysbus", CMD_ARGV[i]) == 0)
+			r->mem_access_methods[i] = RISCV_MEM_ACCESS_SYSBUS;
+		else if (strcmp("abstract", CMD_ARGV[i]) == 0)
+			r->mem_access_methods[i] = RISCV_MEM_ACCESS_ABSTRACT;
+	}
+
+	/* Reset warning flags */
+	r->mem_access_progbuf_warn = true;
+	r->mem_access_sysbus_warn = true;
+	r->mem_access_abstract_warn = true;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_set_memory_cache)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	riscv_mem_cache_t *cache = &r->mem_cache;
+
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	unsigned line_size;
+	if (!strcmp(CMD_ARGV[0], "off"))
+		line_size = 0;
+	else
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], line_size);
+	if (line_size != 0 && (line_size < 4 || line_size > 4096 ||
+				(line_size & (line_size - 1)))) {
+		LOG_ERROR("Line size must be a power of 2 from 4 to 4096.");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	riscv_invalidate_memory_cache(target);
+	free(cache->data);
+	cache->data = NULL;
+	cache->line_size = 0;
+	if (line_size == 0)
+		return ERROR_OK;
+
+	cache->data = malloc(RISCV_MEM_CACHE_LINES * line_size);
+	if (!cache->data) {
+		LOG_ERROR("Failed to allocate memory cache.");
+		return ERROR_FAIL;
+	}
+	cache->line_size = line_size;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(riscv_memory_cache_region)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	riscv_mem_cache_t *cache = &r->mem_cache;
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "clear")) {
+		for (unsigned i = 0; i < ARRAY_SIZE(cache->region); i++)
+			cache->region[i].enabled = false;
+		riscv_invalidate_memory_cache(target);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 2) {
+		LOG_ERROR("Command takes either 'clear' or an address and a size.");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	target_addr_t address;
+	target_addr_t size;
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[1], size);
+
+	for (unsigned i = 0; i < ARRAY_SIZE(cache->region); i++) {
+		if (cache->region[i].enabled)
+			continue;
+		cache->region[i].enabled = true;
+		cache->region[i].address = address;
+		cache->region[i].size = size;
+		/* Lines already cached may be outside the new regions. */
+		riscv_invalidate_memory_cache(target);
+		return ERROR_OK;
+	}
+
+	LOG_ERROR("Only %d memory cache regions are supported.",
+			(int)ARRAY_SIZE(cache->region));
+	return ERROR_FAIL;
+}
+
+/* Write the chunks of buffer that differ from what is at address already. */
+static int load_section_incremental(struct target *target, target_addr_t address, const uint8_t *buffer,
+		uint32_t size, uint32_t chunk_size, uint32_t *written)
+{
+	uint32_t num_chunks = DIV_ROUND_UP(size, chunk_size);
+	uint32_t *crcs = malloc(num_chunks * sizeof(*crcs));
+	if (!crcs) {
+		LOG_ERROR("Out of memory.");
+		return ERROR_FAIL;
+	}
+
+	bool compare = riscv_checksum_blocks(target, address, size, chunk_size,
+			crcs) == ERROR_OK;
+	if (!compare)
+		LOG_WARNING("Couldn't checksum target memory at 0x%" TARGET_PRIxADDR
+				"; writing the whole section.", address);
+
+	int retval = ERROR_OK;
+	for (uint32_t i = 0; i < num_chunks; i++) {
+		uint32_t offset = i * chunk_size;
+		uint32_t length = MIN(chunk_size, size - offset);
+		if (compare) {
+			uint32_t crc;
+			retval = image_calculate_checksum(buffer + offset, length, &crc);
+			if (retval != ERROR_OK)
+				break;
+			if (crc == crcs[i])
+				continue;
+		}
+		retval = target_write_buffer(target, address + offset, length,
+				buffer + offset);
+		if (retval != ERROR_OK)
+			break;
+		*written += length;
+	}
+
+	free(crcs);
+	return retval;
+}
+
+COMMAND_HANDLER(riscv_load_image_incremental)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct image image;
+	uint32_t chunk_size = 4096;
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 4)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	image.base_address_set = false;
+	image.start_address_set = false;
+	if (CMD_ARGC >= 2) {
+		target_addr_t addr;
+		COMMAND_PARSE_ADDRESS(CMD_ARGV[1], addr);
+		image.base_address = addr;
+		image.base_address_set = true;
+	}
+	if (CMD_ARGC == 4)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], chunk_size);
+	if (chunk_size == 0) {
+		LOG_ERROR("Chunk size must be nonzero.");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	if (target->state != TARGET_HALTED) {
+		LOG_ERROR("Target not halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	struct duration bench;
+	duration_start(&bench);
+
+	if (image_open(&image, CMD_ARGV[0], (CMD_ARGC >= 3) ? CMD_ARGV[2] : NULL) != ERROR_OK)
+		return ERROR_FAIL;
+
+	int retval = ERROR_OK;
+	uint32_t image_size = 0;
+	uint32_t written = 0;
+	for (unsigned int i = 0; i < image.num_sections; i++) {
+		uint8_t *buffer = malloc(image.sections[i].size);
+		if (!buffer) {
+			LOG_ERROR("Out of memory.");
+			retval = ERROR_FAIL;
+			break;
+		}
+
+		size_t buf_cnt;
+		retval = image_read_section(&image, i, 0, image.sections[i].size,
+				buffer, &buf_cnt);
+		if (retval == ERROR_OK)
+			retval = load_section_incremental(target,
+					image.sections[i].base_address, buffer, buf_cnt,
+					chunk_size, &written);
+		free(buffer);
+		if (retval != ERROR_OK)
+			break;
+		image_size += buf_cnt;
 	}
 
-	return ERROR_OK;
+	if (retval == ERROR_OK && duration_measure(&bench) == ERROR_OK)
+		command_print(CMD, "wrote %" PRIu32 " of %" PRIu32 " bytes in %fs",
+				written, image_size, duration_elapsed(&bench));
+
+	image_close(&image);
+
+	return retval;
 }
 
-int riscv_openocd_step(struct target *target, int current,
-		target_addr_t address, int handle_breakpoints)
+/* Write size bytes to address, splitting the aligned middle of the range
+ * between the harts of target's SMP group so their DMs can all be busy at
+ * once. Falls back to target_write_buffer() through target for anything the
+ * parallel path can't handle. */
+static int write_buffer_parallel(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *buffer)
 {
-	LOG_DEBUG("stepping rtos hart");
+	RISCV_INFO(r);
+	struct target *targets[RISCV_MAX_HARTS];
+	unsigned count = 0;
 
-	if (!current)
-		riscv_set_register(target, GDB_REGNO_PC, address);
+	if (target->smp && r->write_memory_parallel) {
+		for (struct target_list *list = target->head; list &&
+				count < ARRAY_SIZE(targets); list = list->next) {
+			struct target *t = list->target;
+			int mmu_enabled;
+			if (!target_was_examined(t) ||
+					riscv_info(t)->write_memory_parallel != r->write_memory_parallel ||
+					riscv_mmu(t, &mmu_enabled) != ERROR_OK || mmu_enabled)
+				continue;
+			targets[count++] = t;
+		}
+	}
 
-	riscv_reg_t trigger_state[RISCV_MAX_HWBPS] = {0};
-	if (disable_triggers(target, trigger_state) != ERROR_OK)
+	uint32_t head = MIN(size, (4 - address % 4) % 4);
+	uint32_t words = (size - head) / 4;
+	if (count < 2 || words < count)
+		return target_write_buffer(target, address, size, buffer);
+
+	if (head && target_write_buffer(target, address, head, buffer) != ERROR_OK)
 		return ERROR_FAIL;
 
-	int out = riscv_step_rtos_hart(target);
-	if (out != ERROR_OK) {
-		LOG_ERROR("unable to step rtos hart");
-		return out;
+	target_addr_t middle = address + head;
+	target_addr_t addresses[RISCV_MAX_HARTS];
+	const uint8_t *buffers[RISCV_MAX_HARTS];
+	uint32_t counts[RISCV_MAX_HARTS];
+	uint32_t per_target = DIV_ROUND_UP(words, count);
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t first = MIN(words, i * per_target);
+		addresses[i] = middle + 4 * first;
+		buffers[i] = buffer + head + 4 * first;
+		counts[i] = MIN(words - first, per_target);
 	}
 
-	register_cache_invalidate(target->reg_cache);
-
-	if (enable_triggers(target, trigger_state) != ERROR_OK)
+	if (restore_removed_sw_breakpoints(target, middle, 4 * words) != ERROR_OK)
 		return ERROR_FAIL;
+	for (unsigned i = 0; i < count; i++) {
+		riscv_invalidate_memory_cache(targets[i]);
+		invalidate_watchpoint_insn_cache(targets[i]);
+	}
 
-	target->state = TARGET_RUNNING;
-	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
-	target->state = TARGET_HALTED;
-	target->debug_reason = DBG_REASON_SINGLESTEP;
-	target_call_event_callbacks(target, TARGET_EVENT_HALTED);
-	return out;
+	int retval = r->write_memory_parallel(count, targets, addresses, buffers,
+			counts);
+	if (retval == ERROR_NOT_IMPLEMENTED) {
+		LOG_DEBUG("Can't write to these harts in parallel.");
+		retval = target_write_buffer(target, middle, 4 * words, buffer + head);
+	}
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint32_t tail = size - head - 4 * words;
+	if (tail)
+		return target_write_buffer(target, middle + 4 * words, tail,
+				buffer + head + 4 * words);
+	return ERROR_OK;
 }
 
-/* Command Handlers */
-COMMAND_HANDLER(riscv_set_command_timeout_sec)
+COMMAND_HANDLER(riscv_load_image_parallel)
 {
-	if (CMD_ARGC != 1) {
-		LOG_ERROR("Command takes exactly 1 parameter");
+	struct target *target = get_current_target(CMD_CTX);
+	struct image image;
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 3)
 		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	image.base_address_set = false;
+	image.start_address_set = false;
+	if (CMD_ARGC >= 2) {
+		target_addr_t addr;
+		COMMAND_PARSE_ADDRESS(CMD_ARGV[1], addr);
+		image.base_address = addr;
+		image.base_address_set = true;
 	}
-	int timeout = atoi(CMD_ARGV[0]);
-	if (timeout <= 0) {
-		LOG_ERROR("%s is not a valid integer argument for command.", CMD_ARGV[0]);
+
+	struct duration bench;
+	duration_start(&bench);
+
+	if (image_open(&image, CMD_ARGV[0], (CMD_ARGC >= 3) ? CMD_ARGV[2] : NULL) != ERROR_OK)
 		return ERROR_FAIL;
+
+	int retval = ERROR_OK;
+	uint32_t image_size = 0;
+	for (unsigned int i = 0; i < image.num_sections; i++) {
+		uint8_t *buffer = malloc(image.sections[i].size);
+		if (!buffer) {
+			LOG_ERROR("Out of memory.");
+			retval = ERROR_FAIL;
+			break;
+		}
+
+		size_t buf_cnt;
+		retval = image_read_section(&image, i, 0, image.sections[i].size,
+				buffer, &buf_cnt);
+		if (retval == ERROR_OK)
+			retval = write_buffer_parallel(target,
+					image.sections[i].base_address, buf_cnt, buffer);
+		free(buffer);
+		if (retval != ERROR_OK)
+			break;
+		image_size += buf_cnt;
 	}
 
-	riscv_command_timeout_sec = timeout;
+	if (retval == ERROR_OK && duration_measure(&bench) == ERROR_OK)
+		command_print(CMD, "downloaded %" PRIu32 " bytes in %fs (%0.3f KiB/s)",
+				image_size, duration_elapsed(&bench),
+				duration_kbps(&bench, image_size));
 
-	return ERROR_OK;
+	image_close(&image);
+
+	return retval;
 }
 
-COMMAND_HANDLER(riscv_set_reset_timeout_sec)
+struct riscv_async_dump {
+	FILE *file;
+	char *filename;
+	target_addr_t address;
+	target_addr_t end;
+	uint32_t chunk_size;
+	uint8_t *buffer;
+	int64_t start_ms;
+};
+
+static int async_dump_callback(void *priv);
+
+static void async_dump_stop(struct target *target)
 {
-	if (CMD_ARGC != 1) {
-		LOG_ERROR("Command takes exactly 1 parameter");
-		return ERROR_COMMAND_SYNTAX_ERROR;
+	RISCV_INFO(r);
+	struct riscv_async_dump *dump = r->async_dump;
+	if (!dump)
+		return;
+
+	target_unregister_timer_callback(async_dump_callback, target);
+	fclose(dump->file);
+	free(dump->filename);
+	free(dump->buffer);
+	free(dump);
+	r->async_dump = NULL;
+}
+
+/* Read one chunk per call, so the server loop gets to service gdb, telnet
+ * and polling between chunks. */
+static int async_dump_callback(void *priv)
+{
+	struct target *target = priv;
+	RISCV_INFO(r);
+	struct riscv_async_dump *dump = r->async_dump;
+	if (!dump)
+		return ERROR_OK;
+
+	/* Wait out resets and the like. */
+	if (target->state != TARGET_RUNNING && target->state != TARGET_HALTED)
+		return ERROR_OK;
+
+	uint32_t size = MIN(dump->chunk_size, dump->end - dump->address);
+	if (target_read_buffer(target, dump->address, size, dump->buffer) != ERROR_OK) {
+		LOG_ERROR("Background dump to %s stopped: failed to read 0x%" PRIx32
+				" bytes at 0x%" TARGET_PRIxADDR ".", dump->filename, size,
+				dump->address);
+		async_dump_stop(target);
+		return ERROR_OK;
 	}
-	int timeout = atoi(CMD_ARGV[0]);
-	if (timeout <= 0) {
-		LOG_ERROR("%s is not a valid integer argument for command.", CMD_ARGV[0]);
-		return ERROR_FAIL;
+
+	if (fwrite(dump->buffer, 1, size, dump->file) != size) {
+		LOG_ERROR("Background dump stopped: failed to write %s: %s",
+				dump->filename, strerror(errno));
+		async_dump_stop(target);
+		return ERROR_OK;
+	}
+
+	dump->address += size;
+	if (dump->address == dump->end) {
+		LOG_INFO("Background dump to %s finished in %" PRId64 " ms.",
+				dump->filename, timeval_ms() - dump->start_ms);
+		async_dump_stop(target);
 	}
 
-	riscv_reset_timeout_sec = timeout;
 	return ERROR_OK;
 }
 
-COMMAND_HANDLER(riscv_set_prefer_sba)
+COMMAND_HANDLER(riscv_async_dump_memory)
 {
 	struct target *target = get_current_target(CMD_CTX);
 	RISCV_INFO(r);
-	bool prefer_sba;
-	LOG_WARNING("`riscv set_prefer_sba` is deprecated. Please use `riscv set_mem_access` instead.");
-	if (CMD_ARGC != 1) {
-		LOG_ERROR("Command takes exactly 1 parameter");
+	struct riscv_async_dump *dump = r->async_dump;
+
+	if (CMD_ARGC == 0) {
+		if (!dump) {
+			command_print(CMD, "No background dump in progress.");
+			return ERROR_OK;
+		}
+		command_print(CMD, "Dumping to %s: 0x%" TARGET_PRIxADDR " bytes left, "
+				"next address 0x%" TARGET_PRIxADDR ".", dump->filename,
+				dump->end - dump->address, dump->address);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "cancel")) {
+		if (dump)
+			LOG_INFO("Background dump to %s cancelled.", dump->filename);
+		async_dump_stop(target);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 3 && CMD_ARGC != 4)
 		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (dump) {
+		LOG_ERROR("A background dump to %s is already in progress.",
+				dump->filename);
+		return ERROR_FAIL;
 	}
-	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], prefer_sba);
-	if (prefer_sba) {
-		/* Use system bus with highest priority */
-		r->mem_access_methods[0] = RISCV_MEM_ACCESS_SYSBUS;
-		r->mem_access_methods[1] = RISCV_MEM_ACCESS_PROGBUF;
-		r->mem_access_methods[2] = RISCV_MEM_ACCESS_ABSTRACT;
-	} else {
-		/* Use progbuf with highest priority */
-		r->mem_access_methods[0] = RISCV_MEM_ACCESS_PROGBUF;
-		r->mem_access_methods[1] = RISCV_MEM_ACCESS_SYSBUS;
-		r->mem_access_methods[2] = RISCV_MEM_ACCESS_ABSTRACT;
+
+	target_addr_t address;
+	uint32_t size;
+	uint32_t chunk_size = 1024;
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+	if (CMD_ARGC == 4)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], chunk_size);
+	if (size == 0 || chunk_size == 0) {
+		LOG_ERROR("Size and chunk size must be nonzero.");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
 	}
 
-	/* Reset warning flags */
-	r->mem_access_progbuf_warn = true;
-	r->mem_access_sysbus_warn = true;
-	r->mem_access_abstract_warn = true;
+	dump = calloc(1, sizeof(*dump));
+	if (!dump) {
+		LOG_ERROR("Out of memory.");
+		return ERROR_FAIL;
+	}
+	dump->buffer = malloc(chunk_size);
+	dump->filename = strdup(CMD_ARGV[2]);
+	if (!dump->buffer || !dump->filename) {
+		LOG_ERROR("Out of memory.");
+		goto fail;
+	}
+	dump->file = fopen(CMD_ARGV[2], "wb");
+	if (!dump->file) {
+		LOG_ERROR("Couldn't open %s: %s", CMD_ARGV[2], strerror(errno));
+		goto fail;
+	}
+	dump->address = address;
+	dump->end = address + size;
+	dump->chunk_size = chunk_size;
+	dump->start_ms = timeval_ms();
+
+	if (target_register_timer_callback(async_dump_callback, 0,
+				TARGET_TIMER_TYPE_PERIODIC, target) != ERROR_OK) {
+		fclose(dump->file);
+		goto fail;
+	}
+	r->async_dump = dump;
 
 	return ERROR_OK;
+
+fail:
+	free(dump->filename);
+	free(dump->buffer);
+	free(dump);
+	return ERROR_FAIL;
 }
 
-COMMAND_HANDLER(riscv_set_mem_access)
+COMMAND_HANDLER(riscv_set_sba_wide_writes)
 {
 	struct target *target = get_current_target(CMD_CTX);
 	RISCV_INFO(r);
-	int progbuf_cnt = 0;
-	int sysbus_cnt = 0;
-	int abstract_cnt = 0;
 
-	if (CMD_ARGC < 1 || CMD_ARGC > RISCV_NUM_MEM_ACCESS_METHODS) {
-		LOG_ERROR("Command takes 1 to %d parameters", RISCV_NUM_MEM_ACCESS_METHODS);
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
 		return ERROR_COMMAND_SYNTAX_ERROR;
 	}
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], r->sba_wide_writes);
+	return ERROR_OK;
+}
 
-	/* Check argument validity */
-	for (unsigned i = 0; i < CMD_ARGC; i++) {
-		if (strcmp("progbuf", CMD_ARGV[i]) == 0)
-			progbuf_cnt++;
-		else if (strcmp("sysbus", CMD_ARGV[i]) == 0)
-			sysbus_cnt++;
-		else if (strcmp("abstract", CMD_ARGV[i]) == 0)
-			abstract_cnt++;
-		else {
-			LOG_ERROR("Unknown argument '%s'. "
-				"Must be one of: 'progbuf', 'sysbus' or 'abstract'.", CMD_ARGV[i]);
-			return ERROR_COMMAND_SYNTAX_ERROR;
-		}
-	}
-	if (progbuf_cnt > 1 || sysbus_cnt > 1 || abstract_cnt > 1) {
-		LOG_ERROR("Syntax error - duplicate arguments to `riscv set_mem_access`.");
+COMMAND_HANDLER(riscv_set_lazy_breakpoints)
+{
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 parameter");
 		return ERROR_COMMAND_SYNTAX_ERROR;
 	}
-
-	/* Args are valid, store them */
-	for (unsigned i = 0; i < RISCV_NUM_MEM_ACCESS_METHODS; i++)
-		r->mem_access_methods[i] = RISCV_MEM_ACCESS_UNSPECIFIED;
-	for (unsigned i = 0; i < CMD_ARGC; i++) {
-		if (strcmp("progbuf", CMD_ARGV[i]) == 0)
-			r->mem_access_methods[i] = RISCV_MEM_ACCESS_PROGBUF;
-		else if (strcmp("sysbus", CMD_ARGV[i]) == 0)
-			r->mem_access_methods[i] = RISCV_MEM_ACCESS_SYSBUS;
-		else if (strcmp("abstract", CMD_ARGV[i]) == 0)
-			r->mem_access_methods[i] = RISCV_MEM_ACCESS_ABSTRACT;
-	}
-
-	/* Reset warning flags */
-	r->mem_access_progbuf_warn = true;
-	r->mem_access_sysbus_warn = true;
-	r->mem_access_abstract_warn = true;
-
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], riscv_lazy_breakpoints);
 	return ERROR_OK;
 }
 
@@ -2806,6 +5282,54 @@ COMMAND_HANDLER(riscv_use_bscan_tunnel)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(riscv_semihosting_buffer)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+
+	if (CMD_ARGC == 0) {
+		if (r->semihosting_buffer.enabled)
+			command_print(CMD, "0x%" TARGET_PRIxADDR " %u",
+					r->semihosting_buffer.address, r->semihosting_buffer.poll_ms);
+		else
+			command_print(CMD, "off");
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "off"))
+		return riscv_semihosting_buffer_set(target, false, 0, 0);
+
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	target_addr_t address;
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	unsigned poll_ms = 10;
+	if (CMD_ARGC == 2)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], poll_ms);
+	return riscv_semihosting_buffer_set(target, true, address, poll_ms);
+}
+
+COMMAND_HANDLER(riscv_set_bscan_tunnel_batch)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!strcmp(CMD_ARGV[0], "off")) {
+		bscan_tunnel_batch = BSCAN_TUNNEL_BATCH_OFF;
+	} else if (!strcmp(CMD_ARGV[0], "select")) {
+		bscan_tunnel_batch = BSCAN_TUNNEL_BATCH_SELECT;
+	} else if (!strcmp(CMD_ARGV[0], "pack")) {
+		if (bscan_tunnel_type != BSCAN_TUNNEL_NESTED_TAP)
+			LOG_WARNING("Only nested TAP tunnels can be packed. Batches "
+					"through this tunnel will only select USER4 once.");
+		bscan_tunnel_batch = BSCAN_TUNNEL_BATCH_PACK;
+	} else {
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(riscv_set_enable_virt2phys)
 {
 	if (CMD_ARGC != 1) {
@@ -2868,20 +5392,110 @@ COMMAND_HANDLER(handle_repeat_read)
 	if (CMD_ARGC > 2)
 		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], size);
 
-	if (count == 0)
-		return ERROR_OK;
+	if (count == 0)
+		return ERROR_OK;
+
+	uint8_t *buffer = malloc(size * count);
+	if (!buffer) {
+		LOG_ERROR("malloc failed");
+		return ERROR_FAIL;
+	}
+	int result = r->read_memory(target, address, size, count, buffer, 0);
+	if (result == ERROR_OK) {
+		target_handle_md_output(cmd, target, address, size, count, buffer,
+			false);
+	}
+	free(buffer);
+	return result;
+}
+
+static int dump_csrs_hart(struct command_invocation *cmd, struct target *target,
+		const unsigned *regnos, unsigned count)
+{
+	if (target->state != TARGET_HALTED) {
+		LOG_ERROR("[%s] Target not halted.", target_name(target));
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	riscv_reg_t *values = malloc(count * sizeof(*values));
+	bool *valid = malloc(count * sizeof(*valid));
+	if (!values || !valid) {
+		LOG_ERROR("malloc failed");
+		free(values);
+		free(valid);
+		return ERROR_FAIL;
+	}
+
+	int result = riscv_read_csrs(target, regnos, count, values, valid);
+	if (result == ERROR_OK) {
+		for (unsigned i = 0; i < count; i++) {
+			if (!valid[i])
+				continue;
+			command_print(CMD, "%d 0x%03x %s 0x%" PRIx64,
+					riscv_current_hartid(target), regnos[i] - GDB_REGNO_CSR0,
+					target->reg_cache->reg_list[regnos[i]].name, values[i]);
+		}
+	}
+
+	free(values);
+	free(valid);
+	return result;
+}
+
+COMMAND_HANDLER(handle_dump_csrs)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	unsigned first_arg = 0;
+	bool all_harts = false;
+	if (CMD_ARGC > 0 && !strcmp(CMD_ARGV[0], "-all-harts")) {
+		all_harts = true;
+		first_arg = 1;
+	}
+	if (CMD_ARGC <= first_arg)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!target->reg_cache) {
+		LOG_ERROR("Target not examined yet.");
+		return ERROR_FAIL;
+	}
+
+	LIST_HEAD(ranges);
+	int result = ERROR_OK;
+	for (unsigned i = first_arg; i < CMD_ARGC && result == ERROR_OK; i++)
+		result = parse_ranges(&ranges, CMD_ARGV[i], "csr", 0xfff);
+
+	bool selected[4096] = { false };
+	range_list_t *entry, *tmp;
+	list_for_each_entry_safe(entry, tmp, &ranges, list) {
+		for (unsigned csr = entry->low; csr <= entry->high; csr++)
+			selected[csr] = true;
+		free(entry->name);
+		free(entry);
+	}
+	if (result != ERROR_OK)
+		return result;
 
-	uint8_t *buffer = malloc(size * count);
-	if (!buffer) {
+	unsigned *regnos = malloc(ARRAY_SIZE(selected) * sizeof(*regnos));
+	if (!regnos) {
 		LOG_ERROR("malloc failed");
 		return ERROR_FAIL;
 	}
-	int result = r->read_memory(target, address, size, count, buffer, 0);
-	if (result == ERROR_OK) {
-		target_handle_md_output(cmd, target, address, size, count, buffer,
-			false);
+	unsigned count = 0;
+	for (unsigned csr = 0; csr < ARRAY_SIZE(selected); csr++)
+		if (selected[csr])
+			regnos[count++] = GDB_REGNO_CSR0 + csr;
+
+	if (all_harts && target->smp) {
+		for (struct target_list *tlist = target->head; tlist; tlist = tlist->next) {
+			if (dump_csrs_hart(CMD, tlist->target, regnos, count) != ERROR_OK)
+				result = ERROR_FAIL;
+		}
+	} else {
+		result = dump_csrs_hart(CMD, target, regnos, count);
 	}
-	free(buffer);
+
+	free(regnos);
 	return result;
 }
 
@@ -2948,6 +5562,36 @@ COMMAND_HANDLER(handle_memory_sample_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_memory_sample_stream_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+
+	if (CMD_ARGC != 1) {
+		LOG_ERROR("Command takes exactly 1 argument.");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	if (r->sample_stream) {
+		fclose(r->sample_stream);
+		r->sample_stream = NULL;
+	}
+
+	if (!strcmp(CMD_ARGV[0], "off"))
+		return ERROR_OK;
+
+	r->sample_stream = fopen(CMD_ARGV[0], "wb");
+	if (!r->sample_stream) {
+		LOG_ERROR("Couldn't open %s: %s", CMD_ARGV[0], strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	/* Start the stream with whatever was collected so far. */
+	sample_buf_drain(target);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_dump_sample_buf_command)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -3071,6 +5715,14 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 		.usage = "riscv memory_sample bucket address|clear [size=4]",
 		.help = "Causes OpenOCD to frequently read size bytes at the given address."
 	},
+	{
+		.name = "memory_sample_stream",
+		.handler = handle_memory_sample_stream_command,
+		.mode = COMMAND_ANY,
+		.usage = "riscv memory_sample_stream filename|off",
+		.help = "Continuously write memory samples to a file instead of "
+			"collecting them in the sample buffer."
+	},
 	{
 		.name = "repeat_read",
 		.handler = handle_repeat_read,
@@ -3078,6 +5730,15 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 		.usage = "count address [size=4]",
 		.help = "Repeatedly read the value at address."
 	},
+	{
+		.name = "dump_csrs",
+		.handler = handle_dump_csrs,
+		.mode = COMMAND_EXEC,
+		.usage = "[-all-harts] n0[-m0][,n1[-m1]]...",
+		.help = "Read the given CSRs in as few round trips as possible and "
+			"print one 'hartid number name value' line for each CSR that "
+			"could be read."
+	},
 	{
 		.name = "set_command_timeout_sec",
 		.handler = riscv_set_command_timeout_sec,
@@ -3092,6 +5753,38 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 		.usage = "[sec]",
 		.help = "Set the wall-clock timeout (in seconds) after reset is deasserted"
 	},
+	{
+		.name = "set_batch_flush_scans",
+		.handler = riscv_set_batch_flush_scans,
+		.mode = COMMAND_ANY,
+		.usage = "scans",
+		.help = "Set the maximum number of DMI scans sent to the adapter in a "
+			"single flush when running a batch. 0 (default) means no limit."
+	},
+	{
+		.name = "set_capability_cache",
+		.handler = riscv_set_capability_cache,
+		.mode = COMMAND_ANY,
+		.usage = "filename|off",
+		.help = "Remember what examine discovers about each hart in filename, "
+			"and reuse it on later runs with the same hardware."
+	},
+	{
+		.name = "set_poll_interval",
+		.handler = riscv_set_poll_interval,
+		.mode = COMMAND_ANY,
+		.usage = "[min_ms max_ms]",
+		.help = "Set how quickly a running target is polled right after it "
+			"is resumed, and how far polling backs off while it keeps running."
+	},
+	{
+		.name = "set_pc_sample_address",
+		.handler = riscv_set_pc_sample_address,
+		.mode = COMMAND_ANY,
+		.usage = "address|none",
+		.help = "Set the address of a memory-mapped register that reads as "
+			"the current pc, for use by profile."
+	},
 	{
 		.name = "set_prefer_sba",
 		.handler = riscv_set_prefer_sba,
@@ -3104,9 +5797,91 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 		.name = "set_mem_access",
 		.handler = riscv_set_mem_access,
 		.mode = COMMAND_ANY,
-		.usage = "method1 [method2] [method3]",
+		.usage = "method1 [method2] [method3]|auto",
 		.help = "Set which memory access methods shall be used and in which order "
-			"of priority. Method can be one of: 'progbuf', 'sysbus' or 'abstract'."
+			"of priority. Method can be one of: 'progbuf', 'sysbus' or 'abstract'. "
+			"'auto' picks the fastest method measured for each kind of access."
+	},
+	{
+		.name = "dmi_stats",
+		.handler = riscv_dmi_stats,
+		.mode = COMMAND_ANY,
+		.usage = "[clear]",
+		.help = "Show how long DMI scans took, how many came back busy, and "
+			"how much of the time since the stats were cleared was spent "
+			"scanning."
+	},
+	{
+		.name = "dmi_trace",
+		.handler = riscv_dmi_trace,
+		.mode = COMMAND_ANY,
+		.usage = "[entries]",
+		.help = "Record the last entries DMI scans, 0 to stop recording."
+	},
+	{
+		.name = "dmi_trace_dump",
+		.handler = riscv_dmi_trace_dump_command,
+		.mode = COMMAND_ANY,
+		.usage = "filename",
+		.help = "Write the recorded DMI scans to a file."
+	},
+	{
+		.name = "mem_access_stats",
+		.handler = riscv_mem_access_stats,
+		.mode = COMMAND_ANY,
+		.usage = "[clear]",
+		.help = "Show the throughput measured for each memory access method "
+			"by 'riscv set_mem_access auto'."
+	},
+	{
+		.name = "set_memory_cache",
+		.handler = riscv_set_memory_cache,
+		.mode = COMMAND_ANY,
+		.usage = "line_size|off",
+		.help = "Cache memory read while the hart is halted, in aligned lines "
+				"of line_size bytes. Off by default."
+	},
+	{
+		.name = "memory_cache_region",
+		.handler = riscv_memory_cache_region,
+		.mode = COMMAND_ANY,
+		.usage = "address size|clear",
+		.help = "Only cache memory inside the given region (up to 8 regions "
+				"may be given). By default all memory is cached."
+	},
+	{
+		.name = "load_image_incremental",
+		.handler = riscv_load_image_incremental,
+		.mode = COMMAND_EXEC,
+		.usage = "filename [address [type [chunk_size]]]",
+		.help = "Like load_image, but only write chunks whose CRC, computed "
+				"on the target, differs from the image."
+	},
+	{
+		.name = "load_image_parallel",
+		.handler = riscv_load_image_parallel,
+		.mode = COMMAND_EXEC,
+		.usage = "filename [address [type]]",
+		.help = "Like load_image, but split each section between the harts "
+				"of the SMP group and write through all their DMs at once."
+	},
+	{
+		.name = "async_dump_memory",
+		.handler = riscv_async_dump_memory,
+		.mode = COMMAND_EXEC,
+		.usage = "[address size filename [chunk_size]|cancel]",
+		.help = "Dump memory to a file in the background, one chunk at a "
+				"time, without blocking other connections. Without "
+				"arguments, show progress."
+	},
+	{
+		.name = "set_sba_wide_writes",
+		.handler = riscv_set_sba_wide_writes,
+		.mode = COMMAND_ANY,
+		.usage = "on|off",
+		.help = "When on, system bus writes are done with the widest access "
+				"the bus supports that the address and length allow. "
+				"Off by default."
 	},
 	{
 		.name = "set_enable_virtual",
@@ -3117,6 +5892,14 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 				"memory depending on the current system configuration. "
 				"When off (default), all memory accessses are performed on physical memory."
 	},
+	{
+		.name = "set_lazy_breakpoints",
+		.handler = riscv_set_lazy_breakpoints,
+		.mode = COMMAND_ANY,
+		.usage = "on|off",
+		.help = "When on (default), adding and removing breakpoints while the "
+				"target is halted only takes effect when it runs again."
+	},
 	{
 		.name = "expose_csrs",
 		.handler = riscv_set_expose_csrs,
@@ -3178,6 +5961,15 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 			"an illegal, 128-byte aligned address for error flag/handling cases, "
 			"and whether sbbusyerror test should be run."
 	},
+	{
+		.name = "set_busy_delay_decay",
+		.handler = riscv_set_busy_delay_decay,
+		.mode = COMMAND_ANY,
+		.usage = "count",
+		.help = "Shorten a learned busy delay again after count operations "
+			"have succeeded without the target being busy. 0 keeps learned "
+			"delays until reset_delays is used."
+	},
 	{
 		.name = "reset_delays",
 		.handler = riscv_reset_delays,
@@ -3215,6 +6007,24 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 			"(optional) to indicate Bscan Tunnel Type {0:(default) NESTED_TAP , "
 			"1: DATA_REGISTER}"
 	},
+	{
+		.name = "semihosting_buffer",
+		.handler = riscv_semihosting_buffer,
+		.mode = COMMAND_ANY,
+		.usage = "[address [poll_ms]|off]",
+		.help = "Drain semihosting output the target writes to the ring buffer "
+			"described at address, every poll_ms milliseconds and before "
+			"every semihosting call."
+	},
+	{
+		.name = "set_bscan_tunnel_batch",
+		.handler = riscv_set_bscan_tunnel_batch,
+		.mode = COMMAND_ANY,
+		.usage = "off|select|pack",
+		.help = "Control how batches of scans go through a BSCAN tunnel: "
+			"select USER4 for every scan, once per batch, or also shift all "
+			"of a batch's scans in one DR scan."
+	},
 	{
 		.name = "set_enable_virt2phys",
 		.handler = riscv_set_enable_virt2phys,
@@ -3296,6 +6106,87 @@ static unsigned riscv_data_bits(struct target *target)
 	return riscv_xlen(target);
 }
 
+static int riscv_profiling(struct target *target, uint32_t *samples,
+		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	RISCV_INFO(r);
+	struct timeval timeout, now;
+
+	if (!r->pc_sample_address_set && !r->sample_pc)
+		return target_profiling_default(target, samples, max_num_samples,
+				num_samples, seconds);
+
+	/* Make sure the target is running */
+	target_poll(target);
+	int retval = ERROR_OK;
+	if (target->state == TARGET_HALTED)
+		retval = target_resume(target, 1, 0, 0, 0);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error while resuming target");
+		return retval;
+	}
+
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
+
+	if (r->pc_sample_address_set)
+		LOG_INFO("Starting RISC-V profiling. Sampling 0x%" TARGET_PRIxADDR
+				" as fast as we can...", r->pc_sample_address);
+	else
+		LOG_INFO("Starting RISC-V profiling. Halting and resuming the target "
+				"in batches...");
+
+	uint32_t sample_count = 0;
+	for (;;) {
+		uint32_t read_count = MIN(max_num_samples - sample_count, 1024);
+
+		if (r->pc_sample_address_set) {
+			uint8_t *buffer = (uint8_t *)&samples[sample_count];
+			retval = r->read_memory(target, r->pc_sample_address, 4,
+					read_count, buffer, 0);
+			for (uint32_t i = 0; retval == ERROR_OK && i < read_count; i++)
+				samples[sample_count + i] =
+					target_buffer_get_u32(target, buffer + 4 * i);
+		} else {
+			/* Halt and resume the whole SMP group together, so that
+			 * haltgroups don't leave the other harts halted. */
+			if (target->smp) {
+				for (struct target_list *list = target->head; list;
+						list = list->next)
+					riscv_info(list->target)->prepped =
+						list->target->state == TARGET_RUNNING;
+			}
+			unsigned count;
+			retval = r->sample_pc(target, samples + sample_count, read_count,
+					&count);
+			if (retval == ERROR_NOT_IMPLEMENTED && sample_count == 0) {
+				LOG_INFO("Can't read dpc with an abstract command.");
+				return target_profiling_default(target, samples,
+						max_num_samples, num_samples, seconds);
+			}
+			read_count = count;
+		}
+
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error while sampling the pc");
+			return retval;
+		}
+		sample_count += read_count;
+
+		gettimeofday(&now, NULL);
+		if (sample_count >= max_num_samples || timeval_compare(&now, &timeout) > 0) {
+			LOG_INFO("Profiling completed. %" PRIu32 " samples.", sample_count);
+			break;
+		}
+	}
+
+	*num_samples = sample_count;
+	return retval;
+}
+
 struct target_type riscv_target = {
 	.name = "riscv",
 
@@ -3305,7 +6196,8 @@ struct target_type riscv_target = {
 	.examine = riscv_examine,
 
 	/* poll current target status */
-	.poll = old_or_new_riscv_poll,
+	.poll = riscv_poll,
+	.poll_smp = riscv_poll_smp,
 
 	.halt = riscv_halt,
 	.resume = riscv_target_resume,
@@ -3315,11 +6207,15 @@ struct target_type riscv_target = {
 	.deassert_reset = riscv_deassert_reset,
 
 	.read_memory = riscv_read_memory,
+	.read_memory_batch = riscv_read_memory_batch,
 	.write_memory = riscv_write_memory,
 	.read_phys_memory = riscv_read_phys_memory,
 	.write_phys_memory = riscv_write_phys_memory,
 
 	.checksum_memory = riscv_checksum_memory,
+	.blank_check_memory = riscv_blank_check_memory,
+	.decompress_memory = riscv_decompress_memory,
+	.search_memory = riscv_search_memory,
 
 	.mmu = riscv_mmu,
 	.virt2phys = riscv_virt2phys,
@@ -3337,11 +6233,17 @@ struct target_type riscv_target = {
 	.arch_state = riscv_arch_state,
 
 	.run_algorithm = riscv_run_algorithm,
+	.start_algorithm = riscv_start_algorithm,
+	.wait_algorithm = riscv_wait_algorithm,
+
+	.profiling = riscv_profiling,
 
 	.commands = riscv_command_handlers,
 
 	.address_bits = riscv_xlen_nonconst,
-	.data_bits = riscv_data_bits
+	.data_bits = riscv_data_bits,
+
+	.set_non_stop = riscv_set_non_stop
 };
 
 /*** RISC-V Interface ***/
@@ -3386,6 +6288,7 @@ static int riscv_resume_go_all_harts(struct target *target)
 	}
 
 	riscv_invalidate_register_cache(target);
+	riscv_invalidate_memory_cache(target);
 	return ERROR_OK;
 }
 
@@ -3400,16 +6303,22 @@ int riscv_step_rtos_hart(struct target *target)
 		LOG_ERROR("Hart isn't halted before single step!");
 		return ERROR_FAIL;
 	}
+	if (riscv_flush_registers(target) != ERROR_OK)
+		return ERROR_FAIL;
 	riscv_invalidate_register_cache(target);
 	r->on_step(target);
+	/* Invalidate before stepping, so that step_current_hart() can fill in
+	 * registers it reads while it's at it. */
+	riscv_invalidate_register_cache(target);
+	riscv_invalidate_memory_cache(target);
 	if (r->step_current_hart(target) != ERROR_OK)
 		return ERROR_FAIL;
-	riscv_invalidate_register_cache(target);
 	r->on_halt(target);
 	if (!riscv_is_halted(target)) {
 		LOG_ERROR("Hart was not halted after single step!");
 		return ERROR_FAIL;
 	}
+	riscv_prefetch_registers(target);
 	return ERROR_OK;
 }
 
@@ -3439,6 +6348,9 @@ int riscv_set_current_hartid(struct target *target, int hartid)
 		return ERROR_OK;
 
 	int previous_hartid = riscv_current_hartid(target);
+	/* The register cache belongs to the hart that is selected now. */
+	if (hartid != previous_hartid && riscv_flush_registers(target) != ERROR_OK)
+		return ERROR_FAIL;
 	r->current_hartid = hartid;
 	LOG_DEBUG("setting hartid to %d, was %d", hartid, previous_hartid);
 	if (r->select_current_hart(target) != ERROR_OK)
@@ -3452,6 +6364,12 @@ void riscv_invalidate_register_cache(struct target *target)
 	RISCV_INFO(r);
 
 	LOG_DEBUG("[%d]", target->coreid);
+	for (size_t i = 0; i < target->reg_cache->num_regs; ++i) {
+		struct reg *reg = &target->reg_cache->reg_list[i];
+		if (reg->dirty)
+			LOG_DEBUG("[%s] discarding pending write to %s",
+					target_name(target), reg->name);
+	}
 	register_cache_invalidate(target->reg_cache);
 	for (size_t i = 0; i < target->reg_cache->num_regs; ++i) {
 		struct reg *reg = &target->reg_cache->reg_list[i];
@@ -3461,6 +6379,89 @@ void riscv_invalidate_register_cache(struct target *target)
 	r->registers_initialized = true;
 }
 
+static void mem_cache_invalidate_one(struct target *target)
+{
+	RISCV_INFO(r);
+	for (unsigned i = 0; i < RISCV_MEM_CACHE_LINES; i++)
+		r->mem_cache.line[i].valid = false;
+	/* Page tables are in memory too. */
+	riscv_invalidate_translation_cache(target);
+}
+
+void riscv_invalidate_translation_cache(struct target *target)
+{
+	RISCV_INFO(r);
+	for (unsigned i = 0; i < RISCV_TLB_ENTRIES; i++)
+		r->translation_cache.tlb[i].valid = false;
+	for (unsigned i = 0; i < RISCV_PTE_CACHE_ENTRIES; i++)
+		r->translation_cache.pte[i].valid = false;
+}
+
+void riscv_invalidate_memory_cache(struct target *target)
+{
+	/* Harts in an SMP group share memory, so what one hart does may be
+	 * visible to all of them. */
+	if (target->smp) {
+		for (struct target_list *tlist = target->head; tlist; tlist = tlist->next)
+			mem_cache_invalidate_one(tlist->target);
+	} else {
+		mem_cache_invalidate_one(target);
+	}
+}
+
+/* Write every register whose write was deferred by riscv_set_register() to
+ * the hart. This must happen before the hart executes anything. */
+int riscv_flush_registers(struct target *target)
+{
+	RISCV_INFO(r);
+
+	if (!target->reg_cache)
+		return ERROR_OK;
+
+	for (size_t i = 0; i < target->reg_cache->num_regs; ++i) {
+		struct reg *reg = &target->reg_cache->reg_list[i];
+		if (!reg->dirty)
+			continue;
+
+		riscv_reg_t value = buf_get_u64(reg->value, 0, reg->size);
+		LOG_DEBUG("[%s] flushing 0x%" PRIx64 " to %s", target_name(target),
+				value, reg->name);
+		int result = r->set_register(target, i, value);
+		reg->dirty = false;
+		if (result != ERROR_OK) {
+			reg->valid = false;
+			return result;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+/* Fill the register cache with the registers a debugger is going to ask for
+ * right after a halt, if the debug spec implementation can do that more
+ * cheaply than one register at a time. Failing to do so isn't an error; the
+ * registers are then read on demand. */
+void riscv_prefetch_registers(struct target *target)
+{
+	RISCV_INFO(r);
+
+	if (!r->prefetch_registers || !target->reg_cache)
+		return;
+
+	/* Nothing to do if the GPRs and pc are already cached. */
+	bool all_valid = true;
+	for (unsigned regno = GDB_REGNO_RA; regno <= GDB_REGNO_PC; regno++) {
+		struct reg *reg = &target->reg_cache->reg_list[regno];
+		if (reg->exist && !reg->valid)
+			all_valid = false;
+	}
+	if (all_valid)
+		return;
+
+	if (r->prefetch_registers(target) != ERROR_OK)
+		LOG_DEBUG("[%s] register prefetch failed", target_name(target));
+}
+
 int riscv_current_hartid(const struct target *target)
 {
 	RISCV_INFO(r);
@@ -3526,6 +6527,17 @@ static bool gdb_regno_cacheable(enum gdb_regno regno, bool write)
 	}
 }
 
+/* GPR writes don't have side effects, and the hart can't observe them until
+ * it runs again, so they are kept in the cache and written back by
+ * riscv_flush_registers(). */
+static bool riscv_can_defer_write(struct target *target, enum gdb_regno regno)
+{
+	RISCV_INFO(r);
+	/* Only debug spec implementations that go through the riscv.c
+	 * resume/step paths flush the cache before running. */
+	return r->is_halted && regno >= GDB_REGNO_RA && regno <= GDB_REGNO_XPR31;
+}
+
 /**
  * This function is called when the debug user wants to change the value of a
  * register. The new value may be cached, and may not be written until the hart
@@ -3544,6 +6556,17 @@ int riscv_set_register(struct target *target, enum gdb_regno regid, riscv_reg_t
 	struct reg *reg = &target->reg_cache->reg_list[regid];
 	buf_set_u64(reg->value, 0, reg->size, value);
 
+	if (regid == GDB_REGNO_SATP)
+		riscv_invalidate_translation_cache(target);
+
+	if (riscv_can_defer_write(target, regid)) {
+		reg->valid = true;
+		reg->dirty = true;
+		LOG_DEBUG("[%s] deferred write of 0x%" PRIx64 " to %s",
+				target_name(target), value, reg->name);
+		return ERROR_OK;
+	}
+
 	int result = r->set_register(target, regid, value);
 	if (result == ERROR_OK)
 		reg->valid = gdb_regno_cacheable(regid, true);
@@ -3590,6 +6613,76 @@ int riscv_get_register(struct target *target, riscv_reg_t *value,
 	return result;
 }
 
+int riscv_read_csrs(struct target *target, const unsigned *regnos,
+		unsigned count, riscv_reg_t *values, bool *valid)
+{
+	RISCV_INFO(r);
+
+	if (count == 0)
+		return ERROR_OK;
+
+	/* Take what we can from the cache, and collect the rest. */
+	unsigned *missing = malloc(count * sizeof(*missing));
+	unsigned *missing_regnos = malloc(count * sizeof(*missing_regnos));
+	riscv_reg_t *missing_values = malloc(count * sizeof(*missing_values));
+	bool *missing_valid = malloc(count * sizeof(*missing_valid));
+	if (!missing || !missing_regnos || !missing_values || !missing_valid) {
+		LOG_ERROR("malloc failed");
+		free(missing);
+		free(missing_regnos);
+		free(missing_values);
+		free(missing_valid);
+		return ERROR_FAIL;
+	}
+
+	unsigned missing_count = 0;
+	for (unsigned i = 0; i < count; i++) {
+		struct reg *reg = &target->reg_cache->reg_list[regnos[i]];
+		valid[i] = false;
+		if (!reg->exist)
+			continue;
+		if (reg->valid) {
+			values[i] = buf_get_u64(reg->value, 0, reg->size);
+			valid[i] = true;
+			continue;
+		}
+		missing[missing_count] = i;
+		missing_regnos[missing_count] = regnos[i];
+		missing_count++;
+	}
+
+	int result = ERROR_OK;
+	if (missing_count > 0 && r->read_csrs) {
+		result = r->read_csrs(target, missing_regnos, missing_count,
+				missing_values, missing_valid);
+	} else {
+		for (unsigned i = 0; i < missing_count; i++)
+			missing_valid[i] = r->get_register(target, &missing_values[i],
+					missing_regnos[i]) == ERROR_OK;
+	}
+
+	if (result == ERROR_OK) {
+		for (unsigned i = 0; i < missing_count; i++) {
+			if (!missing_valid[i])
+				continue;
+			values[missing[i]] = missing_values[i];
+			valid[missing[i]] = true;
+
+			struct reg *reg = &target->reg_cache->reg_list[missing_regnos[i]];
+			if (!reg->dirty) {
+				buf_set_u64(reg->value, 0, reg->size, missing_values[i]);
+				reg->valid = gdb_regno_cacheable(missing_regnos[i], false);
+			}
+		}
+	}
+
+	free(missing);
+	free(missing_regnos);
+	free(missing_values);
+	free(missing_valid);
+	return result;
+}
+
 bool riscv_is_halted(struct target *target)
 {
 	RISCV_INFO(r);
@@ -3686,6 +6779,33 @@ int riscv_enumerate_triggers(struct target *target)
 		return ERROR_OK;
 	}
 
+	riscv_reg_t swept_tselect[RISCV_MAX_TRIGGERS];
+	riscv_reg_t swept_tdata1[RISCV_MAX_TRIGGERS];
+	unsigned swept_count;
+	if (r->read_triggers &&
+			r->read_triggers(target, RISCV_MAX_TRIGGERS, swept_tselect,
+				swept_tdata1, &swept_count) == ERROR_OK) {
+		unsigned t;
+		for (t = 0; t < swept_count; t++) {
+			uint64_t tselect_rb = swept_tselect[t] &
+				~(1ULL << (riscv_xlen(target) - 1));
+			if (tselect_rb != t)
+				break;
+			int type = get_field(swept_tdata1[t], MCONTROL_TYPE(riscv_xlen(target)));
+			if (type == 0)
+				break;
+			if (type == 1 || (type == 2 &&
+						(swept_tdata1[t] & MCONTROL_DMODE(riscv_xlen(target))))) {
+				riscv_set_register(target, GDB_REGNO_TSELECT, t);
+				riscv_set_register(target, GDB_REGNO_TDATA1, 0);
+			}
+		}
+		r->trigger_count = t;
+		riscv_set_register(target, GDB_REGNO_TSELECT, tselect);
+		LOG_INFO("[%s] Found %d triggers", target_name(target), r->trigger_count);
+		return ERROR_OK;
+	}
+
 	for (unsigned t = 0; t < RISCV_MAX_TRIGGERS; ++t) {
 		r->trigger_count = t;
 
@@ -4004,6 +7124,45 @@ static int cmp_csr_info(const void *p1, const void *p2)
 	return (int) (((struct csr_info *)p1)->number) - (int) (((struct csr_info *)p2)->number);
 }
 
+/* Allocate value storage for the registers that exist, now that their sizes
+ * are known. */
+static int riscv_alloc_register_values(struct target *target)
+{
+	RISCV_INFO(info);
+	struct reg_cache *cache = target->reg_cache;
+
+	size_t total = 0;
+	size_t scratch = 8;
+	for (unsigned number = 0; number < cache->num_regs; number++) {
+		const struct reg *r = &cache->reg_list[number];
+		size_t bytes = DIV_ROUND_UP(r->size, 8);
+		if (r->exist)
+			total += bytes;
+		else
+			scratch = MAX(scratch, bytes);
+	}
+
+	free(info->reg_cache_values);
+	info->reg_cache_values = calloc(1, total + scratch);
+	if (!info->reg_cache_values)
+		return ERROR_FAIL;
+	LOG_DEBUG("[%s] %zu bytes of register values (+%zu scratch)",
+			target_name(target), total, scratch);
+
+	uint8_t *value = info->reg_cache_values;
+	for (unsigned number = 0; number < cache->num_regs; number++) {
+		struct reg *r = &cache->reg_list[number];
+		if (r->exist) {
+			r->value = value;
+			value += DIV_ROUND_UP(r->size, 8);
+		} else {
+			r->value = info->reg_cache_values + total;
+		}
+	}
+
+	return ERROR_OK;
+}
+
 int riscv_init_registers(struct target *target)
 {
 	RISCV_INFO(info);
@@ -4197,6 +7356,7 @@ int riscv_init_registers(struct target *target)
 		r->type = &riscv_reg_arch_type;
 		r->arch_info = shared_reg_info;
 		r->number = number;
+		r->stable = gdb_regno_cacheable(number, false);
 		r->size = riscv_xlen(target);
 		/* r->size is set in riscv_invalidate_register_cache, maybe because the
 		 * target is in theory allowed to change XLEN on us. But I expect a lot
@@ -4625,17 +7785,18 @@ int riscv_init_registers(struct target *target)
 			assert(reg_name < info->reg_names + target->reg_cache->num_regs *
 					max_reg_name_len);
 		}
-		r->value = info->reg_cache_values[number];
 	}
 
-	return ERROR_OK;
+	return riscv_alloc_register_values(target);
 }
 
 
-void riscv_add_bscan_tunneled_scan(struct target *target, struct scan_field *field,
-					riscv_bscan_tunneled_scan_context_t *ctxt)
+/* Fill in ctxt->tunneled_dr to tunnel field, followed by idle extra zero bits
+ * that keep the tunneled TAP in Run-Test/Idle. */
+static void bscan_tunnel_frame(struct scan_field *field,
+		riscv_bscan_tunneled_scan_context_t *ctxt, unsigned idle)
 {
-	jtag_add_ir_scan(target->tap, &select_user4, TAP_IDLE);
+	static const uint8_t bscan_idle_zero[64] = {0};
 
 	memset(ctxt->tunneled_dr, 0, sizeof(ctxt->tunneled_dr));
 	if (bscan_tunnel_type == BSCAN_TUNNEL_DATA_REGISTER) {
@@ -4665,8 +7826,60 @@ void riscv_add_bscan_tunneled_scan(struct target *target, struct scan_field *fie
 		ctxt->tunneled_dr[2].num_bits = field->num_bits + 1;
 		ctxt->tunneled_dr[2].out_value = field->out_value;
 		ctxt->tunneled_dr[2].in_value = field->in_value;
-		ctxt->tunneled_dr[3].num_bits = 3;
-		ctxt->tunneled_dr[3].out_value = bscan_zero;
+		ctxt->tunneled_dr[3].num_bits = 3 + MIN(idle, 8 * sizeof(bscan_idle_zero) - 3);
+		ctxt->tunneled_dr[3].out_value = bscan_idle_zero;
 	}
+}
+
+void riscv_add_bscan_tunneled_scan(struct target *target, struct scan_field *field,
+					riscv_bscan_tunneled_scan_context_t *ctxt)
+{
+	jtag_add_ir_scan(target->tap, &select_user4, TAP_IDLE);
+	bscan_tunnel_frame(field, ctxt, 0);
 	jtag_add_dr_scan(target->tap, ARRAY_SIZE(ctxt->tunneled_dr), ctxt->tunneled_dr, TAP_IDLE);
 }
+
+/* Queue count tunneled scans, each followed by idle Run-Test/Idle cycles.
+ * Unless bscan_tunnel_batch is off, USER4 is only selected once for all of
+ * them. When packing, the scans are also shifted in a single DR scan, with
+ * the idle cycles done by the tunnel. */
+void riscv_add_bscan_tunneled_scans(struct target *target,
+		struct scan_field *fields, riscv_bscan_tunneled_scan_context_t *ctxt,
+		size_t count, unsigned idle)
+{
+	if (bscan_tunnel_batch == BSCAN_TUNNEL_BATCH_OFF) {
+		for (size_t i = 0; i < count; i++) {
+			riscv_add_bscan_tunneled_scan(target, fields + i, ctxt + i);
+			if (idle > 0)
+				jtag_add_runtest(idle, TAP_IDLE);
+		}
+		return;
+	}
+
+	jtag_add_ir_scan(target->tap, &select_user4, TAP_IDLE);
+
+	if (bscan_tunnel_batch == BSCAN_TUNNEL_BATCH_PACK &&
+			bscan_tunnel_type == BSCAN_TUNNEL_NESTED_TAP) {
+		const size_t frame_fields = ARRAY_SIZE(ctxt->tunneled_dr);
+		struct scan_field *packed = malloc(count * frame_fields * sizeof(*packed));
+		if (packed) {
+			for (size_t i = 0; i < count; i++) {
+				bscan_tunnel_frame(fields + i, ctxt + i, idle);
+				memcpy(packed + i * frame_fields, ctxt[i].tunneled_dr,
+						sizeof(ctxt[i].tunneled_dr));
+			}
+			/* The field descriptions are copied into the JTAG queue. */
+			jtag_add_dr_scan(target->tap, count * frame_fields, packed, TAP_IDLE);
+			free(packed);
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		bscan_tunnel_frame(fields + i, ctxt + i, 0);
+		jtag_add_dr_scan(target->tap, ARRAY_SIZE(ctxt[i].tunneled_dr),
+				ctxt[i].tunneled_dr, TAP_IDLE);
+		if (idle > 0)
+			jtag_add_runtest(idle, TAP_IDLE);
+	}
+}
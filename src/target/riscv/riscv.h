@@ -14,16 +14,17 @@ struct riscv_program;
 
 /* The register cache is statically allocated. */
 #define RISCV_MAX_HARTS 1024
-#define RISCV_MAX_REGISTERS 5000
 #define RISCV_MAX_TRIGGERS 32
 #define RISCV_MAX_HWBPS 16
 
 #define DEFAULT_COMMAND_TIMEOUT_SEC		2
 #define DEFAULT_RESET_TIMEOUT_SEC		30
+#define DEFAULT_BUSY_DELAY_DECAY		1000
 
 #define RISCV_SATP_MODE(xlen)  ((xlen) == 32 ? SATP32_MODE : SATP64_MODE)
 #define RISCV_SATP_PPN(xlen)  ((xlen) == 32 ? SATP32_PPN : SATP64_PPN)
 #define RISCV_PGSHIFT 12
+#define RISCV_PGSIZE (1 << RISCV_PGSHIFT)
 
 # define PG_MAX_LEVEL 4
 
@@ -78,6 +79,73 @@ typedef struct {
 	} bucket[16];
 } riscv_sample_config_t;
 
+#define RISCV_MEM_CACHE_LINES	16
+#define RISCV_WATCHPOINT_INSN_CACHE	16
+#define RISCV_TLB_ENTRIES	16
+#define RISCV_PTE_CACHE_ENTRIES	64
+/* Most leaf PTEs read at once when translating a range of pages. */
+#define RISCV_PTE_PREFETCH	16
+/* Memory accesses are grouped by 16MiB region, access size, direction and
+ * whether they are small or bulk for "riscv set_mem_access auto". */
+#define RISCV_MEM_ACCESS_REGION_SHIFT	24
+#define RISCV_MEM_ACCESS_SMALL_BYTES	64
+#define RISCV_MEM_ACCESS_MIN_SAMPLES	3
+#define RISCV_MEM_ACCESS_STATS	32
+typedef struct {
+	bool valid;
+	target_addr_t region;
+	uint8_t size;
+	bool write;
+	bool bulk;
+	/* Indexed by method - RISCV_MEM_ACCESS_PROGBUF. */
+	struct {
+		unsigned samples;
+		unsigned failures;
+		uint64_t bytes;
+		double seconds;
+	} method[RISCV_NUM_MEM_ACCESS_METHODS];
+} riscv_mem_access_stat_t;
+
+typedef struct {
+	/* 0 when the cache is off. */
+	unsigned line_size;
+	/* RISCV_MEM_CACHE_LINES lines of line_size bytes each. */
+	uint8_t *data;
+	struct {
+		bool valid;
+		target_addr_t address;
+	} line[RISCV_MEM_CACHE_LINES];
+	/* Next line to replace. */
+	unsigned next;
+	/* If any region is enabled, only memory inside one is cached. */
+	struct {
+		bool enabled;
+		target_addr_t address;
+		target_addr_t size;
+	} region[8];
+} riscv_mem_cache_t;
+
+typedef struct {
+	/* Translations found by walking the page tables. */
+	struct {
+		bool valid;
+		riscv_reg_t satp;
+		/* Level the leaf PTE was found at. */
+		int level;
+		/* virtual >> vpn_shift[level] */
+		target_addr_t vpage;
+		uint64_t pte;
+	} tlb[RISCV_TLB_ENTRIES];
+	unsigned tlb_next;
+	/* PTEs read from memory, leaf or not. */
+	struct {
+		bool valid;
+		target_addr_t address;
+		uint64_t pte;
+	} pte[RISCV_PTE_CACHE_ENTRIES];
+	unsigned pte_next;
+} riscv_translation_cache_t;
+
 typedef struct {
 	struct list_head list;
 	uint16_t low, high;
@@ -98,8 +166,10 @@ typedef struct {
 
 	/* OpenOCD's register cache points into here. This is not per-hart because
 	 * we just invalidate the entire cache when we change which hart is
-	 * selected. Use an array of 8 uint8_t per register. */
-	uint8_t reg_cache_values[RISCV_MAX_REGISTERS][8];
+	 * selected. Registers that exist get DIV_ROUND_UP(size, 8) bytes each,
+	 * packed in register number order; all registers that don't exist share
+	 * a single scratch slot at the end. */
+	uint8_t *reg_cache_values;
 
 	/* Single buffer that contains all register names, instead of calling
 	 * malloc for each register. Needs to be freed when reg_list is freed. */
@@ -120,6 +190,26 @@ typedef struct {
 	 * target controls, while otherwise only a single hart is controlled. */
 	int trigger_unique_id[RISCV_MAX_HWBPS];
 
+	/* Triggers that are still programmed for a hardware breakpoint that has
+	 * been removed. They are cleared before the hart runs, unless a
+	 * breakpoint with the same address and length is added back first, in
+	 * which case it takes over the trigger. */
+	struct {
+		bool clear_pending;
+		target_addr_t address;
+		uint32_t length;
+	} trigger_lazy[RISCV_MAX_HWBPS];
+
+	/* Software breakpoints that are, or should be, in memory. When lazy
+	 * breakpoints are enabled, adding and removing a breakpoint only updates
+	 * this list, and riscv_sync_breakpoints() makes memory match it before
+	 * the hart runs. */
+	struct riscv_sw_breakpoint *sw_breakpoints;
+	unsigned sw_breakpoint_count;
+	/* Set while breakpoints are written just before the hart runs. Memory
+	 * writes then skip their fence, since resuming executes one anyway. */
+	bool defer_fence;
+
 	/* The number of entries in the debug buffer. */
 	int debug_buffer_size;
 
@@ -137,6 +227,8 @@ typedef struct {
 
 	/* This target has been prepped and is ready to step/resume. */
 	bool prepped;
+	/* Halt and resume this hart on its own, even in an SMP group. */
+	bool non_stop;
 	/* This target was selected using hasel. */
 	bool selected;
 
@@ -149,12 +241,47 @@ typedef struct {
 			const uint8_t *buf);
 	int (*select_current_hart)(struct target *target);
 	bool (*is_halted)(struct target *target);
+	/* Optional. Find out which harts in the SMP group of target are halted
+	 * with as few round trips as possible, and set halted[i] for the i-th
+	 * target in target->head. On any error the caller asks every hart
+	 * separately. */
+	int (*group_halted)(struct target *target, bool *halted);
+	/* Optional. Read sp and pc of every halted hart in the SMP group of
+	 * target that doesn't have them cached, in as few round trips as
+	 * possible. */
+	int (*snapshot_group)(struct target *target);
+	/* Optional. Put the hart in the halt group of its SMP group, or take it
+	 * out again while non_stop is set. */
+	int (*set_halt_group)(struct target *target, bool *supported);
+	/* Optional. Write words[i] 32-bit words from buffer[i] to address[i] on
+	 * targets[i], for all count targets at once. Returns
+	 * ERROR_NOT_IMPLEMENTED if these targets can't be written that way, in
+	 * which case nothing was written. */
+	int (*write_memory_parallel)(unsigned count, struct target * const *targets,
+			const target_addr_t *address, const uint8_t * const *buffer,
+			const uint32_t *words);
 	/* Resume this target, as well as every other prepped target that can be
 	 * resumed near-simultaneously. Clear the prepped flag on any target that
 	 * was resumed. */
 	int (*resume_go)(struct target *target);
 	int (*step_current_hart)(struct target *target);
 	int (*on_halt)(struct target *target);
+	/* Optional. Read the registers a debugger needs after a halt into the
+	 * register cache in as few round trips as possible. */
+	int (*prefetch_registers)(struct target *target);
+	/* Optional. Read count CSRs (GDB register numbers) from the current
+	 * hart in as few round trips as possible. valid[i] is cleared for every
+	 * CSR that can't be read. */
+	int (*read_csrs)(struct target *target, const unsigned *regnos,
+			unsigned count, riscv_reg_t *values, bool *valid);
+	/* Optional. Select each of triggers 0..max-1 in turn, and read back
+	 * tselect and tdata1 for each, in as few round trips as possible. Set
+	 * *count to the number of triggers there are results for. */
+	int (*read_triggers)(struct target *target, unsigned max,
+			riscv_reg_t *tselect, riscv_reg_t *tdata1, unsigned *count);
+	/* Optional. Whether memory accesses of the given size can be done while
+	 * the hart is running. */
+	bool (*can_access_memory_running)(struct target *target, uint32_t size);
 	/* Get this target as ready as possible to resume, without actually
 	 * resuming. */
 	int (*resume_prep)(struct target *target);
@@ -185,8 +312,18 @@ typedef struct {
 						 riscv_sample_config_t *config,
 						 int64_t until_ms);
 
+	/* Halt the current hart, read its pc and resume it again, as many
+	 * times as fit in one go (but no more than max), and store the pcs in
+	 * samples. Every prepped hart is halted and resumed along with the
+	 * current one. */
+	int (*sample_pc)(struct target *target, uint32_t *samples, unsigned max,
+			unsigned *count);
+
 	int (*read_memory)(struct target *target, target_addr_t address,
 			uint32_t size, uint32_t count, uint8_t *buffer, uint32_t increment);
+	/* Physical addresses, see target_type::read_memory_batch. Optional. */
+	int (*read_memory_batch)(struct target *target,
+			struct target_memory_read *reads, unsigned int num_reads);
 
 	/* How many harts are attached to the DM that this target is attached to? */
 	int (*hart_count)(struct target *target);
@@ -216,12 +353,23 @@ typedef struct {
 	/* Memory access methods to use, ordered by priority, highest to lowest. */
 	int mem_access_methods[RISCV_NUM_MEM_ACCESS_METHODS];
 
+	/* When set, mem_access_methods only lists the methods that may be used,
+	 * and the order is picked per access from mem_access_stats. */
+	bool mem_access_auto;
+	riscv_mem_access_stat_t mem_access_stats[RISCV_MEM_ACCESS_STATS];
+	/* Next entry of mem_access_stats to replace. */
+	unsigned mem_access_stats_next;
+
 	/* Different memory regions may need different methods but single configuration is applied
 	 * for all. Following flags are used to warn only once about failing memory access method. */
 	bool mem_access_progbuf_warn;
 	bool mem_access_sysbus_warn;
 	bool mem_access_abstract_warn;
 
+	/* Let system bus writes use a wider sbaccess than was asked for, when
+	 * alignment allows. */
+	bool sba_wide_writes;
+
 	/* In addition to the ones in the standard spec, we'll also expose additional
 	 * CSRs in this list. */
 	struct list_head expose_csr;
@@ -230,8 +378,59 @@ typedef struct {
 	 * from range 0xc000 ... 0xffff. */
 	struct list_head expose_custom;
 
+	/* Polling backs off from poll_min_ms to poll_max_ms while the target is
+	 * running, starting again from poll_min_ms after every resume. */
+	unsigned poll_min_ms;
+	unsigned poll_max_ms;
+	unsigned poll_interval_ms;
+	int64_t next_poll_ms;
+	bool fast_poll_scheduled;
+
+	/* Address of a memory-mapped register that reads as the current pc, to
+	 * be used by profiling if set. */
+	bool pc_sample_address_set;
+	target_addr_t pc_sample_address;
+
 	riscv_sample_config_t sample_config;
 	riscv_sample_buf_t sample_buf;
+
+	/* Hart state saved by riscv_start_algorithm() until
+	 * riscv_wait_algorithm() restores it. */
+	struct {
+		uint64_t pc;
+		uint64_t mstatus;
+		uint64_t regs[32];
+	} algorithm_saved;
+
+	/* Memory read while the hart is halted. Dropped whenever it runs, or
+	 * anything writes memory. */
+	riscv_mem_cache_t mem_cache;
+	/* Page table walks done while the hart is halted. Dropped along with
+	 * mem_cache, and when satp is written. */
+	riscv_translation_cache_t translation_cache;
+	/* Instructions riscv_hit_watchpoint() read to find out what address a
+	 * load or store accessed, by address. Dropped whenever OpenOCD writes
+	 * memory or the hart is reset. */
+	struct {
+		bool valid;
+		target_addr_t address;
+		uint32_t instruction;
+	} watchpoint_insn_cache[RISCV_WATCHPOINT_INSN_CACHE];
+	/* When set, sample_buf is appended to this file and emptied after every
+	 * poll. */
+	FILE *sample_stream;
+
+	/* Memory dump in progress in the background, see
+	 * riscv async_dump_memory. */
+	struct riscv_async_dump *async_dump;
+
+	/* Output ring buffer the target's semihosting library writes to instead
+	 * of trapping, see riscv semihosting_buffer. */
+	struct {
+		bool enabled;
+		target_addr_t address;
+		unsigned poll_ms;
+	} semihosting_buffer;
 } riscv_info_t;
 
 COMMAND_HELPER(riscv_print_info_line, const char *section, const char *key,
@@ -255,12 +454,47 @@ typedef struct {
 	unsigned pa_ppn_mask[PG_MAX_LEVEL];
 } virt2phys_info_t;
 
+/* Software breakpoints whose ebreaks are at most this many bytes apart are
+ * inserted and removed with a single read and a single write, of at most
+ * RISCV_BREAKPOINT_SPAN bytes. */
+#define RISCV_BREAKPOINT_COALESCE	64
+#define RISCV_BREAKPOINT_SPAN		4096
+
+/* Kept in riscv_info_t::sw_breakpoints, sorted by address. */
+struct riscv_sw_breakpoint {
+	target_addr_t address;
+	unsigned length;
+	/* What memory held before the ebreak was written. */
+	uint8_t orig_instr[4];
+	/* The ebreak is in memory. */
+	bool inserted;
+	/* The ebreak should be in memory when the hart runs. */
+	bool wanted;
+};
+
 /* Wall-clock timeout for a command/access. Settable via RISC-V Target commands.*/
 extern int riscv_command_timeout_sec;
 
 /* Wall-clock timeout after reset. Settable via RISC-V Target commands.*/
 extern int riscv_reset_timeout_sec;
 
+/* Maximum number of scans in a single JTAG flush of a batch, 0 for no limit.
+ * Settable via RISC-V Target commands.*/
+extern unsigned riscv_batch_flush_scans;
+
+/* Number of operations that must succeed before a learned busy delay is
+ * shortened again, 0 to never shorten them. Settable via RISC-V Target
+ * commands. */
+extern unsigned riscv_busy_delay_decay;
+
+/* Defer inserting and removing breakpoints until the hart runs. Settable via
+ * RISC-V Target commands. */
+extern bool riscv_lazy_breakpoints;
+
+/* File to remember discovered hart capabilities in across runs, or NULL.
+ * Settable via RISC-V Target commands. */
+extern char *riscv_capability_cache_file;
+
 extern bool riscv_enable_virtual;
 extern bool riscv_ebreakm;
 extern bool riscv_ebreaks;
@@ -289,10 +523,25 @@ extern uint32_t bscan_tunneled_select_dmi_num_fields;
 typedef enum { BSCAN_TUNNEL_NESTED_TAP, BSCAN_TUNNEL_DATA_REGISTER } bscan_tunnel_type_t;
 extern int bscan_tunnel_ir_width;
 extern bscan_tunnel_type_t bscan_tunnel_type;
+/* How batches of scans are sent through the BSCAN tunnel. */
+typedef enum {
+	/* Select USER4 again for every scan. */
+	BSCAN_TUNNEL_BATCH_OFF,
+	/* Select USER4 once per batch. */
+	BSCAN_TUNNEL_BATCH_SELECT,
+	/* Also shift all tunneled scans of a batch in a single DR scan. */
+	BSCAN_TUNNEL_BATCH_PACK
+} bscan_tunnel_batch_t;
+extern bscan_tunnel_batch_t bscan_tunnel_batch;
 
 uint32_t dtmcontrol_scan_via_bscan(struct target *target, uint32_t out);
 void select_dmi_via_bscan(struct target *target);
 
+extern bool use_vjtag;
+int riscv_tap_vjtag_init(struct jtag_tap *tap);
+int vjtag_vir_scan(struct jtag_tap *tap, uint32_t vir);
+void vjtag_vir_invalidate(struct jtag_tap *tap);
+
 /*** OpenOCD Interface */
 int riscv_openocd_poll(struct target *target);
 
@@ -317,6 +566,35 @@ int riscv_openocd_step(
 int riscv_openocd_assert_reset(struct target *target);
 int riscv_openocd_deassert_reset(struct target *target);
 
+/* Hart state saved while an algorithm is run many times in a row, e.g. by a
+ * flash driver. Between _begin() and _end() only the argument registers are
+ * written for each run, and the registers the algorithm clobbers are only
+ * restored at the end. */
+struct riscv_resident_algorithm {
+	/* Set by riscv_resident_algorithm_load(); freed by _end(). */
+	struct working_area *area;
+	bool active;
+	riscv_reg_t saved_pc;
+	riscv_reg_t saved_mstatus;
+	/* GPRs used as arguments so far, and their original values. */
+	uint32_t saved_mask;
+	riscv_reg_t saved_regs[32];
+};
+
+bool riscv_can_access_memory_running(struct target *target, uint32_t size);
+
+int riscv_resident_algorithm_load(struct target *target,
+		struct riscv_resident_algorithm *algo, const uint8_t *code,
+		unsigned size);
+int riscv_resident_algorithm_begin(struct target *target,
+		struct riscv_resident_algorithm *algo);
+int riscv_resident_algorithm_run(struct target *target,
+		struct riscv_resident_algorithm *algo, int num_reg_params,
+		struct reg_param *reg_params, target_addr_t entry_point,
+		target_addr_t exit_point, int timeout_ms);
+int riscv_resident_algorithm_end(struct target *target,
+		struct riscv_resident_algorithm *algo);
+
 /*** RISC-V Interface ***/
 
 /* Initializes the shared RISC-V structure. */
@@ -371,8 +649,26 @@ int riscv_dmi_write_u64_bits(struct target *target);
 
 /* Invalidates the register cache. */
 void riscv_invalidate_register_cache(struct target *target);
+/* Forgets all memory read while the hart was halted. */
+void riscv_invalidate_memory_cache(struct target *target);
+void riscv_invalidate_translation_cache(struct target *target);
+void riscv_mem_access_order(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, bool write, int *methods);
+void riscv_mem_access_record(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, bool write, int method, bool success,
+		float seconds);
+/* Writes back registers whose writes were deferred. */
+int riscv_flush_registers(struct target *target);
+/* Reads the registers a debugger needs after a halt into the cache. */
+void riscv_prefetch_registers(struct target *target);
+/* Reads count CSRs into values, using and filling the register cache. valid[i]
+ * is cleared for every CSR that can't be read. */
+int riscv_read_csrs(struct target *target, const unsigned *regnos,
+		unsigned count, riscv_reg_t *values, bool *valid);
 
 int riscv_enumerate_triggers(struct target *target);
+/* Bring memory and triggers in line with the breakpoints that are set. */
+int riscv_sync_breakpoints(struct target *target);
 
 int riscv_add_breakpoint(struct target *target, struct breakpoint *breakpoint);
 int riscv_remove_breakpoint(struct target *target,
@@ -392,9 +688,15 @@ typedef enum {
 	SEMI_ERROR		/* Something went wrong. */
 } semihosting_result_t;
 semihosting_result_t riscv_semihosting(struct target *target, int *retval);
+int riscv_semihosting_buffer_set(struct target *target, bool enable,
+		target_addr_t address, unsigned poll_ms);
+int riscv_semihosting_buffer_drain(struct target *target);
 
 void riscv_add_bscan_tunneled_scan(struct target *target, struct scan_field *field,
 		riscv_bscan_tunneled_scan_context_t *ctxt);
+void riscv_add_bscan_tunneled_scans(struct target *target,
+		struct scan_field *fields, riscv_bscan_tunneled_scan_context_t *ctxt,
+		size_t count, unsigned idle);
 
 int riscv_read_by_any_size(struct target *target, target_addr_t address, uint32_t size, uint8_t *buffer);
 int riscv_write_by_any_size(struct target *target, target_addr_t address, uint32_t size, uint8_t *buffer);
@@ -41,6 +41,10 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "log.h"
 
 #include "target/target.h"
@@ -49,6 +53,7 @@
 
 static int riscv_semihosting_setup(struct target *target, int enable);
 static int riscv_semihosting_post_result(struct target *target);
+static int riscv_semihosting_buffer_poll(void *priv);
 
 /**
  * Initialize RISC-V semihosting. Use common ARM code.
@@ -139,6 +144,9 @@ semihosting_result_t riscv_semihosting(struct target *target, int *retval)
 		semihosting->param = r1;
 		semihosting->word_size_bytes = riscv_xlen(target) / 8;
 
+		/* Anything buffered was written before this call. */
+		riscv_semihosting_buffer_drain(target);
+
 		/* Check for ARM operation numbers. */
 		if (0 <= semihosting->op && semihosting->op <= 0x31) {
 			*retval = semihosting_common(target);
@@ -201,3 +209,87 @@ static int riscv_semihosting_post_result(struct target *target)
 	riscv_set_register(target, GDB_REGNO_A0, semihosting->result);
 	return 0;
 }
+
+/* -------------------------------------------------------------------------
+ * Buffered output.
+ *
+ * The target writes its output to a ring buffer described by a control block
+ * of four 32-bit words: the buffer address, its size, the offset the target
+ * writes at next and the offset OpenOCD reads from next. The buffer is empty
+ * when both offsets are equal, so the target must leave one byte unused.
+ * OpenOCD drains it from a timer, using memory accesses that work while the
+ * hart runs, and before every semihosting call, so the target can flush it
+ * with any call (e.g. a 0-byte SYS_WRITE) when it is full. */
+
+int riscv_semihosting_buffer_drain(struct target *target)
+{
+	RISCV_INFO(r);
+	if (!r->semihosting_buffer.enabled || !target_was_examined(target))
+		return ERROR_OK;
+
+	target_addr_t address = r->semihosting_buffer.address;
+	uint8_t control[16];
+	if (target_read_phys_memory(target, address, 4, 4, control) != ERROR_OK)
+		return ERROR_FAIL;
+	uint32_t buffer = target_buffer_get_u32(target, control);
+	uint32_t size = target_buffer_get_u32(target, control + 4);
+	uint32_t head = target_buffer_get_u32(target, control + 8);
+	uint32_t tail = target_buffer_get_u32(target, control + 12);
+	if (head == tail)
+		return ERROR_OK;
+	if (size == 0 || head >= size || tail >= size) {
+		LOG_DEBUG("Semihosting buffer at 0x%" TARGET_PRIxADDR " isn't set up "
+				"(size=%" PRIu32 ", head=%" PRIu32 ", tail=%" PRIu32 ").",
+				address, size, head, tail);
+		return ERROR_FAIL;
+	}
+
+	uint8_t data[1024];
+	while (tail != head) {
+		uint32_t count = head > tail ? head - tail : size - tail;
+		count = MIN(count, sizeof(data));
+		if (target_read_phys_memory(target, buffer + tail, 1, count,
+					data) != ERROR_OK)
+			return ERROR_FAIL;
+		if (write(STDOUT_FILENO, data, count) < 0)
+			LOG_WARNING("Couldn't write semihosting output: %s", strerror(errno));
+		tail = (tail + count) % size;
+	}
+
+	uint8_t value[4];
+	target_buffer_set_u32(target, value, tail);
+	return target_write_phys_memory(target, address + 12, 4, 1, value);
+}
+
+static int riscv_semihosting_buffer_poll(void *priv)
+{
+	struct target *target = priv;
+	/* Don't disturb the hart if reading the buffer means halting it. */
+	if (target->state == TARGET_RUNNING &&
+			!riscv_can_access_memory_running(target, 4))
+		return ERROR_OK;
+	if (target->state != TARGET_RUNNING && target->state != TARGET_HALTED)
+		return ERROR_OK;
+	riscv_semihosting_buffer_drain(target);
+	return ERROR_OK;
+}
+
+int riscv_semihosting_buffer_set(struct target *target, bool enable,
+		target_addr_t address, unsigned poll_ms)
+{
+	RISCV_INFO(r);
+	if (r->semihosting_buffer.enabled) {
+		target_unregister_timer_callback(riscv_semihosting_buffer_poll, target);
+		r->semihosting_buffer.enabled = false;
+	}
+	if (!enable)
+		return ERROR_OK;
+
+	r->semihosting_buffer.address = address;
+	r->semihosting_buffer.poll_ms = poll_ms;
+	if (target_register_timer_callback(riscv_semihosting_buffer_poll, poll_ms,
+				TARGET_TIMER_TYPE_PERIODIC, target) != ERROR_OK)
+		return ERROR_FAIL;
+	r->semihosting_buffer.enabled = true;
+	return ERROR_OK;
+}
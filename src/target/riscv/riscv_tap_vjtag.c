@@ -23,6 +23,8 @@
 #endif
 
 #include <jtag/jtag.h>
+#include <target/target.h>
+#include "riscv.h"
 
 /* Contains constants relevant to the Altera Virtual JTAG
  * device, which are not included in the BSDL.
@@ -84,12 +86,43 @@ static unsigned char guess_addr_width(unsigned char number_of_nodes)
 static int nb_nodes;
 static int m_width;
 static int vjtag_node_address = -1;
-int vjtag_vir_scan(struct jtag_tap *tap, uint32_t vir);
+
+/* The VIR that was most recently queued, and the tap it was queued on.
+ * The hub keeps its VIR until it is rewritten through USER1 or the TAP is
+ * reset, so there is no need to rescan it before every DR access. A
+ * negative value means the selection is unknown. */
+static struct jtag_tap *vjtag_selected_tap;
+static int vjtag_selected_vir = -1;
+
+static bool vjtag_event_handler_registered;
+
+void vjtag_vir_invalidate(struct jtag_tap *tap)
+{
+	if (!tap || tap == vjtag_selected_tap)
+		vjtag_selected_vir = -1;
+}
+
+static int vjtag_jtag_event_handler(enum jtag_event event, void *priv)
+{
+	/* TRST puts every TAP back into Test-Logic-Reset, which also drops
+	 * the USER0 instruction the VIR selection relies on. */
+	if (event == JTAG_TRST_ASSERTED)
+		vjtag_vir_invalidate(NULL);
+	return ERROR_OK;
+}
 
 int riscv_tap_vjtag_init(struct jtag_tap *tap)
 {
 	LOG_DEBUG("Initialising Altera Virtual JTAG TAP");
 
+	if (!vjtag_event_handler_registered) {
+		jtag_register_event_callback(vjtag_jtag_event_handler, NULL);
+		vjtag_event_handler_registered = true;
+	}
+
+	/* Enumeration below goes through the hub's own VIR. */
+	vjtag_vir_invalidate(tap);
+
 	/* Put TAP into state where it can talk to the debug interface
 	 * by shifting in correct value to IR.
 	 */
@@ -271,7 +304,11 @@ int riscv_tap_vjtag_init(struct jtag_tap *tap)
 		return ERROR_FAIL;
 	}
 
-	return vjtag_vir_scan(tap, RISCV_DEBUG_DTMCS);
+	vjtag_vir_scan(tap, RISCV_DEBUG_DTMCS);
+	retval = jtag_execute_queue();
+	if (retval != ERROR_OK)
+		vjtag_vir_invalidate(tap);
+	return retval;
 
 #if 0
 	/* Select VIR */
@@ -300,11 +337,17 @@ int riscv_tap_vjtag_init(struct jtag_tap *tap)
 #endif
 }
 
+/* Queue the scans that select vir_val on the virtual JTAG node, unless it is
+ * already selected. The caller is responsible for flushing the queue, which
+ * lets DMI accesses that follow the selection be batched with it. */
 int vjtag_vir_scan(struct jtag_tap *tap, uint32_t vir_val)
 {
 	uint8_t t[4] = { 0 };
 	struct scan_field field;
 
+	if (tap == vjtag_selected_tap && vjtag_selected_vir == (int)vir_val)
+		return ERROR_OK;
+
 	/* Select VIR chain */
 	buf_set_u32(t, 0, tap->ir_length, ALTERA_CYCLONE_CMD_USER1);
 	field.num_bits = tap->ir_length;
@@ -327,5 +370,8 @@ int vjtag_vir_scan(struct jtag_tap *tap, uint32_t vir_val)
 	field.in_value = NULL;
 	jtag_add_ir_scan(tap, &field, TAP_IDLE);
 
-	return jtag_execute_queue();
+	vjtag_selected_tap = tap;
+	vjtag_selected_vir = vir_val;
+
+	return ERROR_OK;
 }
@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <helper/log.h>
 #include <helper/binarybuffer.h>
 #include <helper/command.h>
@@ -24,6 +25,18 @@
 
 #include "target.h"
 
+static void parse_rtt_channel(const uint8_t *buf, target_addr_t address,
+		struct rtt_channel *channel)
+{
+	channel->address = address;
+	channel->name_addr = buf_get_u32(buf + 0, 0, 32);
+	channel->buffer_addr = buf_get_u32(buf + 4, 0, 32);
+	channel->size = buf_get_u32(buf + 8, 0, 32);
+	channel->write_pos = buf_get_u32(buf + 12, 0, 32);
+	channel->read_pos = buf_get_u32(buf + 16, 0, 32);
+	channel->flags = buf_get_u32(buf + 20, 0, 32);
+}
+
 static int read_rtt_channel(struct target *target,
 		const struct rtt_control *ctrl, unsigned int channel_index,
 		enum rtt_channel_type type, struct rtt_channel *channel)
@@ -42,13 +55,7 @@ static int read_rtt_channel(struct target *target,
 	if (ret != ERROR_OK)
 		return ret;
 
-	channel->address = address;
-	channel->name_addr = buf_get_u32(buf + 0, 0, 32);
-	channel->buffer_addr = buf_get_u32(buf + 4, 0, 32);
-	channel->size = buf_get_u32(buf + 8, 0, 32);
-	channel->write_pos = buf_get_u32(buf + 12, 0, 32);
-	channel->read_pos = buf_get_u32(buf + 16, 0, 32);
-	channel->flags = buf_get_u32(buf + 20, 0, 32);
+	parse_rtt_channel(buf, address, channel);
 
 	return ERROR_OK;
 }
@@ -258,6 +265,22 @@ int target_rtt_find_control_block(struct target *target,
 
 	LOG_INFO("rtt: Searching for control block '%s'", id);
 
+	/* a halted target can scan its memory much faster than we can read it */
+	if (size <= UINT32_MAX) {
+		target_addr_t found_address;
+		int ret = target_search_memory(target, *address, size,
+			(const uint8_t *)id, id_length, &found_address, found);
+
+		if (ret == ERROR_OK) {
+			if (*found)
+				*address = found_address;
+
+			return ERROR_OK;
+		}
+
+		LOG_DEBUG("rtt: Searching for control block on the host");
+	}
+
 	for (target_addr_t addr = 0; addr < size; addr = addr + sizeof(buf)) {
 		int ret;
 
@@ -322,103 +345,176 @@ int target_rtt_read_channel_info(struct target *target,
 	return ERROR_OK;
 }
 
-static int read_from_channel(struct target *target,
-		const struct rtt_channel *channel, uint8_t *buffer,
-		size_t *length)
-{
-	int ret;
-	uint32_t len;
+/* Most reads one up-channel can need: two ring segments, each split into
+ * unaligned head, words and tail, see add_buffer_reads() */
+#define RTT_READS_PER_CHANNEL	6
+#define RTT_READ_BUFFER_SIZE	1024
 
-	if (!*length)
-		return ERROR_OK;
-
-	if (channel->read_pos == channel->write_pos) {
-		len = 0;
-	} else if (channel->read_pos < channel->write_pos) {
-		len = MIN(*length, channel->write_pos - channel->read_pos);
-
-		ret = target_read_buffer(target,
-			channel->buffer_addr + channel->read_pos, len, buffer);
+/* Add reads for length bytes at address, with word accesses where aligned */
+static void add_buffer_reads(struct target_memory_read *reads,
+		unsigned int *num_reads, target_addr_t address, uint32_t length,
+		uint8_t *buffer)
+{
+	uint32_t head = MIN(length, (4 - (address & 3)) & 3);
+	uint32_t words = (length - head) / 4;
+	uint32_t tail = length - head - words * 4;
+	const uint32_t sizes[3] = { 1, 4, 1 };
+	const uint32_t counts[3] = { head, words, tail };
+
+	for (unsigned int i = 0; i < 3; i++) {
+		if (!counts[i])
+			continue;
 
-		if (ret != ERROR_OK)
-			return ret;
-	} else {
-		uint32_t first_length;
+		reads[*num_reads].address = address;
+		reads[*num_reads].size = sizes[i];
+		reads[*num_reads].count = counts[i];
+		reads[*num_reads].buffer = buffer;
+		(*num_reads)++;
 
-		len = MIN(*length,
-			channel->size - channel->read_pos + channel->write_pos);
-		first_length = MIN(len, channel->size - channel->read_pos);
+		address += sizes[i] * counts[i];
+		buffer += sizes[i] * counts[i];
+	}
+}
 
-		ret = target_read_buffer(target,
-			channel->buffer_addr + channel->read_pos, first_length, buffer);
+/*
+ * Read all up-channels in three rounds instead of a few target accesses per
+ * channel: one read for all the channel descriptors, one batch of reads for
+ * the ring data of the channels that have any, then the read pointer
+ * updates of those channels.
+ */
+int target_rtt_read_callback(struct target *target,
+		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
+		struct rtt_channel_stats *stats, size_t num_channels, void *user_data)
+{
+	int ret;
 
-		if (ret != ERROR_OK)
-			return ret;
+	num_channels = MIN(num_channels, ctrl->num_up_channels);
 
-		ret = target_read_buffer(target, channel->buffer_addr,
-			len - first_length, buffer + first_length);
+	if (!num_channels)
+		return ERROR_OK;
 
-		if (ret != ERROR_OK)
-			return ret;
+	target_addr_t address = ctrl->address + RTT_CB_SIZE;
+	uint8_t *descriptors = malloc(num_channels * RTT_CHANNEL_SIZE);
+	struct rtt_channel *channels = calloc(num_channels, sizeof(*channels));
+	uint32_t *lengths = calloc(num_channels, sizeof(*lengths));
+	uint8_t *buffers = malloc(num_channels * RTT_READ_BUFFER_SIZE);
+	struct target_memory_read *reads = calloc(num_channels * RTT_READS_PER_CHANNEL,
+			sizeof(*reads));
+	unsigned int num_reads = 0;
+
+	if (!descriptors || !channels || !lengths || !buffers || !reads) {
+		LOG_ERROR("rtt: Out of memory");
+		ret = ERROR_FAIL;
+		goto out;
 	}
 
-	if (len > 0) {
-		ret = target_write_u32(target, channel->address + 16,
-			(channel->read_pos + len) % channel->size);
+	ret = target_read_buffer(target, address, num_channels * RTT_CHANNEL_SIZE,
+		descriptors);
 
-		if (ret != ERROR_OK)
-			return ret;
+	if (ret != ERROR_OK) {
+		LOG_ERROR("rtt: Failed to read up-channel descriptions");
+		goto out;
 	}
 
-	*length = len;
-
-	return ERROR_OK;
-}
-
-int target_rtt_read_callback(struct target *target,
-		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
-		size_t num_channels, void *user_data)
-{
-	num_channels = MIN(num_channels, ctrl->num_up_channels);
-
 	for (size_t i = 0; i < num_channels; i++) {
-		int ret;
-		struct rtt_channel channel;
-		uint8_t buffer[1024];
-		size_t length;
+		struct rtt_channel *channel = &channels[i];
+		uint8_t *buffer = buffers + i * RTT_READ_BUFFER_SIZE;
+		uint32_t fill;
+
+		stats[i].fill = 0;
+		stats[i].read = 0;
 
 		if (!sinks[i])
 			continue;
 
-		ret = read_rtt_channel(target, ctrl, i, RTT_CHANNEL_TYPE_UP,
-			&channel);
+		parse_rtt_channel(descriptors + i * RTT_CHANNEL_SIZE,
+			address + i * RTT_CHANNEL_SIZE, channel);
 
-		if (ret != ERROR_OK) {
-			LOG_ERROR("rtt: Failed to read up-channel %zu description", i);
-			return ret;
-		}
-
-		if (!channel_is_active(&channel)) {
+		if (!channel_is_active(channel)) {
 			LOG_WARNING("rtt: Up-channel %zu is not active", i);
 			continue;
 		}
 
-		if (channel.size < RTT_CHANNEL_BUFFER_MIN_SIZE) {
+		if (channel->size < RTT_CHANNEL_BUFFER_MIN_SIZE) {
 			LOG_WARNING("rtt: Up-channel %zu is not large enough", i);
 			continue;
 		}
 
-		length = sizeof(buffer);
-		ret = read_from_channel(target, &channel, buffer, &length);
+		if (channel->read_pos >= channel->size
+				|| channel->write_pos >= channel->size) {
+			LOG_WARNING("rtt: Up-channel %zu has a bad read or write position", i);
+			continue;
+		}
+
+		/* nothing new */
+		if (channel->read_pos == channel->write_pos)
+			continue;
+
+		fill = (channel->write_pos + channel->size - channel->read_pos)
+			% channel->size;
+		stats[i].size = channel->size;
+		stats[i].fill = fill;
+
+		/* the write position caught up with the read position, the target
+		 * either blocks or drops data until we read */
+		if (fill == channel->size - 1)
+			stats[i].overflows++;
+
+		lengths[i] = MIN(RTT_READ_BUFFER_SIZE, fill);
+
+		if (channel->read_pos < channel->write_pos) {
+			add_buffer_reads(reads, &num_reads,
+				channel->buffer_addr + channel->read_pos, lengths[i], buffer);
+		} else {
+			uint32_t first_length;
+
+			first_length = MIN(lengths[i], channel->size - channel->read_pos);
+
+			add_buffer_reads(reads, &num_reads,
+				channel->buffer_addr + channel->read_pos, first_length, buffer);
+			add_buffer_reads(reads, &num_reads, channel->buffer_addr,
+				lengths[i] - first_length, buffer + first_length);
+		}
+	}
+
+	if (!num_reads)
+		goto out;
+
+	ret = target_read_memory_batch(target, reads, num_reads);
+
+	if (ret != ERROR_OK) {
+		LOG_ERROR("rtt: Failed to read from up-channels");
+		goto out;
+	}
+
+	for (size_t i = 0; i < num_channels; i++) {
+		const struct rtt_channel *channel = &channels[i];
+
+		if (!lengths[i])
+			continue;
+
+		ret = target_write_u32(target, channel->address + 16,
+			(channel->read_pos + lengths[i]) % channel->size);
 
 		if (ret != ERROR_OK) {
 			LOG_ERROR("rtt: Failed to read from up-channel %zu", i);
-			return ret;
+			goto out;
 		}
 
+		stats[i].read = lengths[i];
+		stats[i].bytes += lengths[i];
+
 		for (struct rtt_sink_list *sink = sinks[i]; sink; sink = sink->next)
-			sink->read(i, buffer, length, sink->user_data);
+			sink->read(i, buffers + i * RTT_READ_BUFFER_SIZE, lengths[i],
+				sink->user_data);
 	}
 
-	return ERROR_OK;
+out:
+	free(reads);
+	free(buffers);
+	free(lengths);
+	free(channels);
+	free(descriptors);
+
+	return ret;
 }
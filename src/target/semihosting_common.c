@@ -123,6 +123,8 @@ int semihosting_common_init(struct target *target, void *setup,
 	semihosting->result = -1;
 	semihosting->sys_errno = -1;
 	semihosting->cmdline = NULL;
+	semihosting->is_console_buffered = false;
+	semihosting->console_buffer_len = 0;
 
 	/* If possible, update it in setup(). */
 	semihosting->setup_time = clock();
@@ -138,6 +140,56 @@ int semihosting_common_init(struct target *target, void *setup,
 	return ERROR_OK;
 }
 
+static void semihosting_console_flush(struct semihosting *semihosting)
+{
+	const char *p = semihosting->console_buffer;
+	size_t len = semihosting->console_buffer_len;
+
+	while (len > 0) {
+		ssize_t written = write(STDOUT_FILENO, p, len);
+		if (written <= 0)
+			break;
+		p += written;
+		len -= written;
+	}
+	semihosting->console_buffer_len = 0;
+}
+
+static void semihosting_console_write(struct semihosting *semihosting,
+	const char *buf, size_t len)
+{
+	while (len > 0) {
+		size_t room = SEMIHOSTING_CONSOLE_BUFFER_SIZE - semihosting->console_buffer_len;
+		size_t n = MIN(len, room);
+		memcpy(semihosting->console_buffer + semihosting->console_buffer_len, buf, n);
+		semihosting->console_buffer_len += n;
+		if (n == room || memchr(buf, '\n', n))
+			semihosting_console_flush(semihosting);
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Copy a null-terminated string from the target to the console buffer. It is
+ * read in pieces that don't cross a 64 byte boundary, so nothing past the
+ * page the terminator is in is touched. */
+static int semihosting_console_write_string(struct target *target, uint64_t addr)
+{
+	char chunk[64];
+
+	for (;;) {
+		size_t n = 64 - (addr & 63);
+		int retval = target_read_buffer(target, addr, n, (uint8_t *)chunk);
+		if (retval != ERROR_OK)
+			return retval;
+		size_t len = strnlen(chunk, n);
+		semihosting_console_write(target->semihosting, chunk, len);
+		if (len < n)
+			return ERROR_OK;
+		addr += n;
+	}
+}
+
 /**
  * Portable implementation of ARM semihosting calls.
  * Performs the currently pending semihosting operation
@@ -170,6 +222,12 @@ int semihosting_common(struct target *target)
 	LOG_DEBUG("op=0x%x, param=0x%" PRIx64, (int)semihosting->op,
 		semihosting->param);
 
+	/* keep console output in order with everything else the program does */
+	if (semihosting->op != SEMIHOSTING_SYS_WRITEC &&
+			semihosting->op != SEMIHOSTING_SYS_WRITE0 &&
+			semihosting->op != SEMIHOSTING_SYS_WRITE)
+		semihosting_console_flush(semihosting);
+
 	switch (semihosting->op) {
 
 		case SEMIHOSTING_SYS_CLOCK:	/* 0x10 */
@@ -1139,7 +1197,23 @@ int semihosting_common(struct target *target)
 				int fd = semihosting_get_field(target, 0, fields);
 				uint64_t addr = semihosting_get_field(target, 1, fields);
 				size_t len = semihosting_get_field(target, 2, fields);
-				if (semihosting->is_fileio) {
+				if (semihosting->is_console_buffered && fd == 1) {
+					char *buf = malloc(len);
+					if (!buf) {
+						semihosting->result = len;
+						semihosting->sys_errno = ENOMEM;
+					} else {
+						retval = target_read_buffer(target, addr, len, (uint8_t *)buf);
+						if (retval != ERROR_OK) {
+							free(buf);
+							return retval;
+						}
+						semihosting_console_write(semihosting, buf, len);
+						semihosting->result = 0;
+						free(buf);
+					}
+				} else if (semihosting->is_fileio) {
+					semihosting_console_flush(semihosting);
 					semihosting->hit_fileio = true;
 					fileio_info->identifier = "write";
 					fileio_info->param_1 = fd;
@@ -1156,6 +1230,7 @@ int semihosting_common(struct target *target)
 							free(buf);
 							return retval;
 						}
+						semihosting_console_flush(semihosting);
 						semihosting->result = write(fd, buf, len);
 						semihosting->sys_errno = errno;
 						LOG_DEBUG("write(%d, 0x%" PRIx64 ", %zu)=%d",
@@ -1189,7 +1264,14 @@ int semihosting_common(struct target *target)
 			 * Return
 			 * None. The RETURN REGISTER is corrupted.
 			 */
-			if (semihosting->is_fileio) {
+			if (semihosting->is_console_buffered) {
+				char c;
+				retval = target_read_memory(target, semihosting->param, 1, 1, (uint8_t *)&c);
+				if (retval != ERROR_OK)
+					return retval;
+				semihosting_console_write(semihosting, &c, 1);
+				semihosting->result = 0;
+			} else if (semihosting->is_fileio) {
 				semihosting->hit_fileio = true;
 				fileio_info->identifier = "write";
 				fileio_info->param_1 = 1;
@@ -1219,7 +1301,12 @@ int semihosting_common(struct target *target)
 			 * Return
 			 * None. The RETURN REGISTER is corrupted.
 			 */
-			if (semihosting->is_fileio) {
+			if (semihosting->is_console_buffered) {
+				retval = semihosting_console_write_string(target, semihosting->param);
+				if (retval != ERROR_OK)
+					return retval;
+				semihosting->result = 0;
+			} else if (semihosting->is_fileio) {
 				size_t count = 0;
 				uint64_t addr = semihosting->param;
 				for (;; addr++) {
@@ -1534,6 +1621,33 @@ static __COMMAND_HANDLER(handle_common_semihosting_fileio_command)
 	return ERROR_OK;
 }
 
+static __COMMAND_HANDLER(handle_common_semihosting_buffered_console_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (target == NULL) {
+		LOG_ERROR("No target selected");
+		return ERROR_FAIL;
+	}
+
+	struct semihosting *semihosting = target->semihosting;
+	if (!semihosting) {
+		command_print(CMD, "semihosting not supported for current target");
+		return ERROR_FAIL;
+	}
+
+	if (CMD_ARGC > 0) {
+		COMMAND_PARSE_ENABLE(CMD_ARGV[0], semihosting->is_console_buffered);
+		semihosting_console_flush(semihosting);
+	}
+
+	command_print(CMD, "semihosting buffered console is %s",
+		semihosting->is_console_buffered
+		? "enabled" : "disabled");
+
+	return ERROR_OK;
+}
+
 static __COMMAND_HANDLER(handle_common_semihosting_cmdline)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -1619,6 +1733,14 @@ const struct command_registration semihosting_common_handlers[] = {
 		.usage = "['enable'|'disable']",
 		.help = "activate support for semihosting fileio operations",
 	},
+	{
+		"semihosting_buffered_console",
+		.handler = handle_common_semihosting_buffered_console_command,
+		.mode = COMMAND_EXEC,
+		.usage = "['enable'|'disable']",
+		.help = "write semihosting console output to OpenOCD's stdout "
+			"through a line buffer, also while fileio is enabled",
+	},
 	{
 		"semihosting_resexit",
 		.handler = handle_common_semihosting_resumable_exit_command,
@@ -27,6 +27,8 @@
 #include <time.h>
 #include "helper/replacements.h"
 
+#define SEMIHOSTING_CONSOLE_BUFFER_SIZE	1024
+
 /*
  * According to:
  * "Semihosting for AArch32 and AArch64, Release 2.0"
@@ -150,6 +152,16 @@ struct semihosting {
 	/** The semihosting command line to be passed to the target. */
 	char *cmdline;
 
+	/**
+	 * Console output (SYS_WRITEC, SYS_WRITE0 and SYS_WRITE to fd 1) goes to
+	 * OpenOCD's stdout through console_buffer, flushed at each newline, when
+	 * full, and before any other operation, instead of one write (or one GDB
+	 * File-I/O round trip) per call.
+	 */
+	bool is_console_buffered;
+	char console_buffer[SEMIHOSTING_CONSOLE_BUFFER_SIZE];
+	size_t console_buffer_len;
+
 	/** The current time when 'execution starts' */
 	clock_t setup_time;
 
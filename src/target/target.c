@@ -42,6 +42,8 @@
 #endif
 
 #include <helper/time_support.h>
+#include <helper/lz4.h>
+#include <helper/perf.h>
 #include <jtag/jtag.h>
 #include <flash/nor/core.h>
 
@@ -55,16 +57,23 @@
 #include "rtos/rtos.h"
 #include "transport/transport.h"
 #include "arm_cti.h"
+#include "benchmark.h"
+#include "watch.h"
+#include "smp.h"
 
 /* default halt wait timeout (ms) */
 #define DEFAULT_HALT_TIMEOUT 5000
 
 static int target_read_buffer_default(struct target *target, target_addr_t address,
 		uint32_t count, uint8_t *buffer);
+static int target_access_working_area(struct target *target,
+		target_addr_t address, uint32_t size, bool write);
 static int target_write_buffer_default(struct target *target, target_addr_t address,
 		uint32_t count, const uint8_t *buffer);
 static int target_array2mem(Jim_Interp *interp, struct target *target,
 		int argc, Jim_Obj * const *argv);
+static bool target_examined_on_use(struct target *target);
+static void target_batch_sync(struct target *target);
 static int target_mem2array(Jim_Interp *interp, struct target *target,
 		int argc, Jim_Obj * const *argv);
 static int target_register_user_commands(struct command_context *cmd_ctx);
@@ -153,7 +162,14 @@ static struct target_type *target_types[] = {
 
 struct target *all_targets;
 static struct target_event_callback *target_event_callbacks;
-static struct target_timer_callback *target_timer_callbacks;
+/* Timer callbacks, kept in a binary min-heap ordered by (when, seq). */
+static struct target_timer_callback **timer_heap;
+static size_t timer_heap_len;
+static size_t timer_heap_alloc;
+static uint64_t timer_seq;
+/* The callbacks target_call_timer_callbacks_check_time() took out of the
+ * heap to run, the one that is running first. */
+static struct target_timer_callback *timer_batch;
 static LIST_HEAD(target_reset_callback_list);
 static LIST_HEAD(target_trace_callback_list);
 static const int polling_interval = TARGET_DEFAULT_POLLING_INTERVAL;
@@ -541,6 +557,24 @@ struct target *get_current_target_or_null(struct command_context *cmd_ctx)
 		: cmd_ctx->current_target;
 }
 
+/* Wake up GDB if a halt it asked for doesn't happen */
+static void target_check_halt_issued(struct target *target)
+{
+	if (!target->halt_issued)
+		return;
+
+	if (target->state == TARGET_HALTED) {
+		target->halt_issued = false;
+	} else {
+		int64_t t = timeval_ms() - target->halt_issued_time;
+		if (t > DEFAULT_HALT_TIMEOUT) {
+			target->halt_issued = false;
+			LOG_INFO("Halt timed out, wake up GDB.");
+			target_call_event_callbacks(target, TARGET_EVENT_GDB_HALT);
+		}
+	}
+}
+
 int target_poll(struct target *target)
 {
 	int retval;
@@ -551,21 +585,21 @@ int target_poll(struct target *target)
 		return ERROR_FAIL;
 	}
 
-	retval = target->type->poll(target);
+	int64_t start = perf_now();
+	if (target->smp && target->type->poll_smp)
+		retval = target->type->poll_smp(target);
+	else
+		retval = target->type->poll(target);
+	perf_record(PERF_TARGET_POLL, 0, start);
 	if (retval != ERROR_OK)
 		return retval;
 
-	if (target->halt_issued) {
-		if (target->state == TARGET_HALTED)
-			target->halt_issued = false;
-		else {
-			int64_t t = timeval_ms() - target->halt_issued_time;
-			if (t > DEFAULT_HALT_TIMEOUT) {
-				target->halt_issued = false;
-				LOG_INFO("Halt timed out, wake up GDB.");
-				target_call_event_callbacks(target, TARGET_EVENT_GDB_HALT);
-			}
-		}
+	if (target->smp && target->type->poll_smp) {
+		struct target_list *head;
+		foreach_smp_target(head, target->head)
+			target_check_halt_issued(head->target);
+	} else {
+		target_check_halt_issued(target);
 	}
 
 	return ERROR_OK;
@@ -575,7 +609,7 @@ int target_halt(struct target *target)
 {
 	int retval;
 	/* We can't poll until after examine */
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -626,13 +660,19 @@ int target_resume(struct target *target, int current, target_addr_t address,
 	int retval;
 
 	/* We can't poll until after examine */
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
 
 	target_call_event_callbacks(target, TARGET_EVENT_RESUME_START);
 
+	if (!debug_execution) {
+		retval = target_flush_working_areas(target);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
 	/* note that resume *must* be asynchronous. The CPU can halt before
 	 * we poll. The CPU can even halt at the current PC as a result of
 	 * a software breakpoint being inserted by (a bug?) the application.
@@ -733,6 +773,30 @@ int target_examine_one(struct target *target)
 	return ERROR_OK;
 }
 
+int target_examine_on_demand(struct target *target)
+{
+	if (target_was_examined(target) || !target->examine_on_demand ||
+			!target->tap->enabled)
+		return ERROR_OK;
+
+	LOG_INFO("Examining %s on first use", target_name(target));
+	/* examine() itself accesses the target */
+	target->examine_on_demand = false;
+	int retval = target_examine_one(target);
+	target->examine_on_demand = true;
+	if (retval != ERROR_OK)
+		LOG_WARNING("target %s examination failed", target_name(target));
+	return retval;
+}
+
+/* Whether @a target can be accessed, after examining it if it is examined on
+ * demand and this is the first time it's used. */
+static bool target_examined_on_use(struct target *target)
+{
+	target_examine_on_demand(target);
+	return target_was_examined(target);
+}
+
 static int jtag_enable_callback(enum jtag_event event, void *priv)
 {
 	struct target *target = priv;
@@ -782,7 +846,7 @@ const char *target_type_name(struct target *target)
 
 static int target_soft_reset_halt(struct target *target)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -820,7 +884,7 @@ int target_run_algorithm(struct target *target,
 {
 	int retval = ERROR_FAIL;
 
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		goto done;
 	}
@@ -830,12 +894,14 @@ int target_run_algorithm(struct target *target,
 		goto done;
 	}
 
+	int64_t start = perf_now();
 	target->running_alg = true;
 	retval = target->type->run_algorithm(target,
 			num_mem_params, mem_params,
 			num_reg_params, reg_param,
 			entry_point, exit_point, timeout_ms, arch_info);
 	target->running_alg = false;
+	perf_record(PERF_TARGET_ALGORITHM, 0, start);
 
 done:
 	return retval;
@@ -861,7 +927,7 @@ int target_start_algorithm(struct target *target,
 {
 	int retval = ERROR_FAIL;
 
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		goto done;
 	}
@@ -1122,6 +1188,150 @@ int target_run_flash_async_algorithm(struct target *target,
 	return retval;
 }
 
+int target_run_flash_async_algorithm_multi(struct target *target,
+		struct target_async_fifo *fifos, unsigned int num_fifos, int block_size,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t entry_point, uint32_t exit_point, void *arch_info)
+{
+	int retval = ERROR_OK;
+	int timeout = 0;
+	uint32_t wp[num_fifos];
+
+	/* validate block_size is 2^n */
+	assert(!block_size || !(block_size & (block_size - 1)));
+
+	/* Same layout as target_run_flash_async_algorithm() for each fifo */
+	for (unsigned int i = 0; i < num_fifos; i++) {
+		wp[i] = fifos[i].start + 8;
+		retval = target_write_u32(target, fifos[i].start, wp[i]);
+		if (retval == ERROR_OK)
+			retval = target_write_u32(target, fifos[i].start + 4, wp[i]);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	retval = target_start_algorithm(target, num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			entry_point,
+			exit_point,
+			arch_info);
+
+	if (retval != ERROR_OK) {
+		LOG_ERROR("error starting target flash write algorithm");
+		return retval;
+	}
+
+	bool pending = true;
+	while (pending && retval == ERROR_OK) {
+		bool progress = false;
+		pending = false;
+
+		for (unsigned int i = 0; i < num_fifos && retval == ERROR_OK; i++) {
+			struct target_async_fifo *fifo = &fifos[i];
+			uint32_t fifo_start_addr = fifo->start + 8;
+			uint32_t fifo_end_addr = fifo->start + fifo->size;
+			uint32_t rp;
+
+			if (fifo->count == 0)
+				continue;
+			pending = true;
+
+			retval = target_read_u32(target, fifo->start + 4, &rp);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("failed to get read pointer");
+				break;
+			}
+
+			if (rp == 0) {
+				LOG_ERROR("flash write algorithm aborted by target");
+				retval = ERROR_FLASH_OPERATION_FAILED;
+				break;
+			}
+
+			if (((rp - fifo_start_addr) & (block_size - 1)) || rp < fifo_start_addr || rp >= fifo_end_addr) {
+				LOG_ERROR("corrupted fifo read pointer 0x%" PRIx32, rp);
+				retval = ERROR_FAIL;
+				break;
+			}
+
+			/* Never fill the fifo completely, wp == rp means empty */
+			uint32_t thisrun_bytes;
+			if (rp > wp[i])
+				thisrun_bytes = rp - wp[i] - block_size;
+			else if (rp > fifo_start_addr)
+				thisrun_bytes = fifo_end_addr - wp[i];
+			else
+				thisrun_bytes = fifo_end_addr - wp[i] - block_size;
+
+			if (thisrun_bytes == 0)
+				continue;
+
+			if (thisrun_bytes > fifo->count * block_size)
+				thisrun_bytes = fifo->count * block_size;
+
+			retval = target_write_buffer(target, wp[i], thisrun_bytes, fifo->buffer);
+			if (retval != ERROR_OK)
+				break;
+
+			fifo->buffer += thisrun_bytes;
+			fifo->count -= thisrun_bytes / block_size;
+			wp[i] += thisrun_bytes;
+			if (wp[i] >= fifo_end_addr)
+				wp[i] = fifo_start_addr;
+
+			retval = target_write_u32(target, fifo->start, wp[i]);
+			progress = true;
+		}
+
+		if (retval != ERROR_OK || !pending)
+			break;
+
+		if (progress) {
+			timeout = 0;
+			/* Avoid GDB timeouts */
+			keep_alive();
+			continue;
+		}
+
+		/* All fifos are full, see target_run_flash_async_algorithm() */
+		alive_sleep(2);
+		if (timeout++ >= 2500) {
+			LOG_ERROR("timeout waiting for algorithm, a target reset is recommended");
+			return ERROR_FLASH_OPERATION_FAILED;
+		}
+	}
+
+	if (retval != ERROR_OK) {
+		/* abort flash write algorithm on target */
+		for (unsigned int i = 0; i < num_fifos; i++)
+			target_write_u32(target, fifos[i].start, 0);
+	}
+
+	int retval2 = target_wait_algorithm(target, num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			exit_point,
+			10000,
+			arch_info);
+
+	if (retval2 != ERROR_OK) {
+		LOG_ERROR("error waiting for target flash write algorithm");
+		retval = retval2;
+	}
+
+	for (unsigned int i = 0; i < num_fifos && retval == ERROR_OK; i++) {
+		/* check if algorithm set rp = 0 after fifo writer loop finished */
+		uint32_t rp;
+		retval = target_read_u32(target, fifos[i].start + 4, &rp);
+		if (retval == ERROR_OK && rp == 0) {
+			LOG_ERROR("flash write algorithm aborted by target");
+			retval = ERROR_FLASH_OPERATION_FAILED;
+		}
+	}
+
+	return retval;
+}
+
 int target_run_read_async_algorithm(struct target *target,
 		uint8_t *buffer, uint32_t count, int block_size,
 		int num_mem_params, struct mem_param *mem_params,
@@ -1275,24 +1485,107 @@ int target_run_read_async_algorithm(struct target *target,
 int target_read_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
+	target_batch_sync(target);
 	if (!target->type->read_memory) {
 		LOG_ERROR("Target %s doesn't support read_memory", target_name(target));
 		return ERROR_FAIL;
 	}
-	return target->type->read_memory(target, address, size, count, buffer);
+	int retval = target_access_working_area(target, address, size * count, false);
+	if (retval != ERROR_OK)
+		return retval;
+	int64_t start = perf_now();
+	retval = target->type->read_memory(target, address, size, count, buffer);
+	perf_record(PERF_TARGET_READ_MEMORY, size * count, start);
+	return retval;
+}
+
+int target_read_memory_batch(struct target *target,
+		struct target_memory_read *reads, unsigned int num_reads)
+{
+	if (!target_examined_on_use(target)) {
+		LOG_ERROR("Target not examined yet");
+		return ERROR_FAIL;
+	}
+	target_batch_sync(target);
+
+	for (unsigned int i = 0; i < num_reads; i++) {
+		int retval = target_access_working_area(target, reads[i].address,
+				reads[i].size * reads[i].count, false);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	if (target->type->read_memory_batch && num_reads > 1) {
+		int64_t start = perf_now();
+		int retval = target->type->read_memory_batch(target, reads, num_reads);
+		uint64_t bytes = 0;
+		for (unsigned int i = 0; i < num_reads; i++)
+			bytes += reads[i].size * reads[i].count;
+		perf_record(PERF_TARGET_READ_BATCH, bytes, start);
+		if (retval == ERROR_OK)
+			return ERROR_OK;
+	}
+
+	/* one at a time, which also tells which of them failed */
+	for (unsigned int i = 0; i < num_reads; i++) {
+		int retval = target_read_memory(target, reads[i].address, reads[i].size,
+				reads[i].count, reads[i].buffer);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
+int target_write_memory_batch(struct target *target,
+		struct target_memory_write *writes, unsigned int num_writes)
+{
+	if (!target_examined_on_use(target)) {
+		LOG_ERROR("Target not examined yet");
+		return ERROR_FAIL;
+	}
+	target_batch_sync(target);
+
+	for (unsigned int i = 0; i < num_writes; i++) {
+		int retval = target_access_working_area(target, writes[i].address,
+				writes[i].size * writes[i].count, true);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	if (target->type->write_memory_batch && num_writes > 1) {
+		int64_t start = perf_now();
+		int retval = target->type->write_memory_batch(target, writes, num_writes);
+		uint64_t bytes = 0;
+		for (unsigned int i = 0; i < num_writes; i++)
+			bytes += writes[i].size * writes[i].count;
+		perf_record(PERF_TARGET_WRITE_BATCH, bytes, start);
+		if (retval != ERROR_NOT_IMPLEMENTED)
+			return retval;
+	}
+
+	for (unsigned int i = 0; i < num_writes; i++) {
+		int retval = target_write_memory(target, writes[i].address, writes[i].size,
+				writes[i].count, writes[i].buffer);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
 }
 
 int target_read_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
+	target_batch_sync(target);
 	if (!target->type->read_phys_memory) {
 		LOG_ERROR("Target %s doesn't support read_phys_memory", target_name(target));
 		return ERROR_FAIL;
@@ -1303,24 +1596,32 @@ int target_read_phys_memory(struct target *target,
 int target_write_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, const uint8_t *buffer)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
+	target_batch_sync(target);
 	if (!target->type->write_memory) {
 		LOG_ERROR("Target %s doesn't support write_memory", target_name(target));
 		return ERROR_FAIL;
 	}
-	return target->type->write_memory(target, address, size, count, buffer);
+	int retval = target_access_working_area(target, address, size * count, true);
+	if (retval != ERROR_OK)
+		return retval;
+	int64_t start = perf_now();
+	retval = target->type->write_memory(target, address, size, count, buffer);
+	perf_record(PERF_TARGET_WRITE_MEMORY, size * count, start);
+	return retval;
 }
 
 int target_write_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, const uint8_t *buffer)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
+	target_batch_sync(target);
 	if (!target->type->write_phys_memory) {
 		LOG_ERROR("Target %s doesn't support write_phys_memory", target_name(target));
 		return ERROR_FAIL;
@@ -1409,7 +1710,7 @@ int target_get_gdb_reg_list(struct target *target,
 {
 	int result = ERROR_FAIL;
 
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		goto done;
 	}
@@ -1452,6 +1753,10 @@ int target_step(struct target *target,
 
 	target_call_event_callbacks(target, TARGET_EVENT_STEP_START);
 
+	retval = target_flush_working_areas(target);
+	if (retval != ERROR_OK)
+		return retval;
+
 	retval = target->type->step(target, current, address, handle_breakpoints);
 	if (retval != ERROR_OK)
 		return retval;
@@ -1502,6 +1807,18 @@ unsigned target_data_bits(struct target *target)
 	return 32;
 }
 
+int target_set_non_stop(struct target *target, bool enable)
+{
+	if (!target->type->set_non_stop)
+		return enable ? ERROR_NOT_IMPLEMENTED : ERROR_OK;
+	return target->type->set_non_stop(target, enable);
+}
+
+bool target_supports_non_stop(struct target *target)
+{
+	return target->type->set_non_stop != NULL;
+}
+
 static int target_profiling(struct target *target, uint32_t *samples,
 			uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
 {
@@ -1702,30 +2019,102 @@ int target_register_trace_callback(int (*callback)(struct target *target,
 	return ERROR_OK;
 }
 
+static bool timer_heap_before(size_t a, size_t b)
+{
+	const struct target_timer_callback *x = timer_heap[a];
+	const struct target_timer_callback *y = timer_heap[b];
+
+	return x->when < y->when || (x->when == y->when && x->seq < y->seq);
+}
+
+static void timer_heap_swap(size_t a, size_t b)
+{
+	struct target_timer_callback *tmp = timer_heap[a];
+	timer_heap[a] = timer_heap[b];
+	timer_heap[b] = tmp;
+}
+
+static void timer_heap_sift_up(size_t i)
+{
+	while (i > 0 && timer_heap_before(i, (i - 1) / 2)) {
+		timer_heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void timer_heap_sift_down(size_t i)
+{
+	for (;;) {
+		size_t first = i;
+		size_t child = 2 * i + 1;
+
+		if (child < timer_heap_len && timer_heap_before(child, first))
+			first = child;
+		if (child + 1 < timer_heap_len && timer_heap_before(child + 1, first))
+			first = child + 1;
+		if (first == i)
+			return;
+		timer_heap_swap(i, first);
+		i = first;
+	}
+}
+
+static int timer_heap_push(struct target_timer_callback *cb)
+{
+	if (timer_heap_len == timer_heap_alloc) {
+		size_t alloc = timer_heap_alloc ? 2 * timer_heap_alloc : 16;
+		struct target_timer_callback **heap = realloc(timer_heap,
+				alloc * sizeof(*heap));
+		if (!heap) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		timer_heap = heap;
+		timer_heap_alloc = alloc;
+	}
+
+	timer_heap[timer_heap_len] = cb;
+	timer_heap_sift_up(timer_heap_len++);
+	return ERROR_OK;
+}
+
+static struct target_timer_callback *timer_heap_pop(void)
+{
+	struct target_timer_callback *top = timer_heap[0];
+
+	timer_heap[0] = timer_heap[--timer_heap_len];
+	timer_heap_sift_down(0);
+	return top;
+}
+
 int target_register_timer_callback(int (*callback)(void *priv),
 		unsigned int time_ms, enum target_timer_type type, void *priv)
 {
-	struct target_timer_callback **callbacks_p = &target_timer_callbacks;
+	struct target_timer_callback *cb;
 
 	if (callback == NULL)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	if (*callbacks_p) {
-		while ((*callbacks_p)->next)
-			callbacks_p = &((*callbacks_p)->next);
-		callbacks_p = &((*callbacks_p)->next);
+	cb = malloc(sizeof(struct target_timer_callback));
+	if (!cb) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
 	}
+	cb->callback = callback;
+	cb->type = type;
+	cb->time_ms = time_ms;
+	cb->removed = false;
 
-	(*callbacks_p) = malloc(sizeof(struct target_timer_callback));
-	(*callbacks_p)->callback = callback;
-	(*callbacks_p)->type = type;
-	(*callbacks_p)->time_ms = time_ms;
-	(*callbacks_p)->removed = false;
+	cb->when = timeval_ms() + time_ms;
+	cb->seq = timer_seq++;
 
-	(*callbacks_p)->when = timeval_ms() + time_ms;
+	cb->priv = priv;
+	cb->next = NULL;
 
-	(*callbacks_p)->priv = priv;
-	(*callbacks_p)->next = NULL;
+	if (timer_heap_push(cb) != ERROR_OK) {
+		free(cb);
+		return ERROR_FAIL;
+	}
 
 	return ERROR_OK;
 }
@@ -1796,9 +2185,18 @@ int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
 	if (callback == NULL)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	for (struct target_timer_callback *c = target_timer_callbacks;
-	     c; c = c->next) {
-		if ((c->callback == callback) && (c->priv == priv)) {
+	/* Callbacks are only marked here, as one may be running right now.
+	 * They're freed once they come out of the heap. */
+	for (struct target_timer_callback *c = timer_batch; c; c = c->next) {
+		if (!c->removed && (c->callback == callback) && (c->priv == priv)) {
+			c->removed = true;
+			return ERROR_OK;
+		}
+	}
+
+	for (size_t i = 0; i < timer_heap_len; i++) {
+		struct target_timer_callback *c = timer_heap[i];
+		if (!c->removed && (c->callback == callback) && (c->priv == priv)) {
 			c->removed = true;
 			return ERROR_OK;
 		}
@@ -1855,24 +2253,6 @@ int target_call_trace_callbacks(struct target *target, size_t len, uint8_t *data
 	return ERROR_OK;
 }
 
-static int target_timer_callback_periodic_restart(
-		struct target_timer_callback *cb, int64_t *now)
-{
-	cb->when = *now + cb->time_ms;
-	return ERROR_OK;
-}
-
-static int target_call_timer_callback(struct target_timer_callback *cb,
-		int64_t *now)
-{
-	cb->callback(cb->priv);
-
-	if (cb->type == TARGET_TIMER_TYPE_PERIODIC)
-		return target_timer_callback_periodic_restart(cb, now);
-
-	return target_unregister_timer_callback(cb->callback, cb->priv);
-}
-
 static int target_call_timer_callbacks_check_time(int64_t *next_event, int checktime)
 {
 	static bool callback_processing;
@@ -1886,32 +2266,53 @@ static int target_call_timer_callbacks_check_time(int64_t *next_event, int check
 	keep_alive();
 
 	int64_t now = timeval_ms();
-	if (next_event)
-		*next_event = now + 1000;
 
-	/* Store an address of the place containing a pointer to the
-	 * next item; initially, that's a standalone "root of the
-	 * list" variable. */
-	struct target_timer_callback **callback = &target_timer_callbacks;
-	while (callback && *callback) {
-		if ((*callback)->removed) {
-			struct target_timer_callback *p = *callback;
-			*callback = (*callback)->next;
-			free(p);
-			continue;
+	if (!checktime) {
+		/* Periodic callbacks are all due right now */
+		for (size_t i = 0; i < timer_heap_len; i++) {
+			if (timer_heap[i]->type == TARGET_TIMER_TYPE_PERIODIC)
+				timer_heap[i]->when = now;
 		}
+		for (size_t i = timer_heap_len / 2; i-- > 0; )
+			timer_heap_sift_down(i);
+	}
+
+	/* Take out everything that is due before running any of it, so that
+	 * whatever the callbacks register or reschedule waits for next time. */
+	struct target_timer_callback **tail = &timer_batch;
+	while (timer_heap_len && timer_heap[0]->when <= now) {
+		*tail = timer_heap_pop();
+		tail = &(*tail)->next;
+	}
+	*tail = NULL;
 
-		bool call_it = (*callback)->callback &&
-			((!checktime && (*callback)->type == TARGET_TIMER_TYPE_PERIODIC) ||
-			 now >= (*callback)->when);
+	while (timer_batch) {
+		struct target_timer_callback *cb = timer_batch;
 
-		if (call_it)
-			target_call_timer_callback(*callback, &now);
+		if (!cb->removed) {
+			cb->callback(cb->priv);
+			if (cb->type != TARGET_TIMER_TYPE_PERIODIC)
+				cb->removed = true;
+		}
+
+		timer_batch = cb->next;
+		cb->next = NULL;
+		if (!cb->removed) {
+			cb->when = now + cb->time_ms;
+			if (timer_heap_push(cb) == ERROR_OK)
+				continue;
+		}
+		free(cb);
+	}
 
-		if (next_event && (*callback)->when < *next_event)
-			*next_event = (*callback)->when;
+	/* Don't wake up early for callbacks that are gone already */
+	while (timer_heap_len && timer_heap[0]->removed)
+		free(timer_heap_pop());
 
-		callback = &(*callback)->next;
+	if (next_event) {
+		*next_event = now + 1000;
+		if (timer_heap_len && timer_heap[0]->when < *next_event)
+			*next_event = timer_heap[0]->when;
 	}
 
 	callback_processing = false;
@@ -1939,9 +2340,10 @@ static void print_wa_layout(struct target *target)
 	struct working_area *c = target->working_areas;
 
 	while (c) {
-		LOG_DEBUG("%c%c " TARGET_ADDR_FMT "-" TARGET_ADDR_FMT " (%" PRIu32 " bytes)",
-			c->backup ? 'b' : ' ', c->free ? ' ' : '*',
-			c->address, c->address + c->size - 1, c->size);
+		LOG_DEBUG("%c%c " TARGET_ADDR_FMT "-" TARGET_ADDR_FMT " (%" PRIu32 " bytes)%s%s",
+			c->pin ? 'p' : ' ', c->free ? ' ' : (c->idle ? '-' : '*'),
+			c->address, c->address + c->size - 1, c->size,
+			c->pin ? " " : "", c->pin ? c->pin : "");
 		c = c->next;
 	}
 }
@@ -1962,17 +2364,13 @@ static void target_split_working_area(struct working_area *area, uint32_t size)
 		new_wa->next = area->next;
 		new_wa->size = area->size - size;
 		new_wa->address = area->address + size;
-		new_wa->backup = NULL;
+		new_wa->pin = NULL;
+		new_wa->idle = false;
 		new_wa->user = NULL;
 		new_wa->free = true;
 
 		area->next = new_wa;
 		area->size = size;
-
-		/* If backup memory was allocated to this area, it has the wrong size
-		 * now so free it and it will be reallocated if/when needed */
-		free(area->backup);
-		area->backup = NULL;
 	}
 }
 
@@ -1992,20 +2390,296 @@ static void target_merge_working_areas(struct target *target)
 			/* Remove the last */
 			struct working_area *to_be_freed = c->next;
 			c->next = c->next->next;
-			free(to_be_freed->backup);
 			free(to_be_freed);
+		} else {
+			c = c->next;
+		}
+	}
+}
+
+/* With -work-area-backup, the original content of the working area is read
+ * the first time a word of it gets allocated and is only written back when
+ * it matters: when the target runs its own code again, when all working
+ * areas are freed, or when memory access from the debugger touches a word
+ * that isn't allocated any more. Areas that are allocated and freed over and
+ * over again, or that hold pinned helper code, are thus saved only once.
+ * Each word of the working area has a bit in working_area_saved, set while
+ * working_area_backup holds its original content. */
+static bool target_working_area_saved(struct target *target, uint32_t word)
+{
+	return target->working_area_saved[word / 32] & (1u << (word % 32));
+}
+
+static void target_working_area_set_saved(struct target *target, uint32_t word, bool saved)
+{
+	if (saved) {
+		target->working_area_saved[word / 32] |= 1u << (word % 32);
+		target->working_area_saved_count++;
+	} else {
+		target->working_area_saved[word / 32] &= ~(1u << (word % 32));
+		target->working_area_saved_count--;
+	}
+}
+
+/* Read the original content of the words of an area that haven't been saved yet */
+static int target_save_working_area(struct target *target, struct working_area *area)
+{
+	uint32_t words = target->working_area_size / 4;
+
+	if (target->working_area_backup == NULL) {
+		target->working_area_backup = malloc(words * 4);
+		target->working_area_saved = calloc(DIV_ROUND_UP(words, 32), sizeof(uint32_t));
+		if (target->working_area_backup == NULL || target->working_area_saved == NULL) {
+			free(target->working_area_backup);
+			free(target->working_area_saved);
+			target->working_area_backup = NULL;
+			target->working_area_saved = NULL;
+			return ERROR_FAIL;
+		}
+		target->working_area_saved_count = 0;
+	}
+
+	uint32_t first = (area->address - target->working_area) / 4;
+	uint32_t end = first + area->size / 4;
+
+	while (first < end) {
+		if (target_working_area_saved(target, first)) {
+			first++;
+			continue;
+		}
+		uint32_t last = first;
+		while (last < end && !target_working_area_saved(target, last))
+			last++;
+
+		int retval = target->type->read_memory(target, target->working_area + first * 4,
+				4, last - first, target->working_area_backup + first * 4);
+		if (retval != ERROR_OK)
+			return retval;
+
+		for (; first < last; first++)
+			target_working_area_set_saved(target, first, true);
+	}
+
+	return ERROR_OK;
+}
+
+/* Saved runs of at least this size are compared by target side checksum
+ * in blocks of this size before being written back, see
+ * target_skip_unchanged_working_area() */
+#define WORKING_AREA_CRC_BLOCK	8192
+#define WORKING_AREA_CRC_MIN	4096
+
+/* Algorithms often leave most of the memory they were given untouched.
+ * Checksum the larger saved runs in [address, address + size) on the target
+ * and forget the blocks that still match their backup, so restoring them
+ * costs a checksum instead of a full write. The runs are kept allocated
+ * meanwhile so the checksum algorithm can't land on them. */
+static void target_skip_unchanged_working_area(struct target *target,
+		target_addr_t address, target_addr_t size)
+{
+	struct working_area **runs = NULL;
+	unsigned int num_runs = 0;
+
+	for (struct working_area *c = target->working_areas; c; c = c->next) {
+		if (!c->free)
+			continue;
+
+		target_addr_t start = MAX(c->address, address & ~(target_addr_t)3);
+		target_addr_t end = MIN(c->address + c->size, address + size);
+		if (start >= end)
+			continue;
+
+		/* find the first long enough saved run in this area */
+		uint32_t first = (start - target->working_area) / 4;
+		uint32_t stop = DIV_ROUND_UP(end - target->working_area, 4);
+		uint32_t last = first;
+		while (first < stop) {
+			while (first < stop && !target_working_area_saved(target, first))
+				first++;
+			last = first;
+			while (last < stop && target_working_area_saved(target, last))
+				last++;
+			if ((last - first) * 4 >= WORKING_AREA_CRC_MIN)
+				break;
+			first = last;
+		}
+		if (first >= stop)
+			continue;
+
+		struct working_area **new_runs = realloc(runs, (num_runs + 1) * sizeof(*runs));
+		if (new_runs == NULL)
+			break;
+		runs = new_runs;
+
+		/* carve the run out of the area and reserve it */
+		uint32_t offset = target->working_area + first * 4 - c->address;
+		if (offset) {
+			target_split_working_area(c, offset);
+			if (c->size != offset)
+				break;
+			c = c->next;
+		}
+		target_split_working_area(c, (last - first) * 4);
+		if (c->size != (last - first) * 4)
+			break;
+		c->free = false;
+		runs[num_runs++] = c;
+	}
+
+	for (unsigned int i = 0; i < num_runs; i++) {
+		struct working_area *r = runs[i];
+		for (uint32_t offset = 0; r->size - offset >= WORKING_AREA_CRC_MIN;
+				offset += WORKING_AREA_CRC_BLOCK) {
+			uint32_t len = MIN(WORKING_AREA_CRC_BLOCK, r->size - offset);
+			uint32_t first = (r->address + offset - target->working_area) / 4;
+			uint32_t target_crc, backup_crc;
+
+			if (target->type->checksum_memory(target, r->address + offset, len,
+						&target_crc) != ERROR_OK)
+				break;
+			image_calculate_checksum(target->working_area_backup + first * 4, len,
+					&backup_crc);
+			if (target_crc != backup_crc)
+				continue;
+
+			LOG_DEBUG("%" PRIu32 " bytes of working area at " TARGET_ADDR_FMT " unchanged",
+					len, r->address + offset);
+			for (uint32_t word = first; word < first + len / 4; word++)
+				target_working_area_set_saved(target, word, false);
+		}
+		r->free = true;
+	}
+
+	free(runs);
+	target_merge_working_areas(target);
+}
+
+/* Write back the saved words in [address, address + size) that lie in free areas */
+static int target_restore_working_area_range(struct target *target,
+		target_addr_t address, target_addr_t size)
+{
+	int retval = ERROR_OK;
+
+	if (target->working_area_saved_count * 4 >= WORKING_AREA_CRC_MIN &&
+			!target->working_area_restoring && target->type->checksum_memory) {
+		/* the checksum algorithm's own memory accesses mustn't get here */
+		target->working_area_restoring = true;
+		target_skip_unchanged_working_area(target, address, size);
+		target->working_area_restoring = false;
+	}
+
+	for (struct working_area *c = target->working_areas;
+			c && target->working_area_saved_count; c = c->next) {
+		if (!c->free)
+			continue;
+
+		target_addr_t start = MAX(c->address, address & ~(target_addr_t)3);
+		target_addr_t end = MIN(c->address + c->size, address + size);
+		if (start >= end)
+			continue;
+
+		uint32_t first = (start - target->working_area) / 4;
+		uint32_t stop = DIV_ROUND_UP(end - target->working_area, 4);
+		while (first < stop) {
+			if (!target_working_area_saved(target, first)) {
+				first++;
+				continue;
+			}
+			uint32_t last = first;
+			while (last < stop && target_working_area_saved(target, last))
+				last++;
+
+			int ret = target->type->write_memory(target, target->working_area + first * 4,
+					4, last - first, target->working_area_backup + first * 4);
+			if (ret != ERROR_OK) {
+				LOG_ERROR("failed to restore %" PRIu32 " bytes of working area at address "
+						TARGET_ADDR_FMT, (last - first) * 4, target->working_area + first * 4);
+				retval = ret;
+			}
+
+			for (; first < last; first++)
+				target_working_area_set_saved(target, first, false);
+		}
+	}
+
+	return retval;
+}
+
+/* Forget the saved content of the whole working area */
+static void target_drop_working_area_backup(struct target *target)
+{
+	free(target->working_area_backup);
+	free(target->working_area_saved);
+	target->working_area_backup = NULL;
+	target->working_area_saved = NULL;
+	target->working_area_saved_count = 0;
+}
+
+void target_unpin_working_area(struct working_area *area)
+{
+	free(area->pin);
+	area->pin = NULL;
+}
+
+/* Return an idle pinned area to the allocation pool */
+static void target_release_pinned_working_area(struct working_area *area)
+{
+	LOG_DEBUG("released pinned working area '%s' at address " TARGET_ADDR_FMT,
+			area->pin, area->address);
+	target_unpin_working_area(area);
+	area->idle = false;
+	area->free = true;
+}
+
+/* Release all pinned areas that aren't in use, return true if there were any */
+static bool target_evict_pinned_working_areas(struct target *target,
+		target_addr_t address, target_addr_t size)
+{
+	bool evicted = false;
+
+	for (struct working_area *c = target->working_areas; c; c = c->next) {
+		if (c->pin && c->idle && c->address < address + size &&
+				address < c->address + c->size) {
+			target_release_pinned_working_area(c);
+			evicted = true;
+		}
+	}
+
+	if (evicted)
+		target_merge_working_areas(target);
+
+	return evicted;
+}
+
+/* Called before memory in [address, address + size) is accessed by the debugger */
+static int target_access_working_area(struct target *target,
+		target_addr_t address, uint32_t size, bool write)
+{
+	if (target->working_areas == NULL || size == 0 || target->working_area_restoring ||
+			address >= target->working_area + target->working_area_size ||
+			address + size <= target->working_area)
+		return ERROR_OK;
+
+	/* helper code pinned here can't be trusted any more */
+	if (write)
+		target_evict_pinned_working_areas(target, address, size);
+
+	return target_restore_working_area_range(target, address, size);
+}
+
+int target_flush_working_areas(struct target *target)
+{
+	if (target->working_areas == NULL)
+		return ERROR_OK;
+
+	/* the target's own code may overwrite pinned helpers */
+	target_evict_pinned_working_areas(target, 0, TARGET_ADDR_MAX);
 
-			/* If backup memory was allocated to the remaining area, it's has
-			 * the wrong size now */
-			free(c->backup);
-			c->backup = NULL;
-		} else {
-			c = c->next;
-		}
-	}
+	return target_restore_working_area_range(target, 0, TARGET_ADDR_MAX);
 }
 
-int target_alloc_working_area_try(struct target *target, uint32_t size, struct working_area **area)
+static int target_alloc_working_area_pinned(struct target *target, uint32_t size,
+		struct working_area **area, const char *pin)
 {
 	/* Reevaluate working area address based on MMU state*/
 	if (target->working_areas == NULL) {
@@ -2046,7 +2720,8 @@ int target_alloc_working_area_try(struct target *target, uint32_t size, struct w
 			new_wa->next = NULL;
 			new_wa->size = target->working_area_size & ~3UL; /* 4-byte align */
 			new_wa->address = target->working_area;
-			new_wa->backup = NULL;
+			new_wa->pin = NULL;
+			new_wa->idle = false;
 			new_wa->user = NULL;
 			new_wa->free = true;
 		}
@@ -2058,14 +2733,18 @@ int target_alloc_working_area_try(struct target *target, uint32_t size, struct w
 	if (size % 4)
 		size = (size + 3) & (~3UL);
 
-	struct working_area *c = target->working_areas;
+	struct working_area *c;
 
-	/* Find the first large enough working area */
-	while (c) {
-		if (c->free && c->size >= size)
-			break;
-		c = c->next;
-	}
+	do {
+		/* Find the smallest large enough working area, to keep large
+		 * ones for large requests and limit fragmentation */
+		c = NULL;
+		for (struct working_area *i = target->working_areas; i; i = i->next) {
+			if (i->free && i->size >= size && (c == NULL || i->size < c->size))
+				c = i;
+		}
+		/* Make room by releasing pinned areas nobody uses at the moment */
+	} while (c == NULL && target_evict_pinned_working_areas(target, 0, TARGET_ADDR_MAX));
 
 	if (c == NULL)
 		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
@@ -2077,17 +2756,17 @@ int target_alloc_working_area_try(struct target *target, uint32_t size, struct w
 			  size, c->address);
 
 	if (target->backup_working_area) {
-		if (c->backup == NULL) {
-			c->backup = malloc(c->size);
-			if (c->backup == NULL)
-				return ERROR_FAIL;
-		}
-
-		int retval = target_read_memory(target, c->address, 4, c->size / 4, c->backup);
+		int retval = target_save_working_area(target, c);
 		if (retval != ERROR_OK)
 			return retval;
 	}
 
+	if (pin) {
+		c->pin = strdup(pin);
+		if (c->pin == NULL)
+			return ERROR_FAIL;
+	}
+
 	/* mark as used, and return the new (reused) area */
 	c->free = false;
 	*area = c;
@@ -2100,6 +2779,11 @@ int target_alloc_working_area_try(struct target *target, uint32_t size, struct w
 	return ERROR_OK;
 }
 
+int target_alloc_working_area_try(struct target *target, uint32_t size, struct working_area **area)
+{
+	return target_alloc_working_area_pinned(target, size, area, NULL);
+}
+
 int target_alloc_working_area(struct target *target, uint32_t size, struct working_area **area)
 {
 	int retval;
@@ -2111,33 +2795,60 @@ int target_alloc_working_area(struct target *target, uint32_t size, struct worki
 
 }
 
-static int target_restore_working_area(struct target *target, struct working_area *area)
+int target_alloc_pinned_working_area(struct target *target, const char *name,
+		uint32_t size, struct working_area **area, bool *fresh)
 {
-	int retval = ERROR_OK;
+	for (struct working_area *c = target->working_areas; c; c = c->next) {
+		if (!c->pin || strcmp(c->pin, name))
+			continue;
 
-	if (target->backup_working_area && area->backup != NULL) {
-		retval = target_write_memory(target, area->address, 4, area->size / 4, area->backup);
-		if (retval != ERROR_OK)
-			LOG_ERROR("failed to restore %" PRIu32 " bytes of working area at address " TARGET_ADDR_FMT,
-					area->size, area->address);
+		if (!c->idle) {
+			/* in use already, hand out a private copy */
+			*fresh = true;
+			return target_alloc_working_area_try(target, size, area);
+		}
+
+		if (c->size >= size) {
+			LOG_DEBUG("reusing pinned working area '%s' at address " TARGET_ADDR_FMT,
+					name, c->address);
+			c->idle = false;
+			c->user = area;
+			*area = c;
+			*fresh = false;
+			return ERROR_OK;
+		}
+
+		/* too small for this request */
+		target_release_pinned_working_area(c);
+		target_merge_working_areas(target);
+		break;
 	}
 
-	return retval;
+	*fresh = true;
+	return target_alloc_working_area_pinned(target, size, area, name);
 }
 
-/* Restore the area's backup memory, if any, and return the area to the allocation pool */
-static int target_free_working_area_restore(struct target *target, struct working_area *area, int restore)
+/* Return the area to the allocation pool, or to its pinned pool */
+int target_free_working_area(struct target *target, struct working_area *area)
 {
-	int retval = ERROR_OK;
+	if (area->free || area->idle)
+		return ERROR_OK;
 
-	if (area->free)
-		return retval;
+	/* mark user pointer invalid */
+	/* TODO: Is this really safe? It points to some previous caller's memory.
+	 * How could we know that the area pointer is still in that place and not
+	 * some other vital data? What's the purpose of this, anyway? */
+	*area->user = NULL;
+	area->user = NULL;
 
-	if (restore) {
-		retval = target_restore_working_area(target, area);
-		/* REVISIT: Perhaps the area should be freed even if restoring fails. */
-		if (retval != ERROR_OK)
-			return retval;
+	/* nothing may stay behind while the backup is written back */
+	if (area->pin && target->working_area_restoring)
+		target_unpin_working_area(area);
+
+	if (area->pin) {
+		/* keep the content around for the next user */
+		area->idle = true;
+		return ERROR_OK;
 	}
 
 	area->free = true;
@@ -2145,23 +2856,12 @@ static int target_free_working_area_restore(struct target *target, struct workin
 	LOG_DEBUG("freed %" PRIu32 " bytes of working area at address " TARGET_ADDR_FMT,
 			area->size, area->address);
 
-	/* mark user pointer invalid */
-	/* TODO: Is this really safe? It points to some previous caller's memory.
-	 * How could we know that the area pointer is still in that place and not
-	 * some other vital data? What's the purpose of this, anyway? */
-	*area->user = NULL;
-	area->user = NULL;
-
 	target_merge_working_areas(target);
 
 	print_wa_layout(target);
 
-	return retval;
-}
-
-int target_free_working_area(struct target *target, struct working_area *area)
-{
-	return target_free_working_area_restore(target, area, 1);
+	/* The backup, if any, is written back lazily, see target_save_working_area() */
+	return ERROR_OK;
 }
 
 /* free resources and restore memory, if restoring memory fails,
@@ -2173,18 +2873,24 @@ static void target_free_all_working_areas_restore(struct target *target, int res
 
 	LOG_DEBUG("freeing all working areas");
 
-	/* Loop through all areas, restoring the allocated ones and marking them as free */
+	/* Loop through all areas, marking the allocated and pinned ones as free */
 	while (c) {
 		if (!c->free) {
-			if (restore)
-				target_restore_working_area(target, c);
-			c->free = true;
-			*c->user = NULL; /* Same as above */
+			if (c->user)
+				*c->user = NULL; /* Same as above */
 			c->user = NULL;
+			if (c->pin)
+				target_release_pinned_working_area(c);
+			c->idle = false;
+			c->free = true;
 		}
 		c = c->next;
 	}
 
+	if (restore)
+		target_restore_working_area_range(target, 0, TARGET_ADDR_MAX);
+	target_drop_working_area_backup(target);
+
 	/* Run a merge pass to combine all areas into one */
 	target_merge_working_areas(target);
 
@@ -2198,7 +2904,6 @@ void target_free_all_working_areas(struct target *target)
 	/* Now we have none or only one working area marked as free */
 	if (target->working_areas) {
 		/* Free the last one to allow on-the-fly moving and resizing */
-		free(target->working_areas->backup);
 		free(target->working_areas);
 		target->working_areas = NULL;
 	}
@@ -2209,13 +2914,21 @@ uint32_t target_get_working_area_avail(struct target *target)
 {
 	struct working_area *c = target->working_areas;
 	uint32_t max_size = 0;
+	uint32_t run = 0;
 
 	if (c == NULL)
 		return target->working_area_size;
 
+	/* idle pinned areas are given up when memory runs short, so count
+	 * them as free space the way they'd be merged */
 	while (c) {
-		if (c->free && max_size < c->size)
-			max_size = c->size;
+		if (c->free || c->idle) {
+			run += c->size;
+			if (max_size < run)
+				max_size = run;
+		} else {
+			run = 0;
+		}
 
 		c = c->next;
 	}
@@ -2241,6 +2954,7 @@ static void target_destroy(struct target *target)
 	}
 
 	target_free_all_working_areas(target);
+	breakpoint_index_reset(target);
 
 	/* release the targets SMP list */
 	if (target->smp) {
@@ -2274,13 +2988,12 @@ void target_quit(void)
 	}
 	target_event_callbacks = NULL;
 
-	struct target_timer_callback *pt = target_timer_callbacks;
-	while (pt) {
-		struct target_timer_callback *t = pt->next;
-		free(pt);
-		pt = t;
-	}
-	target_timer_callbacks = NULL;
+	for (size_t i = 0; i < timer_heap_len; i++)
+		free(timer_heap[i]);
+	free(timer_heap);
+	timer_heap = NULL;
+	timer_heap_len = 0;
+	timer_heap_alloc = 0;
 
 	for (struct target *target = all_targets; target;) {
 		struct target *tmp;
@@ -2381,7 +3094,7 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 	LOG_DEBUG("writing buffer of %" PRIu32 " byte at " TARGET_ADDR_FMT,
 			  size, address);
 
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2397,9 +3110,33 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 		return ERROR_FAIL;
 	}
 
+	int retval = target_access_working_area(target, address, size, true);
+	if (retval != ERROR_OK)
+		return retval;
+
 	return target->type->write_buffer(target, address, size, buffer);
 }
 
+/* Bytes of the aligned middle part target_{read,write}_buffer_default() hand
+ * to a single read/write_memory call, ending on a multiple of
+ * buffer_chunk_size where possible so chunks line up with the transfer
+ * granularity the target or the user asked for. */
+static uint32_t target_buffer_chunk(struct target *target, target_addr_t address,
+		uint32_t length, uint32_t size)
+{
+	uint32_t max = target->buffer_chunk_size;
+
+	if (max < size)
+		return length;
+
+	uint32_t chunk = max - address % max;
+	chunk -= chunk % size;
+	if (chunk == 0)
+		chunk = size;
+
+	return MIN(chunk, length);
+}
+
 static int target_write_buffer_default(struct target *target,
 	target_addr_t address, uint32_t count, const uint8_t *buffer)
 {
@@ -2423,13 +3160,15 @@ static int target_write_buffer_default(struct target *target,
 	/* Write the data with as large access size as possible. */
 	for (; size > 0; size /= 2) {
 		uint32_t aligned = count - count % size;
-		if (aligned > 0) {
-			int retval = target_write_memory(target, address, size, aligned / size, buffer);
+		while (aligned > 0) {
+			uint32_t chunk = target_buffer_chunk(target, address, aligned, size);
+			int retval = target_write_memory(target, address, size, chunk / size, buffer);
 			if (retval != ERROR_OK)
 				return retval;
-			address += aligned;
-			count -= aligned;
-			buffer += aligned;
+			address += chunk;
+			count -= chunk;
+			buffer += chunk;
+			aligned -= chunk;
 		}
 	}
 
@@ -2445,7 +3184,7 @@ int target_read_buffer(struct target *target, target_addr_t address, uint32_t si
 	LOG_DEBUG("reading buffer of %" PRIu32 " byte at " TARGET_ADDR_FMT,
 			  size, address);
 
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2461,6 +3200,10 @@ int target_read_buffer(struct target *target, target_addr_t address, uint32_t si
 		return ERROR_FAIL;
 	}
 
+	int retval = target_access_working_area(target, address, size, false);
+	if (retval != ERROR_OK)
+		return retval;
+
 	return target->type->read_buffer(target, address, size, buffer);
 }
 
@@ -2486,13 +3229,15 @@ static int target_read_buffer_default(struct target *target, target_addr_t addre
 	/* Read the data with as large access size as possible. */
 	for (; size > 0; size /= 2) {
 		uint32_t aligned = count - count % size;
-		if (aligned > 0) {
-			int retval = target_read_memory(target, address, size, aligned / size, buffer);
+		while (aligned > 0) {
+			uint32_t chunk = target_buffer_chunk(target, address, aligned, size);
+			int retval = target_read_memory(target, address, size, chunk / size, buffer);
 			if (retval != ERROR_OK)
 				return retval;
-			address += aligned;
-			count -= aligned;
-			buffer += aligned;
+			address += chunk;
+			count -= chunk;
+			buffer += chunk;
+			aligned -= chunk;
 		}
 	}
 
@@ -2505,11 +3250,15 @@ int target_checksum_memory(struct target *target, target_addr_t address, uint32_
 	int retval;
 	uint32_t i;
 	uint32_t checksum = 0;
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
 
+	retval = target_access_working_area(target, address, size, false);
+	if (retval != ERROR_OK)
+		return retval;
+
 	retval = target->type->checksum_memory(target, address, size, &checksum);
 	if (retval != ERROR_OK) {
 		buffer = malloc(size);
@@ -2539,11 +3288,129 @@ int target_checksum_memory(struct target *target, target_addr_t address, uint32_
 	return retval;
 }
 
+bool target_memory_matches(struct target *target,
+		target_addr_t address, uint32_t size, const uint8_t *buffer)
+{
+	uint32_t target_crc, image_crc;
+
+	if (target_checksum_memory(target, address, size, &target_crc) != ERROR_OK)
+		return false;
+	if (image_calculate_checksum(buffer, size, &image_crc) != ERROR_OK)
+		return false;
+
+	return target_crc == image_crc;
+}
+
+/* Chunk size for delta writes. Large enough that downloading the checksum
+ * algorithm for every chunk costs little. */
+#define DELTA_CHUNK_SIZE	(64 * 1024)
+
+int target_write_buffer_delta(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *buffer, uint32_t *written)
+{
+	for (uint32_t offset = 0; offset < size; offset += DELTA_CHUNK_SIZE) {
+		uint32_t length = MIN(DELTA_CHUNK_SIZE, size - offset);
+
+		if (target_memory_matches(target, address + offset, length, buffer + offset))
+			continue;
+
+		int retval = target_write_buffer(target, address + offset, length,
+				buffer + offset);
+		if (retval != ERROR_OK)
+			return retval;
+		if (written)
+			*written += length;
+	}
+
+	return ERROR_OK;
+}
+
+/* Working area for the compressed data of one chunk. Each chunk holds up
+ * to 4 times as much raw data, less if it doesn't compress that well. */
+#define COMPRESS_STAGING_SIZE	(16 * 1024)
+/* Sections smaller than this are written as they are */
+#define COMPRESS_STAGING_MIN	1024
+
+int target_write_buffer_compressed(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *buffer)
+{
+	struct working_area *staging = NULL;
+	uint32_t staging_size = MIN(size, COMPRESS_STAGING_SIZE);
+
+	if (target->type->decompress_memory) {
+		/* leave room for the decompressor itself */
+		uint32_t avail = target_get_working_area_avail(target);
+		staging_size = MIN(staging_size, avail > 512 ? avail - 512 : 0);
+		if (staging_size >= COMPRESS_STAGING_MIN &&
+				target_alloc_working_area(target, staging_size, &staging) != ERROR_OK)
+			staging = NULL;
+	}
+
+	/* the decompressor mustn't overwrite its own input */
+	if (staging && address < staging->address + staging->size &&
+			staging->address < address + size) {
+		target_free_working_area(target, staging);
+		staging = NULL;
+	}
+
+	if (!staging)
+		return target_write_buffer(target, address, size, buffer);
+
+	uint8_t *packed = malloc(staging_size);
+	if (!packed) {
+		target_free_working_area(target, staging);
+		return ERROR_FAIL;
+	}
+
+	int retval = ERROR_OK;
+	bool decompress = true;
+	uint32_t offset = 0;
+	while (offset < size) {
+		uint32_t length = MIN(size - offset, 4 * staging_size);
+		size_t packed_size = 0;
+
+		while (decompress) {
+			packed_size = lz4_compress_block(buffer + offset, length,
+					packed, staging_size);
+			if (packed_size && packed_size < length)
+				break;
+			packed_size = 0;
+			if (length <= staging_size)
+				break;
+			length /= 2;
+		}
+
+		if (packed_size) {
+			retval = target_write_buffer(target, staging->address, packed_size, packed);
+			if (retval == ERROR_OK)
+				retval = target->type->decompress_memory(target, staging->address,
+						packed_size, address + offset, length);
+			if (retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE) {
+				LOG_DEBUG("no room to decompress on the target, writing uncompressed");
+				decompress = false;
+				continue;
+			}
+		} else {
+			retval = target_write_buffer(target, address + offset, length,
+					buffer + offset);
+		}
+		if (retval != ERROR_OK)
+			break;
+
+		offset += length;
+	}
+
+	free(packed);
+	target_free_working_area(target, staging);
+
+	return retval;
+}
+
 int target_blank_check_memory(struct target *target,
 	struct target_memory_check_block *blocks, int num_blocks,
 	uint8_t erased_value)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2554,10 +3421,99 @@ int target_blank_check_memory(struct target *target,
 	return target->type->blank_check_memory(target, blocks, num_blocks, erased_value);
 }
 
+/* Search [start, end) on the target, if there's room for a match */
+static int target_search_memory_range(struct target *target,
+		target_addr_t start, target_addr_t end, const uint8_t *pattern,
+		uint32_t pattern_size, target_addr_t *found_address, bool *found)
+{
+	if (end <= start || end - start < pattern_size)
+		return ERROR_OK;
+
+	return target->type->search_memory(target, start, end - start, pattern,
+			pattern_size, found_address, found);
+}
+
+int target_search_memory(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *pattern, uint32_t pattern_size,
+		target_addr_t *found_address, bool *found)
+{
+	struct working_area *area;
+	int retval;
+
+	*found = false;
+
+	if (!target_examined_on_use(target)) {
+		LOG_ERROR("Target not examined yet");
+		return ERROR_FAIL;
+	}
+
+	if (target->type->search_memory == NULL)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	if (target->state != TARGET_HALTED)
+		return ERROR_TARGET_NOT_HALTED;
+
+	if (pattern_size == 0 || size < pattern_size)
+		return ERROR_OK;
+
+	/* settle where the working area is */
+	if (target->working_areas == NULL) {
+		if (target_alloc_working_area_try(target, 4, &area) != ERROR_OK)
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		target_free_working_area(target, area);
+	}
+
+	target_addr_t end = address + size;
+	target_addr_t area_start = target->working_area;
+	target_addr_t area_end = area_start + target->working_area_size;
+
+	if (area_end <= address || area_start >= end)
+		return target_search_memory_range(target, address, end, pattern,
+				pattern_size, found_address, found);
+
+	/* The algorithm would see its own code and data there rather than what
+	 * the working area backup holds, so read that part, plus enough on
+	 * either side for matches across its edges. */
+	retval = target_search_memory_range(target, address, area_start,
+			pattern, pattern_size, found_address, found);
+	if (retval != ERROR_OK || *found)
+		return retval;
+
+	target_addr_t start = address;
+	if (area_start > address && area_start - address >= pattern_size)
+		start = area_start - (pattern_size - 1);
+	target_addr_t stop = MIN(end, area_end + pattern_size - 1);
+	uint32_t length = stop - start;
+
+	uint8_t *buffer = malloc(length);
+	if (buffer == NULL) {
+		LOG_ERROR("error allocating buffer for section (%" PRIu32 " bytes)", length);
+		return ERROR_FAIL;
+	}
+
+	retval = target_read_buffer(target, start, length, buffer);
+	if (retval == ERROR_OK) {
+		for (uint32_t i = 0; i + pattern_size <= length; i++) {
+			if (memcmp(buffer + i, pattern, pattern_size) == 0) {
+				*found_address = start + i;
+				*found = true;
+				break;
+			}
+		}
+	}
+	free(buffer);
+
+	if (retval != ERROR_OK || *found)
+		return retval;
+
+	return target_search_memory_range(target, area_end, end, pattern,
+			pattern_size, found_address, found);
+}
+
 int target_read_u64(struct target *target, target_addr_t address, uint64_t *value)
 {
 	uint8_t value_buf[8];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2581,7 +3537,7 @@ int target_read_u64(struct target *target, target_addr_t address, uint64_t *valu
 int target_read_u32(struct target *target, target_addr_t address, uint32_t *value)
 {
 	uint8_t value_buf[4];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2605,7 +3561,7 @@ int target_read_u32(struct target *target, target_addr_t address, uint32_t *valu
 int target_read_u16(struct target *target, target_addr_t address, uint16_t *value)
 {
 	uint8_t value_buf[2];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2628,7 +3584,7 @@ int target_read_u16(struct target *target, target_addr_t address, uint16_t *valu
 
 int target_read_u8(struct target *target, target_addr_t address, uint8_t *value)
 {
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2652,7 +3608,7 @@ int target_write_u64(struct target *target, target_addr_t address, uint64_t valu
 {
 	int retval;
 	uint8_t value_buf[8];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2673,7 +3629,7 @@ int target_write_u32(struct target *target, target_addr_t address, uint32_t valu
 {
 	int retval;
 	uint8_t value_buf[4];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2694,7 +3650,7 @@ int target_write_u16(struct target *target, target_addr_t address, uint16_t valu
 {
 	int retval;
 	uint8_t value_buf[2];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2714,7 +3670,7 @@ int target_write_u16(struct target *target, target_addr_t address, uint16_t valu
 int target_write_u8(struct target *target, target_addr_t address, uint8_t value)
 {
 	int retval;
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2733,7 +3689,7 @@ int target_write_phys_u64(struct target *target, target_addr_t address, uint64_t
 {
 	int retval;
 	uint8_t value_buf[8];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2754,7 +3710,7 @@ int target_write_phys_u32(struct target *target, target_addr_t address, uint32_t
 {
 	int retval;
 	uint8_t value_buf[4];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2775,7 +3731,7 @@ int target_write_phys_u16(struct target *target, target_addr_t address, uint16_t
 {
 	int retval;
 	uint8_t value_buf[2];
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2795,7 +3751,7 @@ int target_write_phys_u16(struct target *target, target_addr_t address, uint16_t
 int target_write_phys_u8(struct target *target, target_addr_t address, uint8_t value)
 {
 	int retval;
-	if (!target_was_examined(target)) {
+	if (!target_examined_on_use(target)) {
 		LOG_ERROR("Target not examined yet");
 		return ERROR_FAIL;
 	}
@@ -2823,6 +3779,10 @@ static int find_target(struct command_invocation *cmd, const char *name)
 			 target->tap->dotted_name);
 		return ERROR_FAIL;
 	}
+	if (target->session && target->session != cmd->ctx) {
+		command_print(cmd, "Target: %s is claimed by another session\n", name);
+		return ERROR_FAIL;
+	}
 
 	cmd->ctx->current_target = target;
 	if (cmd->ctx->current_target_override)
@@ -2992,6 +3952,11 @@ static int handle_target(void *priv)
 		recursive = 0;
 	}
 
+	/* SMP groups whose target type polls them as a whole are polled
+	 * through their first member that is due, once per round. */
+	static unsigned int poll_round;
+	poll_round++;
+
 	/* Poll targets for state changes unless that's globally disabled.
 	 * Skip targets that are currently disabled.
 	 */
@@ -3012,6 +3977,14 @@ static int handle_target(void *priv)
 		}
 		target->backoff.count = 0;
 
+		if (target->smp && target->type->poll_smp) {
+			if (target->poll_round == poll_round)
+				continue;
+			struct target_list *head;
+			foreach_smp_target(head, target->head)
+				head->target->poll_round = poll_round;
+		}
+
 		/* only poll target if we've got power and srst isn't asserted */
 		if (!powerDropout && !srstAsserted) {
 			/* polling may fail silently until the target has been examined */
@@ -3061,6 +4034,7 @@ COMMAND_HANDLER(handle_reg_command)
 	LOG_DEBUG("-");
 
 	target = get_current_target(CMD_CTX);
+	target_batch_sync(target);
 
 	/* list all available registers for the current target */
 	if (CMD_ARGC == 0) {
@@ -3323,7 +4297,15 @@ COMMAND_HANDLER(handle_reset_command)
 		reset_mode = n->value;
 	}
 
-	/* reset *all* targets */
+	/* reset *all* targets, which other sessions wouldn't expect */
+	for (struct target *target = all_targets; target; target = target->next) {
+		if (target->session && target->session != CMD_CTX) {
+			command_print(CMD, "Target %s is claimed by another session",
+					target_name(target));
+			return ERROR_FAIL;
+		}
+	}
+
 	return target_process_reset(CMD, reset_mode);
 }
 
@@ -3434,6 +4416,158 @@ void target_handle_md_output(struct command_invocation *cmd,
 	}
 }
 
+/* A memory access queued by an md or mw command inside "$target batch" */
+struct target_batch_op {
+	bool write;
+	bool physical;
+	target_addr_t address;
+	uint32_t size;
+	uint32_t count;
+	uint8_t *buffer;
+};
+
+struct target_batch {
+	/* the batch command, which md output and errors are reported to */
+	struct command_invocation *cmd;
+	struct target_batch_op *ops;
+	unsigned int num_ops;
+	unsigned int max_ops;
+	/* set while the queued ops are being done */
+	bool running;
+	/* what the first failed op returned */
+	int retval;
+};
+
+static int target_batch_queue(struct target *target, bool write, bool physical,
+		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
+{
+	struct target_batch *batch = target->batch;
+	if (batch->num_ops == batch->max_ops) {
+		unsigned int max_ops = batch->max_ops ? 2 * batch->max_ops : 32;
+		struct target_batch_op *ops = realloc(batch->ops, max_ops * sizeof(*ops));
+		if (!ops) {
+			LOG_ERROR("Out of memory");
+			free(buffer);
+			return ERROR_FAIL;
+		}
+		batch->ops = ops;
+		batch->max_ops = max_ops;
+	}
+
+	batch->ops[batch->num_ops++] = (struct target_batch_op) {
+		.write = write,
+		.physical = physical,
+		.address = address,
+		.size = size,
+		.count = count,
+		.buffer = buffer,
+	};
+	return ERROR_OK;
+}
+
+static void target_batch_report(struct target *target,
+		const struct target_batch_op *op, int retval)
+{
+	struct target_batch *batch = target->batch;
+	if (retval != ERROR_OK) {
+		command_print(batch->cmd, "%s of %" PRIu32 " x %" PRIu32 " bytes at "
+				TARGET_ADDR_FMT " failed", op->write ? "write" : "read",
+				op->count, op->size, op->address);
+		if (batch->retval == ERROR_OK)
+			batch->retval = retval;
+	} else if (!op->write) {
+		target_handle_md_output(batch->cmd, target, op->address, op->size,
+				op->count, op->buffer, true);
+	}
+}
+
+/* Do the queued ops in order. Runs of reads and runs of writes each go to
+ * the target as one batch; when one of those fails, its ops are done again
+ * one at a time to find out which of them failed. */
+static int target_batch_run(struct target *target)
+{
+	struct target_batch *batch = target->batch;
+	batch->running = true;
+
+	unsigned int i = 0;
+	while (i < batch->num_ops) {
+		struct target_batch_op *op = &batch->ops[i];
+		unsigned int n = 1;
+		int retval;
+
+		if (op->physical) {
+			if (op->write)
+				retval = target_write_phys_memory(target, op->address, op->size,
+						op->count, op->buffer);
+			else
+				retval = target_read_phys_memory(target, op->address, op->size,
+						op->count, op->buffer);
+			target_batch_report(target, op, retval);
+			i++;
+			continue;
+		}
+
+		while (i + n < batch->num_ops && !op[n].physical && op[n].write == op->write)
+			n++;
+
+		if (op->write) {
+			struct target_memory_write *writes = calloc(n, sizeof(*writes));
+			if (!writes) {
+				LOG_ERROR("Out of memory");
+				retval = ERROR_FAIL;
+			} else {
+				for (unsigned int j = 0; j < n; j++)
+					writes[j] = (struct target_memory_write) {
+						op[j].address, op[j].size, op[j].count, op[j].buffer
+					};
+				retval = target_write_memory_batch(target, writes, n);
+				free(writes);
+			}
+		} else {
+			struct target_memory_read *reads = calloc(n, sizeof(*reads));
+			if (!reads) {
+				LOG_ERROR("Out of memory");
+				retval = ERROR_FAIL;
+			} else {
+				for (unsigned int j = 0; j < n; j++)
+					reads[j] = (struct target_memory_read) {
+						op[j].address, op[j].size, op[j].count, op[j].buffer
+					};
+				retval = target_read_memory_batch(target, reads, n);
+				free(reads);
+			}
+		}
+
+		for (unsigned int j = 0; j < n; j++) {
+			int op_retval = retval;
+			if (retval != ERROR_OK && n > 1) {
+				if (op[j].write)
+					op_retval = target_write_memory(target, op[j].address,
+							op[j].size, op[j].count, op[j].buffer);
+				else
+					op_retval = target_read_memory(target, op[j].address,
+							op[j].size, op[j].count, op[j].buffer);
+			}
+			target_batch_report(target, &op[j], op_retval);
+		}
+		i += n;
+	}
+
+	for (i = 0; i < batch->num_ops; i++)
+		free(batch->ops[i].buffer);
+	batch->num_ops = 0;
+	batch->running = false;
+	return batch->retval;
+}
+
+/* Do what "$target batch" queued so far before anything else accesses the
+ * target, so that everything still happens in script order. */
+static void target_batch_sync(struct target *target)
+{
+	if (target->batch && !target->batch->running)
+		target_batch_run(target);
+}
+
 COMMAND_HANDLER(handle_md_command)
 {
 	if (CMD_ARGC < 1)
@@ -3483,6 +4617,10 @@ COMMAND_HANDLER(handle_md_command)
 	}
 
 	struct target *target = get_current_target(CMD_CTX);
+	if (target->batch && !target->batch->running)
+		return target_batch_queue(target, false, physical, address, size,
+				count, buffer);
+
 	int retval = fn(target, address, size, count, buffer);
 	if (ERROR_OK == retval)
 		target_handle_md_output(CMD, target, address, size, count, buffer,
@@ -3596,9 +4734,70 @@ COMMAND_HANDLER(handle_mw_command)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 	}
 
+	if (target->batch && !target->batch->running) {
+		uint8_t *buffer = malloc(wordsize * count);
+		if (!buffer) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		for (unsigned i = 0; i < count; i++) {
+			switch (wordsize) {
+			case 8:
+				target_buffer_set_u64(target, buffer + i * wordsize, value);
+				break;
+			case 4:
+				target_buffer_set_u32(target, buffer + i * wordsize, value);
+				break;
+			case 2:
+				target_buffer_set_u16(target, buffer + i * wordsize, value);
+				break;
+			case 1:
+				buffer[i] = value;
+				break;
+			}
+		}
+		return target_batch_queue(target, true, physical, address, wordsize,
+				count, buffer);
+	}
+
 	return target_fill_mem(target, address, fn, wordsize, value, count);
 }
 
+COMMAND_HANDLER(handle_target_batch_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target *target = get_current_target(CMD_CTX);
+	if (target->batch) {
+		command_print(CMD, "%s is already in a batch", target_name(target));
+		return ERROR_FAIL;
+	}
+
+	struct target_batch batch = {
+		.cmd = CMD,
+		.retval = ERROR_OK,
+	};
+	target->batch = &batch;
+
+	Jim_Interp *interp = CMD_CTX->interp;
+	int jim_retval = Jim_Eval(interp, CMD_ARGV[0]);
+	if (jim_retval != JIM_OK) {
+		Jim_MakeErrorMessage(interp);
+		command_print(CMD, "%s", Jim_GetString(Jim_GetResult(interp), NULL));
+	}
+
+	/* what was queued before an error is still done, as it would have
+	 * been without the batch */
+	int retval = target_batch_run(target);
+	target->batch = NULL;
+	free(batch.ops);
+
+	if (jim_retval != JIM_OK)
+		return ERROR_FAIL;
+	return retval;
+}
+
 static COMMAND_HELPER(parse_load_image_command_CMD_ARGV, struct image *image,
 		target_addr_t *min_address, target_addr_t *max_address)
 {
@@ -3631,6 +4830,9 @@ static COMMAND_HELPER(parse_load_image_command_CMD_ARGV, struct image *image,
 	return ERROR_OK;
 }
 
+/* Largest run of adjacent image sections load_image writes at once */
+#define LOAD_IMAGE_MAX_RUN	(4 * 1024 * 1024)
+
 COMMAND_HANDLER(handle_load_image_command)
 {
 	uint8_t *buffer;
@@ -3639,6 +4841,19 @@ COMMAND_HANDLER(handle_load_image_command)
 	target_addr_t min_address = 0;
 	target_addr_t max_address = -1;
 	struct image image;
+	bool delta = false;
+	bool compress = false;
+	uint32_t written = 0;
+
+	if (CMD_ARGC > 0 && strcmp(CMD_ARGV[0], "-delta") == 0) {
+		delta = true;
+		CMD_ARGV++;
+		CMD_ARGC--;
+	} else if (CMD_ARGC > 0 && strcmp(CMD_ARGV[0], "-compress") == 0) {
+		compress = true;
+		CMD_ARGV++;
+		CMD_ARGC--;
+	}
 
 	int retval = CALL_COMMAND_HANDLER(parse_load_image_command_CMD_ARGV,
 			&image, &min_address, &max_address);
@@ -3655,17 +4870,42 @@ COMMAND_HANDLER(handle_load_image_command)
 
 	image_size = 0x0;
 	retval = ERROR_OK;
-	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
+	for (unsigned int i = 0; i < image.num_sections; ) {
+		/* Sections that follow each other in memory (.text, .rodata, .data,
+		 * or many of them with -ffunction-sections) are written together. */
+		target_addr_t base_address = image.sections[i].base_address;
+		uint32_t run_size = image.sections[i].size;
+		unsigned int run_end = i + 1;
+		while (run_end < image.num_sections &&
+				image.sections[run_end].base_address == base_address + run_size &&
+				run_size + image.sections[run_end].size <= LOAD_IMAGE_MAX_RUN) {
+			run_size += image.sections[run_end].size;
+			run_end++;
+		}
+
+		buffer = malloc(run_size);
 		if (buffer == NULL) {
 			command_print(CMD,
 						  "error allocating buffer for section (%d bytes)",
-						  (int)(image.sections[i].size));
+						  (int)run_size);
 			retval = ERROR_FAIL;
 			break;
 		}
 
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
+		buf_cnt = 0;
+		for (; i < run_end; i++) {
+			size_t section_cnt;
+			retval = image_read_section(&image, i, 0x0, image.sections[i].size,
+					buffer + buf_cnt, &section_cnt);
+			if (retval != ERROR_OK)
+				break;
+			buf_cnt += section_cnt;
+			if (section_cnt != image.sections[i].size) {
+				/* short section, the next one doesn't follow on */
+				i++;
+				break;
+			}
+		}
 		if (retval != ERROR_OK) {
 			free(buffer);
 			break;
@@ -3676,20 +4916,31 @@ COMMAND_HANDLER(handle_load_image_command)
 
 		/* DANGER!!! beware of unsigned comparison here!!! */
 
-		if ((image.sections[i].base_address + buf_cnt >= min_address) &&
-				(image.sections[i].base_address < max_address)) {
+		if ((base_address + buf_cnt >= min_address) &&
+				(base_address < max_address)) {
 
-			if (image.sections[i].base_address < min_address) {
+			if (base_address < min_address) {
 				/* clip addresses below */
-				offset += min_address-image.sections[i].base_address;
+				offset += min_address-base_address;
 				length -= offset;
 			}
 
-			if (image.sections[i].base_address + buf_cnt > max_address)
-				length -= (image.sections[i].base_address + buf_cnt)-max_address;
-
-			retval = target_write_buffer(target,
-					image.sections[i].base_address + offset, length, buffer + offset);
+			if (base_address + buf_cnt > max_address)
+				length -= (base_address + buf_cnt)-max_address;
+
+			if (delta) {
+				uint32_t section_written = 0;
+				retval = target_write_buffer_delta(target,
+						base_address + offset, length,
+						buffer + offset, &section_written);
+				written += section_written;
+			} else if (compress) {
+				retval = target_write_buffer_compressed(target,
+						base_address + offset, length, buffer + offset);
+			} else {
+				retval = target_write_buffer(target,
+						base_address + offset, length, buffer + offset);
+			}
 			if (retval != ERROR_OK) {
 				free(buffer);
 				break;
@@ -3697,7 +4948,7 @@ COMMAND_HANDLER(handle_load_image_command)
 			image_size += length;
 			command_print(CMD, "%u bytes written at address " TARGET_ADDR_FMT "",
 					(unsigned int)length,
-					image.sections[i].base_address + offset);
+					base_address + offset);
 		}
 
 		free(buffer);
@@ -3708,6 +4959,9 @@ COMMAND_HANDLER(handle_load_image_command)
 				"in %fs (%0.3f KiB/s)", image_size,
 				duration_elapsed(&bench), duration_kbps(&bench, image_size));
 	}
+	if (ERROR_OK == retval && delta)
+		command_print(CMD, "%" PRIu32 " of %" PRIu32 " bytes differed and were written",
+				written, image_size);
 
 	image_close(&image);
 
@@ -3715,6 +4969,14 @@ COMMAND_HANDLER(handle_load_image_command)
 
 }
 
+/* dump_image reads in chunks that grow while the target answers quickly,
+ * so large dumps don't pay the per-read setup every 4 KiB, and shrink again
+ * when a chunk takes long enough to hold up the GDB keep-alive */
+#define DUMP_IMAGE_MIN_CHUNK	4096
+#define DUMP_IMAGE_MAX_CHUNK	(1024 * 1024)
+#define DUMP_IMAGE_FAST_MS	100
+#define DUMP_IMAGE_SLOW_MS	500
+
 COMMAND_HANDLER(handle_dump_image_command)
 {
 	struct fileio *fileio;
@@ -3730,7 +4992,7 @@ COMMAND_HANDLER(handle_dump_image_command)
 	COMMAND_PARSE_ADDRESS(CMD_ARGV[1], address);
 	COMMAND_PARSE_ADDRESS(CMD_ARGV[2], size);
 
-	uint32_t buf_size = (size > 4096) ? 4096 : size;
+	uint32_t buf_size = (size > DUMP_IMAGE_MAX_CHUNK) ? DUMP_IMAGE_MAX_CHUNK : size;
 	buffer = malloc(buf_size);
 	if (!buffer)
 		return ERROR_FAIL;
@@ -3743,12 +5005,15 @@ COMMAND_HANDLER(handle_dump_image_command)
 
 	duration_start(&bench);
 
+	uint32_t chunk_size = DUMP_IMAGE_MIN_CHUNK;
 	while (size > 0) {
 		size_t size_written;
-		uint32_t this_run_size = (size > buf_size) ? buf_size : size;
+		uint32_t this_run_size = (size > chunk_size) ? chunk_size : size;
+		int64_t start = timeval_ms();
 		retval = target_read_buffer(target, address, this_run_size, buffer);
 		if (retval != ERROR_OK)
 			break;
+		int64_t elapsed = timeval_ms() - start;
 
 		retval = fileio_write(fileio, this_run_size, buffer, &size_written);
 		if (retval != ERROR_OK)
@@ -3756,6 +5021,12 @@ COMMAND_HANDLER(handle_dump_image_command)
 
 		size -= this_run_size;
 		address += this_run_size;
+
+		if (elapsed < DUMP_IMAGE_FAST_MS && chunk_size < buf_size)
+			chunk_size = MIN(chunk_size * 2, buf_size);
+		else if (elapsed > DUMP_IMAGE_SLOW_MS && chunk_size > DUMP_IMAGE_MIN_CHUNK)
+			chunk_size /= 2;
+		keep_alive();
 	}
 
 	free(buffer);
@@ -4045,6 +5316,118 @@ COMMAND_HANDLER(handle_bp_command)
 	}
 }
 
+COMMAND_HANDLER(handle_bp_set_load_command)
+{
+	uint32_t length = 4;
+	bool once = false;
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	for (unsigned int i = 1; i < CMD_ARGC; i++) {
+		if (!strcmp(CMD_ARGV[i], "once"))
+			once = true;
+		else
+			COMMAND_PARSE_NUMBER(u32, CMD_ARGV[i], length);
+	}
+
+	struct target *target = get_current_target(CMD_CTX);
+	struct fileio *fileio;
+	int retval = fileio_open(&fileio, CMD_ARGV[0], FILEIO_READ, FILEIO_TEXT);
+	if (retval != ERROR_OK)
+		return retval;
+
+	struct duration bench;
+	duration_start(&bench);
+
+	/* one breakpoint per line: address [length], '#' starts a comment */
+	char line[128];
+	unsigned int line_number = 0, added = 0;
+	while (fileio_fgets(fileio, sizeof(line), line) == ERROR_OK) {
+		line_number++;
+		char *p = line;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		char *end;
+		target_addr_t address = strtoull(p, &end, 0);
+		uint32_t bp_length = length;
+		if (end != p && isspace((unsigned char)*end)) {
+			p = end;
+			while (isspace((unsigned char)*p))
+				p++;
+			if (*p != '\0' && *p != '#')
+				bp_length = strtoul(p, &end, 0);
+		}
+		if (end == p || (*end != '\0' && *end != '#' && !isspace((unsigned char)*end))) {
+			LOG_ERROR("%s:%u: expected an address and optional length",
+					CMD_ARGV[0], line_number);
+			retval = ERROR_COMMAND_ARGUMENT_INVALID;
+			break;
+		}
+
+		retval = breakpoint_set_add(target, address, bp_length, once);
+		if (retval != ERROR_OK)
+			break;
+		added++;
+	}
+	fileio_close(fileio);
+
+	if (duration_measure(&bench) == ERROR_OK)
+		command_print(CMD, "added %u breakpoints in %fs", added,
+				duration_elapsed(&bench));
+	return retval;
+}
+
+COMMAND_HANDLER(handle_bp_set_clear_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target *target = get_current_target(CMD_CTX);
+	command_print(CMD, "removed %u breakpoints", breakpoint_set_remove(target));
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_bp_set_hits_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target *target = get_current_target(CMD_CTX);
+	unsigned int count;
+	const target_addr_t *hits = breakpoint_set_hits(target, &count);
+	for (unsigned int i = 0; i < count; i++)
+		command_print(CMD, TARGET_ADDR_FMT, hits[i]);
+	return ERROR_OK;
+}
+
+static const struct command_registration bp_set_command_handlers[] = {
+	{
+		.name = "load",
+		.handler = handle_bp_set_load_command,
+		.mode = COMMAND_EXEC,
+		.help = "add a software breakpoint at each address listed in a file",
+		.usage = "filename [length] ['once']",
+	},
+	{
+		.name = "clear",
+		.handler = handle_bp_set_clear_command,
+		.mode = COMMAND_EXEC,
+		.help = "remove all breakpoints added by 'bp_set load'",
+		.usage = "",
+	},
+	{
+		.name = "hits",
+		.handler = handle_bp_set_hits_command,
+		.mode = COMMAND_EXEC,
+		.help = "list the 'once' breakpoints that were hit, in order",
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
 COMMAND_HANDLER(handle_rbp_command)
 {
 	if (CMD_ARGC != 1)
@@ -4781,6 +6164,117 @@ static int target_array2mem(Jim_Interp *interp, struct target *target,
 	return e;
 }
 
+/* Reads @a count bytes at @a address into one binary Tcl string. Unlike
+ * mem2array this builds a single object however large the read. */
+static int target_mem2bin(Jim_Interp *interp, struct target *target,
+		int argc, Jim_Obj *const *argv)
+{
+	jim_wide addr, count;
+
+	if (argc != 2) {
+		Jim_WrongNumArgs(interp, 0, argv, "addr count");
+		return JIM_ERR;
+	}
+	if (Jim_GetWide(interp, argv[0], &addr) != JIM_OK ||
+			Jim_GetWide(interp, argv[1], &count) != JIM_OK)
+		return JIM_ERR;
+	if (count <= 0 || count > INT_MAX) {
+		Jim_SetResultString(interp, "mem2bin: invalid count", -1);
+		return JIM_ERR;
+	}
+	if ((target_addr_t)addr + count - 1 < (target_addr_t)addr) {
+		Jim_SetResultString(interp, "mem2bin: addr + count - wraps to zero?", -1);
+		return JIM_ERR;
+	}
+
+	char *buffer = Jim_Alloc(count + 1);
+	int retval = target_read_buffer(target, addr, count, (uint8_t *)buffer);
+	if (retval != ERROR_OK) {
+		Jim_Free(buffer);
+		Jim_SetResultString(interp, "mem2bin: cannot read memory", -1);
+		return JIM_ERR;
+	}
+	buffer[count] = 0;
+
+	Jim_SetResult(interp, Jim_NewStringObjNoAlloc(interp, buffer, count));
+	return JIM_OK;
+}
+
+static int target_bin2mem(Jim_Interp *interp, struct target *target,
+		int argc, Jim_Obj *const *argv)
+{
+	jim_wide addr;
+	int len;
+
+	if (argc != 2) {
+		Jim_WrongNumArgs(interp, 0, argv, "addr data");
+		return JIM_ERR;
+	}
+	if (Jim_GetWide(interp, argv[0], &addr) != JIM_OK)
+		return JIM_ERR;
+	const char *data = Jim_GetString(argv[1], &len);
+	if (len == 0)
+		return JIM_OK;
+	if ((target_addr_t)addr + len - 1 < (target_addr_t)addr) {
+		Jim_SetResultString(interp, "bin2mem: addr + len - wraps to zero?", -1);
+		return JIM_ERR;
+	}
+
+	int retval = target_write_buffer(target, addr, len, (const uint8_t *)data);
+	if (retval != ERROR_OK) {
+		Jim_SetResultString(interp, "bin2mem: cannot write memory", -1);
+		return JIM_ERR;
+	}
+	return JIM_OK;
+}
+
+static int jim_mem2bin(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
+{
+	struct command_context *context = current_command_context(interp);
+	struct target *target = get_current_target(context);
+	if (target == NULL) {
+		LOG_ERROR("mem2bin: no current target");
+		return JIM_ERR;
+	}
+	return target_mem2bin(interp, target, argc - 1, argv + 1);
+}
+
+static int jim_bin2mem(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
+{
+	struct command_context *context = current_command_context(interp);
+	struct target *target = get_current_target(context);
+	if (target == NULL) {
+		LOG_ERROR("bin2mem: no current target");
+		return JIM_ERR;
+	}
+	return target_bin2mem(interp, target, argc - 1, argv + 1);
+}
+
+/* Offset of the first byte where two binary strings differ, -1 if they
+ * are equal. A shorter string differs where it ends. */
+static int jim_bin_compare(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
+{
+	int len1, len2;
+
+	if (argc != 3) {
+		Jim_WrongNumArgs(interp, 1, argv, "data1 data2");
+		return JIM_ERR;
+	}
+	const char *data1 = Jim_GetString(argv[1], &len1);
+	const char *data2 = Jim_GetString(argv[2], &len2);
+
+	int len = MIN(len1, len2);
+	jim_wide offset = -1;
+	if (memcmp(data1, data2, len) != 0) {
+		for (offset = 0; data1[offset] == data2[offset]; offset++)
+			;
+	} else if (len1 != len2)
+		offset = len;
+
+	Jim_SetResult(interp, Jim_NewIntObj(interp, offset));
+	return JIM_OK;
+}
+
 /* FIX? should we propagate errors here rather than printing them
  * and continuing?
  */
@@ -4789,6 +6283,9 @@ void target_handle_event(struct target *target, enum target_event e)
 	struct target_event_action *teap;
 	int retval;
 
+	if (!target_has_event_action(target, e))
+		return;
+
 	for (teap = target->event_action; teap != NULL; teap = teap->next) {
 		if (teap->event == e) {
 			LOG_DEBUG("target(%d): %s (%s) event: %d (%s) action: %s",
@@ -4835,13 +6332,7 @@ void target_handle_event(struct target *target, enum target_event e)
  */
 bool target_has_event_action(struct target *target, enum target_event event)
 {
-	struct target_event_action *teap;
-
-	for (teap = target->event_action; teap != NULL; teap = teap->next) {
-		if (teap->event == event)
-			return true;
-	}
-	return false;
+	return target->event_action_mask & (1ull << event);
 }
 
 enum target_cfg_param {
@@ -4857,8 +6348,10 @@ enum target_cfg_param {
 	TCFG_DBGBASE,
 	TCFG_RTOS,
 	TCFG_DEFER_EXAMINE,
+	TCFG_EXAMINE_ON_DEMAND,
 	TCFG_GDB_PORT,
 	TCFG_GDB_MAX_CONNECTIONS,
+	TCFG_BUFFER_CHUNK_SIZE,
 };
 
 static Jim_Nvp nvp_config_opts[] = {
@@ -4874,8 +6367,10 @@ static Jim_Nvp nvp_config_opts[] = {
 	{ .name = "-dbgbase",          .value = TCFG_DBGBASE },
 	{ .name = "-rtos",             .value = TCFG_RTOS },
 	{ .name = "-defer-examine",    .value = TCFG_DEFER_EXAMINE },
+	{ .name = "-examine-on-demand", .value = TCFG_EXAMINE_ON_DEMAND },
 	{ .name = "-gdb-port",         .value = TCFG_GDB_PORT },
 	{ .name = "-gdb-max-connections",   .value = TCFG_GDB_MAX_CONNECTIONS },
+	{ .name = "-buffer-chunk-size",   .value = TCFG_BUFFER_CHUNK_SIZE },
 	{ .name = NULL, .value = -1 }
 };
 
@@ -4994,6 +6489,7 @@ no_params:
 						/* add to head of event list */
 						teap->next = target->event_action;
 						target->event_action = teap;
+						target->event_action_mask |= 1ull << teap->event;
 					}
 					Jim_SetEmptyResult(goi->interp);
 				} else {
@@ -5163,6 +6659,12 @@ no_params:
 			/* loop for more */
 			break;
 
+		case TCFG_EXAMINE_ON_DEMAND:
+			target->defer_examine = true;
+			target->examine_on_demand = true;
+			/* loop for more */
+			break;
+
 		case TCFG_GDB_PORT:
 			if (goi->isconfigure) {
 				struct command_context *cmd_ctx = current_command_context(goi->interp);
@@ -5203,6 +6705,19 @@ no_params:
 			}
 			Jim_SetResult(goi->interp, Jim_NewIntObj(goi->interp, target->gdb_max_connections));
 			break;
+
+		case TCFG_BUFFER_CHUNK_SIZE:
+			if (goi->isconfigure) {
+				e = Jim_GetOpt_Wide(goi, &w);
+				if (e != JIM_OK)
+					return e;
+				target->buffer_chunk_size = w;
+			} else {
+				if (goi->argc != 0)
+					goto no_params;
+			}
+			Jim_SetResult(goi->interp, Jim_NewIntObj(goi->interp, target->buffer_chunk_size));
+			break;
 		}
 	} /* while (goi->argc) */
 
@@ -5240,6 +6755,20 @@ static int jim_target_array2mem(Jim_Interp *interp,
 	return target_array2mem(interp, target, argc - 1, argv + 1);
 }
 
+static int jim_target_mem2bin(Jim_Interp *interp,
+		int argc, Jim_Obj *const *argv)
+{
+	struct target *target = Jim_CmdPrivData(interp);
+	return target_mem2bin(interp, target, argc - 1, argv + 1);
+}
+
+static int jim_target_bin2mem(Jim_Interp *interp,
+		int argc, Jim_Obj *const *argv)
+{
+	struct target *target = Jim_CmdPrivData(interp);
+	return target_bin2mem(interp, target, argc - 1, argv + 1);
+}
+
 static int jim_target_tap_disabled(Jim_Interp *interp)
 {
 	Jim_SetResultFormatted(interp, "[TAP is disabled]");
@@ -5274,7 +6803,10 @@ static int jim_target_examine(Jim_Interp *interp, int argc, Jim_Obj *const *argv
 
 	if (allow_defer && target->defer_examine) {
 		LOG_INFO("Deferring arp_examine of %s", target_name(target));
-		LOG_INFO("Use arp_examine command to examine it manually!");
+		if (target->examine_on_demand)
+			LOG_INFO("It will be examined when it is first used.");
+		else
+			LOG_INFO("Use arp_examine command to examine it manually!");
 		return JIM_OK;
 	}
 
@@ -5559,6 +7091,14 @@ static const struct command_registration target_instance_command_handlers[] = {
 		.help = "Display target memory as 8-bit bytes",
 		.usage = "address [count]",
 	},
+	{
+		.name = "batch",
+		.handler = handle_target_batch_command,
+		.mode = COMMAND_EXEC,
+		.help = "Run a script, queueing the memory display and modify "
+			"commands in it to do them all at once at the end",
+		.usage = "script",
+	},
 	{
 		.name = "array2mem",
 		.mode = COMMAND_EXEC,
@@ -5575,6 +7115,20 @@ static const struct command_registration target_instance_command_handlers[] = {
 			"from target memory",
 		.usage = "arrayname bitwidth address count",
 	},
+	{
+		.name = "bin2mem",
+		.mode = COMMAND_EXEC,
+		.jim_handler = jim_target_bin2mem,
+		.help = "Writes a binary Tcl string to target memory",
+		.usage = "address data",
+	},
+	{
+		.name = "mem2bin",
+		.mode = COMMAND_EXEC,
+		.jim_handler = jim_target_mem2bin,
+		.help = "Returns target memory as a binary Tcl string",
+		.usage = "address count",
+	},
 	{
 		.name = "eventlist",
 		.handler = handle_target_event_list,
@@ -6008,6 +7562,59 @@ static int jim_target_create(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
 	return target_create(&goi);
 }
 
+void target_release_session(struct command_context *cmd_ctx)
+{
+	for (struct target *target = all_targets; target; target = target->next) {
+		if (target->session == cmd_ctx)
+			target->session = NULL;
+	}
+}
+
+COMMAND_HANDLER(handle_target_claim_command)
+{
+	if (CMD_ARGC == 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	/* all or nothing, so two sessions can't each end up with half */
+	for (unsigned int i = 0; i < CMD_ARGC; i++) {
+		struct target *target = get_target(CMD_ARGV[i]);
+		if (!target) {
+			command_print(CMD, "Target %s is unknown", CMD_ARGV[i]);
+			return ERROR_FAIL;
+		}
+		if (target->session && target->session != CMD_CTX) {
+			command_print(CMD, "Target %s is claimed by another session",
+					target_name(target));
+			return ERROR_FAIL;
+		}
+	}
+
+	for (unsigned int i = 0; i < CMD_ARGC; i++)
+		get_target(CMD_ARGV[i])->session = CMD_CTX;
+
+	return find_target(CMD, CMD_ARGV[0]);
+}
+
+COMMAND_HANDLER(handle_target_release_command)
+{
+	if (CMD_ARGC == 0) {
+		target_release_session(CMD_CTX);
+		return ERROR_OK;
+	}
+
+	for (unsigned int i = 0; i < CMD_ARGC; i++) {
+		struct target *target = get_target(CMD_ARGV[i]);
+		if (!target) {
+			command_print(CMD, "Target %s is unknown", CMD_ARGV[i]);
+			return ERROR_FAIL;
+		}
+		if (target->session == CMD_CTX)
+			target->session = NULL;
+	}
+
+	return ERROR_OK;
+}
+
 static const struct command_registration target_subcommand_handlers[] = {
 	{
 		.name = "init",
@@ -6049,6 +7656,21 @@ static const struct command_registration target_subcommand_handlers[] = {
 		.usage = "targetname1 targetname2 ...",
 		.help = "gather several target in a smp list"
 	},
+	{
+		.name = "claim",
+		.mode = COMMAND_EXEC,
+		.handler = handle_target_claim_command,
+		.usage = "targetname1 targetname2 ...",
+		.help = "Reserve targets for this connection and select the first"
+	},
+	{
+		.name = "release",
+		.mode = COMMAND_EXEC,
+		.handler = handle_target_release_command,
+		.usage = "[targetname1 targetname2 ...]",
+		.help = "Give back targets claimed by this connection, "
+			"all of them without arguments"
+	},
 
 	COMMAND_REGISTRATION_DONE
 };
@@ -6630,6 +8252,13 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.help = "list or set hardware or software breakpoint",
 		.usage = "[<address> [<asid>] <length> ['hw'|'hw_ctx']]",
 	},
+	{
+		.name = "bp_set",
+		.mode = COMMAND_EXEC,
+		.help = "manage large sets of software breakpoints",
+		.usage = "",
+		.chain = bp_set_command_handlers,
+	},
 	{
 		.name = "rbp",
 		.handler = handle_rbp_command,
@@ -6655,7 +8284,7 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.name = "load_image",
 		.handler = handle_load_image_command,
 		.mode = COMMAND_EXEC,
-		.usage = "filename address ['bin'|'ihex'|'elf'|'s19'] "
+		.usage = "['-delta'|'-compress'] filename address ['bin'|'ihex'|'elf'|'s19'] "
 			"[min_address] [max_length]",
 	},
 	{
@@ -6698,6 +8327,28 @@ static const struct command_registration target_exec_command_handlers[] = {
 			"and write the 8/16/32 bit values",
 		.usage = "arrayname bitwidth address count",
 	},
+	{
+		.name = "mem2bin",
+		.mode = COMMAND_EXEC,
+		.jim_handler = jim_mem2bin,
+		.help = "read memory and return it as one binary TCL string",
+		.usage = "address count",
+	},
+	{
+		.name = "bin2mem",
+		.mode = COMMAND_EXEC,
+		.jim_handler = jim_bin2mem,
+		.help = "write a binary TCL string to memory",
+		.usage = "address data",
+	},
+	{
+		.name = "bin_compare",
+		.mode = COMMAND_ANY,
+		.jim_handler = jim_bin_compare,
+		.help = "return the offset of the first byte where two binary "
+			"strings differ, or -1",
+		.usage = "data1 data2",
+	},
 	{
 		.name = "reset_nag",
 		.handler = handle_target_reset_nag,
@@ -6720,6 +8371,12 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.help = "Test the target's memory access functions",
 		.usage = "size",
 	},
+	{
+		.chain = benchmark_command_handlers,
+	},
+	{
+		.chain = watch_command_handlers,
+	},
 
 	COMMAND_REGISTRATION_DONE
 };
@@ -101,7 +101,8 @@ struct working_area {
 	target_addr_t address;
 	uint32_t size;
 	bool free;
-	uint8_t *backup;
+	char *pin;		/* name of the pinned pool, see target_alloc_pinned_working_area() */
+	bool idle;		/* pinned, but not in use at the moment */
 	struct working_area **user;
 	struct working_area *next;
 };
@@ -113,6 +114,11 @@ struct gdb_service {
 	/*  element 1 coreid to be displayed at next resume 1 till n 0 means resume
 	 *  all cores core displayed  */
 	int32_t core[2];
+	/* target description last sent to GDB, kept while the register
+	 * list it was generated from, as hashed in tdesc_hash, stays the same */
+	char *tdesc;
+	uint32_t tdesc_length;
+	uint32_t tdesc_hash;
 };
 
 /* target back off timer */
@@ -137,6 +143,8 @@ struct target {
 
 	/** Should we defer examine to later */
 	bool defer_examine;
+	/** ...and do it the first time the target is used */
+	bool examine_on_demand;
 
 	/**
 	 * Indicates whether this target has been examined.
@@ -155,7 +163,13 @@ struct target {
 	 */
 	bool running_alg;
 
+	/* memory commands queued by "$target batch", NULL outside of one */
+	struct target_batch *batch;
+
 	struct target_event_action *event_action;
+	/* bit (1 << event) set for every event with an action above, so the
+	 * frequent events without one are dispatched without a list walk */
+	uint64_t event_action_mask;
 
 	int reset_halt;						/* attempt resetting the CPU into the halted mode? */
 	target_addr_t working_area;				/* working area (initialised RAM). Evaluated
@@ -166,6 +180,13 @@ struct target {
 	target_addr_t working_area_phys;			/* physical address */
 	uint32_t working_area_size;			/* size in bytes */
 	uint32_t backup_working_area;		/* whether the content of the working area has to be preserved */
+	uint8_t *working_area_backup;		/* original content of the working area */
+	uint32_t *working_area_saved;		/* bitmap of the words held in working_area_backup */
+	uint32_t working_area_saved_count;	/* number of bits set in working_area_saved */
+	bool working_area_restoring;		/* working_area_backup is being written back */
+	uint32_t buffer_chunk_size;			/* largest transfer target_{read,write}_buffer() pass on
+										 * at once, 0 for no limit. Target types may preset it
+										 * in target_create, -buffer-chunk-size overrides it. */
 	struct working_area *working_areas;/* list of allocated working areas */
 	enum target_debug_reason debug_reason;/* reason why the target entered debug state */
 	enum target_endianness endianness;	/* target endianness */
@@ -174,6 +195,7 @@ struct target {
 	struct reg_cache *reg_cache;		/* the first register cache of the target (core regs) */
 	struct breakpoint *breakpoints;		/* list of breakpoints */
 	struct watchpoint *watchpoints;		/* list of watchpoints */
+	struct breakpoint_index *breakpoint_index;	/* both lists by address, see breakpoints.c */
 	struct trace *trace_info;			/* generic trace information */
 	struct debug_msg_receiver *dbgmsg;	/* list of debug message receivers */
 	uint32_t dbg_msg_enabled;			/* debug message status */
@@ -185,6 +207,8 @@ struct target {
 										 * lots of halted/resumed info when stepping in debugger. */
 	bool halt_issued;					/* did we transition to halted state? */
 	int64_t halt_issued_time;			/* Note time when halt was issued */
+	unsigned int poll_round;			/* poll timer round that polled this target's
+										 * SMP group, see target_type.poll_smp */
 
 										/* ARM v7/v8 targets with ADIv5 interface */
 	bool dbgbase_set;					/* By default the debug base is not set */
@@ -213,6 +237,8 @@ struct target {
 
 	char *gdb_port_override;			/* target-specific override for gdb_port */
 
+	struct command_context *session;	/* connection that claimed the target, if any */
+
 	int gdb_max_connections;			/* max number of simultaneous gdb connections */
 
 	/* The semihosting information, extracted from the target. */
@@ -334,7 +360,9 @@ struct target_timer_callback {
 	enum target_timer_type type;
 	bool removed;
 	int64_t when;	/* output of timeval_ms() */
+	uint64_t seq;	/* registration order, to break ties on when */
 	void *priv;
+	/* links the callbacks that are being run */
 	struct target_timer_callback *next;
 };
 
@@ -402,6 +430,8 @@ int target_register_timer_callback(int (*callback)(void *priv),
 		unsigned int time_ms, enum target_timer_type type, void *priv);
 int target_unregister_timer_callback(int (*callback)(void *priv), void *priv);
 int target_call_timer_callbacks(int64_t *next_event);
+/** Release the targets claimed by a connection's command context. */
+void target_release_session(struct command_context *cmd_ctx);
 /**
  * Invoke this to ensure that e.g. polling timer callbacks happen before
  * a synchronous command completes.
@@ -429,6 +459,12 @@ const char *target_type_name(struct target *target);
  */
 int target_examine_one(struct target *target);
 
+/**
+ * Examine @a target now if it was configured with -examine-on-demand and
+ * hasn't been examined yet, so that it can be used.
+ */
+int target_examine_on_demand(struct target *target);
+
 /** @returns @c true if target_set_examined() has been called. */
 static inline bool target_was_examined(struct target *target)
 {
@@ -579,6 +615,29 @@ int target_run_flash_async_algorithm(struct target *target,
 		uint32_t entry_point, uint32_t exit_point,
 		void *arch_info);
 
+/** One of the fifos target_run_flash_async_algorithm_multi() feeds. */
+struct target_async_fifo {
+	const uint8_t *buffer;
+	/** blocks left to send */
+	uint32_t count;
+	/** working area holding the write and read pointers, then the data */
+	uint32_t start;
+	uint32_t size;
+};
+
+/**
+ * Like target_run_flash_async_algorithm(), but feeds @a num_fifos fifos
+ * at once, for algorithms that program several flash controllers at the
+ * same time. The algorithm aborts by setting any read pointer to 0 and is
+ * aborted by setting all write pointers to 0.
+ */
+int target_run_flash_async_algorithm_multi(struct target *target,
+		struct target_async_fifo *fifos, unsigned int num_fifos, int block_size,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t entry_point, uint32_t exit_point,
+		void *arch_info);
+
 /**
  * This routine is a wrapper for asynchronous algorithms.
  *
@@ -601,6 +660,22 @@ int target_read_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer);
 int target_read_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer);
+
+struct target_memory_read {
+	target_addr_t address;
+	uint32_t size;
+	uint32_t count;
+	uint8_t *buffer;
+};
+
+/**
+ * Do all @a reads, each like target_read_memory(). Targets that can queue
+ * them (riscv over the system bus, Cortex-M through the MEM-AP) talk to the
+ * adapter once for all of them instead of once per read, which is what
+ * callers polling a handful of scattered variables want.
+ */
+int target_read_memory_batch(struct target *target,
+		struct target_memory_read *reads, unsigned int num_reads);
 /**
  * Write @a count items of @a size bytes to the memory of @a target at
  * the @a address given. @a address must be aligned to @a size
@@ -623,6 +698,21 @@ int target_write_memory(struct target *target,
 int target_write_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, const uint8_t *buffer);
 
+struct target_memory_write {
+	target_addr_t address;
+	uint32_t size;
+	uint32_t count;
+	const uint8_t *buffer;
+};
+
+/**
+ * Do all @a writes in order, each like target_write_memory(), talking to
+ * the adapter once for all of them where the target can queue them. On
+ * failure there's no telling how many of them were done.
+ */
+int target_write_memory_batch(struct target *target,
+		struct target_memory_write *writes, unsigned int num_writes);
+
 /*
  * Write to target memory using the virtual address.
  *
@@ -653,9 +743,40 @@ int target_read_buffer(struct target *target,
 		target_addr_t address, uint32_t size, uint8_t *buffer);
 int target_checksum_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t *crc);
+/**
+ * Check whether target memory at address already holds buffer, by comparing
+ * a checksum computed on the target (if the target supports it) with one of
+ * buffer. Any failure reports a mismatch.
+ */
+bool target_memory_matches(struct target *target,
+		target_addr_t address, uint32_t size, const uint8_t *buffer);
+/**
+ * Write buffer to address one chunk at a time, skipping chunks
+ * target_memory_matches() says are already there. *written (if not NULL)
+ * is increased by the number of bytes actually written.
+ */
+int target_write_buffer_delta(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *buffer, uint32_t *written);
+/**
+ * Write buffer to address as LZ4 compressed chunks, expanded by an algorithm
+ * on the target. Falls back to target_write_buffer() where the target has no
+ * decompressor or there isn't enough working area.
+ */
+int target_write_buffer_compressed(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *buffer);
 int target_blank_check_memory(struct target *target,
 		struct target_memory_check_block *blocks, int num_blocks,
 		uint8_t erased_value);
+/**
+ * Find the first occurrence of pattern in the size bytes at address with an
+ * algorithm on the halted target, rather than reading the range back. The
+ * part of the range under the working area is read and searched here.
+ * Returns ERROR_TARGET_RESOURCE_NOT_AVAILABLE or ERROR_TARGET_NOT_HALTED when
+ * the caller has to search the memory itself.
+ */
+int target_search_memory(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *pattern, uint32_t pattern_size,
+		target_addr_t *found_address, bool *found);
 int target_wait_state(struct target *target, enum target_state state, int ms);
 
 /**
@@ -691,6 +812,14 @@ unsigned target_address_bits(struct target *target);
  */
 unsigned target_data_bits(struct target *target);
 
+/**
+ * Let the cores in the SMP group of target halt and resume independently
+ * of each other, or go back to all of them together.
+ */
+int target_set_non_stop(struct target *target, bool enable);
+/** @returns True if target_set_non_stop() is supported. */
+bool target_supports_non_stop(struct target *target);
+
 /** Return the *name* of this targets current state */
 const char *target_state_name(struct target *target);
 
@@ -721,8 +850,22 @@ int target_alloc_working_area(struct target *target,
  */
 int target_alloc_working_area_try(struct target *target,
 		uint32_t size, struct working_area **area);
+/* Allocate from the pinned pool @a name, for helper code that is used over
+ * and over again. Freeing the area keeps it and its content reserved for
+ * the next caller asking for the same name, until memory runs short, the
+ * target resumes or is reset, or the debugger writes to it. @a fresh tells
+ * whether the content has to be (re)written.
+ */
+int target_alloc_pinned_working_area(struct target *target, const char *name,
+		uint32_t size, struct working_area **area, bool *fresh);
+/* Turn an allocated pinned area into an ordinary one, e.g. because writing
+ * its content failed, so freeing it doesn't keep it. */
+void target_unpin_working_area(struct working_area *area);
 int target_free_working_area(struct target *target, struct working_area *area);
 void target_free_all_working_areas(struct target *target);
+/* Give up pinned areas and write back the backup of free working area
+ * memory, before the target runs its own code again. */
+int target_flush_working_areas(struct target *target);
 uint32_t target_get_working_area_avail(struct target *target);
 
 /**
@@ -44,6 +44,10 @@ struct target_type {
 
 	/* poll current target status */
 	int (*poll)(struct target *target);
+	/* Optional. Poll every target of target's SMP group and update each
+	 * one's state. If set, the poll timer uses it once per group instead
+	 * of calling poll() for each member. */
+	int (*poll_smp)(struct target *target);
 	/* Invoked only from target_arch_state().
 	 * Issue USER() w/architecture specific status.  */
 	int (*arch_state)(struct target *target);
@@ -135,6 +139,22 @@ struct target_type {
 	 */
 	int (*write_memory)(struct target *target, target_addr_t address,
 			uint32_t size, uint32_t count, const uint8_t *buffer);
+	/**
+	 * Read several independent blocks of memory, queueing as much of
+	 * it as possible before talking to the adapter. Optional, do @b not
+	 * call this function directly, use target_read_memory_batch() instead.
+	 * Return ERROR_NOT_IMPLEMENTED for a batch that should be read
+	 * one block at a time.
+	 */
+	int (*read_memory_batch)(struct target *target,
+			struct target_memory_read *reads, unsigned int num_reads);
+	/**
+	 * Like read_memory_batch, for writes, which must be done in order.
+	 * Optional, do @b not call this function directly, use
+	 * target_write_memory_batch() instead.
+	 */
+	int (*write_memory_batch)(struct target *target,
+			struct target_memory_write *writes, unsigned int num_writes);
 
 	/* Default implementation will do some fancy alignment to improve performance, target can override */
 	int (*read_buffer)(struct target *target, target_addr_t address,
@@ -149,6 +169,22 @@ struct target_type {
 	int (*blank_check_memory)(struct target *target,
 			struct target_memory_check_block *blocks, int num_blocks,
 			uint8_t erased_value);
+	/**
+	 * Expand the LZ4 block of @a src_size bytes at @a src (usually in
+	 * working area) into the @a dst_size bytes at @a dst.
+	 * Returns ERROR_TARGET_RESOURCE_NOT_AVAILABLE if no algorithm can run.
+	 */
+	int (*decompress_memory)(struct target *target, target_addr_t src,
+			uint32_t src_size, target_addr_t dst, uint32_t dst_size);
+	/**
+	 * Find the first occurrence of @a pattern in the @a size bytes at
+	 * @a address with an algorithm on the target. The range never overlaps
+	 * the working area, see target_search_memory().
+	 * Returns ERROR_TARGET_RESOURCE_NOT_AVAILABLE if no algorithm can run.
+	 */
+	int (*search_memory)(struct target *target, target_addr_t address,
+			uint32_t size, const uint8_t *pattern, uint32_t pattern_size,
+			target_addr_t *found_address, bool *found);
 
 	/*
 	 * target break-/watchpoint control
@@ -301,6 +337,10 @@ struct target_type {
 	 * will typically be 32 for 32-bit targets, and 64 for 64-bit targets. If
 	 * not implemented, it's assumed to be 32. */
 	unsigned (*data_bits)(struct target *target);
+
+	/* Optional. In non-stop mode the cores of an SMP group are halted,
+	 * resumed and report halts one by one, instead of all together. */
+	int (*set_non_stop)(struct target *target, bool enable);
 };
 
 #endif /* OPENOCD_TARGET_TARGET_TYPE_H */
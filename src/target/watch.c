@@ -0,0 +1,442 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * Live variable watch: sample a set of addresses of a running target at a
+ * fixed rate and stream the values, with timestamps, to a file or to TCP
+ * clients. Each sample is one target_read_memory_batch() call, so targets
+ * that queue scattered reads (riscv over the system bus, Cortex-M through
+ * the MEM-AP) take one adapter round trip per sample.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/perf.h>
+#include <server/server.h>
+
+#include "target.h"
+#include "watch.h"
+
+#define WATCH_MAX_VARS		128
+#define WATCH_MAX_RATE		1000
+/* Output a TCP client may fall behind by before samples are dropped for it */
+#define WATCH_BACKLOG_MAX	(256 * 1024)
+
+struct watch_var {
+	target_addr_t address;
+	uint32_t width;
+};
+
+static struct {
+	struct watch_var vars[WATCH_MAX_VARS];
+	unsigned int num_vars;
+
+	bool running;
+	struct target *target;
+	unsigned int rate;
+	/* deadlines, in perf_now() microseconds */
+	int64_t period;
+	int64_t start;
+	int64_t next;
+
+	FILE *file;
+	struct service *service;
+
+	struct target_memory_read *reads;
+	uint8_t *data;
+	char *line;
+	size_t line_size;
+
+	uint64_t samples;
+	uint64_t missed;
+	uint64_t failed;
+	uint64_t dropped;
+	int64_t last;
+} watch;
+
+/* Header line naming the columns of the sample lines */
+static int watch_format_header(char *buf, size_t size)
+{
+	int n = snprintf(buf, size, "# watch %u Hz: time_us", watch.rate);
+	for (unsigned int i = 0; i < watch.num_vars && n < (int)size; i++)
+		n += snprintf(buf + n, size - n, " " TARGET_ADDR_FMT "/%" PRIu32,
+				watch.vars[i].address, watch.vars[i].width);
+	if (n < (int)size)
+		n += snprintf(buf + n, size - n, "\n");
+	return MIN(n, (int)size - 1);
+}
+
+static void watch_output(const char *buf, size_t size)
+{
+	if (watch.file) {
+		if (fwrite(buf, 1, size, watch.file) != size)
+			watch.dropped++;
+		return;
+	}
+
+	/* broadcast to all clients, one that doesn't keep up loses samples
+	 * instead of stalling the others */
+	for (struct connection *c = watch.service ? watch.service->connections : NULL;
+			c; c = c->next) {
+		if (connection_output_pending(c) + size > WATCH_BACKLOG_MAX)
+			watch.dropped++;
+		else
+			connection_send(c, buf, size);
+	}
+}
+
+static int watch_sample(int64_t now)
+{
+	struct target *target = watch.target;
+
+	if (!target_was_examined(target) ||
+			(target->state != TARGET_RUNNING && target->state != TARGET_HALTED))
+		return ERROR_FAIL;
+
+	int retval = target_read_memory_batch(target, watch.reads, watch.num_vars);
+	if (retval != ERROR_OK)
+		return retval;
+
+	int n = snprintf(watch.line, watch.line_size, "%" PRId64, now - watch.start);
+	for (unsigned int i = 0; i < watch.num_vars; i++) {
+		const uint8_t *value = watch.reads[i].buffer;
+		uint64_t v;
+		switch (watch.vars[i].width) {
+		case 8:
+			v = target_buffer_get_u64(target, value);
+			break;
+		case 4:
+			v = target_buffer_get_u32(target, value);
+			break;
+		case 2:
+			v = target_buffer_get_u16(target, value);
+			break;
+		default:
+			v = *value;
+			break;
+		}
+		n += snprintf(watch.line + n, watch.line_size - n, " 0x%" PRIx64, v);
+	}
+	n += snprintf(watch.line + n, watch.line_size - n, "\n");
+
+	watch_output(watch.line, n);
+	return ERROR_OK;
+}
+
+static int watch_timer_callback(void *priv)
+{
+	int64_t now = perf_now();
+
+	/* timers fire on milliseconds, deadlines are kept in microseconds */
+	if (now < watch.next)
+		return ERROR_OK;
+
+	/* every period that passed without a sample is a missed deadline */
+	int64_t late = (now - watch.next) / watch.period;
+	watch.missed += late;
+	watch.next += (late + 1) * watch.period;
+
+	if (watch_sample(now) == ERROR_OK) {
+		watch.samples++;
+		watch.last = now;
+	} else {
+		watch.failed++;
+	}
+
+	if (watch.file && watch.samples % watch.rate == 0)
+		fflush(watch.file);
+
+	return ERROR_OK;
+}
+
+static int watch_new_connection(struct connection *connection)
+{
+	char header[64 + WATCH_MAX_VARS * 32];
+	int n = watch_format_header(header, sizeof(header));
+
+	connection_send(connection, header, n);
+	return ERROR_OK;
+}
+
+static int watch_input(struct connection *connection)
+{
+	/* nothing is expected from clients, only notice them leaving */
+	unsigned char buf[64];
+	int bytes_read = connection_read(connection, buf, sizeof(buf));
+
+	if (bytes_read == 0)
+		return ERROR_SERVER_REMOTE_CLOSED;
+	else if (bytes_read == -1) {
+		LOG_ERROR("error during read: %s", strerror(errno));
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	return ERROR_OK;
+}
+
+static int watch_connection_closed(struct connection *connection)
+{
+	return ERROR_OK;
+}
+
+static void watch_stop(void)
+{
+	if (!watch.running)
+		return;
+
+	target_unregister_timer_callback(watch_timer_callback, NULL);
+
+	if (watch.file)
+		fclose(watch.file);
+	watch.file = NULL;
+	if (watch.service)
+		remove_service(watch.service->name, watch.service->port);
+	watch.service = NULL;
+
+	free(watch.reads);
+	watch.reads = NULL;
+	free(watch.data);
+	watch.data = NULL;
+	free(watch.line);
+	watch.line = NULL;
+
+	watch.running = false;
+}
+
+static void watch_print_status(struct command_invocation *cmd)
+{
+	for (unsigned int i = 0; i < watch.num_vars; i++)
+		command_print(cmd, TARGET_ADDR_FMT " width %" PRIu32,
+				watch.vars[i].address, watch.vars[i].width);
+
+	if (!watch.running) {
+		command_print(cmd, "%u addresses, not running", watch.num_vars);
+		return;
+	}
+
+	double elapsed = (watch.last - watch.start) / 1000000.0;
+	command_print(cmd, "%u addresses on %s at %u Hz: %" PRIu64 " samples, "
+			"%.1f Hz achieved, %" PRIu64 " missed deadlines, %" PRIu64 " failed reads, "
+			"%" PRIu64 " dropped outputs",
+			watch.num_vars, target_name(watch.target), watch.rate, watch.samples,
+			watch.samples > 1 && elapsed > 0 ? (watch.samples - 1) / elapsed : 0.0,
+			watch.missed, watch.failed, watch.dropped);
+}
+
+COMMAND_HANDLER(handle_watch_add_command)
+{
+	struct watch_var var = { .width = 4 };
+
+	if (CMD_ARGC < 1 || CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], var.address);
+	if (CMD_ARGC == 2)
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], var.width);
+
+	if (var.width != 1 && var.width != 2 && var.width != 4 && var.width != 8) {
+		command_print(CMD, "width must be 1, 2, 4 or 8");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	if (var.address % var.width) {
+		command_print(CMD, "address must be aligned to its width");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	if (watch.running) {
+		command_print(CMD, "stop the watch first");
+		return ERROR_FAIL;
+	}
+	if (watch.num_vars == WATCH_MAX_VARS) {
+		command_print(CMD, "at most %d addresses can be watched", WATCH_MAX_VARS);
+		return ERROR_FAIL;
+	}
+
+	watch.vars[watch.num_vars++] = var;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_watch_clear_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	watch_stop();
+	watch.num_vars = 0;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_watch_start_command)
+{
+	unsigned int rate;
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], rate);
+	if (rate == 0 || rate > WATCH_MAX_RATE) {
+		command_print(CMD, "rate must be 1 to %d Hz", WATCH_MAX_RATE);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	if (watch.num_vars == 0) {
+		command_print(CMD, "no addresses to watch, see 'watch add'");
+		return ERROR_FAIL;
+	}
+
+	watch_stop();
+
+	watch.target = get_current_target(CMD_CTX);
+	watch.rate = rate;
+	watch.period = 1000000 / rate;
+
+	uint32_t data_size = 0;
+	for (unsigned int i = 0; i < watch.num_vars; i++)
+		data_size += watch.vars[i].width;
+	watch.reads = calloc(watch.num_vars, sizeof(*watch.reads));
+	watch.data = malloc(data_size);
+	/* timestamp, then a 64 bit value in hex for each */
+	watch.line_size = 24 + watch.num_vars * 20;
+	watch.line = malloc(watch.line_size);
+	if (!watch.reads || !watch.data || !watch.line) {
+		free(watch.reads);
+		free(watch.data);
+		free(watch.line);
+		watch.reads = NULL;
+		watch.data = NULL;
+		watch.line = NULL;
+		return ERROR_FAIL;
+	}
+
+	uint8_t *buffer = watch.data;
+	for (unsigned int i = 0; i < watch.num_vars; i++) {
+		watch.reads[i].address = watch.vars[i].address;
+		watch.reads[i].size = watch.vars[i].width;
+		watch.reads[i].count = 1;
+		watch.reads[i].buffer = buffer;
+		buffer += watch.vars[i].width;
+	}
+
+	/* same destinations as "tpiu config internal": a file or :port */
+	int retval;
+	if (CMD_ARGV[1][0] == ':') {
+		retval = add_service("watch", &CMD_ARGV[1][1], CONNECTION_LIMIT_UNLIMITED,
+				watch_new_connection, watch_input, watch_connection_closed,
+				NULL, &watch.service);
+		if (retval != ERROR_OK)
+			command_print(CMD, "can't open watch TCP port");
+	} else {
+		retval = ERROR_OK;
+		watch.file = fopen(CMD_ARGV[1], "ab");
+		if (!watch.file) {
+			command_print(CMD, "can't open %s", CMD_ARGV[1]);
+			retval = ERROR_FAIL;
+		} else {
+			char header[64 + WATCH_MAX_VARS * 32];
+			watch_output(header, watch_format_header(header, sizeof(header)));
+		}
+	}
+
+	watch.running = true;
+	if (retval == ERROR_OK)
+		retval = target_register_timer_callback(watch_timer_callback,
+				MAX(1000 / rate, 1u), TARGET_TIMER_TYPE_PERIODIC, NULL);
+	if (retval != ERROR_OK) {
+		watch_stop();
+		return retval;
+	}
+
+	watch.samples = 0;
+	watch.missed = 0;
+	watch.failed = 0;
+	watch.dropped = 0;
+	watch.start = perf_now();
+	watch.last = watch.start;
+	watch.next = watch.start;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_watch_stop_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (watch.running)
+		watch_print_status(CMD);
+	watch_stop();
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_watch_status_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	watch_print_status(CMD);
+	return ERROR_OK;
+}
+
+static const struct command_registration watch_subcommand_handlers[] = {
+	{
+		.name = "add",
+		.handler = handle_watch_add_command,
+		.mode = COMMAND_ANY,
+		.help = "add an address to the watched set",
+		.usage = "address [1|2|4|8]",
+	},
+	{
+		.name = "clear",
+		.handler = handle_watch_clear_command,
+		.mode = COMMAND_ANY,
+		.help = "stop watching and empty the watched set",
+		.usage = "",
+	},
+	{
+		.name = "start",
+		.handler = handle_watch_start_command,
+		.mode = COMMAND_EXEC,
+		.help = "sample the watched set of the current target rate times "
+			"a second, streaming to a file or to TCP clients on :port",
+		.usage = "rate (filename|:port)",
+	},
+	{
+		.name = "stop",
+		.handler = handle_watch_stop_command,
+		.mode = COMMAND_EXEC,
+		.help = "stop sampling and report the statistics",
+		.usage = "",
+	},
+	{
+		.name = "status",
+		.handler = handle_watch_status_command,
+		.mode = COMMAND_EXEC,
+		.help = "show the watched set, the achieved sample rate and "
+			"missed deadlines",
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+const struct command_registration watch_command_handlers[] = {
+	{
+		.name = "watch",
+		.mode = COMMAND_ANY,
+		.help = "stream variables of a running target",
+		.usage = "",
+		.chain = watch_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -197,6 +197,61 @@ static int xsvf_read_buffer(int num_bits, int fd, uint8_t *buf)
 	return ERROR_OK;
 }
 
+/*
+ * With the "batch" option, XSDR and XSDRTDO vectors are queued without
+ * waiting for their results, and compared when the batch is executed.
+ * Everything the retry logic needs is kept per vector, so when one of
+ * them mismatches, the player seeks back to it and replays it, and all
+ * that follows, the normal way with XREPEAT retries.
+ */
+#define XSVF_BATCH_VECTORS	256
+
+struct xsvf_vector {
+	long offset;			/* of the XSDR or XSDRTDO opcode */
+	int xsdrsize;
+	int xruntest;
+	int xrepeat;
+	tap_state_t xendir;
+	tap_state_t xenddr;
+	int loop_count;
+	tap_state_t loop_state;
+	int loop_clocks;
+	int loop_usecs;
+	uint8_t *captured;
+	uint8_t *expected;
+	uint8_t *mask;
+};
+
+static void xsvf_free_batch(struct xsvf_vector *batch, int *count)
+{
+	for (int i = 0; i < *count; i++) {
+		free(batch[i].captured);
+		free(batch[i].expected);
+		free(batch[i].mask);
+	}
+	*count = 0;
+}
+
+/* Execute the queue and return the first vector that didn't match in
+ * *failed, or -1 if they all did. */
+static int xsvf_run_batch(struct xsvf_vector *batch, int count, int *failed)
+{
+	int result = jtag_execute_queue();
+
+	*failed = -1;
+	if (result != ERROR_OK)
+		return result;
+
+	for (int i = 0; i < count; i++) {
+		if (buf_cmp_mask(batch[i].captured, batch[i].expected,
+				batch[i].mask, batch[i].xsdrsize)) {
+			*failed = i;
+			break;
+		}
+	}
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_xsvf_command)
 {
 	uint8_t *dr_out_buf = NULL;				/* from host to device (TDI) */
@@ -235,6 +290,10 @@ COMMAND_HANDLER(handle_xsvf_command)
 	 */
 	int runtest_requires_tck = 0;
 
+	struct xsvf_vector *batch = NULL;
+	int batch_count = 0;
+	long replay_offset = -1;
+
 	/* use NULL to indicate a "plain" xsvf file which accounts for
 	 * additional devices in the scan chain, otherwise the device
 	 * that should be affected
@@ -269,13 +328,82 @@ COMMAND_HANDLER(handle_xsvf_command)
 		++CMD_ARGV;
 	}
 
-	if ((CMD_ARGC > 2) && (strcmp(CMD_ARGV[2], "quiet") == 0))
+	if ((CMD_ARGC > 2) && (strcmp(CMD_ARGV[2], "quiet") == 0)) {
 		verbose = 0;
+		--CMD_ARGC;
+		++CMD_ARGV;
+	}
+
+	if ((CMD_ARGC > 2) && (strcmp(CMD_ARGV[2], "batch") == 0)) {
+		batch = calloc(XSVF_BATCH_VECTORS, sizeof(*batch));
+		if (!batch) {
+			LOG_ERROR("Out of memory");
+			close(xsvf_fd);
+			return ERROR_FAIL;
+		}
+	}
 
 	LOG_WARNING("XSVF support in OpenOCD is limited. Consider using SVF instead");
 	LOG_USER("xsvf processing file: \"%s\"", filename);
 
-	while (read(xsvf_fd, &opcode, 1) > 0) {
+	for (;;) {
+		bool eof = read(xsvf_fd, &opcode, 1) <= 0;
+
+		/* check the batched vectors before anything that needs their
+		 * results, which includes LSDR's own checks */
+		if (batch_count > 0 && (eof || batch_count == XSVF_BATCH_VECTORS
+				|| opcode == XCOMPLETE || opcode == LSDR)) {
+			int failed;
+
+			result = xsvf_run_batch(batch, batch_count, &failed);
+			if (result != ERROR_OK) {
+				file_offset = batch[0].offset;
+				xsvf_free_batch(batch, &batch_count);
+				tdo_mismatch = 1;
+				break;
+			}
+
+			if (failed >= 0) {
+				struct xsvf_vector *v = &batch[failed];
+				int num_bytes = DIV_ROUND_UP(v->xsdrsize, 8);
+
+				if (verbose)
+					LOG_USER("XSDR mismatch at offset %ld, replaying from there",
+							v->offset);
+
+				xsdrsize = v->xsdrsize;
+				xruntest = v->xruntest;
+				xrepeat = v->xrepeat;
+				xendir = v->xendir;
+				xenddr = v->xenddr;
+				loop_count = v->loop_count;
+				loop_state = v->loop_state;
+				loop_clocks = v->loop_clocks;
+				loop_usecs = v->loop_usecs;
+
+				free(dr_out_buf);
+				free(dr_in_buf);
+				free(dr_in_mask);
+				dr_out_buf = malloc(num_bytes);
+				dr_in_buf = v->expected;
+				dr_in_mask = v->mask;
+				v->expected = NULL;
+				v->mask = NULL;
+
+				replay_offset = v->offset;
+				xsvf_free_batch(batch, &batch_count);
+				if (lseek(xsvf_fd, replay_offset, SEEK_SET) < 0) {
+					do_abort = 1;
+					break;
+				}
+				continue;
+			}
+			xsvf_free_batch(batch, &batch_count);
+		}
+
+		if (eof)
+			break;
+
 		/* record the position of this opcode within the file */
 		file_offset = lseek(xsvf_fd, 0, SEEK_CUR) - 1;
 
@@ -345,7 +473,8 @@ COMMAND_HANDLER(handle_xsvf_command)
 					else
 						jtag_add_pathmove(pathlen, path);
 
-					result = jtag_execute_queue();
+					/* when batching, errors show up with the next batch */
+					result = batch ? ERROR_OK : jtag_execute_queue();
 					if (result != ERROR_OK) {
 						LOG_ERROR("XSVF: pathmove error %d", result);
 						do_abort = 1;
@@ -449,6 +578,48 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				LOG_DEBUG("%s %d", op_name, xsdrsize);
 
+				if (batch && file_offset != replay_offset) {
+					struct xsvf_vector *v = &batch[batch_count];
+					struct scan_field field;
+					int num_bytes = DIV_ROUND_UP(xsdrsize, 8);
+
+					v->offset = file_offset;
+					v->xsdrsize = xsdrsize;
+					v->xruntest = xruntest;
+					v->xrepeat = xrepeat;
+					v->xendir = xendir;
+					v->xenddr = xenddr;
+					v->loop_count = loop_count;
+					v->loop_state = loop_state;
+					v->loop_clocks = loop_clocks;
+					v->loop_usecs = loop_usecs;
+					v->captured = calloc(num_bytes, 1);
+					v->expected = malloc(num_bytes);
+					v->mask = malloc(num_bytes);
+					batch_count++;
+					if (!v->captured || !v->expected || !v->mask) {
+						LOG_ERROR("Out of memory");
+						do_abort = 1;
+						break;
+					}
+					memcpy(v->expected, dr_in_buf, num_bytes);
+					memcpy(v->mask, dr_in_mask, num_bytes);
+
+					field.num_bits = xsdrsize;
+					field.out_value = dr_out_buf;
+					field.in_value = v->captured;
+
+					if (tap == NULL)
+						jtag_add_plain_dr_scan(field.num_bits,
+								field.out_value,
+								field.in_value,
+								TAP_DRPAUSE);
+					else
+						jtag_add_dr_scan(tap, 1, &field, TAP_DRPAUSE);
+					matched = 1;
+					limit = 0;
+				}
+
 				for (attempt = 0; attempt < limit; ++attempt) {
 					struct scan_field field;
 
@@ -715,7 +886,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 					 */
 
 					/* LOG_DEBUG("FLUSHING QUEUE"); */
-					result = jtag_execute_queue();
+					result = batch ? ERROR_OK : jtag_execute_queue();
 					if (result != ERROR_OK)
 						tdo_mismatch = 1;
 				}
@@ -990,18 +1161,25 @@ COMMAND_HANDLER(handle_xsvf_command)
 				unsupported = 1;
 		}
 
-		if (do_abort || unsupported || tdo_mismatch) {
-			LOG_DEBUG("xsvf failed, setting taps to reasonable state");
-
-			/* upon error, return the TAPs to a reasonable state */
-			result = svf_add_statemove(TAP_IDLE);
-			if (result != ERROR_OK)
-				return result;
-			result = jtag_execute_queue();
-			if (result != ERROR_OK)
-				return result;
+		if (do_abort || unsupported || tdo_mismatch)
 			break;
-		}
+	}
+
+	if (batch) {
+		xsvf_free_batch(batch, &batch_count);
+		free(batch);
+	}
+
+	if (do_abort || unsupported || tdo_mismatch) {
+		LOG_DEBUG("xsvf failed, setting taps to reasonable state");
+
+		/* upon error, return the TAPs to a reasonable state */
+		result = svf_add_statemove(TAP_IDLE);
+		if (result != ERROR_OK)
+			return result;
+		result = jtag_execute_queue();
+		if (result != ERROR_OK)
+			return result;
 	}
 
 	if (tdo_mismatch) {
@@ -1044,8 +1222,9 @@ static const struct command_registration xsvf_command_handlers[] = {
 		.help = "Runs a XSVF file.  If 'virt2' is given, xruntest "
 			"counts are interpreted as TCK cycles rather than "
 			"as microseconds.  Without the 'quiet' option, all "
-			"comments, retries, and mismatches will be reported.",
-		.usage = "(tapname|'plain') filename ['virt2'] ['quiet']",
+			"comments, retries, and mismatches will be reported.  "
+			"With 'batch', data vectors are checked in batches.",
+		.usage = "(tapname|'plain') filename ['virt2'] ['quiet'] ['batch']",
 	},
 	COMMAND_REGISTRATION_DONE
 };